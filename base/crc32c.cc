@@ -0,0 +1,145 @@
+// Copyright © 2017 by Donald King <chronos@chronos-tachyon.net>
+// Available under the MIT License. See LICENSE for details.
+
+#include "base/crc32c.h"
+
+#if defined(__aarch64__)
+#include <sys/auxv.h>
+#ifndef HWCAP_CRC32
+#define HWCAP_CRC32 (1 << 7)
+#endif
+#endif
+
+namespace base {
+
+namespace {
+
+// Bit-reversed form of the Castagnoli polynomial, 0x1EDC6F41.
+static constexpr uint32_t kPoly = 0x82f63b78U;
+
+struct Tables {
+  uint32_t t[8][256];
+
+  Tables() noexcept {
+    for (uint32_t i = 0; i < 256; ++i) {
+      uint32_t crc = i;
+      for (unsigned int j = 0; j < 8; ++j) {
+        crc = (crc >> 1) ^ ((crc & 1) ? kPoly : 0);
+      }
+      t[0][i] = crc;
+    }
+    for (uint32_t i = 0; i < 256; ++i) {
+      for (unsigned int k = 1; k < 8; ++k) {
+        t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xffU];
+      }
+    }
+  }
+};
+
+static const Tables& tables() {
+  static const Tables* const t = new Tables;
+  return *t;
+}
+
+static uint64_t load_u64(const unsigned char* p) noexcept {
+  uint64_t x;
+  ::memcpy(&x, p, sizeof(x));
+  return x;
+}
+
+static uint32_t crc32c_portable(const unsigned char* p, std::size_t len,
+                                uint32_t crc) noexcept {
+  const auto& t = tables().t;
+  while (len > 0 && (reinterpret_cast<uintptr_t>(p) & 7) != 0) {
+    crc = (crc >> 8) ^ t[0][(crc ^ *p) & 0xffU];
+    ++p, --len;
+  }
+  // Slicing-by-8 assumes that the 8-byte loads are little-endian.
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  while (len >= 8) {
+    uint64_t x = load_u64(p) ^ crc;
+    crc = t[7][x & 0xffU] ^ t[6][(x >> 8) & 0xffU] ^
+          t[5][(x >> 16) & 0xffU] ^ t[4][(x >> 24) & 0xffU] ^
+          t[3][(x >> 32) & 0xffU] ^ t[2][(x >> 40) & 0xffU] ^
+          t[1][(x >> 48) & 0xffU] ^ t[0][x >> 56];
+    p += 8, len -= 8;
+  }
+#endif
+  while (len > 0) {
+    crc = (crc >> 8) ^ t[0][(crc ^ *p) & 0xffU];
+    ++p, --len;
+  }
+  return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2"))) static uint32_t crc32c_hw(
+    const unsigned char* p, std::size_t len, uint32_t crc) noexcept {
+  while (len > 0 && (reinterpret_cast<uintptr_t>(p) & 7) != 0) {
+    crc = __builtin_ia32_crc32qi(crc, *p);
+    ++p, --len;
+  }
+  uint64_t crc64 = crc;
+  while (len >= 8) {
+    crc64 = __builtin_ia32_crc32di(crc64, load_u64(p));
+    p += 8, len -= 8;
+  }
+  crc = uint32_t(crc64);
+  while (len > 0) {
+    crc = __builtin_ia32_crc32qi(crc, *p);
+    ++p, --len;
+  }
+  return crc;
+}
+
+static bool detect_hw() noexcept { return __builtin_cpu_supports("sse4.2"); }
+#elif defined(__aarch64__)
+__attribute__((target("+crc"))) static uint32_t crc32c_hw(
+    const unsigned char* p, std::size_t len, uint32_t crc) noexcept {
+  while (len > 0 && (reinterpret_cast<uintptr_t>(p) & 7) != 0) {
+    crc = __builtin_aarch64_crc32cb(crc, *p);
+    ++p, --len;
+  }
+  while (len >= 8) {
+    crc = __builtin_aarch64_crc32cx(crc, load_u64(p));
+    p += 8, len -= 8;
+  }
+  while (len > 0) {
+    crc = __builtin_aarch64_crc32cb(crc, *p);
+    ++p, --len;
+  }
+  return crc;
+}
+
+static bool detect_hw() noexcept {
+  return (::getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+}
+#else
+static uint32_t crc32c_hw(const unsigned char* p, std::size_t len,
+                          uint32_t crc) noexcept {
+  return crc32c_portable(p, len, crc);
+}
+
+static bool detect_hw() noexcept { return false; }
+#endif
+
+static bool use_hw() noexcept {
+  static const bool value = detect_hw();
+  return value;
+}
+
+}  // anonymous namespace
+
+uint32_t crc32c(const void* ptr, std::size_t len, uint32_t crc) noexcept {
+  const auto* p = reinterpret_cast<const unsigned char*>(ptr);
+  crc = ~crc;
+  if (use_hw())
+    crc = crc32c_hw(p, len, crc);
+  else
+    crc = crc32c_portable(p, len, crc);
+  return ~crc;
+}
+
+bool crc32c_is_accelerated() noexcept { return use_hw(); }
+
+}  // namespace base
@@ -0,0 +1,25 @@
+// base/crc32c.h - CRC-32C (Castagnoli) checksums
+// Copyright © 2017 by Donald King <chronos@chronos-tachyon.net>
+// Available under the MIT License. See LICENSE for details.
+
+#ifndef BASE_CRC32C_H
+#define BASE_CRC32C_H
+
+#include <cstdint>
+#include <cstring>
+
+namespace base {
+
+// Returns the CRC-32C of the |len| bytes at |ptr|.
+// - To checksum data in pieces, pass the result for the previous pieces as
+//   |crc|; the default of 0 starts a new checksum
+// - Uses the CPU's CRC32 instructions when available (SSE 4.2 on x86-64,
+//   the CRC extension on AArch64), falling back to a table-driven loop
+uint32_t crc32c(const void* ptr, std::size_t len, uint32_t crc = 0) noexcept;
+
+// Returns true iff |crc32c()| is using CRC32 instructions on this CPU.
+bool crc32c_is_accelerated() noexcept;
+
+}  // namespace base
+
+#endif  // BASE_CRC32C_H
@@ -0,0 +1,35 @@
+// Copyright © 2017 by Donald King <chronos@chronos-tachyon.net>
+// Available under the MIT License. See LICENSE for details.
+
+#include "gtest/gtest.h"
+
+#include <string>
+
+#include "base/crc32c.h"
+
+TEST(CRC32C, KnownValues) {
+  EXPECT_EQ(0x00000000U, base::crc32c("", 0));
+  EXPECT_EQ(0xe3069283U, base::crc32c("123456789", 9));
+
+  std::string buf(32, '\x00');
+  EXPECT_EQ(0x8a9136aaU, base::crc32c(buf.data(), buf.size()));
+
+  buf.assign(32, '\xff');
+  EXPECT_EQ(0x62a8ab43U, base::crc32c(buf.data(), buf.size()));
+
+  for (std::size_t i = 0; i < buf.size(); ++i) buf[i] = i;
+  EXPECT_EQ(0x46dd794eU, base::crc32c(buf.data(), buf.size()));
+}
+
+TEST(CRC32C, Incremental) {
+  std::string buf;
+  for (std::size_t i = 0; i < 1000; ++i) buf.push_back(i * 7 + 3);
+  uint32_t expected = base::crc32c(buf.data(), buf.size());
+
+  // Every split point, so that both halves hit every alignment.
+  for (std::size_t i = 0; i <= 64; ++i) {
+    uint32_t crc = base::crc32c(buf.data(), i);
+    crc = base::crc32c(buf.data() + i, buf.size() - i, crc);
+    EXPECT_EQ(expected, crc) << "split at " << i;
+  }
+}
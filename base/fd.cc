@@ -153,37 +153,48 @@ Result truncate(FD fd) {
   return r;
 }
 
-Result readdir_all(std::vector<DEntry>* out, FD fd, const char* what) {
+Result readdir_some(std::vector<DEntry>* out, FD fd, std::size_t buflen,
+                    const char* what) {
   CHECK_NOTNULL(out);
   CHECK_NOTNULL(fd);
 
-  std::vector<char> buf(4096);
+  std::unique_ptr<char[]> buf(new char[buflen]);
   long nread;
   auto fdpair = fd->acquire_fd();
+  nread = syscall(SYS_getdents64, fdpair.first, buf.get(), buflen);
+  if (nread < 0) {
+    int err_no = errno;
+    return Result::from_errno(err_no, "getdents64(2) from ", what);
+  }
+
+  // struct linux_dirent64 {
+  //   uint64_t d_ino;
+  //   int64_t d_off;
+  //   unsigned short d_reclen;
+  //   unsigned char d_type;
+  //   char d_name[];
+  // };
+  const char* ptr = buf.get();
+  const char* end = ptr + nread;
+  while (ptr != end) {
+    uint64_t ino;
+    unsigned short reclen;
+    ::memcpy(&ino, ptr, 8);
+    ::memcpy(&reclen, ptr + 16, sizeof(reclen));
+    unsigned char type = *(ptr + 18);
+    out->emplace_back(ino, type, std::string(ptr + 19));
+    ptr += reclen;
+  }
+  return Result();
+}
+
+Result readdir_all(std::vector<DEntry>* out, FD fd, const char* what) {
+  CHECK_NOTNULL(out);
   while (true) {
-    nread = syscall(SYS_getdents, fdpair.first, buf.data(), buf.size());
-    if (nread < 0) {
-      int err_no = errno;
-      return Result::from_errno(err_no, "getdents(2) from ", what);
-    }
-    if (nread == 0) break;
-
-    const char* ptr = buf.data();
-    const char* end = ptr + nread;
-    while (ptr != end) {
-      constexpr std::size_t kUL = sizeof(unsigned long);
-      constexpr std::size_t kUS = sizeof(unsigned short);
-
-      unsigned long ino;
-      unsigned short reclen;
-      unsigned char type;
-      ::memcpy(&ino, ptr, kUL);
-      ::memcpy(&reclen, ptr + 2 * kUL, kUS);
-      type = *(ptr + reclen - 1);
-      const char* p = ptr + 2 * kUL + kUS;
-      out->emplace_back(ino, type, std::string(p));
-      ptr += reclen;
-    }
+    std::size_t before = out->size();
+    Result r = readdir_some(out, fd, kReadDirBufferSize, what);
+    if (!r) return r;
+    if (out->size() == before) break;
   }
   return Result();
 }
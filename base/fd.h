@@ -105,6 +105,15 @@ Result truncate(FD fd);
 
 using DEntry = std::tuple<unsigned long, unsigned char, std::string>;
 
+// The getdents64(2) buffer size used by |readdir_all|.
+constexpr std::size_t kReadDirBufferSize = std::size_t(64) << 10;
+
+// Appends the next batch of directory entries that fit in |buflen| bytes of
+// getdents64(2) output, including "." and "..".  Appends nothing at the end
+// of the directory.
+Result readdir_some(std::vector<DEntry>* out, FD fd, std::size_t buflen,
+                    const char* what);
+
 Result readdir_all(std::vector<DEntry>* out, FD fd, const char* what);
 Result read_all(std::vector<char>* out, FD fd, const char* what);
 Result read_exactly(FD fd, void* ptr, std::size_t len, const char* what);
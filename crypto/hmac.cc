@@ -0,0 +1,73 @@
+// Copyright © 2017 by Donald King <chronos@chronos-tachyon.net>
+// Available under the MIT License. See LICENSE for details.
+
+#include "crypto/hmac.h"
+
+#include <algorithm>
+
+#include "base/logging.h"
+
+namespace crypto {
+
+static std::string digest(Hasher* h) {
+  std::string out(h->output_size(), '\0');
+  h->finalize();
+  h->sum(base::MutableBytes(&out[0], out.size()));
+  return out;
+}
+
+std::string hmac(NewHasher fn, base::Bytes key, base::Bytes data) {
+  auto h = fn();
+  CHECK(!h->is_sponge());
+  std::size_t bs = h->block_size();
+
+  std::string k;
+  if (key.size() > bs) {
+    h->write(key);
+    k = digest(h.get());
+    h->reset();
+  } else {
+    k.assign(reinterpret_cast<const char*>(key.data()), key.size());
+  }
+  k.resize(bs, '\0');
+
+  std::string pad(k);
+  for (char& ch : pad) ch ^= 0x36;
+  h->write(pad);
+  h->write(data);
+  std::string inner = digest(h.get());
+  h->reset();
+
+  for (std::size_t i = 0; i < bs; ++i) pad[i] = k[i] ^ 0x5c;
+  h->write(pad);
+  h->write(inner);
+  return digest(h.get());
+}
+
+std::string hkdf_extract(NewHasher fn, base::Bytes salt, base::Bytes ikm) {
+  if (salt.empty()) {
+    std::string zeroes(fn()->output_size(), '\0');
+    return hmac(fn, zeroes, ikm);
+  }
+  return hmac(fn, salt, ikm);
+}
+
+std::string hkdf_expand(NewHasher fn, base::Bytes prk, base::Bytes info,
+                        std::size_t len) {
+  std::size_t hlen = fn()->output_size();
+  CHECK_LE(len, 255U * hlen);
+
+  std::string out, t, block;
+  out.reserve(len + hlen);
+  for (unsigned int i = 1; out.size() < len; ++i) {
+    block = t;
+    block.append(reinterpret_cast<const char*>(info.data()), info.size());
+    block.push_back(char(i));
+    t = hmac(fn, prk, block);
+    out.append(t);
+  }
+  out.resize(len);
+  return out;
+}
+
+}  // namespace crypto
@@ -0,0 +1,43 @@
+// crypto/hmac.h - HMAC and HKDF over any Hasher
+// Copyright © 2017 by Donald King <chronos@chronos-tachyon.net>
+// Available under the MIT License. See LICENSE for details.
+
+#ifndef CRYPTO_HMAC_H
+#define CRYPTO_HMAC_H
+
+#include <cstddef>
+#include <string>
+
+#include "base/bytes.h"
+#include "crypto/crypto.h"
+
+namespace crypto {
+
+// Computes the HMAC of |data| under |key|, using the hash from |fn|.
+//
+//   https://tools.ietf.org/html/rfc2104
+//
+// - |fn| MUST NOT be a sponge hash
+// - The result is |output_size()| bytes long
+//
+std::string hmac(NewHasher fn, base::Bytes key, base::Bytes data);
+
+// Computes HKDF-Extract(|salt|, |ikm|), using the hash from |fn|.
+//
+//   https://tools.ietf.org/html/rfc5869
+//
+// - An empty |salt| is the same as |output_size()| zero bytes
+//
+std::string hkdf_extract(NewHasher fn, base::Bytes salt, base::Bytes ikm);
+
+// Computes the first |len| bytes of HKDF-Expand(|prk|, |info|), using the
+// hash from |fn|.
+//
+// - |len| MUST be no more than 255 times |output_size()|
+//
+std::string hkdf_expand(NewHasher fn, base::Bytes prk, base::Bytes info,
+                        std::size_t len);
+
+}  // namespace crypto
+
+#endif  // CRYPTO_HMAC_H
@@ -0,0 +1,68 @@
+// Copyright © 2017 by Donald King <chronos@chronos-tachyon.net>
+// Available under the MIT License. See LICENSE for details.
+
+#include <string>
+
+#include "crypto/hash/sha2.h"
+#include "crypto/hmac.h"
+#include "encoding/hex.h"
+#include "gtest/gtest.h"
+
+static std::string hex(base::Bytes bytes) {
+  return encode(encoding::HEX, bytes);
+}
+
+static std::string seq(unsigned int first, unsigned int last) {
+  std::string out;
+  for (unsigned int i = first; i <= last; ++i) out.push_back(char(i));
+  return out;
+}
+
+TEST(HMAC, RFC4231) {
+  std::string key(20, '\x0b');
+  std::string data("Hi There");
+  EXPECT_EQ(
+      "b0344c61d8db38535ca8afceaf0bf12b881dc200c9833da726e9376c2e32cff7",
+      hex(crypto::hmac(crypto::hash::new_sha256, key, data)));
+  EXPECT_EQ(
+      "87aa7cdea5ef619d4ff0b4241a1d6cb02379f4e2ce4ec2787ad0b30545e17cde"
+      "daa833b7d6b8a702038b274eaea3f4e4be9d914eeb61f1702e696c203a126854",
+      hex(crypto::hmac(crypto::hash::new_sha512, key, data)));
+
+  EXPECT_EQ(
+      "5bdcc146bf60754e6a042426089575c75a003f089d2739839dec58b964ec3843",
+      hex(crypto::hmac(crypto::hash::new_sha256, std::string("Jefe"),
+                       std::string("what do ya want for nothing?"))));
+
+  // Keys longer than the block size are hashed first.
+  std::string long_key(131, '\xaa');
+  EXPECT_EQ(
+      "60e431591ee0b67f0d8a26aacbf5b77f8e0bc6213728c5140546040f0ee37f54",
+      hex(crypto::hmac(crypto::hash::new_sha256, long_key,
+                       std::string("Test Using Larger Than Block-Size Key - "
+                                   "Hash Key First"))));
+}
+
+TEST(HKDF, RFC5869) {
+  std::string ikm(22, '\x0b');
+  std::string prk =
+      crypto::hkdf_extract(crypto::hash::new_sha256, seq(0x00, 0x0c), ikm);
+  EXPECT_EQ(
+      "077709362c2e32df0ddc3f0dc47bba6390b6c73bb50f9c3122ec844ad7c2b3e5",
+      hex(prk));
+  EXPECT_EQ(
+      "3cb25f25faacd57a90434f64d0362f2a2d2d0a90cf1a5a4c5db02d56ecc4c5bf"
+      "34007208d5b887185865",
+      hex(crypto::hkdf_expand(crypto::hash::new_sha256, prk, seq(0xf0, 0xf9),
+                              42)));
+
+  prk = crypto::hkdf_extract(crypto::hash::new_sha256, base::Bytes(), ikm);
+  EXPECT_EQ(
+      "19ef24a32c717b167f33a91d6f648bdf96596776afdb6377ac434c1c293ccb04",
+      hex(prk));
+  EXPECT_EQ(
+      "8da4e775a563c18f715f802a063c5a31b8a11f5c5ee1879ec3454e5f3c738d2d"
+      "9d201395faa4b61a96c8",
+      hex(crypto::hkdf_expand(crypto::hash::new_sha256, prk, base::Bytes(),
+                              42)));
+}
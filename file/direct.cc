@@ -0,0 +1,635 @@
+// Copyright © 2017 by Donald King <chronos@chronos-tachyon.net>
+// Available under the MIT License. See LICENSE for details.
+
+#include "file/direct.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/vfs.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "base/logging.h"
+#include "base/mutex.h"
+#include "io/options.h"
+
+namespace file {
+
+namespace {
+
+// A task to be finished once the lock protecting it has been released.
+using Completion = std::pair<event::Task*, base::Result>;
+
+static void complete(std::vector<Completion>* done) {
+  for (auto& c : *done) c.first->finish(std::move(c.second));
+}
+
+static std::size_t round_down(std::size_t x, std::size_t align) noexcept {
+  return x & ~(align - 1);
+}
+
+static std::size_t round_up(std::size_t x, std::size_t align) noexcept {
+  return round_down(x + align - 1, align);
+}
+
+// Reads up to |len| bytes at |off|.  Stops early at the end of the file,
+// which is the only place where O_DIRECT reads may come up short.
+static base::Result pread_aligned(std::size_t* n, int fdnum, char* out,
+                                  std::size_t len, int64_t off,
+                                  std::size_t align) {
+  *n = 0;
+  while (*n < len) {
+    ssize_t x = ::pread(fdnum, out + *n, len - *n, off + *n);
+    if (x < 0) {
+      int err_no = errno;
+      if (err_no == EINTR) continue;
+      return base::Result::from_errno(err_no, "pread(2)");
+    }
+    if (x == 0) break;
+    *n += x;
+    if ((*n & (align - 1)) != 0) break;
+  }
+  return base::Result();
+}
+
+static base::Result pwrite_aligned(int fdnum, const char* ptr, std::size_t len,
+                                   int64_t off) {
+  std::size_t n = 0;
+  while (n < len) {
+    ssize_t x = ::pwrite(fdnum, ptr + n, len - n, off + n);
+    if (x < 0) {
+      int err_no = errno;
+      if (err_no == EINTR) continue;
+      return base::Result::from_errno(err_no, "pwrite(2)");
+    }
+    n += x;
+  }
+  return base::Result();
+}
+
+// Returns the current file offset of |fd| and the size of the file.
+static base::Result offset_and_size(int64_t* off, int64_t* size, int fdnum) {
+  struct stat st;
+  ::bzero(&st, sizeof(st));
+  if (::fstat(fdnum, &st) != 0) {
+    int err_no = errno;
+    return base::Result::from_errno(err_no, "fstat(2)");
+  }
+  *size = st.st_size;
+  off_t pos = ::lseek(fdnum, 0, SEEK_CUR);
+  if (pos < 0) {
+    int err_no = errno;
+    return base::Result::from_errno(err_no, "lseek(2)");
+  }
+  *off = pos;
+  return base::Result();
+}
+
+// DirectReader {{{
+
+class DirectReader : public io::ReaderImpl,
+                     public std::enable_shared_from_this<DirectReader> {
+ public:
+  DirectReader(base::FD fd, io::PoolPtr pool, std::size_t depth,
+               int64_t offset) noexcept
+      : fd_(std::move(fd)),
+        pool_(std::move(pool)),
+        depth_(std::max(depth, std::size_t(1))),
+        next_(round_down(offset, pool_->alignment())),
+        skip_(offset - next_),
+        eof_(false),
+        closed_(false) {}
+
+  std::size_t ideal_block_size() const noexcept override {
+    return pool_->buffer_size();
+  }
+
+  bool is_buffered() const noexcept override { return true; }
+
+  void read(event::Task* task, char* out, std::size_t* n, std::size_t min,
+            std::size_t max, const base::Options& opts) override {
+    if (!prologue(task, out, n, min, max)) return;
+    auto lock = base::acquire_lock(mu_);
+    ops_.push_back(ReadOp{task, out, n, min, max});
+    pump(lock, opts);
+  }
+
+  void close(event::Task* task, const base::Options& opts) override {
+    auto lock = base::acquire_lock(mu_);
+    bool was = closed_;
+    closed_ = true;
+    pump(lock, opts);
+    base::Result r;
+    if (was) r = io::reader_closed();
+    else r = fd_->close();
+    if (prologue(task)) task->finish(std::move(r));
+  }
+
+ private:
+  struct Chunk {
+    int64_t offset;
+    io::OwnedBuffer buf;
+    std::size_t begin;  // first byte not yet consumed
+    std::size_t end;    // number of bytes read from the file
+    base::Result result;
+    bool done;
+
+    Chunk(int64_t off, io::OwnedBuffer b, std::size_t skip) noexcept
+        : offset(off), buf(std::move(b)), begin(skip), end(0), done(false) {}
+  };
+
+  struct ReadOp {
+    event::Task* task;
+    char* out;
+    std::size_t* n;
+    std::size_t min;
+    std::size_t max;
+  };
+
+  // Satisfies as many pending reads as possible, then tops up the chunks in
+  // flight.  Releases |lock| before finishing tasks or dispatching I/O.
+  void pump(base::Lock& lock, const base::Options& opts);
+
+  // Runs on the dispatcher.  Fills |chunk| with a single aligned read.
+  void fill(Chunk* chunk, base::Options opts);
+
+  const base::FD fd_;
+  const io::PoolPtr pool_;
+  const std::size_t depth_;
+  mutable std::mutex mu_;
+  std::deque<std::unique_ptr<Chunk>> chunks_;  // protected by mu_
+  std::deque<ReadOp> ops_;                     // protected by mu_
+  int64_t next_;                               // protected by mu_
+  std::size_t skip_;                           // protected by mu_
+  bool eof_;                                   // protected by mu_
+  bool closed_;                                // protected by mu_
+};
+
+void DirectReader::pump(base::Lock& lock, const base::Options& opts) {
+  std::vector<Completion> done;
+  while (!ops_.empty()) {
+    ReadOp& op = ops_.front();
+    if (closed_) {
+      done.emplace_back(op.task, io::reader_closed());
+      ops_.pop_front();
+      continue;
+    }
+    if (*op.n == 0 && op.max > 0 && !op.task->is_running()) {
+      done.emplace_back(op.task, base::Result::cancelled());
+      ops_.pop_front();
+      continue;
+    }
+
+    base::Result r;
+    bool waiting = false;
+    while (*op.n < op.max) {
+      if (chunks_.empty()) {
+        waiting = !eof_;
+        break;
+      }
+      Chunk* c = chunks_.front().get();
+      if (!c->done) {
+        waiting = true;
+        break;
+      }
+      if (!c->result) {
+        // Leave the failed chunk in place, so that the error is sticky.
+        r = c->result;
+        break;
+      }
+      std::size_t len = std::min(op.max - *op.n, c->end - c->begin);
+      ::memcpy(op.out + *op.n, c->buf.data() + c->begin, len);
+      c->begin += len;
+      *op.n += len;
+      if (c->begin == c->end) {
+        pool_->give(std::move(c->buf));
+        chunks_.pop_front();
+      }
+    }
+
+    // Block only while the read hasn't produced its minimum, or any data.
+    if (waiting && r && *op.n < std::max(op.min, std::size_t(1))) break;
+    if (r && *op.n < op.min) r = base::Result::eof();
+    done.emplace_back(op.task, std::move(r));
+    ops_.pop_front();
+  }
+
+  std::vector<Chunk*> issue;
+  if (!ops_.empty()) {
+    while (!eof_ && !closed_ && chunks_.size() < depth_) {
+      std::unique_ptr<Chunk> c(new Chunk(next_, pool_->take(), skip_));
+      next_ += pool_->buffer_size();
+      skip_ = 0;
+      issue.push_back(c.get());
+      chunks_.push_back(std::move(c));
+    }
+  }
+  lock.unlock();
+
+  complete(&done);
+  if (issue.empty()) return;
+  auto d = io::get_manager(opts).dispatcher();
+  auto self = shared_from_this();
+  for (Chunk* c : issue) {
+    d->dispatch(event::callback([self, c, opts] {
+      self->fill(c, opts);
+      return base::Result();
+    }));
+  }
+}
+
+void DirectReader::fill(Chunk* chunk, base::Options opts) {
+  std::size_t n = 0;
+  base::Result r;
+  {
+    auto fdpair = fd_->acquire_fd();
+    r = pread_aligned(&n, fdpair.first, chunk->buf.data(), chunk->buf.size(),
+                      chunk->offset, pool_->alignment());
+  }
+
+  auto lock = base::acquire_lock(mu_);
+  chunk->result = std::move(r);
+  chunk->end = n;
+  chunk->done = true;
+  if (chunk->begin > chunk->end) chunk->begin = chunk->end;
+  if (!chunk->result || n < chunk->buf.size()) eof_ = true;
+  pump(lock, opts);
+}
+
+// }}}
+// DirectWriter {{{
+
+class DirectWriter : public io::WriterImpl,
+                     public std::enable_shared_from_this<DirectWriter> {
+ public:
+  DirectWriter(base::FD fd, io::PoolPtr pool, std::size_t depth) noexcept
+      : fd_(std::move(fd)),
+        pool_(std::move(pool)),
+        depth_(std::max(depth, std::size_t(1))),
+        file_size_(0),
+        inflight_(0),
+        busy_(false),
+        closed_(false) {}
+
+  // Positions the Writer at |offset|, reading in the partial block that
+  // precedes it if |offset| is unaligned.  If |r| is an error, it becomes
+  // the Writer's sticky error instead.
+  base::Result init(base::Result r, int64_t offset, int64_t file_size);
+
+  std::size_t ideal_block_size() const noexcept override {
+    return pool_->buffer_size();
+  }
+
+  bool is_buffered() const noexcept override { return true; }
+
+  void write(event::Task* task, std::size_t* n, const char* ptr,
+             std::size_t len, const base::Options& opts) override {
+    if (!prologue(task, n, ptr, len)) return;
+    enqueue(Op(Op::kWrite, task, n, ptr, len), opts);
+  }
+
+  void flush(event::Task* task, const base::Options& opts) override {
+    if (!prologue(task)) return;
+    enqueue(Op(Op::kFlush, task), opts);
+  }
+
+  void sync(event::Task* task, const base::Options& opts) override {
+    if (!prologue(task)) return;
+    enqueue(Op(Op::kSync, task), opts);
+  }
+
+  void close(event::Task* task, const base::Options& opts) override {
+    if (!prologue(task)) return;
+    enqueue(Op(Op::kClose, task), opts);
+  }
+
+ private:
+  struct Chunk {
+    int64_t offset;
+    io::OwnedBuffer buf;
+    std::size_t len;
+
+    Chunk(int64_t off, io::OwnedBuffer b) noexcept
+        : offset(off), buf(std::move(b)), len(0) {}
+  };
+
+  struct Op {
+    enum Kind { kWrite, kFlush, kSync, kClose };
+
+    Kind kind;
+    event::Task* task;
+    std::size_t* n;
+    const char* ptr;
+    std::size_t len;
+
+    Op(Kind k, event::Task* t, std::size_t* n = nullptr,
+       const char* p = nullptr, std::size_t l = 0) noexcept : kind(k),
+                                                              task(t),
+                                                              n(n),
+                                                              ptr(p),
+                                                              len(l) {}
+  };
+
+  void enqueue(Op op, const base::Options& opts) {
+    auto lock = base::acquire_lock(mu_);
+    ops_.push_back(op);
+    pump(lock, opts);
+  }
+
+  // Processes queued operations in order.  Releases |lock| before finishing
+  // tasks or dispatching I/O.
+  void pump(base::Lock& lock, const base::Options& opts);
+
+  // Runs on the dispatcher.  Writes out the full |chunk|.
+  void write_chunk(Chunk* chunk, base::Options opts);
+
+  // Runs on the dispatcher, once all chunks have landed.  Writes out the
+  // partial tail chunk, then syncs and/or closes as |kind| demands.
+  void drain(Op::Kind kind, base::Options opts);
+
+  const base::FD fd_;
+  const io::PoolPtr pool_;
+  const std::size_t depth_;
+  mutable std::mutex mu_;
+  std::deque<Op> ops_;          // protected by mu_
+  std::unique_ptr<Chunk> tail_;  // protected by mu_
+  int64_t file_size_;           // protected by mu_
+  std::size_t inflight_;        // protected by mu_
+  bool busy_;                   // protected by mu_
+  bool closed_;                 // protected by mu_
+  base::Result result_;         // protected by mu_
+};
+
+base::Result DirectWriter::init(base::Result r, int64_t offset,
+                                int64_t file_size) {
+  result_ = std::move(r);
+  if (!result_) return result_;
+  const std::size_t align = pool_->alignment();
+  const int64_t start = round_down(offset, align);
+  file_size_ = file_size;
+  tail_.reset(new Chunk(start, pool_->take()));
+  tail_->len = offset - start;
+  if (tail_->len == 0) return base::Result();
+
+  std::size_t n = 0;
+  auto fdpair = fd_->acquire_fd();
+  result_ = pread_aligned(&n, fdpair.first, tail_->buf.data(), align, start,
+                          align);
+  if (result_ && n < tail_->len) {
+    result_ = base::Result::data_loss("file shorter than its offset");
+  }
+  return result_;
+}
+
+void DirectWriter::pump(base::Lock& lock, const base::Options& opts) {
+  const std::size_t chunk_size = pool_->buffer_size();
+  std::vector<Completion> done;
+  std::vector<Chunk*> issue;
+  bool draining = false;
+  Op::Kind drain_kind = Op::kFlush;
+
+  while (!ops_.empty() && !busy_) {
+    Op& op = ops_.front();
+    if (closed_) {
+      done.emplace_back(op.task, io::writer_closed());
+      ops_.pop_front();
+      continue;
+    }
+    if (!result_ && op.kind != Op::kClose) {
+      done.emplace_back(op.task, result_);
+      ops_.pop_front();
+      continue;
+    }
+
+    if (op.kind != Op::kWrite) {
+      // Wait for every chunk to land before touching the tail.
+      if (inflight_ > 0) break;
+      busy_ = true;
+      draining = true;
+      drain_kind = op.kind;
+      break;
+    }
+
+    if (*op.n == 0 && op.len > 0 && !op.task->is_running()) {
+      done.emplace_back(op.task, base::Result::cancelled());
+      ops_.pop_front();
+      continue;
+    }
+
+    bool blocked = false;
+    while (true) {
+      if (tail_ && tail_->len == chunk_size) {
+        if (inflight_ >= depth_) {
+          blocked = true;
+          break;
+        }
+        int64_t next = tail_->offset + chunk_size;
+        ++inflight_;
+        issue.push_back(tail_.release());
+        tail_.reset(new Chunk(next, pool_->take()));
+      }
+      if (*op.n == op.len) break;
+      std::size_t len = std::min(op.len - *op.n, chunk_size - tail_->len);
+      ::memcpy(tail_->buf.data() + tail_->len, op.ptr + *op.n, len);
+      tail_->len += len;
+      *op.n += len;
+    }
+    if (blocked) break;
+    done.emplace_back(op.task, base::Result());
+    ops_.pop_front();
+  }
+  lock.unlock();
+
+  complete(&done);
+  if (issue.empty() && !draining) return;
+  auto d = io::get_manager(opts).dispatcher();
+  auto self = shared_from_this();
+  for (Chunk* c : issue) {
+    d->dispatch(event::callback([self, c, opts] {
+      self->write_chunk(c, opts);
+      return base::Result();
+    }));
+  }
+  if (draining) {
+    d->dispatch(event::callback([self, drain_kind, opts] {
+      self->drain(drain_kind, opts);
+      return base::Result();
+    }));
+  }
+}
+
+void DirectWriter::write_chunk(Chunk* chunk, base::Options opts) {
+  base::Result r;
+  {
+    auto fdpair = fd_->acquire_fd();
+    r = pwrite_aligned(fdpair.first, chunk->buf.data(), chunk->len,
+                       chunk->offset);
+  }
+
+  auto lock = base::acquire_lock(mu_);
+  --inflight_;
+  if (r) {
+    file_size_ = std::max(file_size_, int64_t(chunk->offset + chunk->len));
+  } else if (result_) {
+    result_ = std::move(r);
+  }
+  pool_->give(std::move(chunk->buf));
+  delete chunk;
+  pump(lock, opts);
+}
+
+void DirectWriter::drain(Op::Kind kind, base::Options opts) {
+  // |busy_| keeps pump() away from |tail_| and |file_size_| until we're done.
+  auto lock = base::acquire_lock(mu_);
+  Chunk* tail = tail_.get();
+  int64_t file_size = file_size_;
+  base::Result r = result_;
+  lock.unlock();
+
+  const std::size_t align = pool_->alignment();
+  auto fdpair = fd_->acquire_fd();
+  const int fdnum = fdpair.first;
+  if (r && tail && tail->len > 0) {
+    char* buf = tail->buf.data();
+    const std::size_t whole = round_down(tail->len, align);
+    const std::size_t padded = round_up(tail->len, align);
+    const int64_t end = tail->offset + tail->len;
+
+    // The padding must not clobber data already in the file past |end|.
+    ::bzero(buf + tail->len, padded - tail->len);
+    if (padded > tail->len && end < file_size) {
+      std::size_t n = 0;
+      auto scratch = pool_->take();
+      r = pread_aligned(&n, fdnum, scratch.data(), align,
+                        tail->offset + whole, align);
+      std::size_t have = tail->len - whole;
+      if (r && n > have) {
+        ::memcpy(buf + tail->len, scratch.data() + have, n - have);
+      }
+      pool_->give(std::move(scratch));
+    }
+
+    if (r) r = pwrite_aligned(fdnum, buf, padded, tail->offset);
+    if (r && tail->offset + int64_t(padded) > file_size) {
+      file_size = std::max(file_size, end);
+      if (::ftruncate(fdnum, file_size) != 0) {
+        int err_no = errno;
+        r = base::Result::from_errno(err_no, "ftruncate(2)");
+      }
+    }
+    if (r) {
+      // Keep the final partial block buffered, so that the next chunk to be
+      // written starts on an aligned offset.
+      file_size = std::max(file_size, end);
+      ::memmove(buf, buf + whole, tail->len - whole);
+      tail->offset += whole;
+      tail->len -= whole;
+    }
+  }
+  if (r && kind != Op::kFlush && ::fdatasync(fdnum) != 0) {
+    int err_no = errno;
+    r = base::Result::from_errno(err_no, "fdatasync(2)");
+  }
+  fdpair.second.unlock();
+  if (kind == Op::kClose) {
+    auto r2 = fd_->close();
+    if (r) r = std::move(r2);
+  }
+
+  lock.lock();
+  busy_ = false;
+  file_size_ = file_size;
+  if (!r && result_) result_ = r;
+  if (kind == Op::kClose) closed_ = true;
+  event::Task* task = ops_.front().task;
+  ops_.pop_front();
+  lock.unlock();
+
+  task->finish(std::move(r));
+  lock.lock();
+  pump(lock, opts);
+}
+
+// }}}
+
+}  // anonymous namespace
+
+base::Result direct_alignment(std::size_t* out, const base::FD& fd) {
+  CHECK_NOTNULL(out);
+  *out = 512;
+  struct statfs buf;
+  ::bzero(&buf, sizeof(buf));
+  auto fdpair = fd->acquire_fd();
+  if (::fstatfs(fdpair.first, &buf) != 0) {
+    int err_no = errno;
+    return base::Result::from_errno(err_no, "fstatfs(2)");
+  }
+  if (buf.f_bsize > 512) *out = buf.f_bsize;
+  return base::Result();
+}
+
+io::PoolPtr make_direct_pool(const base::FD& fd, std::size_t depth) {
+  std::size_t align = 0;
+  auto r = direct_alignment(&align, fd);
+  if (!r) VLOG(4) << "file::make_direct_pool: " << r;
+  return io::make_aligned_pool(kDefaultDirectChunkSize, depth + 1, align);
+}
+
+io::Reader directreader(base::FD fd, io::PoolPtr pool, std::size_t depth) {
+  CHECK_NOTNULL(fd);
+  CHECK_NOTNULL(pool);
+  CHECK_NE(pool->alignment(), 0U);
+  off_t pos;
+  {
+    auto fdpair = fd->acquire_fd();
+    pos = ::lseek(fdpair.first, 0, SEEK_CUR);
+  }
+  if (pos < 0) pos = 0;
+  return io::Reader(std::make_shared<DirectReader>(
+      std::move(fd), std::move(pool), depth, pos));
+}
+
+io::Reader directreader(base::FD fd) {
+  auto pool = make_direct_pool(fd);
+  return directreader(std::move(fd), std::move(pool));
+}
+
+io::Writer directwriter(base::FD fd, io::PoolPtr pool, std::size_t depth) {
+  CHECK_NOTNULL(fd);
+  CHECK_NOTNULL(pool);
+  CHECK_NE(pool->alignment(), 0U);
+  int64_t offset = 0, size = 0;
+  base::Result r;
+  {
+    auto fdpair = fd->acquire_fd();
+    r = offset_and_size(&offset, &size, fdpair.first);
+
+    // pwrite(2) ignores its offset in append mode, and DirectWriter needs
+    // to rewrite the final partial block in place.
+    int flags = ::fcntl(fdpair.first, F_GETFL);
+    if (r && flags >= 0 && (flags & O_APPEND) != 0) {
+      r = base::Result::invalid_argument(
+          "file::directwriter: O_APPEND is not supported");
+    }
+  }
+  auto w = std::make_shared<DirectWriter>(std::move(fd), std::move(pool),
+                                          depth);
+  r = w->init(std::move(r), offset, size);
+  if (!r) LOG(WARN) << "file::directwriter: " << r;
+  return io::Writer(std::move(w));
+}
+
+io::Writer directwriter(base::FD fd) {
+  auto pool = make_direct_pool(fd);
+  return directwriter(std::move(fd), std::move(pool));
+}
+
+}  // namespace file
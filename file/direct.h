@@ -0,0 +1,62 @@
+// file/direct.h - Aligned Reader and Writer for files opened with O_DIRECT
+// Copyright © 2017 by Donald King <chronos@chronos-tachyon.net>
+// Available under the MIT License. See LICENSE for details.
+
+#ifndef FILE_DIRECT_H
+#define FILE_DIRECT_H
+
+#include <cstddef>
+
+#include "base/fd.h"
+#include "base/result.h"
+#include "io/buffer.h"
+#include "io/reader.h"
+#include "io/writer.h"
+
+namespace file {
+
+// The size of each chunk of I/O issued by a direct Reader or Writer.
+constexpr std::size_t kDefaultDirectChunkSize = std::size_t(1) << 20;
+
+// The number of chunks a direct Reader or Writer keeps in flight.
+constexpr std::size_t kDefaultDirectDepth = 4;
+
+// Returns the alignment which O_DIRECT I/O on |fd| must honor, i.e. the block
+// size of the filesystem holding it.  Never less than 512.
+base::Result direct_alignment(std::size_t* out, const base::FD& fd);
+
+// Returns an aligned pool suitable for direct I/O on |fd|.
+io::PoolPtr make_direct_pool(const base::FD& fd,
+                             std::size_t depth = kDefaultDirectDepth);
+
+// Returns a Reader which reads |fd| through aligned buffers taken from |pool|,
+// keeping up to |depth| pread(2) calls of |pool->buffer_size()| bytes each in
+// flight on the dispatcher ahead of the consumer.
+// - |pool| MUST be aligned, e.g. see |make_direct_pool()|
+// - Reading starts at the current file offset of |fd|, which need not be
+//   aligned, but the Reader keeps its own offset from then on
+// - The Reader stops at the first short read; data appended to the file
+//   after that point is not seen
+io::Reader directreader(base::FD fd, io::PoolPtr pool,
+                        std::size_t depth = kDefaultDirectDepth);
+io::Reader directreader(base::FD fd);
+
+// Returns a buffered Writer which writes |fd| through aligned buffers taken
+// from |pool|, keeping up to |depth| pwrite(2) calls of |pool->buffer_size()|
+// bytes each in flight on the dispatcher.
+// - |pool| MUST be aligned, e.g. see |make_direct_pool()|
+// - Writing starts at the current file offset of |fd|, which need not be
+//   aligned; if it isn't, then |fd| must also be readable
+// - If |fd| is in append mode, every write fails with INVALID_ARGUMENT, as
+//   pwrite(2) can't rewrite the final partial block in place; to append,
+//   open |fd| without O_APPEND and seek to the end
+// - flush() writes out the final partial block padded to the alignment,
+//   then trims the file back to its true size
+// - The first error is sticky: every later write fails with it
+io::Writer directwriter(base::FD fd, io::PoolPtr pool,
+                        std::size_t depth = kDefaultDirectDepth);
+io::Writer directwriter(base::FD fd);
+
+}  // namespace file
+
+#endif  // FILE_DIRECT_H
@@ -0,0 +1,127 @@
+// Copyright © 2017 by Donald King <chronos@chronos-tachyon.net>
+// Available under the MIT License. See LICENSE for details.
+
+#include "gtest/gtest.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "base/cleanup.h"
+#include "base/fd.h"
+#include "base/result_testing.h"
+#include "file/direct.h"
+
+// Opens |path| with O_DIRECT, if the filesystem allows it.
+static base::FD open_direct(const std::string& path, int flags) {
+  int fdnum = ::open(path.c_str(), flags | O_DIRECT | O_CLOEXEC, 0600);
+  if (fdnum < 0 && errno == EINVAL) {
+    fdnum = ::open(path.c_str(), flags | O_CLOEXEC, 0600);
+  }
+  EXPECT_GE(fdnum, 0) << "open(2): errno " << errno;
+  return base::wrapfd(fdnum);
+}
+
+static std::string slurp(const std::string& path) {
+  std::string out;
+  int fdnum = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  EXPECT_GE(fdnum, 0);
+  char buf[4096];
+  ssize_t n;
+  while ((n = ::read(fdnum, buf, sizeof(buf))) > 0) out.append(buf, n);
+  ::close(fdnum);
+  return out;
+}
+
+TEST(Direct, EndToEnd) {
+  std::string dir;
+  ASSERT_OK(base::make_tempdir(&dir, "mojo2_file_direct_XXXXXXXX"));
+  auto cleanup = base::cleanup([&dir] { ::rmdir(dir.c_str()); });
+
+  std::string path = dir;
+  path.append("/foo");
+  auto cleanup2 = base::cleanup([&path] { ::unlink(path.c_str()); });
+
+  std::string data;
+  for (std::size_t i = 0; i < 50000; ++i) data.push_back('a' + (i % 23));
+
+  // Small chunks, so that many of them are in flight at once.
+  auto pool = io::make_aligned_pool(8192, 4, 4096);
+  EXPECT_EQ(4096U, pool->alignment());
+
+  io::Writer w = file::directwriter(open_direct(path, O_RDWR | O_CREAT), pool);
+  EXPECT_TRUE(w.is_buffered());
+  std::size_t n;
+  for (std::size_t i = 0; i < data.size(); i += 777) {
+    std::size_t len = std::min(std::size_t(777), data.size() - i);
+    EXPECT_OK(w.write(&n, data.data() + i, len));
+    EXPECT_EQ(len, n);
+    if (i == 20202) {
+      // A flush writes out the final partial block, yet keeps the file at
+      // its true size.
+      EXPECT_OK(w.flush());
+      EXPECT_EQ(data.substr(0, i + len), slurp(path));
+    }
+  }
+  EXPECT_OK(w.close());
+  EXPECT_EQ(data, slurp(path));
+
+  // Overwriting from an unaligned offset preserves the data around it.
+  {
+    base::FD fd = open_direct(path, O_RDWR);
+    EXPECT_EQ(10001, ::lseek(fd->acquire_fd().first, 10001, SEEK_SET));
+    w = file::directwriter(fd, pool);
+    std::string patch(5000, 'Z');
+    EXPECT_OK(w.write(&n, patch));
+    EXPECT_OK(w.close());
+    data.replace(10001, patch.size(), patch);
+    EXPECT_EQ(data, slurp(path));
+  }
+
+  // Append mode is refused, and left alone.
+  {
+    base::FD fd = open_direct(path, O_RDWR | O_APPEND);
+    w = file::directwriter(fd, pool);
+    EXPECT_EQ(base::ResultCode::INVALID_ARGUMENT, w.write(&n, "tail").code());
+    EXPECT_NE(0, ::fcntl(fd->acquire_fd().first, F_GETFL) & O_APPEND);
+    EXPECT_EQ(data, slurp(path));
+  }
+
+  // Appending picks up at the end of the file.
+  {
+    base::FD fd = open_direct(path, O_RDWR);
+    EXPECT_EQ(int64_t(data.size()),
+              ::lseek(fd->acquire_fd().first, 0, SEEK_END));
+    w = file::directwriter(fd, pool);
+    EXPECT_OK(w.write(&n, "tail"));
+    EXPECT_OK(w.close());
+    data.append("tail");
+    EXPECT_EQ(data, slurp(path));
+  }
+
+  // Reads of all sizes, starting from an unaligned offset.
+  {
+    base::FD fd = open_direct(path, O_RDONLY);
+    EXPECT_EQ(3, ::lseek(fd->acquire_fd().first, 3, SEEK_SET));
+    io::Reader r = file::directreader(fd, pool);
+    std::string out;
+    std::string buf(10000, '\0');
+    for (std::size_t i = 1; true; i = (i * 7) % 9999 + 1) {
+      auto result = r.read(&buf[0], &n, 1, i);
+      out.append(buf, 0, n);
+      if (!result) {
+        EXPECT_EOF(result);
+        break;
+      }
+      EXPECT_LE(1U, n);
+    }
+    EXPECT_EQ(data.substr(3), out);
+    EXPECT_OK(r.close());
+  }
+}
+
+static void init() __attribute__((constructor));
+static void init() { base::log_stderr_set_level(VLOG_LEVEL(6)); }
@@ -5,17 +5,24 @@
 
 #include <dirent.h>
 #include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/vfs.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <cerrno>
 #include <cstddef>
+#include <cstring>
+#include <mutex>
 
 #include "base/cleanup.h"
+#include "base/mutex.h"
 #include "base/time/time.h"
 #include "base/user.h"
+#include "file/direct.h"
+#include "file/options.h"
 
 namespace file {
 
@@ -34,44 +41,359 @@ static int system_whence(Whence whence) {
   return SEEK_CUR;
 }
 
-static FileType filetype_from_mode(mode_t mode) noexcept {
-  if (S_ISREG(mode)) return FileType::regular;
-  if (S_ISDIR(mode)) return FileType::directory;
-  if (S_ISCHR(mode)) return FileType::char_device;
-  if (S_ISBLK(mode)) return FileType::block_device;
-  if (S_ISFIFO(mode)) return FileType::fifo;
-  if (S_ISSOCK(mode)) return FileType::socket;
-  if (S_ISLNK(mode)) return FileType::symbolic_link;
-  return FileType::unknown;
+// The direct Reader and Writer keep their own offsets, ahead of the
+// descriptor's by whatever they have in flight, so there is no one offset
+// to report or move.
+static base::Result no_direct_seek() {
+  return base::Result::not_implemented(
+      "seek and tell are not supported with direct_io");
 }
 
-static FileType filetype_from_dtype(unsigned char dt) noexcept {
-  switch (dt) {
-    case DT_REG:
-      return FileType::regular;
-    case DT_DIR:
-      return FileType::directory;
-    case DT_CHR:
-      return FileType::char_device;
-    case DT_BLK:
-      return FileType::block_device;
-    case DT_FIFO:
-      return FileType::fifo;
-    case DT_SOCK:
-      return FileType::socket;
-    case DT_LNK:
-      return FileType::symbolic_link;
+// Reads until |len| bytes have been read or the end of the file is reached.
+static base::Result pread_all(std::size_t* n, const base::FD& fd, char* out,
+                              std::size_t len, int64_t off) {
+  *n = 0;
+  auto fdpair = fd->acquire_fd();
+  while (*n < len) {
+    ssize_t x = ::pread(fdpair.first, out + *n, len - *n, off + *n);
+    if (x < 0) {
+      int err_no = errno;
+      if (err_no == EINTR) continue;
+      return base::Result::from_errno(err_no, "pread(2)");
+    }
+    if (x == 0) break;
+    *n += x;
   }
-  return FileType::unknown;
+  return base::Result();
+}
+
+static base::Result pwrite_all(std::size_t* n, const base::FD& fd,
+                               const char* ptr, std::size_t len, int64_t off) {
+  *n = 0;
+  auto fdpair = fd->acquire_fd();
+  while (*n < len) {
+    ssize_t x = ::pwrite(fdpair.first, ptr + *n, len - *n, off + *n);
+    if (x < 0) {
+      int err_no = errno;
+      if (err_no == EINTR) continue;
+      return base::Result::from_errno(err_no, "pwrite(2)");
+    }
+    if (x == 0) return base::Result::internal("pwrite(2) wrote 0 bytes");
+    *n += x;
+  }
+  return base::Result();
+}
+
+// How far ahead of the read cursor MappedReader asks the kernel to fetch.
+static constexpr std::size_t kReadAhead = std::size_t(8) << 20;  // 8 MiB
+
+// MappedReader serves reads of a regular file straight out of a read-only
+// mapping of it, keeping its own read offset.
+//
+// The mapping covers the file as it was when the reader was created; if the
+// file grows, reads past the mapping fall back to pread(2).  As with any
+// mapping, truncating the file out from under the reader raises SIGBUS.
+// Copies to a Writer with a file descriptor skip the mapping entirely, so
+// that they can use sendfile(2).
+class MappedReader : public io::ReaderImpl,
+                     public std::enable_shared_from_this<MappedReader> {
+ public:
+  // Returns null if |fd| can't be mapped, e.g. if it isn't a regular file.
+  static std::shared_ptr<MappedReader> make(base::FD fd);
+
+  MappedReader(base::FD fd, const char* ptr, std::size_t len) noexcept
+      : fd_(std::move(fd)),
+        fdr_(io::fdreader(fd_)),
+        base_(ptr),
+        size_(len),
+        pos_(0),
+        advised_(0),
+        closed_(false) {}
+
+  ~MappedReader() noexcept override {
+    ::munmap(const_cast<char*>(base_), size_);
+  }
+
+  std::size_t ideal_block_size() const noexcept override {
+    return io::kDefaultIdealBlockSize;
+  }
+
+  bool is_buffered() const noexcept override { return true; }
+
+  std::size_t peek(char* out, std::size_t max) override {
+    auto lock = base::acquire_lock(mu_);
+    if (closed_ || pos_ >= size_) return 0;
+    std::size_t len = std::min(max, std::size_t(size_ - pos_));
+    ::memcpy(out, base_ + pos_, len);
+    return len;
+  }
+
+  bool try_read(char* out, std::size_t len) override {
+    auto lock = base::acquire_lock(mu_);
+    if (closed_ || pos_ >= size_ || size_ - pos_ < len) return false;
+    ::memcpy(out, base_ + pos_, len);
+    advance_locked(len);
+    return true;
+  }
+
+  void read(event::Task* task, char* out, std::size_t* n, std::size_t min,
+            std::size_t max, const base::Options& opts) override;
+
+  void write_to(event::Task* task, std::size_t* n, std::size_t max,
+                const io::Writer& w, const base::Options& opts) override;
+
+  void close(event::Task* task, const base::Options& opts) override {
+    auto lock = base::acquire_lock(mu_);
+    closed_ = true;
+    lock.unlock();
+    auto r = fd_->close();
+    if (prologue(task)) task->finish(std::move(r));
+  }
+
+  base::Result tell(int64_t* out) {
+    auto lock = base::acquire_lock(mu_);
+    *out = pos_;
+    return base::Result();
+  }
+
+  base::Result seek(int64_t off, int whence);
+
+ private:
+  // Moves the read offset forward, keeping |kReadAhead| bytes ahead of it
+  // on their way into the page cache.
+  void advance_locked(std::size_t len) noexcept {
+    pos_ += len;
+    if (pos_ >= size_ || advised_ >= size_) return;
+    if (advised_ > pos_ + kReadAhead / 2) return;
+    const std::size_t page = ::sysconf(_SC_PAGESIZE);
+    std::size_t begin = std::max(advised_, std::size_t(pos_)) & ~(page - 1);
+    std::size_t end = std::min(std::size_t(pos_) + kReadAhead, size_);
+    ::madvise(const_cast<char*>(base_) + begin, end - begin, MADV_WILLNEED);
+    advised_ = end;
+  }
+
+  void send_to(event::Task* task, std::size_t* n, std::size_t max,
+               const io::Writer& w, const base::Options& opts);
+
+  struct WriteToHelper;  // forward declaration
+
+  const base::FD fd_;
+  const io::Reader fdr_;  // for write_to() via sendfile(2)
+  const char* const base_;
+  const std::size_t size_;
+  mutable std::mutex mu_;
+  uint64_t pos_;         // protected by mu_
+  std::size_t advised_;  // protected by mu_
+  bool closed_;          // protected by mu_
+};
+
+std::shared_ptr<MappedReader> MappedReader::make(base::FD fd) {
+  auto fdpair = fd->acquire_fd();
+  struct stat st;
+  ::bzero(&st, sizeof(st));
+  if (::fstat(fdpair.first, &st) != 0) return nullptr;
+  if (!S_ISREG(st.st_mode) || st.st_size <= 0) return nullptr;
+  if (uint64_t(st.st_size) > uint64_t(SIZE_MAX)) return nullptr;
+
+  std::size_t len = st.st_size;
+  void* ptr = ::mmap(nullptr, len, PROT_READ, MAP_SHARED, fdpair.first, 0);
+  if (ptr == MAP_FAILED) {
+    int err_no = errno;
+    VLOG(4) << "file::MappedReader: mmap(2) failed: "
+            << base::Result::from_errno(err_no, "mmap(2)");
+    return nullptr;
+  }
+  ::madvise(ptr, len, MADV_SEQUENTIAL);
+  fdpair.second.unlock();
+
+  auto mr = std::make_shared<MappedReader>(std::move(fd),
+                                           static_cast<const char*>(ptr), len);
+  auto lock = base::acquire_lock(mr->mu_);
+  mr->advance_locked(0);
+  return mr;
+}
+
+void MappedReader::read(event::Task* task, char* out, std::size_t* n,
+                        std::size_t min, std::size_t max,
+                        const base::Options& opts) {
+  if (!prologue(task, out, n, min, max)) return;
+
+  auto lock = base::acquire_lock(mu_);
+  if (closed_) {
+    lock.unlock();
+    task->finish(io::reader_closed());
+    return;
+  }
+
+  if (pos_ < size_) {
+    std::size_t len = std::min(max, std::size_t(size_ - pos_));
+    ::memcpy(out, base_ + pos_, len);
+    advance_locked(len);
+    *n = len;
+  }
+
+  // The file may have grown since it was mapped.  The pread(2) happens
+  // without |mu_|, and the read offset only moves past what it read if
+  // nothing else moved it in the meantime.
+  base::Result r;
+  if (*n < max && pos_ >= size_) {
+    const uint64_t start = pos_;
+    lock.unlock();
+    uint64_t off = start;
+    auto fdpair = fd_->acquire_fd();
+    while (*n < max) {
+      ssize_t len = ::pread(fdpair.first, out + *n, max - *n, off);
+      if (len < 0) {
+        int err_no = errno;
+        if (err_no == EINTR) continue;
+        r = base::Result::from_errno(err_no, "pread(2)");
+        break;
+      }
+      if (len == 0) break;
+      *n += len;
+      off += len;
+    }
+    fdpair.second.unlock();
+    lock.lock();
+    if (pos_ == start) pos_ = off;
+  }
+  lock.unlock();
+
+  if (r && *n < min) r = base::Result::eof();
+  task->finish(std::move(r));
+}
+
+// Writes straight out of the mapping, starting from the read offset as it
+// was when the write began.  Once the write is done, the read offset moves
+// past whatever was written, unless a read or seek moved it in the meantime.
+//
+// If |w| has a file descriptor, the copy is instead left to the FDReader,
+// starting from the read offset, and the read offset moves past whatever
+// it copied.
+struct MappedReader::WriteToHelper {
+  event::Task* const task;
+  std::size_t* const n;
+  const uint64_t start;
+  const std::shared_ptr<MappedReader> self;
+  event::Task subtask;
+
+  WriteToHelper(event::Task* t, std::size_t* n, uint64_t start,
+                std::shared_ptr<MappedReader> s) noexcept
+      : task(t), n(n), start(start), self(std::move(s)) {}
+};
+
+// The read offset of the FDReader is the descriptor's own offset, which
+// MappedReader doesn't otherwise use.
+void MappedReader::send_to(event::Task* task, std::size_t* n,
+                           std::size_t max, const io::Writer& w,
+                           const base::Options& opts) {
+  auto lock = base::acquire_lock(mu_);
+  auto fdpair = fd_->acquire_fd();
+  off_t off = ::lseek(fdpair.first, pos_, SEEK_SET);
+  int err_no = errno;
+  fdpair.second.unlock();
+  if (off < 0) {
+    lock.unlock();
+    task->finish(base::Result::from_errno(err_no, "lseek(2)"));
+    return;
+  }
+  lock.unlock();
+
+  auto* h = new WriteToHelper(task, n, 0, shared_from_this());
+  task->add_subtask(&h->subtask);
+  fdr_.write_to(&h->subtask, n, max, w, opts);
+  h->subtask.on_finished(event::callback([h] {
+    auto lock = base::acquire_lock(h->self->mu_);
+    h->self->pos_ += *h->n;
+    h->self->advised_ = 0;
+    h->self->advance_locked(0);
+    lock.unlock();
+    event::propagate_result(h->task, &h->subtask);
+    delete h;
+    return base::Result();
+  }));
+}
+
+void MappedReader::write_to(event::Task* task, std::size_t* n,
+                            std::size_t max, const io::Writer& w,
+                            const base::Options& opts) {
+  if (!prologue(task, n, max, w)) return;
+
+  auto lock = base::acquire_lock(mu_);
+  if (closed_) {
+    lock.unlock();
+    task->finish(io::reader_closed());
+    return;
+  }
+  if (w.implementation()->internal_writerfd()) {
+    lock.unlock();
+    send_to(task, n, max, w, opts);
+    return;
+  }
+  if (pos_ >= size_) {
+    // Past the end of the mapping; let the generic copy loop use read().
+    lock.unlock();
+    ReaderImpl::write_to(task, n, max, w, opts);
+    return;
+  }
+  const uint64_t start = pos_;
+  const char* ptr = base_ + start;
+  std::size_t len = std::min(max, std::size_t(size_ - start));
+  lock.unlock();
+
+  auto* h = new WriteToHelper(task, n, start, shared_from_this());
+  task->add_subtask(&h->subtask);
+  w.write(&h->subtask, n, ptr, len, opts);
+  h->subtask.on_finished(event::callback([h] {
+    auto lock = base::acquire_lock(h->self->mu_);
+    if (h->self->pos_ == h->start) h->self->advance_locked(*h->n);
+    lock.unlock();
+    event::propagate_result(h->task, &h->subtask);
+    delete h;
+    return base::Result();
+  }));
+}
+
+base::Result MappedReader::seek(int64_t off, int whence) {
+  auto lock = base::acquire_lock(mu_);
+  int64_t origin = 0;
+  switch (whence) {
+    case SEEK_CUR:
+      origin = pos_;
+      break;
+
+    case SEEK_END: {
+      struct stat st;
+      ::bzero(&st, sizeof(st));
+      auto fdpair = fd_->acquire_fd();
+      if (::fstat(fdpair.first, &st) != 0) {
+        int err_no = errno;
+        return base::Result::from_errno(err_no, "fstat(2)");
+      }
+      origin = st.st_size;
+      break;
+    }
+  }
+  if (origin + off < 0) {
+    return base::Result::invalid_argument("seek to negative offset");
+  }
+  pos_ = origin + off;
+  advised_ = 0;
+  advance_locked(0);
+  return base::Result();
 }
 
 class FDFile : public FileImpl {
  public:
-  FDFile(FileSystemPtr fs, std::string path, Mode mode, base::FD fd) noexcept
+  FDFile(FileSystemPtr fs, std::string path, Mode mode, base::FD fd,
+         std::shared_ptr<MappedReader> mr, io::Reader r, io::Writer w,
+         bool direct) noexcept
       : FileImpl(std::move(fs), std::move(path), mode),
         fd_(std::move(fd)),
-        r_(io::fdreader(fd_)),
-        w_(io::fdwriter(fd_)) {}
+        mr_(std::move(mr)),
+        r_(std::move(r)),
+        w_(std::move(w)),
+        direct_(direct) {}
 
   io::Reader reader() override { return r_; }
   io::Writer writer() override { return w_; }
@@ -100,12 +422,28 @@ class FDFile : public FileImpl {
   void truncate_at(event::Task* task, int64_t off,
                    const base::Options& opts) override;
 
+  void read_at(event::Task* task, char* out, std::size_t* n, std::size_t min,
+               std::size_t max, int64_t off,
+               const base::Options& opts) const override;
+
+  void read_at(event::Task* task, std::vector<ReadRange>* ranges,
+               const base::Options& opts) const override;
+
+  void write_at(event::Task* task, std::size_t* n, const char* ptr,
+                std::size_t len, int64_t off,
+                const base::Options& opts) override;
+
+  void write_at(event::Task* task, std::vector<WriteRange>* ranges,
+                const base::Options& opts) override;
+
   void close(event::Task* task, const base::Options& opts) override;
 
  private:
   base::FD fd_;
+  std::shared_ptr<MappedReader> mr_;
   io::Reader r_;
   io::Writer w_;
+  bool direct_;
 };
 
 void FDFile::readdir(event::Task* task, std::vector<DirEntry>* out,
@@ -196,6 +534,15 @@ void FDFile::tell(event::Task* task, int64_t* out,
   CHECK_NOTNULL(out);
   if (!task->start()) return;
 
+  if (mr_) {
+    task->finish(mr_->tell(out));
+    return;
+  }
+  if (direct_) {
+    task->finish(no_direct_seek());
+    return;
+  }
+
   off_t tmp = -1;
   base::Result r = base::seek(&tmp, fd_, 0, SEEK_CUR);
   *out = tmp;
@@ -300,7 +647,13 @@ void FDFile::set_stat(event::Task* task, const SetStat& delta,
 void FDFile::seek(event::Task* task, int64_t off, Whence whence,
                   const base::Options& opts) {
   CHECK_NOTNULL(task);
-  base::Result r = base::seek(nullptr, fd_, off, system_whence(whence));
+  base::Result r;
+  if (mr_)
+    r = mr_->seek(off, system_whence(whence));
+  else if (direct_)
+    r = no_direct_seek();
+  else
+    r = base::seek(nullptr, fd_, off, system_whence(whence));
   if (task->start()) task->finish(std::move(r));
 }
 
@@ -319,15 +672,113 @@ void FDFile::truncate_at(event::Task* task, int64_t off,
   task->finish(std::move(r));
 }
 
+void FDFile::read_at(event::Task* task, char* out, std::size_t* n,
+                     std::size_t min, std::size_t max, int64_t off,
+                     const base::Options& opts) const {
+  if (!io::ReaderImpl::prologue(task, out, n, min, max)) return;
+
+  base::Result r = pread_all(n, fd_, out, max, off);
+  if (r && *n < min) r = base::Result::eof();
+  task->finish(std::move(r));
+}
+
+void FDFile::read_at(event::Task* task, std::vector<ReadRange>* ranges,
+                     const base::Options& opts) const {
+  CHECK_NOTNULL(task);
+  CHECK_NOTNULL(ranges);
+  if (!task->start()) return;
+
+  base::Result r;
+  for (auto& range : *ranges) {
+    r = pread_all(&range.n, fd_, range.out, range.len, range.offset);
+    if (!r) break;
+  }
+  task->finish(std::move(r));
+}
+
+void FDFile::write_at(event::Task* task, std::size_t* n, const char* ptr,
+                      std::size_t len, int64_t off,
+                      const base::Options& opts) {
+  if (!io::WriterImpl::prologue(task, n, ptr, len)) return;
+  task->finish(pwrite_all(n, fd_, ptr, len, off));
+}
+
+void FDFile::write_at(event::Task* task, std::vector<WriteRange>* ranges,
+                      const base::Options& opts) {
+  CHECK_NOTNULL(task);
+  CHECK_NOTNULL(ranges);
+  if (!task->start()) return;
+
+  base::Result r;
+  for (auto& range : *ranges) {
+    r = pwrite_all(&range.n, fd_, range.ptr, range.len, range.offset);
+    if (!r) break;
+  }
+  task->finish(std::move(r));
+}
+
 void FDFile::close(event::Task* task, const base::Options& opts) {
   CHECK_NOTNULL(task);
 
-  auto r = fd_->close();
-  if (task->start()) task->finish(std::move(r));
+  if (!direct_ || !mode().write()) {
+    base::Result r = fd_->close();
+    if (task->start()) task->finish(std::move(r));
+    return;
+  }
+
+  // The direct writer may still hold the file's final partial block, so the
+  // descriptor is closed once that has been flushed.
+  struct Helper {
+    event::Task* const task;
+    const base::FD fd;
+    event::Task subtask;
+
+    Helper(event::Task* t, base::FD fd) noexcept : task(t), fd(std::move(fd)) {}
+  };
+
+  auto* h = new Helper(task, fd_);
+  w_.flush(&h->subtask, opts);
+  h->subtask.on_finished(event::callback([h] {
+    base::Result r = h->subtask.result().and_then(h->fd->close());
+    if (h->task->start()) h->task->finish(std::move(r));
+    delete h;
+    return base::Result();
+  }));
 }
 
 }  // anonymous namespace
 
+FileType filetype_from_mode(mode_t mode) noexcept {
+  if (S_ISREG(mode)) return FileType::regular;
+  if (S_ISDIR(mode)) return FileType::directory;
+  if (S_ISCHR(mode)) return FileType::char_device;
+  if (S_ISBLK(mode)) return FileType::block_device;
+  if (S_ISFIFO(mode)) return FileType::fifo;
+  if (S_ISSOCK(mode)) return FileType::socket;
+  if (S_ISLNK(mode)) return FileType::symbolic_link;
+  return FileType::unknown;
+}
+
+FileType filetype_from_dtype(unsigned char dt) noexcept {
+  switch (dt) {
+    case DT_REG:
+      return FileType::regular;
+    case DT_DIR:
+      return FileType::directory;
+    case DT_CHR:
+      return FileType::char_device;
+    case DT_BLK:
+      return FileType::block_device;
+    case DT_FIFO:
+      return FileType::fifo;
+    case DT_SOCK:
+      return FileType::socket;
+    case DT_LNK:
+      return FileType::symbolic_link;
+  }
+  return FileType::unknown;
+}
+
 base::Result convert_statfs(StatFS* out, const struct statfs& f) {
   StatFS tmp;
   tmp.optimal_block_size = f.f_bsize;
@@ -366,9 +817,34 @@ base::Result convert_stat(Stat* out, const struct stat& st) {
   return base::Result();
 }
 
-File fdfile(FileSystemPtr fs, std::string path, Mode mode, base::FD fd) {
+File fdfile(FileSystemPtr fs, std::string path, Mode mode, base::FD fd,
+           const base::Options& opts) {
+  // Only files opened read-only are mapped, so that the mapping and
+  // the read offset can't be disturbed by writes through this File.
+  std::shared_ptr<MappedReader> mr;
+  const file::Options& fo = opts;
+  if (fo.mmap_reads && !fo.direct_io && mode.read() && !mode.write()) {
+    mr = MappedReader::make(fd);
+  }
+
+  io::Reader r;
+  io::Writer w;
+  if (mr) {
+    r = io::Reader(mr);
+  } else if (fo.direct_io && mode.read()) {
+    r = directreader(fd);
+  } else {
+    r = io::fdreader(fd);
+  }
+  if (fo.direct_io && mode.write()) {
+    w = directwriter(fd);
+  } else {
+    w = io::fdwriter(fd);
+  }
   return File(std::make_shared<FDFile>(std::move(fs), std::move(path), mode,
-                                       std::move(fd)));
+                                       std::move(fd), std::move(mr),
+                                       std::move(r), std::move(w),
+                                       fo.direct_io));
 }
 
 }  // namespace file
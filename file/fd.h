@@ -19,7 +19,19 @@ namespace file {
 base::Result convert_statfs(StatFS* out, const struct statfs& f);
 base::Result convert_stat(Stat* out, const struct stat& st);
 
-File fdfile(FileSystemPtr fs, std::string path, Mode mode, base::FD fd);
+// Maps |st_mode| from stat(2), or |d_type| from getdents64(2), to a FileType.
+FileType filetype_from_mode(mode_t mode) noexcept;
+FileType filetype_from_dtype(unsigned char dt) noexcept;
+
+// Returns a File wrapping |fd|.
+// - If |file::Options::mmap_reads| is set and |fd| is a regular file opened
+//   read-only, then its reader serves reads from a memory mapping
+// - If |file::Options::direct_io| is set, then its reader and writer go
+//   through aligned buffers; see file/direct.h.  The direct reader and
+//   writer keep their own offsets, so seek() and tell() fail with
+//   NOT_IMPLEMENTED
+File fdfile(FileSystemPtr fs, std::string path, Mode mode, base::FD fd,
+            const base::Options& opts = base::default_options());
 
 }  // namespace file
 
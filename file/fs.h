@@ -7,6 +7,7 @@
 
 #include <memory>
 #include <string>
+#include <vector>
 
 #include "base/result.h"
 #include "event/task.h"
@@ -26,6 +27,32 @@ enum class Whence : uint8_t {
   end = 2,
 };
 
+// ReadRange describes one range of a positional read.
+struct ReadRange {
+  int64_t offset;   // offset in the file to read from
+  char* out;        // buffer to read into
+  std::size_t len;  // number of bytes to read
+  std::size_t n;    // number of bytes actually read
+
+  ReadRange(int64_t off, char* o, std::size_t l) noexcept : offset(off),
+                                                            out(o),
+                                                            len(l),
+                                                            n(0) {}
+};
+
+// WriteRange describes one range of a positional write.
+struct WriteRange {
+  int64_t offset;   // offset in the file to write to
+  const char* ptr;  // buffer to write from
+  std::size_t len;  // number of bytes to write
+  std::size_t n;    // number of bytes actually written
+
+  WriteRange(int64_t off, const char* p, std::size_t l) noexcept : offset(off),
+                                                                   ptr(p),
+                                                                   len(l),
+                                                                   n(0) {}
+};
+
 class File;            // forward declaration
 class FileImpl;        // forward declaration
 class FileSystemImpl;  // forward declaration
@@ -188,6 +215,28 @@ class FileImpl {
   virtual void truncate_at(event::Task* task, int64_t off,
                            const base::Options& opts) = 0;
 
+  // Positional I/O.  These neither use nor move the offset shared by
+  // |reader()|, |writer()|, |seek()|, and |tell()|, so any number of them
+  // may run in parallel against the same File.
+  //
+  // |read_at| follows the contract of |io::Reader::read|, but reads from
+  // offset |off|.  The batched form reads each range in turn; a range comes
+  // up short (|n < len|) only at the end of the file.
+  //
+  // |write_at| writes all |len| bytes at offset |off|, or fails.  Files
+  // opened in append mode may ignore |off|.
+  //
+  virtual void read_at(event::Task* task, char* out, std::size_t* n,
+                       std::size_t min, std::size_t max, int64_t off,
+                       const base::Options& opts) const = 0;
+  virtual void read_at(event::Task* task, std::vector<ReadRange>* ranges,
+                       const base::Options& opts) const = 0;
+  virtual void write_at(event::Task* task, std::size_t* n, const char* ptr,
+                        std::size_t len, int64_t off,
+                        const base::Options& opts) = 0;
+  virtual void write_at(event::Task* task, std::vector<WriteRange>* ranges,
+                        const base::Options& opts) = 0;
+
   virtual void close(event::Task* task, const base::Options& opts) = 0;
 
  private:
@@ -305,6 +354,32 @@ class File {
     truncate_at(task, 0, opts);
   }
 
+  void read_at(event::Task* task, char* out, std::size_t* n, std::size_t min,
+               std::size_t max, int64_t off,
+               const base::Options& opts = base::default_options()) const {
+    assert_valid();
+    ptr_->read_at(task, out, n, min, max, off, opts);
+  }
+
+  void read_at(event::Task* task, std::vector<ReadRange>* ranges,
+               const base::Options& opts = base::default_options()) const {
+    assert_valid();
+    ptr_->read_at(task, ranges, opts);
+  }
+
+  void write_at(event::Task* task, std::size_t* n, const char* ptr,
+                std::size_t len, int64_t off,
+                const base::Options& opts = base::default_options()) const {
+    assert_valid();
+    ptr_->write_at(task, n, ptr, len, off, opts);
+  }
+
+  void write_at(event::Task* task, std::vector<WriteRange>* ranges,
+                const base::Options& opts = base::default_options()) const {
+    assert_valid();
+    ptr_->write_at(task, ranges, opts);
+  }
+
   void close(event::Task* task,
              const base::Options& opts = base::default_options()) const {
     assert_valid();
@@ -384,6 +459,42 @@ class File {
     return truncate_at(0, opts);
   }
 
+  base::Result read_at(
+      char* out, std::size_t* n, std::size_t min, std::size_t max, int64_t off,
+      const base::Options& opts = base::default_options()) const {
+    event::Task task;
+    read_at(&task, out, n, min, max, off, opts);
+    event::wait(io::get_manager(opts), &task);
+    return task.result();
+  }
+
+  base::Result read_at(
+      std::vector<ReadRange>* ranges,
+      const base::Options& opts = base::default_options()) const {
+    event::Task task;
+    read_at(&task, ranges, opts);
+    event::wait(io::get_manager(opts), &task);
+    return task.result();
+  }
+
+  base::Result write_at(
+      std::size_t* n, const char* ptr, std::size_t len, int64_t off,
+      const base::Options& opts = base::default_options()) const {
+    event::Task task;
+    write_at(&task, n, ptr, len, off, opts);
+    event::wait(io::get_manager(opts), &task);
+    return task.result();
+  }
+
+  base::Result write_at(
+      std::vector<WriteRange>* ranges,
+      const base::Options& opts = base::default_options()) const {
+    event::Task task;
+    write_at(&task, ranges, opts);
+    event::wait(io::get_manager(opts), &task);
+    return task.result();
+  }
+
   base::Result close(
       const base::Options& opts = base::default_options()) const {
     event::Task task;
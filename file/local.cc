@@ -235,6 +235,12 @@ void LocalFS::open(event::Task* task, File* out, const std::string& path,
   if (fo.nofollow) flags |= O_NOFOLLOW;
   if (fo.noatime) flags |= O_NOATIME;
 
+  if (fo.direct_io && mode.write() && mode.append()) {
+    task->finish(base::Result::invalid_argument(
+        "file::Options::direct_io does not support append mode"));
+    return;
+  }
+
   std::string cleaned = path::partial_clean(path);
   Perm perm = fo.masked_create_perm();
   if (fo.open_directory && mode.create()) {
@@ -254,7 +260,7 @@ void LocalFS::open(event::Task* task, File* out, const std::string& path,
     task->finish(base::Result::from_errno(err_no, "open(2)"));
     return;
   }
-  *out = fdfile(self(), cleaned, mode, base::wrapfd(fdnum));
+  *out = fdfile(self(), cleaned, mode, base::wrapfd(fdnum), opts);
   task->finish_ok();
 }
 
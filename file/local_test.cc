@@ -8,6 +8,7 @@
 #include <sys/types.h>
 #include <unistd.h>
 #include <iostream>
+#include <thread>
 
 #include "base/cleanup.h"
 #include "base/fd.h"
@@ -16,6 +17,7 @@
 #include "file/fd.h"
 #include "file/file.h"
 #include "file/local.h"
+#include "io/util.h"
 
 TEST(LocalFS, Linker) {
   auto fs = file::system_registry().find("local");
@@ -148,5 +150,180 @@ TEST(FDFile, EndToEnd) {
   EXPECT_OK(f.close(opts));
 }
 
+TEST(FDFile, MappedReader) {
+  std::string dir;
+  ASSERT_OK(base::make_tempdir(&dir, "mojo2_file_fd_XXXXXXXX"));
+  auto cleanup = base::cleanup([&dir] { ::rmdir(dir.c_str()); });
+
+  std::string path = dir;
+  path.append("/foo");
+  auto cleanup2 = base::cleanup([&path] { ::unlink(path.c_str()); });
+
+  auto fs = file::local_filesystem();
+  base::Options opts;
+
+  std::string data;
+  for (std::size_t i = 0; i < 10000; ++i) data.push_back('a' + (i % 26));
+
+  file::File w;
+  ASSERT_OK(fs->open(&w, path, file::Mode::create_exclusive_rw_mode(), opts));
+  std::size_t n;
+  EXPECT_OK(w.writer().write(&n, data, opts));
+
+  for (bool mmap_reads : {true, false}) {
+    opts.get<file::Options>().mmap_reads = mmap_reads;
+    file::File f;
+    ASSERT_OK(fs->open(&f, path, file::Mode::ro_mode(), opts));
+
+    std::string buf(16, '\0');
+    EXPECT_OK(f.reader().read(&buf[0], &n, 16, 16, opts));
+    EXPECT_EQ(data.substr(0, 16), buf);
+
+    int64_t pos = -1;
+    EXPECT_OK(f.tell(&pos, opts));
+    EXPECT_EQ(16, pos);
+
+    EXPECT_OK(f.seek(-10, file::Whence::end, opts));
+    EXPECT_OK(f.reader().read(&buf[0], &n, 0, 16, opts));
+    EXPECT_EQ(10U, n);
+    EXPECT_EQ(data.substr(9990), buf.substr(0, n));
+
+    // Data appended after opening is still visible.
+    EXPECT_OK(w.writer().write(&n, "0123", opts));
+    EXPECT_OK(f.reader().read(&buf[0], &n, 4, 16, opts));
+    EXPECT_EQ("0123", buf.substr(0, n));
+    EXPECT_EOF(f.reader().read(&buf[0], &n, 1, 16, opts));
+    EXPECT_OK(w.truncate_at(10000, opts));
+    EXPECT_OK(w.seek(10000, file::Whence::start, opts));
+
+    EXPECT_OK(f.seek(100, file::Whence::start, opts));
+    std::string out;
+    EXPECT_OK(io::copy(&n, io::stringwriter(&out), f.reader(), opts));
+    EXPECT_EQ(data.substr(100), out);
+
+    // A copy out of the mapping that fails leaves the read offset alone.
+    if (mmap_reads) {
+      EXPECT_OK(f.seek(200, file::Whence::start, opts));
+      EXPECT_FALSE(io::copy(&n, io::fullwriter(), f.reader(), opts));
+      EXPECT_OK(f.tell(&pos, opts));
+      EXPECT_EQ(200, pos);
+    }
+
+    // Copies to a descriptor go through sendfile(2), from the read offset.
+    base::Pipe pipe;
+    ASSERT_OK(base::make_pipe(&pipe));
+    EXPECT_OK(f.seek(9000, file::Whence::start, opts));
+    EXPECT_OK(io::copy(&n, io::fdwriter(pipe.write), f.reader(), opts));
+    EXPECT_EQ(1000U, n);
+    EXPECT_OK(f.tell(&pos, opts));
+    EXPECT_EQ(10000, pos);
+    out.assign(1000, '\0');
+    auto pair = pipe.read->acquire_fd();
+    EXPECT_EQ(1000, ::read(pair.first, &out[0], out.size()));
+    pair.second.unlock();
+    EXPECT_EQ(data.substr(9000), out);
+
+    EXPECT_OK(f.close(opts));
+  }
+  EXPECT_OK(w.close(opts));
+}
+
+TEST(FDFile, PositionalIO) {
+  std::string dir;
+  ASSERT_OK(base::make_tempdir(&dir, "mojo2_file_fd_XXXXXXXX"));
+  auto cleanup = base::cleanup([&dir] { ::rmdir(dir.c_str()); });
+
+  std::string path = dir;
+  path.append("/foo");
+  auto cleanup2 = base::cleanup([&path] { ::unlink(path.c_str()); });
+
+  auto fs = file::local_filesystem();
+  base::Options opts;
+
+  file::File f;
+  ASSERT_OK(fs->open(&f, path, file::Mode::create_exclusive_rw_mode(), opts));
+
+  constexpr std::size_t kBlock = 4096;
+  constexpr std::size_t kNumBlocks = 16;
+  std::vector<std::string> blocks;
+  std::vector<file::WriteRange> writes;
+  for (std::size_t i = 0; i < kNumBlocks; ++i) {
+    blocks.emplace_back(kBlock, 'a' + i);
+  }
+  for (std::size_t i = 0; i < kNumBlocks; ++i) {
+    writes.emplace_back(i * kBlock, blocks[i].data(), kBlock);
+  }
+  EXPECT_OK(f.write_at(&writes, opts));
+
+  int64_t off = -1;
+  EXPECT_OK(f.tell(&off, opts));
+  EXPECT_EQ(0, off);
+
+  // Many threads read blocks of the same File at once.
+  std::vector<std::thread> threads;
+  for (std::size_t t = 0; t < 4; ++t) {
+    threads.emplace_back([&f, &blocks, &opts, t] {
+      std::string buf(kBlock, '\0');
+      for (std::size_t i = t; i < kNumBlocks; i += 4) {
+        std::size_t n = 0;
+        EXPECT_OK(f.read_at(&buf[0], &n, kBlock, kBlock, i * kBlock, opts));
+        EXPECT_EQ(blocks[i], buf);
+      }
+    });
+  }
+  for (auto& t : threads) t.join();
+
+  char a[4], b[4];
+  std::vector<file::ReadRange> reads;
+  reads.emplace_back(kBlock - 2, a, sizeof(a));
+  reads.emplace_back(kNumBlocks * kBlock - 2, b, sizeof(b));
+  EXPECT_OK(f.read_at(&reads, opts));
+  EXPECT_EQ("aabb", std::string(a, reads[0].n));
+  EXPECT_EQ("pp", std::string(b, reads[1].n));
+
+  EXPECT_OK(f.close(opts));
+}
+
 static void init() __attribute__((constructor));
 static void init() { base::log_stderr_set_level(VLOG_LEVEL(6)); }
+
+TEST(FDFile, DirectIO) {
+  std::string dir;
+  ASSERT_OK(base::make_tempdir(&dir, "mojo2_file_fd_XXXXXXXX"));
+  auto cleanup = base::cleanup([&dir] { ::rmdir(dir.c_str()); });
+
+  std::string path = dir;
+  path.append("/foo");
+  auto cleanup2 = base::cleanup([&path] { ::unlink(path.c_str()); });
+
+  auto fs = file::local_filesystem();
+  base::Options opts;
+  opts.get<file::Options>().direct_io = true;
+
+  // Append mode can't be honored, so it's refused up front.
+  file::File f;
+  EXPECT_EQ(base::ResultCode::INVALID_ARGUMENT,
+            fs->open(&f, path, file::Mode::create_ao_mode(), opts).code());
+
+  // Not every filesystem takes O_DIRECT, but the direct writer works the
+  // same on a plain descriptor.
+  int fdnum = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  ASSERT_GE(fdnum, 0);
+  f = file::fdfile(fs, path, file::Mode::rw_mode(), base::wrapfd(fdnum), opts);
+  std::size_t n;
+  EXPECT_OK(f.writer().write(&n, "hello", opts));
+
+  // The descriptor's offset isn't the direct writer's.
+  int64_t pos = -1;
+  EXPECT_EQ(base::ResultCode::NOT_IMPLEMENTED, f.tell(&pos, opts).code());
+  EXPECT_EQ(base::ResultCode::NOT_IMPLEMENTED,
+            f.seek(0, file::Whence::start, opts).code());
+
+  // Closing flushes the final partial block.
+  EXPECT_OK(f.close(opts));
+  ASSERT_OK(fs->open(&f, path, file::Mode::ro_mode(), base::Options()));
+  std::string out;
+  EXPECT_OK(io::copy(&n, io::stringwriter(&out), f.reader()));
+  EXPECT_EQ("hello", out);
+  EXPECT_OK(f.close());
+}
@@ -3,10 +3,17 @@
 
 #include "file/mem.h"
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <functional>
 #include <limits>
 #include <map>
 #include <stdexcept>
 #include <tuple>
+#include <unordered_map>
 #include <vector>
 
 #include "base/cleanup.h"
@@ -62,9 +69,99 @@ struct Inode;
 using InodePtr = std::shared_ptr<Inode>;
 using Tuple = std::tuple<std::string, InodePtr, InodePtr>;
 
+// Pages holds the bytes of a regular file as a list of fixed-size pages, so
+// that growing a file never copies the bytes already in it.  Pages that have
+// never been written aren't allocated, and read back as zeroes.
+class Pages {
+ public:
+  static constexpr std::size_t kPageSize = std::size_t(64) << 10;  // 64 KiB
+
+  // Files can't grow past this size, so that a write at a wild offset fails
+  // with EFBIG instead of exhausting memory.
+  static constexpr std::size_t kMaxSize = std::size_t(64) << 30;  // 64 GiB
+
+  Pages() noexcept : size_(0) {}
+
+  std::size_t size() const noexcept { return size_; }
+
+  void clear() noexcept {
+    pages_.clear();
+    size_ = 0;
+  }
+
+  // Grows the file with zeroes, or shrinks it, to exactly |n| bytes.
+  // - Returns EFBIG if |n| exceeds |kMaxSize|
+  base::Result resize(uint64_t n);
+
+  // Copies up to |len| bytes at |pos| into |out|.  Returns the number of
+  // bytes copied, which is short only at the end of the file.
+  std::size_t read(char* out, std::size_t len, std::size_t pos) const;
+
+  // Copies |len| bytes from |ptr| to |pos|, growing the file if needed.
+  // - Returns EFBIG if the file would grow past |kMaxSize|
+  base::Result write(const char* ptr, std::size_t len, uint64_t pos);
+
+ private:
+  std::vector<std::unique_ptr<char[]>> pages_;
+  std::size_t size_;
+};
+
+constexpr std::size_t Pages::kPageSize;
+constexpr std::size_t Pages::kMaxSize;
+
+static base::Result too_big() {
+  return base::Result::from_errno(EFBIG, "file::MemFile: file too large");
+}
+
+base::Result Pages::resize(uint64_t n) {
+  if (n > kMaxSize) return too_big();
+  if (n < size_) {
+    // Zero the rest of the new last page, so that regrowing the file later
+    // reads back zeroes there.
+    std::size_t off = n % kPageSize;
+    auto& page = pages_[n / kPageSize];
+    if (off != 0 && page) ::bzero(page.get() + off, kPageSize - off);
+  }
+  pages_.resize((n + kPageSize - 1) / kPageSize);
+  size_ = n;
+  return base::Result();
+}
+
+std::size_t Pages::read(char* out, std::size_t len, std::size_t pos) const {
+  if (pos >= size_) return 0;
+  if (len > size_ - pos) len = size_ - pos;
+  std::size_t n = 0;
+  while (n < len) {
+    std::size_t off = (pos + n) % kPageSize;
+    std::size_t count = std::min(len - n, kPageSize - off);
+    const auto& page = pages_[(pos + n) / kPageSize];
+    if (page)
+      ::memcpy(out + n, page.get() + off, count);
+    else
+      ::bzero(out + n, count);
+    n += count;
+  }
+  return len;
+}
+
+base::Result Pages::write(const char* ptr, std::size_t len, uint64_t pos) {
+  if (pos > kMaxSize || len > kMaxSize - pos) return too_big();
+  if (pos + len > size_) resize(pos + len).expect_ok(__FILE__, __LINE__);
+  std::size_t n = 0;
+  while (n < len) {
+    std::size_t off = (pos + n) % kPageSize;
+    std::size_t count = std::min(len - n, kPageSize - off);
+    auto& page = pages_[(pos + n) / kPageSize];
+    if (!page) page.reset(new char[kPageSize]());
+    ::memcpy(page.get() + off, ptr + n, count);
+    n += count;
+  }
+  return base::Result();
+}
+
 struct Inode {
-  using Bytes = std::vector<char>;
-  using DEntryMap = std::map<std::string, InodePtr>;
+  using Bytes = Pages;
+  using DEntryMap = std::unordered_map<std::string, InodePtr>;
 
   const FileType type;
   mutable std::mutex mu;
@@ -130,6 +227,57 @@ struct Resolver {
   base::Result run();
 };
 
+// The outcome of resolving a path: the last entry on the Resolver's stack.
+struct Lookup {
+  std::string name;
+  InodePtr parent;
+  InodePtr inode;
+  std::string canonical;
+  std::size_t depth;
+  bool trailing_slashes;
+
+  Lookup() noexcept : depth(0), trailing_slashes(false) {}
+};
+
+// LookupCache remembers successful lookups, so that hot paths can skip the
+// walk from the root.  It is split into shards, each with its own lock.
+//
+// Entries are tagged with the filesystem's generation at the time of the
+// lookup, and are ignored once the generation moves on.
+class LookupCache {
+ public:
+  static constexpr std::size_t kNumShards = 16;
+  static constexpr std::size_t kMaxEntriesPerShard = 1024;
+
+  bool find(Lookup* out, const std::string& key, uint64_t gen) const;
+  void insert(const std::string& key, const Lookup& lookup, uint64_t gen);
+
+ private:
+  struct Entry {
+    std::string name;
+    std::weak_ptr<Inode> parent;
+    std::weak_ptr<Inode> inode;
+    std::string canonical;
+    std::size_t depth;
+    bool trailing_slashes;
+    uint64_t gen;
+  };
+
+  struct Shard {
+    mutable std::mutex mu;
+    std::unordered_map<std::string, Entry> map;
+  };
+
+  Shard& shard(const std::string& key) const {
+    return shards_[std::hash<std::string>()(key) % kNumShards];
+  }
+
+  mutable std::array<Shard, kNumShards> shards_;
+};
+
+constexpr std::size_t LookupCache::kNumShards;
+constexpr std::size_t LookupCache::kMaxEntriesPerShard;
+
 struct Descriptor {
   InodePtr inode;
   std::size_t pos;
@@ -188,7 +336,9 @@ class DescriptorWriter : public io::WriterImpl {
 class MemFS : public FileSystemImpl {
  public:
   explicit MemFS(std::string name, InodePtr root)
-      : FileSystemImpl(std::move(name)), root_(CHECK_NOTNULL(std::move(root))) {
+      : FileSystemImpl(std::move(name)),
+        root_(CHECK_NOTNULL(std::move(root))),
+        generation_(0) {
     CHECK_EQ(root_->type, FileType::directory);
     auto lock = base::acquire_lock(root_->mu);
     root_->nlinks++;
@@ -225,7 +375,19 @@ class MemFS : public FileSystemImpl {
   }
 
  private:
+  // Resolves |path| as |fo.user| and |fo.group|, consulting the cache first.
+  base::Result lookup(Lookup* out, const std::string& path,
+                      const file::Options& fo, bool missing_ok) const;
+
+  // Invalidates every cached lookup.  Called whenever a change to the tree
+  // could alter the outcome of a successful lookup, e.g. unlinking.
+  void bump_generation() noexcept {
+    generation_.fetch_add(1, std::memory_order_acq_rel);
+  }
+
   InodePtr root_;
+  mutable LookupCache cache_;
+  std::atomic<uint64_t> generation_;
 };
 
 class MemFile : public FileImpl {
@@ -263,6 +425,20 @@ class MemFile : public FileImpl {
   void truncate_at(event::Task* task, int64_t off,
                    const base::Options& opts) override;
 
+  void read_at(event::Task* task, char* out, std::size_t* n, std::size_t min,
+               std::size_t max, int64_t off,
+               const base::Options& opts) const override;
+
+  void read_at(event::Task* task, std::vector<ReadRange>* ranges,
+               const base::Options& opts) const override;
+
+  void write_at(event::Task* task, std::size_t* n, const char* ptr,
+                std::size_t len, int64_t off,
+                const base::Options& opts) override;
+
+  void write_at(event::Task* task, std::vector<WriteRange>* ranges,
+                const base::Options& opts) override;
+
   void close(event::Task* task, const base::Options& opts) override;
 
   static File make(FileSystemPtr fs, std::string path, Mode mode,
@@ -272,6 +448,10 @@ class MemFile : public FileImpl {
   }
 
  private:
+  base::Result check_locked(bool write) const;
+  std::size_t read_locked(char* out, std::size_t len, int64_t off) const;
+  base::Result write_locked(const char* ptr, std::size_t len, int64_t off);
+
   Descriptor desc_;
   io::Reader r_;
   io::Writer w_;
@@ -420,6 +600,43 @@ base::Result Resolver::run() {
   return base::Result();
 }
 
+bool LookupCache::find(Lookup* out, const std::string& key,
+                       uint64_t gen) const {
+  auto& s = shard(key);
+  auto lock = base::acquire_lock(s.mu);
+  auto it = s.map.find(key);
+  if (it == s.map.end()) return false;
+  const Entry& e = it->second;
+  if (e.gen != gen) return false;
+  InodePtr inode = e.inode.lock();
+  InodePtr parent = e.parent.lock();
+  if (!inode || (e.depth > 1 && !parent)) return false;
+  out->name = e.name;
+  out->parent = std::move(parent);
+  out->inode = std::move(inode);
+  out->canonical = e.canonical;
+  out->depth = e.depth;
+  out->trailing_slashes = e.trailing_slashes;
+  return true;
+}
+
+void LookupCache::insert(const std::string& key, const Lookup& lookup,
+                         uint64_t gen) {
+  auto& s = shard(key);
+  auto lock = base::acquire_lock(s.mu);
+  if (s.map.size() >= kMaxEntriesPerShard && s.map.count(key) == 0) {
+    s.map.clear();
+  }
+  Entry& e = s.map[key];
+  e.name = lookup.name;
+  e.parent = lookup.parent;
+  e.inode = lookup.inode;
+  e.canonical = lookup.canonical;
+  e.depth = lookup.depth;
+  e.trailing_slashes = lookup.trailing_slashes;
+  e.gen = gen;
+}
+
 void DescriptorReader::read(event::Task* task, char* out, std::size_t* n,
                             std::size_t min, std::size_t max,
                             const base::Options& opts) {
@@ -437,12 +654,8 @@ void DescriptorReader::read(event::Task* task, char* out, std::size_t* n,
     return;
   }
 
-  auto& buf = desc_.inode->data;
   auto& pos = desc_.pos;
-  std::size_t len = 0;
-  if (buf.size() > pos) len = buf.size() - pos;
-  if (len > max) len = max;
-  ::memcpy(out, buf.data() + pos, len);
+  std::size_t len = desc_.inode->data.read(out, max, pos);
   pos += len;
   desc_.inode->access_time = base::time::now();
 
@@ -488,8 +701,12 @@ void DescriptorWriter::write(event::Task* task, std::size_t* n, const char* ptr,
   auto& buf = desc_.inode->data;
   auto& pos = desc_.pos;
   if (desc_.mode.append()) pos = buf.size();
-  if (pos + len > buf.size()) buf.resize(pos + len);
-  ::memcpy(buf.data() + pos, ptr, len);
+  base::Result r = buf.write(ptr, len, pos);
+  if (!r) {
+    lock.unlock();
+    task->finish(std::move(r));
+    return;
+  }
   pos += len;
   auto now = base::time::now();
   desc_.inode->modify_time = now;
@@ -515,6 +732,32 @@ void DescriptorWriter::close(event::Task* task, const base::Options& opts) {
   }
 }
 
+base::Result MemFS::lookup(Lookup* out, const std::string& path,
+                           const file::Options& fo, bool missing_ok) const {
+  std::string key;
+  key.reserve(fo.user.size() + fo.group.size() + path.size() + 2);
+  key.append(fo.user);
+  key.push_back('\0');
+  key.append(fo.group);
+  key.push_back('\0');
+  key.append(path);
+
+  // Read the generation first, so that an unlink racing with the walk below
+  // leaves behind an entry that is already stale.
+  uint64_t gen = generation_.load(std::memory_order_acquire);
+  if (cache_.find(out, key, gen)) return base::Result();
+
+  Resolver resolver(root_, path, fo, missing_ok);
+  base::Result r = resolver.run();
+  if (!r) return r;
+  std::tie(out->name, out->parent, out->inode) = resolver.stack.back();
+  out->canonical = std::move(resolver.canonical);
+  out->depth = resolver.stack.size();
+  out->trailing_slashes = resolver.trailing_slashes;
+  if (out->inode) cache_.insert(key, *out, gen);
+  return r;
+}
+
 void MemFS::statfs(event::Task* task, StatFS* out, const std::string& path,
                    const base::Options& opts) const {
   CHECK_NOTNULL(task);
@@ -531,19 +774,15 @@ void MemFS::stat(event::Task* task, Stat* out, const std::string& path,
   if (!task->start()) return;
   *out = Stat();
 
-  InodePtr inode;
-  {
-    Resolver resolver(root_, path, opts, false);
-    base::Result r = resolver.run();
-    if (!r) {
-      task->finish(std::move(r));
-      return;
-    }
-    std::tie(std::ignore, std::ignore, inode) = resolver.stack.back();
+  Lookup found;
+  base::Result r = lookup(&found, path, opts, false);
+  if (!r) {
+    task->finish(std::move(r));
+    return;
   }
 
-  auto lock = base::acquire_lock(inode->mu);
-  inode->stat(out);
+  auto lock = base::acquire_lock(found.inode->mu);
+  found.inode->stat(out);
   task->finish_ok();
 }
 
@@ -567,25 +806,18 @@ void MemFS::open(event::Task* task, File* out, const std::string& path,
     return;
   }
 
-  std::string name;
-  InodePtr parent;
-  InodePtr inode;
-  std::string canon;
-  bool trailing_slashes;
-  {
-    Resolver resolver(root_, path, opts, mode.create());
-    base::Result r = resolver.run();
-    if (!r) {
-      task->finish(std::move(r));
-      return;
-    }
-    std::tie(name, parent, inode) = resolver.stack.back();
-    canon = std::move(resolver.canonical);
-    trailing_slashes = resolver.trailing_slashes;
+  const file::Options& fo = opts;
+  Lookup found;
+  base::Result r = lookup(&found, path, fo, mode.create());
+  if (!r) {
+    task->finish(std::move(r));
+    return;
   }
+  const std::string& name = found.name;
+  const InodePtr& parent = found.parent;
+  InodePtr& inode = found.inode;
 
-  const file::Options& fo = opts;
-  if (trailing_slashes && !fo.open_directory) {
+  if (found.trailing_slashes && !fo.open_directory) {
     task->finish(not_a_directory());
     return;
   }
@@ -600,7 +832,10 @@ void MemFS::open(event::Task* task, File* out, const std::string& path,
     }
 
     auto& slot = parent->dentries[name];  // provoke exceptions
-    if (fo.open_directory) {
+    if (slot) {
+      // lost a race with another creator
+      inode = slot;
+    } else if (fo.open_directory) {
       inode = file::Inode::make_directory(fo);
       inode->nlinks += 2;  // parent -> inode and '.' -> inode
       parent->nlinks++;    // '..' -> parent
@@ -608,8 +843,8 @@ void MemFS::open(event::Task* task, File* out, const std::string& path,
       inode = file::Inode::make_regular(fo);
       inode->nlinks++;  // just parent -> inode
     }
+    created = !slot;
     slot = inode;
-    created = true;
   }
 
   if (mode.exclusive() && !created) {
@@ -643,7 +878,8 @@ void MemFS::open(event::Task* task, File* out, const std::string& path,
 
   if (mode.truncate()) inode->data.clear();
 
-  *out = MemFile::make(self(), canon, mode, std::move(inode));
+  *out = MemFile::make(self(), std::move(found.canonical), mode,
+                       std::move(inode));
   task->finish_ok();
 }
 
@@ -665,24 +901,24 @@ void MemFS::symlink(event::Task* task, const std::string& target,
 
 void MemFS::unlink(event::Task* task, const std::string& path,
                    const base::Options& opts) {
+  CHECK_NOTNULL(task);
+  if (!task->start()) return;
+
   const file::Options& fo = opts;
-  std::string name;
-  InodePtr parent;
-  InodePtr inode;
-  {
-    Resolver resolver(root_, path, fo, false);
-    base::Result r = resolver.run();
-    if (!r) {
-      task->finish(std::move(r));
-      return;
-    }
-    if (resolver.stack.size() == 1) {
-      task->finish(
-          base::Result::invalid_argument("cannot unlink the root directory"));
-      return;
-    }
-    std::tie(name, parent, inode) = resolver.stack.back();
+  Lookup found;
+  base::Result r = lookup(&found, path, fo, false);
+  if (!r) {
+    task->finish(std::move(r));
+    return;
+  }
+  if (found.depth == 1) {
+    task->finish(
+        base::Result::invalid_argument("cannot unlink the root directory"));
+    return;
   }
+  const std::string& name = found.name;
+  const InodePtr& parent = found.parent;
+  const InodePtr& inode = found.inode;
 
   if (fo.remove_directory) {
     if (!inode->is_directory()) {
@@ -723,6 +959,7 @@ void MemFS::unlink(event::Task* task, const std::string& path,
   }
 
   dentries.erase(it);
+  bump_generation();
   inode->nlinks--;                              // parent -> inode
   if (inode->is_directory()) parent->nlinks--;  // '..' -> parent
   task->finish_ok();
@@ -751,6 +988,10 @@ void MemFile::readdir(event::Task* task, std::vector<DirEntry>* out,
   for (const auto& pair : desc_.inode->dentries) {
     out->emplace_back(pair.first, pair.second->type);
   }
+  lock.unlock();
+
+  // The dentries are hashed; list them in a stable order.
+  std::sort(out->begin(), out->end());
   task->finish_ok();
 }
 
@@ -910,8 +1151,128 @@ void MemFile::truncate_at(event::Task* task, int64_t off,
     task->finish(no_write());
     return;
   }
-  desc_.inode->data.resize(uint64_t(off));
-  task->finish_ok();
+  task->finish(desc_.inode->data.resize(uint64_t(off)));
+}
+
+base::Result MemFile::check_locked(bool write) const {
+  if (desc_.closed) return file_closed();
+  if (desc_.inode->is_directory()) return is_a_directory();
+  if (write && !desc_.mode.write()) return no_write();
+  if (!write && !desc_.mode.read()) return no_read();
+  return base::Result();
+}
+
+std::size_t MemFile::read_locked(char* out, std::size_t len,
+                                 int64_t off) const {
+  if (off < 0) return 0;
+  return desc_.inode->data.read(out, len, off);
+}
+
+base::Result MemFile::write_locked(const char* ptr, std::size_t len,
+                                   int64_t off) {
+  auto& buf = desc_.inode->data;
+  uint64_t pos = off;
+  if (desc_.mode.append()) pos = buf.size();
+  return buf.write(ptr, len, pos);
+}
+
+void MemFile::read_at(event::Task* task, char* out, std::size_t* n,
+                      std::size_t min, std::size_t max, int64_t off,
+                      const base::Options& opts) const {
+  if (!io::ReaderImpl::prologue(task, out, n, min, max)) return;
+
+  if (off < 0) {
+    task->finish(base::Result::out_of_range("off < 0"));
+    return;
+  }
+
+  auto lock = base::acquire_lock(desc_.inode->mu);
+  auto r = check_locked(false);
+  if (r) {
+    *n = read_locked(out, max, off);
+    desc_.inode->access_time = base::time::now();
+    if (*n < min) r = base::Result::eof();
+  }
+  lock.unlock();
+  task->finish(std::move(r));
+}
+
+void MemFile::read_at(event::Task* task, std::vector<ReadRange>* ranges,
+                      const base::Options& opts) const {
+  CHECK_NOTNULL(task);
+  CHECK_NOTNULL(ranges);
+  if (!task->start()) return;
+
+  for (const auto& range : *ranges) {
+    if (range.offset < 0) {
+      task->finish(base::Result::out_of_range("off < 0"));
+      return;
+    }
+  }
+
+  auto lock = base::acquire_lock(desc_.inode->mu);
+  auto r = check_locked(false);
+  if (r) {
+    for (auto& range : *ranges) {
+      range.n = read_locked(range.out, range.len, range.offset);
+    }
+    desc_.inode->access_time = base::time::now();
+  }
+  lock.unlock();
+  task->finish(std::move(r));
+}
+
+void MemFile::write_at(event::Task* task, std::size_t* n, const char* ptr,
+                       std::size_t len, int64_t off,
+                       const base::Options& opts) {
+  if (!io::WriterImpl::prologue(task, n, ptr, len)) return;
+
+  if (off < 0) {
+    task->finish(base::Result::out_of_range("off < 0"));
+    return;
+  }
+
+  auto lock = base::acquire_lock(desc_.inode->mu);
+  auto r = check_locked(true);
+  if (r) r = write_locked(ptr, len, off);
+  if (r) {
+    *n = len;
+    auto now = base::time::now();
+    desc_.inode->modify_time = now;
+    desc_.inode->access_time = now;
+  }
+  lock.unlock();
+  task->finish(std::move(r));
+}
+
+void MemFile::write_at(event::Task* task, std::vector<WriteRange>* ranges,
+                       const base::Options& opts) {
+  CHECK_NOTNULL(task);
+  CHECK_NOTNULL(ranges);
+  if (!task->start()) return;
+
+  for (const auto& range : *ranges) {
+    if (range.offset < 0) {
+      task->finish(base::Result::out_of_range("off < 0"));
+      return;
+    }
+  }
+
+  auto lock = base::acquire_lock(desc_.inode->mu);
+  auto r = check_locked(true);
+  if (r) {
+    // Ranges before a failed one stay written, as with pwritev(2).
+    for (auto& range : *ranges) {
+      r = write_locked(range.ptr, range.len, range.offset);
+      if (!r) break;
+      range.n = range.len;
+    }
+    auto now = base::time::now();
+    desc_.inode->modify_time = now;
+    desc_.inode->access_time = now;
+  }
+  lock.unlock();
+  task->finish(std::move(r));
 }
 
 void MemFile::close(event::Task* task, const base::Options& opts) {
@@ -3,6 +3,8 @@
 
 #include "gtest/gtest.h"
 
+#include <cstdint>
+
 #include "base/result_testing.h"
 #include "file/mem.h"
 
@@ -240,3 +242,104 @@ TEST(MemFile, EndToEnd) {
   EXPECT_OK(f.tell(&off, opts));
   EXPECT_EQ(9, off);
 }
+
+TEST(MemFS, PositionalIO) {
+  base::Options opts;
+  auto fs = file::mem_filesystem("test-memfs-positional");
+
+  file::File f;
+  ASSERT_OK(fs->open(&f, "/foo", file::Mode::create_exclusive_rw_mode(),
+                     opts));
+
+  std::size_t n;
+  EXPECT_OK(f.write_at(&n, "world", 5, 7, opts));
+  EXPECT_EQ(5U, n);
+  std::vector<file::WriteRange> writes;
+  writes.emplace_back(0, "Hello", 5);
+  writes.emplace_back(5, ", ", 2);
+  EXPECT_OK(f.write_at(&writes, opts));
+  EXPECT_EQ(2U, writes[1].n);
+
+  // Positional I/O leaves the stream offset alone.
+  int64_t off = -1;
+  EXPECT_OK(f.tell(&off, opts));
+  EXPECT_EQ(0, off);
+
+  char buf[16];
+  EXPECT_OK(f.read_at(buf, &n, 5, 5, 7, opts));
+  EXPECT_EQ("world", std::string(buf, n));
+  EXPECT_EOF(f.read_at(buf, &n, 4, 4, 10, opts));
+  EXPECT_EQ("ld", std::string(buf, n));
+
+  char a[5], b[8];
+  std::vector<file::ReadRange> reads;
+  reads.emplace_back(0, a, sizeof(a));
+  reads.emplace_back(5, b, sizeof(b));
+  EXPECT_OK(f.read_at(&reads, opts));
+  EXPECT_EQ("Hello", std::string(a, reads[0].n));
+  EXPECT_EQ(", world", std::string(b, reads[1].n));
+
+  EXPECT_EQ(base::ResultCode::OUT_OF_RANGE,
+            f.read_at(buf, &n, 0, 1, -1, opts).code());
+  EXPECT_OK(f.close(opts));
+  EXPECT_FALSE(f.read_at(buf, &n, 0, 1, 0, opts));
+}
+
+TEST(MemFS, LargeFile) {
+  base::Options opts;
+  auto fs = file::mem_filesystem("test-memfs-large");
+
+  file::File f;
+  ASSERT_OK(fs->open(&f, "/foo", file::Mode::create_exclusive_rw_mode(),
+                     opts));
+
+  // Straddle the boundary between the first and second 64 KiB pages, and
+  // leave a hole before it.
+  const int64_t boundary = 65536;
+  std::size_t n;
+  EXPECT_OK(f.write_at(&n, "abcdef", 6, boundary - 3, opts));
+  EXPECT_EQ(6U, n);
+
+  int64_t size = -1;
+  EXPECT_OK(f.size(&size, opts));
+  EXPECT_EQ(boundary + 3, size);
+
+  char buf[8];
+  EXPECT_OK(f.read_at(buf, &n, 8, 8, boundary - 5, opts));
+  EXPECT_EQ(std::string("\0\0abcdef", 8), std::string(buf, n));
+
+  // Shrinking and regrowing the file must read back zeroes.
+  EXPECT_OK(f.truncate_at(boundary - 1, opts));
+  EXPECT_OK(f.write_at(&n, "z", 1, boundary + 1, opts));
+  EXPECT_OK(f.read_at(buf, &n, 5, 5, boundary - 3, opts));
+  EXPECT_EQ(std::string("ab\0\0z", 5), std::string(buf, n));
+
+  // Writes at wild offsets fail, rather than exhausting memory.
+  const int64_t huge = INT64_MAX - 2;
+  EXPECT_FALSE(f.write_at(&n, "abcdef", 6, huge, opts));
+  EXPECT_FALSE(f.truncate_at(huge, opts));
+  EXPECT_OK(f.seek(huge, file::Whence::start, opts));
+  EXPECT_FALSE(f.writer().write(&n, "abcdef", opts));
+  EXPECT_OK(f.size(&size, opts));
+  EXPECT_EQ(boundary + 2, size);
+  EXPECT_OK(f.close(opts));
+}
+
+TEST(MemFS, UnlinkInvalidatesLookups) {
+  base::Options opts;
+  auto fs = file::mem_filesystem("test-memfs-unlink");
+  ASSERT_OK(prepare_tree(fs, opts));
+
+  file::Stat st;
+  EXPECT_OK(fs->stat(&st, "/foo/bar", opts));
+  EXPECT_OK(fs->stat(&st, "/foo/bar", opts));
+  EXPECT_OK(fs->unlink("/foo/bar", opts));
+  EXPECT_NOT_FOUND(fs->stat(&st, "/foo/bar", opts));
+
+  file::File f;
+  EXPECT_OK(fs->open(&f, "/foo/bar", file::Mode::create_exclusive_wo_mode(),
+                     opts));
+  EXPECT_OK(f.close(opts));
+  EXPECT_OK(fs->stat(&st, "/foo/bar", opts));
+  EXPECT_EQ(0U, st.size);
+}
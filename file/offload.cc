@@ -0,0 +1,365 @@
+// Copyright © 2017 by Donald King <chronos@chronos-tachyon.net>
+// Available under the MIT License. See LICENSE for details.
+
+#include "file/offload.h"
+
+#include <functional>
+#include <mutex>
+
+#include "base/logging.h"
+#include "base/mutex.h"
+#include "base/time/clock.h"
+#include "base/time/time.h"
+#include "event/callback.h"
+#include "io/options.h"
+
+using base::time::Duration;
+using base::time::MonotonicTime;
+using base::time::monotonic_now;
+
+namespace file {
+
+static const char* const kOffloadOpNames[] = {
+    "statfs",           "stat",         "set_stat",      "open",
+    "link",             "symlink",      "unlink",        "file_readdir",
+    "file_statfs",      "file_stat",    "file_size",     "file_set_stat",
+    "file_truncate_at", "file_read_at", "file_write_at", "file_close",
+};
+
+const char* offloadop_name(OffloadOp op) noexcept {
+  return kOffloadOpNames[static_cast<uint8_t>(op)];
+}
+
+void append_to(std::string* out, OffloadOp op) {
+  out->append(offloadop_name(op));
+}
+
+std::size_t length_hint(OffloadOp) noexcept { return 16; }
+
+namespace {
+
+struct OffloadState {
+  const event::DispatcherPtr dispatcher;
+  mutable std::mutex mu;
+  OffloadStats stats;  // protected by mu
+
+  explicit OffloadState(event::DispatcherPtr d) noexcept
+      : dispatcher(std::move(d)) {}
+
+  void record(OffloadOp op, Duration wait, Duration latency, bool ok) {
+    auto lock = base::acquire_lock(mu);
+    auto& s = stats[op];
+    ++s.count;
+    if (!ok) ++s.failures;
+    s.total_wait += wait;
+    s.total_latency += latency;
+    if (s.max_latency < latency) s.max_latency = latency;
+  }
+};
+
+using OffloadStatePtr = std::shared_ptr<OffloadState>;
+using OffloadFunc = std::function<void(event::Task*, const base::Options&)>;
+using FixupFunc = std::function<void()>;
+
+// OffloadHelper runs one call on the blocking-I/O Dispatcher against a
+// subtask, then finishes the caller's task back on the event::Manager's
+// Dispatcher.
+struct OffloadHelper {
+  const OffloadStatePtr state;
+  const OffloadOp op;
+  event::Task* const task;
+  const base::Options options;
+  const MonotonicTime queued;
+  MonotonicTime began;
+  event::Task subtask;
+  FixupFunc fixup;
+
+  OffloadHelper(OffloadStatePtr s, OffloadOp o, event::Task* t,
+                const base::Options& opts)
+      : state(std::move(s)),
+        op(o),
+        task(t),
+        options(opts),
+        queued(monotonic_now()) {
+    task->add_subtask(&subtask);
+  }
+
+  base::Result run(const OffloadFunc& func) {
+    began = monotonic_now();
+    func(&subtask, options);
+    return base::Result();
+  }
+
+  base::Result complete() {
+    auto now = monotonic_now();
+    base::Result r = subtask.result();
+    state->record(op, began - queued, now - queued, !!r);
+    if (r && fixup) fixup();
+    task->finish(std::move(r));
+    delete this;
+    return base::Result();
+  }
+};
+
+void offload(const OffloadStatePtr& state, OffloadOp op, event::Task* task,
+             const base::Options& opts, OffloadFunc func,
+             FixupFunc fixup = nullptr) {
+  CHECK_NOTNULL(task);
+  if (!task->start()) return;
+  auto* h = new OffloadHelper(state, op, task, opts);
+  h->fixup = std::move(fixup);
+  h->subtask.on_finished(io::get_manager(opts).dispatcher(),
+                         event::callback([h] { return h->complete(); }));
+  state->dispatcher->dispatch(
+      event::callback([h, func] { return h->run(func); }));
+}
+
+class OffloadFile : public FileImpl {
+ public:
+  OffloadFile(FileSystemPtr fs, OffloadStatePtr state, FilePtr file) noexcept
+      : FileImpl(std::move(fs), file->path(), file->mode()),
+        state_(std::move(state)),
+        file_(std::move(file)) {}
+
+  io::Reader reader() override { return file_->reader(); }
+  io::Writer writer() override { return file_->writer(); }
+
+  void readdir(event::Task* task, std::vector<DirEntry>* out,
+               const base::Options& opts) const override {
+    auto f = file_;
+    offload(state_, OffloadOp::file_readdir, task, opts,
+            [f, out](event::Task* t, const base::Options& o) {
+              f->readdir(t, out, o);
+            });
+  }
+
+  void statfs(event::Task* task, StatFS* out,
+              const base::Options& opts) const override {
+    auto f = file_;
+    offload(state_, OffloadOp::file_statfs, task, opts,
+            [f, out](event::Task* t, const base::Options& o) {
+              f->statfs(t, out, o);
+            });
+  }
+
+  void stat(event::Task* task, Stat* out,
+            const base::Options& opts) const override {
+    auto f = file_;
+    offload(state_, OffloadOp::file_stat, task, opts,
+            [f, out](event::Task* t, const base::Options& o) {
+              f->stat(t, out, o);
+            });
+  }
+
+  void size(event::Task* task, int64_t* out,
+            const base::Options& opts) const override {
+    auto f = file_;
+    offload(state_, OffloadOp::file_size, task, opts,
+            [f, out](event::Task* t, const base::Options& o) {
+              f->size(t, out, o);
+            });
+  }
+
+  void tell(event::Task* task, int64_t* out,
+            const base::Options& opts) const override {
+    file_->tell(task, out, opts);
+  }
+
+  void set_stat(event::Task* task, const SetStat& delta,
+                const base::Options& opts) override {
+    auto f = file_;
+    offload(state_, OffloadOp::file_set_stat, task, opts,
+            [f, delta](event::Task* t, const base::Options& o) {
+              f->set_stat(t, delta, o);
+            });
+  }
+
+  void seek(event::Task* task, int64_t off, Whence whence,
+            const base::Options& opts) override {
+    file_->seek(task, off, whence, opts);
+  }
+
+  void truncate_at(event::Task* task, int64_t off,
+                   const base::Options& opts) override {
+    auto f = file_;
+    offload(state_, OffloadOp::file_truncate_at, task, opts,
+            [f, off](event::Task* t, const base::Options& o) {
+              f->truncate_at(t, off, o);
+            });
+  }
+
+  void read_at(event::Task* task, char* out, std::size_t* n, std::size_t min,
+               std::size_t max, int64_t off,
+               const base::Options& opts) const override {
+    auto f = file_;
+    offload(state_, OffloadOp::file_read_at, task, opts,
+            [f, out, n, min, max, off](event::Task* t,
+                                       const base::Options& o) {
+              f->read_at(t, out, n, min, max, off, o);
+            });
+  }
+
+  void read_at(event::Task* task, std::vector<ReadRange>* ranges,
+               const base::Options& opts) const override {
+    auto f = file_;
+    offload(state_, OffloadOp::file_read_at, task, opts,
+            [f, ranges](event::Task* t, const base::Options& o) {
+              f->read_at(t, ranges, o);
+            });
+  }
+
+  void write_at(event::Task* task, std::size_t* n, const char* ptr,
+                std::size_t len, int64_t off,
+                const base::Options& opts) override {
+    auto f = file_;
+    offload(state_, OffloadOp::file_write_at, task, opts,
+            [f, n, ptr, len, off](event::Task* t, const base::Options& o) {
+              f->write_at(t, n, ptr, len, off, o);
+            });
+  }
+
+  void write_at(event::Task* task, std::vector<WriteRange>* ranges,
+                const base::Options& opts) override {
+    auto f = file_;
+    offload(state_, OffloadOp::file_write_at, task, opts,
+            [f, ranges](event::Task* t, const base::Options& o) {
+              f->write_at(t, ranges, o);
+            });
+  }
+
+  void close(event::Task* task, const base::Options& opts) override {
+    auto f = file_;
+    offload(state_, OffloadOp::file_close, task, opts,
+            [f](event::Task* t, const base::Options& o) { f->close(t, o); });
+  }
+
+ private:
+  const OffloadStatePtr state_;
+  const FilePtr file_;
+};
+
+class OffloadFS : public FileSystemImpl {
+ public:
+  OffloadFS(FileSystemPtr fs, OffloadStatePtr state) noexcept
+      : FileSystemImpl(fs->name()),
+        fs_(std::move(fs)),
+        state_(std::move(state)) {}
+
+  void statfs(event::Task* task, StatFS* out, const std::string& path,
+              const base::Options& opts) const override {
+    auto fs = fs_;
+    offload(state_, OffloadOp::statfs, task, opts,
+            [fs, out, path](event::Task* t, const base::Options& o) {
+              fs->statfs(t, out, path, o);
+            });
+  }
+
+  void stat(event::Task* task, Stat* out, const std::string& path,
+            const base::Options& opts) const override {
+    auto fs = fs_;
+    offload(state_, OffloadOp::stat, task, opts,
+            [fs, out, path](event::Task* t, const base::Options& o) {
+              fs->stat(t, out, path, o);
+            });
+  }
+
+  void set_stat(event::Task* task, const std::string& path,
+                const SetStat& delta, const base::Options& opts) override {
+    auto fs = fs_;
+    offload(state_, OffloadOp::set_stat, task, opts,
+            [fs, path, delta](event::Task* t, const base::Options& o) {
+              fs->set_stat(t, path, delta, o);
+            });
+  }
+
+  void open(event::Task* task, File* out, const std::string& path, Mode mode,
+            const base::Options& opts) override {
+    CHECK_NOTNULL(out);
+    auto fs = fs_;
+    auto state = state_;
+    auto self = this->self();
+    offload(state_, OffloadOp::open, task, opts,
+            [fs, out, path, mode](event::Task* t, const base::Options& o) {
+              fs->open(t, out, path, mode, o);
+            },
+            [self, state, out] {
+              *out = File(std::make_shared<OffloadFile>(
+                  self, state, std::move(out->implementation())));
+            });
+  }
+
+  void link(event::Task* task, const std::string& oldpath,
+            const std::string& newpath, const base::Options& opts) override {
+    auto fs = fs_;
+    offload(state_, OffloadOp::link, task, opts,
+            [fs, oldpath, newpath](event::Task* t, const base::Options& o) {
+              fs->link(t, oldpath, newpath, o);
+            });
+  }
+
+  void symlink(event::Task* task, const std::string& target,
+               const std::string& linkpath,
+               const base::Options& opts) override {
+    auto fs = fs_;
+    offload(state_, OffloadOp::symlink, task, opts,
+            [fs, target, linkpath](event::Task* t, const base::Options& o) {
+              fs->symlink(t, target, linkpath, o);
+            });
+  }
+
+  void unlink(event::Task* task, const std::string& path,
+              const base::Options& opts) override {
+    auto fs = fs_;
+    offload(state_, OffloadOp::unlink, task, opts,
+            [fs, path](event::Task* t, const base::Options& o) {
+              fs->unlink(t, path, o);
+            });
+  }
+
+  OffloadStats stats() const {
+    auto lock = base::acquire_lock(state_->mu);
+    return state_->stats;
+  }
+
+  static FileSystemPtr make(FileSystemPtr fs, event::DispatcherPtr d) {
+    auto state = std::make_shared<OffloadState>(std::move(d));
+    auto ptr = std::make_shared<OffloadFS>(std::move(fs), std::move(state));
+    ptr->set_self(ptr);
+    return ptr;
+  }
+
+ private:
+  const FileSystemPtr fs_;
+  const OffloadStatePtr state_;
+};
+
+}  // anonymous namespace
+
+FileSystemPtr offload_filesystem(FileSystemPtr fs,
+                                 event::DispatcherPtr dispatcher) {
+  CHECK_NOTNULL(fs);
+  CHECK_NOTNULL(dispatcher);
+  return OffloadFS::make(std::move(fs), std::move(dispatcher));
+}
+
+base::Result offload_filesystem(FileSystemPtr* out, FileSystemPtr fs,
+                                const event::DispatcherOptions& dopts) {
+  CHECK_NOTNULL(out);
+  out->reset();
+  event::DispatcherPtr d;
+  base::Result r = event::new_dispatcher(&d, dopts);
+  if (r) *out = offload_filesystem(std::move(fs), std::move(d));
+  return r;
+}
+
+base::Result offload_stats(OffloadStats* out, const FileSystemPtr& fs) {
+  CHECK_NOTNULL(out);
+  *out = OffloadStats();
+  const auto* ofs = dynamic_cast<const OffloadFS*>(fs.get());
+  if (!ofs)
+    return base::Result::invalid_argument("not an offloaded file::FileSystem");
+  *out = ofs->stats();
+  return base::Result();
+}
+
+}  // namespace file
@@ -0,0 +1,121 @@
+// file/offload.h - Running file::FileSystemImpl calls on a blocking-I/O pool
+// Copyright © 2017 by Donald King <chronos@chronos-tachyon.net>
+// Available under the MIT License. See LICENSE for details.
+
+#ifndef FILE_OFFLOAD_H
+#define FILE_OFFLOAD_H
+
+#include <array>
+#include <cstdint>
+#include <iostream>
+#include <string>
+
+#include "base/result.h"
+#include "base/time/duration.h"
+#include "event/dispatcher.h"
+#include "file/fs.h"
+
+namespace file {
+
+// OffloadOp identifies a kind of call that an offloaded FileSystem runs on
+// its blocking-I/O Dispatcher.
+enum class OffloadOp : uint8_t {
+  // FileSystemImpl methods
+  statfs = 0,
+  stat = 1,
+  set_stat = 2,
+  open = 3,
+  link = 4,
+  symlink = 5,
+  unlink = 6,
+
+  // FileImpl methods on Files opened through the offloaded FileSystem
+  file_readdir = 7,
+  file_statfs = 8,
+  file_stat = 9,
+  file_size = 10,
+  file_set_stat = 11,
+  file_truncate_at = 12,
+  file_read_at = 13,
+  file_write_at = 14,
+  file_close = 15,
+};
+
+constexpr std::size_t kNumOffloadOps = 16;
+
+const char* offloadop_name(OffloadOp op) noexcept;
+void append_to(std::string* out, OffloadOp op);
+std::size_t length_hint(OffloadOp op) noexcept;
+
+inline std::ostream& operator<<(std::ostream& os, OffloadOp op) {
+  std::string out;
+  append_to(&out, op);
+  return (os << out);
+}
+
+// OffloadOpStats holds latency statistics for one OffloadOp.
+struct OffloadOpStats {
+  // |count| is the number of calls that have completed.
+  std::size_t count;
+
+  // |failures| is the number of completed calls that did not succeed.
+  std::size_t failures;
+
+  // |total_wait| is the sum of the time that calls spent queued on the
+  // Dispatcher, before a worker picked them up.
+  base::time::Duration total_wait;
+
+  // |total_latency| is the sum of the time from each call to its completion,
+  // including |total_wait|.
+  base::time::Duration total_latency;
+
+  // |max_latency| is the worst latency seen by any one call.
+  base::time::Duration max_latency;
+
+  OffloadOpStats() noexcept : count(0), failures(0) {}
+
+  // Convenience method for the mean of |total_latency|.
+  base::time::Duration mean_latency() const {
+    if (count == 0) return base::time::Duration();
+    return total_latency / uint64_t(count);
+  }
+};
+
+// OffloadStats holds statistics for every OffloadOp of an offloaded
+// FileSystem.  All fields are advisory only, as they are only a snapshot.
+struct OffloadStats {
+  std::array<OffloadOpStats, kNumOffloadOps> ops;
+
+  const OffloadOpStats& operator[](OffloadOp op) const noexcept {
+    return ops[std::size_t(op)];
+  }
+  OffloadOpStats& operator[](OffloadOp op) noexcept {
+    return ops[std::size_t(op)];
+  }
+};
+
+// Returns a FileSystem that forwards every call to |fs|, but runs the calls
+// that can block (i.e. everything but the Reader and Writer of an open File,
+// which are already asynchronous, and the cheap positional bookkeeping in
+// |tell()| and |seek()|) on |dispatcher| instead of on the caller's thread.
+//
+// Completions are delivered back on the io::Options event::Manager's
+// Dispatcher, so that the caller's callbacks never run on |dispatcher|.
+//
+// |dispatcher| SHOULD be a threaded Dispatcher with a bounded number of
+// workers, dedicated to blocking I/O; see the overload below.
+//
+FileSystemPtr offload_filesystem(FileSystemPtr fs,
+                                 event::DispatcherPtr dispatcher);
+
+// As above, but constructs a new Dispatcher from |dopts| to run the calls on.
+base::Result offload_filesystem(FileSystemPtr* out, FileSystemPtr fs,
+                                const event::DispatcherOptions& dopts);
+
+// Obtains statistics about an offloaded FileSystem.
+// - Fails with INVALID_ARGUMENT if |fs| was not made by |offload_filesystem()|
+base::Result offload_stats(OffloadStats* out, const FileSystemPtr& fs);
+
+}  // namespace file
+
+#endif  // FILE_OFFLOAD_H
@@ -0,0 +1,71 @@
+// Copyright © 2017 by Donald King <chronos@chronos-tachyon.net>
+// Available under the MIT License. See LICENSE for details.
+
+#include "gtest/gtest.h"
+
+#include <algorithm>
+
+#include "base/result_testing.h"
+#include "file/mem.h"
+#include "file/offload.h"
+
+TEST(OffloadFS, EndToEnd) {
+  event::DispatcherOptions dopts;
+  dopts.set_type(event::DispatcherType::threaded_dispatcher);
+  dopts.set_num_workers(2);
+
+  file::FileSystemPtr fs;
+  ASSERT_OK(file::offload_filesystem(
+      &fs, file::mem_filesystem("test-offload-e2e"), dopts));
+  EXPECT_EQ("test-offload-e2e", fs->name());
+
+  base::Options opts;
+  opts.get<file::Options>().user = "root";
+  opts.get<file::Options>().group = "root";
+
+  EXPECT_OK(fs->mkdir("/foo", opts));
+
+  file::File f;
+  ASSERT_OK(fs->open(&f, "/foo/bar", file::Mode::create_exclusive_rw_mode(),
+                     opts));
+  EXPECT_EQ(fs, f.filesystem());
+
+  std::size_t n;
+  EXPECT_OK(f.write_at(&n, "Hello, world!", 13, 0, opts));
+  EXPECT_EQ(13U, n);
+
+  int64_t size = -1;
+  EXPECT_OK(f.size(&size, opts));
+  EXPECT_EQ(13, size);
+
+  char buf[16];
+  EXPECT_OK(f.read_at(buf, &n, 5, 5, 7, opts));
+  EXPECT_EQ("world", std::string(buf, n));
+  EXPECT_OK(f.close(opts));
+
+  file::Stat st;
+  EXPECT_OK(fs->stat(&st, "/foo/bar", opts));
+  EXPECT_EQ(file::FileType::regular, st.type);
+  EXPECT_EQ(13U, st.size);
+  EXPECT_NOT_FOUND(fs->stat(&st, "/foo/baz", opts));
+
+  file::File d;
+  ASSERT_OK(fs->opendir(&d, "/foo", file::Mode::ro_mode(), opts));
+  std::vector<file::DirEntry> entries;
+  EXPECT_OK(d.readdir(&entries, opts));
+  ASSERT_EQ(1U, entries.size());
+  EXPECT_EQ("bar", entries[0].name);
+  EXPECT_OK(d.close(opts));
+
+  file::OffloadStats stats;
+  ASSERT_OK(file::offload_stats(&stats, fs));
+  EXPECT_EQ(2U, stats[file::OffloadOp::stat].count);
+  EXPECT_EQ(1U, stats[file::OffloadOp::stat].failures);
+  EXPECT_EQ(1U, stats[file::OffloadOp::file_readdir].count);
+  EXPECT_EQ(3U, stats[file::OffloadOp::file_close].count);
+  EXPECT_LE(stats[file::OffloadOp::stat].max_latency,
+            stats[file::OffloadOp::stat].total_latency);
+
+  EXPECT_EQ(base::ResultCode::INVALID_ARGUMENT,
+            file::offload_stats(&stats, file::mem_filesystem("x")).code());
+}
@@ -26,6 +26,12 @@ struct Options : public base::OptionsType {
   bool nofollow;
   bool noatime;
 
+  // If true, regular files opened read-only are read through a memory
+  // mapping, with read-ahead driven by madvise(2), instead of read(2).
+  // Truncating a mapped file raises SIGBUS in its readers, so this is only
+  // safe for files that no other process will shrink.
+  bool mmap_reads;
+
   // Options is default constructible.
   Options() noexcept : create_perm(0666),
                        create_dir_perm(0777),
@@ -36,7 +42,8 @@ struct Options : public base::OptionsType {
                        nonblocking_io(true),
                        direct_io(false),
                        nofollow(false),
-                       noatime(false) {}
+                       noatime(false),
+                       mmap_reads(false) {}
 
   // Options is copyable and moveable.
   Options(const Options&) = default;
@@ -0,0 +1,349 @@
+// Copyright © 2017 by Donald King <chronos@chronos-tachyon.net>
+// Available under the MIT License. See LICENSE for details.
+
+#include "file/walk.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "base/fd.h"
+#include "base/logging.h"
+#include "base/mutex.h"
+#include "event/callback.h"
+#include "event/dispatcher.h"
+#include "file/fd.h"
+#include "file/local.h"
+#include "io/options.h"
+
+namespace file {
+
+namespace {
+
+static std::string child_path(const std::string& parent,
+                              const std::string& name) {
+  std::string out;
+  out.reserve(parent.size() + 1 + name.size());
+  out.append(parent);
+  if (out.empty() || out.back() != '/') out.push_back('/');
+  out.append(name);
+  return out;
+}
+
+// A directory waiting to be read.
+struct PendingDir {
+  base::FD parent;   // native walks only; null for the root
+  std::string name;  // native walks only; relative to |parent|
+  std::string path;
+  std::size_t depth;
+
+  PendingDir(base::FD pfd, std::string n, std::string p,
+             std::size_t d) noexcept : parent(std::move(pfd)),
+                                       name(std::move(n)),
+                                       path(std::move(p)),
+                                       depth(d) {}
+};
+
+class Walker : public std::enable_shared_from_this<Walker> {
+ public:
+  Walker(event::Task* task, FileSystemPtr fs, WalkFunc func,
+         const WalkOptions& wo, const base::Options& opts)
+      : task_(task),
+        fs_(std::move(fs)),
+        func_(std::move(func)),
+        wo_(wo),
+        options_(opts),
+        dispatcher_(io::get_manager(opts).dispatcher()),
+        native_(fs_ == local_filesystem()),
+        active_(0),
+        finished_(false) {
+    if (wo_.max_parallel == 0) wo_.max_parallel = kDefaultWalkParallelism;
+  }
+
+  // Queues |dirs| and starts reading as many directories as allowed.
+  void push(std::vector<PendingDir> dirs);
+
+  // Marks one directory as completely read.
+  void done();
+
+  // Aborts the walk with |r|.  Only the first failure is kept.
+  void fail(base::Result r);
+
+  bool failed() const {
+    auto lock = base::acquire_lock(mu_);
+    return !result_;
+  }
+
+  // Reports one entry to |func_|.  Returns true iff |entry| is a directory
+  // that should be walked in turn.
+  bool report(const WalkEntry& entry);
+
+  const FileSystemPtr& filesystem() const noexcept { return fs_; }
+  const base::Options& options() const noexcept { return options_; }
+  event::Task* task() const noexcept { return task_; }
+
+ private:
+  void pump();
+  void visit(const PendingDir& dir);
+  void visit_native(const PendingDir& dir);
+  void visit_generic(const PendingDir& dir);
+
+  event::Task* const task_;
+  const FileSystemPtr fs_;
+  const WalkFunc func_;
+  WalkOptions wo_;
+  const base::Options options_;
+  const event::DispatcherPtr dispatcher_;
+  const bool native_;
+  mutable std::mutex mu_;
+  std::vector<PendingDir> stack_;  // protected by mu_
+  std::size_t active_;             // protected by mu_
+  base::Result result_;            // protected by mu_
+  bool finished_;                  // protected by mu_
+  std::mutex func_mu_;             // serializes calls to func_
+};
+
+using WalkerPtr = std::shared_ptr<Walker>;
+
+// GenericVisit reads one directory through the FileSystem interface,
+// chaining opendir, readdir, and close on a subtask.
+struct GenericVisit {
+  const WalkerPtr walker;
+  const PendingDir dir;
+  event::Task subtask;
+  File file;
+  std::vector<DirEntry> entries;
+  base::Result result;
+
+  GenericVisit(WalkerPtr w, PendingDir d) noexcept : walker(std::move(w)),
+                                                     dir(std::move(d)) {}
+
+  void start() {
+    walker->task()->add_subtask(&subtask);
+    walker->filesystem()->opendir(&subtask, &file, dir.path, Mode::ro_mode(),
+                                  walker->options());
+    subtask.on_finished(event::callback([this] { return opened(); }));
+  }
+
+  base::Result opened() {
+    base::Result r = subtask.result();
+    if (!r) return finish(std::move(r));
+    subtask.reset();
+    walker->task()->add_subtask(&subtask);
+    file.readdir(&subtask, &entries, walker->options());
+    subtask.on_finished(event::callback([this] { return listed(); }));
+    return base::Result();
+  }
+
+  base::Result listed() {
+    result = subtask.result();
+    std::vector<PendingDir> children;
+    if (result) {
+      for (const auto& entry : entries) {
+        if (entry.name == "." || entry.name == "..") continue;
+        WalkEntry we(child_path(dir.path, entry.name), entry.type,
+                     dir.depth + 1);
+        if (walker->report(we)) {
+          children.emplace_back(nullptr, entry.name, std::move(we.path),
+                                dir.depth + 1);
+        }
+        if (walker->failed()) break;
+      }
+      walker->push(std::move(children));
+    }
+    subtask.reset();
+    walker->task()->add_subtask(&subtask);
+    file.close(&subtask, walker->options());
+    subtask.on_finished(event::callback([this] { return closed(); }));
+    return base::Result();
+  }
+
+  base::Result closed() {
+    return finish(result.and_then(subtask.result()));
+  }
+
+  base::Result finish(base::Result r) {
+    if (!r) walker->fail(std::move(r));
+    walker->done();
+    delete this;
+    return base::Result();
+  }
+};
+
+void Walker::push(std::vector<PendingDir> dirs) {
+  if (!dirs.empty()) {
+    auto lock = base::acquire_lock(mu_);
+    for (auto& dir : dirs) stack_.push_back(std::move(dir));
+  }
+  pump();
+}
+
+void Walker::done() {
+  {
+    auto lock = base::acquire_lock(mu_);
+    --active_;
+  }
+  pump();
+}
+
+void Walker::fail(base::Result r) {
+  auto lock = base::acquire_lock(mu_);
+  if (result_) result_ = std::move(r);
+}
+
+bool Walker::report(const WalkEntry& entry) {
+  bool descend = (entry.type == FileType::directory);
+  base::Result r;
+  {
+    auto lock = base::acquire_lock(func_mu_);
+    if (failed()) return false;
+    r = func_(entry, &descend);
+  }
+  if (!r) {
+    fail(std::move(r));
+    return false;
+  }
+  if (entry.type != FileType::directory) return false;
+  if (wo_.max_depth != 0 && entry.depth >= wo_.max_depth) return false;
+  return descend;
+}
+
+void Walker::pump() {
+  // Walking depth-first, by popping the most recently found directory, keeps
+  // the number of parent directories held open for openat(2) low.
+  std::vector<PendingDir> ready;
+  bool finish = false;
+  bool cancelled = false;
+  base::Result r;
+  {
+    auto lock = base::acquire_lock(mu_);
+    cancelled = !task_->is_running();
+    if (!result_ || cancelled) stack_.clear();
+    while (active_ < wo_.max_parallel && !stack_.empty()) {
+      ready.push_back(std::move(stack_.back()));
+      stack_.pop_back();
+      ++active_;
+    }
+    if (active_ == 0 && stack_.empty() && !finished_) {
+      finished_ = true;
+      finish = true;
+      r = result_;
+    }
+  }
+
+  auto self = shared_from_this();
+  for (auto& dir : ready) {
+    auto closure = [self, dir] {
+      self->visit(dir);
+      return base::Result();
+    };
+    dispatcher_->dispatch(event::callback(closure));
+  }
+  if (!finish) return;
+  if (cancelled)
+    task_->finish_cancel();
+  else
+    task_->finish(std::move(r));
+}
+
+void Walker::visit(const PendingDir& dir) {
+  if (native_)
+    visit_native(dir);
+  else
+    visit_generic(dir);
+}
+
+void Walker::visit_generic(const PendingDir& dir) {
+  auto* v = new GenericVisit(shared_from_this(), dir);
+  v->start();
+}
+
+void Walker::visit_native(const PendingDir& dir) {
+  int fdnum;
+  if (dir.parent) {
+    auto pair = dir.parent->acquire_fd();
+    fdnum = ::openat(pair.first, dir.name.c_str(),
+                     O_RDONLY | O_DIRECTORY | O_CLOEXEC | O_NOFOLLOW);
+  } else {
+    fdnum = ::open(dir.path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  }
+  if (fdnum == -1) {
+    int err_no = errno;
+    fail(base::Result::from_errno(err_no, "openat(2) on ", dir.path));
+    done();
+    return;
+  }
+  base::FD fd = base::wrapfd(fdnum);
+
+  std::vector<base::DEntry> batch;
+  while (!failed()) {
+    batch.clear();
+    base::Result r = base::readdir_some(&batch, fd, base::kReadDirBufferSize,
+                                        dir.path.c_str());
+    if (!r) {
+      fail(std::move(r));
+      break;
+    }
+    if (batch.empty()) break;
+
+    std::vector<PendingDir> children;
+    for (auto& dent : batch) {
+      std::string& name = std::get<2>(dent);
+      if (name == "." || name == "..") continue;
+
+      FileType type = filetype_from_dtype(std::get<1>(dent));
+      if (type == FileType::unknown && wo_.resolve_unknown) {
+        struct stat st;
+        ::bzero(&st, sizeof(st));
+        auto pair = fd->acquire_fd();
+        int rc = ::fstatat(pair.first, name.c_str(), &st, AT_SYMLINK_NOFOLLOW);
+        if (rc == 0) type = filetype_from_mode(st.st_mode);
+      }
+
+      WalkEntry we(child_path(dir.path, name), type, dir.depth + 1);
+      if (report(we)) {
+        children.emplace_back(fd, std::move(name), std::move(we.path),
+                              dir.depth + 1);
+      }
+      if (failed()) break;
+    }
+
+    // Hand subdirectories out after every batch, so that other workers can
+    // get started on them while this one keeps reading.
+    push(std::move(children));
+  }
+  done();
+}
+
+}  // anonymous namespace
+
+void walk(event::Task* task, FileSystemPtr fs, const std::string& root,
+          WalkFunc func, const WalkOptions& wo, const base::Options& opts) {
+  CHECK_NOTNULL(task);
+  CHECK_NOTNULL(fs);
+  CHECK(func);
+  if (!task->start()) return;
+
+  auto walker = std::make_shared<Walker>(task, std::move(fs), std::move(func),
+                                         wo, opts);
+  std::vector<PendingDir> dirs;
+  dirs.emplace_back(nullptr, std::string(), root, 0);
+  walker->push(std::move(dirs));
+}
+
+base::Result walk(FileSystemPtr fs, const std::string& root, WalkFunc func,
+                  const WalkOptions& wo, const base::Options& opts) {
+  event::Task task;
+  walk(&task, std::move(fs), root, std::move(func), wo, opts);
+  event::wait(io::get_manager(opts), &task);
+  return task.result();
+}
+
+}  // namespace file
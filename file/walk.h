@@ -0,0 +1,91 @@
+// file/walk.h - Recursive, parallel traversal of a directory tree
+// Copyright © 2017 by Donald King <chronos@chronos-tachyon.net>
+// Available under the MIT License. See LICENSE for details.
+
+#ifndef FILE_WALK_H
+#define FILE_WALK_H
+
+#include <cstddef>
+#include <functional>
+#include <string>
+
+#include "base/options.h"
+#include "base/result.h"
+#include "event/task.h"
+#include "file/fs.h"
+#include "file/stat.h"
+
+namespace file {
+
+// WalkEntry describes one entry found while walking a directory tree.
+struct WalkEntry {
+  // The path of the entry: the root of the walk, joined with the names of
+  // every directory between there and here.
+  std::string path;
+
+  // The type of the entry, or |FileType::unknown| if the filesystem didn't
+  // say and |WalkOptions::resolve_unknown| is false.  Symbolic links are
+  // reported as such, and never followed.
+  FileType type;
+
+  // The number of directories between the root and the entry: 1 for the
+  // root's own children, 2 for their children, and so on.
+  std::size_t depth;
+
+  WalkEntry(std::string p, FileType t, std::size_t d) noexcept
+      : path(std::move(p)),
+        type(t),
+        depth(d) {}
+};
+
+// WalkFunc is called once for each entry found.
+// - A failure aborts the walk, which then fails with the same result; so
+//   does a failure to open or read a directory
+// - Setting |*descend = false| on a directory prunes it from the walk
+using WalkFunc = std::function<base::Result(const WalkEntry& entry,
+                                            bool* descend)>;
+
+struct WalkOptions {
+  // The maximum number of directories read at the same time.
+  // - If 0, |kDefaultWalkParallelism| is used
+  std::size_t max_parallel;
+
+  // The maximum depth to descend to, or 0 for no limit.
+  std::size_t max_depth;
+
+  // If true, entries whose type the filesystem doesn't report are stat'ed.
+  // Only applies to the local filesystem.
+  bool resolve_unknown;
+
+  WalkOptions() noexcept : max_parallel(0),
+                           max_depth(0),
+                           resolve_unknown(true) {}
+};
+
+constexpr std::size_t kDefaultWalkParallelism = 4;
+
+// Walks the directory tree rooted at |root| on |fs|, calling |func| for
+// every entry below it but not for |root| itself.  Entries are streamed to
+// |func| as each batch is read; nothing is collected along the way.
+//
+// Directories are read in parallel on the io::Options event::Manager's
+// Dispatcher.  Calls to |func| are serialized, but may come from any thread
+// and in any order, except that a directory is always reported before
+// anything inside it.
+//
+// On the local filesystem, directories are opened with openat(2) relative
+// to their parent and read with large getdents64(2) batches.  Elsewhere the
+// walk goes through |FileSystem::opendir()| and |File::readdir()|.
+//
+void walk(event::Task* task, FileSystemPtr fs, const std::string& root,
+          WalkFunc func, const WalkOptions& wo = WalkOptions(),
+          const base::Options& opts = base::default_options());
+
+// Synchronous version of |walk()|.
+base::Result walk(FileSystemPtr fs, const std::string& root, WalkFunc func,
+                  const WalkOptions& wo = WalkOptions(),
+                  const base::Options& opts = base::default_options());
+
+}  // namespace file
+
+#endif  // FILE_WALK_H
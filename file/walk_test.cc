@@ -0,0 +1,116 @@
+// Copyright © 2017 by Donald King <chronos@chronos-tachyon.net>
+// Available under the MIT License. See LICENSE for details.
+
+#include "gtest/gtest.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "base/cleanup.h"
+#include "base/fd.h"
+#include "base/result_testing.h"
+#include "event/task.h"
+#include "file/local.h"
+#include "file/mem.h"
+#include "file/walk.h"
+#include "io/options.h"
+
+static base::Result make_tree(file::FileSystemPtr fs, const std::string& dir,
+                              const base::Options& opts) {
+  return fs->mkdir(dir + "/a", opts)
+      .and_then([&] { return fs->mkdir(dir + "/a/b", opts); })
+      .and_then([&] { return fs->mkdir(dir + "/c", opts); })
+      .and_then([&] { return fs->touch(dir + "/a/b/x", opts); })
+      .and_then([&] { return fs->touch(dir + "/a/y", opts); })
+      .and_then([&] { return fs->touch(dir + "/z", opts); });
+}
+
+static base::Result remove_tree(file::FileSystemPtr fs, const std::string& dir,
+                                const base::Options& opts) {
+  return fs->unlink(dir + "/a/b/x", opts)
+      .and_then([&] { return fs->unlink(dir + "/a/y", opts); })
+      .and_then([&] { return fs->unlink(dir + "/z", opts); })
+      .and_then([&] { return fs->rmdir(dir + "/a/b", opts); })
+      .and_then([&] { return fs->rmdir(dir + "/a", opts); })
+      .and_then([&] { return fs->rmdir(dir + "/c", opts); });
+}
+
+static void check_walk(file::FileSystemPtr fs, const std::string& dir,
+                       const base::Options& opts) {
+  std::vector<std::string> seen;
+  auto collect = [&dir, &seen](const file::WalkEntry& entry, bool* descend) {
+    std::string rel = entry.path.substr(dir.size());
+    if (entry.type == file::FileType::directory) rel.push_back('/');
+    seen.push_back(std::move(rel));
+    return base::Result();
+  };
+
+  file::WalkOptions wo;
+  wo.max_parallel = 2;
+  EXPECT_OK(file::walk(fs, dir, collect, wo, opts));
+  std::sort(seen.begin(), seen.end());
+  std::vector<std::string> expected = {
+      "/a/", "/a/b/", "/a/b/x", "/a/y", "/c/", "/z",
+  };
+  EXPECT_EQ(expected, seen);
+
+  // Depth limits and pruning.
+  seen.clear();
+  wo.max_depth = 1;
+  EXPECT_OK(file::walk(fs, dir, collect, wo, opts));
+  std::sort(seen.begin(), seen.end());
+  expected = {"/a/", "/c/", "/z"};
+  EXPECT_EQ(expected, seen);
+
+  seen.clear();
+  wo.max_depth = 0;
+  auto prune = [&](const file::WalkEntry& entry, bool* descend) {
+    if (entry.path == dir + "/a") *descend = false;
+    return collect(entry, descend);
+  };
+  EXPECT_OK(file::walk(fs, dir, prune, wo, opts));
+  std::sort(seen.begin(), seen.end());
+  EXPECT_EQ(expected, seen);
+
+  // Failures abort the walk.
+  auto fail = [](const file::WalkEntry& entry, bool* descend) {
+    return base::Result::aborted();
+  };
+  EXPECT_EQ(base::ResultCode::ABORTED,
+            file::walk(fs, dir, fail, wo, opts).code());
+
+  EXPECT_NOT_FOUND(file::walk(fs, dir + "/nope", collect, wo, opts));
+
+  // Cancelling the task stops the walk, and it reports the cancellation.
+  event::Task task;
+  auto cancel = [&task](const file::WalkEntry& entry, bool* descend) {
+    task.cancel();
+    return base::Result();
+  };
+  file::walk(&task, fs, dir, cancel, wo, opts);
+  event::wait(io::get_manager(opts), &task);
+  EXPECT_CANCELLED(task.result());
+}
+
+TEST(Walk, Local) {
+  std::string dir;
+  ASSERT_OK(base::make_tempdir(&dir, "mojo2_file_walk_XXXXXXXX"));
+  auto cleanup = base::cleanup([&dir] { ::rmdir(dir.c_str()); });
+
+  auto fs = file::local_filesystem();
+  base::Options opts;
+  ASSERT_OK(make_tree(fs, dir, opts));
+  check_walk(fs, dir, opts);
+  EXPECT_OK(remove_tree(fs, dir, opts));
+}
+
+TEST(Walk, Mem) {
+  auto fs = file::mem_filesystem("test-walk-mem");
+  base::Options opts;
+  opts.get<file::Options>().user = "root";
+  opts.get<file::Options>().group = "root";
+  ASSERT_OK(fs->mkdir("/root", opts));
+  ASSERT_OK(make_tree(fs, "/root", opts));
+  check_walk(fs, "/root", opts);
+}
@@ -3,7 +3,10 @@
 
 #include "io/buffer.h"
 
+#include <algorithm>
+#include <cstdlib>
 #include <cstring>
+#include <new>
 
 #include "base/debug.h"
 #include "base/logging.h"
@@ -30,10 +33,33 @@ static char* alloc(std::size_t len) {
   return ptr;
 }
 
-OwnedBuffer::OwnedBuffer(std::size_t len) : data_(alloc(len)), size_(len) {}
+static char* alloc_aligned(std::size_t len, std::size_t align) {
+  CHECK_EQ(align & (align - 1), 0U);
+  if (align < sizeof(void*)) align = sizeof(void*);
+  void* ptr = nullptr;
+  if (len > 0) {
+    int rc = ::posix_memalign(&ptr, align, len);
+    if (rc != 0) throw std::bad_alloc();
+    ::bzero(ptr, len);
+  }
+  return static_cast<char*>(ptr);
+}
+
+void OwnedBuffer::Deleter::operator()(char* ptr) const noexcept {
+  if (aligned)
+    ::free(ptr);
+  else
+    delete[] ptr;
+}
+
+OwnedBuffer::OwnedBuffer(std::size_t len)
+    : data_(alloc(len), Deleter(false)), size_(len) {}
+
+OwnedBuffer::OwnedBuffer(std::size_t len, std::size_t align)
+    : data_(alloc_aligned(len, align), Deleter(true)), size_(len) {}
 
 OwnedBuffer::OwnedBuffer(std::unique_ptr<char[]> ptr, std::size_t len) noexcept
-    : data_(std::move(ptr)),
+    : data_(ptr.release(), Deleter(false)),
       size_(len) {
   CHECK(size_ == 0 || data_);
   if (size_ == 0) data_ = nullptr;
@@ -42,11 +68,26 @@ OwnedBuffer::OwnedBuffer(std::unique_ptr<char[]> ptr, std::size_t len) noexcept
 
 Pool::Pool(std::size_t size, std::size_t max_buffers) noexcept
     : size_(next_power_of_two(size)),
-      max_(max_buffers) {
+      max_(max_buffers),
+      align_(0) {
   CHECK_GT(size, 0U);
   vec_.reserve(max_);
 }
 
+Pool::Pool(std::size_t size, std::size_t max_buffers,
+           std::size_t align) noexcept
+    : size_(next_power_of_two(std::max(size, align))),
+      max_(max_buffers),
+      align_(next_power_of_two(align)) {
+  CHECK_GT(size, 0U);
+  vec_.reserve(max_);
+}
+
+OwnedBuffer Pool::allocate() const {
+  if (align_ != 0) return OwnedBuffer(size_, align_);
+  return OwnedBuffer(size_);
+}
+
 std::size_t Pool::size() const noexcept {
   auto lock = base::acquire_lock(mu_);
   return vec_.size();
@@ -60,7 +101,7 @@ void Pool::flush() noexcept {
 void Pool::reserve(std::size_t count) {
   if (count > max_) count = max_;
   auto lock = base::acquire_lock(mu_);
-  while (vec_.size() < count) vec_.push_back(OwnedBuffer(size_));
+  while (vec_.size() < count) vec_.push_back(allocate());
 }
 
 void Pool::give(OwnedBuffer buf) noexcept {
@@ -71,6 +112,11 @@ void Pool::give(OwnedBuffer buf) noexcept {
                 << "-byte buffer!";
     return;
   }
+  if (align_ != 0 && (uintptr_t(buf.data()) & (align_ - 1)) != 0) {
+    LOG(DFATAL) << "BUG: This io::Pool only accepts buffers aligned to "
+                << align_ << " bytes!";
+    return;
+  }
   auto lock = base::acquire_lock(mu_);
   if (vec_.size() < max_) vec_.push_back(std::move(buf));
 }
@@ -79,7 +125,7 @@ OwnedBuffer Pool::take() {
   OwnedBuffer buf;
   auto lock = base::acquire_lock(mu_);
   if (vec_.empty()) {
-    buf = OwnedBuffer(size_);
+    buf = allocate();
   } else {
     buf = std::move(vec_.back());
     vec_.pop_back();
@@ -80,11 +80,16 @@ class OwnedBuffer {
   // OwnedBuffer can allocate its own buffer.
   explicit OwnedBuffer(std::size_t len);
 
+  // OwnedBuffer can allocate its own buffer at an address which is a
+  // multiple of |align|, e.g. for O_DIRECT I/O.
+  // - |align| must be a power of two
+  OwnedBuffer(std::size_t len, std::size_t align);
+
   // OwnedBuffer can adopt ownership of an existing char array.
   OwnedBuffer(std::unique_ptr<char[]> ptr, std::size_t len) noexcept;
 
   // OwnedBuffer can be default constructed as an empty buffer.
-  OwnedBuffer() noexcept : data_(nullptr), size_(0) {}
+  OwnedBuffer() noexcept : data_(nullptr, Deleter()), size_(0) {}
 
   // OwnedBuffer is moveable.
   OwnedBuffer(OwnedBuffer&& x) noexcept : data_(std::move(x.data_)),
@@ -111,17 +116,29 @@ class OwnedBuffer {
   operator ConstBuffer() const noexcept { return ConstBuffer(data(), size()); }
 
  private:
-  std::unique_ptr<char[]> data_;
+  struct Deleter {
+    bool aligned;
+
+    Deleter(bool a = false) noexcept : aligned(a) {}
+    void operator()(char* ptr) const noexcept;
+  };
+
+  std::unique_ptr<char, Deleter> data_;
   std::size_t size_;
 };
 
 // A Pool is a thread-safe pool of OwnedBuffer objects.
 // - All OwnedBuffer objects in the pool have the same size.
+// - All OwnedBuffer objects in the pool have the same alignment.
 class Pool {
  public:
   // Pool is constructed with a fixed buffer size.
   Pool(std::size_t size, std::size_t max_buffers) noexcept;
 
+  // Pool is constructed with a fixed buffer size and alignment.
+  // - |align| is rounded up to a power of two
+  Pool(std::size_t size, std::size_t max_buffers, std::size_t align) noexcept;
+
   // Pool is neither copyable nor moveable.
   Pool(const Pool&) = delete;
   Pool(Pool&&) = delete;
@@ -131,6 +148,9 @@ class Pool {
   // Returns the size of each buffer in this pool.
   std::size_t buffer_size() const noexcept { return size_; }
 
+  // Returns the alignment of each buffer in this pool, or 0 if unaligned.
+  std::size_t alignment() const noexcept { return align_; }
+
   // Returns the maximum number of buffers in this pool.
   std::size_t max() const noexcept { return max_; }
 
@@ -145,14 +165,18 @@ class Pool {
 
   // Returns |buf| to the pool.
   // - |buf.size()| must match |buffer_size()|
+  // - |buf| must be aligned to |alignment()|
   void give(OwnedBuffer buf) noexcept;
 
   // Returns a buffer from the pool if one is available, or else allocates one.
   OwnedBuffer take();
 
  private:
+  OwnedBuffer allocate() const;
+
   const std::size_t size_;
   const std::size_t max_;
+  const std::size_t align_;
   mutable std::mutex mu_;
   std::vector<OwnedBuffer> vec_;
 };
@@ -163,6 +187,11 @@ inline PoolPtr make_pool(std::size_t buffer_size, std::size_t max_buffers) {
   return std::make_shared<Pool>(buffer_size, max_buffers);
 }
 
+inline PoolPtr make_aligned_pool(std::size_t buffer_size,
+                                 std::size_t max_buffers, std::size_t align) {
+  return std::make_shared<Pool>(buffer_size, max_buffers, align);
+}
+
 }  // namespace io
 
 #endif  // IO_BUFFER_H
@@ -67,3 +67,21 @@ TEST(Pool, EndToEnd) {
   pool->give(std::move(z));
   EXPECT_EQ(2U, pool->size());
 }
+
+TEST(Pool, Aligned) {
+  io::PoolPtr pool = io::make_aligned_pool(1000, 2, 3000);
+  EXPECT_EQ(4096U, pool->buffer_size());
+  EXPECT_EQ(4096U, pool->alignment());
+
+  io::OwnedBuffer x = pool->take();
+  EXPECT_EQ(4096U, x.size());
+  EXPECT_EQ(0U, uintptr_t(x.data()) % 4096);
+  EXPECT_EQ(std::string(4096, '\0'), std::string(x.data(), x.size()));
+  pool->give(std::move(x));
+  EXPECT_EQ(1U, pool->size());
+
+  io::OwnedBuffer y(512, 512);
+  EXPECT_EQ(0U, uintptr_t(y.data()) % 512);
+
+  EXPECT_EQ(0U, io::make_pool(1000, 2)->alignment());
+}
@@ -14,49 +14,69 @@
 
 static constexpr std::size_t kDefaultBufferSize = 1U << 16;  // 64 KiB
 static constexpr std::size_t kDefaultMaxBuffers = 16;
+static constexpr std::size_t kMaxFreeOps = 16;
 
 namespace io {
 
 Chain::Chain(PoolPtr pool, std::size_t max_buffers) noexcept
     : pool_(CHECK_NOTNULL(std::move(pool))),
       max_(max_buffers),
-      rdpos_(0),
-      wrpos_(0),
-      loop_(0) {
+      ring_(max_),
+      head_(0),
+      count_(0),
+      bytes_(0),
+      loop_(0),
+      filling_(false),
+      draining_(false),
+      fill_stale_(false),
+      drain_stale_(false) {
   CHECK_GT(pool_->buffer_size(), 0U);
   CHECK_GE(max_, 3U);
-  vec_.reserve(max_);
 }
 
 Chain::Chain(PoolPtr pool) noexcept
     : pool_(CHECK_NOTNULL(std::move(pool))),
       max_(std::max(std::size_t(3), pool_->max())),
-      rdpos_(0),
-      wrpos_(0),
-      loop_(0) {
+      ring_(max_),
+      head_(0),
+      count_(0),
+      bytes_(0),
+      loop_(0),
+      filling_(false),
+      draining_(false),
+      fill_stale_(false),
+      drain_stale_(false) {
   CHECK_GT(pool_->buffer_size(), 0U);
-  vec_.reserve(max_);
 }
 
 Chain::Chain(std::size_t buffer_size, std::size_t max_buffers)
     : pool_(make_pool(buffer_size, max_buffers)),
       max_(max_buffers),
-      rdpos_(0),
-      wrpos_(0),
-      loop_(0) {
+      ring_(max_),
+      head_(0),
+      count_(0),
+      bytes_(0),
+      loop_(0),
+      filling_(false),
+      draining_(false),
+      fill_stale_(false),
+      drain_stale_(false) {
   CHECK_GT(buffer_size, 0U);
   CHECK_GE(max_, 3U);
-  vec_.reserve(max_);
 }
 
 Chain::Chain()
     : pool_(make_pool(kDefaultBufferSize, kDefaultMaxBuffers)),
       max_(kDefaultMaxBuffers),
-      rdpos_(0),
-      wrpos_(0),
-      loop_(0) {
-  vec_.reserve(max_);
-}
+      ring_(max_),
+      head_(0),
+      count_(0),
+      bytes_(0),
+      loop_(0),
+      filling_(false),
+      draining_(false),
+      fill_stale_(false),
+      drain_stale_(false) {}
 
 void Chain::set_rdfn(Func rdfn) {
   auto lock = base::acquire_lock(mu_);
@@ -69,17 +89,19 @@ void Chain::set_wrfn(Func wrfn) {
 }
 
 std::size_t Chain::optimal_fill() const noexcept {
-  std::size_t blocknum, offset;
   auto lock = base::acquire_lock(mu_);
-  xlate_locked(&blocknum, &offset, wrpos_);
-  return pool_->buffer_size() - offset;
+  std::size_t sz = pool_->buffer_size();
+  if (count_ == 0) return sz;
+  const auto& tail = block_locked(count_ - 1);
+  if (tail.end == tail.buf.size()) return sz;
+  return tail.buf.size() - tail.end;
 }
 
 std::size_t Chain::optimal_drain() const noexcept {
-  std::size_t blocknum, offset;
   auto lock = base::acquire_lock(mu_);
-  xlate_locked(&blocknum, &offset, wrpos_);
-  return std::min(pool_->buffer_size() - offset, wrpos_ - rdpos_);
+  if (count_ == 0) return 0;
+  const auto& head = block_locked(0);
+  return head.end - head.begin;
 }
 
 void Chain::fill(std::size_t* n, const char* ptr, std::size_t len) {
@@ -105,6 +127,83 @@ void Chain::undrain(const char* ptr, std::size_t len) {
   undrain_locked(ptr, len);
 }
 
+std::size_t Chain::peek(char* ptr, std::size_t len) const {
+  if (len > 0) CHECK_NOTNULL(ptr);
+
+  auto lock = base::acquire_lock(mu_);
+  if (!rdq_.empty()) return 0;
+  std::size_t n = 0;
+  for (std::size_t i = 0; i < count_ && n < len; ++i) {
+    const auto& block = block_locked(i);
+    std::size_t rdnum = std::min(len - n, block.end - block.begin);
+    ::memcpy(ptr + n, block.buf.data() + block.begin, rdnum);
+    n += rdnum;
+  }
+  return n;
+}
+
+bool Chain::try_drain(char* ptr, std::size_t len) {
+  if (len > 0) CHECK_NOTNULL(ptr);
+
+  auto lock = base::acquire_lock(mu_);
+  if (!rdq_.empty() || bytes_ < len) return false;
+  std::size_t n = 0;
+  drain_locked(&n, ptr, len);
+  DCHECK_EQ(n, len);
+  return true;
+}
+
+Buffer Chain::fill_segment() {
+  auto lock = base::acquire_lock(mu_);
+  if (filling_) return Buffer();
+  if (count_ == 0 || tail_locked().end == tail_locked().buf.size()) {
+    if (count_ >= max_) return Buffer();
+    push_back_locked();
+  }
+  auto& tail = tail_locked();
+  filling_ = true;
+  return Buffer(tail.buf.data() + tail.end, tail.buf.size() - tail.end);
+}
+
+void Chain::commit_fill(std::size_t n) {
+  auto lock = base::acquire_lock(mu_);
+  CHECK(filling_) << ": BUG! commit_fill() without fill_segment()";
+  filling_ = false;
+  if (fill_stale_) {
+    fill_stale_ = false;
+    release_orphans_locked();
+    return;
+  }
+  auto& tail = tail_locked();
+  CHECK_LE(n, tail.buf.size() - tail.end);
+  tail.end += n;
+  bytes_ += n;
+}
+
+ConstBuffer Chain::drain_segment() {
+  auto lock = base::acquire_lock(mu_);
+  if (draining_ || bytes_ == 0) return ConstBuffer();
+  const auto& head = head_locked();
+  draining_ = true;
+  return ConstBuffer(head.buf.data() + head.begin, head.end - head.begin);
+}
+
+void Chain::commit_drain(std::size_t n) {
+  auto lock = base::acquire_lock(mu_);
+  CHECK(draining_) << ": BUG! commit_drain() without drain_segment()";
+  draining_ = false;
+  if (drain_stale_) {
+    drain_stale_ = false;
+    release_orphans_locked();
+    return;
+  }
+  auto& head = head_locked();
+  CHECK_LE(n, head.end - head.begin);
+  head.begin += n;
+  bytes_ -= n;
+  if (head.begin == head.end) pop_front_locked();
+}
+
 void Chain::fail_reads(base::Result r) noexcept {
   CHECK(!r);
   auto lock = base::acquire_lock(mu_);
@@ -119,12 +218,18 @@ void Chain::fail_writes(base::Result r) noexcept {
 
 void Chain::flush() noexcept {
   auto lock = base::acquire_lock(mu_);
-  while (!vec_.empty()) {
-    pool_->give(std::move(vec_.back()));
-    vec_.pop_back();
+  for (std::size_t i = 0; i < count_; ++i) {
+    auto& block = ring_[(head_ + i) % ring_.size()];
+    bool busy = (draining_ && i == 0) || (filling_ && i + 1 == count_);
+    if (busy)
+      orphans_.push_back(std::move(block.buf));
+    else
+      pool_->give(std::move(block.buf));
+    block = Block();
   }
-  rdpos_ = wrpos_ = 0;
-  DCHECK_LE(rdpos_, wrpos_);
+  head_ = count_ = bytes_ = 0;
+  fill_stale_ = filling_;
+  drain_stale_ = draining_;
 }
 
 void Chain::process() noexcept {
@@ -136,8 +241,13 @@ void Chain::read(event::Task* task, char* out, std::size_t* n, std::size_t min,
                  std::size_t max, const base::Options& opts) {
   if (!ReaderImpl::prologue(task, out, n, min, max)) return;
   auto lock = base::acquire_lock(mu_);
-  auto op =
-      base::backport::make_unique<const ReadOp>(task, out, n, min, max, opts);
+  auto op = new_read_op_locked();
+  op->task = task;
+  op->out = out;
+  op->n = n;
+  op->min = min;
+  op->max = max;
+  op->options = opts;
   rdq_.push_back(std::move(op));
   process_locked(lock);
 }
@@ -146,101 +256,114 @@ void Chain::write(event::Task* task, std::size_t* n, const char* ptr,
                   std::size_t len, const base::Options& opts) {
   if (!WriterImpl::prologue(task, n, ptr, len)) return;
   auto lock = base::acquire_lock(mu_);
-  auto op = base::backport::make_unique<const WriteOp>(task, n, ptr, len, opts);
+  auto op = new_write_op_locked();
+  op->task = task;
+  op->n = n;
+  op->ptr = ptr;
+  op->len = len;
+  op->options = opts;
   wrq_.push_back(std::move(op));
   process_locked(lock);
 }
 
-void Chain::xlate_locked(std::size_t* blocknum, std::size_t* offset,
-                         std::size_t pos) const noexcept {
-  DCHECK_NOTNULL(blocknum);
-  DCHECK_NOTNULL(offset);
-  std::size_t x, y, z;
-  z = pool_->buffer_size();
-  DCHECK_GT(z, 0U);
-  x = pos / z;
-  y = pos - x * z;
-  DCHECK_GE(x, 0U);
-  DCHECK_LE(x, vec_.size());
-  DCHECK(x < vec_.size() || y == 0);
-  *blocknum = x;
-  *offset = y;
+void Chain::grow_locked() {
+  std::vector<Block> ring(std::max(std::size_t(4), ring_.size() * 2));
+  for (std::size_t i = 0; i < count_; ++i) {
+    ring[i] = std::move(ring_[(head_ + i) % ring_.size()]);
+  }
+  ring_.swap(ring);
+  head_ = 0;
+}
+
+void Chain::release_orphans_locked() noexcept {
+  if (filling_ || draining_) return;
+  for (auto& buf : orphans_) pool_->give(std::move(buf));
+  orphans_.clear();
+}
+
+void Chain::push_front_locked() noexcept {
+  if (count_ == ring_.size()) grow_locked();
+  head_ = (head_ + ring_.size() - 1) % ring_.size();
+  ring_[head_] = Block(pool_->take(), pool_->buffer_size());
+  ++count_;
+}
+
+void Chain::push_back_locked() noexcept {
+  if (count_ == ring_.size()) grow_locked();
+  ring_[(head_ + count_) % ring_.size()] = Block(pool_->take(), 0);
+  ++count_;
+}
+
+void Chain::pop_front_locked() noexcept {
+  DCHECK_GT(count_, 0U);
+  auto& head = head_locked();
+  DCHECK_EQ(head.begin, head.end);
+  if (count_ == 1) {
+    // Keep the last buffer around for the next fill, unless it's reserved
+    // by an outstanding |fill_segment()|.
+    if (!filling_) head.begin = head.end = 0;
+    return;
+  }
+  pool_->give(std::move(head.buf));
+  head = Block();
+  head_ = (head_ + 1) % ring_.size();
+  --count_;
 }
 
 void Chain::fill_locked(std::size_t* n, const char* ptr,
                         std::size_t len) noexcept {
-  DCHECK_LE(rdpos_, wrpos_);
-  std::size_t blocknum, offset;
+  DCHECK(!filling_);
   while (*n < len) {
-    xlate_locked(&blocknum, &offset, wrpos_);
-    while (blocknum >= vec_.size()) {
-      if (vec_.size() >= max_) break;
-      vec_.push_back(pool_->take());
+    if (count_ == 0 || tail_locked().end == tail_locked().buf.size()) {
+      if (count_ >= max_) break;
+      push_back_locked();
     }
-    auto& buf = vec_[blocknum];
-    std::size_t sz = buf.size();
-    DCHECK_EQ(sz, pool_->buffer_size());
-    DCHECK_GT(sz, offset);
-    std::size_t wrnum = std::min(len - *n, sz - offset);
-    ::memcpy(buf.data() + offset, ptr + *n, wrnum);
+    auto& tail = tail_locked();
+    std::size_t wrnum = std::min(len - *n, tail.buf.size() - tail.end);
+    ::memcpy(tail.buf.data() + tail.end, ptr + *n, wrnum);
+    tail.end += wrnum;
+    bytes_ += wrnum;
     *n += wrnum;
-    wrpos_ += wrnum;
-    DCHECK_LE(rdpos_, wrpos_);
   }
   DCHECK_LE(*n, len);
 }
 
 void Chain::drain_locked(std::size_t* n, char* ptr, std::size_t len) noexcept {
-  DCHECK_LE(rdpos_, wrpos_);
-  std::size_t blocknum, offset;
-  while (*n < len) {
-    xlate_locked(&blocknum, &offset, rdpos_);
-    if (blocknum >= vec_.size()) break;
-    if (rdpos_ >= wrpos_) break;
-    auto& buf = vec_[blocknum];
-    std::size_t sz = buf.size();
-    DCHECK_EQ(blocknum, 0U);
-    DCHECK_EQ(sz, pool_->buffer_size());
-    DCHECK_GT(sz, offset);
-    std::size_t rdnum =
-        std::min(len - *n, std::min(sz - offset, wrpos_ - rdpos_));
-    ::memcpy(ptr + *n, buf.data() + offset, rdnum);
+  DCHECK(!draining_);
+  while (*n < len && bytes_ > 0) {
+    auto& head = head_locked();
+    std::size_t rdnum = std::min(len - *n, head.end - head.begin);
+    ::memcpy(ptr + *n, head.buf.data() + head.begin, rdnum);
+    head.begin += rdnum;
+    bytes_ -= rdnum;
     *n += rdnum;
-    rdpos_ += rdnum;
-    DCHECK_LE(rdpos_, wrpos_);
-    if (offset + rdnum == sz) {
-      pool_->give(std::move(buf));
-      vec_.erase(vec_.begin());
-      rdpos_ -= sz;
-      wrpos_ -= sz;
-      DCHECK_LE(rdpos_, wrpos_);
-    }
+    if (head.begin == head.end) pop_front_locked();
   }
   DCHECK_LE(*n, len);
 }
 
 void Chain::undrain_locked(const char* ptr, std::size_t len) noexcept {
-  DCHECK_LE(rdpos_, wrpos_);
-  std::size_t sz = pool_->buffer_size();
-  while (len > rdpos_) {
-    vec_.insert(vec_.begin(), pool_->take());
-    rdpos_ += sz;
-    wrpos_ += sz;
-  }
-  rdpos_ -= len;
-  std::size_t n = 0;
-  std::size_t blocknum, offset;
-  while (n < len) {
-    xlate_locked(&blocknum, &offset, rdpos_ + n);
-    auto& buf = vec_[blocknum];
-    sz = buf.size();
-    DCHECK_EQ(sz, pool_->buffer_size());
-    DCHECK_GT(sz, offset);
-    std::size_t wrnum = std::min(len - n, sz - offset);
-    ::memcpy(buf.data() + offset, ptr + n, wrnum);
-    n += wrnum;
+  DCHECK(!draining_);
+  // Copy backward from the end of |ptr|, so that each Block is filled from
+  // its end toward its start.
+  while (len > 0) {
+    if (count_ == 0 || head_locked().begin == 0) {
+      if (count_ == 1 && head_locked().begin == head_locked().end &&
+          !filling_) {
+        // The lone Block is empty; reuse it instead of adding another.
+        auto& head = head_locked();
+        head.begin = head.end = head.buf.size();
+      } else {
+        push_front_locked();
+      }
+    }
+    auto& head = head_locked();
+    std::size_t wrnum = std::min(len, head.begin);
+    ::memcpy(head.buf.data() + head.begin - wrnum, ptr + len - wrnum, wrnum);
+    head.begin -= wrnum;
+    bytes_ += wrnum;
+    len -= wrnum;
   }
-  DCHECK_EQ(n, len);
 }
 
 void Chain::process_locked(base::Lock& lock) noexcept {
@@ -257,20 +380,19 @@ bool Chain::reads_locked(base::Lock& lock) noexcept {
   bool some = false;
   bool want = false;
   while (!rdq_.empty()) {
-    auto op = std::move(rdq_.front());
-    rdq_.pop_front();
-    auto progress = read_locked(lock, op.get());
+    auto progress = read_locked(lock, rdq_.front().get());
     if (progress != Progress::none) some = true;
     if (progress != Progress::complete) {
       want = true;
-      rdq_.push_front(std::move(op));
       break;
     }
+    recycle_locked(std::move(rdq_.front()));
+    rdq_.pop_front();
   }
 
   if (want && rdfn_) {
     auto fn = rdfn_;
-    const auto& opts = rdq_.front()->options;
+    auto opts = rdq_.front()->options;
     lock.unlock();
     auto reacquire = base::cleanup([&lock] { lock.lock(); });
     fn(opts);
@@ -283,20 +405,19 @@ bool Chain::writes_locked(base::Lock& lock) noexcept {
   bool some = false;
   bool want = false;
   while (!wrq_.empty()) {
-    auto op = std::move(wrq_.front());
-    wrq_.pop_front();
-    auto progress = write_locked(lock, op.get());
+    auto progress = write_locked(lock, wrq_.front().get());
     if (progress != Progress::none) some = true;
     if (progress != Progress::complete) {
       want = true;
-      wrq_.push_front(std::move(op));
       break;
     }
+    recycle_locked(std::move(wrq_.front()));
+    wrq_.pop_front();
   }
 
   if (want && wrfn_) {
     auto fn = wrfn_;
-    const auto& opts = wrq_.front()->options;
+    auto opts = wrq_.front()->options;
     lock.unlock();
     auto reacquire = base::cleanup([&lock] { lock.lock(); });
     fn(opts);
@@ -343,4 +464,30 @@ Chain::Progress Chain::write_locked(base::Lock& lock,
   return Chain::Progress::none;
 }
 
+std::unique_ptr<Chain::ReadOp> Chain::new_read_op_locked() {
+  if (rdfree_.empty()) return base::backport::make_unique<ReadOp>();
+  auto op = std::move(rdfree_.back());
+  rdfree_.pop_back();
+  return op;
+}
+
+std::unique_ptr<Chain::WriteOp> Chain::new_write_op_locked() {
+  if (wrfree_.empty()) return base::backport::make_unique<WriteOp>();
+  auto op = std::move(wrfree_.back());
+  wrfree_.pop_back();
+  return op;
+}
+
+void Chain::recycle_locked(std::unique_ptr<ReadOp> op) noexcept {
+  if (rdfree_.size() >= kMaxFreeOps) return;
+  op->options = base::Options();
+  rdfree_.push_back(std::move(op));
+}
+
+void Chain::recycle_locked(std::unique_ptr<WriteOp> op) noexcept {
+  if (wrfree_.size() >= kMaxFreeOps) return;
+  op->options = base::Options();
+  wrfree_.push_back(std::move(op));
+}
+
 }  // namespace io
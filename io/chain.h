@@ -22,6 +22,9 @@ namespace io {
 
 // Chain is an intermediate class representing a chain of OwnedBuffer objects.
 // It's used as a byte queue by Pipes, buffered Readers, and buffered Writers.
+//
+// The buffers are kept in a ring, so filling and draining never shift the
+// queue, and fully drained buffers go straight back to the pool.
 class Chain {
  public:
   // Func is a callback that requests that the Chain's owner should call some
@@ -67,6 +70,34 @@ class Chain {
   // Fill the head of the queue with bytes.
   void undrain(const char* ptr, std::size_t len);
 
+  // Copies up to |len| bytes from the head of the queue without draining
+  // them.  Returns the number of bytes copied, or 0 if reads are pending.
+  std::size_t peek(char* ptr, std::size_t len) const;
+
+  // Drains exactly |len| bytes from the head of the queue, if that many are
+  // queued and no reads are pending.  Returns true iff bytes were drained.
+  bool try_drain(char* ptr, std::size_t len);
+
+  // Contiguous access to the queue, for I/O directly into or out of the
+  // Chain's buffers without an intermediate copy.
+  //
+  // |fill_segment()| returns the writable space at the tail of the queue,
+  // allocating a new buffer if needed.  Once up to |size()| bytes have been
+  // written there, |commit_fill(n)| appends them to the queue.
+  //
+  // |drain_segment()| returns the readable bytes at the head of the queue.
+  // Once they have been consumed, |commit_drain(n)| removes the first |n|.
+  //
+  // At most one segment of each kind may be outstanding at a time, and the
+  // owner must not |fill()| or |drain()| while one is.  Either returns an
+  // empty segment if none is available, e.g. if one is already outstanding.
+  // A segment stays valid until it is committed, even across |flush()|; if
+  // the queue was flushed in the meantime, the commit is a no-op.
+  Buffer fill_segment();
+  void commit_fill(std::size_t n);
+  ConstBuffer drain_segment();
+  void commit_drain(std::size_t n);
+
   // Once reads drain the queue, start returning an error on future reads.
   void fail_reads(base::Result r) noexcept;
 
@@ -101,15 +132,6 @@ class Chain {
     std::size_t min;
     std::size_t max;
     base::Options options;
-
-    ReadOp(event::Task* t, char* o, std::size_t* n, std::size_t mn,
-           std::size_t mx, base::Options opts) noexcept
-        : task(t),
-          out(o),
-          n(n),
-          min(mn),
-          max(mx),
-          options(std::move(opts)) {}
   };
 
   struct WriteOp {
@@ -118,17 +140,34 @@ class Chain {
     const char* ptr;
     std::size_t len;
     base::Options options;
+  };
+
+  // Block is one buffer in the ring.  Bytes [begin, end) are queued.
+  struct Block {
+    OwnedBuffer buf;
+    std::size_t begin;
+    std::size_t end;
 
-    WriteOp(event::Task* t, std::size_t* n, const char* p, std::size_t l,
-            base::Options opts) noexcept : task(t),
-                                           n(n),
-                                           ptr(p),
-                                           len(l),
-                                           options(std::move(opts)) {}
+    Block() noexcept : begin(0), end(0) {}
+    Block(OwnedBuffer b, std::size_t pos) noexcept : buf(std::move(b)),
+                                                     begin(pos),
+                                                     end(pos) {}
   };
 
-  void xlate_locked(std::size_t* blocknum, std::size_t* offset,
-                    std::size_t pos) const noexcept;
+  Block& head_locked() noexcept { return ring_[head_]; }
+  Block& tail_locked() noexcept {
+    return ring_[(head_ + count_ - 1) % ring_.size()];
+  }
+  const Block& block_locked(std::size_t i) const noexcept {
+    return ring_[(head_ + i) % ring_.size()];
+  }
+
+  void grow_locked();
+  void release_orphans_locked() noexcept;
+  void push_front_locked() noexcept;
+  void push_back_locked() noexcept;
+  void pop_front_locked() noexcept;
+
   void fill_locked(std::size_t* n, const char* ptr, std::size_t len) noexcept;
   void drain_locked(std::size_t* n, char* out, std::size_t len) noexcept;
   void undrain_locked(const char* ptr, std::size_t len) noexcept;
@@ -140,19 +179,33 @@ class Chain {
   Progress read_locked(base::Lock& lock, const ReadOp* op) noexcept;
   Progress write_locked(base::Lock& lock, const WriteOp* op) noexcept;
 
+  // Ops are recycled through these free lists rather than reallocated.
+  std::unique_ptr<ReadOp> new_read_op_locked();
+  std::unique_ptr<WriteOp> new_write_op_locked();
+  void recycle_locked(std::unique_ptr<ReadOp> op) noexcept;
+  void recycle_locked(std::unique_ptr<WriteOp> op) noexcept;
+
   const PoolPtr pool_;
   const std::size_t max_;
   mutable std::mutex mu_;
-  std::vector<OwnedBuffer> vec_;
-  std::deque<std::unique_ptr<const ReadOp>> rdq_;
-  std::deque<std::unique_ptr<const WriteOp>> wrq_;
+  std::vector<Block> ring_;  // circular; ring_.size() is the capacity
+  std::size_t head_;         // index of the first Block in use
+  std::size_t count_;        // number of Blocks in use
+  std::size_t bytes_;        // number of bytes queued
+  std::deque<std::unique_ptr<ReadOp>> rdq_;
+  std::deque<std::unique_ptr<WriteOp>> wrq_;
+  std::vector<std::unique_ptr<ReadOp>> rdfree_;
+  std::vector<std::unique_ptr<WriteOp>> wrfree_;
   Func rdfn_;
   Func wrfn_;
   base::Result rderr_;
   base::Result wrerr_;
-  std::size_t rdpos_;
-  std::size_t wrpos_;
+  std::vector<OwnedBuffer> orphans_;  // flushed under outstanding segments
   std::size_t loop_;
+  bool filling_;      // a |fill_segment()| is outstanding
+  bool draining_;     // a |drain_segment()| is outstanding
+  bool fill_stale_;   // ... and |flush()| was called since
+  bool drain_stale_;  // ... and |flush()| was called since
 };
 
 }  // namespace io
@@ -0,0 +1,98 @@
+// Copyright © 2017 by Donald King <chronos@chronos-tachyon.net>
+// Available under the MIT License. See LICENSE for details.
+
+#include "gtest/gtest.h"
+
+#include <cstring>
+
+#include "io/chain.h"
+
+static std::string drain_all(io::Chain* chain) {
+  std::string out(256, '\0');
+  std::size_t n = 0;
+  chain->drain(&n, &out[0], out.size());
+  out.resize(n);
+  return out;
+}
+
+TEST(Chain, FillDrainWraps) {
+  io::Chain chain(4, 3);
+
+  // Cycle far more bytes through the Chain than its 12-byte capacity, so
+  // that the ring of buffers wraps around many times.
+  std::string expected;
+  std::string actual;
+  for (std::size_t i = 0; i < 100; ++i) {
+    std::string in(1 + i % 7, 'a' + i % 26);
+    std::size_t n = 0;
+    chain.fill(&n, in.data(), in.size());
+    EXPECT_LT(0U, n);
+    expected.append(in, 0, n);
+
+    char buf[5];
+    n = 0;
+    chain.drain(&n, buf, 1 + i % 5);
+    actual.append(buf, n);
+    if (expected.size() - actual.size() > 8) actual += drain_all(&chain);
+  }
+  actual += drain_all(&chain);
+  EXPECT_EQ(expected, actual);
+
+  // Fills stop when the Chain is full.
+  std::size_t n = 0;
+  chain.fill(&n, "abcdefghijklmnop", 16);
+  EXPECT_EQ(12U, n);
+  EXPECT_EQ("abcdefghijkl", drain_all(&chain));
+}
+
+TEST(Chain, Undrain) {
+  io::Chain chain(4, 3);
+  std::size_t n = 0;
+  chain.fill(&n, "ghij", 4);
+
+  char buf[2];
+  n = 0;
+  chain.drain(&n, buf, 2);
+  EXPECT_EQ("gh", std::string(buf, 2));
+
+  // Undrain can grow the Chain past its usual limit.
+  chain.undrain("abcdefgh", 8);
+  chain.undrain("0123456789", 10);
+  EXPECT_EQ("0123456789abcdefghij", drain_all(&chain));
+}
+
+TEST(Chain, Segments) {
+  io::Chain chain(8, 3);
+
+  io::Buffer seg = chain.fill_segment();
+  ASSERT_EQ(8U, seg.size());
+  EXPECT_FALSE(chain.fill_segment());
+  ::memcpy(seg.data(), "hello", 5);
+  chain.commit_fill(5);
+
+  seg = chain.fill_segment();
+  ASSERT_EQ(3U, seg.size());
+  ::memcpy(seg.data(), ", w", 3);
+  chain.commit_fill(3);
+
+  std::size_t n = 0;
+  chain.fill(&n, "orld!", 5);
+
+  io::ConstBuffer in = chain.drain_segment();
+  ASSERT_EQ(8U, in.size());
+  EXPECT_EQ("hello, w", std::string(in.data(), in.size()));
+  chain.commit_drain(7);
+
+  in = chain.drain_segment();
+  ASSERT_EQ(1U, in.size());
+  chain.commit_drain(1);
+  EXPECT_EQ("orld!", drain_all(&chain));
+
+  // A flush while a segment is outstanding turns the commit into a no-op.
+  seg = chain.fill_segment();
+  ASSERT_TRUE(bool(seg));
+  chain.flush();
+  ::memcpy(seg.data(), "x", 1);
+  chain.commit_fill(1);
+  EXPECT_EQ("", drain_all(&chain));
+}
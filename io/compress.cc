@@ -0,0 +1,1246 @@
+// Copyright © 2017 by Donald King <chronos@chronos-tachyon.net>
+// Available under the MIT License. See LICENSE for details.
+
+#include "io/compress.h"
+
+#include <zlib.h>
+#include <zstd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "base/backport.h"
+#include "base/logging.h"
+#include "base/mutex.h"
+#include "io/lz4.h"
+
+namespace io {
+
+inline namespace implementation {
+static constexpr std::size_t kMaxPoolBuffers = 16;
+
+static int window_bits(Compression c) noexcept {
+  switch (c) {
+    case Compression::deflate:
+      return -MAX_WBITS;
+
+    case Compression::zlib:
+      return MAX_WBITS;
+
+    case Compression::gzip:
+      return MAX_WBITS + 16;
+
+    default:
+      break;
+  }
+  LOG(DFATAL) << "BUG! unknown io::Compression " << static_cast<int>(c);
+  return MAX_WBITS;
+}
+
+static base::Result zlib_result(int rc, const z_stream& zs, const char* what) {
+  const char* msg = zs.msg ? zs.msg : "";
+  switch (rc) {
+    case Z_MEM_ERROR:
+      return base::Result::resource_exhausted(what, ": ", msg);
+
+    case Z_DATA_ERROR:
+    case Z_NEED_DICT:
+      return base::Result::data_loss(what, ": ", msg);
+
+    case Z_STREAM_ERROR:
+    case Z_VERSION_ERROR:
+      return base::Result::internal(what, ": ", msg);
+
+    default:
+      return base::Result::unknown(what, ": rc=", rc, ": ", msg);
+  }
+}
+
+static base::Result zstd_result(std::size_t rc, const char* what,
+                                bool decoding) {
+  const char* msg = ::ZSTD_getErrorName(rc);
+  if (::ZSTD_getErrorCode(rc) == ZSTD_error_memory_allocation) {
+    return base::Result::resource_exhausted(what, ": ", msg);
+  }
+  if (decoding) return base::Result::data_loss(what, ": ", msg);
+  return base::Result::internal(what, ": ", msg);
+}
+
+// zlib counts bytes with |uInt|, which may be narrower than std::size_t.
+static uInt clamp(std::size_t len) noexcept {
+  constexpr std::size_t kMax = std::numeric_limits<uInt>::max();
+  return (len > kMax) ? kMax : len;
+}
+
+static uint32_t get_le32(const char* ptr) noexcept {
+  auto* p = reinterpret_cast<const unsigned char*>(ptr);
+  return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) |
+         (uint32_t(p[3]) << 24);
+}
+
+static void put_le32(std::string* out, uint32_t v) {
+  out->push_back(char(v & 0xff));
+  out->push_back(char((v >> 8) & 0xff));
+  out->push_back(char((v >> 16) & 0xff));
+  out->push_back(char((v >> 24) & 0xff));
+}
+
+// InSpan is the unconsumed part of a codec's input.
+struct InSpan {
+  const char* ptr;
+  std::size_t len;
+
+  InSpan() noexcept : ptr(nullptr), len(0) {}
+  InSpan(const char* p, std::size_t n) noexcept : ptr(p), len(n) {}
+
+  void consume(std::size_t n) noexcept {
+    ptr += n;
+    len -= n;
+  }
+};
+
+// OutSpan is the unfilled part of a codec's output.
+struct OutSpan {
+  char* ptr;
+  std::size_t len;
+
+  OutSpan() noexcept : ptr(nullptr), len(0) {}
+  OutSpan(char* p, std::size_t n) noexcept : ptr(p), len(n) {}
+
+  void produce(std::size_t n) noexcept {
+    ptr += n;
+    len -= n;
+  }
+};
+
+enum class Flush : uint8_t { none, sync, finish };
+
+// Encoder is the compressing half of a codec.  CompressingWriter drives it,
+// whatever the format.
+class Encoder {
+ public:
+  virtual ~Encoder() noexcept = default;
+
+  // Compresses as much of |*in| into |*out| as it can, moving both forward.
+  // With |flush| other than |none|, also pushes out everything consumed so
+  // far and, for |finish|, the stream trailer; |*complete| is set once that
+  // has all fit in |*out|.
+  virtual base::Result encode(InSpan* in, OutSpan* out, Flush flush,
+                              bool* complete) = 0;
+};
+
+// Decoder is the decompressing half of a codec.  DecompressingReader drives
+// it, whatever the format.
+class Decoder {
+ public:
+  virtual ~Decoder() noexcept = default;
+
+  // Decompresses as much of |*in| into |*out| as it can, moving both
+  // forward.  |*ended| is set at the end of the compressed stream, and any
+  // input past it is left in |*in|.
+  virtual base::Result decode(InSpan* in, OutSpan* out, bool* ended) = 0;
+};
+
+class ZlibEncoder : public Encoder {
+ public:
+  ZlibEncoder() noexcept : ready_(false) { ::bzero(&zs_, sizeof(zs_)); }
+
+  ~ZlibEncoder() noexcept override {
+    if (ready_) ::deflateEnd(&zs_);
+  }
+
+  base::Result init(Compression c, int level) {
+    int rc = ::deflateInit2(&zs_, level, Z_DEFLATED, window_bits(c), 8,
+                            Z_DEFAULT_STRATEGY);
+    if (rc != Z_OK) return zlib_result(rc, zs_, "deflateInit2");
+    ready_ = true;
+    return base::Result();
+  }
+
+  base::Result encode(InSpan* in, OutSpan* out, Flush flush,
+                      bool* complete) override;
+
+ private:
+  z_stream zs_;
+  bool ready_;
+};
+
+base::Result ZlibEncoder::encode(InSpan* in, OutSpan* out, Flush flush,
+                                 bool* complete) {
+  int mode = Z_NO_FLUSH;
+  if (flush == Flush::sync) mode = Z_SYNC_FLUSH;
+  if (flush == Flush::finish) mode = Z_FINISH;
+
+  zs_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in->ptr));
+  zs_.avail_in = clamp(in->len);
+  zs_.next_out = reinterpret_cast<Bytef*>(out->ptr);
+  zs_.avail_out = clamp(out->len);
+  uInt in_before = zs_.avail_in;
+  uInt out_before = zs_.avail_out;
+  int rc = ::deflate(&zs_, mode);
+  in->consume(in_before - zs_.avail_in);
+  out->produce(out_before - zs_.avail_out);
+  *complete = (flush == Flush::finish && rc == Z_STREAM_END) ||
+              (flush == Flush::sync && zs_.avail_out != 0);
+  zs_.next_in = nullptr;
+  zs_.avail_in = 0;
+  zs_.next_out = nullptr;
+  zs_.avail_out = 0;
+
+  if (rc != Z_OK && rc != Z_BUF_ERROR && rc != Z_STREAM_END) {
+    return zlib_result(rc, zs_, "deflate");
+  }
+  return base::Result();
+}
+
+class ZlibDecoder : public Decoder {
+ public:
+  ZlibDecoder() noexcept : ready_(false) { ::bzero(&zs_, sizeof(zs_)); }
+
+  ~ZlibDecoder() noexcept override {
+    if (ready_) ::inflateEnd(&zs_);
+  }
+
+  base::Result init(Compression c) {
+    int rc = ::inflateInit2(&zs_, window_bits(c));
+    if (rc != Z_OK) return zlib_result(rc, zs_, "inflateInit2");
+    ready_ = true;
+    return base::Result();
+  }
+
+  base::Result decode(InSpan* in, OutSpan* out, bool* ended) override;
+
+ private:
+  z_stream zs_;
+  bool ready_;
+};
+
+base::Result ZlibDecoder::decode(InSpan* in, OutSpan* out, bool* ended) {
+  zs_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in->ptr));
+  zs_.avail_in = clamp(in->len);
+  zs_.next_out = reinterpret_cast<Bytef*>(out->ptr);
+  zs_.avail_out = clamp(out->len);
+  uInt in_before = zs_.avail_in;
+  uInt out_before = zs_.avail_out;
+  int rc = ::inflate(&zs_, Z_NO_FLUSH);
+  in->consume(in_before - zs_.avail_in);
+  out->produce(out_before - zs_.avail_out);
+  zs_.next_in = nullptr;
+  zs_.avail_in = 0;
+  zs_.next_out = nullptr;
+  zs_.avail_out = 0;
+
+  switch (rc) {
+    case Z_STREAM_END:
+      *ended = true;
+      return base::Result();
+
+    case Z_OK:
+    case Z_BUF_ERROR:
+      return base::Result();
+
+    default:
+      return zlib_result(rc, zs_, "inflate");
+  }
+}
+
+class ZstdEncoder : public Encoder {
+ public:
+  ZstdEncoder() noexcept : cctx_(nullptr) {}
+  ~ZstdEncoder() noexcept override { ::ZSTD_freeCCtx(cctx_); }
+
+  base::Result init(int level);
+  base::Result encode(InSpan* in, OutSpan* out, Flush flush,
+                      bool* complete) override;
+
+ private:
+  ZSTD_CCtx* cctx_;
+};
+
+base::Result ZstdEncoder::init(int level) {
+  // zstd has no store-only level, so 0 is its fastest regular level.
+  if (level == kDefaultCompressionLevel) level = ZSTD_CLEVEL_DEFAULT;
+  if (level == 0) level = 1;
+
+  cctx_ = ::ZSTD_createCCtx();
+  if (cctx_ == nullptr) {
+    return base::Result::resource_exhausted("ZSTD_createCCtx");
+  }
+  std::size_t rc =
+      ::ZSTD_CCtx_setParameter(cctx_, ZSTD_c_compressionLevel, level);
+  if (!::ZSTD_isError(rc)) {
+    rc = ::ZSTD_CCtx_setParameter(cctx_, ZSTD_c_checksumFlag, 1);
+  }
+  if (::ZSTD_isError(rc)) {
+    return zstd_result(rc, "ZSTD_CCtx_setParameter", false);
+  }
+  return base::Result();
+}
+
+base::Result ZstdEncoder::encode(InSpan* in, OutSpan* out, Flush flush,
+                                 bool* complete) {
+  ZSTD_EndDirective mode = ZSTD_e_continue;
+  if (flush == Flush::sync) mode = ZSTD_e_flush;
+  if (flush == Flush::finish) mode = ZSTD_e_end;
+
+  ZSTD_inBuffer ib = {in->ptr, in->len, 0};
+  ZSTD_outBuffer ob = {out->ptr, out->len, 0};
+  std::size_t rc = ::ZSTD_compressStream2(cctx_, &ob, &ib, mode);
+  in->consume(ib.pos);
+  out->produce(ob.pos);
+  if (::ZSTD_isError(rc)) {
+    return zstd_result(rc, "ZSTD_compressStream2", false);
+  }
+  *complete = (flush != Flush::none && rc == 0);
+  return base::Result();
+}
+
+class ZstdDecoder : public Decoder {
+ public:
+  ZstdDecoder() noexcept : dctx_(nullptr) {}
+  ~ZstdDecoder() noexcept override { ::ZSTD_freeDCtx(dctx_); }
+
+  base::Result init() {
+    dctx_ = ::ZSTD_createDCtx();
+    if (dctx_ == nullptr) {
+      return base::Result::resource_exhausted("ZSTD_createDCtx");
+    }
+    return base::Result();
+  }
+
+  base::Result decode(InSpan* in, OutSpan* out, bool* ended) override {
+    ZSTD_inBuffer ib = {in->ptr, in->len, 0};
+    ZSTD_outBuffer ob = {out->ptr, out->len, 0};
+    std::size_t rc = ::ZSTD_decompressStream(dctx_, &ob, &ib);
+    in->consume(ib.pos);
+    out->produce(ob.pos);
+    if (::ZSTD_isError(rc)) {
+      return zstd_result(rc, "ZSTD_decompressStream", true);
+    }
+    // 0 means the frame is complete and all of its output has been given.
+    if (rc == 0) *ended = true;
+    return base::Result();
+  }
+
+ private:
+  ZSTD_DCtx* dctx_;
+};
+
+// LZ4 frame format constants.  The frame is a header, a run of blocks that
+// each start with a little-endian 32-bit length, a zero length to end them,
+// and an optional checksum of the decompressed content.
+static constexpr uint32_t kLZ4Magic = 0x184d2204U;
+static constexpr uint32_t kSkippableMagic = 0x184d2a50U;
+static constexpr uint32_t kSkippableMask = 0xfffffff0U;
+static constexpr uint32_t kUncompressedBit = 0x80000000U;
+static constexpr unsigned char kFlagVersion = 0x40;
+static constexpr unsigned char kFlagVersionMask = 0xc0;
+static constexpr unsigned char kFlagIndependent = 0x20;
+static constexpr unsigned char kFlagBlockChecksum = 0x10;
+static constexpr unsigned char kFlagContentSize = 0x08;
+static constexpr unsigned char kFlagContentChecksum = 0x04;
+static constexpr unsigned char kFlagReserved = 0x02;
+static constexpr unsigned char kFlagDictID = 0x01;
+static constexpr unsigned char kBlockMaxReserved = 0x8f;
+
+// Written frames use independent 64 KiB blocks, with a content checksum.
+static constexpr unsigned int kLZ4BlockMaxID = 4;
+static constexpr std::size_t kLZ4BlockSize = std::size_t(1) << 16;
+
+class LZ4Encoder : public Encoder {
+ public:
+  explicit LZ4Encoder(bool store) noexcept
+      : store_(store),
+        pos_(0),
+        started_(false),
+        ended_(false) {}
+
+  base::Result encode(InSpan* in, OutSpan* out, Flush flush,
+                      bool* complete) override;
+
+ private:
+  void put_header();
+  void put_block();
+  void put_trailer();
+
+  const bool store_;     // if true, blocks are left uncompressed
+  std::string block_;    // input that hasn't been made into a block yet
+  std::string staged_;   // output that hasn't been copied out yet
+  std::size_t pos_;      // how much of |staged_| has been copied out
+  lz4::XXH32 sum_;       // checksum of all input so far
+  bool started_;
+  bool ended_;
+};
+
+base::Result LZ4Encoder::encode(InSpan* in, OutSpan* out, Flush flush,
+                                bool* complete) {
+  *complete = false;
+  if (!started_) {
+    block_.reserve(kLZ4BlockSize);
+    put_header();
+    started_ = true;
+  }
+  while (true) {
+    if (pos_ < staged_.size()) {
+      std::size_t len = std::min(out->len, staged_.size() - pos_);
+      ::memcpy(out->ptr, staged_.data() + pos_, len);
+      out->produce(len);
+      pos_ += len;
+      if (pos_ < staged_.size()) return base::Result();
+      staged_.clear();
+      pos_ = 0;
+    }
+
+    if (ended_) {
+      *complete = true;
+      return base::Result();
+    }
+
+    if (in->len > 0) {
+      std::size_t len = std::min(in->len, kLZ4BlockSize - block_.size());
+      sum_.update(in->ptr, len);
+      block_.append(in->ptr, len);
+      in->consume(len);
+      if (block_.size() == kLZ4BlockSize) put_block();
+      continue;
+    }
+
+    if (flush == Flush::none) return base::Result();
+    if (!block_.empty()) {
+      put_block();
+      continue;
+    }
+    if (flush == Flush::finish) {
+      put_trailer();
+      ended_ = true;
+      continue;
+    }
+    *complete = true;
+    return base::Result();
+  }
+}
+
+void LZ4Encoder::put_header() {
+  put_le32(&staged_, kLZ4Magic);
+  std::size_t at = staged_.size();
+  staged_.push_back(
+      char(kFlagVersion | kFlagIndependent | kFlagContentChecksum));
+  staged_.push_back(char(kLZ4BlockMaxID << 4));
+  uint32_t hc = lz4::xxh32(staged_.data() + at, staged_.size() - at);
+  staged_.push_back(char((hc >> 8) & 0xff));
+}
+
+// Blocks that don't shrink are stored as they are.
+void LZ4Encoder::put_block() {
+  std::size_t at = staged_.size();
+  std::size_t bound = lz4::compress_bound(block_.size());
+  staged_.resize(at + 4 + bound);
+  std::size_t n = 0;
+  if (!store_) {
+    n = lz4::compress_block(&staged_[at + 4], bound, block_.data(),
+                            block_.size());
+  }
+  if (n == 0 || n >= block_.size()) {
+    staged_.resize(at);
+    put_le32(&staged_, block_.size() | kUncompressedBit);
+    staged_.append(block_);
+  } else {
+    std::string word;
+    put_le32(&word, n);
+    staged_.replace(at, 4, word);
+    staged_.resize(at + 4 + n);
+  }
+  block_.clear();
+}
+
+void LZ4Encoder::put_trailer() {
+  put_le32(&staged_, 0);
+  put_le32(&staged_, sum_.finish());
+}
+
+class LZ4Decoder : public Decoder {
+ public:
+  LZ4Decoder() noexcept
+      : state_(State::magic),
+        block_max_(0),
+        block_len_(0),
+        skip_(0),
+        hist_(0),
+        out_pos_(0),
+        out_end_(0),
+        independent_(false),
+        block_checksum_(false),
+        content_checksum_(false),
+        uncompressed_(false) {}
+
+  base::Result decode(InSpan* in, OutSpan* out, bool* ended) override;
+
+ private:
+  enum class State : uint8_t {
+    magic,
+    header,
+    block_size,
+    block_data,
+    content_checksum,
+    skip_size,
+    skip_data,
+    ended,
+  };
+
+  // Moves input into |stage_| until it holds |want| bytes.  Returns true if
+  // it does.
+  bool gather(InSpan* in, std::size_t want);
+
+  base::Result parse_header();
+  base::Result decode_block();
+
+  // Once a block's output has all been copied out, keeps the last 64 KiB of
+  // it as history for the next block, if blocks are linked.
+  void slide();
+
+  State state_;
+  std::string stage_;         // a header, block, or checksum being gathered
+  std::vector<char> window_;  // history, followed by the current block
+  lz4::XXH32 sum_;            // checksum of all output so far
+  std::size_t block_max_;
+  std::size_t block_len_;
+  uint64_t skip_;
+  std::size_t hist_;     // how much of |window_| is history
+  std::size_t out_pos_;  // the next byte of |window_| to copy out
+  std::size_t out_end_;  // the end of the current block in |window_|
+  bool independent_;
+  bool block_checksum_;
+  bool content_checksum_;
+  bool uncompressed_;
+};
+
+base::Result LZ4Decoder::decode(InSpan* in, OutSpan* out, bool* ended) {
+  base::Result r;
+  while (true) {
+    if (out_pos_ < out_end_) {
+      std::size_t len = std::min(out->len, out_end_ - out_pos_);
+      ::memcpy(out->ptr, window_.data() + out_pos_, len);
+      out->produce(len);
+      out_pos_ += len;
+      if (out_pos_ < out_end_) return base::Result();
+      slide();
+    }
+
+    switch (state_) {
+      case State::magic: {
+        if (!gather(in, 4)) return base::Result();
+        uint32_t magic = get_le32(stage_.data());
+        stage_.clear();
+        if (magic == kLZ4Magic) {
+          state_ = State::header;
+        } else if ((magic & kSkippableMask) == kSkippableMagic) {
+          state_ = State::skip_size;
+        } else {
+          return base::Result::data_loss("not an LZ4 frame");
+        }
+        break;
+      }
+
+      case State::header: {
+        if (!gather(in, 2)) return base::Result();
+        unsigned char flg = stage_[0];
+        std::size_t want = 3;
+        if (flg & kFlagContentSize) want += 8;
+        if (flg & kFlagDictID) want += 4;
+        if (!gather(in, want)) return base::Result();
+        r = parse_header();
+        if (!r) return r;
+        stage_.clear();
+        state_ = State::block_size;
+        break;
+      }
+
+      case State::block_size: {
+        if (!gather(in, 4)) return base::Result();
+        uint32_t word = get_le32(stage_.data());
+        stage_.clear();
+        if (word == 0) {
+          state_ = content_checksum_ ? State::content_checksum : State::ended;
+          break;
+        }
+        uncompressed_ = (word & kUncompressedBit) != 0;
+        block_len_ = word & ~kUncompressedBit;
+        if (block_len_ > block_max_) {
+          return base::Result::data_loss("LZ4 block is too large");
+        }
+        state_ = State::block_data;
+        break;
+      }
+
+      case State::block_data: {
+        std::size_t want = block_len_ + (block_checksum_ ? 4 : 0);
+        if (!gather(in, want)) return base::Result();
+        r = decode_block();
+        if (!r) return r;
+        stage_.clear();
+        state_ = State::block_size;
+        break;
+      }
+
+      case State::content_checksum: {
+        if (!gather(in, 4)) return base::Result();
+        if (get_le32(stage_.data()) != sum_.finish()) {
+          return base::Result::data_loss("LZ4 content checksum mismatch");
+        }
+        stage_.clear();
+        state_ = State::ended;
+        break;
+      }
+
+      case State::skip_size: {
+        if (!gather(in, 4)) return base::Result();
+        skip_ = get_le32(stage_.data());
+        stage_.clear();
+        state_ = State::skip_data;
+        break;
+      }
+
+      case State::skip_data: {
+        std::size_t len = std::min<uint64_t>(skip_, in->len);
+        in->consume(len);
+        skip_ -= len;
+        if (skip_ > 0) return base::Result();
+        state_ = State::magic;
+        break;
+      }
+
+      case State::ended:
+        *ended = true;
+        return base::Result();
+    }
+  }
+}
+
+bool LZ4Decoder::gather(InSpan* in, std::size_t want) {
+  std::size_t len = std::min(in->len, want - stage_.size());
+  stage_.append(in->ptr, len);
+  in->consume(len);
+  return stage_.size() == want;
+}
+
+base::Result LZ4Decoder::parse_header() {
+  auto flg = static_cast<unsigned char>(stage_[0]);
+  auto bd = static_cast<unsigned char>(stage_[1]);
+  if ((flg & kFlagVersionMask) != kFlagVersion) {
+    return base::Result::data_loss("unsupported LZ4 frame version");
+  }
+  if ((flg & kFlagReserved) != 0 || (bd & kBlockMaxReserved) != 0) {
+    return base::Result::data_loss("LZ4 frame header has reserved bits set");
+  }
+  uint32_t hc = lz4::xxh32(stage_.data(), stage_.size() - 1);
+  if (static_cast<unsigned char>(stage_.back()) != ((hc >> 8) & 0xff)) {
+    return base::Result::data_loss("LZ4 frame header checksum mismatch");
+  }
+  if ((flg & kFlagDictID) != 0) {
+    return base::Result::not_implemented("LZ4 dictionaries");
+  }
+  unsigned int id = bd >> 4;
+  if (id < 4) return base::Result::data_loss("LZ4 block size is invalid");
+
+  independent_ = (flg & kFlagIndependent) != 0;
+  block_checksum_ = (flg & kFlagBlockChecksum) != 0;
+  content_checksum_ = (flg & kFlagContentChecksum) != 0;
+  block_max_ = std::size_t(1) << (8 + 2 * id);
+  window_.resize((independent_ ? 0 : lz4::kMaxDistance) + block_max_);
+  hist_ = out_pos_ = out_end_ = 0;
+  sum_.reset();
+  return base::Result();
+}
+
+base::Result LZ4Decoder::decode_block() {
+  if (block_checksum_ &&
+      get_le32(stage_.data() + block_len_) !=
+          lz4::xxh32(stage_.data(), block_len_)) {
+    return base::Result::data_loss("LZ4 block checksum mismatch");
+  }
+  char* dst = window_.data() + hist_;
+  std::size_t n = block_len_;
+  if (uncompressed_) {
+    ::memcpy(dst, stage_.data(), n);
+  } else {
+    base::Result r = lz4::decompress_block(dst, block_max_, hist_,
+                                           stage_.data(), block_len_, &n);
+    if (!r) return r;
+  }
+  if (content_checksum_) sum_.update(dst, n);
+  out_pos_ = hist_;
+  out_end_ = hist_ + n;
+  return base::Result();
+}
+
+void LZ4Decoder::slide() {
+  std::size_t keep = 0;
+  if (!independent_) {
+    keep = std::min(out_end_, lz4::kMaxDistance);
+    ::memmove(window_.data(), window_.data() + out_end_ - keep, keep);
+  }
+  hist_ = out_pos_ = out_end_ = keep;
+}
+
+static base::Result new_encoder(std::unique_ptr<Encoder>* out, Compression c,
+                                int level) {
+  switch (c) {
+    case Compression::deflate:
+    case Compression::zlib:
+    case Compression::gzip: {
+      auto enc = base::backport::make_unique<ZlibEncoder>();
+      base::Result r = enc->init(c, level);
+      *out = std::move(enc);
+      return r;
+    }
+
+    case Compression::zstd: {
+      auto enc = base::backport::make_unique<ZstdEncoder>();
+      base::Result r = enc->init(level);
+      *out = std::move(enc);
+      return r;
+    }
+
+    case Compression::lz4:
+      out->reset(new LZ4Encoder(level == 0));
+      return base::Result();
+  }
+  return base::Result::invalid_argument("unknown io::Compression ",
+                                        static_cast<int>(c));
+}
+
+static base::Result new_decoder(std::unique_ptr<Decoder>* out,
+                                Compression c) {
+  switch (c) {
+    case Compression::deflate:
+    case Compression::zlib:
+    case Compression::gzip: {
+      auto dec = base::backport::make_unique<ZlibDecoder>();
+      base::Result r = dec->init(c);
+      *out = std::move(dec);
+      return r;
+    }
+
+    case Compression::zstd: {
+      auto dec = base::backport::make_unique<ZstdDecoder>();
+      base::Result r = dec->init();
+      *out = std::move(dec);
+      return r;
+    }
+
+    case Compression::lz4:
+      out->reset(new LZ4Decoder);
+      return base::Result();
+  }
+  return base::Result::invalid_argument("unknown io::Compression ",
+                                        static_cast<int>(c));
+}
+
+// StreamOp is one call into a CompressingWriter or DecompressingReader,
+// queued until it reaches the head of the line.
+struct StreamOp {
+  enum class Type : uint8_t { read, write, flush, sync, close };
+
+  Type type;
+  event::Task* task;
+  std::size_t* n;
+  char* out;
+  const char* ptr;
+  std::size_t min;
+  std::size_t len;
+  base::Options options;
+  base::Result result;
+
+  StreamOp() noexcept : type(Type::close),
+                        task(nullptr),
+                        n(nullptr),
+                        out(nullptr),
+                        ptr(nullptr),
+                        min(0),
+                        len(0) {}
+
+  StreamOp(Type y, event::Task* t, base::Options o) noexcept
+      : type(y),
+        task(t),
+        n(nullptr),
+        out(nullptr),
+        ptr(nullptr),
+        min(0),
+        len(0),
+        options(std::move(o)) {}
+};
+
+// Sequencer runs StreamOps one at a time, in the order they were queued.
+// A compressed stream is strictly sequential, so this is the only sane way to
+// let callers issue overlapping reads or writes.
+//
+// Subclasses implement |step()|, which either does the next bit of CPU work
+// on the current op, starts one I/O call on |subtask_| via |start_io()|, or
+// finishes the op.  Only one thread at a time is ever inside |step()|, so the
+// codec state needs no locking of its own.
+class Sequencer {
+ protected:
+  enum class Step : uint8_t { again, wait, done };
+
+  Sequencer() noexcept : have_op_(false),
+                         busy_(false),
+                         io_done_(false),
+                         io_async_(false) {}
+
+  virtual ~Sequencer() noexcept = default;
+
+  virtual Step step(StreamOp* op) = 0;
+
+  // Ends |op| with result |r|.  The op's task is finished by |pump()|, after
+  // it is done touching |this|.
+  static Step done(StreamOp* op, base::Result r) {
+    op->result = std::move(r);
+    return Step::done;
+  }
+
+  void enqueue(StreamOp op) {
+    auto lock = base::acquire_lock(mu_);
+    q_.push_back(std::move(op));
+    if (busy_) return;
+    busy_ = true;
+    lock.unlock();
+    pump();
+  }
+
+  // Starts an I/O call on |subtask_|, as a subtask of |op->task|.  |fn| is
+  // given |&subtask_| and must start the call.  The next |step()| sees the
+  // finished |subtask_|.
+  template <typename Fn>
+  Step start_io(StreamOp* op, Fn fn) {
+    subtask_.reset();
+    op->task->add_subtask(&subtask_);
+    auto lock = base::acquire_lock(mu_);
+    io_done_ = false;
+    io_async_ = false;
+    lock.unlock();
+
+    // Some Readers and Writers, e.g. io::Chain, finish tasks while holding
+    // their own locks, so the continuation goes through the dispatcher.
+    fn(&subtask_);
+    subtask_.on_finished(get_manager(op->options).dispatcher(),
+                         event::callback([this] {
+                           io_complete();
+                           return base::Result();
+                         }));
+
+    lock.lock();
+    if (io_done_) return Step::again;
+    io_async_ = true;
+    return Step::wait;
+  }
+
+  event::Task subtask_;
+
+ private:
+  void pump() {
+    auto lock = base::acquire_lock(mu_);
+    while (true) {
+      if (!have_op_) {
+        if (q_.empty()) {
+          busy_ = false;
+          return;
+        }
+        op_ = std::move(q_.front());
+        q_.pop_front();
+        have_op_ = true;
+      }
+      lock.unlock();
+      Step s = step(&op_);
+      // On |wait|, the I/O completion owns the pump now, and may already be
+      // running it on another thread.
+      if (s == Step::wait) return;
+      lock.lock();
+      if (s == Step::again) continue;
+
+      // Finishing the task may wake a caller that then destroys |this|, so
+      // nothing may touch |this| afterward unless more ops are queued.
+      event::Task* task = op_.task;
+      base::Result r = std::move(op_.result);
+      have_op_ = false;
+      bool idle = q_.empty();
+      if (idle) busy_ = false;
+      lock.unlock();
+      task->finish(std::move(r));
+      if (idle) return;
+      lock.lock();
+    }
+  }
+
+  void io_complete() {
+    auto lock = base::acquire_lock(mu_);
+    io_done_ = true;
+    if (!io_async_) return;
+    io_async_ = false;
+    lock.unlock();
+    pump();
+  }
+
+  mutable std::mutex mu_;
+  std::deque<StreamOp> q_;  // protected by mu_
+  StreamOp op_;             // owned by whoever set busy_
+  bool have_op_;            // owned by whoever set busy_
+  bool busy_;               // protected by mu_
+  bool io_done_;            // protected by mu_
+  bool io_async_;           // protected by mu_
+};
+
+class CompressingWriter : public WriterImpl, private Sequencer {
+ public:
+  CompressingWriter(Writer w, Compression c, int level, PoolPtr p)
+      : w_(std::move(w)),
+        pool_(std::move(p)),
+        buffer_(pool_->take()),
+        wn_(0),
+        io_pending_(false),
+        flushed_(false),
+        tail_started_(false),
+        closed_(false) {
+    result_ = new_encoder(&enc_, c, level);
+    if (result_) {
+      reset_output();
+    } else {
+      closed_ = true;
+    }
+  }
+
+  ~CompressingWriter() noexcept override {
+    enc_.reset();
+    pool_->give(std::move(buffer_));
+  }
+
+  std::size_t ideal_block_size() const noexcept override {
+    return pool_->buffer_size();
+  }
+
+  bool is_buffered() const noexcept override { return true; }
+
+  void write(event::Task* task, std::size_t* n, const char* ptr,
+             std::size_t len, const base::Options& opts) override {
+    if (!prologue(task, n, ptr, len)) return;
+    StreamOp op(StreamOp::Type::write, task, opts);
+    op.n = n;
+    op.ptr = ptr;
+    op.len = len;
+    enqueue(std::move(op));
+  }
+
+  void flush(event::Task* task, const base::Options& opts) override {
+    if (!prologue(task)) return;
+    enqueue(StreamOp(StreamOp::Type::flush, task, opts));
+  }
+
+  void sync(event::Task* task, const base::Options& opts) override {
+    if (!prologue(task)) return;
+    enqueue(StreamOp(StreamOp::Type::sync, task, opts));
+  }
+
+  void close(event::Task* task, const base::Options& opts) override {
+    if (!prologue(task)) return;
+    enqueue(StreamOp(StreamOp::Type::close, task, opts));
+  }
+
+ private:
+  Step step(StreamOp* op) override;
+  Step write_out(StreamOp* op);
+  Step start_tail(StreamOp* op);
+  Step finish(StreamOp* op, base::Result r);
+
+  std::size_t pending() const noexcept { return buffer_.size() - out_.len; }
+
+  void reset_output() noexcept {
+    out_ = OutSpan(buffer_.data(), buffer_.size());
+  }
+
+  const Writer w_;
+  const PoolPtr pool_;
+  OwnedBuffer buffer_;
+  std::unique_ptr<Encoder> enc_;
+  OutSpan out_;  // the unfilled part of |buffer_|
+  base::Result result_;  // sticky; once an error, always an error
+  std::size_t wn_;
+  bool io_pending_;
+  bool flushed_;
+  bool tail_started_;
+  bool closed_;
+};
+
+CompressingWriter::Step CompressingWriter::step(StreamOp* op) {
+  if (io_pending_) {
+    io_pending_ = false;
+    base::Result r;
+    if (subtask_.result_will_throw()) {
+      r = base::Result::unknown();
+    } else {
+      r = subtask_.result();
+    }
+    if (!tail_started_ && r) reset_output();
+    if (result_) result_ = std::move(r);
+    if (tail_started_) return finish(op, result_);
+  }
+
+  if (!result_) return finish(op, result_);
+
+  if (closed_) {
+    if (op->type == StreamOp::Type::close) return finish(op, base::Result());
+    return finish(op, writer_closed());
+  }
+
+  bool complete = false;
+  if (op->type == StreamOp::Type::write) {
+    if (out_.len == 0) return write_out(op);
+    if (*op->n == op->len) return finish(op, base::Result());
+    InSpan in(op->ptr + *op->n, op->len - *op->n);
+    base::Result r = enc_->encode(&in, &out_, Flush::none, &complete);
+    *op->n = op->len - in.len;
+    if (!r) result_ = std::move(r);
+    return Step::again;
+  }
+
+  if (!flushed_) {
+    if (out_.len == 0) return write_out(op);
+    bool last = (op->type == StreamOp::Type::close);
+    InSpan in;
+    base::Result r = enc_->encode(&in, &out_,
+                                  last ? Flush::finish : Flush::sync,
+                                  &complete);
+    if (!r) {
+      result_ = std::move(r);
+    } else if (complete) {
+      flushed_ = true;
+    }
+    return Step::again;
+  }
+
+  if (pending() > 0) return write_out(op);
+  return start_tail(op);
+}
+
+CompressingWriter::Step CompressingWriter::write_out(StreamOp* op) {
+  io_pending_ = true;
+  wn_ = 0;
+  const char* ptr = buffer_.data();
+  std::size_t len = pending();
+  return start_io(op, [this, op, ptr, len](event::Task* subtask) {
+    w_.write(subtask, &wn_, ptr, len, op->options);
+  });
+}
+
+CompressingWriter::Step CompressingWriter::start_tail(StreamOp* op) {
+  io_pending_ = true;
+  tail_started_ = true;
+  return start_io(op, [this, op](event::Task* subtask) {
+    switch (op->type) {
+      case StreamOp::Type::flush:
+        w_.flush(subtask, op->options);
+        break;
+
+      case StreamOp::Type::sync:
+        w_.sync(subtask, op->options);
+        break;
+
+      default:
+        w_.close(subtask, op->options);
+    }
+  });
+}
+
+CompressingWriter::Step CompressingWriter::finish(StreamOp* op,
+                                                  base::Result r) {
+  if (op->type == StreamOp::Type::close) closed_ = true;
+  flushed_ = false;
+  tail_started_ = false;
+  return done(op, std::move(r));
+}
+
+class DecompressingReader : public ReaderImpl, private Sequencer {
+ public:
+  DecompressingReader(Reader r, Compression c, PoolPtr p)
+      : r_(std::move(r)),
+        pool_(std::move(p)),
+        buffer_(pool_->take()),
+        rn_(0),
+        io_pending_(false),
+        input_eof_(false),
+        ended_(false),
+        closing_(false),
+        closed_(false) {
+    result_ = new_decoder(&dec_, c);
+  }
+
+  ~DecompressingReader() noexcept override {
+    dec_.reset();
+    pool_->give(std::move(buffer_));
+  }
+
+  std::size_t ideal_block_size() const noexcept override {
+    return pool_->buffer_size();
+  }
+
+  bool is_buffered() const noexcept override { return true; }
+
+  void read(event::Task* task, char* out, std::size_t* n, std::size_t min,
+            std::size_t max, const base::Options& opts) override {
+    if (!prologue(task, out, n, min, max)) return;
+    StreamOp op(StreamOp::Type::read, task, opts);
+    op.n = n;
+    op.out = out;
+    op.min = min;
+    op.len = max;
+    enqueue(std::move(op));
+  }
+
+  void close(event::Task* task, const base::Options& opts) override {
+    if (!prologue(task)) return;
+    enqueue(StreamOp(StreamOp::Type::close, task, opts));
+  }
+
+ private:
+  Step step(StreamOp* op) override;
+  Step fill(StreamOp* op);
+  void give_back_unused();
+
+  const Reader r_;
+  const PoolPtr pool_;
+  OwnedBuffer buffer_;
+  std::unique_ptr<Decoder> dec_;
+  InSpan in_;            // the unconsumed part of |buffer_|
+  base::Result result_;  // sticky; once an error, always an error
+  std::size_t rn_;
+  bool io_pending_;
+  bool input_eof_;
+  bool ended_;
+  bool closing_;
+  bool closed_;
+};
+
+DecompressingReader::Step DecompressingReader::step(StreamOp* op) {
+  if (io_pending_) {
+    io_pending_ = false;
+    base::Result r;
+    if (subtask_.result_will_throw()) {
+      r = base::Result::unknown();
+    } else {
+      r = subtask_.result();
+    }
+    if (closing_) {
+      closing_ = false;
+      closed_ = true;
+      return done(op, std::move(r));
+    }
+    in_ = InSpan(buffer_.data(), rn_);
+    if (rn_ == 0) input_eof_ = true;
+    if (r.code() == base::ResultCode::END_OF_FILE) {
+      input_eof_ = true;
+    } else if (!r && result_) {
+      result_ = std::move(r);
+    }
+  }
+
+  if (op->type == StreamOp::Type::close) {
+    if (closed_) return done(op, reader_closed());
+    io_pending_ = true;
+    closing_ = true;
+    return start_io(op, [this, op](event::Task* subtask) {
+      r_.close(subtask, op->options);
+    });
+  }
+
+  if (closed_) return done(op, reader_closed());
+
+  std::size_t want = (op->min > 0) ? op->min : 1;
+  if (*op->n >= want || *op->n == op->len) return done(op, base::Result());
+  if (!result_) return done(op, result_);
+  if (ended_) {
+    if (*op->n < op->min) return done(op, base::Result::eof());
+    return done(op, base::Result());
+  }
+
+  return fill(op);
+}
+
+DecompressingReader::Step DecompressingReader::fill(StreamOp* op) {
+  // Try to make progress with the input we already have.  Even with no input,
+  // the codec may be holding output that didn't fit last time.
+  OutSpan out(op->out + *op->n, op->len - *op->n);
+  std::size_t in_before = in_.len;
+  std::size_t out_before = out.len;
+  bool ended = false;
+  base::Result r = dec_->decode(&in_, &out, &ended);
+  *op->n += out_before - out.len;
+  bool progress = (in_.len != in_before || out.len != out_before);
+
+  if (!r) {
+    result_ = std::move(r);
+    return Step::again;
+  }
+  if (ended) {
+    ended_ = true;
+    give_back_unused();
+    return Step::again;
+  }
+  if (progress) return Step::again;
+
+  if (input_eof_) {
+    result_ = base::Result::data_loss("compressed stream is truncated");
+    return Step::again;
+  }
+
+  io_pending_ = true;
+  rn_ = 0;
+  return start_io(op, [this, op](event::Task* subtask) {
+    r_.read(subtask, buffer_.data(), &rn_, 1, buffer_.size(), op->options);
+  });
+}
+
+// Read-ahead may have pulled in bytes past the end of the compressed stream.
+// Hand them back to |r_|, if it allows that.
+void DecompressingReader::give_back_unused() {
+  if (in_.len == 0) return;
+  if (r_.can_unread()) {
+    base::Result r = r_.unread(in_.ptr, in_.len);
+    if (!r) LOG(WARN) << "io::DecompressingReader: " << r;
+  }
+  in_ = InSpan();
+}
+
+static PoolPtr default_pool(std::size_t block_size) {
+  return make_pool(block_size, kMaxPoolBuffers);
+}
+}  // inline namespace implementation
+
+Reader decompressingreader(Reader r, Compression c, PoolPtr pool) {
+  CHECK_NOTNULL(pool.get());
+  return Reader(std::make_shared<DecompressingReader>(std::move(r), c,
+                                                      std::move(pool)));
+}
+
+Reader decompressingreader(Reader r, Compression c) {
+  PoolPtr pool = default_pool(r.ideal_block_size());
+  return decompressingreader(std::move(r), c, std::move(pool));
+}
+
+Writer compressingwriter(Writer w, Compression c, int level, PoolPtr pool) {
+  CHECK_NOTNULL(pool.get());
+  CHECK_GE(level, kDefaultCompressionLevel);
+  CHECK_LE(level, 9);
+  return Writer(std::make_shared<CompressingWriter>(std::move(w), c, level,
+                                                    std::move(pool)));
+}
+
+Writer compressingwriter(Writer w, Compression c, int level) {
+  PoolPtr pool = default_pool(w.ideal_block_size());
+  return compressingwriter(std::move(w), c, level, std::move(pool));
+}
+
+}  // namespace io
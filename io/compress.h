@@ -0,0 +1,65 @@
+// io/compress.h - Streaming compression and decompression
+// Copyright © 2017 by Donald King <chronos@chronos-tachyon.net>
+// Available under the MIT License. See LICENSE for details.
+
+#ifndef IO_COMPRESS_H
+#define IO_COMPRESS_H
+
+#include <cstdint>
+
+#include "io/buffer.h"
+#include "io/reader.h"
+#include "io/writer.h"
+
+namespace io {
+
+// Compression selects the format of a compressed stream.
+enum class Compression : uint8_t {
+  // Raw DEFLATE (RFC 1951), with no header or trailer.
+  deflate = 0,
+
+  // The zlib format (RFC 1950), with a 2-byte header and an Adler-32 trailer.
+  zlib = 1,
+
+  // The gzip format (RFC 1952), with a 10-byte header and a CRC-32 trailer.
+  gzip = 2,
+
+  // The Zstandard frame format (RFC 8878), with a content checksum.
+  zstd = 3,
+
+  // The LZ4 frame format, in independent 64 KiB blocks with a content
+  // checksum.  Much faster than the others, but with larger output.
+  lz4 = 4,
+};
+
+// Lets the codec pick its own speed/size tradeoff.  Otherwise, compression
+// levels run from 0 to 9 (smallest output).
+// - For DEFLATE, 0 means store only
+// - For zstd, 0 is the same as 1
+// - For LZ4, 0 means store only and 1 through 9 are all the same
+constexpr int kDefaultCompressionLevel = -1;
+
+// Returns a Reader that decompresses the data read from |r|.
+// - Compressed input is read into buffers from |pool|, and |ideal_block_size()|
+//   is the pool's buffer size
+// - If no pool is given, one is made to match |r.ideal_block_size()|
+// - Reads past the end of the compressed stream return END_OF_FILE; corrupt
+//   or truncated input is DATA_LOSS
+Reader decompressingreader(Reader r, Compression c, PoolPtr pool);
+Reader decompressingreader(Reader r, Compression c = Compression::gzip);
+
+// Returns a Writer that compresses the data written to it and writes the
+// result to |w|.
+// - Compressed output is staged in a buffer from |pool| and written to |w|
+//   one full buffer at a time; |ideal_block_size()| is the pool's buffer size
+// - If no pool is given, one is made to match |w.ideal_block_size()|
+// - |flush()| and |sync()| push out everything written so far, so that the
+//   reader on the other end can decompress it, then flush or sync |w|
+// - |close()| writes the stream trailer, then closes |w|
+Writer compressingwriter(Writer w, Compression c, int level, PoolPtr pool);
+Writer compressingwriter(Writer w, Compression c = Compression::gzip,
+                         int level = kDefaultCompressionLevel);
+
+}  // namespace io
+
+#endif  // IO_COMPRESS_H
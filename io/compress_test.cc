@@ -0,0 +1,243 @@
+// Copyright © 2017 by Donald King <chronos@chronos-tachyon.net>
+// Available under the MIT License. See LICENSE for details.
+
+#include "gtest/gtest.h"
+
+#include <zlib.h>
+#include <zstd.h>
+
+#include "base/logging.h"
+#include "base/result_testing.h"
+#include "io/compress.h"
+#include "io/util.h"
+
+static std::string make_input(std::size_t len) {
+  std::string out;
+  uint32_t x = 12345;
+  while (out.size() < len) {
+    x = x * 1103515245U + 12345U;
+    std::size_t word = (x >> 16) % 8;
+    out.append("the quick brown fox jumps over lazy dogs " + word * 5, 5);
+    if ((x >> 8) % 11 == 0) out.push_back('\n');
+  }
+  out.resize(len);
+  return out;
+}
+
+static const io::Compression kAll[] = {
+    io::Compression::deflate, io::Compression::zlib, io::Compression::gzip,
+    io::Compression::zstd,    io::Compression::lz4,
+};
+
+static std::string compress_all(const std::string& in, io::Compression c,
+                                io::PoolPtr pool) {
+  std::string out;
+  io::Writer w =
+      io::compressingwriter(io::stringwriter(&out), c,
+                            io::kDefaultCompressionLevel, std::move(pool));
+  std::size_t pos = 0, step = 1;
+  while (pos < in.size()) {
+    std::size_t len = std::min(step, in.size() - pos);
+    std::size_t n = 0;
+    EXPECT_OK(w.write(&n, in.data() + pos, len));
+    EXPECT_EQ(len, n);
+    pos += len;
+    step = step * 3 + 1;
+  }
+  EXPECT_OK(w.close());
+  return out;
+}
+
+static std::string decompress_all(const std::string& in, io::Compression c,
+                                  io::PoolPtr pool) {
+  std::string out;
+  io::Reader r =
+      io::decompressingreader(io::stringreader(in), c, std::move(pool));
+  std::size_t n = 0;
+  EXPECT_OK(io::copy(&n, io::stringwriter(&out), r));
+  EXPECT_EQ(out.size(), n);
+  return out;
+}
+
+static void TestRoundTrip(io::Compression c, double ratio = 0.5) {
+  std::string in = make_input(100000);
+
+  std::string z = compress_all(in, c, io::make_pool(64, 4));
+  EXPECT_LT(z.size(), in.size() * ratio);
+  EXPECT_EQ(in, decompress_all(z, c, io::make_pool(64, 4)));
+  EXPECT_EQ(in, decompress_all(z, c, io::make_pool(1U << 16, 4)));
+}
+
+TEST(Compress, RoundTripDeflate) { TestRoundTrip(io::Compression::deflate); }
+TEST(Compress, RoundTripZlib) { TestRoundTrip(io::Compression::zlib); }
+TEST(Compress, RoundTripGzip) { TestRoundTrip(io::Compression::gzip); }
+TEST(Compress, RoundTripZstd) { TestRoundTrip(io::Compression::zstd); }
+TEST(Compress, RoundTripLZ4) {
+  // LZ4 gives up some compression for speed.
+  TestRoundTrip(io::Compression::lz4, 0.6);
+}
+
+TEST(Compress, RoundTripLevels) {
+  std::string in = make_input(200000);
+  for (io::Compression c : kAll) {
+    for (int level : {0, 1, 9}) {
+      SCOPED_TRACE(static_cast<int>(c));
+      SCOPED_TRACE(level);
+      std::string z;
+      io::Writer w = io::compressingwriter(io::stringwriter(&z), c, level);
+      std::size_t n = 0;
+      EXPECT_OK(w.write(&n, in.data(), in.size()));
+      EXPECT_OK(w.close());
+      EXPECT_EQ(in, decompress_all(z, c, io::make_pool(64, 4)));
+    }
+  }
+}
+
+TEST(Compress, InteropZlib) {
+  std::string in = make_input(5000);
+
+  std::string z = compress_all(in, io::Compression::zlib, io::make_pool(64, 4));
+  std::string out(in.size(), '\0');
+  uLongf outlen = out.size();
+  ASSERT_EQ(Z_OK, ::uncompress(reinterpret_cast<Bytef*>(&out[0]), &outlen,
+                               reinterpret_cast<const Bytef*>(z.data()),
+                               z.size()));
+  EXPECT_EQ(in.size(), outlen);
+  EXPECT_EQ(in, out);
+
+  uLongf zlen = ::compressBound(in.size());
+  z.assign(zlen, '\0');
+  ASSERT_EQ(Z_OK, ::compress(reinterpret_cast<Bytef*>(&z[0]), &zlen,
+                             reinterpret_cast<const Bytef*>(in.data()),
+                             in.size()));
+  z.resize(zlen);
+  EXPECT_EQ(in, decompress_all(z, io::Compression::zlib, io::make_pool(64, 4)));
+}
+
+TEST(Compress, InteropZstd) {
+  std::string in = make_input(5000);
+
+  std::string z = compress_all(in, io::Compression::zstd, io::make_pool(64, 4));
+  std::string out(in.size(), '\0');
+  std::size_t outlen =
+      ::ZSTD_decompress(&out[0], out.size(), z.data(), z.size());
+  ASSERT_FALSE(::ZSTD_isError(outlen)) << ::ZSTD_getErrorName(outlen);
+  EXPECT_EQ(in.size(), outlen);
+  EXPECT_EQ(in, out);
+
+  z.assign(::ZSTD_compressBound(in.size()), '\0');
+  std::size_t zlen = ::ZSTD_compress(&z[0], z.size(), in.data(), in.size(), 3);
+  ASSERT_FALSE(::ZSTD_isError(zlen)) << ::ZSTD_getErrorName(zlen);
+  z.resize(zlen);
+  EXPECT_EQ(in, decompress_all(z, io::Compression::zstd, io::make_pool(64, 4)));
+}
+
+static std::string unhex(const char* hex) {
+  std::string out;
+  while (hex[0] != '\0' && hex[1] != '\0') {
+    out.push_back(char(std::stoi(std::string(hex, 2), nullptr, 16)));
+    hex += 2;
+  }
+  return out;
+}
+
+TEST(Compress, InteropLZ4) {
+  // Frames written by the reference implementation (lz4 1.9), exercising the
+  // optional header fields and checksums that compressingwriter() doesn't
+  // emit itself.
+  std::string hello;
+  for (int i = 0; i < 3; ++i) {
+    hello += "hello hello hello hello hello hello, world!\n";
+  }
+  // Content size, block checksums, and a content checksum.
+  std::string z = unhex(
+      "04224d187c408400000000000000b4240000006f68656c6c6f2006000a9f2c2077"
+      "6f726c64210a26000a0244000f2c001d50726c64210a7b25c6220000000007183153");
+  EXPECT_EQ(hello, decompress_all(z, io::Compression::lz4,
+                                  io::make_pool(64, 4)));
+
+  // Linked blocks, where the second block's first match reaches back into
+  // the first block.
+  std::string alpha;
+  while (alpha.size() < 70000) {
+    alpha += "0123456789abcdefghijklmnopqrstuvwxyz\n";
+  }
+  alpha.resize(70000);
+  z = unhex(
+      "04224d185440ae30010000ff16303132333435363738396162636465666768696a"
+      "6b6c6d6e6f707172737475767778797a0a2500");
+  z.append(256, '\xff');
+  z += unhex(
+      "c350343536373801ba2f1c1b0000000ff7ffffffffffffffffffffffffffffffff"
+      "ffff6950737475767764bf257700000000c5463535");
+  EXPECT_EQ(alpha, decompress_all(z, io::Compression::lz4,
+                                  io::make_pool(64, 4)));
+
+  // A skippable frame before the real one is ignored.
+  std::string skip = unhex("522a4d18050000000102030405");
+  EXPECT_EQ(alpha, decompress_all(skip + z, io::Compression::lz4,
+                                  io::make_pool(64, 4)));
+}
+
+TEST(Compress, Flush) {
+  for (io::Compression c : kAll) {
+    SCOPED_TRACE(static_cast<int>(c));
+    std::string z;
+    io::Writer w = io::compressingwriter(io::stringwriter(&z), c);
+
+    std::size_t n = 0;
+    EXPECT_OK(w.write(&n, "hello, world!\n", 14));
+    EXPECT_OK(w.flush());
+    if (c == io::Compression::gzip) {
+      ASSERT_GE(z.size(), 2U);
+      EXPECT_EQ('\x1f', z[0]);
+      EXPECT_EQ('\x8b', z[1]);
+    }
+
+    // Everything written before the flush can be decompressed, even though
+    // the stream has no trailer yet.
+    std::string out;
+    io::Reader r = io::decompressingreader(io::stringreader(z), c);
+    EXPECT_OK(r.read(&out, 14, 14));
+    EXPECT_EQ("hello, world!\n", out);
+
+    EXPECT_OK(w.close());
+    EXPECT_EQ(base::ResultCode::FAILED_PRECONDITION,
+              w.write(&n, "x", 1).code());
+  }
+}
+
+TEST(Compress, Errors) {
+  std::string in = make_input(5000);
+  for (io::Compression c : kAll) {
+    SCOPED_TRACE(static_cast<int>(c));
+    std::string z = compress_all(in, c, io::make_pool(64, 4));
+
+    std::string out;
+    io::Reader r =
+        io::decompressingreader(io::stringreader(z.substr(0, z.size() / 2)), c);
+    std::size_t n = 0;
+    EXPECT_EQ(base::ResultCode::DATA_LOSS,
+              io::copy(&n, io::stringwriter(&out), r).code());
+    EXPECT_EQ(in.substr(0, out.size()), out);
+
+    // Raw DEFLATE has no checksum, so corruption may go unnoticed.
+    if (c == io::Compression::deflate) continue;
+    z[z.size() / 2] ^= 0x55;
+    z[z.size() / 2 + 1] ^= 0x55;
+    out.clear();
+    r = io::decompressingreader(io::stringreader(z), c);
+    EXPECT_EQ(base::ResultCode::DATA_LOSS,
+              io::copy(&n, io::stringwriter(&out), r).code());
+  }
+
+  // Not a stream of the requested format at all.
+  std::string out;
+  io::Reader r = io::decompressingreader(
+      io::stringreader("definitely not compressed"), io::Compression::lz4);
+  std::size_t n = 0;
+  EXPECT_EQ(base::ResultCode::DATA_LOSS,
+            io::copy(&n, io::stringwriter(&out), r).code());
+
+  base::log_flush();
+}
@@ -0,0 +1,283 @@
+// Copyright © 2017 by Donald King <chronos@chronos-tachyon.net>
+// Available under the MIT License. See LICENSE for details.
+
+#include "io/lz4.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace io {
+namespace lz4 {
+
+inline namespace implementation {
+// The shortest match that the format can express.
+static constexpr std::size_t kMinMatch = 4;
+
+// The last 5 bytes of a block are always literals, and the last match must
+// start at least 12 bytes before the end.
+static constexpr std::size_t kLastLiterals = 5;
+static constexpr std::size_t kMatchFindLimit = 12;
+
+// The match finder hashes 4-byte sequences into a table of 2**kHashLog
+// recent positions.
+static constexpr unsigned int kHashLog = 12;
+
+// Every 2**kSkipShift misses in a row, the search steps one byte further.
+static constexpr unsigned int kSkipShift = 6;
+
+static uint32_t load32(const char* p) noexcept {
+  uint32_t v;
+  ::memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static uint32_t load32le(const unsigned char* p) noexcept {
+  return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) |
+         (uint32_t(p[3]) << 24);
+}
+
+static uint32_t hash4(uint32_t v) noexcept {
+  return (v * 2654435761U) >> (32 - kHashLog);
+}
+
+static uint32_t rotl32(uint32_t x, unsigned int r) noexcept {
+  return (x << r) | (x >> (32 - r));
+}
+
+// Appends the variable-length tail of a length that didn't fit in its
+// 4-bit token field.
+static char* put_length(char* op, std::size_t len) noexcept {
+  while (len >= 255) {
+    *op++ = char(255);
+    len -= 255;
+  }
+  *op++ = char(len);
+  return op;
+}
+
+// Appends one sequence: |lit| literals from |anchor|, followed by a match of
+// |mlen| bytes at |offset| (or no match at all, for the final sequence, when
+// |mlen| is 0).  Returns nullptr if the sequence doesn't fit.
+static char* put_sequence(char* op, char* oend, const char* anchor,
+                          std::size_t lit, std::size_t offset,
+                          std::size_t mlen) noexcept {
+  std::size_t need = 1 + lit + (lit / 255 + 1);
+  if (mlen != 0) need += 2 + (mlen / 255 + 1);
+  if (std::size_t(oend - op) < need) return nullptr;
+
+  std::size_t mcode = (mlen != 0) ? mlen - kMinMatch : 0;
+  char* token = op++;
+  *token = char((std::min<std::size_t>(lit, 15) << 4) |
+                std::min<std::size_t>(mcode, 15));
+  if (lit >= 15) op = put_length(op, lit - 15);
+  ::memcpy(op, anchor, lit);
+  op += lit;
+  if (mlen == 0) return op;
+
+  *op++ = char(offset & 0xff);
+  *op++ = char(offset >> 8);
+  if (mcode >= 15) op = put_length(op, mcode - 15);
+  return op;
+}
+
+// Reads the variable-length tail of a length whose 4-bit token field was
+// saturated.  Returns false if the block ends first.
+static bool get_length(const unsigned char** ip, const unsigned char* iend,
+                       std::size_t* len) noexcept {
+  unsigned char b;
+  do {
+    if (*ip == iend) return false;
+    b = *(*ip)++;
+    *len += b;
+  } while (b == 255);
+  return true;
+}
+
+static base::Result corrupt_block() {
+  return base::Result::data_loss("LZ4 block is corrupt");
+}
+
+static constexpr uint32_t kPrime1 = 2654435761U;
+static constexpr uint32_t kPrime2 = 2246822519U;
+static constexpr uint32_t kPrime3 = 3266489917U;
+static constexpr uint32_t kPrime4 = 668265263U;
+static constexpr uint32_t kPrime5 = 374761393U;
+
+static uint32_t xxh_round(uint32_t acc, uint32_t input) noexcept {
+  acc += input * kPrime2;
+  acc = rotl32(acc, 13);
+  return acc * kPrime1;
+}
+}  // inline namespace implementation
+
+std::size_t compress_block(char* dst, std::size_t cap, const char* src,
+                           std::size_t len) noexcept {
+  char* op = dst;
+  char* const oend = dst + cap;
+  const char* anchor = src;
+  const char* const iend = src + len;
+
+  if (len > kMatchFindLimit) {
+    const char* const mflimit = iend - kMatchFindLimit;
+    const char* const matchlimit = iend - kLastLiterals;
+    uint32_t table[1U << kHashLog];
+    ::bzero(table, sizeof(table));
+
+    const char* ip = src + 1;
+    std::size_t misses = std::size_t(1) << kSkipShift;
+    while (ip < mflimit) {
+      uint32_t seq = load32(ip);
+      uint32_t h = hash4(seq);
+      const char* ref = src + table[h];
+      table[h] = ip - src;
+      if (ref >= ip || std::size_t(ip - ref) > kMaxDistance ||
+          load32(ref) != seq) {
+        ip += misses++ >> kSkipShift;
+        continue;
+      }
+
+      while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+        --ip;
+        --ref;
+      }
+      const char* mp = ip + kMinMatch;
+      const char* rp = ref + kMinMatch;
+      while (mp < matchlimit && *mp == *rp) {
+        ++mp;
+        ++rp;
+      }
+
+      op = put_sequence(op, oend, anchor, ip - anchor, ip - ref, mp - ip);
+      if (op == nullptr) return 0;
+      ip = anchor = mp;
+      misses = std::size_t(1) << kSkipShift;
+      if (ip < mflimit) table[hash4(load32(ip - 2))] = ip - 2 - src;
+    }
+  }
+
+  op = put_sequence(op, oend, anchor, iend - anchor, 0, 0);
+  if (op == nullptr) return 0;
+  return op - dst;
+}
+
+base::Result decompress_block(char* dst, std::size_t cap, std::size_t dict,
+                              const char* src, std::size_t len,
+                              std::size_t* n) {
+  auto* ip = reinterpret_cast<const unsigned char*>(src);
+  auto* const iend = ip + len;
+  char* op = dst;
+  char* const oend = dst + cap;
+  const char* const lowest = dst - dict;
+
+  *n = 0;
+  if (ip == iend) return corrupt_block();
+  while (true) {
+    unsigned char token = *ip++;
+
+    std::size_t lit = token >> 4;
+    if (lit == 15 && !get_length(&ip, iend, &lit)) return corrupt_block();
+    if (std::size_t(iend - ip) < lit) return corrupt_block();
+    if (std::size_t(oend - op) < lit) return corrupt_block();
+    ::memcpy(op, ip, lit);
+    op += lit;
+    ip += lit;
+    if (ip == iend) break;
+
+    if (iend - ip < 2) return corrupt_block();
+    std::size_t offset = std::size_t(ip[0]) | (std::size_t(ip[1]) << 8);
+    ip += 2;
+    if (offset == 0 || offset > std::size_t(op - lowest)) {
+      return corrupt_block();
+    }
+
+    std::size_t mlen = token & 15;
+    if (mlen == 15 && !get_length(&ip, iend, &mlen)) return corrupt_block();
+    mlen += kMinMatch;
+    if (std::size_t(oend - op) < mlen) return corrupt_block();
+
+    // The match may overlap the bytes it produces, e.g. for runs.
+    const char* match = op - offset;
+    for (std::size_t i = 0; i < mlen; ++i) op[i] = match[i];
+    op += mlen;
+  }
+  *n = op - dst;
+  return base::Result();
+}
+
+void XXH32::reset(uint32_t seed) noexcept {
+  v_[0] = seed + kPrime1 + kPrime2;
+  v_[1] = seed + kPrime2;
+  v_[2] = seed;
+  v_[3] = seed - kPrime1;
+  seed_ = seed;
+  total_ = 0;
+  buflen_ = 0;
+}
+
+void XXH32::update(const char* ptr, std::size_t len) noexcept {
+  auto* p = reinterpret_cast<const unsigned char*>(ptr);
+  total_ += len;
+
+  if (buflen_ > 0) {
+    std::size_t take = std::min(len, sizeof(buf_) - buflen_);
+    ::memcpy(buf_ + buflen_, p, take);
+    buflen_ += take;
+    p += take;
+    len -= take;
+    if (buflen_ < sizeof(buf_)) return;
+    for (unsigned int i = 0; i < 4; ++i) {
+      v_[i] = xxh_round(v_[i], load32le(buf_ + 4 * i));
+    }
+    buflen_ = 0;
+  }
+
+  while (len >= 16) {
+    for (unsigned int i = 0; i < 4; ++i) {
+      v_[i] = xxh_round(v_[i], load32le(p + 4 * i));
+    }
+    p += 16;
+    len -= 16;
+  }
+
+  ::memcpy(buf_, p, len);
+  buflen_ = len;
+}
+
+uint32_t XXH32::finish() const noexcept {
+  uint32_t h;
+  if (total_ >= 16) {
+    h = rotl32(v_[0], 1) + rotl32(v_[1], 7) + rotl32(v_[2], 12) +
+        rotl32(v_[3], 18);
+  } else {
+    h = seed_ + kPrime5;
+  }
+  h += uint32_t(total_);
+
+  const unsigned char* p = buf_;
+  const unsigned char* const end = buf_ + buflen_;
+  while (end - p >= 4) {
+    h += load32le(p) * kPrime3;
+    h = rotl32(h, 17) * kPrime4;
+    p += 4;
+  }
+  while (p < end) {
+    h += (*p++) * kPrime5;
+    h = rotl32(h, 11) * kPrime1;
+  }
+
+  h ^= h >> 15;
+  h *= kPrime2;
+  h ^= h >> 13;
+  h *= kPrime3;
+  h ^= h >> 16;
+  return h;
+}
+
+uint32_t xxh32(const char* ptr, std::size_t len, uint32_t seed) noexcept {
+  XXH32 x(seed);
+  x.update(ptr, len);
+  return x.finish();
+}
+
+}  // namespace lz4
+}  // namespace io
@@ -0,0 +1,63 @@
+// io/lz4.h - LZ4 block format and the xxHash-32 checksum
+// Copyright © 2017 by Donald King <chronos@chronos-tachyon.net>
+// Available under the MIT License. See LICENSE for details.
+
+#ifndef IO_LZ4_H
+#define IO_LZ4_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "base/result.h"
+
+namespace io {
+namespace lz4 {
+
+// The farthest back that a match may refer, and thus the most history that
+// a block can depend on.
+constexpr std::size_t kMaxDistance = 65535;
+
+// Returns the most space that |compress_block()| can need for |len| bytes.
+constexpr std::size_t compress_bound(std::size_t len) noexcept {
+  return len + len / 255 + 16;
+}
+
+// Compresses the |len| bytes at |src| into a self-contained LZ4 block at
+// |dst|, which has room for |cap| bytes.  Returns the length of the block,
+// or 0 if it didn't fit.
+std::size_t compress_block(char* dst, std::size_t cap, const char* src,
+                           std::size_t len) noexcept;
+
+// Decompresses the LZ4 block of |len| bytes at |src| into |dst|, which has
+// room for |cap| bytes, and stores the decompressed length in |*n|.
+// - Matches may refer back into the |dict| bytes just before |dst|
+// - Corrupt blocks, and blocks that need more than |cap| bytes, are DATA_LOSS
+base::Result decompress_block(char* dst, std::size_t cap, std::size_t dict,
+                              const char* src, std::size_t len,
+                              std::size_t* n);
+
+// XXH32 computes the 32-bit xxHash of a byte stream, which the LZ4 frame
+// format uses for its header, block, and content checksums.
+class XXH32 {
+ public:
+  explicit XXH32(uint32_t seed = 0) noexcept { reset(seed); }
+
+  void reset(uint32_t seed = 0) noexcept;
+  void update(const char* ptr, std::size_t len) noexcept;
+  uint32_t finish() const noexcept;
+
+ private:
+  uint32_t v_[4];
+  uint32_t seed_;
+  uint64_t total_;
+  unsigned char buf_[16];
+  std::size_t buflen_;
+};
+
+// Returns the 32-bit xxHash of the |len| bytes at |ptr|.
+uint32_t xxh32(const char* ptr, std::size_t len, uint32_t seed = 0) noexcept;
+
+}  // namespace lz4
+}  // namespace io
+
+#endif  // IO_LZ4_H
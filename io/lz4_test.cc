@@ -0,0 +1,108 @@
+// Copyright © 2017 by Donald King <chronos@chronos-tachyon.net>
+// Available under the MIT License. See LICENSE for details.
+
+#include "gtest/gtest.h"
+
+#include <string>
+
+#include "base/result_testing.h"
+#include "io/lz4.h"
+
+static std::string make_input(std::size_t len) {
+  std::string out;
+  uint32_t x = 54321;
+  while (out.size() < len) {
+    x = x * 1103515245U + 12345U;
+    if ((x >> 12) % 4 == 0) {
+      out.push_back(char(x >> 16));
+    } else {
+      out.append("lorem ipsum dolor sit amet " + (x >> 16) % 20, 7);
+    }
+  }
+  out.resize(len);
+  return out;
+}
+
+TEST(LZ4, XXH32) {
+  EXPECT_EQ(0x02cc5d05U, io::lz4::xxh32("", 0));
+  EXPECT_EQ(0x32d153ffU, io::lz4::xxh32("abc", 3));
+
+  // Feeding the input in pieces gives the same answer as all at once.
+  std::string in = make_input(1000);
+  uint32_t expected = io::lz4::xxh32(in.data(), in.size(), 7);
+  io::lz4::XXH32 h(7);
+  std::size_t pos = 0, step = 1;
+  while (pos < in.size()) {
+    std::size_t len = std::min(step, in.size() - pos);
+    h.update(in.data() + pos, len);
+    pos += len;
+    ++step;
+  }
+  EXPECT_EQ(expected, h.finish());
+}
+
+TEST(LZ4, Decompress) {
+  // A block written by the reference implementation.
+  const char kBlock[] =
+      "\x3f" "abc" "\x03\x00\x08\xcf" " hello world"
+      "\x0c\x00\x00\x50" "world";
+  const std::string expected =
+      "abcabcabcabcabcabcabcabcabcabc hello world hello world hello world";
+  char out[128];
+  std::size_t n = 0;
+  EXPECT_OK(io::lz4::decompress_block(out, sizeof(out), 0, kBlock,
+                                      sizeof(kBlock) - 1, &n));
+  EXPECT_EQ(expected, std::string(out, n));
+
+  // Too little room for the output.
+  EXPECT_EQ(base::ResultCode::DATA_LOSS,
+            io::lz4::decompress_block(out, 40, 0, kBlock, sizeof(kBlock) - 1,
+                                      &n).code());
+
+  // Truncated.
+  EXPECT_EQ(base::ResultCode::DATA_LOSS,
+            io::lz4::decompress_block(out, sizeof(out), 0, kBlock, 10, &n)
+                .code());
+}
+
+TEST(LZ4, RoundTrip) {
+  for (std::size_t len : {0, 1, 12, 13, 100, 5000, 65536}) {
+    SCOPED_TRACE(len);
+    std::string in = make_input(len);
+    std::string z(io::lz4::compress_bound(len), '\0');
+    std::size_t zlen = io::lz4::compress_block(&z[0], z.size(), in.data(), len);
+    ASSERT_NE(0U, zlen);
+    if (len >= 5000) {
+      EXPECT_LT(zlen, len / 2);
+    }
+
+    std::string out(len, '\0');
+    std::size_t n = 0;
+    EXPECT_OK(io::lz4::decompress_block(&out[0], out.size(), 0, z.data(),
+                                        zlen, &n));
+    EXPECT_EQ(len, n);
+    EXPECT_EQ(in, out);
+
+    // No room for the block.
+    if (len > 0) {
+      EXPECT_EQ(0U, io::lz4::compress_block(&z[0], zlen - 1, in.data(), len));
+    }
+  }
+}
+
+TEST(LZ4, Dictionary) {
+  // A match that reaches back before the start of the output, into history
+  // left by an earlier block.
+  std::string buf = "hello, world!";
+  const char kBlock[] = "\x09\x0d\x00" "\x50" "xyzzy";
+  buf.resize(64);
+  std::size_t n = 0;
+  EXPECT_OK(io::lz4::decompress_block(&buf[13], buf.size() - 13, 13, kBlock,
+                                      sizeof(kBlock) - 1, &n));
+  EXPECT_EQ("hello, world!xyzzy", buf.substr(13, n));
+
+  // Without the history, the same block is corrupt.
+  EXPECT_EQ(base::ResultCode::DATA_LOSS,
+            io::lz4::decompress_block(&buf[13], buf.size() - 13, 0, kBlock,
+                                      sizeof(kBlock) - 1, &n).code());
+}
@@ -50,8 +50,17 @@ struct Options : public base::OptionsType {
   // Determines how data should be copied from a Reader to a Writer.
   TransferMode transfer_mode;
 
+  // The maximum number of buffers that io::copy keeps in flight when it has
+  // to fall back to reading and writing.
+  // - If 2 or more, the next block is read while the previous block is still
+  //   being written, so that a slow Reader and a slow Writer overlap; the
+  //   Reader stalls once this many blocks are waiting to be written
+  // - If 0 or 1, reads and writes strictly alternate on a single buffer
+  std::size_t copy_depth;
+
   Options() noexcept : block_size(0),
-                       transfer_mode(TransferMode::system_default) {}
+                       transfer_mode(TransferMode::system_default),
+                       copy_depth(0) {}
   Options(const Options&) noexcept = default;
   Options(Options&&) noexcept = default;
   Options& operator=(const Options&) noexcept = default;
@@ -3,6 +3,8 @@
 
 #include "io/pipe.h"
 
+#include <fcntl.h>
+
 #include <algorithm>
 #include <cstdint>
 #include <cstring>
@@ -11,6 +13,7 @@
 #include <vector>
 
 #include "base/cleanup.h"
+#include "base/fd.h"
 #include "base/logging.h"
 #include "io/buffer.h"
 #include "io/chain.h"
@@ -25,6 +28,7 @@ static base::Result closed_pipe() {
 
 static constexpr std::size_t kPipeIdealBlockSize = 1U << 16;  // 64 KiB
 static constexpr std::size_t kPipeMaxBlocks = 16;
+static constexpr std::size_t kSplicePipeSize = 1U << 20;  // 1 MiB
 
 struct Guts {
   mutable std::mutex mu;
@@ -139,6 +143,85 @@ class PipeWriter : public WriterImpl {
   const std::size_t bufsz_;
 };
 
+// Copies |opts|, upgrading |TransferMode::system_default| to splice.
+// Splicing is always viable when one of the two FDs is a kernel pipe.
+static base::Options with_splice(const base::Options& opts) {
+  base::Options o = opts;
+  auto& io = o.get<io::Options>();
+  if (io.transfer_mode == TransferMode::system_default)
+    io.transfer_mode = TransferMode::splice;
+  return o;
+}
+
+class SplicePipeReader : public ReaderImpl {
+ public:
+  explicit SplicePipeReader(base::FD fd, std::size_t bufsz) noexcept
+      : r_(fdreader(std::move(fd))),
+        bufsz_(bufsz) {}
+
+  std::size_t ideal_block_size() const noexcept override { return bufsz_; }
+
+  void read(event::Task* task, char* out, std::size_t* n, std::size_t min,
+            std::size_t max, const base::Options& opts) override {
+    r_.read(task, out, n, min, max, opts);
+  }
+
+  void write_to(event::Task* task, std::size_t* n, std::size_t max,
+                const Writer& w, const base::Options& opts) override {
+    r_.write_to(task, n, max, w, with_splice(opts));
+  }
+
+  void close(event::Task* task, const base::Options& opts) override {
+    r_.close(task, opts);
+  }
+
+  base::FD internal_readerfd() const override {
+    return r_.implementation()->internal_readerfd();
+  }
+
+ private:
+  const Reader r_;
+  const std::size_t bufsz_;
+};
+
+class SplicePipeWriter : public WriterImpl {
+ public:
+  explicit SplicePipeWriter(base::FD fd, std::size_t bufsz) noexcept
+      : w_(fdwriter(std::move(fd))),
+        bufsz_(bufsz) {}
+
+  std::size_t ideal_block_size() const noexcept override { return bufsz_; }
+
+  void write(event::Task* task, std::size_t* n, const char* ptr,
+             std::size_t len, const base::Options& opts) override {
+    w_.write(task, n, ptr, len, opts);
+  }
+
+  void read_from(event::Task* task, std::size_t* n, std::size_t max,
+                 const Reader& r, const base::Options& opts) override {
+    // Only FD-backed Readers can splice(2) into us.  Everyone else goes
+    // through the io::copy fallback loop, i.e. read(2) + |write()|.
+    if (!r.implementation()->internal_readerfd()) {
+      if (prologue(task, n, max, r))
+        task->finish(base::Result::not_implemented());
+      return;
+    }
+    r.write_to(task, n, max, w_, with_splice(opts));
+  }
+
+  void close(event::Task* task, const base::Options& opts) override {
+    w_.close(task, opts);
+  }
+
+  base::FD internal_writerfd() const override {
+    return w_.implementation()->internal_writerfd();
+  }
+
+ private:
+  const Writer w_;
+  const std::size_t bufsz_;
+};
+
 }  // anonymous namespace
 
 static Pipe make_pipe(GutsPtr guts) {
@@ -166,4 +249,28 @@ void make_pipe(Reader* r, Writer* w) {
   *w = std::move(pipe.write);
 }
 
+Pipe make_splice_pipe() {
+  base::Pipe kpipe;
+  auto r = base::make_pipe(&kpipe);
+  if (!r) {
+    LOG(WARN) << "io::make_splice_pipe: falling back to io::make_pipe: " << r;
+    return make_pipe();
+  }
+
+  // Grow the kernel buffer so that each splice(2) moves more data.
+  // Failure is harmless: unprivileged processes are capped by
+  // /proc/sys/fs/pipe-max-size, in which case we keep the default.
+  std::size_t bufsz = kPipeIdealBlockSize;
+  {
+    auto pair = kpipe.write->acquire_fd();
+    ::fcntl(pair.first, F_SETPIPE_SZ, int(kSplicePipeSize));
+    int sz = ::fcntl(pair.first, F_GETPIPE_SZ);
+    if (sz > 0) bufsz = sz;
+  }
+
+  auto rd = std::make_shared<SplicePipeReader>(std::move(kpipe.read), bufsz);
+  auto wr = std::make_shared<SplicePipeWriter>(std::move(kpipe.write), bufsz);
+  return Pipe(Reader(std::move(rd)), Writer(std::move(wr)));
+}
+
 }  // namespace io
@@ -25,6 +25,15 @@ Pipe make_pipe();
 
 void make_pipe(Reader* r, Writer* w);  // backward compatibility
 
+// Returns a Pipe backed by a kernel pipe(2) instead of an in-memory Chain.
+//
+// When the other side of an io::copy is also FD-backed (e.g. a socket), data
+// moves through the Pipe with splice(2) and never enters user space.  Readers
+// and Writers without an FD still work, via plain read(2) and write(2).
+//
+// If the kernel refuses to create a pipe, falls back to |make_pipe()|.
+Pipe make_splice_pipe();
+
 }  // namespace io
 
 #endif  // IO_PIPE_H
@@ -3,9 +3,11 @@
 
 #include "gtest/gtest.h"
 
+#include "base/fd.h"
 #include "base/logging.h"
 #include "base/result_testing.h"
 #include "io/pipe.h"
+#include "io/util.h"
 
 TEST(Pipe, EndToEnd) {
   io::Pipe pipe = io::make_pipe();
@@ -84,3 +86,46 @@ TEST(Pipe, EndToEnd) {
   EXPECT_EQ(2U, n3);
   EXPECT_EQ("qr", std::string(buf, 2));
 }
+
+TEST(SplicePipe, EndToEnd) {
+  io::Pipe pipe = io::make_splice_pipe();
+  ASSERT_TRUE(pipe.read.implementation()->internal_readerfd());
+  ASSERT_TRUE(pipe.write.implementation()->internal_writerfd());
+
+  base::Pipe src, dst;
+  ASSERT_OK(base::make_pipe(&src));
+  ASSERT_OK(base::make_pipe(&dst));
+  ASSERT_OK(base::write_exactly(src.write, "hello, world", 12, "src"));
+  ASSERT_OK(src.write->close());
+
+  std::size_t n = 0;
+  EXPECT_OK(io::copy(&n, pipe.write, io::fdreader(src.read)));
+  EXPECT_EQ(12U, n);
+  EXPECT_OK(pipe.write.write(&n, "!", 1));
+  EXPECT_EQ(1U, n);
+  EXPECT_OK(pipe.write.close());
+
+  n = 0;
+  EXPECT_OK(io::copy(&n, io::fdwriter(dst.write), pipe.read));
+  EXPECT_EQ(13U, n);
+  EXPECT_OK(dst.write->close());
+
+  char buf[16];
+  EXPECT_OK(base::read_exactly(dst.read, buf, 13, "dst"));
+  EXPECT_EQ("hello, world!", std::string(buf, 13));
+}
+
+TEST(SplicePipe, NonFDEndpoints) {
+  io::Pipe pipe = io::make_splice_pipe();
+
+  std::size_t n = 0;
+  EXPECT_OK(io::copy(&n, pipe.write, io::stringreader("abcdefgh")));
+  EXPECT_EQ(8U, n);
+  EXPECT_OK(pipe.write.close());
+
+  std::string out;
+  n = 0;
+  EXPECT_OK(io::copy(&n, io::stringwriter(&out), pipe.read));
+  EXPECT_EQ(8U, n);
+  EXPECT_EQ("abcdefgh", out);
+}
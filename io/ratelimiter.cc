@@ -3,10 +3,11 @@
 
 #include "io/ratelimiter.h"
 
-#include <deque>
+#include <atomic>
+#include <map>
 #include <mutex>
+#include <vector>
 
-#include "base/backport.h"
 #include "base/logging.h"
 #include "base/mutex.h"
 #include "base/time/clock.h"
@@ -15,100 +16,196 @@
 namespace io {
 
 inline namespace implementation {
-static std::size_t min(std::size_t a, std::size_t b) noexcept {
-  return (a < b) ? a : b;
-}
-
-struct RateLimiterItem {
-  event::Task* const task;
-  const base::Options options;
-  std::size_t remaining;
-  event::Handle timer;
-
-  RateLimiterItem(event::Task* t, std::size_t n, base::Options o) noexcept
-      : task(t),
-        options(o),
-        remaining(n) {}
-};
+// TokenBucketRateLimiter is a token bucket expressed as GCRA ("virtual
+// scheduling"): instead of a token count plus a refill timestamp, the bucket
+// keeps a single "theoretical arrival time" |tat_|, the monotonic time (in
+// nanoseconds) at which the bucket would be completely full again.
+//
+// Admitting |n| units pushes |tat_| forward by |n * cost_|.  If the new |tat_|
+// is no more than |tolerance_| past now, the burst allowance covers it and the
+// caller proceeds at once.  Otherwise the units are still reserved, and the
+// caller waits out the difference.  Either way it is one CAS on |tat_| per
+// level of the hierarchy; |mu_| is only taken by callers that must wait.
+//
+// All waiters share one timer, armed for the earliest deadline.  A waiter
+// that is cancelled hands its units back, so that it doesn't hold up the
+// callers after it.
+class TokenBucketRateLimiter
+    : public RateLimiterImpl,
+      public std::enable_shared_from_this<TokenBucketRateLimiter> {
+ public:
+  using Pointer = std::shared_ptr<TokenBucketRateLimiter>;
 
-using Item = RateLimiterItem;
-using Pointer = std::unique_ptr<Item>;
+  TokenBucketRateLimiter(base::time::Duration ww, std::size_t wc,
+                         std::size_t wb, Pointer parent) noexcept
+      : parent_(std::move(parent)),
+        cost_((ww / base::time::NANOSECOND) / wc),
+        tolerance_(cost_ * wb),
+        tat_(0) {}
 
-class BasicRateLimiter : public RateLimiterImpl {
- public:
-  BasicRateLimiter(base::time::Duration ww, std::size_t wc,
-                   std::size_t wb) noexcept : ww_(ww),
-                                              wc_(wc),
-                                              wb_(wb),
-                                              bank_(wb) {}
+  ~TokenBucketRateLimiter() noexcept override;
 
   void gate(event::Task* task, std::size_t n,
             const base::Options& opts) override;
 
-  void process();
-  void process_impl(base::Lock& lock, base::time::MonotonicTime now);
-
  private:
-  const base::time::Duration ww_;
-  const std::size_t wc_;
-  const std::size_t wb_;
+  struct Waiter {
+    event::Task* task;
+    std::size_t n;
+
+    Waiter(event::Task* t, std::size_t n) noexcept : task(t), n(n) {}
+  };
+
+  using Map = std::multimap<base::time::MonotonicTime, Waiter>;
+
+  // Reserves |n| units in this bucket.  Returns the number of nanoseconds
+  // until the reservation becomes valid, or 0 if it is valid immediately.
+  double reserve(std::size_t n, double now) noexcept;
+
+  // Undoes a |reserve(n, ...)| whose units will never be used.
+  void refund(std::size_t n) noexcept;
+
+  base::Result arm(base::Lock& lock, const base::Options& opts);
+  void expire();
+  void cancel(event::Task* task);
+
+  const Pointer parent_;
+  const double cost_;       // nanoseconds per unit
+  const double tolerance_;  // nanoseconds of burst allowance
+  std::atomic<double> tat_;
   mutable std::mutex mu_;
-  std::deque<Pointer> q_;
-  base::time::MonotonicTime last_;
-  std::size_t bank_;
+  Map waiters_;          // protected by mu_
+  event::Handle timer_;  // protected by mu_
 };
 
-void BasicRateLimiter::gate(event::Task* task, std::size_t n,
-                            const base::Options& opts) {
-  CHECK_NOTNULL(task);
-  auto lock = base::acquire_lock(mu_);
-  auto now = base::time::monotonic_now();
-  q_.push_back(base::backport::make_unique<Item>(task, n, opts));
-  process_impl(lock, now);
+static double now_ns(base::time::MonotonicTime now) noexcept {
+  return now.since_epoch() / base::time::NANOSECOND;
 }
 
-void BasicRateLimiter::process() {
-  auto lock = base::acquire_lock(mu_);
-  auto now = base::time::monotonic_now();
-  process_impl(lock, now);
+TokenBucketRateLimiter::~TokenBucketRateLimiter() noexcept {
+  // The timer's handler only holds a weak reference to |this|, so there is no
+  // need to wait for it; waiting here would deadlock if the last reference
+  // were dropped from inside an event callback.
+  if (timer_) {
+    timer_.disable().ignore_ok();
+    timer_.disown();
+  }
+  for (const auto& pair : waiters_) pair.second.task->finish_cancel();
 }
 
-void BasicRateLimiter::process_impl(base::Lock& lock,
-                                    base::time::MonotonicTime now) {
-  if (!last_.is_epoch()) {
-    base::time::Duration delta = now - last_;
-    std::size_t earned = ::ceil(wc_ * (delta / ww_));
-    bank_ = min(bank_ + earned, wb_);
+double TokenBucketRateLimiter::reserve(std::size_t n, double now) noexcept {
+  double amount = cost_ * n;
+  double tat = tat_.load(std::memory_order_relaxed);
+  double next;
+  do {
+    next = ((tat < now) ? now : tat) + amount;
+  } while (!tat_.compare_exchange_weak(tat, next, std::memory_order_relaxed));
+  double delay = next - now - tolerance_;
+  return (delay > 0) ? delay : 0;
+}
+
+void TokenBucketRateLimiter::refund(std::size_t n) noexcept {
+  double amount = cost_ * n;
+  double tat = tat_.load(std::memory_order_relaxed);
+  while (!tat_.compare_exchange_weak(tat, tat - amount,
+                                     std::memory_order_relaxed)) {
   }
-  last_ = now;
-
-  while (!q_.empty()) {
-    Item* item = q_.front().get();
-    if (bank_ < item->remaining) break;
-    bank_ -= item->remaining;
-    item->task->finish_ok();
-    q_.pop_front();
+}
+
+void TokenBucketRateLimiter::gate(event::Task* task, std::size_t n,
+                                  const base::Options& opts) {
+  CHECK_NOTNULL(task);
+  if (!task->start()) return;
+
+  auto now = base::time::monotonic_now();
+  double ns = now_ns(now);
+  double delay = 0;
+  for (auto* b = this; b != nullptr; b = b->parent_.get()) {
+    double d = b->reserve(n, ns);
+    if (delay < d) delay = d;
+  }
+  if (delay == 0) {
+    task->finish_ok();
+    return;
+  }
+
+  auto at = now + base::time::nanoseconds(delay);
+  auto lock = base::acquire_lock(mu_);
+  bool earliest = (waiters_.empty() || at < waiters_.begin()->first);
+  waiters_.emplace(at, Waiter(task, n));
+  base::Result r;
+  if (earliest) r = arm(lock, opts);
+  if (!r) {
+    auto range = waiters_.equal_range(at);
+    for (auto it = range.first; it != range.second; ++it) {
+      if (it->second.task == task) {
+        waiters_.erase(it);
+        break;
+      }
+    }
+    lock.unlock();
+    task->finish(std::move(r));
+    return;
   }
+  lock.unlock();
 
-  if (q_.empty()) return;
-  Item* item = q_.front().get();
-  item->remaining -= bank_;
-  bank_ = 0;
-  event::Manager m = get_manager(item->options);
-  auto r = m.timer(&item->timer, event::handler([this](event::Data) {
-    process();
+  std::weak_ptr<TokenBucketRateLimiter> weak = shared_from_this();
+  task->on_cancelled(event::callback([weak, task] {
+    auto self = weak.lock();
+    if (self) self->cancel(task);
     return base::Result();
   }));
-  if (r) {
-    auto end = now + ww_ * item->remaining / wc_;
-    r = item->timer.set_at(end);
+}
+
+base::Result TokenBucketRateLimiter::arm(base::Lock& lock,
+                                         const base::Options& opts) {
+  base::Result r;
+  if (!timer_) {
+    std::weak_ptr<TokenBucketRateLimiter> weak = shared_from_this();
+    event::Manager m = get_manager(opts);
+    r = m.timer(&timer_, event::handler([weak](event::Data) {
+      auto self = weak.lock();
+      if (self) self->expire();
+      return base::Result();
+    }));
   }
-  if (!r) {
-    item->task->finish(std::move(r));
-    q_.pop_front();
+  if (r) r = timer_.set_at(waiters_.begin()->first);
+  return r;
+}
+
+void TokenBucketRateLimiter::expire() {
+  std::vector<event::Task*> ready;
+  auto lock = base::acquire_lock(mu_);
+  auto now = base::time::monotonic_now();
+  auto it = waiters_.begin(), end = waiters_.end();
+  while (it != end && it->first <= now) {
+    ready.push_back(it->second.task);
+    it = waiters_.erase(it);
+  }
+  if (it != end) timer_.set_at(it->first).expect_ok(__FILE__, __LINE__);
+  lock.unlock();
+
+  for (event::Task* task : ready) {
+    if (task->is_running())
+      task->finish_ok();
+    else
+      task->finish_cancel();
   }
 }
 
+void TokenBucketRateLimiter::cancel(event::Task* task) {
+  auto lock = base::acquire_lock(mu_);
+  auto it = waiters_.begin(), end = waiters_.end();
+  while (it != end && it->second.task != task) ++it;
+  if (it == end) return;
+  std::size_t n = it->second.n;
+  waiters_.erase(it);
+  lock.unlock();
+
+  for (auto* b = this; b != nullptr; b = b->parent_.get()) b->refund(n);
+  task->finish_cancel();
+}
+
 class RateLimitedReader : public ReaderImpl {
  public:
   RateLimitedReader(Reader r, RateLimiter l) noexcept : r_(std::move(r)),
@@ -253,12 +350,15 @@ base::Result RateLimiterImpl::gate(std::size_t n, const base::Options& opts) {
 }
 
 RateLimiter new_ratelimiter(base::time::Duration window, std::size_t count,
-                            std::size_t burst) {
+                            std::size_t burst, RateLimiter parent) {
   CHECK(!window.is_zero()) << ": " << window;
   CHECK(!window.is_neg()) << ": " << window;
   CHECK_GT(count, 0U);
   if (burst < count) burst = count;
-  return std::make_shared<BasicRateLimiter>(window, count, burst);
+  auto p = std::dynamic_pointer_cast<TokenBucketRateLimiter>(parent);
+  CHECK(p || !parent) << ": parent was not made by io::new_ratelimiter";
+  return std::make_shared<TokenBucketRateLimiter>(window, count, burst,
+                                                  std::move(p));
 }
 
 Reader ratelimitedreader(Reader r, RateLimiter l) {
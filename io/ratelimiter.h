@@ -36,8 +36,18 @@ class RateLimiterImpl {
 
 using RateLimiter = std::shared_ptr<RateLimiterImpl>;
 
+// Returns a token-bucket RateLimiter that admits |count| units per |window|,
+// allowing bursts of up to |burst| units (at least |count|).
+//
+// If |parent| is non-null, it must also have come from |new_ratelimiter|, and
+// every unit admitted by the new limiter is also drawn from |parent| and its
+// ancestors.  For example, per-connection limiters can share a per-tenant
+// parent, which in turn shares a global grandparent.
+//
+// Callers that do not have to wait never take a lock.
 RateLimiter new_ratelimiter(base::time::Duration window, std::size_t count,
-                            std::size_t burst = 0);
+                            std::size_t burst = 0,
+                            RateLimiter parent = nullptr);
 
 Reader ratelimitedreader(Reader r, RateLimiter l);
 Writer ratelimitedwriter(Writer w, RateLimiter l);
@@ -0,0 +1,93 @@
+// Copyright © 2017 by Donald King <chronos@chronos-tachyon.net>
+// Available under the MIT License. See LICENSE for details.
+
+#include "gtest/gtest.h"
+
+#include "base/logging.h"
+#include "base/result_testing.h"
+#include "base/time/time.h"
+#include "io/ratelimiter.h"
+
+using base::time::MILLISECOND;
+using base::time::Duration;
+using base::time::monotonic_now;
+
+static Duration elapsed_since(base::time::MonotonicTime t0) {
+  return monotonic_now() - t0;
+}
+
+TEST(RateLimiter, Burst) {
+  auto l = io::new_ratelimiter(MILLISECOND * 100, 1000);
+
+  auto t0 = monotonic_now();
+  EXPECT_OK(l->gate(500));
+  EXPECT_OK(l->gate(500));
+  EXPECT_OK(l->gate(0));
+  EXPECT_LT(elapsed_since(t0), MILLISECOND * 40);
+
+  t0 = monotonic_now();
+  EXPECT_OK(l->gate(500));
+  EXPECT_GE(elapsed_since(t0), MILLISECOND * 40);
+
+  base::log_flush();
+}
+
+TEST(RateLimiter, Concurrent) {
+  auto l = io::new_ratelimiter(MILLISECOND * 100, 1000);
+  base::Options o;
+
+  auto t0 = monotonic_now();
+  event::Task t1, t2, t3;
+  l->gate(&t1, 1000, o);
+  l->gate(&t2, 200, o);
+  l->gate(&t3, 300, o);
+  EXPECT_TRUE(t1.is_finished());
+  EXPECT_FALSE(t2.is_finished());
+  EXPECT_FALSE(t3.is_finished());
+
+  event::wait_all({io::get_manager(o)}, {&t1, &t2, &t3});
+  EXPECT_OK(t1.result());
+  EXPECT_OK(t2.result());
+  EXPECT_OK(t3.result());
+  EXPECT_GE(elapsed_since(t0), MILLISECOND * 40);
+
+  base::log_flush();
+}
+
+TEST(RateLimiter, Hierarchy) {
+  auto global = io::new_ratelimiter(MILLISECOND * 100, 1000);
+  auto a = io::new_ratelimiter(MILLISECOND * 100, 100000, 0, global);
+  auto b = io::new_ratelimiter(MILLISECOND * 100, 100000, 0, global);
+
+  auto t0 = monotonic_now();
+  EXPECT_OK(a->gate(1000));
+  EXPECT_LT(elapsed_since(t0), MILLISECOND * 40);
+
+  t0 = monotonic_now();
+  EXPECT_OK(b->gate(500));
+  EXPECT_GE(elapsed_since(t0), MILLISECOND * 40);
+
+  base::log_flush();
+}
+
+TEST(RateLimiter, CancelRefunds) {
+  auto l = io::new_ratelimiter(MILLISECOND * 100, 1000);
+  base::Options o;
+
+  EXPECT_OK(l->gate(1000));
+
+  event::Task task;
+  l->gate(&task, 1000, o);
+  EXPECT_FALSE(task.is_finished());
+  task.cancel();
+
+  // Without the refund, this would wait behind the cancelled reservation.
+  auto t0 = monotonic_now();
+  EXPECT_OK(l->gate(500));
+  EXPECT_LT(elapsed_since(t0), MILLISECOND * 100);
+
+  event::wait(io::get_manager(o), &task);
+  EXPECT_CANCELLED(task.result());
+
+  base::log_flush();
+}
@@ -16,9 +16,13 @@
 #endif
 
 #include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <atomic>
 #include <condition_variable>
 #include <cstring>
 #include <deque>
@@ -53,8 +57,167 @@ static constexpr bool s64_holds_smallest() {
   return std::numeric_limits<int64_t>::min() < -0x7fffffffffffffffLL;
 }
 
-static TransferMode default_transfer_mode() noexcept {
-  return TransferMode::read_write;  // TODO: probe this on first access
+// Decodes a varint straight out of |r|'s buffer, if all of it is buffered.
+// Returns false if the caller must fall back to byte-at-a-time reads.
+static bool try_read_uvarint(const Reader& r, uint64_t* out) {
+  char buf[10];
+  std::size_t n = r.peek(buf, sizeof(buf));
+  const auto* p = reinterpret_cast<const unsigned char*>(&buf);
+  std::size_t x = 0;
+  while (x < n && (p[x] & 0x80U) != 0) ++x;
+  if (x >= n || !r.try_read(buf, x + 1)) return false;
+
+  uint64_t value = 0;
+  for (std::size_t i = 0; i <= x; ++i) {
+    value |= uint64_t(p[i] & 0x7fU) << (7 * i);
+  }
+  *out = value;
+  return true;
+}
+
+static base::Result decode_svarint(int64_t* out, uint64_t tmp) {
+  static constexpr uint64_t K = uint64_t(1U) << 63;
+  if (tmp == K && !s64_holds_smallest()) {
+    return base::Result::out_of_range(
+        "int64_t cannot hold -2**63 on this platform");
+  }
+  if (tmp < K)
+    *out = tmp;
+  else
+    *out = -int64_t(~tmp) - 1;
+  return base::Result();
+}
+
+static base::Result decode_svarint_zigzag(int64_t* out, uint64_t tmp) {
+  static constexpr uint64_t K = 0xffffffffffffffffULL;
+  if (tmp == K && !s64_holds_smallest()) {
+    return base::Result::out_of_range(
+        "int64_t cannot hold -2**63 on this platform");
+  }
+  if (tmp & 1)
+    *out = -int64_t(tmp >> 1) - 1;
+  else
+    *out = int64_t(tmp >> 1);
+  return base::Result();
+}
+
+static std::atomic<uint64_t> g_xfer_splice(0);
+static std::atomic<uint64_t> g_xfer_sendfile(0);
+static std::atomic<uint64_t> g_xfer_fallback(0);
+
+inline namespace implementation {
+// FDKind classifies a file descriptor for the purpose of choosing the
+// fastest viable TransferMode between a pair of file descriptors.
+enum class FDKind : uint8_t {
+  other = 0,
+  file = 1,
+  pipe = 2,
+  socket = 3,
+};
+
+static constexpr std::size_t kNumFDKinds = 4;
+
+static FDKind classify_fd(const base::FD& fd) noexcept {
+  struct stat st;
+  ::bzero(&st, sizeof(st));
+  auto pair = fd->acquire_fd();
+  int rc = ::fstat(pair.first, &st);
+  pair.second.unlock();
+  if (rc != 0) return FDKind::other;
+  if (S_ISREG(st.st_mode)) return FDKind::file;
+  if (S_ISFIFO(st.st_mode)) return FDKind::pipe;
+  if (S_ISSOCK(st.st_mode)) return FDKind::socket;
+  return FDKind::other;
+}
+
+// ProbeFDs is a throwaway pair of file descriptors of a given FDKind.
+// Data written to |wr| can be read back from |rd|.
+struct ProbeFDs {
+  int rd;
+  int wr;
+
+  ProbeFDs() noexcept : rd(-1), wr(-1) {}
+  ~ProbeFDs() noexcept {
+    if (wr != -1 && wr != rd) ::close(wr);
+    if (rd != -1) ::close(rd);
+  }
+
+  bool open(FDKind kind) noexcept {
+    int fds[2] = {-1, -1};
+    switch (kind) {
+      case FDKind::file:
+        rd = wr = ::memfd_create("mojo-io-probe", MFD_CLOEXEC);
+        return rd != -1;
+
+      case FDKind::pipe:
+        if (::pipe2(fds, O_NONBLOCK | O_CLOEXEC) != 0) return false;
+        rd = fds[0];
+        wr = fds[1];
+        return true;
+
+      case FDKind::socket:
+        if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                         0, fds) != 0)
+          return false;
+        rd = fds[0];
+        wr = fds[1];
+        return true;
+
+      default:
+        return false;
+    }
+  }
+
+  // Makes one byte available for reading from |rd|.
+  bool prime() noexcept {
+    if (rd == wr) return ::pwrite(wr, "x", 1, 0) == 1;
+    return ::write(wr, "x", 1) == 1;
+  }
+};
+
+// Tries splice(2), then sendfile(2), on a throwaway pair of file descriptors
+// of the given kinds, and returns the best TransferMode that worked.
+static TransferMode probe_transfer_mode(FDKind src, FDKind dst) noexcept {
+  ProbeFDs in, out;
+  if (!in.open(src) || !out.open(dst) || !in.prime())
+    return TransferMode::read_write;
+
+#if HAVE_SPLICE
+  if (::splice(in.rd, nullptr, out.wr, nullptr, 1, SPLICE_F_NONBLOCK) == 1)
+    return TransferMode::splice;
+#endif
+
+#if HAVE_SENDFILE
+  if (::sendfile(out.wr, in.rd, nullptr, 1) == 1)
+    return TransferMode::sendfile;
+#endif
+
+  return TransferMode::read_write;
+}
+}  // inline namespace implementation
+
+// Returns the best TransferMode for copying from |rfd| to |wfd|.
+// The probe runs once per <FDKind, FDKind> pair and the result is cached.
+static TransferMode default_transfer_mode(const base::FD& rfd,
+                                          const base::FD& wfd) noexcept {
+  static std::once_flag once[kNumFDKinds * kNumFDKinds];
+  static TransferMode cache[kNumFDKinds * kNumFDKinds];
+
+  if (!rfd || !wfd) return TransferMode::read_write;
+  FDKind src = classify_fd(rfd);
+  FDKind dst = classify_fd(wfd);
+  if (src == FDKind::other || dst == FDKind::other)
+    return TransferMode::read_write;
+
+  std::size_t index = std::size_t(src) * kNumFDKinds + std::size_t(dst);
+  std::call_once(once[index], [src, dst, index] {
+    cache[index] = probe_transfer_mode(src, dst);
+    VLOG(2) << "io::default_transfer_mode: probed "
+            << "src=" << uint16_t(src) << ", "
+            << "dst=" << uint16_t(dst) << ", "
+            << "result=" << uint16_t(cache[index]);
+  });
+  return cache[index];
 }
 
 bool ReaderImpl::prologue(event::Task* task, char* out, std::size_t* n,
@@ -104,6 +267,18 @@ base::Result Reader::unread(const char* ptr, std::size_t len) const {
   return ptr_->unread(ptr, len);
 }
 
+std::size_t Reader::peek(char* out, std::size_t max) const {
+  if (max) CHECK_NOTNULL(out);
+  assert_valid();
+  return ptr_->peek(out, max);
+}
+
+bool Reader::try_read(char* out, std::size_t len) const {
+  if (len) CHECK_NOTNULL(out);
+  assert_valid();
+  return ptr_->try_read(out, len);
+}
+
 inline namespace implementation {
 struct StringReadHelper {
   event::Task* const task;
@@ -185,6 +360,13 @@ void Reader::read_u8(event::Task* task, uint8_t* out,
   if (!task->start()) return;
   *out = 0;
 
+  char lone;
+  if (try_read(&lone, 1)) {
+    *out = *reinterpret_cast<const unsigned char*>(&lone);
+    task->finish_ok();
+    return;
+  }
+
   auto helper = base::backport::make_unique<Helper>(task, out);
   auto* h = helper.get();
   task->add_subtask(&h->subtask);
@@ -223,6 +405,13 @@ void Reader::read_u16(event::Task* task, uint16_t* out,
   if (!task->start()) return;
   *out = 0;
 
+  char buf[2];
+  if (try_read(buf, sizeof(buf))) {
+    *out = endian->get_u16(buf);
+    task->finish_ok();
+    return;
+  }
+
   auto helper = base::backport::make_unique<Helper>(task, out, endian);
   auto* h = helper.get();
   task->add_subtask(&h->subtask);
@@ -261,6 +450,13 @@ void Reader::read_u32(event::Task* task, uint32_t* out,
   if (!task->start()) return;
   *out = 0;
 
+  char buf[4];
+  if (try_read(buf, sizeof(buf))) {
+    *out = endian->get_u32(buf);
+    task->finish_ok();
+    return;
+  }
+
   auto helper = base::backport::make_unique<Helper>(task, out, endian);
   auto* h = helper.get();
   task->add_subtask(&h->subtask);
@@ -299,6 +495,13 @@ void Reader::read_u64(event::Task* task, uint64_t* out,
   if (!task->start()) return;
   *out = 0;
 
+  char buf[8];
+  if (try_read(buf, sizeof(buf))) {
+    *out = endian->get_u64(buf);
+    task->finish_ok();
+    return;
+  }
+
   auto helper = base::backport::make_unique<Helper>(task, out, endian);
   auto* h = helper.get();
   task->add_subtask(&h->subtask);
@@ -555,6 +758,11 @@ void Reader::read_uvarint(event::Task* task, uint64_t* out,
   if (!task->start()) return;
   *out = 0;
 
+  if (try_read_uvarint(*this, out)) {
+    task->finish_ok();
+    return;
+  }
+
   auto* h = new Helper(*this, task, out, opts);
   h->next();
 }
@@ -571,17 +779,7 @@ void Reader::read_svarint(event::Task* task, int64_t* out,
 
     base::Result run() override {
       if (!event::propagate_failure(task, &subtask)) {
-        static constexpr uint64_t K = uint64_t(1U) << 63;
-        if (tmp == K && !s64_holds_smallest()) {
-          task->finish(base::Result::out_of_range(
-              "int64_t cannot hold -2**63 on this platform"));
-        } else {
-          if (tmp < K)
-            *out = tmp;
-          else
-            *out = -int64_t(~tmp) - 1;
-          task->finish_ok();
-        }
+        task->finish(decode_svarint(out, tmp));
       }
       return base::Result();
     }
@@ -592,6 +790,12 @@ void Reader::read_svarint(event::Task* task, int64_t* out,
   if (!task->start()) return;
   *out = 0;
 
+  uint64_t tmp;
+  if (try_read_uvarint(*this, &tmp)) {
+    task->finish(decode_svarint(out, tmp));
+    return;
+  }
+
   auto helper = base::backport::make_unique<Helper>(task, out);
   auto* h = helper.get();
   task->add_subtask(&h->subtask);
@@ -611,17 +815,7 @@ void Reader::read_svarint_zigzag(event::Task* task, int64_t* out,
 
     base::Result run() override {
       if (!event::propagate_failure(task, &subtask)) {
-        static constexpr uint64_t K = 0xffffffffffffffffULL;
-        if (tmp == K && !s64_holds_smallest()) {
-          task->finish(base::Result::out_of_range(
-              "int64_t cannot hold -2**63 on this platform"));
-        } else {
-          if (tmp & 1)
-            *out = -int64_t(tmp >> 1) - 1;
-          else
-            *out = int64_t(tmp >> 1);
-          task->finish_ok();
-        }
+        task->finish(decode_svarint_zigzag(out, tmp));
       }
       return base::Result();
     }
@@ -632,6 +826,12 @@ void Reader::read_svarint_zigzag(event::Task* task, int64_t* out,
   if (!task->start()) return;
   *out = 0;
 
+  uint64_t tmp;
+  if (try_read_uvarint(*this, &tmp)) {
+    task->finish(decode_svarint_zigzag(out, tmp));
+    return;
+  }
+
   auto helper = base::backport::make_unique<Helper>(task, out);
   auto* h = helper.get();
   task->add_subtask(&h->subtask);
@@ -954,6 +1154,14 @@ class CloseIgnoringReader : public ReaderImpl {
     return r_.unread(ptr, len);
   }
 
+  std::size_t peek(char* out, std::size_t max) override {
+    return r_.peek(out, max);
+  }
+
+  bool try_read(char* out, std::size_t len) override {
+    return r_.try_read(out, len);
+  }
+
   void read(event::Task* task, char* out, std::size_t* n, std::size_t min,
             std::size_t max, const base::Options& opts) override {
     r_.read(task, out, n, min, max, opts);
@@ -1074,6 +1282,23 @@ class StringOrBufferReader : public ReaderImpl {
 
   bool is_buffered() const noexcept override { return true; }
 
+  // Both of these give up rather than wait while |write_to()| holds |mu_|.
+  std::size_t peek(char* out, std::size_t max) override {
+    base::Lock lock(mu_, std::try_to_lock);
+    if (!lock.owns_lock() || closed_) return 0;
+    std::size_t len = std::min(buf_.size() - pos_, max);
+    ::memcpy(out, buf_.data() + pos_, len);
+    return len;
+  }
+
+  bool try_read(char* out, std::size_t len) override {
+    base::Lock lock(mu_, std::try_to_lock);
+    if (!lock.owns_lock() || closed_ || buf_.size() - pos_ < len) return false;
+    ::memcpy(out, buf_.data() + pos_, len);
+    pos_ += len;
+    return true;
+  }
+
   void read(event::Task* task, char* out, std::size_t* n, std::size_t min,
             std::size_t max, const base::Options& opts) override {
     if (!prologue(task, out, n, min, max)) return;
@@ -1483,16 +1708,18 @@ bool FDReader::WriteToOp::process(FDReader* reader) {
     return true;
   }
 
-  auto xm = options.get<io::Options>().transfer_mode;
-  if (xm == TransferMode::system_default) xm = default_transfer_mode();
-
   base::FD rfd = reader->fd_;
   base::FD wfd = writer.implementation()->internal_writerfd();
   base::Result r;
 
+  auto xm = options.get<io::Options>().transfer_mode;
+  if (xm == TransferMode::system_default) xm = default_transfer_mode(rfd, wfd);
+  auto used = TransferMode::read_write;
+
 #if HAVE_SPLICE
   // Try using splice(2)
   if (xm >= TransferMode::splice && wfd) {
+    used = TransferMode::splice;
     while (*n < max) {
       std::size_t cmax = max - *n;
       if (cmax > kSpliceMax) cmax = kSpliceMax;
@@ -1561,9 +1788,10 @@ bool FDReader::WriteToOp::process(FDReader* reader) {
 no_splice:
 #endif  // HAVE_SPLICE
 
-#ifdef HAVE_SENDFILE
+#if HAVE_SENDFILE
   // Try using sendfile(2)
   if (xm >= TransferMode::sendfile && wfd) {
+    used = TransferMode::sendfile;
     while (*n < max) {
       std::size_t cmax = max - *n;
       if (cmax > kSendfileMax) cmax = kSendfileMax;
@@ -1635,6 +1863,18 @@ no_sendfile:
   r = base::Result::not_implemented();
 
 finish:
+  if (r.code() == RC::NOT_IMPLEMENTED) used = TransferMode::read_write;
+  switch (used) {
+    case TransferMode::splice:
+      ++g_xfer_splice;
+      break;
+    case TransferMode::sendfile:
+      ++g_xfer_sendfile;
+      break;
+    default:
+      ++g_xfer_fallback;
+      break;
+  }
   VLOG(4) << "io::FDReader::WriteToOp: end: "
           << "*n=" << *n << ", "
           << "r=" << r;
@@ -1863,6 +2103,16 @@ class BufferedReader : public ReaderImpl {
     return base::Result();
   }
 
+  std::size_t peek(char* out, std::size_t max) override {
+    return chain_.peek(out, max);
+  }
+
+  bool try_read(char* out, std::size_t len) override {
+    if (!chain_.try_drain(out, len)) return false;
+    chain_.process();
+    return true;
+  }
+
   void read(event::Task* task, char* out, std::size_t* n, std::size_t min,
             std::size_t max, const base::Options& opts) override {
     chain_.read(task, out, n, min, max, opts);
@@ -1886,19 +2136,16 @@ class BufferedReader : public ReaderImpl {
   }
 
  private:
+  // Reads directly into the free space at the tail of |chain_|.
   struct FillHelper : public event::Callback {
     event::Task task;
     BufferedReader* self;
-    OwnedBuffer buffer;
-    std::size_t length;
     std::size_t n;
 
-    explicit FillHelper(BufferedReader* s, const base::Options& opts) noexcept
-        : self(s),
-          buffer(self->chain_.pool()->take()),
-          length(self->chain_.optimal_fill()),
-          n(0) {
-      self->r_.read(&task, buffer.data(), &n, 1, length, opts);
+    FillHelper(BufferedReader* s, Buffer segment,
+               const base::Options& opts) noexcept : self(s),
+                                                     n(0) {
+      self->r_.read(&task, segment.data(), &n, 1, segment.size(), opts);
     }
 
     base::Result run() override {
@@ -1908,21 +2155,18 @@ class BufferedReader : public ReaderImpl {
       } else {
         r = task.result();
       }
-      if (r) {
-        std::size_t nn = 0;
-        self->chain_.fill(&nn, buffer.data(), n);
-        CHECK_EQ(nn, n);
-      } else {
-        self->chain_.fail_reads(r);
-      }
-      self->chain_.pool()->give(std::move(buffer));
+      self->chain_.commit_fill(n);
+      if (!r) self->chain_.fail_reads(r);
       self->chain_.process();
       return base::Result();
     }
   };
 
   void fill_callback(const base::Options& opts) {
-    auto helper = base::backport::make_unique<FillHelper>(this, opts);
+    // Empty if a fill is already in flight; it will call back when done.
+    Buffer segment = chain_.fill_segment();
+    if (!segment) return;
+    auto helper = base::backport::make_unique<FillHelper>(this, segment, opts);
     auto* h = helper.get();
     h->task.on_finished(std::move(helper));
   }
@@ -1997,6 +2241,14 @@ Reader bufferedreader(Reader r, std::size_t buffer_size,
 
 Reader bufferedreader(Reader r) { return make_bufferedreader(std::move(r)); }
 
+TransferStats transfer_stats() noexcept {
+  TransferStats stats;
+  stats.splice = g_xfer_splice.load();
+  stats.sendfile = g_xfer_sendfile.load();
+  stats.fallback = g_xfer_fallback.load();
+  return stats;
+}
+
 base::Result reader_closed() {
   return base::Result::from_errno(EBADF, "io::Reader is closed");
 }
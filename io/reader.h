@@ -101,6 +101,25 @@ class ReaderImpl {
   //
   virtual base::Result unread(const char* ptr, std::size_t len);
 
+  // OPTIONAL. Copies up to |max| bytes of already-buffered data into |out|
+  // without consuming them.  Returns the number of bytes copied.
+  // - NEVER blocks and NEVER performs I/O
+  // - Returns 0 if nothing is buffered, or if other reads are in flight
+  //
+  // THREAD SAFETY: Implementations of this function MUST be thread-safe.
+  //
+  virtual std::size_t peek(char* out, std::size_t max) { return 0; }
+
+  // OPTIONAL. Consumes exactly |len| bytes of already-buffered data into
+  // |out|, as if by a synchronous |read()| with |min == max == len|.
+  // - NEVER blocks and NEVER performs I/O
+  // - Returns false, consuming nothing, if fewer than |len| bytes are
+  //   buffered or if other reads are in flight
+  //
+  // THREAD SAFETY: Implementations of this function MUST be thread-safe.
+  //
+  virtual bool try_read(char* out, std::size_t len) { return false; }
+
   // Reads up to |max| bytes into the buffer at |out|.
   // - NEVER reads more than |max| bytes
   // - ALWAYS sets |*n| to the number of bytes successfully read
@@ -243,6 +262,18 @@ class Reader {
   // NOTE: This function is OPTIONAL, i.e. it may return NOT_IMPLEMENTED.
   base::Result unread(const char* ptr, std::size_t len) const;
 
+  // Copies up to |max| bytes of buffered data into |out| without consuming
+  // them, returning the number of bytes copied.  Never blocks.
+  //
+  // NOTE: This function is OPTIONAL, i.e. it may always return 0.
+  std::size_t peek(char* out, std::size_t max) const;
+
+  // Consumes exactly |len| bytes of buffered data into |out| and returns
+  // true, or returns false without consuming anything.  Never blocks.
+  //
+  // NOTE: This function is OPTIONAL, i.e. it may always return false.
+  bool try_read(char* out, std::size_t len) const;
+
   // Fully qualified read {{{
 
   // Reads |min| to |max| bytes into the buffer at |out|, updating |n|.
@@ -490,6 +521,26 @@ Reader zeroreader();
 // Returns a Reader that reads bytes from a file descriptor.
 Reader fdreader(base::FD fd);
 
+// TransferStats counts how FD-backed Readers carried out |write_to()|.
+// - If |TransferMode::system_default| is requested, the best mode for each
+//   pair of file descriptor types (file, pipe, socket) is probed once and
+//   cached for the lifetime of the process
+// - |fallback| counts transfers that returned NOT_IMPLEMENTED, leaving
+//   io::copy to fall back to a read(2)/write(2) loop
+//
+// THREAD SAFETY: The counters are process-wide and updated atomically.
+//
+struct TransferStats {
+  uint64_t splice;
+  uint64_t sendfile;
+  uint64_t fallback;
+
+  TransferStats() noexcept : splice(0), sendfile(0), fallback(0) {}
+};
+
+// Returns a snapshot of the process-wide TransferStats.
+TransferStats transfer_stats() noexcept;
+
 // Returns a Reader that concatenates multiple streams into one.
 Reader multireader(std::vector<Reader> readers);
 
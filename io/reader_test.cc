@@ -1288,6 +1288,52 @@ TEST(BufferedReader, Threaded) {
   m.shutdown();
 }
 
+TEST(BufferedReader, FastPath) {
+  event::ManagerOptions mo;
+  mo.set_async_mode();
+  event::Manager m;
+  ASSERT_OK(event::new_manager(&m, mo));
+
+  base::Options o;
+  o.get<io::Options>().manager = m;
+
+  // The first read fills the buffer; the rest are served out of it without
+  // waiting on the event::Manager.
+  io::Reader r = io::bufferedreader(
+      io::stringreader("\x01\x02\x03\x04\x05\xac\x02\x03\x80"));
+  uint8_t u8 = 0;
+  EXPECT_OK(r.read_u8(&u8, o));
+  EXPECT_EQ(1U, u8);
+
+  event::Task task;
+  uint32_t u32 = 0;
+  r.read_u32(&task, &u32, base::kBigEndian, o);
+  EXPECT_TRUE(task.is_finished());
+  EXPECT_OK(task.result());
+  EXPECT_EQ(0x02030405U, u32);
+
+  task.reset();
+  uint64_t u64 = 0;
+  r.read_uvarint(&task, &u64, o);
+  EXPECT_TRUE(task.is_finished());
+  EXPECT_OK(task.result());
+  EXPECT_EQ(300U, u64);
+
+  task.reset();
+  int64_t s64 = 0;
+  r.read_svarint_zigzag(&task, &s64, o);
+  EXPECT_TRUE(task.is_finished());
+  EXPECT_OK(task.result());
+  EXPECT_EQ(-2, s64);
+
+  // A truncated varint can't be decoded from the buffer alone, so it falls
+  // back to the slow path and reports END_OF_FILE.
+  EXPECT_EOF(r.read_uvarint(&u64, o));
+
+  m.shutdown();
+  base::log_flush();
+}
+
 TEST(UnbufferedReader, Inline) {
   event::ManagerOptions mo;
   mo.set_inline_mode();
@@ -0,0 +1,411 @@
+// Copyright © 2017 by Donald King <chronos@chronos-tachyon.net>
+// Available under the MIT License. See LICENSE for details.
+
+#include "io/record.h"
+
+#include <mutex>
+#include <vector>
+
+#include "base/crc32c.h"
+#include "base/endian.h"
+#include "base/logging.h"
+#include "base/mutex.h"
+
+namespace io {
+
+inline namespace implementation {
+static base::Result subtask_result(const event::Task& subtask) {
+  if (subtask.result_will_throw()) return base::Result::unknown();
+  return subtask.result();
+}
+
+struct RecordReadHelper {
+  enum class Stage : uint8_t {
+    header = 0,
+    payload = 1,
+    trailer = 2,
+  };
+
+  event::Task subtask;
+  const Reader reader;
+  const RecordOptions ro;
+  event::Task* const task;
+  std::string* const out;
+  const base::Options options;
+  Stage stage;
+  uint64_t length;
+  std::size_t n;
+  char crc[4];
+
+  RecordReadHelper(Reader r, RecordOptions ro, event::Task* t, std::string* o,
+                   base::Options opts) noexcept : reader(std::move(r)),
+                                                  ro(std::move(ro)),
+                                                  task(t),
+                                                  out(o),
+                                                  options(std::move(opts)),
+                                                  stage(Stage::header),
+                                                  length(0),
+                                                  n(0) {}
+
+  // Issues reads until one of them has to wait.  Data that is already
+  // buffered is consumed without a trip through the dispatcher.
+  void run() {
+    while (true) {
+      subtask.reset();
+      task->add_subtask(&subtask);
+      switch (stage) {
+        case Stage::header:
+          reader.read_uvarint(&subtask, &length, options);
+          break;
+
+        case Stage::payload:
+          reader.read(&subtask, &(*out)[0], &n, length, length, options);
+          break;
+
+        case Stage::trailer:
+          reader.read(&subtask, crc, &n, 4, 4, options);
+          break;
+      }
+      if (!subtask.is_finished()) {
+        auto d = get_manager(options).dispatcher();
+        subtask.on_finished(d, event::callback([this] {
+          if (complete()) run();
+          return base::Result();
+        }));
+        return;
+      }
+      if (!complete()) return;
+    }
+  }
+
+  // Returns true if another read is needed.
+  bool complete() {
+    auto r = subtask_result(subtask);
+    if (r.code() == base::ResultCode::END_OF_FILE && stage != Stage::header) {
+      r = base::Result::data_loss("truncated record");
+    }
+    if (!r) return finish(std::move(r));
+
+    switch (stage) {
+      case Stage::header:
+        if (length > ro.max_record_size) {
+          return finish(base::Result::data_loss(
+              "record of ", length, " bytes exceeds the maximum of ",
+              ro.max_record_size, " bytes"));
+        }
+        out->resize(length);
+        if (length > 0) {
+          stage = Stage::payload;
+          return true;
+        }
+        break;
+
+      case Stage::payload:
+        break;
+
+      case Stage::trailer: {
+        uint32_t expected = base::kLittleEndian->get_u32(crc);
+        uint32_t actual = base::crc32c(out->data(), out->size());
+        if (expected != actual) {
+          return finish(base::Result::data_loss("record checksum mismatch"));
+        }
+        return finish(base::Result());
+      }
+    }
+
+    if (!ro.checksum) return finish(base::Result());
+    stage = Stage::trailer;
+    return true;
+  }
+
+  bool finish(base::Result r) {
+    if (!r) out->clear();
+    task->finish(std::move(r));
+    delete this;
+    return false;
+  }
+};
+}  // inline namespace implementation
+
+RecordReader::RecordReader(Reader r, RecordOptions ro)
+    : r_(std::move(r)), ro_(std::move(ro)) {
+  if (!r_.is_buffered()) r_ = bufferedreader(std::move(r_));
+}
+
+void RecordReader::read(event::Task* task, std::string* out,
+                        const base::Options& opts) const {
+  CHECK_NOTNULL(task);
+  CHECK_NOTNULL(out);
+  if (!task->start()) return;
+  out->clear();
+
+  auto* h = new RecordReadHelper(r_, ro_, task, out, opts);
+  h->run();
+}
+
+base::Result RecordReader::read(std::string* out,
+                                const base::Options& opts) const {
+  event::Task task;
+  read(&task, out, opts);
+  event::wait(get_manager(opts), &task);
+  return task.result();
+}
+
+void RecordReader::close(event::Task* task, const base::Options& opts) const {
+  r_.close(task, opts);
+}
+
+base::Result RecordReader::close(const base::Options& opts) const {
+  return r_.close(opts);
+}
+
+class RecordWriterImpl
+    : public std::enable_shared_from_this<RecordWriterImpl> {
+ public:
+  RecordWriterImpl(Writer w, RecordOptions ro)
+      : w_(std::move(w)),
+        ro_(std::move(ro)),
+        batch_size_(ro_.batch_size),
+        n_(0),
+        busy_(false),
+        closed_(false) {
+    if (batch_size_ == 0) batch_size_ = w_.ideal_block_size();
+  }
+
+  const Writer& writer() const noexcept { return w_; }
+  const RecordOptions& record_options() const noexcept { return ro_; }
+
+  void write(event::Task* task, const char* ptr, std::size_t len,
+             const base::Options& opts) {
+    if (len > ro_.max_record_size) {
+      task->finish(base::Result::out_of_range(
+          "record of ", len, " bytes exceeds the maximum of ",
+          ro_.max_record_size, " bytes"));
+      return;
+    }
+
+    auto lock = base::acquire_lock(mu_);
+    if (closed_ || !result_) {
+      auto r = closed_ ? writer_closed() : result_;
+      lock.unlock();
+      task->finish(std::move(r));
+      return;
+    }
+
+    char buf[10];
+    auto* p = reinterpret_cast<unsigned char*>(&buf);
+    std::size_t hlen = 0;
+    uint64_t x = len;
+    while (x >= 0x80) {
+      p[hlen] = 0x80 | (x & 0x7f);
+      x >>= 7;
+      ++hlen;
+    }
+    p[hlen] = (x & 0x7f);
+    ++hlen;
+    pending_.append(buf, hlen);
+    pending_.append(ptr, len);
+    if (ro_.checksum) {
+      base::kLittleEndian->put_u32(buf, base::crc32c(ptr, len));
+      pending_.append(buf, 4);
+    }
+
+    if (pending_.size() < batch_size_) {
+      lock.unlock();
+      task->finish_ok();
+      return;
+    }
+    next_.emplace_back(task, Tail::none, opts);
+    kick(lock, opts);
+  }
+
+  void flush(event::Task* task, const base::Options& opts) {
+    wait_then(task, Tail::flush, opts);
+  }
+
+  void close(event::Task* task, const base::Options& opts) {
+    wait_then(task, Tail::close, opts);
+  }
+
+ private:
+  enum class Tail : uint8_t {
+    none = 0,
+    flush = 1,
+    close = 2,
+  };
+
+  struct Waiter {
+    event::Task* task;
+    Tail tail;
+    base::Options options;
+
+    Waiter(event::Task* t, Tail tl, base::Options opts) noexcept
+        : task(t),
+          tail(tl),
+          options(std::move(opts)) {}
+  };
+
+  // Runs |tail| against |w_| once every record staged so far is written.
+  void wait_then(event::Task* task, Tail tail, const base::Options& opts) {
+    auto lock = base::acquire_lock(mu_);
+    if (closed_ || !result_) {
+      auto r = closed_ ? writer_closed() : result_;
+      lock.unlock();
+      task->finish(std::move(r));
+      return;
+    }
+    if (tail == Tail::close) closed_ = true;
+
+    if (!pending_.empty()) {
+      next_.emplace_back(task, tail, opts);
+      kick(lock, opts);
+    } else if (busy_) {
+      batch_.emplace_back(task, tail, opts);
+    } else {
+      lock.unlock();
+      finish_waiter(Waiter(task, tail, opts), base::Result());
+    }
+  }
+
+  // Starts writing |pending_|, unless a write is already in flight.
+  // Always releases |lock|.
+  void kick(base::Lock& lock, const base::Options& opts) {
+    if (busy_ || pending_.empty()) {
+      lock.unlock();
+      return;
+    }
+    busy_ = true;
+    inflight_.swap(pending_);
+    pending_.clear();
+    batch_.swap(next_);
+    subtask_.reset();
+    n_ = 0;
+    auto self = shared_from_this();
+    lock.unlock();
+
+    w_.write(&subtask_, &n_, inflight_.data(), inflight_.size(), opts);
+    auto d = get_manager(opts).dispatcher();
+    subtask_.on_finished(d, event::callback([self, opts] {
+      self->write_complete(opts);
+      return base::Result();
+    }));
+  }
+
+  void write_complete(const base::Options& opts) {
+    auto r = subtask_result(subtask_);
+    auto lock = base::acquire_lock(mu_);
+    busy_ = false;
+    inflight_.clear();
+    std::vector<Waiter> waiters;
+    waiters.swap(batch_);
+    if (!r) {
+      result_ = r;
+      pending_.clear();
+      for (auto& w : next_) waiters.push_back(std::move(w));
+      next_.clear();
+    }
+    if (!next_.empty() || pending_.size() >= batch_size_)
+      kick(lock, opts);
+    else
+      lock.unlock();
+
+    for (auto& w : waiters) finish_waiter(std::move(w), r);
+  }
+
+  void finish_waiter(Waiter w, base::Result r) {
+    if (!r) {
+      w.task->finish(std::move(r));
+      return;
+    }
+    if (w.tail == Tail::none) {
+      w.task->finish_ok();
+      return;
+    }
+
+    // |w.task| is already running, so the tail runs as a subtask.
+    struct Helper {
+      event::Task* const task;
+      event::Task subtask;
+
+      explicit Helper(event::Task* t) noexcept : task(t) {}
+    };
+    auto* h = new Helper(w.task);
+    w.task->add_subtask(&h->subtask);
+    if (w.tail == Tail::flush)
+      w_.flush(&h->subtask, w.options);
+    else
+      w_.close(&h->subtask, w.options);
+    h->subtask.on_finished(event::callback([h] {
+      event::propagate_result(h->task, &h->subtask);
+      delete h;
+      return base::Result();
+    }));
+  }
+
+  const Writer w_;
+  const RecordOptions ro_;
+  std::size_t batch_size_;
+  mutable std::mutex mu_;
+  event::Task subtask_;
+  std::size_t n_;
+  std::string pending_;        // records staged for the next batch
+  std::string inflight_;       // records being written by |subtask_|
+  std::vector<Waiter> next_;   // waiting for |pending_| to be written
+  std::vector<Waiter> batch_;  // waiting for |inflight_| to be written
+  base::Result result_;
+  bool busy_;
+  bool closed_;
+};
+
+RecordWriter::RecordWriter(Writer w, RecordOptions ro)
+    : ptr_(std::make_shared<RecordWriterImpl>(std::move(w), std::move(ro))) {}
+
+const Writer& RecordWriter::writer() const noexcept { return ptr_->writer(); }
+
+const RecordOptions& RecordWriter::record_options() const noexcept {
+  return ptr_->record_options();
+}
+
+void RecordWriter::write(event::Task* task, const char* ptr, std::size_t len,
+                         const base::Options& opts) const {
+  CHECK_NOTNULL(task);
+  if (len > 0) CHECK_NOTNULL(ptr);
+  if (!task->start()) return;
+  ptr_->write(task, ptr, len, opts);
+}
+
+base::Result RecordWriter::write(const char* ptr, std::size_t len,
+                                 const base::Options& opts) const {
+  event::Task task;
+  write(&task, ptr, len, opts);
+  event::wait(get_manager(opts), &task);
+  return task.result();
+}
+
+void RecordWriter::flush(event::Task* task, const base::Options& opts) const {
+  CHECK_NOTNULL(task);
+  if (!task->start()) return;
+  ptr_->flush(task, opts);
+}
+
+base::Result RecordWriter::flush(const base::Options& opts) const {
+  event::Task task;
+  flush(&task, opts);
+  event::wait(get_manager(opts), &task);
+  return task.result();
+}
+
+void RecordWriter::close(event::Task* task, const base::Options& opts) const {
+  CHECK_NOTNULL(task);
+  if (!task->start()) return;
+  ptr_->close(task, opts);
+}
+
+base::Result RecordWriter::close(const base::Options& opts) const {
+  event::Task task;
+  close(&task, opts);
+  event::wait(get_manager(opts), &task);
+  return task.result();
+}
+
+}  // namespace io
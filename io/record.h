@@ -0,0 +1,125 @@
+// io/record.h - Length-prefixed record framing
+// Copyright © 2017 by Donald King <chronos@chronos-tachyon.net>
+// Available under the MIT License. See LICENSE for details.
+
+#ifndef IO_RECORD_H
+#define IO_RECORD_H
+
+#include <memory>
+#include <string>
+
+#include "base/result.h"
+#include "io/reader.h"
+#include "io/writer.h"
+
+namespace io {
+
+// Records larger than this are rejected unless configured otherwise.
+constexpr std::size_t kDefaultMaxRecordSize = std::size_t(16) << 20;
+
+// Each record is framed as:
+//
+//    uvarint  length of payload, in bytes
+//    bytes    payload
+//    u32le    CRC-32C of payload (only if |checksum| is true)
+//
+struct RecordOptions {
+  // The largest payload that will be written or read.
+  std::size_t max_record_size;
+
+  // If true, each payload is followed by its CRC-32C.
+  bool checksum;
+
+  // RecordWriter stages records in memory and writes them out together once
+  // at least this many bytes are pending.  0 means |w.ideal_block_size()|.
+  std::size_t batch_size;
+
+  RecordOptions() noexcept : max_record_size(kDefaultMaxRecordSize),
+                             checksum(true),
+                             batch_size(0) {}
+};
+
+// RecordReader reads framed records from a Reader.
+// - Payloads are read straight out of the Reader's buffer into the caller's
+//   string; |r| is wrapped in a |bufferedreader()| if it has no buffering
+// - A clean END_OF_FILE between records is reported as END_OF_FILE; a
+//   truncated record, an oversized length, or a checksum mismatch is
+//   reported as DATA_LOSS
+// - Each |read()| must complete before the next one starts
+class RecordReader {
+ public:
+  explicit RecordReader(Reader r, RecordOptions ro = RecordOptions());
+
+  const Reader& reader() const noexcept { return r_; }
+  const RecordOptions& record_options() const noexcept { return ro_; }
+
+  // Reads the next record's payload into |out|.
+  void read(event::Task* task, std::string* out,
+            const base::Options& opts = base::default_options()) const;
+  base::Result read(std::string* out,
+                    const base::Options& opts = base::default_options()) const;
+
+  // Closes the underlying Reader.
+  void close(event::Task* task,
+             const base::Options& opts = base::default_options()) const;
+  base::Result close(const base::Options& opts = base::default_options()) const;
+
+ private:
+  Reader r_;
+  RecordOptions ro_;
+};
+
+class RecordWriterImpl;  // forward declaration
+
+// RecordWriter writes framed records to a Writer.
+// - Small records are batched: |write()| completes as soon as the record is
+//   staged, and staged records go out in a single write to |w| once
+//   |batch_size| bytes are pending, or on |flush()| or |close()|
+// - Writes that fill a batch complete once that batch has been written
+// - Payloads larger than |max_record_size| are rejected with OUT_OF_RANGE
+// - Once a write to |w| fails, every later call returns the same error
+//
+// Staged records are lost if the RecordWriter is destroyed without a call to
+// |flush()| or |close()|.
+//
+// THREAD SAFETY: This class is thread-safe.
+//
+class RecordWriter {
+ public:
+  explicit RecordWriter(Writer w, RecordOptions ro = RecordOptions());
+
+  const Writer& writer() const noexcept;
+  const RecordOptions& record_options() const noexcept;
+
+  // Writes one record whose payload is the |len| bytes at |ptr|.
+  void write(event::Task* task, const char* ptr, std::size_t len,
+             const base::Options& opts = base::default_options()) const;
+  base::Result write(const char* ptr, std::size_t len,
+                     const base::Options& opts = base::default_options()) const;
+  void write(event::Task* task, const std::string& str,
+             const base::Options& opts = base::default_options()) const {
+    write(task, str.data(), str.size(), opts);
+  }
+  base::Result write(
+      const std::string& str,
+      const base::Options& opts = base::default_options()) const {
+    return write(str.data(), str.size(), opts);
+  }
+
+  // Writes out all staged records, then flushes the underlying Writer.
+  void flush(event::Task* task,
+             const base::Options& opts = base::default_options()) const;
+  base::Result flush(const base::Options& opts = base::default_options()) const;
+
+  // Writes out all staged records, then closes the underlying Writer.
+  void close(event::Task* task,
+             const base::Options& opts = base::default_options()) const;
+  base::Result close(const base::Options& opts = base::default_options()) const;
+
+ private:
+  std::shared_ptr<RecordWriterImpl> ptr_;
+};
+
+}  // namespace io
+
+#endif  // IO_RECORD_H
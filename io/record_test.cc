@@ -0,0 +1,142 @@
+// Copyright © 2017 by Donald King <chronos@chronos-tachyon.net>
+// Available under the MIT License. See LICENSE for details.
+
+#include "gtest/gtest.h"
+
+#include <thread>
+
+#include "base/logging.h"
+#include "base/result_testing.h"
+#include "io/pipe.h"
+#include "io/record.h"
+
+static io::Writer counting_writer(std::string* out, std::size_t* count) {
+  return io::writer([out, count](std::size_t* n, const char* ptr,
+                                 std::size_t len, const base::Options& opts) {
+    out->append(ptr, len);
+    *n = len;
+    ++*count;
+    return base::Result();
+  });
+}
+
+static std::string record(std::size_t i) {
+  return std::string(i % 37, 'a' + (i % 26));
+}
+
+TEST(Record, RoundTrip) {
+  io::RecordOptions ro;
+  ro.batch_size = 1024;
+
+  std::string data;
+  std::size_t count = 0;
+  io::RecordWriter w(counting_writer(&data, &count), ro);
+  for (std::size_t i = 0; i < 100; ++i) {
+    EXPECT_OK(w.write(record(i)));
+  }
+  // Many small records go out in a handful of large writes.
+  EXPECT_GT(count, 0U);
+  EXPECT_LT(count, 5U);
+  EXPECT_OK(w.flush());
+  EXPECT_LT(count, 6U);
+
+  io::RecordReader r(io::stringreader(data), ro);
+  std::string str;
+  for (std::size_t i = 0; i < 100; ++i) {
+    EXPECT_OK(r.read(&str));
+    EXPECT_EQ(record(i), str);
+  }
+  EXPECT_EOF(r.read(&str));
+
+  EXPECT_OK(w.close());
+  EXPECT_EQ(base::ResultCode::FAILED_PRECONDITION, w.write("x").code());
+
+  base::log_flush();
+}
+
+TEST(Record, NoChecksum) {
+  io::RecordOptions ro;
+  ro.checksum = false;
+
+  std::string data;
+  io::RecordWriter w(io::stringwriter(&data), ro);
+  EXPECT_OK(w.write("hello"));
+  EXPECT_OK(w.write(""));
+  EXPECT_OK(w.close());
+  EXPECT_EQ(std::string("\x05hello\x00", 7), data);
+
+  io::RecordReader r(io::stringreader(data), ro);
+  std::string str;
+  EXPECT_OK(r.read(&str));
+  EXPECT_EQ("hello", str);
+  EXPECT_OK(r.read(&str));
+  EXPECT_EQ("", str);
+  EXPECT_EOF(r.read(&str));
+
+  base::log_flush();
+}
+
+TEST(Record, Errors) {
+  io::RecordOptions ro;
+  ro.max_record_size = 8;
+
+  std::string data;
+  io::RecordWriter w(io::stringwriter(&data), ro);
+  EXPECT_EQ(base::ResultCode::OUT_OF_RANGE, w.write("123456789").code());
+  EXPECT_OK(w.write("12345678"));
+  EXPECT_OK(w.close());
+  ASSERT_EQ(13U, data.size());
+
+  std::string str;
+  ro.max_record_size = 4;
+  io::RecordReader r0(io::stringreader(data), ro);
+  EXPECT_EQ(base::ResultCode::DATA_LOSS, r0.read(&str).code());
+
+  io::RecordReader r1(io::stringreader(data.substr(0, 11)));
+  EXPECT_EQ(base::ResultCode::DATA_LOSS, r1.read(&str).code());
+
+  data[3] ^= 0x20;
+  io::RecordReader r2(io::stringreader(data));
+  EXPECT_EQ(base::ResultCode::DATA_LOSS, r2.read(&str).code());
+
+  base::log_flush();
+}
+
+TEST(Record, Pipe) {
+  io::Pipe pipe = io::make_pipe(16, 4);
+  io::RecordOptions ro;
+  ro.batch_size = 100;
+  io::RecordWriter w(std::move(pipe.write), ro);
+  io::RecordReader r(std::move(pipe.read), ro);
+
+  base::Options o;
+  event::Manager m = io::get_manager(o);
+
+  constexpr std::size_t kNum = 50;
+  std::thread t([&r, &o] {
+    std::string str;
+    for (std::size_t i = 0; i < kNum; ++i) {
+      EXPECT_OK(r.read(&str, o));
+      EXPECT_EQ(record(i), str);
+    }
+    EXPECT_EOF(r.read(&str, o));
+  });
+
+  std::vector<std::string> in;
+  for (std::size_t i = 0; i < kNum; ++i) in.push_back(record(i));
+
+  event::Task tasks[kNum + 1];
+  std::vector<event::Task*> ptrs;
+  for (std::size_t i = 0; i < kNum; ++i) {
+    w.write(&tasks[i], in[i], o);
+    ptrs.push_back(&tasks[i]);
+  }
+  w.close(&tasks[kNum], o);
+  ptrs.push_back(&tasks[kNum]);
+
+  event::wait_all({m}, ptrs);
+  for (auto* task : ptrs) EXPECT_OK(task->result());
+  t.join();
+
+  base::log_flush();
+}
@@ -3,14 +3,205 @@
 
 #include "io/util.h"
 
+#include <deque>
+#include <mutex>
 #include <type_traits>
 #include <vector>
 
+#include "base/cleanup.h"
 #include "base/logging.h"
+#include "base/mutex.h"
 
 namespace io {
 
 namespace {
+// PipelinedCopyHelper is the |copy_depth >= 2| flavor of the read/write
+// fallback loop.  At most one read and one write are outstanding at a time,
+// but they run concurrently, with up to |depth| buffers in flight between
+// them.
+class PipelinedCopyHelper {
+ public:
+  PipelinedCopyHelper(event::Task* t, std::size_t* c, std::size_t x, Writer w,
+                      Reader r, base::Options opts, PoolPtr p,
+                      std::size_t d) noexcept : task_(t),
+                                                copied_(c),
+                                                max_(x),
+                                                writer_(std::move(w)),
+                                                reader_(std::move(r)),
+                                                options_(std::move(opts)),
+                                                pool_(std::move(p)),
+                                                depth_(d),
+                                                total_(*c),
+                                                inflight_(0),
+                                                rdn_(0),
+                                                wrn_(0),
+                                                reading_(false),
+                                                writing_(false),
+                                                eof_(false),
+                                                pumping_(false),
+                                                repump_(false) {
+    VLOG(6) << "io::PipelinedCopyHelper: max=" << max_ << ", depth=" << depth_;
+  }
+
+  void begin() {
+    auto lock = base::acquire_lock(mu_);
+    pump(lock);
+  }
+
+ private:
+  struct Block {
+    OwnedBuffer buffer;
+    std::size_t len;
+
+    Block(OwnedBuffer b, std::size_t l) noexcept : buffer(std::move(b)),
+                                                   len(l) {}
+  };
+
+  bool stopped() const noexcept { return eof_ || !result_; }
+
+  // Starts the next read and/or write, if possible.  If everything is done,
+  // finishes |task_| and deletes |this|.
+  void pump(base::Lock& lock) {
+    if (pumping_) {
+      repump_ = true;
+      return;
+    }
+    pumping_ = true;
+    do {
+      repump_ = false;
+      if (!writing_ && !wrq_.empty()) start_write(lock);
+      if (!reading_ && !stopped() && total_ < max_ && inflight_ < depth_)
+        start_read(lock);
+    } while (repump_);
+    pumping_ = false;
+
+    bool done = (stopped() || total_ >= max_) && wrq_.empty();
+    if (done && !reading_ && !writing_) {
+      base::Result r = std::move(result_);
+      lock.unlock();
+      task_->finish(std::move(r));
+      delete this;
+    }
+  }
+
+  void start_read(base::Lock& lock) {
+    reading_ = true;
+    ++inflight_;
+    rdbuf_ = pool_->take();
+    std::size_t len = rdbuf_.size();
+    if (len > max_ - total_) len = max_ - total_;
+    rdn_ = 0;
+    rdtask_.reset();
+    task_->add_subtask(&rdtask_);
+    char* ptr = rdbuf_.data();
+    lock.unlock();
+    auto reacquire = base::cleanup([&lock] { lock.lock(); });
+    reader_.read(&rdtask_, ptr, &rdn_, 1, len, options_);
+    rdtask_.on_finished(event::callback([this] { return read_complete(); }));
+  }
+
+  void start_write(base::Lock& lock) {
+    writing_ = true;
+    wrbuf_ = std::move(wrq_.front().buffer);
+    std::size_t len = wrq_.front().len;
+    wrq_.pop_front();
+    wrn_ = 0;
+    wrtask_.reset();
+    task_->add_subtask(&wrtask_);
+    const char* ptr = wrbuf_.data();
+    lock.unlock();
+    auto reacquire = base::cleanup([&lock] { lock.lock(); });
+    writer_.write(&wrtask_, &wrn_, ptr, len, options_);
+    wrtask_.on_finished(event::callback([this] { return write_complete(); }));
+  }
+
+  base::Result read_complete() {
+    auto r = rdtask_.result();
+    auto lock = base::acquire_lock(mu_);
+    VLOG(6) << "io::PipelinedCopyHelper::read_complete: "
+            << "n=" << rdn_ << ", "
+            << "r=" << r;
+    reading_ = false;
+    total_ += rdn_;
+    if (rdn_ > 0) {
+      wrq_.emplace_back(std::move(rdbuf_), rdn_);
+    } else {
+      pool_->give(std::move(rdbuf_));
+      --inflight_;
+    }
+    switch (r.code()) {
+      case base::ResultCode::OK:
+        if (rdn_ == 0) eof_ = true;
+        break;
+
+      case base::ResultCode::END_OF_FILE:
+        eof_ = true;
+        break;
+
+      default:
+        if (result_) result_ = std::move(r);
+    }
+    pump(lock);
+    return base::Result();
+  }
+
+  base::Result write_complete() {
+    auto r = wrtask_.result();
+    auto lock = base::acquire_lock(mu_);
+    VLOG(6) << "io::PipelinedCopyHelper::write_complete: "
+            << "n=" << wrn_ << ", "
+            << "r=" << r;
+    *copied_ += wrn_;
+    pool_->give(std::move(wrbuf_));
+    --inflight_;
+    if (!r) {
+      if (result_) result_ = std::move(r);
+      // Nothing more will be written, so stop waiting on the Reader.
+      while (!wrq_.empty()) {
+        pool_->give(std::move(wrq_.front().buffer));
+        wrq_.pop_front();
+        --inflight_;
+      }
+      // Cancelling can finish the read inline, and |read_complete()| takes
+      // |mu_|.  |writing_| stays set until afterward, so that it can't
+      // finish |task_| and delete |this| in the meantime.
+      if (reading_) {
+        lock.unlock();
+        rdtask_.cancel();
+        lock.lock();
+      }
+    }
+    writing_ = false;
+    pump(lock);
+    return base::Result();
+  }
+
+  event::Task* const task_;
+  std::size_t* const copied_;
+  const std::size_t max_;
+  const Writer writer_;
+  const Reader reader_;
+  const base::Options options_;
+  const PoolPtr pool_;
+  const std::size_t depth_;
+  mutable std::mutex mu_;
+  std::deque<Block> wrq_;   // protected by mu_
+  OwnedBuffer rdbuf_;       // protected by reading_
+  OwnedBuffer wrbuf_;       // protected by writing_
+  event::Task rdtask_;
+  event::Task wrtask_;
+  base::Result result_;     // protected by mu_
+  std::size_t total_;       // protected by mu_; bytes read so far
+  std::size_t inflight_;    // protected by mu_; # of buffers taken
+  std::size_t rdn_;         // protected by reading_
+  std::size_t wrn_;         // protected by writing_
+  bool reading_;            // protected by mu_
+  bool writing_;            // protected by mu_
+  bool eof_;                // protected by mu_
+  bool pumping_;            // protected by mu_
+  bool repump_;             // protected by mu_
+};
+
 struct CopyHelper {
   event::Task* const task;
   std::size_t* const copied;
@@ -100,6 +291,22 @@ struct CopyHelper {
       delete this;
       return base::Result();
     }
+    std::size_t depth = options.get<io::Options>().copy_depth;
+    if (depth >= 2) {
+      pool->give(std::move(buffer));
+      subtask.reset();
+      task->add_subtask(&subtask);
+      n = 0;
+      if (subtask.start()) {
+        auto* helper = new PipelinedCopyHelper(&subtask, &n, max - *copied,
+                                               writer, reader, options, pool,
+                                               depth);
+        helper->begin();
+      }
+      auto closure = [this] { return pipelined_complete(); };
+      subtask.on_finished(event::callback(closure));
+      return base::Result();
+    }
     subtask.reset();
     task->add_subtask(&subtask);
     std::size_t min = 1;
@@ -112,6 +319,18 @@ struct CopyHelper {
     return base::Result();
   }
 
+  base::Result pipelined_complete() {
+    *copied += n;
+    auto r = subtask.result();
+    VLOG(6) << "io::CopyHelper::pipelined_complete: "
+            << "*copied=" << *copied << ", "
+            << "n=" << n << ", "
+            << "r=" << r;
+    task->finish(std::move(r));
+    delete this;
+    return base::Result();
+  }
+
   base::Result fallback_read_complete() {
     auto r = subtask.result();
     VLOG(6) << "io::CopyHelper::fallback_read_complete: "
@@ -21,6 +21,7 @@
 #include "base/fd.h"
 #include "base/logging.h"
 #include "base/result_testing.h"
+#include "event/callback.h"
 #include "io/util.h"
 
 static std::unique_lock<std::mutex> acquire_lock(std::mutex& mu) {
@@ -62,6 +63,119 @@ TEST(Copy, StringReaderStringWriter) {
   base::log_flush();
 }
 
+// Hides the |write_to()| fast path of |r|, forcing io::copy to fall back.
+static io::Reader plain_reader(io::Reader r) {
+  return io::reader([r](char* out, std::size_t* n, std::size_t min,
+                        std::size_t max, const base::Options& o) {
+    return r.read(out, n, min, max, o);
+  });
+}
+
+TEST(Copy, Pipelined) {
+  std::string in;
+  for (std::size_t i = 0; i < 1000; ++i) in.push_back('a' + (i % 26));
+  std::string out;
+  io::Reader r = plain_reader(io::stringreader(in));
+  io::Writer w = io::stringwriter(&out);
+  base::Options o;
+  o.get<io::Options>().manager = make_manager();
+  o.get<io::Options>().block_size = 16;
+  o.get<io::Options>().copy_depth = 4;
+
+  event::Task task;
+  std::size_t n;
+  io::copy(&task, &n, w, r, o);
+  event::wait(io::get_manager(o), &task);
+  EXPECT_OK(task.result());
+  EXPECT_EQ(1000U, n);
+  EXPECT_EQ(in, out);
+
+  out.clear();
+  r = plain_reader(io::stringreader(in));
+  task.reset();
+  io::copy_n(&task, &n, 100, w, r, o);
+  event::wait(io::get_manager(o), &task);
+  EXPECT_OK(task.result());
+  EXPECT_EQ(100U, n);
+  EXPECT_EQ(in.substr(0, 100), out);
+
+  r = plain_reader(io::stringreader(in));
+  task.reset();
+  io::copy(&task, &n, io::fullwriter(), r, o);
+  event::wait(io::get_manager(o), &task);
+  EXPECT_EQ(base::ResultCode::RESOURCE_EXHAUSTED, task.result().code());
+  EXPECT_EQ(0U, n);
+
+  base::log_flush();
+}
+
+// Returns one block, then stalls until cancelled, at which point it finishes
+// the read inline.
+class StallReader : public io::ReaderImpl {
+ public:
+  std::size_t ideal_block_size() const noexcept override { return 16; }
+
+  void read(event::Task* task, char* out, std::size_t* n, std::size_t min,
+            std::size_t max, const base::Options& opts) override {
+    if (!prologue(task, out, n, min, max)) return;
+    if (first_) {
+      first_ = false;
+      ::memset(out, 'x', max);
+      *n = max;
+      task->finish_ok();
+      return;
+    }
+    task->on_cancelled(event::callback([task] {
+      task->finish_cancel();
+      return base::Result();
+    }));
+  }
+
+  void close(event::Task* task, const base::Options& opts) override {
+    if (prologue(task)) task->finish_ok();
+  }
+
+ private:
+  bool first_ = true;
+};
+
+// Fails every write, a little later and from another thread.
+class LateFailWriter : public io::WriterImpl {
+ public:
+  std::size_t ideal_block_size() const noexcept override { return 16; }
+
+  void write(event::Task* task, std::size_t* n, const char* ptr,
+             std::size_t len, const base::Options& opts) override {
+    if (!prologue(task, n, ptr, len)) return;
+    std::thread([task] {
+      sleep_ms(10);
+      task->finish(base::Result::internal("write failed"));
+    }).detach();
+  }
+
+  void close(event::Task* task, const base::Options& opts) override {
+    if (prologue(task)) task->finish_ok();
+  }
+};
+
+TEST(Copy, PipelinedWriteFailureCancelsRead) {
+  io::Reader r(std::make_shared<StallReader>());
+  io::Writer w(std::make_shared<LateFailWriter>());
+  base::Options o;
+  o.get<io::Options>().manager = make_manager();
+  o.get<io::Options>().block_size = 16;
+  o.get<io::Options>().copy_depth = 4;
+
+  event::Task task;
+  std::size_t n;
+  io::copy(&task, &n, w, r, o);
+  event::wait(io::get_manager(o), &task);
+  EXPECT_EQ(base::ResultCode::INTERNAL, task.result().code());
+  EXPECT_EQ(0U, n);
+
+  base::log_flush();
+}
+
 static void TestFileFileCopy(const base::Options& o) {
   std::string srcpath, dstpath;
   base::FD srcfd, dstfd;
@@ -153,6 +267,67 @@ TEST(Copy, FileFileSplice) {
   TestFileFileCopy(o);
 }
 
+TEST(Copy, FileSocketDefault) {
+  base::Options o;
+  o.get<io::Options>().manager = make_manager();
+
+  std::string path;
+  base::FD fd;
+  ASSERT_OK(base::make_tempfile(&path, &fd, "mojo-io-util-test.XXXXXX"));
+  auto cleanup = base::cleanup([path] { ::unlink(path.c_str()); });
+  ASSERT_OK(base::write_exactly(fd, "0123456789", 10, "tempfile"));
+  ASSERT_OK(base::seek(nullptr, fd, 0, SEEK_SET));
+
+  base::SocketPair pair;
+  ASSERT_OK(base::make_socketpair(&pair, AF_UNIX, SOCK_STREAM, 0));
+
+  auto before = io::transfer_stats();
+  event::Task task;
+  std::size_t n;
+  io::copy(&task, &n, io::fdwriter(pair.left), io::fdreader(fd), o);
+  event::wait(io::get_manager(o), &task);
+  EXPECT_OK(task.result());
+  EXPECT_EQ(10U, n);
+  auto after = io::transfer_stats();
+  EXPECT_EQ(before.splice, after.splice);
+  EXPECT_EQ(before.sendfile + 1, after.sendfile);
+
+  char buf[10];
+  EXPECT_OK(base::read_exactly(pair.right, buf, 10, "socket"));
+  EXPECT_EQ("0123456789", std::string(buf, 10));
+
+  base::log_flush();
+}
+
+TEST(Copy, PipeSocketDefault) {
+  base::Options o;
+  o.get<io::Options>().manager = make_manager();
+
+  base::Pipe pipe;
+  ASSERT_OK(base::make_pipe(&pipe));
+  ASSERT_OK(base::write_exactly(pipe.write, "abcdef", 6, "pipe"));
+  ASSERT_OK(pipe.write->close());
+
+  base::SocketPair pair;
+  ASSERT_OK(base::make_socketpair(&pair, AF_UNIX, SOCK_STREAM, 0));
+
+  auto before = io::transfer_stats();
+  event::Task task;
+  std::size_t n;
+  io::copy(&task, &n, io::fdwriter(pair.left), io::fdreader(pipe.read), o);
+  event::wait(io::get_manager(o), &task);
+  EXPECT_OK(task.result());
+  EXPECT_EQ(6U, n);
+  auto after = io::transfer_stats();
+  EXPECT_EQ(before.splice + 1, after.splice);
+
+  char buf[6];
+  EXPECT_OK(base::read_exactly(pair.right, buf, 6, "socket"));
+  EXPECT_EQ("abcdef", std::string(buf, 6));
+
+  base::log_flush();
+}
+
 TEST(Copy, SocketShuffle) {
   event::Manager m = make_manager();
   base::Options o;
@@ -3,8 +3,10 @@
 
 #include "io/writer.h"
 
+#include <sys/uio.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <condition_variable>
 #include <cstring>
 #include <deque>
@@ -415,6 +417,8 @@ class CloseIgnoringWriter : public WriterImpl {
   }
 
   bool is_buffered() const noexcept override { return w_.is_buffered(); }
+  void cork() override { w_.cork(); }
+  void uncork() override { w_.uncork(); }
 
   void write(event::Task* task, std::size_t* n, const char* ptr,
              std::size_t len, const base::Options& opts) override {
@@ -649,10 +653,13 @@ class FullWriter : public WriterImpl {
 
 class FDWriter : public WriterImpl {
  public:
+  struct WriteOp;  // forward declaration
+
   struct Op {
     virtual ~Op() noexcept = default;
     virtual void cancel() = 0;
     virtual bool process(FDWriter* writer) = 0;
+    virtual WriteOp* as_write() noexcept { return nullptr; }
   };
 
   struct WriteOp : public Op {
@@ -671,6 +678,16 @@ class FDWriter : public WriterImpl {
                                            options(std::move(opts)) {}
     void cancel() override { task->cancel(); }
     bool process(FDWriter* writer) override;
+    WriteOp* as_write() noexcept override { return this; }
+    void retire(FDWriter* writer);
+  };
+
+  struct FlushOp : public Op {
+    event::Task* const task;
+
+    explicit FlushOp(event::Task* t) noexcept : task(t) {}
+    void cancel() override { task->cancel(); }
+    bool process(FDWriter* writer) override;
   };
 
   struct SyncOp : public Op {
@@ -689,21 +706,32 @@ class FDWriter : public WriterImpl {
     bool process(FDWriter* writer) override;
   };
 
-  explicit FDWriter(base::FD fd) noexcept : fd_(std::move(fd)), depth_(0) {}
+  using Batch = std::vector<std::unique_ptr<Op>>;
+
+  // The most writes that will be coalesced into a single writev(2).
+  static constexpr std::size_t kMaxBatch = 64;
+
+  explicit FDWriter(base::FD fd) noexcept : fd_(std::move(fd)),
+                                            depth_(0),
+                                            corked_(false) {}
   ~FDWriter() noexcept override;
 
   std::size_t ideal_block_size() const noexcept override {
     return kDefaultIdealBlockSize;
   }
 
+  void cork() override;
+  void uncork() override;
   void write(event::Task* task, std::size_t* n, const char* ptr,
              std::size_t len, const base::Options& opts) override;
+  void flush(event::Task* task, const base::Options& opts) override;
   void sync(event::Task* task, const base::Options& opts) override;
   void close(event::Task* task, const base::Options& opts) override;
   base::FD internal_writerfd() const override { return fd_; }
 
  private:
   void process(base::Lock& lock);
+  void write_batch(Batch* batch);
   base::Result wake(event::Set set);
   base::Result arm(event::Handle* evt, const base::FD& fd, event::Set set,
                    const base::Options& o);
@@ -714,8 +742,11 @@ class FDWriter : public WriterImpl {
   std::deque<std::unique_ptr<Op>> q_;  // protected by mu_
   std::vector<event::Handle> purge_;   // protected by mu_
   std::size_t depth_;                  // protected by mu_
+  bool corked_;                        // protected by mu_
 };
 
+constexpr std::size_t FDWriter::kMaxBatch;
+
 FDWriter::~FDWriter() noexcept {
   VLOG(6) << "io::FDWriter::~FDWriter";
   auto lock = base::acquire_lock(mu_);
@@ -740,10 +771,31 @@ void FDWriter::write(event::Task* task, std::size_t* n, const char* ptr,
   process(lock);
 }
 
+void FDWriter::cork() {
+  auto lock = base::acquire_lock(mu_);
+  corked_ = true;
+}
+
+void FDWriter::uncork() {
+  auto lock = base::acquire_lock(mu_);
+  corked_ = false;
+  process(lock);
+}
+
+void FDWriter::flush(event::Task* task, const base::Options& opts) {
+  if (!prologue(task)) return;
+  auto lock = base::acquire_lock(mu_);
+  VLOG(6) << "io::FDWriter::flush";
+  corked_ = false;
+  q_.emplace_back(new FlushOp(task));
+  process(lock);
+}
+
 void FDWriter::sync(event::Task* task, const base::Options& opts) {
   if (!prologue(task)) return;
   auto lock = base::acquire_lock(mu_);
   VLOG(6) << "io::FDWriter::sync";
+  corked_ = false;
   q_.emplace_back(new SyncOp(task));
   process(lock);
 }
@@ -752,6 +804,7 @@ void FDWriter::close(event::Task* task, const base::Options& opts) {
   if (!prologue(task)) return;
   auto lock = base::acquire_lock(mu_);
   VLOG(6) << "io::FDWriter::close";
+  corked_ = false;
   q_.emplace_back(new CloseOp(task));
   process(lock);
 }
@@ -760,6 +813,31 @@ void FDWriter::process(base::Lock& lock) {
   VLOG(4) << "io::FDWriter::process: begin: q.size()=" << q_.size();
 
   while (!q_.empty()) {
+    if (q_.front()->as_write() != nullptr) {
+      // While corked, writes wait in the queue for |uncork()|.
+      if (corked_) break;
+
+      // Several writes in a row go out together in one writev(2).
+      if (q_.size() > 1 && q_[1]->as_write() != nullptr) {
+        Batch batch;
+        while (!q_.empty() && batch.size() < kMaxBatch &&
+               q_.front()->as_write() != nullptr) {
+          batch.push_back(std::move(q_.front()));
+          q_.pop_front();
+        }
+        lock.unlock();
+        auto reacquire = base::cleanup([&lock] { lock.lock(); });
+        write_batch(&batch);
+        reacquire.run();
+        if (batch.empty()) continue;
+        while (!batch.empty()) {
+          q_.push_front(std::move(batch.back()));
+          batch.pop_back();
+        }
+        break;
+      }
+    }
+
     auto op = std::move(q_.front());
     q_.pop_front();
     lock.unlock();
@@ -805,19 +883,107 @@ base::Result FDWriter::arm(event::Handle* evt, const base::FD& fd,
   return r;
 }
 
+// Writes out as much of |*batch| as possible, using one writev(2) call for
+// all of the writes.  Completed writes are removed from the front of
+// |*batch|; if any remain, the first one has been armed for writability.
+void FDWriter::write_batch(Batch* batch) {
+  VLOG(4) << "io::FDWriter::write_batch: begin: "
+          << "batch.size()=" << batch->size();
+
+  const auto& wfd = fd_;
+  std::size_t first = 0;
+  base::Result r;
+  while (first < batch->size()) {
+    auto* op = (*batch)[first]->as_write();
+
+    // Check for cancellation
+    if (!op->task->is_running()) {
+      op->retire(this);
+      op->task->finish_cancel();
+      ++first;
+      continue;
+    }
+
+    // Check for completion
+    if (*op->n >= op->len) {
+      op->retire(this);
+      op->task->finish_ok();
+      ++first;
+      continue;
+    }
+
+    struct iovec iov[kMaxBatch];
+    int count = 0;
+    for (std::size_t i = first; i < batch->size(); ++i) {
+      auto* x = (*batch)[i]->as_write();
+      if (!x->task->is_running()) break;
+      if (*x->n >= x->len) continue;
+      iov[count].iov_base = const_cast<char*>(x->ptr + *x->n);
+      iov[count].iov_len = x->len - *x->n;
+      ++count;
+    }
+
+    auto pair = wfd->acquire_fd();
+    VLOG(6) << "io::FDWriter::write_batch: writev: "
+            << "fd=" << pair.first << ", "
+            << "count=" << count;
+    ssize_t written = ::writev(pair.first, iov, count);
+    int err_no = errno;
+    pair.second.unlock();
+    VLOG(6) << "io::FDWriter::write_batch: result=" << written;
+
+    if (written < 0) {
+      // Interrupted by signal? Retry immediately
+      if (err_no == EINTR) continue;
+
+      // No room for non-blocking write? Reschedule for later
+      if (err_no == EAGAIN || err_no == EWOULDBLOCK) {
+        r = arm(&op->wrevt, wfd, event::Set::writable_bit(), op->options);
+        if (r) break;
+      } else {
+        r = base::Result::from_errno(err_no, "writev(2)");
+      }
+
+      // Writes behind a failed write would fail too.
+      for (std::size_t i = first; i < batch->size(); ++i) {
+        auto* x = (*batch)[i]->as_write();
+        x->retire(this);
+        x->task->finish(r);
+      }
+      first = batch->size();
+      break;
+    }
+
+    // Distribute the bytes written among the writes.
+    std::size_t remaining = written;
+    for (std::size_t i = first; remaining > 0 && i < batch->size(); ++i) {
+      auto* x = (*batch)[i]->as_write();
+      std::size_t len = std::min(remaining, x->len - *x->n);
+      *x->n += len;
+      remaining -= len;
+    }
+  }
+  batch->erase(batch->begin(), batch->begin() + first);
+
+  VLOG(4) << "io::FDWriter::write_batch: end: "
+          << "batch.size()=" << batch->size();
+}
+
+// Disables any event and makes sure someone waits on it.
+void FDWriter::WriteOp::retire(FDWriter* writer) {
+  if (wrevt) {
+    wrevt.disable().expect_ok(__FILE__, __LINE__);
+    auto lock = base::acquire_lock(writer->mu_);
+    writer->purge_.push_back(std::move(wrevt));
+  }
+}
+
 bool FDWriter::WriteOp::process(FDWriter* writer) {
   VLOG(4) << "io::FDWriter::WriteOp: begin: "
           << "*n=" << *n << ", "
           << "len=" << len;
 
-  // Disable any event and make sure someone waits on it.
-  auto cleanup = base::cleanup([this, writer] {
-    if (wrevt) {
-      wrevt.disable().expect_ok(__FILE__, __LINE__);
-      auto lock = base::acquire_lock(writer->mu_);
-      writer->purge_.push_back(std::move(wrevt));
-    }
-  });
+  auto cleanup = base::cleanup([this, writer] { retire(writer); });
 
   // Check for cancellation
   if (!task->is_running()) {
@@ -876,6 +1042,16 @@ bool FDWriter::WriteOp::process(FDWriter* writer) {
   return true;
 }
 
+bool FDWriter::FlushOp::process(FDWriter* writer) {
+  // Every earlier write has completed by the time this op is reached.
+  if (!task->is_running()) {
+    task->finish_cancel();
+    return true;
+  }
+  task->finish_ok();
+  return true;
+}
+
 bool FDWriter::SyncOp::process(FDWriter* writer) {
   VLOG(4) << "io::FDWriter::SyncOp: begin";
 
@@ -951,6 +1127,11 @@ class BufferedWriter : public WriterImpl {
 
   bool is_buffered() const noexcept override { return true; }
 
+  // Buffered data only reaches |w_| when the buffers fill or on flush, so
+  // corking is a matter for |w_|.
+  void cork() override { w_.cork(); }
+  void uncork() override { w_.uncork(); }
+
   void write(event::Task* task, std::size_t* n, const char* ptr,
              std::size_t len, const base::Options& opts) override {
     chain_.write(task, n, ptr, len, opts);
@@ -959,6 +1140,7 @@ class BufferedWriter : public WriterImpl {
   void flush(event::Task* task, const base::Options& opts) override {
     CHECK_NOTNULL(task);
     if (!task->start()) return;
+    w_.uncork();
     auto* h = new DrainHelper(this, task, true, false, false, opts);
     h->next();
   }
@@ -966,6 +1148,7 @@ class BufferedWriter : public WriterImpl {
   void sync(event::Task* task, const base::Options& opts) override {
     CHECK_NOTNULL(task);
     if (!task->start()) return;
+    w_.uncork();
     auto* h = new DrainHelper(this, task, true, true, false, opts);
     h->next();
   }
@@ -987,6 +1170,7 @@ class BufferedWriter : public WriterImpl {
     closed_ = true;
     lock.unlock();
 
+    w_.uncork();
     auto* h = new DrainHelper(this, task, true, true, true, opts);
     h->next();
   }
@@ -86,6 +86,18 @@ class WriterImpl {
   // Returns true if this Writer has buffering.
   virtual bool is_buffered() const noexcept { return false; }
 
+  // OPTIONAL. Enters or leaves "corked" mode.
+  // - While corked, implementations may hold back written data instead of
+  //   passing it on, so that many small writes go out as one large one
+  // - Uncorking sends everything that was held back
+  // - flush, sync, and close all imply uncork
+  // - The default no-op behavior is a valid implementation
+  //
+  // THREAD SAFETY: Implementations of these functions MUST be thread-safe.
+  //
+  virtual void cork() {}
+  virtual void uncork() {}
+
   // Writes |len| bytes out of the buffer at |ptr|.
   // - ALWAYS sets |*n| to the number of bytes successfully written
   //   ~ In the case of an error, |*n| is the number of bytes *known* to have
@@ -231,6 +243,30 @@ class Writer {
     return ptr_->is_buffered();
   }
 
+  // Corks this Writer: until |uncork()| is called, small writes may be held
+  // back and coalesced into fewer, larger writes to the underlying stream.
+  // - See |WriterImpl::cork| for details of the API contract
+  // - Writes issued while corked may not complete until the Writer is
+  //   uncorked, so use the asynchronous write API while corked
+  //
+  // Typical usage, in a callback that emits many small writes:
+  //
+  //    w.cork();
+  //    w.write(&task1, &n1, header, opts);
+  //    w.write(&task2, &n2, body, opts);
+  //    w.uncork();
+  //
+  void cork() const {
+    assert_valid();
+    ptr_->cork();
+  }
+
+  // Uncorks this Writer, sending any data that |cork()| held back.
+  void uncork() const {
+    assert_valid();
+    ptr_->uncork();
+  }
+
   // Standard write {{{
 
   // Writes up to |len| bytes from the buffer at |ptr|.
@@ -415,6 +415,51 @@ TEST(FDWriter, ThreadedWrite) {
   FDWriterTest(std::move(mo));
 }
 
+TEST(FDWriter, Cork) {
+  base::Pipe pipe;
+  ASSERT_OK(base::make_pipe(&pipe));
+
+  base::Options o;
+  event::Manager m = io::get_manager(o);
+  io::Writer w = io::fdwriter(pipe.write);
+
+  // Corked writes wait until the Writer is uncorked.
+  const std::string in[] = {"GET / HTTP/1.1\r\n", "Host: a\r\n", "", "\r\n"};
+  event::Task tasks[4];
+  std::size_t n[4] = {0, 0, 0, 0};
+  w.cork();
+  for (std::size_t i = 0; i < 4; ++i) w.write(&tasks[i], &n[i], in[i], o);
+  for (const auto& task : tasks) EXPECT_FALSE(task.is_finished());
+
+  w.uncork();
+  event::wait_all({m}, {&tasks[0], &tasks[1], &tasks[2], &tasks[3]});
+  std::string expected;
+  for (std::size_t i = 0; i < 4; ++i) {
+    EXPECT_OK(tasks[i].result());
+    EXPECT_EQ(in[i].size(), n[i]);
+    expected += in[i];
+  }
+
+  // Flushing also uncorks.
+  event::Task task;
+  std::size_t x = 0;
+  w.cork();
+  w.write(&task, &x, "body", o);
+  EXPECT_FALSE(task.is_finished());
+  EXPECT_OK(w.flush(o));
+  event::wait(m, &task);
+  EXPECT_OK(task.result());
+  expected += "body";
+
+  std::string out(expected.size(), '\0');
+  auto pair = pipe.read->acquire_fd();
+  EXPECT_EQ(ssize_t(out.size()), ::read(pair.first, &out[0], out.size()));
+  pair.second.unlock();
+  EXPECT_EQ(expected, out);
+
+  base::log_flush();
+}
+
 // }}}
 // BufferedWriter {{{
 
@@ -3,18 +3,24 @@
 
 #include "net/connfd.h"
 
+#include <arpa/inet.h>
+#include <linux/filter.h>
+#include <netinet/in.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
 #include <cerrno>
 #include <cstdint>
 #include <cstring>
 #include <exception>
 #include <mutex>
+#include <vector>
 
-#include "base/cleanup.h"
 #include "base/logging.h"
 #include "base/mutex.h"
+#include "event/callback.h"
 #include "io/reader.h"
 #include "io/writer.h"
 
@@ -61,12 +67,30 @@ class FDConnReader : public io::ReaderImpl {
 
 class FDConnWriter : public io::WriterImpl {
  public:
-  explicit FDConnWriter(base::FD fd) : w_(io::fdwriter(std::move(fd))) {}
+  explicit FDConnWriter(base::FD fd)
+      : w_(io::fdwriter(std::move(fd))), can_cork_(true) {}
 
   std::size_t ideal_block_size() const noexcept override {
     return w_.ideal_block_size();
   }
 
+  // Besides holding writes back in |w_|, corking sets TCP_CORK on TCP
+  // sockets, so that the kernel also waits for full-sized segments.
+  void cork() override {
+    w_.cork();
+    set_tcp_cork(1);
+  }
+
+  void uncork() override {
+    w_.uncork();
+    set_tcp_cork(0);
+  }
+
+  void flush(event::Task* task, const base::Options& opts) override {
+    set_tcp_cork(0);
+    w_.flush(task, opts);
+  }
+
   void write(event::Task* task, std::size_t* n, const char* ptr,
              std::size_t len, const base::Options& opts) override {
     w_.write(task, n, ptr, len, opts);
@@ -77,10 +101,30 @@ class FDConnWriter : public io::WriterImpl {
     w_.read_from(task, n, max, r, opts);
   }
 
+  // Writes queued while corked may still be waiting on EAGAIN, so the
+  // socket is only shut down once they have all gone out.
   void close(event::Task* task, const base::Options& opts) override {
+    struct Helper {
+      event::Task* const task;
+      const base::FD fd;
+      event::Task subtask;
+
+      Helper(event::Task* t, base::FD fd) noexcept
+          : task(t), fd(std::move(fd)) {}
+    };
+
     if (!prologue(task)) return;
-    auto fd = internal_writerfd();
-    task->finish(base::shutdown(fd, SHUT_WR));
+    auto* h = new Helper(task, internal_writerfd());
+    task->add_subtask(&h->subtask);
+    flush(&h->subtask, opts);
+    h->subtask.on_finished(event::callback([h] {
+      base::Result r = h->subtask.result();
+      base::Result sr = base::shutdown(h->fd, SHUT_WR);
+      if (r) r = std::move(sr);
+      h->task->finish(std::move(r));
+      delete h;
+      return base::Result();
+    }));
   }
 
   base::FD internal_writerfd() const override {
@@ -88,7 +132,18 @@ class FDConnWriter : public io::WriterImpl {
   }
 
  private:
+  // Not every socket is a TCP socket; stop trying after the first failure.
+  void set_tcp_cork(int value) {
+    if (!can_cork_.load(std::memory_order_relaxed)) return;
+    auto r = sockopt_tcp_cork.set(internal_writerfd(), &value, sizeof(value));
+    if (!r) {
+      VLOG(4) << "net::FDConnWriter: TCP_CORK unavailable: " << r;
+      can_cork_.store(false, std::memory_order_relaxed);
+    }
+  }
+
   io::Writer w_;
+  std::atomic<bool> can_cork_;
 };
 
 class FDConn : public ConnImpl {
@@ -105,9 +160,22 @@ class FDConn : public ConnImpl {
     VLOG(6) << "net::FDConn::FDConn";
   }
 
+  // Leaves the local address to be looked up by |pr| on first use.
+  FDConn(std::shared_ptr<Protocol> pr, Addr ra, io::Reader r,
+         io::Writer w) noexcept : pr_(std::move(pr)),
+                                  ra_(std::move(ra)),
+                                  r_(std::move(r)),
+                                  w_(std::move(w)) {
+    CHECK(pr_);
+    CHECK(ra_);
+    CHECK(r_);
+    CHECK(w_);
+    VLOG(6) << "net::FDConn::FDConn";
+  }
+
   ~FDConn() noexcept { VLOG(6) << "net::FDConn::~FDConn"; }
 
-  Addr local_addr() const override { return la_; }
+  Addr local_addr() const override;
   Addr remote_addr() const override { return ra_; }
   io::Reader reader() override { return r_; }
   io::Writer writer() override { return w_; }
@@ -136,31 +204,88 @@ class FDConn : public ConnImpl {
     return w_.implementation()->internal_writerfd();
   }
 
-  Addr la_;
-  Addr ra_;
-  io::Reader r_;
-  io::Writer w_;
+  const std::shared_ptr<Protocol> pr_;
+  mutable std::mutex mu_;
+  mutable Addr la_;  // protected by mu_
+  const Addr ra_;
+  const io::Reader r_;
+  const io::Writer w_;
 };
 
+Addr FDConn::local_addr() const {
+  auto lock = base::acquire_lock(mu_);
+  if (la_) return la_;
+
+  sockaddr_storage ss;
+  ::bzero(&ss, sizeof(ss));
+  socklen_t sslen = sizeof(ss);
+  auto fdpair = fd()->acquire_fd();
+  int rc = ::getsockname(fdpair.first, RISA(&ss), &sslen);
+  if (rc != 0) {
+    int err_no = errno;
+    base::Result::from_errno(err_no, "getsockname(2)")
+        .expect_ok(__FILE__, __LINE__);
+    return Addr();
+  }
+  pr_->interpret(&la_, ra_.protocol_type(), RICSA(&ss), sslen)
+      .expect_ok(__FILE__, __LINE__);
+  return la_;
+}
+
+// Returns true iff every connection accepted on a listen socket bound to
+// |aa| has |aa| as its local address, i.e. |aa| is not a wildcard.
+static bool is_fixed_local_addr(const Addr& aa) {
+  auto raw = aa.raw();
+  if (raw.second < sizeof(sa_family_t)) return false;
+  const auto* sa = RICSA(raw.first);
+  switch (sa->sa_family) {
+    case AF_INET: {
+      const auto* sin = reinterpret_cast<const sockaddr_in*>(sa);
+      return sin->sin_addr.s_addr != htonl(INADDR_ANY);
+    }
+
+    case AF_INET6: {
+      const auto* sin6 = reinterpret_cast<const sockaddr_in6*>(sa);
+      return !IN6_IS_ADDR_UNSPECIFIED(&sin6->sin6_addr);
+    }
+
+    case AF_UNIX:
+      return true;
+
+    default:
+      return false;
+  }
+}
+
 class FDListenConn : public ListenConnImpl {
  public:
   FDListenConn(event::Manager m, std::shared_ptr<Protocol> pr, Addr aa,
-               base::FD fd, AcceptFn fn) noexcept : m_(std::move(m)),
-                                                    pr_(std::move(pr)),
-                                                    aa_(std::move(aa)),
-                                                    fd_(std::move(fd)),
-                                                    fn_(std::move(fn)),
-                                                    accepting_(false) {
-    auto pair = fd_->acquire_fd();
-    VLOG(6) << "net::FDListenConn::FDListenConn: fd=" << pair.first << ", "
-            << "bind=" << aa_;
+               std::vector<base::FD> fds, AcceptFn fn) noexcept
+      : m_(std::move(m)),
+        pr_(std::move(pr)),
+        aa_(std::move(aa)),
+        fn_(std::move(fn)),
+        fixed_la_(is_fixed_local_addr(aa_)),
+        accepting_(false) {
+    for (auto& fd : fds) {
+      auto pair = fd->acquire_fd();
+      VLOG(6) << "net::FDListenConn::FDListenConn: fd=" << pair.first << ", "
+              << "bind=" << aa_;
+      shards_.emplace_back(new Shard(std::move(fd)));
+    }
   }
 
   ~FDListenConn() noexcept { VLOG(6) << "net::FDListenConn::~FDListenConn"; }
 
   base::Result initialize() {
-    auto closure = [this](event::Data data) { return handle(data); };
-    return m_.fd(&evt_, fd_, event::Set::no_bits(), event::handler(closure));
+    for (const auto& shard : shards_) {
+      Shard* s = shard.get();
+      auto closure = [this, s](event::Data data) { return handle(s, data); };
+      base::Result r = m_.fd(&s->evt, s->fd, event::Set::no_bits(),
+                             event::handler(closure));
+      if (!r) return r;
+    }
+    return base::Result();
   }
 
   Addr listen_addr() const override { return aa_; }
@@ -174,124 +299,157 @@ class FDListenConn : public ListenConnImpl {
                   unsigned int optlen, const base::Options& opts) override;
 
  private:
-  base::Result handle(event::Data) const;
+  // One listen socket.  With SO_REUSEPORT there are several, each of which
+  // is accepted from independently of the others.
+  struct Shard {
+    const base::FD fd;
+    mutable std::mutex mu;
+    event::Handle evt;
+
+    explicit Shard(base::FD fd) noexcept : fd(std::move(fd)) {}
+  };
+
+  // The most connections accepted before handing them to |fn_|.
+  static constexpr std::size_t kAcceptBatchSize = 32;
+
+  base::Result handle(const Shard* shard, event::Data) const;
 
   const event::Manager m_;
   const std::shared_ptr<Protocol> pr_;
   const Addr aa_;
-  const base::FD fd_;
   const AcceptFn fn_;
-  mutable std::mutex mu_;
-  event::Handle evt_;
-  bool accepting_;
+  const bool fixed_la_;
+  std::vector<std::unique_ptr<Shard>> shards_;
+  std::atomic<bool> accepting_;
 };
 
 void FDListenConn::start(event::Task* task, const base::Options& opts) {
   VLOG(6) << "net::FDListenConn::start";
-  auto lock = base::acquire_lock(mu_);
-  accepting_ = true;
-  base::Result r = evt_.modify(event::Set::readable_bit());
-  lock.unlock();
-  handle(event::Data()).ignore_ok();
+  accepting_.store(true);
+  base::Result r;
+  for (const auto& shard : shards_) {
+    auto lock = base::acquire_lock(shard->mu);
+    r = r.and_then(shard->evt.modify(event::Set::readable_bit()));
+  }
+  for (const auto& shard : shards_) {
+    handle(shard.get(), event::Data()).ignore_ok();
+  }
   if (task->start()) task->finish(std::move(r));
 }
 
 void FDListenConn::stop(event::Task* task, const base::Options& opts) {
   VLOG(6) << "net::FDListenConn::stop";
-  auto lock = base::acquire_lock(mu_);
-  accepting_ = false;
-  base::Result r = evt_.modify(event::Set::no_bits());
-  lock.unlock();
+  accepting_.store(false);
+  base::Result r;
+  for (const auto& shard : shards_) {
+    auto lock = base::acquire_lock(shard->mu);
+    r = r.and_then(shard->evt.modify(event::Set::no_bits()));
+  }
   if (task->start()) task->finish(std::move(r));
 }
 
 void FDListenConn::close(event::Task* task, const base::Options& opts) {
   VLOG(6) << "net::FDListenConn::close";
-  auto lock = base::acquire_lock(mu_);
-  accepting_ = false;
-  base::Result r0 = evt_.disable();
-  base::Result r1 = fd_->close();
-  lock.unlock();
-  if (task->start()) task->finish(r0.and_then(r1));
+  accepting_.store(false);
+  base::Result r;
+  for (const auto& shard : shards_) {
+    auto lock = base::acquire_lock(shard->mu);
+    base::Result r0 = shard->evt.disable();
+    base::Result r1 = shard->fd->close();
+    r = r.and_then(r0).and_then(r1);
+  }
+  if (task->start()) task->finish(std::move(r));
 }
 
 void FDListenConn::get_option(event::Task* task, SockOpt opt, void* optval,
                               unsigned int* optlen,
                               const base::Options& opts) const {
   if (!task->start()) return;
-  task->finish(opt.get(fd_, optval, optlen));
+  task->finish(opt.get(shards_.front()->fd, optval, optlen));
 }
 
 void FDListenConn::set_option(event::Task* task, SockOpt opt,
                               const void* optval, unsigned int optlen,
                               const base::Options& opts) {
   if (!task->start()) return;
-  task->finish(opt.set(fd_, optval, optlen));
+  base::Result r;
+  for (const auto& shard : shards_) {
+    r = r.and_then(opt.set(shard->fd, optval, optlen));
+  }
+  task->finish(std::move(r));
 }
 
-base::Result FDListenConn::handle(event::Data data) const {
+constexpr std::size_t FDListenConn::kAcceptBatchSize;
+
+base::Result FDListenConn::handle(const Shard* shard, event::Data data) const {
   VLOG(4) << "net::FDListenConn: woke, set=" << data.events;
   struct sockaddr_storage ss;
   socklen_t sslen;
   const int flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
-
-  auto lock = base::acquire_lock(mu_);
-  while (accepting_) {
-    auto pair = fd_->acquire_fd();
-    ::bzero(&ss, sizeof(ss));
-    sslen = sizeof(ss);
-    int fdnum = ::accept4(pair.first, RISA(&ss), &sslen, flags);
-    if (fdnum == -1) {
-      int err_no = errno;
-      if (err_no == EINTR) continue;
-      if (err_no == EAGAIN || err_no == EWOULDBLOCK) break;
-      base::Result::from_errno(err_no, "accept4(2)")
-          .expect_ok(__FILE__, __LINE__);
-      break;
-    }
-    base::FD fd = base::wrapfd(fdnum);
-
-    ProtocolType p = aa_.protocol_type();
-
-    Addr ra;
-    base::Result r = pr_->interpret(&ra, p, RICSA(&ss), sslen);
-    r.expect_ok(__FILE__, __LINE__);
-    if (!r) continue;
-
-    ::bzero(&ss, sizeof(ss));
-    sslen = sizeof(ss);
-    int rc = ::getsockname(fdnum, RISA(&ss), &sslen);
-    if (rc != 0) {
-      int err_no = errno;
-      base::Result::from_errno(err_no, "getsockname(2)")
-          .expect_ok(__FILE__, __LINE__);
-      continue;
+  const ProtocolType p = aa_.protocol_type();
+  auto d = m_.dispatcher();
+
+  // Accept connections in batches under |shard->mu|, then hand each batch
+  // out to the Dispatcher with the lock released, so that an accept storm
+  // is neither serialized on |fn_| nor on a single thread.
+  std::vector<Conn> batch;
+  batch.reserve(kAcceptBatchSize);
+  bool more = true;
+  while (more) {
+    auto lock = base::acquire_lock(shard->mu);
+    while (batch.size() < kAcceptBatchSize) {
+      if (!accepting_.load()) {
+        more = false;
+        break;
+      }
+      auto pair = shard->fd->acquire_fd();
+      ::bzero(&ss, sizeof(ss));
+      sslen = sizeof(ss);
+      int fdnum = ::accept4(pair.first, RISA(&ss), &sslen, flags);
+      if (fdnum == -1) {
+        int err_no = errno;
+        if (err_no == EINTR) continue;
+        more = false;
+        if (err_no == EAGAIN || err_no == EWOULDBLOCK) break;
+        base::Result::from_errno(err_no, "accept4(2)")
+            .expect_ok(__FILE__, __LINE__);
+        break;
+      }
+      base::FD fd = base::wrapfd(fdnum);
+
+      Addr ra;
+      base::Result r = pr_->interpret(&ra, p, RICSA(&ss), sslen);
+      r.expect_ok(__FILE__, __LINE__);
+      if (!r) continue;
+
+      VLOG(6) << "net::FDListenConn: accept, "
+              << "fdnum=" << fdnum << ", "
+              << "peer=" << ra;
+
+      Conn conn;
+      if (fixed_la_)
+        r = fdconn(&conn, aa_, std::move(ra), std::move(fd));
+      else
+        r = fdconn(&conn, pr_, std::move(ra), std::move(fd));
+      r.expect_ok(__FILE__, __LINE__);
+      if (!r) continue;
+      batch.push_back(std::move(conn));
     }
-
-    Addr la;
-    r = pr_->interpret(&la, p, RICSA(&ss), sslen);
-    r.expect_ok(__FILE__, __LINE__);
-    if (!r) continue;
-
-    VLOG(6) << "net::FDListenConn: accept, "
-            << "fdnum=" << fdnum << ", "
-            << "self=" << la << ", "
-            << "peer=" << ra;
-
-    Conn conn;
-    r = fdconn(&conn, std::move(la), std::move(ra), std::move(fd));
-    r.expect_ok(__FILE__, __LINE__);
-    if (!r) continue;
-
-    pair.second.unlock();
     lock.unlock();
-    auto reacquire = base::cleanup([&lock] { lock.lock(); });
 
-    try {
-      fn_(std::move(conn));
-    } catch (...) {
-      LOG_EXCEPTION(std::current_exception());
+    for (auto& conn : batch) {
+      auto fn = fn_;
+      auto closure = [fn, conn] {
+        try {
+          fn(conn);
+        } catch (...) {
+          LOG_EXCEPTION(std::current_exception());
+        }
+        return base::Result();
+      };
+      d->dispatch(event::callback(closure));
     }
+    batch.clear();
   }
   return base::Result();
 }
@@ -381,40 +539,50 @@ struct DialHelper {
     task->finish(std::move(r));
     return base::Result();
   }
+
+  // Abandons an in-progress connect(2); the socket is closed once the
+  // last reference to this helper goes away.
+  base::Result cancel() {
+    auto lock = base::acquire_lock(mu);
+    if (seen) return base::Result();
+    seen = true;
+    evt.disable().expect_ok(__FILE__, __LINE__);
+    evt.disown();
+    lock.unlock();
+    task->finish_cancel();
+    return base::Result();
+  }
 };
 }  // anonymous namespace
 
-void FDProtocol::listen(event::Task* task, ListenConn* out, const Addr& bind,
-                        const base::Options& opts, AcceptFn fn) {
-  CHECK(task);
-  CHECK(out);
-  CHECK(bind);
-  CHECK(fn);
-  std::string protocol = bind.protocol();
-  CHECK(supports(protocol));
-  if (!task->start()) return;
-
-  ProtocolType p = bind.protocol_type();
+// Creates one listen socket, binds it to |bind|, and starts listening.
+static base::Result make_listen_socket(base::FD* out, const Addr& bind,
+                                       std::tuple<int, int, int> triple,
+                                       const Options& no, bool reuseport) {
   int domain, type, protonum;
-  std::tie(domain, type, protonum) = socket_triple(protocol);
+  std::tie(domain, type, protonum) = triple;
   int fdnum = ::socket(domain, type | SOCK_NONBLOCK | SOCK_CLOEXEC, protonum);
   if (fdnum == -1) {
     int err_no = errno;
-    task->finish(base::Result::from_errno(err_no, "socket(2)"));
-    return;
+    return base::Result::from_errno(err_no, "socket(2)");
   }
   base::FD fd = base::wrapfd(fdnum);
 
-  const auto ra = opts.get<net::Options>().reuseaddr;
-  if (ra) {
+  if (no.reuseaddr) {
     int x = 1;
     base::Result r = sockopt_reuseaddr.set(fd, &x, sizeof(x));
     r.expect_ok(__FILE__, __LINE__);
   }
 
+  if (reuseport) {
+    int x = 1;
+    base::Result r = sockopt_reuseport.set(fd, &x, sizeof(x));
+    if (!r) return r;
+  }
+
   bool apply = false;
   int value;
-  const auto dl = opts.get<net::Options>().duallisten;
+  const auto dl = no.duallisten;
   switch (dl) {
     case DualListen::system_default:
       break;
@@ -442,13 +610,62 @@ void FDProtocol::listen(event::Task* task, ListenConn* out, const Addr& bind,
   int rc = ::bind(fdnum, RICSA(raw.first), raw.second);
   if (rc != 0) {
     int err_no = errno;
-    task->finish(base::Result::from_errno(err_no, "bind(2)"));
+    return base::Result::from_errno(err_no, "bind(2)");
+  }
+
+  int backlog = no.listen_backlog;
+  if (backlog <= 0) backlog = SOMAXCONN;
+  rc = ::listen(fdnum, backlog);
+  if (rc != 0) {
+    int err_no = errno;
+    return base::Result::from_errno(err_no, "listen(2)");
+  }
+
+  *out = std::move(fd);
+  return base::Result();
+}
+
+// Attaches a classic BPF program to a SO_REUSEPORT group, which picks the
+// listen socket whose index matches the CPU that received the connection.
+static base::Result steer_by_cpu(const base::FD& fd, std::size_t n) {
+  struct sock_filter code[] = {
+      {BPF_LD | BPF_W | BPF_ABS, 0, 0, uint32_t(SKF_AD_OFF + SKF_AD_CPU)},
+      {BPF_ALU | BPF_MOD | BPF_K, 0, 0, uint32_t(n)},
+      {BPF_RET | BPF_A, 0, 0, 0},
+  };
+  struct sock_fprog prog;
+  prog.len = sizeof(code) / sizeof(code[0]);
+  prog.filter = code;
+  return sockopt_attach_reuseport_cbpf.set(fd, &prog, sizeof(prog));
+}
+
+void FDProtocol::listen(event::Task* task, ListenConn* out, const Addr& bind,
+                        const base::Options& opts, AcceptFn fn) {
+  CHECK(task);
+  CHECK(out);
+  CHECK(bind);
+  CHECK(fn);
+  std::string protocol = bind.protocol();
+  CHECK(supports(protocol));
+  if (!task->start()) return;
+
+  ProtocolType p = bind.protocol_type();
+  auto triple = socket_triple(protocol);
+  const auto& no = opts.get<net::Options>();
+  const std::size_t n = std::max(no.listen_shards, std::size_t(1));
+
+  std::vector<base::FD> fds;
+  base::FD fd;
+  base::Result r = make_listen_socket(&fd, bind, triple, no, n > 1);
+  if (!r) {
+    task->finish(std::move(r));
     return;
   }
+  fds.push_back(fd);
 
   sockaddr_storage ss;
   socklen_t sslen = sizeof(ss);
-  rc = ::getsockname(fdnum, RISA(&ss), &sslen);
+  int rc = ::getsockname(fd->acquire_fd().first, RISA(&ss), &sslen);
   if (rc != 0) {
     int err_no = errno;
     task->finish(base::Result::from_errno(err_no, "getsockname(2)"));
@@ -457,20 +674,28 @@ void FDProtocol::listen(event::Task* task, ListenConn* out, const Addr& bind,
   CHECK_GE(sslen, 0U);
 
   Addr bound;
-  base::Result r = interpret(&bound, p, RICSA(&ss), sslen);
+  r = interpret(&bound, p, RICSA(&ss), sslen);
   if (!r) {
     task->finish(std::move(r));
     return;
   }
 
-  rc = ::listen(fdnum, 1000);
-  if (rc != 0) {
-    int err_no = errno;
-    task->finish(base::Result::from_errno(err_no, "listen(2)"));
-    return;
+  // The remaining shards bind to |bound|, not |bind|, so that they join the
+  // first shard's port even if |bind| asked for an ephemeral one.
+  while (fds.size() < n) {
+    r = make_listen_socket(&fd, bound, triple, no, true);
+    if (!r) {
+      task->finish(std::move(r));
+      return;
+    }
+    fds.push_back(fd);
+  }
+
+  if (n > 1 && no.listen_cpu_steering) {
+    steer_by_cpu(fds.front(), n).expect_ok(__FILE__, __LINE__);
   }
 
-  r = fdlistenconn(out, self(), std::move(bound), std::move(fd), opts,
+  r = fdlistenconn(out, self(), std::move(bound), std::move(fds), opts,
                    std::move(fn));
   task->finish(std::move(r));
 }
@@ -522,7 +747,10 @@ redo:
   if (err_no == EINPROGRESS) {
     event::Manager m = io::get_manager(opts);
     r = m.fd(&h->evt, fd, event::Set::writable_bit(), event::handler(closure));
-    if (r) return;
+    if (r) {
+      task->on_cancelled(event::callback([h] { return h->cancel(); }));
+      return;
+    }
   } else {
     r = base::Result::from_errno(err_no, "connect(2)");
   }
@@ -554,17 +782,43 @@ base::Result fdconn(Conn* out, Addr la, Addr ra, base::FD fd) {
   return base::Result();
 }
 
+base::Result fdconn(Conn* out, std::shared_ptr<Protocol> pr, Addr ra,
+                    base::FD fd) {
+  CHECK(out);
+  CHECK(pr);
+  CHECK(ra);
+  CHECK(fd);
+
+  io::Reader r = fdconnreader(fd);
+  io::Writer w = fdconnwriter(std::move(fd));
+  auto impl = std::make_shared<FDConn>(std::move(pr), std::move(ra),
+                                       std::move(r), std::move(w));
+  *out = Conn(std::move(impl));
+  return base::Result();
+}
+
 base::Result fdlistenconn(ListenConn* out, std::shared_ptr<Protocol> pr,
                           Addr aa, base::FD fd, const base::Options& opts,
                           AcceptFn fn) {
+  CHECK(fd);
+  std::vector<base::FD> fds;
+  fds.push_back(std::move(fd));
+  return fdlistenconn(out, std::move(pr), std::move(aa), std::move(fds), opts,
+                      std::move(fn));
+}
+
+base::Result fdlistenconn(ListenConn* out, std::shared_ptr<Protocol> pr,
+                          Addr aa, std::vector<base::FD> fds,
+                          const base::Options& opts, AcceptFn fn) {
   CHECK(out);
   CHECK(pr);
   CHECK(aa);
-  CHECK(fd);
+  CHECK(!fds.empty());
+  for (const auto& fd : fds) CHECK(fd);
   CHECK(fn);
   auto ptr = std::make_shared<FDListenConn>(io::get_manager(opts),
                                             std::move(pr), std::move(aa),
-                                            std::move(fd), std::move(fn));
+                                            std::move(fds), std::move(fn));
   auto r = ptr->initialize();
   if (r) {
     *out = ListenConn(std::move(ptr));
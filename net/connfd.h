@@ -6,6 +6,7 @@
 #define NET_CONNFD_H
 
 #include <tuple>
+#include <vector>
 
 #include "base/fd.h"
 #include "io/reader.h"
@@ -48,13 +49,30 @@ io::Writer fdconnwriter(base::FD fd);
 // Returns a net::Conn with the specified properties.
 base::Result fdconn(Conn* out, Addr la, Addr ra, base::FD fd);
 
+// As above, but the local address is looked up with getsockname(2) and
+// |pr->interpret()| the first time it is asked for, rather than up front.
+base::Result fdconn(Conn* out, std::shared_ptr<Protocol> pr, Addr ra,
+                    base::FD fd);
+
 // Returns a net::ListenConn with the specified properties.
 // - |p| must be capable of |interpret()|-ing the results of the getsockname(2)
 //   and getpeername(2) functions
+// - Accepted connections are handed to |fn| on the io::Options
+//   event::Manager's Dispatcher, possibly several at once
+// - If |aa| isn't a wildcard address, it is used as the local address of
+//   every accepted connection; otherwise that is looked up lazily
 base::Result fdlistenconn(ListenConn* out, std::shared_ptr<Protocol> pr,
                           Addr aa, base::FD fd, const base::Options& opts,
                           AcceptFn fn);
 
+// As above, but accepts from several listen sockets bound to the same
+// address, e.g. with SO_REUSEPORT.  Each socket is accepted from
+// independently, so connections on different sockets can be accepted in
+// parallel.
+base::Result fdlistenconn(ListenConn* out, std::shared_ptr<Protocol> pr,
+                          Addr aa, std::vector<base::FD> fds,
+                          const base::Options& opts, AcceptFn fn);
+
 }  // namespace net
 
 #endif  // NET_CONNFD_H
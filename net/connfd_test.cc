@@ -0,0 +1,52 @@
+// Copyright © 2017 by Donald King <chronos@chronos-tachyon.net>
+// Available under the MIT License. See LICENSE for details.
+
+#include "gtest/gtest.h"
+
+#include <sys/socket.h>
+
+#include <string>
+
+#include "base/fd.h"
+#include "base/result_testing.h"
+#include "event/manager.h"
+#include "event/task.h"
+#include "io/options.h"
+#include "net/connfd.h"
+#include "net/unix.h"
+
+TEST(FDConn, CloseFlushesCorkedWrites) {
+  base::SocketPair s;
+  ASSERT_OK(base::make_socketpair(&s, AF_UNIX, SOCK_STREAM, 0));
+
+  auto addr = net::unixaddr(net::ProtocolType::stream, "");
+  net::Conn a, b;
+  ASSERT_OK(net::fdconn(&a, addr, addr, s.left));
+  ASSERT_OK(net::fdconn(&b, addr, addr, s.right));
+
+  // Far more than the socket buffer holds, so the write backs up on EAGAIN.
+  std::string big;
+  for (std::size_t i = 0; i < (4U << 20); ++i) {
+    big.push_back(char('a' + i % 26));
+  }
+
+  auto o = base::default_options();
+  auto m = io::get_manager(o);
+  std::size_t n = 0;
+  event::Task wt, ct, rt;
+  std::string got;
+  a.writer().cork();
+  a.writer().write(&wt, &n, big, o);
+  a.writer().close(&ct, o);
+  b.reader().read(&rt, &got, big.size() + 1, big.size() + 1, o);
+  event::wait_all({m}, {&wt, &ct, &rt});
+
+  EXPECT_OK(wt.result());
+  EXPECT_OK(ct.result());
+  EXPECT_EOF(rt.result());
+  EXPECT_EQ(big.size(), n);
+  EXPECT_EQ(big, got);
+
+  EXPECT_OK(a.close());
+  EXPECT_OK(b.close());
+}
@@ -0,0 +1,928 @@
+// Copyright © 2017 by Donald King <chronos@chronos-tachyon.net>
+// Available under the MIT License. See LICENSE for details.
+
+#include "net/dns.h"
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <random>
+
+#include "base/fd.h"
+#include "base/logging.h"
+#include "base/mutex.h"
+#include "event/callback.h"
+#include "event/handler.h"
+#include "event/manager.h"
+#include "io/options.h"
+#include "net/conn.h"
+#include "net/inet.h"
+#include "net/net.h"
+
+using base::time::Duration;
+using P = net::ProtocolType;
+
+namespace net {
+
+constexpr uint16_t DNSMessage::kFlagQR;
+constexpr uint16_t DNSMessage::kFlagAA;
+constexpr uint16_t DNSMessage::kFlagTC;
+constexpr uint16_t DNSMessage::kFlagRD;
+constexpr uint16_t DNSMessage::kFlagRA;
+
+namespace {
+
+static constexpr std::size_t kMaxNameLen = 255;
+static constexpr std::size_t kMaxLabelLen = 63;
+
+// The UDP payload size advertised with EDNS(0), per the DNS Flag Day 2020
+// recommendation.  Larger answers come back truncated and are asked again
+// over TCP.
+static constexpr uint16_t kEDNSPayloadSize = 1232;
+
+static inline const sockaddr* RICSA(const void* ptr) {
+  return reinterpret_cast<const sockaddr*>(ptr);
+}
+
+static void put16(std::string* out, uint16_t x) {
+  out->push_back(char(x >> 8));
+  out->push_back(char(x));
+}
+
+static void put32(std::string* out, uint32_t x) {
+  put16(out, x >> 16);
+  put16(out, x);
+}
+
+static base::Result put_name(std::string* out, const std::string& name) {
+  if (name.size() > kMaxNameLen)
+    return base::Result::invalid_argument("DNS name too long: ", name);
+  std::size_t pos = 0;
+  while (pos < name.size()) {
+    auto dot = name.find('.', pos);
+    if (dot == std::string::npos) dot = name.size();
+    std::size_t len = dot - pos;
+    if (len == 0 || len > kMaxLabelLen)
+      return base::Result::invalid_argument("bad DNS label in name: ", name);
+    out->push_back(char(len));
+    out->append(name, pos, len);
+    pos = dot + 1;
+  }
+  out->push_back('\0');
+  return base::Result();
+}
+
+static char to_lower(char ch) noexcept {
+  return (ch >= 'A' && ch <= 'Z') ? (ch - 'A' + 'a') : ch;
+}
+
+static bool same_name(const std::string& a, const std::string& b) noexcept {
+  if (a.size() != b.size()) return false;
+  for (std::size_t i = 0; i < a.size(); ++i) {
+    if (to_lower(a[i]) != to_lower(b[i])) return false;
+  }
+  return true;
+}
+
+// Reads a DNS message, expanding compressed names.
+class WireReader {
+ public:
+  WireReader(const char* ptr, std::size_t len) noexcept
+      : ptr_(reinterpret_cast<const uint8_t*>(ptr)),
+        len_(len),
+        pos_(0) {}
+
+  std::size_t pos() const noexcept { return pos_; }
+
+  bool u16(uint16_t* out) noexcept {
+    if (len_ - pos_ < 2) return false;
+    *out = (uint16_t(ptr_[pos_]) << 8) | uint16_t(ptr_[pos_ + 1]);
+    pos_ += 2;
+    return true;
+  }
+
+  bool u32(uint32_t* out) noexcept {
+    uint16_t hi, lo;
+    if (!u16(&hi) || !u16(&lo)) return false;
+    *out = (uint32_t(hi) << 16) | uint32_t(lo);
+    return true;
+  }
+
+  bool bytes(std::string* out, std::size_t n) {
+    if (len_ - pos_ < n) return false;
+    out->assign(reinterpret_cast<const char*>(ptr_ + pos_), n);
+    pos_ += n;
+    return true;
+  }
+
+  bool name(std::string* out) {
+    out->clear();
+    std::size_t pos = pos_;
+    bool jumped = false;
+    // Each pointer must lead strictly backward, so this bounds the loop.
+    std::size_t limit = pos_;
+    while (true) {
+      if (pos >= len_) return false;
+      uint8_t len = ptr_[pos];
+      if ((len & 0xc0) == 0xc0) {
+        if (pos + 1 >= len_) return false;
+        std::size_t target = (std::size_t(len & 0x3f) << 8) | ptr_[pos + 1];
+        if (target >= limit) return false;
+        if (!jumped) pos_ = pos + 2;
+        jumped = true;
+        limit = target;
+        pos = target;
+        continue;
+      }
+      if ((len & 0xc0) != 0) return false;
+      ++pos;
+      if (len == 0) break;
+      if (len_ - pos < len) return false;
+      if (!out->empty()) out->push_back('.');
+      out->append(reinterpret_cast<const char*>(ptr_ + pos), len);
+      if (out->size() > kMaxNameLen) return false;
+      pos += len;
+    }
+    if (!jumped) pos_ = pos;
+    return true;
+  }
+
+ private:
+  const uint8_t* const ptr_;
+  const std::size_t len_;
+  std::size_t pos_;
+};
+
+static bool read_record(WireReader* r, DNSRecord* out) {
+  uint16_t rdlen;
+  if (!r->name(&out->name) || !r->u16(&out->type) || !r->u16(&out->klass) ||
+      !r->u32(&out->ttl) || !r->u16(&rdlen))
+    return false;
+  std::size_t end = r->pos() + rdlen;
+  if (out->type == static_cast<uint16_t>(DNSType::cname)) {
+    if (!r->name(&out->data)) return false;
+    return r->pos() == end;
+  }
+  return r->bytes(&out->data, rdlen);
+}
+
+static base::Result write_record(std::string* out, const DNSRecord& rec) {
+  auto r = put_name(out, rec.name);
+  if (!r) return r;
+  put16(out, rec.type);
+  put16(out, rec.klass);
+  put32(out, rec.ttl);
+  std::string rdata;
+  if (rec.type == static_cast<uint16_t>(DNSType::cname)) {
+    r = put_name(&rdata, rec.data);
+    if (!r) return r;
+  } else {
+    rdata = rec.data;
+  }
+  if (rdata.size() > 0xffff)
+    return base::Result::invalid_argument("DNS record data too long");
+  put16(out, rdata.size());
+  out->append(rdata);
+  return base::Result();
+}
+
+static uint16_t random_id() {
+  static std::mutex mu;
+  static std::mt19937* rng = nullptr;
+  auto lock = base::acquire_lock(mu);
+  if (rng == nullptr) rng = new std::mt19937(std::random_device()());
+  return uint16_t((*rng)());
+}
+
+// Returns the names to try for |name|, in order, per resolv.conf(5).
+static std::vector<std::string> candidates(const DNSConfig& config,
+                                           std::string name) {
+  std::vector<std::string> out;
+  if (!name.empty() && name.back() == '.') {
+    name.pop_back();
+    out.push_back(std::move(name));
+    return out;
+  }
+  unsigned int dots = 0;
+  for (char ch : name) {
+    if (ch == '.') ++dots;
+  }
+  if (dots >= config.ndots) out.push_back(name);
+  for (const auto& domain : config.search) {
+    out.push_back(name + "." + domain);
+  }
+  if (dots < config.ndots) out.push_back(name);
+  return out;
+}
+
+static bool parse_uint(unsigned int* out, const std::string& str) {
+  if (str.empty() || str.size() > 4) return false;
+  unsigned int x = 0;
+  for (char ch : str) {
+    if (ch < '0' || ch > '9') return false;
+    x = x * 10 + (ch - '0');
+  }
+  *out = x;
+  return true;
+}
+
+static void split_fields(std::vector<std::string>* out,
+                         const std::string& line) {
+  out->clear();
+  auto is_space = [](char ch) {
+    return ch == ' ' || ch == '\t' || ch == '\r' || ch == '\v' || ch == '\f';
+  };
+  auto it = line.begin(), end = line.end();
+  while (it != end) {
+    while (it != end && is_space(*it)) ++it;
+    if (it == end || *it == '#' || *it == ';') break;
+    auto begin = it;
+    while (it != end && !is_space(*it)) ++it;
+    out->emplace_back(begin, it);
+  }
+}
+
+struct Query {
+  DNSType type;
+  uint16_t id;
+  std::string wire;
+  std::vector<IP> ips;
+  uint32_t ttl;
+  bool done;
+  bool tcp;  // waiting on a TCPExchange
+
+  Query(DNSType t, uint16_t id) noexcept : type(t),
+                                           id(id),
+                                           ttl(0),
+                                           done(false),
+                                           tcp(false) {}
+};
+
+class Lookup;
+
+// TCPExchange asks a single query again over TCP, after a UDP answer came
+// back truncated.
+class TCPExchange {
+ public:
+  TCPExchange(std::weak_ptr<Lookup> lookup, unsigned int gen,
+              std::size_t index, const std::string& wire,
+              base::Options opts)
+      : lookup_(std::move(lookup)),
+        gen_(gen),
+        index_(index),
+        options_(std::move(opts)),
+        n_(0) {
+    put16(&request_, wire.size());
+    request_.append(wire);
+  }
+
+  void start(std::shared_ptr<TCPExchange> self, const Addr& peer) {
+    if (!parent_.start()) return;
+    keep_ = std::move(self);
+    parent_.add_subtask(&dial_);
+    net::dial(&dial_, &conn_, peer, Addr(), options_);
+    dial_.on_finished(event::callback([this] { return dialed(); }));
+  }
+
+  void cancel() { parent_.cancel(); }
+
+ private:
+  base::Result dialed() {
+    if (!dial_.result()) return done(dial_.result());
+    parent_.add_subtask(&write_);
+    conn_.writer().write(&write_, &n_, request_, options_);
+    write_.on_finished(event::callback([this] { return written(); }));
+    return base::Result();
+  }
+
+  base::Result written() {
+    if (!write_.result()) return done(write_.result());
+    parent_.add_subtask(&header_);
+    conn_.reader().read(&header_, &response_, 2, 2, options_);
+    header_.on_finished(event::callback([this] { return got_header(); }));
+    return base::Result();
+  }
+
+  base::Result got_header() {
+    if (!header_.result()) return done(header_.result());
+    if (response_.size() != 2) return done(base::Result::eof());
+    std::size_t len = (uint8_t(response_[0]) << 8) | uint8_t(response_[1]);
+    response_.clear();
+    parent_.add_subtask(&body_);
+    conn_.reader().read(&body_, &response_, len, len, options_);
+    body_.on_finished(event::callback([this] { return done(body_.result()); }));
+    return base::Result();
+  }
+
+  base::Result done(base::Result r);
+
+  const std::weak_ptr<Lookup> lookup_;
+  const unsigned int gen_;
+  const std::size_t index_;
+  const base::Options options_;
+  std::string request_;
+  std::string response_;
+  std::size_t n_;
+  Conn conn_;
+  event::Task parent_;
+  event::Task dial_;
+  event::Task write_;
+  event::Task header_;
+  event::Task body_;
+  std::shared_ptr<TCPExchange> keep_;
+};
+
+using TCPExchangePtr = std::shared_ptr<TCPExchange>;
+
+// Lookup is one call to |DNSClient::lookup()|.
+//
+// Each "try" sends the unanswered queries to one server over a fresh UDP
+// socket and arms a timer; when the timer fires, the next try goes to the
+// next server.  Events from earlier tries are recognized by |gen_| and
+// ignored.  Anything that must not run under |mu_|, i.e. starting or
+// cancelling TCPExchanges and finishing the Task, is deferred to |flush()|.
+class Lookup : public std::enable_shared_from_this<Lookup> {
+ public:
+  Lookup(std::shared_ptr<const DNSConfig> config, unsigned int first,
+         event::Manager m, event::Task* task, std::vector<IP>* out,
+         Duration* ttl, int family, base::Options opts) noexcept
+      : config_(std::move(config)),
+        first_(first),
+        manager_(std::move(m)),
+        task_(task),
+        out_(out),
+        ttl_out_(ttl),
+        family_(family),
+        options_(std::move(opts)),
+        name_index_(0),
+        try_(0),
+        gen_(0),
+        finished_(false),
+        flushed_(false) {}
+
+  void start(const std::string& name);
+  void on_readable(unsigned int gen);
+  void on_timeout(unsigned int gen);
+  void on_tcp(TCPExchange* x, unsigned int gen, std::size_t index,
+              base::Result r, const std::string& response);
+  void cancel();
+
+ private:
+  void next_name(base::Lock& lock);
+  void send_try(base::Lock& lock);
+  base::Result open_try(base::Lock& lock, const Addr& server);
+  void stop_try(base::Lock& lock);
+  void handle_message(base::Lock& lock, const DNSMessage& msg, bool via_tcp,
+                      std::size_t tcp_index);
+  void collect(Query* q, const DNSMessage& msg);
+  void evaluate(base::Lock& lock);
+  void finish(base::Lock& lock, base::Result r);
+  void flush(base::Lock& lock);
+
+  const Addr& server() const {
+    const auto& servers = config_->servers;
+    return servers[(first_ + try_) % servers.size()];
+  }
+
+  const std::shared_ptr<const DNSConfig> config_;
+  const unsigned int first_;
+  const event::Manager manager_;
+  event::Task* const task_;
+  std::vector<IP>* const out_;
+  Duration* const ttl_out_;
+  const int family_;
+  const base::Options options_;
+  std::mutex mu_;
+  std::shared_ptr<Lookup> self_;  // keeps this alive until finished
+  std::vector<std::string> names_;
+  std::size_t name_index_;
+  std::vector<Query> queries_;
+  unsigned int try_;
+  unsigned int gen_;
+  base::FD udp_;
+  event::Handle udp_evt_;
+  event::Handle timer_;
+  std::vector<char> buf_;
+  std::vector<TCPExchangePtr> tcp_;
+  std::vector<std::pair<TCPExchangePtr, Addr>> starting_;
+  std::vector<TCPExchangePtr> doomed_;
+  base::Result result_;
+  std::vector<IP> ips_;
+  Duration ttl_;
+  bool finished_;
+  bool flushed_;
+};
+
+base::Result TCPExchange::done(base::Result r) {
+  parent_.finish(r);
+  auto lookup = lookup_.lock();
+  if (lookup) lookup->on_tcp(this, gen_, index_, std::move(r), response_);
+  auto keep = std::move(keep_);  // may destroy |this| on return
+  return base::Result();
+}
+
+void Lookup::start(const std::string& name) {
+  auto lock = base::acquire_lock(mu_);
+  self_ = shared_from_this();
+  if (config_->servers.empty()) {
+    finish(lock, base::Result::failed_precondition("no DNS servers"));
+  } else if (name.empty() || name == ".") {
+    finish(lock, base::Result::invalid_argument("empty DNS name"));
+  } else {
+    names_ = candidates(*config_, name);
+    next_name(lock);
+  }
+  flush(lock);
+}
+
+void Lookup::next_name(base::Lock& lock) {
+  if (name_index_ >= names_.size()) {
+    finish(lock, base::Result::not_found("no addresses for DNS name"));
+    return;
+  }
+  const auto& name = names_[name_index_];
+  queries_.clear();
+  if (family_ != AF_INET) queries_.emplace_back(DNSType::aaaa, random_id());
+  if (family_ != AF_INET6) queries_.emplace_back(DNSType::a, random_id());
+  for (auto& q : queries_) {
+    DNSMessage msg;
+    msg.id = q.id;
+    msg.flags = DNSMessage::kFlagRD;
+    msg.questions.emplace_back(name, q.type);
+    msg.additionals.emplace_back("", DNSType::opt, 0, "");
+    msg.additionals.back().klass = kEDNSPayloadSize;
+    auto r = msg.encode(&q.wire);
+    if (!r) {
+      finish(lock, std::move(r));
+      return;
+    }
+  }
+  try_ = 0;
+  send_try(lock);
+}
+
+void Lookup::send_try(base::Lock& lock) {
+  stop_try(lock);
+  unsigned int total = std::max(config_->attempts, 1U) *
+                       config_->servers.size();
+  while (try_ < total) {
+    auto r = open_try(lock, server());
+    if (r) return;
+    VLOG(4) << "net::DNSClient: " << server() << ": " << r;
+    stop_try(lock);
+    ++try_;
+  }
+  finish(lock, base::Result::deadline_exceeded("no DNS server answered"));
+}
+
+base::Result Lookup::open_try(base::Lock& lock, const Addr& server) {
+  auto raw = server.raw();
+  int family = RICSA(raw.first)->sa_family;
+  int fdnum = ::socket(family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fdnum == -1) {
+    int err_no = errno;
+    return base::Result::from_errno(err_no, "socket(2)");
+  }
+  udp_ = base::wrapfd(fdnum);
+  if (::connect(fdnum, RICSA(raw.first), raw.second) != 0) {
+    int err_no = errno;
+    return base::Result::from_errno(err_no, "connect(2)");
+  }
+
+  // Only queries still waiting on UDP are sent; truncated ones are already
+  // being asked over TCP.
+  for (const auto& q : queries_) {
+    if (q.done || q.tcp) continue;
+    ssize_t n;
+    do {
+      n = ::send(fdnum, q.wire.data(), q.wire.size(), 0);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) {
+      int err_no = errno;
+      return base::Result::from_errno(err_no, "send(2)");
+    }
+  }
+
+  unsigned int gen = gen_;
+  std::weak_ptr<Lookup> weak = shared_from_this();
+  auto readable = [weak, gen](event::Data data) {
+    auto self = weak.lock();
+    if (self) self->on_readable(gen);
+    return base::Result();
+  };
+  auto timeout = [weak, gen](event::Data data) {
+    auto self = weak.lock();
+    if (self) self->on_timeout(gen);
+    return base::Result();
+  };
+  auto r = manager_.fd(&udp_evt_, udp_, event::Set::readable_bit(),
+                       event::handler(readable));
+  if (r) r = manager_.timer(&timer_, event::handler(timeout));
+  if (r) r = timer_.set_delay(config_->timeout);
+  return r;
+}
+
+void Lookup::stop_try(base::Lock& lock) {
+  ++gen_;
+  if (udp_evt_) {
+    udp_evt_.disable().ignore_ok();
+    udp_evt_.disown();
+  }
+  if (timer_) {
+    timer_.disable().ignore_ok();
+    timer_.disown();
+  }
+  udp_.reset();
+  for (auto& q : queries_) q.tcp = false;
+  for (auto& x : tcp_) doomed_.push_back(std::move(x));
+  tcp_.clear();
+  starting_.clear();
+}
+
+void Lookup::on_readable(unsigned int gen) {
+  auto lock = base::acquire_lock(mu_);
+  if (finished_ || gen != gen_) return;
+  if (buf_.empty()) buf_.resize(0x10000);
+  base::FD fd = udp_;  // |send_try()| may replace |udp_|
+  auto pair = fd->acquire_fd();
+  while (!finished_ && gen == gen_) {
+    ssize_t n = ::recv(pair.first, buf_.data(), buf_.size(), 0);
+    if (n < 0) {
+      int err_no = errno;
+      if (err_no == EINTR) continue;
+      if (err_no == EAGAIN || err_no == EWOULDBLOCK) break;
+      // E.g. ECONNREFUSED from an ICMP port unreachable: try the next one.
+      VLOG(4) << "net::DNSClient: " << server() << ": "
+              << base::Result::from_errno(err_no, "recv(2)");
+      ++try_;
+      send_try(lock);
+      break;
+    }
+    DNSMessage msg;
+    if (DNSMessage::parse(&msg, buf_.data(), n))
+      handle_message(lock, msg, false, 0);
+  }
+  flush(lock);
+}
+
+void Lookup::on_timeout(unsigned int gen) {
+  auto lock = base::acquire_lock(mu_);
+  if (finished_ || gen != gen_) return;
+  VLOG(4) << "net::DNSClient: " << server() << ": timed out";
+  ++try_;
+  send_try(lock);
+  flush(lock);
+}
+
+void Lookup::on_tcp(TCPExchange* x, unsigned int gen, std::size_t index,
+                    base::Result r, const std::string& response) {
+  auto lock = base::acquire_lock(mu_);
+  auto it = tcp_.begin();
+  while (it != tcp_.end()) {
+    if (it->get() == x)
+      it = tcp_.erase(it);
+    else
+      ++it;
+  }
+  if (finished_ || gen != gen_) return;
+  DNSMessage msg;
+  if (r) r = DNSMessage::parse(&msg, response);
+  if (r) {
+    handle_message(lock, msg, true, index);
+  } else {
+    VLOG(4) << "net::DNSClient: " << server() << ": TCP: " << r;
+    ++try_;
+    send_try(lock);
+  }
+  flush(lock);
+}
+
+void Lookup::cancel() {
+  auto lock = base::acquire_lock(mu_);
+  if (!finished_) finish(lock, base::Result::cancelled());
+  flush(lock);
+}
+
+void Lookup::handle_message(base::Lock& lock, const DNSMessage& msg,
+                            bool via_tcp, std::size_t tcp_index) {
+  if (!msg.is_response() || msg.questions.size() != 1) return;
+  const auto& question = msg.questions.front();
+  if (!same_name(question.name, names_[name_index_])) return;
+
+  std::size_t index = 0;
+  while (index < queries_.size()) {
+    const auto& q = queries_[index];
+    if (q.id == msg.id && !q.done &&
+        question.type == static_cast<uint16_t>(q.type) && q.tcp == via_tcp &&
+        (!via_tcp || index == tcp_index))
+      break;
+    ++index;
+  }
+  if (index == queries_.size()) return;
+  auto& q = queries_[index];
+
+  if (msg.is_truncated() && !via_tcp) {
+    IP ip;
+    const auto& s = server();
+    auto r = IP::parse(&ip, s.ip());
+    r.expect_ok(__FILE__, __LINE__);
+    if (!r) return;
+    q.tcp = true;
+    auto x = std::make_shared<TCPExchange>(shared_from_this(), gen_, index,
+                                           q.wire, options_);
+    tcp_.push_back(x);
+    starting_.emplace_back(std::move(x), inetaddr(P::stream, ip, s.port()));
+    return;
+  }
+
+  switch (msg.rcode()) {
+    case DNSRCode::noerror:
+    case DNSRCode::nxdomain:
+      break;
+
+    default:
+      // This server can't help; ask the next one.
+      VLOG(4) << "net::DNSClient: " << server() << ": rcode "
+              << static_cast<unsigned int>(msg.rcode());
+      ++try_;
+      send_try(lock);
+      return;
+  }
+
+  q.done = true;
+  q.tcp = false;
+  collect(&q, msg);
+  for (const auto& other : queries_) {
+    if (!other.done) return;
+  }
+  evaluate(lock);
+}
+
+void Lookup::collect(Query* q, const DNSMessage& msg) {
+  // Follow the CNAME chain from the question name, wherever the records
+  // appear in the answer section.
+  std::vector<std::string> owners;
+  owners.push_back(names_[name_index_]);
+  auto is_owner = [&owners](const std::string& name) {
+    for (const auto& owner : owners) {
+      if (same_name(owner, name)) return true;
+    }
+    return false;
+  };
+
+  uint32_t ttl = std::numeric_limits<uint32_t>::max();
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (const auto& rec : msg.answers) {
+      if (rec.type != static_cast<uint16_t>(DNSType::cname)) continue;
+      if (!is_owner(rec.name) || is_owner(rec.data)) continue;
+      owners.push_back(rec.data);
+      ttl = std::min(ttl, rec.ttl);
+      changed = true;
+    }
+  }
+
+  std::size_t want = (q->type == DNSType::a) ? 4 : 16;
+  for (const auto& rec : msg.answers) {
+    if (rec.type != static_cast<uint16_t>(q->type) || rec.klass != 1) continue;
+    if (rec.data.size() != want || !is_owner(rec.name)) continue;
+    const auto* ptr = reinterpret_cast<const uint8_t*>(rec.data.data());
+    q->ips.emplace_back(ptr, want);
+    ttl = std::min(ttl, rec.ttl);
+  }
+  q->ttl = q->ips.empty() ? 0 : ttl;
+}
+
+void Lookup::evaluate(base::Lock& lock) {
+  std::vector<IP> ips;
+  uint32_t ttl = std::numeric_limits<uint32_t>::max();
+  for (const auto& q : queries_) {
+    if (q.ips.empty()) continue;
+    ips.insert(ips.end(), q.ips.begin(), q.ips.end());
+    ttl = std::min(ttl, q.ttl);
+  }
+  if (ips.empty()) {
+    ++name_index_;
+    next_name(lock);
+    return;
+  }
+  ips_ = std::move(ips);
+  ttl_ = base::time::seconds(ttl);
+  finish(lock, base::Result());
+}
+
+void Lookup::finish(base::Lock& lock, base::Result r) {
+  stop_try(lock);
+  finished_ = true;
+  result_ = std::move(r);
+}
+
+void Lookup::flush(base::Lock& lock) {
+  std::vector<std::pair<TCPExchangePtr, Addr>> starting;
+  std::vector<TCPExchangePtr> doomed;
+  starting.swap(starting_);
+  doomed.swap(doomed_);
+  bool report = (finished_ && !flushed_);
+  std::shared_ptr<Lookup> self;
+  if (report) {
+    flushed_ = true;
+    self = std::move(self_);
+  }
+  lock.unlock();
+
+  for (auto& x : doomed) x->cancel();
+  for (auto& pair : starting) pair.first->start(pair.first, pair.second);
+  if (report) {
+    if (result_) {
+      out_->insert(out_->end(), ips_.begin(), ips_.end());
+      *ttl_out_ = ttl_;
+    }
+    task_->finish(result_);
+  }
+}
+
+}  // anonymous namespace
+
+base::Result DNSMessage::encode(std::string* out) const {
+  CHECK_NOTNULL(out);
+  std::string buf;
+  put16(&buf, id);
+  put16(&buf, flags);
+  put16(&buf, questions.size());
+  put16(&buf, answers.size());
+  put16(&buf, authorities.size());
+  put16(&buf, additionals.size());
+  for (const auto& q : questions) {
+    auto r = put_name(&buf, q.name);
+    if (!r) return r;
+    put16(&buf, q.type);
+    put16(&buf, q.klass);
+  }
+  for (const auto* section : {&answers, &authorities, &additionals}) {
+    for (const auto& rec : *section) {
+      auto r = write_record(&buf, rec);
+      if (!r) return r;
+    }
+  }
+  out->append(buf);
+  return base::Result();
+}
+
+base::Result DNSMessage::parse(DNSMessage* out, const char* ptr,
+                               std::size_t len) {
+  CHECK_NOTNULL(out);
+  CHECK_NOTNULL(ptr);
+  auto bad = [] { return base::Result::data_loss("malformed DNS message"); };
+
+  WireReader r(ptr, len);
+  DNSMessage msg;
+  uint16_t qd, an, ns, ar;
+  if (!r.u16(&msg.id) || !r.u16(&msg.flags) || !r.u16(&qd) || !r.u16(&an) ||
+      !r.u16(&ns) || !r.u16(&ar))
+    return bad();
+  msg.questions.resize(qd);
+  for (auto& q : msg.questions) {
+    if (!r.name(&q.name) || !r.u16(&q.type) || !r.u16(&q.klass)) return bad();
+  }
+  msg.answers.resize(an);
+  msg.authorities.resize(ns);
+  msg.additionals.resize(ar);
+  for (auto* section : {&msg.answers, &msg.authorities, &msg.additionals}) {
+    for (auto& rec : *section) {
+      if (!read_record(&r, &rec)) return bad();
+    }
+  }
+  *out = std::move(msg);
+  return base::Result();
+}
+
+base::Result DNSConfig::parse(DNSConfig* out, const std::string& text) {
+  CHECK_NOTNULL(out);
+  DNSConfig config;
+  std::vector<std::string> fields;
+  std::string line;
+  std::size_t pos = 0;
+  while (pos < text.size()) {
+    auto eol = text.find('\n', pos);
+    if (eol == std::string::npos) eol = text.size();
+    line.assign(text, pos, eol - pos);
+    pos = eol + 1;
+
+    split_fields(&fields, line);
+    if (fields.empty()) continue;
+    const auto& keyword = fields.front();
+    if (keyword == "nameserver" && fields.size() >= 2) {
+      IP ip;
+      if (IP::parse(&ip, fields[1]))
+        config.servers.push_back(inetaddr(P::datagram, ip.as_narrow(), 53));
+    } else if (keyword == "domain" && fields.size() >= 2) {
+      config.search.assign(1, fields[1]);
+    } else if (keyword == "search") {
+      config.search.assign(fields.begin() + 1, fields.end());
+    } else if (keyword == "options") {
+      for (std::size_t i = 1; i < fields.size(); ++i) {
+        const auto& opt = fields[i];
+        auto colon = opt.find(':');
+        std::string name = opt.substr(0, colon);
+        std::string value;
+        if (colon != std::string::npos) value = opt.substr(colon + 1);
+        unsigned int x;
+        if (name == "ndots" && parse_uint(&x, value)) {
+          config.ndots = std::min(x, 15U);
+        } else if (name == "timeout" && parse_uint(&x, value)) {
+          config.timeout = base::time::seconds(std::max(x, 1U));
+        } else if (name == "attempts" && parse_uint(&x, value)) {
+          config.attempts = std::max(std::min(x, 5U), 1U);
+        } else if (name == "rotate") {
+          config.rotate = true;
+        }
+      }
+    }
+  }
+  for (auto& domain : config.search) {
+    if (!domain.empty() && domain.back() == '.') domain.pop_back();
+  }
+  if (config.servers.empty()) {
+    config.servers.push_back(inetaddr(P::datagram, IP::localhost_v4(), 53));
+    config.servers.push_back(inetaddr(P::datagram, IP::localhost_v6(), 53));
+  }
+  *out = std::move(config);
+  return base::Result();
+}
+
+base::Result DNSConfig::load(DNSConfig* out, const std::string& path) {
+  int fdnum = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fdnum == -1) {
+    int err_no = errno;
+    return base::Result::from_errno(err_no, "open(2) path=", path);
+  }
+  base::FD fd = base::wrapfd(fdnum);
+  std::vector<char> data;
+  auto r = base::read_all(&data, fd, path.c_str());
+  if (!r) return r;
+  r = fd->close();
+  if (!r) return r;
+  return parse(out, std::string(data.begin(), data.end()));
+}
+
+DNSClient::DNSClient(DNSConfig config)
+    : config_(std::make_shared<const DNSConfig>(std::move(config))),
+      next_(0) {}
+
+void DNSClient::lookup(event::Task* task, std::vector<IP>* out, Duration* ttl,
+                       const std::string& name, int family,
+                       const base::Options& opts) {
+  CHECK_NOTNULL(task);
+  CHECK_NOTNULL(out);
+  CHECK_NOTNULL(ttl);
+  CHECK(family == AF_UNSPEC || family == AF_INET || family == AF_INET6);
+  if (!task->start()) return;
+
+  unsigned int first = config_->rotate ? next_.fetch_add(1) : 0;
+  auto lookup = std::make_shared<Lookup>(config_, first,
+                                         io::get_manager(opts), task, out,
+                                         ttl, family, opts);
+  std::weak_ptr<Lookup> weak = lookup;
+  task->on_cancelled(event::callback([weak] {
+    auto lookup = weak.lock();
+    if (lookup) lookup->cancel();
+    return base::Result();
+  }));
+  lookup->start(name);
+}
+
+base::Result DNSClient::lookup(std::vector<IP>* out, Duration* ttl,
+                               const std::string& name, int family,
+                               const base::Options& opts) {
+  event::Task task;
+  lookup(&task, out, ttl, name, family, opts);
+  event::wait(io::get_manager(opts), &task);
+  return task.result();
+}
+
+std::shared_ptr<DNSClient> system_dnsclient(const std::string& path) {
+  static std::mutex mu;
+  static auto& clients = *new std::map<std::string, std::shared_ptr<DNSClient>>;
+  auto lock = base::acquire_lock(mu);
+  auto& client = clients[path];
+  if (!client) {
+    DNSConfig config;
+    auto r = DNSConfig::load(&config, path);
+    if (!r) {
+      VLOG(1) << "net::system_dnsclient: " << r;
+      DNSConfig::parse(&config, "").expect_ok(__FILE__, __LINE__);
+    }
+    client = std::make_shared<DNSClient>(std::move(config));
+  }
+  return client;
+}
+
+}  // namespace net
@@ -0,0 +1,192 @@
+// net/dns.h - Native DNS stub resolver
+// Copyright © 2017 by Donald King <chronos@chronos-tachyon.net>
+// Available under the MIT License. See LICENSE for details.
+
+#ifndef NET_DNS_H
+#define NET_DNS_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "base/options.h"
+#include "base/result.h"
+#include "base/time/duration.h"
+#include "event/task.h"
+#include "net/addr.h"
+#include "net/ip.h"
+
+namespace net {
+
+// DNS resource record types, as used in this package.
+enum class DNSType : uint16_t {
+  a = 1,
+  ns = 2,
+  cname = 5,
+  soa = 6,
+  aaaa = 28,
+  opt = 41,
+};
+
+// DNS response codes, as used in this package.
+enum class DNSRCode : uint8_t {
+  noerror = 0,
+  formerr = 1,
+  servfail = 2,
+  nxdomain = 3,
+  notimp = 4,
+  refused = 5,
+};
+
+// DNSQuestion is one entry in the question section of a DNSMessage.
+struct DNSQuestion {
+  std::string name;  // without the trailing dot
+  uint16_t type;
+  uint16_t klass;
+
+  DNSQuestion() noexcept : type(0), klass(1) {}
+  DNSQuestion(std::string n, DNSType t) : name(std::move(n)),
+                                          type(static_cast<uint16_t>(t)),
+                                          klass(1) {}
+};
+
+// DNSRecord is one resource record in a DNSMessage.
+struct DNSRecord {
+  std::string name;  // without the trailing dot
+  uint16_t type;
+  uint16_t klass;
+  uint32_t ttl;
+  std::string data;  // uncompressed RDATA, except for CNAME: the target name
+
+  DNSRecord() noexcept : type(0), klass(1), ttl(0) {}
+  DNSRecord(std::string n, DNSType t, uint32_t ttl, std::string d)
+      : name(std::move(n)),
+        type(static_cast<uint16_t>(t)),
+        klass(1),
+        ttl(ttl),
+        data(std::move(d)) {}
+};
+
+// DNSMessage is a DNS query or response in RFC 1035 format.
+struct DNSMessage {
+  static constexpr uint16_t kFlagQR = 0x8000;
+  static constexpr uint16_t kFlagAA = 0x0400;
+  static constexpr uint16_t kFlagTC = 0x0200;
+  static constexpr uint16_t kFlagRD = 0x0100;
+  static constexpr uint16_t kFlagRA = 0x0080;
+
+  uint16_t id;
+  uint16_t flags;
+  std::vector<DNSQuestion> questions;
+  std::vector<DNSRecord> answers;
+  std::vector<DNSRecord> authorities;
+  std::vector<DNSRecord> additionals;
+
+  DNSMessage() noexcept : id(0), flags(0) {}
+
+  bool is_response() const noexcept { return (flags & kFlagQR) != 0; }
+  bool is_truncated() const noexcept { return (flags & kFlagTC) != 0; }
+  DNSRCode rcode() const noexcept { return DNSRCode(flags & 0x000f); }
+  void set_rcode(DNSRCode rc) noexcept {
+    flags = (flags & 0xfff0) | static_cast<uint16_t>(rc);
+  }
+
+  // Appends the wire format of this message to |out|.  Names are written
+  // without compression.
+  base::Result encode(std::string* out) const;
+
+  // Parses the wire format message in |ptr|/|len|.  Compressed names are
+  // expanded.
+  static base::Result parse(DNSMessage* out, const char* ptr, std::size_t len);
+  static base::Result parse(DNSMessage* out, const std::string& wire) {
+    return parse(out, wire.data(), wire.size());
+  }
+};
+
+// DNSConfig configures a DNSClient, as resolv.conf(5) does for libc.
+struct DNSConfig {
+  // The DNS servers to query, as "udp4" or "udp6" addresses.
+  std::vector<Addr> servers;
+
+  // The domains to append to names with fewer than |ndots| dots.
+  std::vector<std::string> search;
+
+  // The number of dots needed for a name to be tried as-is first.
+  unsigned int ndots;
+
+  // How long to wait for an answer before asking the next server.
+  base::time::Duration timeout;
+
+  // How many times to ask each server before giving up.
+  unsigned int attempts;
+
+  // If true, the first server to ask is rotated among |servers|.
+  bool rotate;
+
+  DNSConfig() noexcept : ndots(1),
+                         timeout(base::time::seconds(5)),
+                         attempts(2),
+                         rotate(false) {}
+
+  // Parses |text| in resolv.conf(5) format.  Unknown keywords are ignored.
+  // If no servers are listed, the local host is used.
+  static base::Result parse(DNSConfig* out, const std::string& text);
+
+  // Like |parse()|, but reads the text from the file at |path|.
+  static base::Result load(DNSConfig* out, const std::string& path);
+};
+
+// DNSClient looks up the IPv4 and IPv6 addresses of names by speaking the
+// DNS protocol directly to the configured servers, without any helper
+// threads.
+//
+// - The A and AAAA queries for a name are sent together over one
+//   non-blocking UDP socket, registered with the io::Options event::Manager
+// - Unanswered queries are retransmitted to the next server after
+//   |DNSConfig::timeout|
+// - Truncated answers are asked again over TCP
+// - The search list is applied as resolv.conf(5) describes
+//
+// THREAD SAFETY: This class is thread-safe.
+//
+class DNSClient {
+ public:
+  explicit DNSClient(DNSConfig config);
+
+  // DNSClient is neither copyable nor moveable.
+  DNSClient(const DNSClient&) = delete;
+  DNSClient(DNSClient&&) = delete;
+  DNSClient& operator=(const DNSClient&) = delete;
+  DNSClient& operator=(DNSClient&&) = delete;
+
+  // Returns the configuration of this DNSClient.
+  const DNSConfig& config() const noexcept { return *config_; }
+
+  // Looks up the addresses of |name| and appends them to |out|, IPv6 first.
+  // The smallest TTL of the records used is stored in |*ttl|.
+  // - |family| is AF_INET, AF_INET6, or AF_UNSPEC for both
+  // - Returns NOT_FOUND if |name| has no addresses of the wanted family
+  // - Returns DEADLINE_EXCEEDED if no server answered
+  void lookup(event::Task* task, std::vector<IP>* out,
+              base::time::Duration* ttl, const std::string& name, int family,
+              const base::Options& opts = base::default_options());
+
+  // Synchronous version of |lookup()|.
+  base::Result lookup(std::vector<IP>* out, base::time::Duration* ttl,
+                      const std::string& name, int family,
+                      const base::Options& opts = base::default_options());
+
+ private:
+  const std::shared_ptr<const DNSConfig> config_;
+  std::atomic<unsigned int> next_;
+};
+
+// Returns the DNSClient configured by the resolv.conf(5) file at |path|.
+// The file is read only once per |path|.
+std::shared_ptr<DNSClient> system_dnsclient(const std::string& path);
+
+}  // namespace net
+
+#endif  // NET_DNS_H
@@ -0,0 +1,363 @@
+// Copyright © 2017 by Donald King <chronos@chronos-tachyon.net>
+// Available under the MIT License. See LICENSE for details.
+
+#include "gtest/gtest.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "base/logging.h"
+#include "base/result_testing.h"
+#include "base/time/duration.h"
+#include "net/dns.h"
+#include "net/inet.h"
+#include "net/ip.h"
+
+using RC = base::ResultCode;
+using T = net::DNSType;
+
+static std::string v4(uint8_t a, uint8_t b, uint8_t c, uint8_t d) {
+  return std::string{char(a), char(b), char(c), char(d)};
+}
+
+static std::string v6(uint8_t last) {
+  std::string out(16, '\0');
+  out[0] = char(0x20);
+  out[1] = char(0x01);
+  out[2] = char(0x0d);
+  out[3] = char(0xb8);
+  out[15] = char(last);
+  return out;
+}
+
+// FakeDNS is an in-process DNS server on 127.0.0.1, answering over both UDP
+// and TCP on the same port from a fixed set of records.
+class FakeDNS {
+ public:
+  FakeDNS() : port_(0), stop_(false), udp_queries_(0), tcp_queries_(0),
+              drop_(0) {
+    sockaddr_in sin;
+    ::bzero(&sin, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(sin);
+
+    udp_ = ::socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    CHECK_GE(udp_, 0);
+    CHECK_EQ(0, ::bind(udp_, reinterpret_cast<sockaddr*>(&sin), len));
+    CHECK_EQ(0, ::getsockname(udp_, reinterpret_cast<sockaddr*>(&sin), &len));
+    port_ = ntohs(sin.sin_port);
+
+    int one = 1;
+    tcp_ = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    CHECK_GE(tcp_, 0);
+    ::setsockopt(tcp_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    CHECK_EQ(0, ::bind(tcp_, reinterpret_cast<sockaddr*>(&sin), len));
+    CHECK_EQ(0, ::listen(tcp_, 16));
+
+    thread_ = std::thread([this] { loop(); });
+  }
+
+  ~FakeDNS() {
+    stop_ = true;
+    thread_.join();
+    ::close(udp_);
+    ::close(tcp_);
+  }
+
+  net::Addr addr() const {
+    return net::inetaddr(net::ProtocolType::datagram, net::IP::localhost_v4(),
+                         port_);
+  }
+
+  void add(std::string name, T type, uint32_t ttl, std::string data) {
+    auto lock = base::acquire_lock(mu_);
+    records_.emplace_back(std::move(name), type, ttl, std::move(data));
+  }
+
+  void truncate(std::string name) {
+    auto lock = base::acquire_lock(mu_);
+    truncate_.push_back(std::move(name));
+  }
+
+  void drop(unsigned int n) { drop_ = n; }
+  unsigned int udp_queries() const { return udp_queries_; }
+  unsigned int tcp_queries() const { return tcp_queries_; }
+
+ private:
+  bool answer(std::string* out, const std::string& query, bool via_tcp) {
+    net::DNSMessage q;
+    if (!net::DNSMessage::parse(&q, query) || q.questions.size() != 1)
+      return false;
+    const auto& question = q.questions.front();
+
+    net::DNSMessage r;
+    r.id = q.id;
+    r.flags = net::DNSMessage::kFlagQR | net::DNSMessage::kFlagRD |
+              net::DNSMessage::kFlagRA;
+    r.questions = q.questions;
+
+    auto lock = base::acquire_lock(mu_);
+    for (const auto& name : truncate_) {
+      if (!via_tcp && name == question.name) {
+        r.flags |= net::DNSMessage::kFlagTC;
+        return bool(r.encode(out));
+      }
+    }
+    bool known = false;
+    std::string name = question.name;
+    for (int depth = 0; depth < 8; ++depth) {
+      std::string next;
+      for (const auto& rec : records_) {
+        if (rec.name != name) continue;
+        known = true;
+        if (rec.type == question.type ||
+            rec.type == static_cast<uint16_t>(T::cname)) {
+          r.answers.push_back(rec);
+        }
+        if (rec.type == static_cast<uint16_t>(T::cname)) next = rec.data;
+      }
+      if (next.empty()) break;
+      name = next;
+    }
+    if (!known) r.set_rcode(net::DNSRCode::nxdomain);
+    return bool(r.encode(out));
+  }
+
+  void serve_tcp(int fd) {
+    std::string query;
+    char buf[4096];
+    while (true) {
+      ssize_t n = ::read(fd, buf, sizeof(buf));
+      if (n <= 0) break;
+      query.append(buf, n);
+      if (query.size() < 2) continue;
+      std::size_t len = (uint8_t(query[0]) << 8) | uint8_t(query[1]);
+      if (query.size() < len + 2) continue;
+      ++tcp_queries_;
+      std::string response;
+      if (answer(&response, query.substr(2, len), true)) {
+        std::string framed;
+        framed.push_back(char(response.size() >> 8));
+        framed.push_back(char(response.size()));
+        framed.append(response);
+        CHECK_EQ(ssize_t(framed.size()),
+                 ::write(fd, framed.data(), framed.size()));
+      }
+      break;
+    }
+    ::close(fd);
+  }
+
+  void loop() {
+    while (!stop_) {
+      pollfd pfds[2];
+      pfds[0].fd = udp_;
+      pfds[0].events = POLLIN;
+      pfds[1].fd = tcp_;
+      pfds[1].events = POLLIN;
+      if (::poll(pfds, 2, 10) <= 0) continue;
+
+      if (pfds[0].revents & POLLIN) {
+        char buf[4096];
+        sockaddr_storage ss;
+        socklen_t sslen = sizeof(ss);
+        ssize_t n = ::recvfrom(udp_, buf, sizeof(buf), 0,
+                               reinterpret_cast<sockaddr*>(&ss), &sslen);
+        if (n > 0) {
+          ++udp_queries_;
+          std::string response;
+          if (drop_ > 0) {
+            --drop_;
+          } else if (answer(&response, std::string(buf, n), false)) {
+            ::sendto(udp_, response.data(), response.size(), 0,
+                     reinterpret_cast<sockaddr*>(&ss), sslen);
+          }
+        }
+      }
+
+      if (pfds[1].revents & POLLIN) {
+        int fd = ::accept4(tcp_, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd >= 0) serve_tcp(fd);
+      }
+    }
+  }
+
+  int udp_;
+  int tcp_;
+  uint16_t port_;
+  std::atomic<bool> stop_;
+  std::atomic<unsigned int> udp_queries_;
+  std::atomic<unsigned int> tcp_queries_;
+  std::atomic<unsigned int> drop_;
+  std::mutex mu_;
+  std::vector<net::DNSRecord> records_;
+  std::vector<std::string> truncate_;
+  std::thread thread_;
+};
+
+static net::DNSConfig config_for(const FakeDNS& dns) {
+  net::DNSConfig config;
+  config.servers.push_back(dns.addr());
+  config.search.push_back("example.test");
+  config.timeout = base::time::milliseconds(100);
+  return config;
+}
+
+TEST(DNSMessage, RoundTrip) {
+  net::DNSMessage m;
+  m.id = 0x1234;
+  m.flags = net::DNSMessage::kFlagQR | net::DNSMessage::kFlagRD;
+  m.set_rcode(net::DNSRCode::nxdomain);
+  m.questions.emplace_back("www.example.test", T::a);
+  m.answers.emplace_back("www.example.test", T::cname, 60, "web.example.test");
+  m.answers.emplace_back("web.example.test", T::a, 30, v4(192, 0, 2, 1));
+
+  std::string wire;
+  ASSERT_OK(m.encode(&wire));
+
+  net::DNSMessage p;
+  ASSERT_OK(net::DNSMessage::parse(&p, wire));
+  EXPECT_EQ(0x1234, p.id);
+  EXPECT_TRUE(p.is_response());
+  EXPECT_FALSE(p.is_truncated());
+  EXPECT_EQ(net::DNSRCode::nxdomain, p.rcode());
+  ASSERT_EQ(1U, p.questions.size());
+  EXPECT_EQ("www.example.test", p.questions[0].name);
+  ASSERT_EQ(2U, p.answers.size());
+  EXPECT_EQ("web.example.test", p.answers[0].data);
+  EXPECT_EQ(30U, p.answers[1].ttl);
+  EXPECT_EQ(v4(192, 0, 2, 1), p.answers[1].data);
+
+  EXPECT_EQ(RC::DATA_LOSS,
+            net::DNSMessage::parse(&p, wire.substr(0, wire.size() - 1)).code());
+
+  net::DNSMessage bad;
+  bad.questions.emplace_back("a..b", T::a);
+  wire.clear();
+  EXPECT_EQ(RC::INVALID_ARGUMENT, bad.encode(&wire).code());
+}
+
+TEST(DNSMessage, Compression) {
+  // One question for "a.test", one answer whose owner points back at it.
+  static const unsigned char kWire[] = {
+      0x00, 0x01, 0x81, 0x80, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00,
+      0x01, 'a',  0x04, 't',  'e',  's',  't',  0x00, 0x00, 0x01, 0x00, 0x01,
+      0xc0, 0x0c, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00, 0x00, 0x3c, 0x00, 0x04,
+      0xc0, 0x00, 0x02, 0x07,
+  };
+  net::DNSMessage m;
+  ASSERT_OK(net::DNSMessage::parse(
+      &m, reinterpret_cast<const char*>(kWire), sizeof(kWire)));
+  ASSERT_EQ(1U, m.answers.size());
+  EXPECT_EQ("a.test", m.answers[0].name);
+  EXPECT_EQ(60U, m.answers[0].ttl);
+
+  // A pointer to itself must not loop forever.
+  std::string loop(reinterpret_cast<const char*>(kWire), sizeof(kWire));
+  loop[24] = char(0xc0);
+  loop[25] = char(24);
+  EXPECT_EQ(RC::DATA_LOSS, net::DNSMessage::parse(&m, loop).code());
+}
+
+TEST(DNSConfig, Parse) {
+  net::DNSConfig c;
+  ASSERT_OK(net::DNSConfig::parse(&c,
+                                  "# comment\n"
+                                  "nameserver 192.0.2.53\n"
+                                  "nameserver 2001:db8::53\n"
+                                  "nameserver bogus\n"
+                                  "domain ignored.test\n"
+                                  "search a.test b.test.\n"
+                                  "options ndots:2 timeout:3 attempts:9 rotate\n"));
+  ASSERT_EQ(2U, c.servers.size());
+  EXPECT_EQ("192.0.2.53:53", c.servers[0].address());
+  EXPECT_EQ("[2001:db8::53]:53", c.servers[1].address());
+  ASSERT_EQ(2U, c.search.size());
+  EXPECT_EQ("a.test", c.search[0]);
+  EXPECT_EQ("b.test", c.search[1]);
+  EXPECT_EQ(2U, c.ndots);
+  EXPECT_EQ(base::time::seconds(3), c.timeout);
+  EXPECT_EQ(5U, c.attempts);
+  EXPECT_TRUE(c.rotate);
+
+  ASSERT_OK(net::DNSConfig::parse(&c, ""));
+  ASSERT_EQ(2U, c.servers.size());
+  EXPECT_EQ("127.0.0.1:53", c.servers[0].address());
+  EXPECT_TRUE(c.search.empty());
+}
+
+TEST(DNSClient, Lookup) {
+  FakeDNS dns;
+  dns.add("www.example.test", T::a, 300, v4(192, 0, 2, 1));
+  dns.add("www.example.test", T::a, 60, v4(192, 0, 2, 2));
+  dns.add("www.example.test", T::aaaa, 120, v6(1));
+  dns.add("alias.example.test", T::cname, 30, "www.example.test");
+  net::DNSClient client(config_for(dns));
+
+  // Found through the search list, IPv6 first, with the smallest TTL.
+  std::vector<net::IP> ips;
+  base::time::Duration ttl;
+  ASSERT_OK(client.lookup(&ips, &ttl, "www", AF_UNSPEC));
+  ASSERT_EQ(3U, ips.size());
+  EXPECT_TRUE(ips[0].is_ipv6());
+  EXPECT_EQ("192.0.2.1", ips[1].as_string());
+  EXPECT_EQ("192.0.2.2", ips[2].as_string());
+  EXPECT_EQ(base::time::seconds(60), ttl);
+
+  // CNAMEs are followed, and count toward the TTL.
+  ips.clear();
+  ASSERT_OK(client.lookup(&ips, &ttl, "alias.example.test.", AF_INET));
+  ASSERT_EQ(2U, ips.size());
+  EXPECT_EQ("192.0.2.1", ips[0].as_string());
+  EXPECT_EQ(base::time::seconds(30), ttl);
+
+  ips.clear();
+  EXPECT_EQ(RC::NOT_FOUND,
+            client.lookup(&ips, &ttl, "nowhere", AF_UNSPEC).code());
+  EXPECT_TRUE(ips.empty());
+}
+
+TEST(DNSClient, TCPFallback) {
+  FakeDNS dns;
+  dns.add("big.example.test", T::a, 300, v4(192, 0, 2, 9));
+  dns.truncate("big.example.test");
+  net::DNSClient client(config_for(dns));
+
+  std::vector<net::IP> ips;
+  base::time::Duration ttl;
+  ASSERT_OK(client.lookup(&ips, &ttl, "big.example.test.", AF_INET));
+  ASSERT_EQ(1U, ips.size());
+  EXPECT_EQ("192.0.2.9", ips[0].as_string());
+  EXPECT_EQ(1U, dns.udp_queries());
+  EXPECT_EQ(1U, dns.tcp_queries());
+}
+
+TEST(DNSClient, Retransmit) {
+  FakeDNS dns;
+  dns.add("slow.example.test", T::a, 300, v4(192, 0, 2, 3));
+  dns.drop(1);
+  net::DNSClient client(config_for(dns));
+
+  std::vector<net::IP> ips;
+  base::time::Duration ttl;
+  ASSERT_OK(client.lookup(&ips, &ttl, "slow.example.test.", AF_INET));
+  ASSERT_EQ(1U, ips.size());
+  EXPECT_EQ(2U, dns.udp_queries());
+
+  // Every try dropped: gives up after |attempts| tries.
+  dns.drop(100);
+  ips.clear();
+  EXPECT_EQ(RC::DEADLINE_EXCEEDED,
+            client.lookup(&ips, &ttl, "slow.example.test.", AF_INET).code());
+}
@@ -0,0 +1,174 @@
+// Copyright © 2017 by Donald King <chronos@chronos-tachyon.net>
+// Available under the MIT License. See LICENSE for details.
+
+#include "net/hosts.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <cerrno>
+#include <map>
+#include <mutex>
+
+#include "base/fd.h"
+#include "base/logging.h"
+#include "base/mutex.h"
+#include "base/time/clock.h"
+#include "base/time/time.h"
+
+using base::time::MonotonicTime;
+using base::time::monotonic_now;
+
+namespace net {
+
+namespace {
+
+static bool is_space(char ch) noexcept {
+  return ch == ' ' || ch == '\t' || ch == '\r' || ch == '\v' || ch == '\f';
+}
+
+static void lowercase(std::string* str) noexcept {
+  for (char& ch : *str) {
+    if (ch >= 'A' && ch <= 'Z') ch = ch - 'A' + 'a';
+  }
+}
+
+// Splits |line| into whitespace-separated fields, stopping at any comment.
+static void split_fields(std::vector<std::string>* out,
+                         const std::string& line) {
+  out->clear();
+  auto it = line.begin(), end = line.end();
+  while (it != end) {
+    while (it != end && is_space(*it)) ++it;
+    if (it == end || *it == '#') break;
+    auto begin = it;
+    while (it != end && !is_space(*it) && *it != '#') ++it;
+    out->emplace_back(begin, it);
+  }
+}
+
+// Identifies a particular version of a file on disk.
+struct FileVersion {
+  dev_t dev;
+  ino_t ino;
+  off_t size;
+  struct timespec mtime;
+
+  FileVersion() noexcept : dev(0), ino(0), size(0), mtime() {}
+
+  static FileVersion from_stat(const struct stat& st) noexcept {
+    FileVersion v;
+    v.dev = st.st_dev;
+    v.ino = st.st_ino;
+    v.size = st.st_size;
+    v.mtime = st.st_mtim;
+    return v;
+  }
+
+  friend bool operator==(const FileVersion& a, const FileVersion& b) noexcept {
+    return a.dev == b.dev && a.ino == b.ino && a.size == b.size &&
+           a.mtime.tv_sec == b.mtime.tv_sec &&
+           a.mtime.tv_nsec == b.mtime.tv_nsec;
+  }
+};
+
+struct LoadedFile {
+  HostsFile hosts;
+  FileVersion version;
+  MonotonicTime checked;
+  bool loaded;
+
+  LoadedFile() noexcept : loaded(false) {}
+};
+
+static std::mutex g_mu;
+static std::map<std::string, LoadedFile>* g_files = nullptr;
+
+}  // anonymous namespace
+
+void HostsFile::parse(const std::string& text) {
+  map_.clear();
+  std::vector<std::string> fields;
+  std::string line;
+  std::size_t pos = 0;
+  while (pos < text.size()) {
+    auto eol = text.find('\n', pos);
+    if (eol == std::string::npos) eol = text.size();
+    line.assign(text, pos, eol - pos);
+    pos = eol + 1;
+
+    split_fields(&fields, line);
+    if (fields.size() < 2) continue;
+    IP ip;
+    if (!IP::parse(&ip, fields[0])) continue;
+    ip.narrow();
+    for (std::size_t i = 1; i < fields.size(); ++i) {
+      auto& name = fields[i];
+      lowercase(&name);
+      auto& ips = map_[name];
+      bool dupe = false;
+      for (const auto& existing : ips) {
+        if (existing == ip) dupe = true;
+      }
+      if (!dupe) ips.push_back(ip);
+    }
+  }
+}
+
+base::Result HostsFile::load(const std::string& path) {
+  int fdnum = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fdnum == -1) {
+    int err_no = errno;
+    return base::Result::from_errno(err_no, "open(2) path=", path);
+  }
+  base::FD fd = base::wrapfd(fdnum);
+  std::vector<char> data;
+  auto r = base::read_all(&data, fd, path.c_str());
+  if (!r) return r;
+  r = fd->close();
+  if (!r) return r;
+  parse(std::string(data.begin(), data.end()));
+  return base::Result();
+}
+
+std::vector<IP> HostsFile::lookup(const std::string& name) const {
+  std::string key(name);
+  lowercase(&key);
+  if (!key.empty() && key.back() == '.') key.pop_back();
+  auto it = map_.find(key);
+  if (it == map_.end()) return std::vector<IP>();
+  return it->second;
+}
+
+base::Result hosts_lookup(std::vector<IP>* out, const std::string& path,
+                          const std::string& name) {
+  CHECK_NOTNULL(out);
+  auto now = monotonic_now();
+  auto lock = base::acquire_lock(g_mu);
+  if (g_files == nullptr) g_files = new std::map<std::string, LoadedFile>;
+  auto& file = (*g_files)[path];
+
+  if (!file.loaded || !(now < file.checked + base::time::seconds(1))) {
+    file.checked = now;
+    struct stat st;
+    FileVersion version;
+    if (::stat(path.c_str(), &st) == 0) version = FileVersion::from_stat(st);
+    if (!file.loaded || !(version == file.version)) {
+      file.hosts = HostsFile();
+      file.version = version;
+      file.loaded = true;
+      if (version.ino != 0) {
+        auto r = file.hosts.load(path);
+        if (!r) LOG(WARN) << "net::hosts_lookup: " << r;
+      }
+    }
+  }
+
+  auto ips = file.hosts.lookup(name);
+  if (ips.empty()) return base::Result::not_found();
+  out->insert(out->end(), ips.begin(), ips.end());
+  return base::Result();
+}
+
+}  // namespace net
@@ -0,0 +1,60 @@
+// net/hosts.h - Name lookups against hosts(5) files
+// Copyright © 2017 by Donald King <chronos@chronos-tachyon.net>
+// Available under the MIT License. See LICENSE for details.
+
+#ifndef NET_HOSTS_H
+#define NET_HOSTS_H
+
+#include <cstddef>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "base/result.h"
+#include "net/ip.h"
+
+namespace net {
+
+// HostsFile holds the contents of a hosts(5) file: a static mapping from
+// host names to IP addresses.
+class HostsFile {
+ public:
+  // HostsFile is default constructible, copyable, and moveable.
+  HostsFile() = default;
+  HostsFile(const HostsFile&) = default;
+  HostsFile(HostsFile&&) noexcept = default;
+  HostsFile& operator=(const HostsFile&) = default;
+  HostsFile& operator=(HostsFile&&) noexcept = default;
+
+  // Replaces the contents of this HostsFile with those of |text|, which is
+  // in hosts(5) format.  Lines that can't be parsed are skipped.
+  void parse(const std::string& text);
+
+  // Like |parse()|, but reads the text from the file at |path|.
+  base::Result load(const std::string& path);
+
+  // Returns the IPs listed for |name|, in the order they appear in the file.
+  // Names are matched case-insensitively, and aliases count as names.
+  // - Returns an empty list if |name| is not listed
+  std::vector<IP> lookup(const std::string& name) const;
+
+  // Returns the number of distinct names listed.
+  std::size_t size() const noexcept { return map_.size(); }
+
+  // Returns true iff no names are listed.
+  bool empty() const noexcept { return map_.empty(); }
+
+ private:
+  std::unordered_map<std::string, std::vector<IP>> map_;
+};
+
+// Looks up |name| in the hosts(5) file at |path| and appends the IPs listed
+// for it to |out|.  The file is kept in memory and is re-read when it changes
+// on disk, but it is checked for changes no more than once a second.
+// - Returns NOT_FOUND if |name| is not listed
+base::Result hosts_lookup(std::vector<IP>* out, const std::string& path,
+                          const std::string& name);
+
+}  // namespace net
+
+#endif  // NET_HOSTS_H
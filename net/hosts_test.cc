@@ -0,0 +1,91 @@
+// Copyright © 2017 by Donald King <chronos@chronos-tachyon.net>
+// Available under the MIT License. See LICENSE for details.
+
+#include "gtest/gtest.h"
+
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "base/fd.h"
+#include "base/logging.h"
+#include "base/result_testing.h"
+#include "net/addr.h"
+#include "net/hosts.h"
+#include "net/inet.h"
+#include "net/ip.h"
+#include "net/net.h"
+#include "net/options.h"
+
+using RC = base::ResultCode;
+
+static const char kHosts[] =
+    "# comment line\n"
+    "127.0.0.1\tlocalhost\n"
+    "::1 localhost ip6-localhost   # trailing comment\n"
+    "\n"
+    "192.0.2.7 Example.Test alias\n"
+    "2001:db8::7 example.test\n"
+    "bogus line here\n"
+    "192.0.2.8\n"
+    "192.0.2.7 example.test\n";
+
+static net::IP ip(const char* str) {
+  net::IP out;
+  CHECK_OK(net::IP::parse(&out, str));
+  return out;
+}
+
+TEST(HostsFile, Parse) {
+  net::HostsFile hosts;
+  hosts.parse(kHosts);
+  EXPECT_EQ(4U, hosts.size());
+
+  auto ips = hosts.lookup("localhost");
+  ASSERT_EQ(2U, ips.size());
+  EXPECT_EQ(ip("127.0.0.1"), ips[0]);
+  EXPECT_EQ(ip("::1"), ips[1]);
+
+  ips = hosts.lookup("EXAMPLE.test.");
+  ASSERT_EQ(2U, ips.size());
+  EXPECT_EQ(ip("192.0.2.7"), ips[0]);
+  EXPECT_EQ(ip("2001:db8::7"), ips[1]);
+
+  EXPECT_EQ(1U, hosts.lookup("alias").size());
+  EXPECT_TRUE(hosts.lookup("bogus").empty());
+  EXPECT_TRUE(hosts.lookup("nowhere").empty());
+}
+
+TEST(HostsFile, Resolve) {
+  std::string path;
+  base::FD fd;
+  ASSERT_OK(base::make_tempfile(&path, &fd, "mojo-net-hosts-test.XXXXXX"));
+  ASSERT_OK(base::write_exactly(fd, kHosts, sizeof(kHosts) - 1, path.c_str()));
+  ASSERT_OK(fd->close());
+
+  std::vector<net::IP> ips;
+  EXPECT_OK(net::hosts_lookup(&ips, path, "alias"));
+  EXPECT_EQ(1U, ips.size());
+  EXPECT_EQ(RC::NOT_FOUND, net::hosts_lookup(&ips, path, "nowhere").code());
+
+  base::Options o;
+  o.get<net::Options>().hosts_file = path;
+  o.get<net::Options>().dualstack = net::DualStack::prefer_ipv6;
+
+  std::vector<net::Addr> out;
+  ASSERT_OK(net::resolve(&out, "tcp", "example.test:80", o));
+  ASSERT_EQ(2U, out.size());
+  EXPECT_EQ("tcp6", out[0].protocol());
+  EXPECT_EQ("[2001:db8::7]:80", out[0].address());
+  EXPECT_EQ("tcp4", out[1].protocol());
+  EXPECT_EQ("192.0.2.7:80", out[1].address());
+
+  out.clear();
+  ASSERT_OK(net::resolve(&out, "udp4", "example.test:53", o));
+  ASSERT_EQ(1U, out.size());
+  EXPECT_EQ("udp4", out[0].protocol());
+  EXPECT_EQ("192.0.2.7:53", out[0].address());
+
+  ::unlink(path.c_str());
+}
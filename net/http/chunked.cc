@@ -0,0 +1,231 @@
+// Copyright © 2017 by Donald King <chronos@chronos-tachyon.net>
+// Available under the MIT License. See LICENSE for details.
+
+#include "net/http/chunked.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "base/logging.h"
+#include "net/http/parser.h"
+
+namespace net {
+namespace http {
+
+static constexpr std::size_t kBufferSize = 16384;
+
+namespace {
+
+class ChunkedReader : public io::ReaderImpl {
+ public:
+  explicit ChunkedReader(io::Reader r)
+      : r_(std::move(r)), buf_(kBufferSize), pos_(0), len_(0) {}
+
+  std::size_t ideal_block_size() const noexcept override {
+    return kBufferSize;
+  }
+
+  void read(event::Task* task, char* out, std::size_t* n, std::size_t min,
+            std::size_t max, const base::Options& opts) override {
+    if (!prologue(task, out, n, min, max)) return;
+    auto* h = new Helper(this, task, out, n, min, max, opts);
+    h->run();
+  }
+
+  void close(event::Task* task, const base::Options& opts) override {
+    if (!prologue(task)) return;
+    task->finish_ok();
+  }
+
+ private:
+  struct Helper {
+    ChunkedReader* const self;
+    event::Task* const task;
+    char* const out;
+    std::size_t* const n;
+    const std::size_t min;
+    const std::size_t max;
+    const base::Options options;
+    event::Task subtask;
+
+    Helper(ChunkedReader* s, event::Task* t, char* o, std::size_t* n,
+           std::size_t mn, std::size_t mx, base::Options opts)
+        : self(s),
+          task(t),
+          out(o),
+          n(n),
+          min(mn),
+          max(mx),
+          options(std::move(opts)) {}
+
+    void run() {
+      while (*n < max && self->pos_ < self->len_) {
+        // Bound the input so that the data can't overrun |out|.
+        std::size_t avail =
+            std::min(self->len_ - self->pos_, max - *n);
+        base::StringPiece data;
+        std::size_t used;
+        base::Result r = self->dec_.decode(
+            &data, &used,
+            base::StringPiece(self->buf_.data() + self->pos_, avail));
+        if (!r) {
+          finish(std::move(r));
+          return;
+        }
+        ::memcpy(out + *n, data.data(), data.size());
+        *n += data.size();
+        self->pos_ += used;
+        if (self->dec_.done()) break;
+      }
+
+      if (self->dec_.done()) {
+        if (self->pos_ < self->len_) {
+          base::Result r = self->r_.unread(self->buf_.data() + self->pos_,
+                                           self->len_ - self->pos_);
+          if (!r) {
+            finish(std::move(r));
+            return;
+          }
+          self->pos_ = self->len_;
+        }
+        if (*n < min)
+          finish(base::Result::eof());
+        else
+          finish(base::Result());
+        return;
+      }
+      if (*n >= min && (*n > 0 || max == 0)) {
+        finish(base::Result());
+        return;
+      }
+      if (!task->is_running()) {
+        finish(base::Result::cancelled());
+        return;
+      }
+
+      self->pos_ = 0;
+      self->len_ = 0;
+      subtask.reset();
+      task->add_subtask(&subtask);
+      self->r_.read(&subtask, self->buf_.data(), &self->len_, 1,
+                    self->buf_.size(), options);
+      subtask.on_finished(event::callback([this] {
+        filled();
+        return base::Result();
+      }));
+    }
+
+    void filled() {
+      base::Result r = subtask.result();
+      if (r.code() == base::ResultCode::END_OF_FILE && self->len_ == 0) {
+        finish(base::Result::data_loss(
+            "HTTP: connection closed in the middle of a chunked body"));
+        return;
+      }
+      if (!r && self->len_ == 0) {
+        finish(std::move(r));
+        return;
+      }
+      run();
+    }
+
+    void finish(base::Result r) {
+      task->finish(std::move(r));
+      delete this;
+    }
+  };
+
+  const io::Reader r_;
+  ChunkDecoder dec_;
+  std::vector<char> buf_;
+  std::size_t pos_;
+  std::size_t len_;
+};
+
+class ChunkedWriter : public io::WriterImpl {
+ public:
+  explicit ChunkedWriter(io::Writer w) : w_(std::move(w)), closed_(false) {}
+
+  std::size_t ideal_block_size() const noexcept override {
+    return w_.ideal_block_size();
+  }
+
+  void write(event::Task* task, std::size_t* n, const char* ptr,
+             std::size_t len, const base::Options& opts) override {
+    if (!prologue(task, n, ptr, len)) return;
+    if (closed_) {
+      task->finish(base::Result::failed_precondition("HTTP: writer is closed"));
+      return;
+    }
+    if (len == 0) {
+      task->finish_ok();
+      return;
+    }
+
+    // One write per chunk keeps each chunk in as few packets as possible.
+    char hex[24];
+    int k = ::snprintf(hex, sizeof(hex), "%zx\r\n", len);
+    auto* h = new Helper(task, n, len);
+    h->frame.reserve(k + len + 2);
+    h->frame.append(hex, k);
+    h->frame.append(ptr, len);
+    h->frame.append("\r\n", 2);
+    h->start(w_, opts);
+  }
+
+  void close(event::Task* task, const base::Options& opts) override {
+    if (!prologue(task)) return;
+    if (closed_) {
+      task->finish_ok();
+      return;
+    }
+    closed_ = true;
+    auto* h = new Helper(task, nullptr, 0);
+    h->frame = "0\r\n\r\n";
+    h->start(w_, opts);
+  }
+
+ private:
+  struct Helper {
+    event::Task* const task;
+    std::size_t* const n;
+    const std::size_t len;
+    std::string frame;
+    std::size_t written;
+    event::Task subtask;
+
+    Helper(event::Task* t, std::size_t* n, std::size_t l) noexcept
+        : task(t), n(n), len(l), written(0) {}
+
+    void start(const io::Writer& w, const base::Options& opts) {
+      task->add_subtask(&subtask);
+      w.write(&subtask, &written, frame.data(), frame.size(), opts);
+      subtask.on_finished(event::callback([this] {
+        if (n != nullptr && written == frame.size()) *n = len;
+        event::propagate_result(task, &subtask);
+        delete this;
+        return base::Result();
+      }));
+    }
+  };
+
+  const io::Writer w_;
+  bool closed_;
+};
+
+}  // anonymous namespace
+
+io::Reader chunkedreader(io::Reader r) {
+  CHECK(r.can_unread());
+  return io::Reader(std::make_shared<ChunkedReader>(std::move(r)));
+}
+
+io::Writer chunkedwriter(io::Writer w) {
+  return io::Writer(std::make_shared<ChunkedWriter>(std::move(w)));
+}
+
+}  // namespace http
+}  // namespace net
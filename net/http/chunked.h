@@ -0,0 +1,31 @@
+// net/http/chunked.h - The chunked transfer coding
+// Copyright © 2017 by Donald King <chronos@chronos-tachyon.net>
+// Available under the MIT License. See LICENSE for details.
+
+#ifndef NET_HTTP_CHUNKED_H
+#define NET_HTTP_CHUNKED_H
+
+#include "io/reader.h"
+#include "io/writer.h"
+
+namespace net {
+namespace http {
+
+// Returns a Reader that removes the chunked transfer coding from |r|,
+// reaching EOF after the last chunk and the trailer.
+// - |r| MUST support |unread()|, e.g. an io::bufferedreader(); any bytes
+//   read past the end of the body are unread back into it
+// - Closing the returned Reader does not close |r|
+// - Reads MUST NOT overlap
+io::Reader chunkedreader(io::Reader r);
+
+// Returns a Writer that applies the chunked transfer coding to each write
+// before passing it to |w|.
+// - Closing the returned Writer writes the last chunk, but does not close |w|
+// - Writes MUST NOT overlap
+io::Writer chunkedwriter(io::Writer w);
+
+}  // namespace http
+}  // namespace net
+
+#endif  // NET_HTTP_CHUNKED_H
@@ -0,0 +1,61 @@
+// Copyright © 2017 by Donald King <chronos@chronos-tachyon.net>
+// Available under the MIT License. See LICENSE for details.
+
+#include "gtest/gtest.h"
+
+#include <string>
+
+#include "base/result_testing.h"
+#include "io/reader.h"
+#include "io/writer.h"
+#include "net/http/chunked.h"
+
+TEST(ChunkedReader, Read) {
+  std::string in =
+      "5\r\nHello\r\n"
+      "7;ext\r\n, world\r\n"
+      "0\r\n"
+      "\r\n"
+      "GET / HTTP/1.1\r\n";
+
+  io::Reader br = io::bufferedreader(io::stringreader(in));
+  io::Reader r = net::http::chunkedreader(br);
+
+  std::string out;
+  EXPECT_OK(r.read(&out, 3, 3));
+  EXPECT_EQ("Hel", out);
+  EXPECT_OK(r.read(&out, 1, 64));
+  EXPECT_EQ("lo, world", out);
+  EXPECT_EOF(r.read(&out, 1, 64));
+  EXPECT_OK(r.close());
+
+  // The bytes after the body are left for the next reader.
+  EXPECT_OK(br.read(&out, 16, 16));
+  EXPECT_EQ("GET / HTTP/1.1\r\n", out);
+}
+
+TEST(ChunkedReader, Truncated) {
+  io::Reader br = io::bufferedreader(io::stringreader("5\r\nHel"));
+  io::Reader r = net::http::chunkedreader(br);
+
+  std::string out;
+  EXPECT_OK(r.read(&out, 1, 64));
+  EXPECT_EQ("Hel", out);
+  EXPECT_EQ(base::ResultCode::DATA_LOSS, r.read(&out, 1, 64).code());
+}
+
+TEST(ChunkedWriter, Write) {
+  std::string out;
+  io::Writer w = net::http::chunkedwriter(io::stringwriter(&out));
+
+  std::size_t n;
+  EXPECT_OK(w.write(&n, "Hello"));
+  EXPECT_EQ(5U, n);
+  EXPECT_OK(w.write(&n, ""));
+  EXPECT_EQ(0U, n);
+  EXPECT_OK(w.write(&n, std::string(26, 'x')));
+  EXPECT_EQ(26U, n);
+  EXPECT_OK(w.close());
+  EXPECT_EQ("5\r\nHello\r\n1a\r\nxxxxxxxxxxxxxxxxxxxxxxxxxx\r\n0\r\n\r\n",
+            out);
+}
@@ -0,0 +1,212 @@
+// Copyright © 2017 by Donald King <chronos@chronos-tachyon.net>
+// Available under the MIT License. See LICENSE for details.
+
+#include "net/http/frame.h"
+
+#include <algorithm>
+
+#include "base/logging.h"
+
+namespace net {
+namespace http {
+
+const char kClientPreface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+const char* h2_error_name(H2Error code) noexcept {
+  switch (code) {
+    case H2Error::no_error:
+      return "NO_ERROR";
+    case H2Error::protocol_error:
+      return "PROTOCOL_ERROR";
+    case H2Error::internal_error:
+      return "INTERNAL_ERROR";
+    case H2Error::flow_control_error:
+      return "FLOW_CONTROL_ERROR";
+    case H2Error::settings_timeout:
+      return "SETTINGS_TIMEOUT";
+    case H2Error::stream_closed:
+      return "STREAM_CLOSED";
+    case H2Error::frame_size_error:
+      return "FRAME_SIZE_ERROR";
+    case H2Error::refused_stream:
+      return "REFUSED_STREAM";
+    case H2Error::cancel:
+      return "CANCEL";
+    case H2Error::compression_error:
+      return "COMPRESSION_ERROR";
+    case H2Error::connect_error:
+      return "CONNECT_ERROR";
+    case H2Error::enhance_your_calm:
+      return "ENHANCE_YOUR_CALM";
+    case H2Error::inadequate_security:
+      return "INADEQUATE_SECURITY";
+    case H2Error::http_1_1_required:
+      return "HTTP_1_1_REQUIRED";
+  }
+  return "UNKNOWN";
+}
+
+FrameHeader parse_frame_header(const char* ptr) noexcept {
+  const auto* p = reinterpret_cast<const unsigned char*>(ptr);
+  FrameHeader h;
+  h.length = (uint32_t(p[0]) << 16) | (uint32_t(p[1]) << 8) | uint32_t(p[2]);
+  h.type = FrameType(p[3]);
+  h.flags = p[4];
+  h.stream_id = parse_uint32(ptr + 5) & 0x7fffffffU;
+  return h;
+}
+
+base::Result strip_padding(base::StringPiece* payload, const FrameHeader& h) {
+  if (!h.has(kFlagPadded)) return base::Result();
+  if (payload->empty())
+    return base::Result::invalid_argument("HTTP/2: missing pad length");
+  std::size_t pad = static_cast<unsigned char>((*payload)[0]);
+  payload->remove_prefix(1);
+  if (pad > payload->size())
+    return base::Result::invalid_argument("HTTP/2: padding exceeds payload");
+  payload->remove_suffix(pad);
+  return base::Result();
+}
+
+base::Result parse_priority(Priority* out, base::StringPiece* payload) {
+  if (payload->size() < 5)
+    return base::Result::invalid_argument("HTTP/2: short priority block");
+  uint32_t dep = parse_uint32(payload->data());
+  out->exclusive = (dep & 0x80000000U) != 0;
+  out->dependency = dep & 0x7fffffffU;
+  out->weight = uint16_t(static_cast<unsigned char>((*payload)[4])) + 1;
+  payload->remove_prefix(5);
+  return base::Result();
+}
+
+uint32_t parse_uint32(const char* ptr) noexcept {
+  const auto* p = reinterpret_cast<const unsigned char*>(ptr);
+  return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) |
+         (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+}
+
+static void append_uint32(std::string* out, uint32_t value) {
+  char buf[4];
+  buf[0] = char(value >> 24);
+  buf[1] = char(value >> 16);
+  buf[2] = char(value >> 8);
+  buf[3] = char(value);
+  out->append(buf, 4);
+}
+
+void append_frame_header(std::string* out, const FrameHeader& h) {
+  DCHECK_LE(h.length, kMaxMaxFrameSize);
+  char buf[kFrameHeaderSize];
+  buf[0] = char(h.length >> 16);
+  buf[1] = char(h.length >> 8);
+  buf[2] = char(h.length);
+  buf[3] = char(h.type);
+  buf[4] = char(h.flags);
+  out->append(buf, 5);
+  append_uint32(out, h.stream_id & 0x7fffffffU);
+}
+
+void append_data_frame(std::string* out, uint32_t stream_id,
+                       base::StringPiece data, bool end_stream) {
+  FrameHeader h;
+  h.length = data.size();
+  h.type = FrameType::data;
+  h.flags = end_stream ? kFlagEndStream : 0;
+  h.stream_id = stream_id;
+  append_frame_header(out, h);
+  out->append(data.data(), data.size());
+}
+
+void append_headers_frames(std::string* out, uint32_t stream_id,
+                           base::StringPiece block, bool end_stream,
+                           uint32_t max_frame_size) {
+  FrameHeader h;
+  h.type = FrameType::headers;
+  h.flags = end_stream ? kFlagEndStream : 0;
+  h.stream_id = stream_id;
+  do {
+    std::size_t n = std::min<std::size_t>(block.size(), max_frame_size);
+    h.length = n;
+    if (n == block.size()) h.flags |= kFlagEndHeaders;
+    append_frame_header(out, h);
+    out->append(block.data(), n);
+    block.remove_prefix(n);
+    h.type = FrameType::continuation;
+    h.flags = 0;
+  } while (!block.empty());
+}
+
+void append_settings_frame(std::string* out, const Setting* settings,
+                           std::size_t count) {
+  FrameHeader h;
+  h.length = count * 6;
+  h.type = FrameType::settings;
+  h.flags = 0;
+  h.stream_id = 0;
+  append_frame_header(out, h);
+  for (std::size_t i = 0; i < count; ++i) {
+    uint16_t id = uint16_t(settings[i].id);
+    out->push_back(char(id >> 8));
+    out->push_back(char(id));
+    append_uint32(out, settings[i].value);
+  }
+}
+
+void append_settings_ack_frame(std::string* out) {
+  FrameHeader h;
+  h.length = 0;
+  h.type = FrameType::settings;
+  h.flags = kFlagAck;
+  h.stream_id = 0;
+  append_frame_header(out, h);
+}
+
+void append_ping_frame(std::string* out, bool ack, const char* opaque8) {
+  FrameHeader h;
+  h.length = 8;
+  h.type = FrameType::ping;
+  h.flags = ack ? kFlagAck : 0;
+  h.stream_id = 0;
+  append_frame_header(out, h);
+  out->append(opaque8, 8);
+}
+
+void append_rst_stream_frame(std::string* out, uint32_t stream_id,
+                             H2Error code) {
+  FrameHeader h;
+  h.length = 4;
+  h.type = FrameType::rst_stream;
+  h.flags = 0;
+  h.stream_id = stream_id;
+  append_frame_header(out, h);
+  append_uint32(out, uint32_t(code));
+}
+
+void append_goaway_frame(std::string* out, uint32_t last_stream_id,
+                         H2Error code, base::StringPiece debug) {
+  FrameHeader h;
+  h.length = 8 + debug.size();
+  h.type = FrameType::goaway;
+  h.flags = 0;
+  h.stream_id = 0;
+  append_frame_header(out, h);
+  append_uint32(out, last_stream_id & 0x7fffffffU);
+  append_uint32(out, uint32_t(code));
+  out->append(debug.data(), debug.size());
+}
+
+void append_window_update_frame(std::string* out, uint32_t stream_id,
+                                uint32_t increment) {
+  DCHECK_GT(increment, 0U);
+  DCHECK_LE(increment, kMaxWindowSize);
+  FrameHeader h;
+  h.length = 4;
+  h.type = FrameType::window_update;
+  h.flags = 0;
+  h.stream_id = stream_id;
+  append_frame_header(out, h);
+  append_uint32(out, increment);
+}
+
+}  // namespace http
+}  // namespace net
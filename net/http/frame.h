@@ -0,0 +1,168 @@
+// net/http/frame.h - HTTP/2 frame encoding and decoding
+// Copyright © 2017 by Donald King <chronos@chronos-tachyon.net>
+// Available under the MIT License. See LICENSE for details.
+
+#ifndef NET_HTTP_FRAME_H
+#define NET_HTTP_FRAME_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "base/result.h"
+#include "base/strings.h"
+
+namespace net {
+namespace http {
+
+// The connection preface that HTTP/2 clients send first, per RFC 7540
+// section 3.5.
+extern const char kClientPreface[];
+constexpr std::size_t kClientPrefaceSize = 24;
+
+// The size of the fixed header that starts every frame.
+constexpr std::size_t kFrameHeaderSize = 9;
+
+// Limits from RFC 7540 sections 4.2 and 6.9.
+constexpr uint32_t kDefaultMaxFrameSize = 16384;
+constexpr uint32_t kMaxMaxFrameSize = (1U << 24) - 1;
+constexpr uint32_t kDefaultWindowSize = 65535;
+constexpr uint32_t kMaxWindowSize = 0x7fffffffU;
+
+// Frame types, per RFC 7540 section 6.
+enum class FrameType : uint8_t {
+  data = 0x0,
+  headers = 0x1,
+  priority = 0x2,
+  rst_stream = 0x3,
+  settings = 0x4,
+  push_promise = 0x5,
+  ping = 0x6,
+  goaway = 0x7,
+  window_update = 0x8,
+  continuation = 0x9,
+};
+
+// Frame flags.  Which ones apply depends on the frame type.
+constexpr uint8_t kFlagEndStream = 0x01;   // DATA, HEADERS
+constexpr uint8_t kFlagAck = 0x01;         // SETTINGS, PING
+constexpr uint8_t kFlagEndHeaders = 0x04;  // HEADERS, CONTINUATION
+constexpr uint8_t kFlagPadded = 0x08;      // DATA, HEADERS
+constexpr uint8_t kFlagPriority = 0x20;    // HEADERS
+
+// Error codes for RST_STREAM and GOAWAY, per RFC 7540 section 7.
+enum class H2Error : uint32_t {
+  no_error = 0x0,
+  protocol_error = 0x1,
+  internal_error = 0x2,
+  flow_control_error = 0x3,
+  settings_timeout = 0x4,
+  stream_closed = 0x5,
+  frame_size_error = 0x6,
+  refused_stream = 0x7,
+  cancel = 0x8,
+  compression_error = 0x9,
+  connect_error = 0xa,
+  enhance_your_calm = 0xb,
+  inadequate_security = 0xc,
+  http_1_1_required = 0xd,
+};
+
+// Returns the RFC name of |code|, e.g. "PROTOCOL_ERROR".
+const char* h2_error_name(H2Error code) noexcept;
+
+// Settings parameters, per RFC 7540 section 6.5.2.
+enum class SettingId : uint16_t {
+  header_table_size = 0x1,
+  enable_push = 0x2,
+  max_concurrent_streams = 0x3,
+  initial_window_size = 0x4,
+  max_frame_size = 0x5,
+  max_header_list_size = 0x6,
+};
+
+struct Setting {
+  SettingId id;
+  uint32_t value;
+};
+
+// FrameHeader is the fixed 9-byte header of a frame.
+struct FrameHeader {
+  uint32_t length;  // of the payload, 24 bits
+  FrameType type;
+  uint8_t flags;
+  uint32_t stream_id;  // 31 bits
+
+  bool has(uint8_t flag) const noexcept { return (flags & flag) != 0; }
+};
+
+// Priority is the stream dependency and weight carried by PRIORITY frames
+// and by HEADERS frames with the PRIORITY flag.
+struct Priority {
+  uint32_t dependency;
+  uint16_t weight;  // 1 to 256
+  bool exclusive;
+};
+
+// Decodes the frame header in the kFrameHeaderSize bytes at |ptr|.  The
+// reserved bit of the stream identifier is ignored.
+FrameHeader parse_frame_header(const char* ptr) noexcept;
+
+// Removes the padding from the payload of a DATA or HEADERS frame, if the
+// PADDED flag is set.
+// - Returns INVALID_ARGUMENT if the padding is longer than the payload
+base::Result strip_padding(base::StringPiece* payload, const FrameHeader& h);
+
+// Removes the 5-byte priority block from the front of |*payload|.
+// - Returns INVALID_ARGUMENT if |*payload| is too short
+base::Result parse_priority(Priority* out, base::StringPiece* payload);
+
+// Decodes the payload of a SETTINGS frame, calling |fn| for each parameter.
+// - Returns INVALID_ARGUMENT if the length isn't a multiple of 6
+template <typename Fn>
+base::Result parse_settings(base::StringPiece payload, Fn fn) {
+  if (payload.size() % 6 != 0)
+    return base::Result::invalid_argument("HTTP/2: bad SETTINGS length");
+  const auto* p = reinterpret_cast<const unsigned char*>(payload.data());
+  for (std::size_t i = 0; i < payload.size(); i += 6, p += 6) {
+    Setting s;
+    s.id = SettingId((uint16_t(p[0]) << 8) | p[1]);
+    s.value = (uint32_t(p[2]) << 24) | (uint32_t(p[3]) << 16) |
+              (uint32_t(p[4]) << 8) | uint32_t(p[5]);
+    fn(s);
+  }
+  return base::Result();
+}
+
+// Decodes a 32-bit big-endian value, as used by RST_STREAM, GOAWAY, and
+// WINDOW_UPDATE payloads.  |ptr| MUST point to at least 4 bytes.
+uint32_t parse_uint32(const char* ptr) noexcept;
+
+// The append_*_frame() functions encode a whole frame onto the end of |out|.
+
+void append_frame_header(std::string* out, const FrameHeader& h);
+
+void append_data_frame(std::string* out, uint32_t stream_id,
+                       base::StringPiece data, bool end_stream);
+
+// Appends a HEADERS frame, plus as many CONTINUATION frames as it takes to
+// carry |block| in frames of at most |max_frame_size| bytes.
+void append_headers_frames(std::string* out, uint32_t stream_id,
+                           base::StringPiece block, bool end_stream,
+                           uint32_t max_frame_size);
+
+void append_settings_frame(std::string* out, const Setting* settings,
+                           std::size_t count);
+void append_settings_ack_frame(std::string* out);
+void append_ping_frame(std::string* out, bool ack, const char* opaque8);
+void append_rst_stream_frame(std::string* out, uint32_t stream_id,
+                             H2Error code);
+void append_goaway_frame(std::string* out, uint32_t last_stream_id,
+                         H2Error code, base::StringPiece debug);
+void append_window_update_frame(std::string* out, uint32_t stream_id,
+                                uint32_t increment);
+
+}  // namespace http
+}  // namespace net
+
+#endif  // NET_HTTP_FRAME_H
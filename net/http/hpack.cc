@@ -0,0 +1,562 @@
+// Copyright © 2017 by Donald King <chronos@chronos-tachyon.net>
+// Available under the MIT License. See LICENSE for details.
+
+#include "net/http/hpack.h"
+
+#include <algorithm>
+#include <array>
+
+#include "base/logging.h"
+
+namespace net {
+namespace http {
+
+namespace {
+
+struct HuffmanCode {
+  uint32_t code;
+  uint8_t bits;
+};
+
+// RFC 7541 Appendix B, indexed by symbol.  Symbol 256 is EOS.
+const HuffmanCode kHuffmanCodes[257] = {
+    {0x1ff8, 13},     {0x7fffd8, 23},   {0xfffffe2, 28},  {0xfffffe3, 28},
+    {0xfffffe4, 28},  {0xfffffe5, 28},  {0xfffffe6, 28},  {0xfffffe7, 28},
+    {0xfffffe8, 28},  {0xffffea, 24},   {0x3ffffffc, 30}, {0xfffffe9, 28},
+    {0xfffffea, 28},  {0x3ffffffd, 30}, {0xfffffeb, 28},  {0xfffffec, 28},
+    {0xfffffed, 28},  {0xfffffee, 28},  {0xfffffef, 28},  {0xffffff0, 28},
+    {0xffffff1, 28},  {0xffffff2, 28},  {0x3ffffffe, 30}, {0xffffff3, 28},
+    {0xffffff4, 28},  {0xffffff5, 28},  {0xffffff6, 28},  {0xffffff7, 28},
+    {0xffffff8, 28},  {0xffffff9, 28},  {0xffffffa, 28},  {0xffffffb, 28},
+    {0x14, 6},        {0x3f8, 10},      {0x3f9, 10},      {0xffa, 12},
+    {0x1ff9, 13},     {0x15, 6},        {0xf8, 8},        {0x7fa, 11},
+    {0x3fa, 10},      {0x3fb, 10},      {0xf9, 8},        {0x7fb, 11},
+    {0xfa, 8},        {0x16, 6},        {0x17, 6},        {0x18, 6},
+    {0x0, 5},         {0x1, 5},         {0x2, 5},         {0x19, 6},
+    {0x1a, 6},        {0x1b, 6},        {0x1c, 6},        {0x1d, 6},
+    {0x1e, 6},        {0x1f, 6},        {0x5c, 7},        {0xfb, 8},
+    {0x7ffc, 15},     {0x20, 6},        {0xffb, 12},      {0x3fc, 10},
+    {0x1ffa, 13},     {0x21, 6},        {0x5d, 7},        {0x5e, 7},
+    {0x5f, 7},        {0x60, 7},        {0x61, 7},        {0x62, 7},
+    {0x63, 7},        {0x64, 7},        {0x65, 7},        {0x66, 7},
+    {0x67, 7},        {0x68, 7},        {0x69, 7},        {0x6a, 7},
+    {0x6b, 7},        {0x6c, 7},        {0x6d, 7},        {0x6e, 7},
+    {0x6f, 7},        {0x70, 7},        {0x71, 7},        {0x72, 7},
+    {0xfc, 8},        {0x73, 7},        {0xfd, 8},        {0x1ffb, 13},
+    {0x7fff0, 19},    {0x1ffc, 13},     {0x3ffc, 14},     {0x22, 6},
+    {0x7ffd, 15},     {0x3, 5},         {0x23, 6},        {0x4, 5},
+    {0x24, 6},        {0x5, 5},         {0x25, 6},        {0x26, 6},
+    {0x27, 6},        {0x6, 5},         {0x74, 7},        {0x75, 7},
+    {0x28, 6},        {0x29, 6},        {0x2a, 6},        {0x7, 5},
+    {0x2b, 6},        {0x76, 7},        {0x2c, 6},        {0x8, 5},
+    {0x9, 5},         {0x2d, 6},        {0x77, 7},        {0x78, 7},
+    {0x79, 7},        {0x7a, 7},        {0x7b, 7},        {0x7ffe, 15},
+    {0x7fc, 11},      {0x3ffd, 14},     {0x1ffd, 13},     {0xffffffc, 28},
+    {0xfffe6, 20},    {0x3fffd2, 22},   {0xfffe7, 20},    {0xfffe8, 20},
+    {0x3fffd3, 22},   {0x3fffd4, 22},   {0x3fffd5, 22},   {0x7fffd9, 23},
+    {0x3fffd6, 22},   {0x7fffda, 23},   {0x7fffdb, 23},   {0x7fffdc, 23},
+    {0x7fffdd, 23},   {0x7fffde, 23},   {0xffffeb, 24},   {0x7fffdf, 23},
+    {0xffffec, 24},   {0xffffed, 24},   {0x3fffd7, 22},   {0x7fffe0, 23},
+    {0xffffee, 24},   {0x7fffe1, 23},   {0x7fffe2, 23},   {0x7fffe3, 23},
+    {0x7fffe4, 23},   {0x1fffdc, 21},   {0x3fffd8, 22},   {0x7fffe5, 23},
+    {0x3fffd9, 22},   {0x7fffe6, 23},   {0x7fffe7, 23},   {0xffffef, 24},
+    {0x3fffda, 22},   {0x1fffdd, 21},   {0xfffe9, 20},    {0x3fffdb, 22},
+    {0x3fffdc, 22},   {0x7fffe8, 23},   {0x7fffe9, 23},   {0x1fffde, 21},
+    {0x7fffea, 23},   {0x3fffdd, 22},   {0x3fffde, 22},   {0xfffff0, 24},
+    {0x1fffdf, 21},   {0x3fffdf, 22},   {0x7fffeb, 23},   {0x7fffec, 23},
+    {0x1fffe0, 21},   {0x1fffe1, 21},   {0x3fffe0, 22},   {0x1fffe2, 21},
+    {0x7fffed, 23},   {0x3fffe1, 22},   {0x7fffee, 23},   {0x7fffef, 23},
+    {0xfffea, 20},    {0x3fffe2, 22},   {0x3fffe3, 22},   {0x3fffe4, 22},
+    {0x7ffff0, 23},   {0x3fffe5, 22},   {0x3fffe6, 22},   {0x7ffff1, 23},
+    {0x3ffffe0, 26},  {0x3ffffe1, 26},  {0xfffeb, 20},    {0x7fff1, 19},
+    {0x3fffe7, 22},   {0x7ffff2, 23},   {0x3fffe8, 22},   {0x1ffffec, 25},
+    {0x3ffffe2, 26},  {0x3ffffe3, 26},  {0x3ffffe4, 26},  {0x7ffffde, 27},
+    {0x7ffffdf, 27},  {0x3ffffe5, 26},  {0xfffff1, 24},   {0x1ffffed, 25},
+    {0x7fff2, 19},    {0x1fffe3, 21},   {0x3ffffe6, 26},  {0x7ffffe0, 27},
+    {0x7ffffe1, 27},  {0x3ffffe7, 26},  {0x7ffffe2, 27},  {0xfffff2, 24},
+    {0x1fffe4, 21},   {0x1fffe5, 21},   {0x3ffffe8, 26},  {0x3ffffe9, 26},
+    {0xffffffd, 28},  {0x7ffffe3, 27},  {0x7ffffe4, 27},  {0x7ffffe5, 27},
+    {0xfffec, 20},    {0xfffff3, 24},   {0xfffed, 20},    {0x1fffe6, 21},
+    {0x3fffe9, 22},   {0x1fffe7, 21},   {0x1fffe8, 21},   {0x7ffff3, 23},
+    {0x3fffea, 22},   {0x3fffeb, 22},   {0x1ffffee, 25},  {0x1ffffef, 25},
+    {0xfffff4, 24},   {0xfffff5, 24},   {0x3ffffea, 26},  {0x7ffff4, 23},
+    {0x3ffffeb, 26},  {0x7ffffe6, 27},  {0x3ffffec, 26},  {0x3ffffed, 26},
+    {0x7ffffe7, 27},  {0x7ffffe8, 27},  {0x7ffffe9, 27},  {0x7ffffea, 27},
+    {0x7ffffeb, 27},  {0xffffffe, 28},  {0x7ffffec, 27},  {0x7ffffed, 27},
+    {0x7ffffee, 27},  {0x7ffffef, 27},  {0x7fffff0, 27},  {0x3ffffee, 26},
+    {0x3fffffff, 30},
+};
+
+constexpr unsigned kMinCodeBits = 5;
+constexpr unsigned kMaxCodeBits = 30;
+constexpr uint16_t kEOS = 256;
+
+// The code is canonical, so the codes of each length are consecutive and
+// can be decoded by comparing against the first code of each length.
+struct HuffmanDecodeTable {
+  std::array<uint32_t, kMaxCodeBits + 1> first_code;
+  std::array<uint16_t, kMaxCodeBits + 1> first_index;
+  std::array<uint16_t, kMaxCodeBits + 1> count;
+  std::array<uint16_t, 257> symbols;  // ordered by (bits, code)
+
+  HuffmanDecodeTable() {
+    first_code.fill(0);
+    first_index.fill(0);
+    count.fill(0);
+    for (uint16_t i = 0; i < 257; ++i) symbols[i] = i;
+    std::sort(symbols.begin(), symbols.end(), [](uint16_t a, uint16_t b) {
+      const auto& x = kHuffmanCodes[a];
+      const auto& y = kHuffmanCodes[b];
+      return x.bits < y.bits || (x.bits == y.bits && x.code < y.code);
+    });
+    for (uint16_t i = 257; i > 0; --i) {
+      const auto& hc = kHuffmanCodes[symbols[i - 1]];
+      first_code[hc.bits] = hc.code;
+      first_index[hc.bits] = i - 1;
+      ++count[hc.bits];
+    }
+  }
+};
+
+const HuffmanDecodeTable& huffman_decode_table() {
+  static const HuffmanDecodeTable* const table = new HuffmanDecodeTable;
+  return *table;
+}
+
+// RFC 7541 Appendix A.
+const HeaderField kStaticTable[] = {
+    {":authority", ""},
+    {":method", "GET"},
+    {":method", "POST"},
+    {":path", "/"},
+    {":path", "/index.html"},
+    {":scheme", "http"},
+    {":scheme", "https"},
+    {":status", "200"},
+    {":status", "204"},
+    {":status", "206"},
+    {":status", "304"},
+    {":status", "400"},
+    {":status", "404"},
+    {":status", "500"},
+    {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""},
+    {"accept-ranges", ""},
+    {"accept", ""},
+    {"access-control-allow-origin", ""},
+    {"age", ""},
+    {"allow", ""},
+    {"authorization", ""},
+    {"cache-control", ""},
+    {"content-disposition", ""},
+    {"content-encoding", ""},
+    {"content-language", ""},
+    {"content-length", ""},
+    {"content-location", ""},
+    {"content-range", ""},
+    {"content-type", ""},
+    {"cookie", ""},
+    {"date", ""},
+    {"etag", ""},
+    {"expect", ""},
+    {"expires", ""},
+    {"from", ""},
+    {"host", ""},
+    {"if-match", ""},
+    {"if-modified-since", ""},
+    {"if-none-match", ""},
+    {"if-range", ""},
+    {"if-unmodified-since", ""},
+    {"last-modified", ""},
+    {"link", ""},
+    {"location", ""},
+    {"max-forwards", ""},
+    {"proxy-authenticate", ""},
+    {"proxy-authorization", ""},
+    {"range", ""},
+    {"referer", ""},
+    {"refresh", ""},
+    {"retry-after", ""},
+    {"server", ""},
+    {"set-cookie", ""},
+    {"strict-transport-security", ""},
+    {"transfer-encoding", ""},
+    {"user-agent", ""},
+    {"vary", ""},
+    {"via", ""},
+    {"www-authenticate", ""},
+};
+
+constexpr std::size_t kStaticTableSize =
+    sizeof(kStaticTable) / sizeof(kStaticTable[0]);
+
+// The overhead per entry, per RFC 7541 section 4.1.
+constexpr std::size_t kEntryOverhead = 32;
+
+std::size_t entry_size(base::StringPiece name, base::StringPiece value) {
+  return name.size() + value.size() + kEntryOverhead;
+}
+
+std::string field_key(base::StringPiece name, base::StringPiece value) {
+  std::string key;
+  key.reserve(name.size() + 1 + value.size());
+  key.append(name.data(), name.size());
+  key.push_back('\0');
+  key.append(value.data(), value.size());
+  return key;
+}
+
+struct StaticIndex {
+  std::unordered_map<std::string, std::size_t> by_name;
+  std::unordered_map<std::string, std::size_t> by_field;
+
+  StaticIndex() {
+    for (std::size_t i = kStaticTableSize; i > 0; --i) {
+      const auto& f = kStaticTable[i - 1];
+      by_name[f.first] = i;
+      by_field[field_key(f.first, f.second)] = i;
+    }
+  }
+};
+
+const StaticIndex& static_index() {
+  static const StaticIndex* const index = new StaticIndex;
+  return *index;
+}
+
+// Integers use the prefix coding of RFC 7541 section 5.1.
+void append_integer(std::string* out, uint8_t first, unsigned prefix_bits,
+                    uint64_t value) {
+  const uint64_t max = (1U << prefix_bits) - 1;
+  if (value < max) {
+    out->push_back(char(first | value));
+    return;
+  }
+  out->push_back(char(first | max));
+  value -= max;
+  while (value >= 128) {
+    out->push_back(char(0x80 | (value & 0x7f)));
+    value >>= 7;
+  }
+  out->push_back(char(value));
+}
+
+base::Result parse_integer(uint64_t* out, base::StringPiece* in,
+                           unsigned prefix_bits) {
+  if (in->empty()) return base::Result::invalid_argument("HPACK: truncated");
+  const uint64_t max = (1U << prefix_bits) - 1;
+  uint64_t value = static_cast<unsigned char>((*in)[0]) & max;
+  in->remove_prefix(1);
+  if (value == max) {
+    unsigned shift = 0;
+    while (true) {
+      if (in->empty())
+        return base::Result::invalid_argument("HPACK: truncated integer");
+      if (shift > 28)
+        return base::Result::invalid_argument("HPACK: integer too large");
+      unsigned char ch = (*in)[0];
+      in->remove_prefix(1);
+      value += uint64_t(ch & 0x7f) << shift;
+      shift += 7;
+      if ((ch & 0x80) == 0) break;
+    }
+  }
+  *out = value;
+  return base::Result();
+}
+
+void append_string(std::string* out, base::StringPiece str) {
+  std::size_t hlen = huffman_encoded_length(str);
+  if (hlen < str.size()) {
+    append_integer(out, 0x80, 7, hlen);
+    huffman_encode(out, str);
+  } else {
+    append_integer(out, 0x00, 7, str.size());
+    out->append(str.data(), str.size());
+  }
+}
+
+base::Result parse_string(std::string* out, base::StringPiece* in) {
+  if (in->empty()) return base::Result::invalid_argument("HPACK: truncated");
+  bool huffman = ((*in)[0] & 0x80) != 0;
+  uint64_t len;
+  base::Result r = parse_integer(&len, in, 7);
+  if (!r) return r;
+  if (len > in->size())
+    return base::Result::invalid_argument("HPACK: string overruns block");
+  base::StringPiece str = in->substring(0, len);
+  in->remove_prefix(len);
+  out->clear();
+  if (huffman) return huffman_decode(out, str);
+  out->assign(str.data(), str.size());
+  return base::Result();
+}
+
+}  // anonymous namespace
+
+void huffman_encode(std::string* out, base::StringPiece in) {
+  uint64_t acc = 0;
+  unsigned bits = 0;
+  for (unsigned char ch : in) {
+    const auto& hc = kHuffmanCodes[ch];
+    acc = (acc << hc.bits) | hc.code;
+    bits += hc.bits;
+    while (bits >= 8) {
+      bits -= 8;
+      out->push_back(char(acc >> bits));
+    }
+  }
+  // Pad with the most significant bits of EOS, which are all ones.
+  if (bits > 0) out->push_back(char((acc << (8 - bits)) | (0xff >> bits)));
+}
+
+std::size_t huffman_encoded_length(base::StringPiece in) noexcept {
+  std::size_t bits = 0;
+  for (unsigned char ch : in) bits += kHuffmanCodes[ch].bits;
+  return (bits + 7) / 8;
+}
+
+base::Result huffman_decode(std::string* out, base::StringPiece in) {
+  const auto& table = huffman_decode_table();
+  uint64_t acc = 0;  // left-aligned
+  unsigned bits = 0;
+  std::size_t i = 0;
+  out->reserve(out->size() + in.size() * 8 / kMinCodeBits);
+  while (true) {
+    while (bits <= 56 && i < in.size()) {
+      acc |= uint64_t(static_cast<unsigned char>(in[i])) << (56 - bits);
+      bits += 8;
+      ++i;
+    }
+    if (bits == 0) break;
+
+    bool found = false;
+    for (unsigned len = kMinCodeBits; len <= kMaxCodeBits && len <= bits;
+         ++len) {
+      uint32_t code = acc >> (64 - len);
+      uint32_t k = code - table.first_code[len];
+      if (k < table.count[len]) {
+        uint16_t sym = table.symbols[table.first_index[len] + k];
+        if (sym == kEOS)
+          return base::Result::invalid_argument("HPACK: EOS in Huffman string");
+        out->push_back(char(sym));
+        acc <<= len;
+        bits -= len;
+        found = true;
+        break;
+      }
+    }
+    if (found) continue;
+
+    // What's left has to be padding: fewer than 8 bits, all ones.
+    uint64_t ones = (uint64_t(1) << bits) - 1;
+    if (bits > 7 || (acc >> (64 - bits)) != ones)
+      return base::Result::invalid_argument("HPACK: bad Huffman padding");
+    break;
+  }
+  return base::Result();
+}
+
+void HeaderTable::set_max_size(std::size_t max_size) {
+  max_size_ = max_size;
+  while (size_ > max_size_) evict();
+}
+
+void HeaderTable::add(std::string name, std::string value) {
+  std::size_t n = entry_size(name, value);
+  while (!entries_.empty() && size_ + n > max_size_) evict();
+  if (n > max_size_) return;
+  if (lookup_) {
+    by_field_[field_key(name, value)] = inserted_;
+    by_name_[name] = inserted_;
+  }
+  entries_.emplace_front(std::move(name), std::move(value));
+  size_ += n;
+  ++inserted_;
+}
+
+void HeaderTable::evict() {
+  DCHECK(!entries_.empty());
+  const auto& f = entries_.back();
+  if (lookup_) {
+    // Only forget the entry if a newer one hasn't replaced it in the index.
+    uint64_t seq = inserted_ - entries_.size();
+    auto it = by_field_.find(field_key(f.first, f.second));
+    if (it != by_field_.end() && it->second == seq) by_field_.erase(it);
+    auto jt = by_name_.find(f.first);
+    if (jt != by_name_.end() && jt->second == seq) by_name_.erase(jt);
+  }
+  size_ -= entry_size(f.first, f.second);
+  entries_.pop_back();
+}
+
+std::size_t HeaderTable::find(bool* name_only, base::StringPiece name,
+                              base::StringPiece value) const {
+  DCHECK(lookup_);
+  auto it = by_field_.find(field_key(name, value));
+  if (it != by_field_.end()) {
+    *name_only = false;
+    return inserted_ - it->second;
+  }
+  auto jt = by_name_.find(name.as_string());
+  if (jt != by_name_.end()) {
+    *name_only = true;
+    return inserted_ - jt->second;
+  }
+  return 0;
+}
+
+void HPackDecoder::set_max_table_size(std::size_t n) {
+  max_table_size_ = n;
+  if (table_.max_size() > n) table_.set_max_size(n);
+}
+
+base::Result HPackDecoder::lookup(const HeaderField** out,
+                                  uint64_t index) const {
+  if (index == 0)
+    return base::Result::invalid_argument("HPACK: index 0");
+  if (index <= kStaticTableSize) {
+    *out = &kStaticTable[index - 1];
+    return base::Result();
+  }
+  index -= kStaticTableSize;
+  if (index > table_.count())
+    return base::Result::invalid_argument("HPACK: index out of range");
+  *out = &table_.at(index);
+  return base::Result();
+}
+
+base::Result HPackDecoder::decode(std::vector<HeaderField>* out,
+                                  bool* too_big, base::StringPiece block,
+                                  std::size_t max_list_size) {
+  *too_big = false;
+  std::size_t list_size = 0;
+  bool first = true;
+  std::string name, value;
+  base::Result r;
+  while (!block.empty()) {
+    unsigned char ch = block[0];
+    uint64_t index;
+    bool add = false;
+
+    if (ch & 0x80) {
+      // Indexed Header Field
+      r = parse_integer(&index, &block, 7);
+      if (!r) return r;
+      const HeaderField* f;
+      r = lookup(&f, index);
+      if (!r) return r;
+      name = f->first;
+      value = f->second;
+    } else if ((ch & 0xe0) == 0x20) {
+      // Dynamic Table Size Update
+      if (!first)
+        return base::Result::invalid_argument(
+            "HPACK: table size update after first field");
+      uint64_t size;
+      r = parse_integer(&size, &block, 5);
+      if (!r) return r;
+      if (size > max_table_size_)
+        return base::Result::invalid_argument("HPACK: table size too large");
+      table_.set_max_size(size);
+      continue;
+    } else {
+      // Literal Header Field, with or without indexing
+      unsigned prefix = 4;
+      if ((ch & 0xc0) == 0x40) {
+        prefix = 6;
+        add = true;
+      }
+      r = parse_integer(&index, &block, prefix);
+      if (!r) return r;
+      if (index != 0) {
+        const HeaderField* f;
+        r = lookup(&f, index);
+        if (!r) return r;
+        name = f->first;
+      } else {
+        r = parse_string(&name, &block);
+        if (!r) return r;
+      }
+      r = parse_string(&value, &block);
+      if (!r) return r;
+    }
+    first = false;
+
+    list_size += entry_size(name, value);
+    if (list_size > max_list_size) *too_big = true;
+    if (add) table_.add(name, value);
+    if (!*too_big) out->emplace_back(std::move(name), std::move(value));
+  }
+  return base::Result();
+}
+
+HPackEncoder::HPackEncoder()
+    : table_(kDefaultHeaderTableSize),
+      pending_size_(kDefaultHeaderTableSize),
+      min_size_(kDefaultHeaderTableSize),
+      size_changed_(false) {
+  table_.enable_lookup();
+}
+
+void HPackEncoder::set_max_table_size(std::size_t n) {
+  n = std::min(n, kDefaultHeaderTableSize);
+  if (n == pending_size_) return;
+  pending_size_ = n;
+  min_size_ = std::min(min_size_, n);
+  size_changed_ = true;
+}
+
+void HPackEncoder::begin_block(std::string* out) {
+  if (!size_changed_) return;
+  // RFC 7541 section 4.2: if the size shrank and grew again, the smallest
+  // size has to be signalled first.
+  if (min_size_ < pending_size_) {
+    append_integer(out, 0x20, 5, min_size_);
+    table_.set_max_size(min_size_);
+  }
+  append_integer(out, 0x20, 5, pending_size_);
+  table_.set_max_size(pending_size_);
+  min_size_ = pending_size_;
+  size_changed_ = false;
+}
+
+void HPackEncoder::encode(std::string* out, base::StringPiece name,
+                          base::StringPiece value, bool sensitive) {
+  const auto& si = static_index();
+  std::size_t name_index = 0;
+
+  if (!sensitive) {
+    auto it = si.by_field.find(field_key(name, value));
+    if (it != si.by_field.end()) {
+      append_integer(out, 0x80, 7, it->second);
+      return;
+    }
+    bool name_only;
+    std::size_t index = table_.find(&name_only, name, value);
+    if (index != 0 && !name_only) {
+      append_integer(out, 0x80, 7, kStaticTableSize + index);
+      return;
+    }
+    if (index != 0) name_index = kStaticTableSize + index;
+  }
+  auto it = si.by_name.find(name.as_string());
+  if (it != si.by_name.end()) name_index = it->second;
+
+  // Entries larger than a quarter of the table would push out too much.
+  const bool add =
+      !sensitive && entry_size(name, value) <= table_.max_size() / 4;
+  if (add)
+    append_integer(out, 0x40, 6, name_index);
+  else if (sensitive)
+    append_integer(out, 0x10, 4, name_index);
+  else
+    append_integer(out, 0x00, 4, name_index);
+  if (name_index == 0) append_string(out, name);
+  append_string(out, value);
+  if (add) table_.add(name.as_string(), value.as_string());
+}
+
+}  // namespace http
+}  // namespace net
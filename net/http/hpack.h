@@ -0,0 +1,168 @@
+// net/http/hpack.h - HPACK header compression for HTTP/2
+// Copyright © 2017 by Donald King <chronos@chronos-tachyon.net>
+// Available under the MIT License. See LICENSE for details.
+
+#ifndef NET_HTTP_HPACK_H
+#define NET_HTTP_HPACK_H
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "base/result.h"
+#include "base/strings.h"
+
+namespace net {
+namespace http {
+
+// HeaderField is a decoded header field, e.g. {":method", "GET"}.
+using HeaderField = std::pair<std::string, std::string>;
+
+// The default size of an HPACK dynamic table, per RFC 7541 section 4.2.
+constexpr std::size_t kDefaultHeaderTableSize = 4096;
+
+// Appends the Huffman coding of |in| to |out|, per RFC 7541 section 5.2.
+void huffman_encode(std::string* out, base::StringPiece in);
+
+// Returns the length in bytes of the Huffman coding of |in|.
+std::size_t huffman_encoded_length(base::StringPiece in) noexcept;
+
+// Appends the decoding of the Huffman-coded string |in| to |out|.
+// - Returns INVALID_ARGUMENT if |in| is malformed, e.g. if it contains EOS
+//   or its padding is not a prefix of EOS
+base::Result huffman_decode(std::string* out, base::StringPiece in);
+
+// HeaderTable is the dynamic table of RFC 7541 section 2.3.2.
+//
+// THREAD SAFETY: This class is NOT thread-safe.
+//
+class HeaderTable {
+ public:
+  explicit HeaderTable(std::size_t max_size = kDefaultHeaderTableSize)
+      : max_size_(max_size), size_(0), inserted_(0) {}
+
+  // Returns the number of entries in the table.
+  std::size_t count() const noexcept { return entries_.size(); }
+
+  // Returns the size of the table, as defined in RFC 7541 section 4.1.
+  std::size_t size() const noexcept { return size_; }
+
+  std::size_t max_size() const noexcept { return max_size_; }
+
+  // Changes the maximum size, evicting entries as needed.
+  void set_max_size(std::size_t max_size);
+
+  // Adds an entry, evicting old entries as needed.  An entry larger than
+  // |max_size()| empties the table.
+  void add(std::string name, std::string value);
+
+  // Returns the entry at |index|, where 1 is the most recently added.
+  // |index| MUST be in the range [1, count()].
+  const HeaderField& at(std::size_t index) const {
+    return entries_[index - 1];
+  }
+
+  // Looks for an entry with the given name and value.
+  // - Returns the index of an exact match, setting |*name_only| to false
+  // - Else returns the index of an entry with the same name, setting
+  //   |*name_only| to true
+  // - Else returns 0
+  // Only maintained if |enable_lookup()| was called while empty.
+  std::size_t find(bool* name_only, base::StringPiece name,
+                   base::StringPiece value) const;
+
+  // Enables |find()|, at the cost of an index kept up to date.
+  void enable_lookup() noexcept { lookup_ = true; }
+
+ private:
+  void evict();
+
+  std::deque<HeaderField> entries_;  // newest first
+  std::size_t max_size_;
+  std::size_t size_;
+  uint64_t inserted_;
+  bool lookup_ = false;
+
+  // Keyed by name, and by name + '\0' + value; maps to the insertion
+  // number of the newest such entry.
+  std::unordered_map<std::string, uint64_t> by_name_;
+  std::unordered_map<std::string, uint64_t> by_field_;
+};
+
+// HPackDecoder decodes header blocks, per RFC 7541.  Blocks MUST be decoded
+// in the order received, as each one may change the dynamic table.
+//
+// THREAD SAFETY: This class is NOT thread-safe.
+//
+class HPackDecoder {
+ public:
+  HPackDecoder() noexcept : table_(kDefaultHeaderTableSize),
+                            max_table_size_(kDefaultHeaderTableSize) {}
+
+  // Sets the largest dynamic table size that the encoder may choose, i.e.
+  // the SETTINGS_HEADER_TABLE_SIZE that was sent to it.
+  void set_max_table_size(std::size_t n);
+
+  // Decodes the header block |block|, appending the fields to |out|.
+  // - If the decoded size of the fields, as defined for
+  //   SETTINGS_MAX_HEADER_LIST_SIZE, would exceed |max_list_size|, then
+  //   decoding continues but the fields are dropped and |*too_big| is set
+  // - Returns INVALID_ARGUMENT if |block| is malformed; this is a
+  //   COMPRESSION_ERROR that leaves the decoder unusable
+  base::Result decode(std::vector<HeaderField>* out, bool* too_big,
+                      base::StringPiece block, std::size_t max_list_size);
+
+  const HeaderTable& table() const noexcept { return table_; }
+
+ private:
+  base::Result lookup(const HeaderField** out, uint64_t index) const;
+
+  HeaderTable table_;
+  std::size_t max_table_size_;
+};
+
+// HPackEncoder encodes header blocks, per RFC 7541.  Blocks MUST be sent in
+// the order encoded, as each one may change the dynamic table.
+//
+// Fields are added to the dynamic table unless they are sensitive or too
+// large to be worth it, and strings are Huffman-coded whenever that makes
+// them shorter.
+//
+// THREAD SAFETY: This class is NOT thread-safe.
+//
+class HPackEncoder {
+ public:
+  HPackEncoder();
+
+  // Sets the largest dynamic table size, i.e. the SETTINGS_HEADER_TABLE_SIZE
+  // received from the decoder, capped at kDefaultHeaderTableSize.  The
+  // change is signalled at the start of the next block.
+  void set_max_table_size(std::size_t n);
+
+  // Starts a new header block in |out|.
+  void begin_block(std::string* out);
+
+  // Appends the encoding of one field of the current block to |out|.
+  // |name| MUST already be lowercase.
+  // - If |sensitive|, the field is encoded as never-indexed, per RFC 7541
+  //   section 7.1.3
+  void encode(std::string* out, base::StringPiece name,
+              base::StringPiece value, bool sensitive = false);
+
+  const HeaderTable& table() const noexcept { return table_; }
+
+ private:
+  HeaderTable table_;
+  std::size_t pending_size_;  // the size to signal in the next block
+  std::size_t min_size_;      // the smallest size since the last block
+  bool size_changed_;
+};
+
+}  // namespace http
+}  // namespace net
+
+#endif  // NET_HTTP_HPACK_H
@@ -0,0 +1,236 @@
+// Copyright © 2017 by Donald King <chronos@chronos-tachyon.net>
+// Available under the MIT License. See LICENSE for details.
+
+#include "gtest/gtest.h"
+
+#include <string>
+#include <vector>
+
+#include "base/result_testing.h"
+#include "net/http/hpack.h"
+
+using net::http::HeaderField;
+
+static std::string unhex(const char* hex) {
+  std::string out;
+  int nibble = -1;
+  for (const char* p = hex; *p; ++p) {
+    int v;
+    if (*p >= '0' && *p <= '9')
+      v = *p - '0';
+    else if (*p >= 'a' && *p <= 'f')
+      v = *p - 'a' + 10;
+    else
+      continue;
+    if (nibble < 0) {
+      nibble = v;
+    } else {
+      out.push_back(char((nibble << 4) | v));
+      nibble = -1;
+    }
+  }
+  return out;
+}
+
+TEST(Huffman, RoundTrip) {
+  std::string all;
+  for (int i = 0; i < 256; ++i) all.push_back(char(i));
+
+  for (const std::string& in : std::vector<std::string>{
+           "", "a", "www.example.com", "no-cache", all, all + all}) {
+    std::string enc;
+    net::http::huffman_encode(&enc, in);
+    EXPECT_EQ(enc.size(), net::http::huffman_encoded_length(in));
+    std::string dec;
+    ASSERT_OK(net::http::huffman_decode(&dec, enc));
+    EXPECT_EQ(in, dec);
+  }
+}
+
+TEST(Huffman, Vectors) {
+  // RFC 7541 Appendix C.4 and C.6.
+  struct TestRow {
+    const char* plain;
+    const char* hex;
+  };
+  std::vector<TestRow> testdata = {
+      {"www.example.com", "f1e3 c2e5 f23a 6ba0 ab90 f4ff"},
+      {"no-cache", "a8eb 1064 9cbf"},
+      {"custom-key", "25a8 49e9 5ba9 7d7f"},
+      {"custom-value", "25a8 49e9 5bb8 e8b4 bf"},
+      {"302", "6402"},
+      {"private", "aec3 771a 4b"},
+      {"Mon, 21 Oct 2013 20:13:21 GMT",
+       "d07a be94 1054 d444 a820 0595 040b 8166 e082 a62d 1bff"},
+      {"https://www.example.com", "9d29 ad17 1863 c78f 0b97 c8e9 ae82 ae43 d3"},
+  };
+  for (const auto& row : testdata) {
+    std::string enc;
+    net::http::huffman_encode(&enc, row.plain);
+    EXPECT_EQ(unhex(row.hex), enc) << row.plain;
+    std::string dec;
+    EXPECT_OK(net::http::huffman_decode(&dec, unhex(row.hex)));
+    EXPECT_EQ(row.plain, dec);
+  }
+}
+
+TEST(Huffman, Errors) {
+  std::string out;
+  // Padding longer than 7 bits.
+  EXPECT_FALSE(net::http::huffman_decode(&out, unhex("ff")));
+  // Padding that isn't all ones.
+  EXPECT_FALSE(net::http::huffman_decode(&out, unhex("00")));
+  // EOS.
+  EXPECT_FALSE(net::http::huffman_decode(&out, unhex("ffff ffff")));
+}
+
+TEST(HPackDecoder, Requests) {
+  // RFC 7541 Appendix C.4: three requests on one connection.
+  std::vector<const char*> blocks = {
+      "8286 8441 8cf1 e3c2 e5f2 3a6b a0ab 90f4 ff",
+      "8286 84be 5886 a8eb 1064 9cbf",
+      "8287 85bf 4088 25a8 49e9 5ba9 7d7f 8925 a849 e95b b8e8 b4bf",
+  };
+  std::vector<std::vector<HeaderField>> expected = {
+      {{":method", "GET"},
+       {":scheme", "http"},
+       {":path", "/"},
+       {":authority", "www.example.com"}},
+      {{":method", "GET"},
+       {":scheme", "http"},
+       {":path", "/"},
+       {":authority", "www.example.com"},
+       {"cache-control", "no-cache"}},
+      {{":method", "GET"},
+       {":scheme", "https"},
+       {":path", "/index.html"},
+       {":authority", "www.example.com"},
+       {"custom-key", "custom-value"}},
+  };
+  std::vector<std::size_t> sizes = {57, 110, 164};
+
+  net::http::HPackDecoder dec;
+  net::http::HPackEncoder enc;
+  for (std::size_t i = 0; i < blocks.size(); ++i) {
+    std::vector<HeaderField> out;
+    bool too_big;
+    ASSERT_OK(dec.decode(&out, &too_big, unhex(blocks[i]), 65536));
+    EXPECT_FALSE(too_big);
+    EXPECT_EQ(expected[i], out) << i;
+    EXPECT_EQ(sizes[i], dec.table().size()) << i;
+
+    // The encoder makes the same choices as the RFC's examples.
+    std::string block;
+    enc.begin_block(&block);
+    for (const auto& f : expected[i]) enc.encode(&block, f.first, f.second);
+    EXPECT_EQ(unhex(blocks[i]), block) << i;
+  }
+}
+
+TEST(HPackDecoder, Eviction) {
+  // RFC 7541 Appendix C.6: three responses with a 256-byte table.
+  std::vector<const char*> blocks = {
+      "4882 6402 5885 aec3 771a 4b61 96d0 7abe 9410 54d4 44a8 2005 9504 0b81"
+      "66e0 82a6 2d1b ff6e 919d 29ad 1718 63c7 8f0b 97c8 e9ae 82ae 43d3",
+      "4883 640e ffc1 c0bf",
+      "88c1 6196 d07a be94 1054 d444 a820 0595 040b 8166 e084 a62d 1bff c05a"
+      "839b d9ab 77ad 94e7 821d d7f2 e6c7 b335 dfdf cd5b 3960 d5af 2708 7f36"
+      "72c1 ab27 0fb5 291f 9587 3160 65c0 03ed 4ee5 b106 3d50 07",
+  };
+  std::vector<std::vector<HeaderField>> expected = {
+      {{":status", "302"},
+       {"cache-control", "private"},
+       {"date", "Mon, 21 Oct 2013 20:13:21 GMT"},
+       {"location", "https://www.example.com"}},
+      {{":status", "307"},
+       {"cache-control", "private"},
+       {"date", "Mon, 21 Oct 2013 20:13:21 GMT"},
+       {"location", "https://www.example.com"}},
+      {{":status", "200"},
+       {"cache-control", "private"},
+       {"date", "Mon, 21 Oct 2013 20:13:22 GMT"},
+       {"location", "https://www.example.com"},
+       {"content-encoding", "gzip"},
+       {"set-cookie",
+        "foo=ASDJKHQKBZXOQWEOPIUAXQWEOIU; max-age=3600; version=1"}},
+  };
+  std::vector<std::size_t> sizes = {222, 222, 215};
+
+  net::http::HPackDecoder dec;
+  dec.set_max_table_size(256);
+  for (std::size_t i = 0; i < blocks.size(); ++i) {
+    std::vector<HeaderField> out;
+    bool too_big;
+    ASSERT_OK(dec.decode(&out, &too_big, unhex(blocks[i]), 65536));
+    EXPECT_EQ(expected[i], out) << i;
+    EXPECT_EQ(sizes[i], dec.table().size()) << i;
+  }
+  EXPECT_EQ(3U, dec.table().count());
+}
+
+TEST(HPackDecoder, Errors) {
+  for (const char* hex : {
+           "80",          // index 0
+           "be",          // index 62, but the table is empty
+           "41",          // truncated literal
+           "4185 f1e3",   // string overruns the block
+           "82 3f e1 1f", // table size update after a field
+           "3f e2 1f",    // table size update above the limit
+           "ff ff ff ff ff ff ff",  // integer overflow
+       }) {
+    net::http::HPackDecoder dec;
+    std::vector<HeaderField> out;
+    bool too_big;
+    EXPECT_FALSE(dec.decode(&out, &too_big, unhex(hex), 65536)) << hex;
+  }
+}
+
+TEST(HPackDecoder, TooBig) {
+  net::http::HPackEncoder enc;
+  std::string block;
+  enc.begin_block(&block);
+  enc.encode(&block, "x-big", std::string(100, 'x'));
+  enc.encode(&block, "x-small", "y");
+
+  net::http::HPackDecoder dec;
+  std::vector<HeaderField> out;
+  bool too_big;
+  ASSERT_OK(dec.decode(&out, &too_big, block, 100));
+  EXPECT_TRUE(too_big);
+  EXPECT_TRUE(out.empty());
+  // The table still tracks the encoder's.
+  EXPECT_EQ(enc.table().size(), dec.table().size());
+}
+
+TEST(HPackEncoder, RoundTrip) {
+  std::vector<HeaderField> fields = {
+      {":status", "200"},
+      {"content-type", "text/html; charset=utf-8"},
+      {"content-length", "1234"},
+      {"x-custom", "value"},
+      {"set-cookie", "secret=1"},
+  };
+
+  net::http::HPackEncoder enc;
+  net::http::HPackDecoder dec;
+  std::size_t first_size = 0;
+  for (int pass = 0; pass < 3; ++pass) {
+    if (pass == 2) enc.set_max_table_size(0);
+    std::string block;
+    enc.begin_block(&block);
+    for (const auto& f : fields)
+      enc.encode(&block, f.first, f.second, f.first == "set-cookie");
+    if (pass == 0) first_size = block.size();
+    // Repeated fields come from the dynamic table.
+    if (pass == 1) {
+      EXPECT_LT(block.size(), first_size / 2);
+    }
+
+    std::vector<HeaderField> out;
+    bool too_big;
+    ASSERT_OK(dec.decode(&out, &too_big, block, 65536)) << pass;
+    EXPECT_EQ(fields, out) << pass;
+    EXPECT_EQ(enc.table().size(), dec.table().size()) << pass;
+  }
+  EXPECT_EQ(0U, dec.table().count());
+}
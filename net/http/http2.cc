@@ -0,0 +1,1524 @@
+// Copyright © 2017 by Donald King <chronos@chronos-tachyon.net>
+// Available under the MIT License. See LICENSE for details.
+
+#include "net/http/http2.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "base/logging.h"
+#include "event/manager.h"
+#include "io/options.h"
+#include "net/http/frame.h"
+#include "net/http/hpack.h"
+#include "net/http/internal.h"
+
+using RC = base::ResultCode;
+using net::http::internal::append_date;
+using net::http::internal::append_number;
+using net::http::internal::fire_and_forget;
+using net::http::internal::is_ctl;
+using net::http::internal::is_tchar;
+
+namespace net {
+namespace http {
+
+// Frames are read into a buffer this large.  It has to hold at least one
+// frame of the largest size we allow, which is kDefaultMaxFrameSize.
+static constexpr std::size_t kReadBufferSize = 65536;
+
+// Writes gather frames until they reach this size.
+static constexpr std::size_t kMaxWriteBytes = 65536;
+
+// Response bodies are read in blocks of this size, and read ahead until
+// this many bytes are waiting to be sent.
+static constexpr std::size_t kBodyBlockSize = 16384;
+static constexpr std::size_t kMaxBufferedBody = 65536;
+
+// Reading pauses while this many bytes are waiting to be written, so that a
+// client that doesn't read can't make the server buffer without limit.
+static constexpr std::size_t kMaxPendingOutput = 1U << 20;
+
+// The IDs of this many streams that were sent RST_STREAM are remembered, so
+// that frames the client sent before it heard are tolerated.
+static constexpr std::size_t kMaxRecentResets = 128;
+
+// DATA frames are at most this large, even if the client allows more, so
+// that streams take turns at a fine grain.
+static constexpr uint32_t kMaxDataFrameSize = 16384;
+
+// Streams are charged this much virtual time per byte at weight 1.
+static constexpr uint64_t kWeightScale = 256;
+
+namespace {
+
+bool has_upper(base::StringPiece sp) {
+  for (char ch : sp) {
+    if (ch >= 'A' && ch <= 'Z') return true;
+  }
+  return false;
+}
+
+// RFC 7540 section 10.3: names are tokens, and values hold no CR, LF, NUL,
+// or other controls that could split a field once the request is handed on.
+bool is_valid_field(base::StringPiece name, base::StringPiece value) {
+  if (name[0] == ':') name.remove_prefix(1);
+  if (name.empty()) return false;
+  for (char ch : name) {
+    if (!is_tchar(ch)) return false;
+  }
+  for (char ch : value) {
+    if (is_ctl(ch) && ch != '\t') return false;
+  }
+  return true;
+}
+
+void to_lower(std::string* str) {
+  for (char& ch : *str) {
+    if (ch >= 'A' && ch <= 'Z') ch += ('a' - 'A');
+  }
+}
+
+// RFC 7540 section 8.1.2.2: these fields have no meaning in HTTP/2.
+bool is_connection_specific(base::StringPiece name) {
+  return name == "connection" || name == "keep-alive" ||
+         name == "proxy-connection" || name == "transfer-encoding" ||
+         name == "upgrade";
+}
+
+bool parse_content_length(uint64_t* out, base::StringPiece sp) {
+  if (sp.empty()) return false;
+  uint64_t value = 0;
+  for (char ch : sp) {
+    if (ch < '0' || ch > '9') return false;
+    if (value > (UINT64_MAX - 9) / 10) return false;
+    value = value * 10 + (ch - '0');
+  }
+  *out = value;
+  return true;
+}
+
+uint32_t clamp_window(uint32_t size) {
+  // Smaller windows than the default can't be enforced until the client
+  // acknowledges our SETTINGS, so they aren't worth the trouble.
+  return std::max(kDefaultWindowSize, std::min(size, kMaxWindowSize));
+}
+
+}  // anonymous namespace
+
+class Http2Conn::Impl {
+ public:
+  Impl(Handler handler, const ServerOptions& so, const base::Options& opts,
+       io::Reader r, io::Writer w, Addr local_addr, Addr remote_addr,
+       Hooks hooks)
+      : handler_(std::move(handler)),
+        so_(so),
+        options_(opts),
+        manager_(io::get_manager(options_)),
+        r_(std::move(r)),
+        w_(std::move(w)),
+        local_addr_(std::move(local_addr)),
+        remote_addr_(std::move(remote_addr)),
+        hooks_(std::move(hooks)),
+        stream_window_(clamp_window(so.stream_window_size)),
+        conn_window_(clamp_window(so.connection_window_size)),
+        task_(nullptr),
+        ops_(0),
+        preface_done_(false),
+        settings_received_(false),
+        reading_(false),
+        read_paused_(false),
+        peer_eof_(false),
+        writing_(false),
+        write_failed_(false),
+        draining_(false),
+        closing_(false),
+        shut_(false),
+        done_(false),
+        rbuf_(kReadBufferSize),
+        rlen_(0),
+        rn_(0),
+        wn_(0),
+        hstream_(0),
+        hflags_(0),
+        has_hprio_(false),
+        expect_continuation_(false),
+        last_stream_id_(0),
+        conn_send_window_(kDefaultWindowSize),
+        conn_recv_window_(kDefaultWindowSize),
+        conn_unacked_(0),
+        peer_initial_window_(kDefaultWindowSize),
+        peer_max_frame_size_(kDefaultMaxFrameSize),
+        vclock_(0),
+        timer_(Timer::none) {}
+
+  void start(event::Task* task);
+
+ private:
+  struct Stream;
+  struct Deferred;
+  class BodyReader;
+
+  enum class Timer : uint8_t {
+    none = 0,
+    idle = 1,
+    write = 2,
+  };
+
+  // Completions.  Each one ends with |leave()|.
+  void on_read();
+  void on_written();
+  void on_handled(const std::shared_ptr<Stream>& s);
+  void on_pumped(const std::shared_ptr<Stream>& s);
+
+  // Called by BodyReader.
+  void body_read(std::shared_ptr<Stream> s, event::Task* task, char* out,
+                 std::size_t* n, std::size_t min, std::size_t max);
+
+  // Performs the work gathered in |d|, without |mu_| held.
+  void run(Deferred* d);
+
+  // Like |run()|, then retires the operation that was in progress.
+  void leave(Deferred* d);
+
+  // The rest are called with |mu_| held.
+  void settle(Deferred* d);
+  void read_more(Deferred* d);
+  void process(Deferred* d);
+  void handle_frame(const FrameHeader& h, base::StringPiece payload,
+                    Deferred* d);
+  void on_data(const FrameHeader& h, base::StringPiece payload, Deferred* d);
+  void on_headers(const FrameHeader& h, base::StringPiece payload,
+                  Deferred* d);
+  void on_continuation(const FrameHeader& h, base::StringPiece payload,
+                       Deferred* d);
+  void on_priority(const FrameHeader& h, base::StringPiece payload,
+                   Deferred* d);
+  void on_rst_stream(const FrameHeader& h, base::StringPiece payload,
+                     Deferred* d);
+  void on_settings(const FrameHeader& h, base::StringPiece payload,
+                   Deferred* d);
+  void on_ping(const FrameHeader& h, base::StringPiece payload, Deferred* d);
+  void on_goaway(const FrameHeader& h, base::StringPiece payload,
+                 Deferred* d);
+  void on_window_update(const FrameHeader& h, base::StringPiece payload,
+                        Deferred* d);
+  void end_headers(Deferred* d);
+  int build_request(Stream* s);
+  void end_body(Stream* s, Deferred* d);
+  void satisfy_read(Stream* s, Deferred* d);
+  void credit(Stream* s, std::size_t n);
+  void discard_input(Stream* s);
+  void replenish(Stream* s);
+  void send_response(Stream* s, Deferred* d);
+  void maybe_pump(Stream* s, Deferred* d);
+  void fill(Deferred* d);
+  void fill_data(Deferred* d);
+  void deactivate(Stream* s);
+  void rst(uint32_t id, H2Error code);
+  bool was_reset(uint32_t id) const;
+  void stream_error(Stream* s, H2Error code, Deferred* d);
+  void reset_stream(Stream* s, Deferred* d);
+  void maybe_retire(Stream* s, Deferred* d);
+  void conn_error(H2Error code, const char* what, Deferred* d);
+  void begin_close(Deferred* d);
+  void maybe_drain(Deferred* d);
+  void update_timer();
+
+  uint32_t data_frame_size() const noexcept {
+    return std::min(peer_max_frame_size_, kMaxDataFrameSize);
+  }
+
+  const Handler handler_;
+  const ServerOptions so_;
+  const base::Options options_;
+  const event::Manager manager_;
+  const io::Reader r_;
+  const io::Writer w_;
+  const Addr local_addr_;
+  const Addr remote_addr_;
+  const Hooks hooks_;
+  const uint32_t stream_window_;
+  const uint32_t conn_window_;
+  event::Task* task_;
+
+  std::mutex mu_;
+  // The rest are protected by |mu_|, except that the buffers of an I/O
+  // operation in flight belong to that operation.
+
+  // The number of operations in flight whose completions refer to |this|.
+  std::size_t ops_;
+
+  bool preface_done_;
+  bool settings_received_;
+  bool reading_;
+  bool read_paused_;
+  bool peer_eof_;
+  bool writing_;
+  bool write_failed_;
+  bool draining_;  // no new streams; close once the current ones finish
+  bool closing_;   // streams are reset; close once the output is flushed
+  bool shut_;
+  bool done_;
+
+  std::vector<char> rbuf_;
+  std::size_t rlen_;
+  std::size_t rn_;
+  event::Task rtask_;
+
+  std::string obuf_;  // frames waiting for the next write
+  std::string wbuf_;  // frames being written
+  std::size_t wn_;
+  event::Task wtask_;
+
+  HPackDecoder decoder_;
+  HPackEncoder encoder_;
+
+  // The header block being gathered from HEADERS and CONTINUATION frames.
+  std::string hblock_;
+  uint32_t hstream_;
+  uint8_t hflags_;
+  Priority hprio_;
+  bool has_hprio_;
+  bool expect_continuation_;
+
+  std::unordered_map<uint32_t, std::shared_ptr<Stream>> streams_;
+  std::vector<Stream*> active_;  // streams with DATA to send
+  std::deque<uint32_t> resets_;  // recently sent RST_STREAM, newest last
+  uint32_t last_stream_id_;
+
+  int64_t conn_send_window_;
+  int64_t conn_recv_window_;
+  std::size_t conn_unacked_;  // consumed, but not yet returned to the client
+  int64_t peer_initial_window_;
+  uint32_t peer_max_frame_size_;
+  uint64_t vclock_;
+  Timer timer_;
+};
+
+struct Http2Conn::Impl::Stream : public std::enable_shared_from_this<Stream> {
+  const uint32_t id;
+
+  // The request.  |req.head| points into |fields| and |cookie|.
+  std::vector<HeaderField> fields;
+  std::string cookie;
+  Request req;
+  Response resp;
+  event::Task task;
+  bool handler_done;
+
+  // The request body.  DATA frames append to |in|, and BodyReader consumes
+  // it; |rtask| is a read that is waiting for more.
+  std::string in;
+  std::size_t in_pos;
+  bool in_done;
+  uint64_t in_total;
+  int64_t recv_window;
+  std::size_t recv_unacked;
+  event::Task* rtask;
+  char* rout;
+  std::size_t* rn;
+  std::size_t rmin;
+  std::size_t rmax;
+
+  // The response.  The scheduler sends |out| as DATA frames, in turns
+  // ordered by |vtime|.
+  bool headers_sent;
+  bool end_sent;
+  bool active;
+  std::string out;
+  std::size_t out_pos;
+  bool out_done;  // all of the body is in |out|
+  int64_t send_window;
+  uint64_t vtime;
+  uint16_t weight;
+
+  // The response body, if it comes from a Reader, is read into |out| a
+  // block at a time.
+  io::Reader body;
+  int64_t body_left;
+  bool pumping;
+  std::vector<char> pump_buf;
+  std::size_t pump_n;
+  event::Task pump_task;
+
+  bool reset;
+
+  Stream(uint32_t id, int64_t recv_window, int64_t send_window)
+      : id(id),
+        handler_done(false),
+        in_pos(0),
+        in_done(false),
+        in_total(0),
+        recv_window(recv_window),
+        recv_unacked(0),
+        rtask(nullptr),
+        rout(nullptr),
+        rn(nullptr),
+        rmin(0),
+        rmax(0),
+        headers_sent(false),
+        end_sent(false),
+        active(false),
+        out_pos(0),
+        out_done(false),
+        send_window(send_window),
+        vtime(0),
+        weight(16),
+        body_left(-1),
+        pumping(false),
+        pump_n(0),
+        reset(false) {}
+};
+
+// Deferred gathers the work that can't be done with |mu_| held, either
+// because it calls out to other code or because it may call back in.
+struct Http2Conn::Impl::Deferred {
+  std::vector<std::pair<event::Task*, base::Result>> finish;
+  std::vector<std::shared_ptr<Stream>> cancel;
+  std::vector<std::shared_ptr<Stream>> handle;
+  std::vector<std::shared_ptr<Stream>> pump;
+  std::vector<std::shared_ptr<Stream>> drop;
+  std::vector<io::Reader> close;
+  std::size_t requests = 0;
+  std::size_t bad_requests = 0;
+  bool read = false;
+  bool write = false;
+  bool shut = false;
+};
+
+class Http2Conn::Impl::BodyReader : public io::ReaderImpl {
+ public:
+  BodyReader(Impl* impl, std::weak_ptr<Stream> s) noexcept
+      : impl_(impl), s_(std::move(s)) {}
+
+  std::size_t ideal_block_size() const noexcept override {
+    return kBodyBlockSize;
+  }
+
+  void read(event::Task* task, char* out, std::size_t* n, std::size_t min,
+            std::size_t max, const base::Options& opts) override {
+    if (!prologue(task, out, n, min, max)) return;
+    auto s = s_.lock();
+    if (!s) {
+      task->finish(
+          base::Result::failed_precondition("HTTP/2: request has finished"));
+      return;
+    }
+    impl_->body_read(std::move(s), task, out, n, min, max);
+  }
+
+  void close(event::Task* task, const base::Options& opts) override {
+    if (!prologue(task)) return;
+    task->finish_ok();
+  }
+
+ private:
+  Impl* const impl_;
+  const std::weak_ptr<Stream> s_;
+};
+
+void Http2Conn::Impl::start(event::Task* task) {
+  task_ = task;
+  Deferred d;
+  auto lock = base::acquire_lock(mu_);
+  ++ops_;
+  const Setting settings[] = {
+      {SettingId::max_concurrent_streams, so_.max_concurrent_streams},
+      {SettingId::initial_window_size, stream_window_},
+      {SettingId::max_header_list_size, uint32_t(so_.max_header_bytes)},
+  };
+  append_settings_frame(&obuf_, settings, 3);
+  if (conn_window_ > kDefaultWindowSize)
+    append_window_update_frame(&obuf_, 0, conn_window_ - kDefaultWindowSize);
+  conn_recv_window_ = conn_window_;
+  read_more(&d);
+  settle(&d);
+  lock.unlock();
+  leave(&d);
+}
+
+void Http2Conn::Impl::on_read() {
+  Deferred d;
+  auto lock = base::acquire_lock(mu_);
+  reading_ = false;
+  base::Result r = rtask_.result();
+  rlen_ += rn_;
+  if (!closing_) process(&d);
+  if (!closing_) {
+    if (r) {
+      read_more(&d);
+    } else if (r.code() == RC::END_OF_FILE) {
+      // Let the streams in progress finish, in case the client only shut
+      // down its half of the connection.
+      peer_eof_ = true;
+      draining_ = true;
+    } else {
+      VLOG(1) << "net::http::Http2Conn: reading: " << r;
+      begin_close(&d);
+    }
+  }
+  settle(&d);
+  lock.unlock();
+  leave(&d);
+}
+
+void Http2Conn::Impl::on_written() {
+  Deferred d;
+  auto lock = base::acquire_lock(mu_);
+  writing_ = false;
+  base::Result r = wtask_.result();
+  if (r && wn_ != wbuf_.size()) r = base::Result::data_loss("short write");
+  if (!r) {
+    VLOG(1) << "net::http::Http2Conn: writing: " << r;
+    write_failed_ = true;
+    obuf_.clear();
+    begin_close(&d);
+    if (!shut_) {
+      shut_ = true;
+      d.shut = true;
+    }
+  } else if (read_paused_ && !closing_) {
+    read_paused_ = false;
+    read_more(&d);
+  }
+  settle(&d);
+  lock.unlock();
+  leave(&d);
+}
+
+void Http2Conn::Impl::on_handled(const std::shared_ptr<Stream>& s) {
+  Deferred d;
+  auto lock = base::acquire_lock(mu_);
+  s->handler_done = true;
+  base::Result r = s->task.result();
+  s->req.body.reset();
+  if (!r && !s->reset) {
+    LOG(WARN) << "net::http::Server: handler failed: " << r;
+    if (s->resp.body_reader) d.close.push_back(s->resp.body_reader);
+    s->resp.clear();
+    s->resp.status = 500;
+  }
+  if (!s->reset) {
+    send_response(s.get(), &d);
+  } else if (s->resp.body_reader) {
+    d.close.push_back(std::move(s->resp.body_reader));
+    s->resp.body_reader.reset();
+  }
+  maybe_retire(s.get(), &d);
+  settle(&d);
+  lock.unlock();
+  leave(&d);
+}
+
+void Http2Conn::Impl::on_pumped(const std::shared_ptr<Stream>& s) {
+  Deferred d;
+  auto lock = base::acquire_lock(mu_);
+  s->pumping = false;
+  base::Result r = s->pump_task.result();
+  if (s->reset) {
+    d.close.push_back(std::move(s->body));
+    s->body.reset();
+  } else {
+    s->out.append(s->pump_buf.data(), s->pump_n);
+    if (s->body_left >= 0) s->body_left -= s->pump_n;
+    if (!r || s->body_left == 0) {
+      d.close.push_back(std::move(s->body));
+      s->body.reset();
+      if (r.code() == RC::END_OF_FILE && s->body_left <= 0) r = base::Result();
+      if (r) {
+        s->out_done = true;
+      } else {
+        // The response can't be completed, so the client has to be told
+        // that it's incomplete.
+        VLOG(1) << "net::http::Http2Conn: reading response body: " << r;
+        stream_error(s.get(), H2Error::internal_error, &d);
+      }
+    } else {
+      maybe_pump(s.get(), &d);
+    }
+  }
+  maybe_retire(s.get(), &d);
+  settle(&d);
+  lock.unlock();
+  leave(&d);
+}
+
+void Http2Conn::Impl::body_read(std::shared_ptr<Stream> s, event::Task* task,
+                                char* out, std::size_t* n, std::size_t min,
+                                std::size_t max) {
+  Deferred d;
+  auto lock = base::acquire_lock(mu_);
+  if (s->rtask != nullptr) {
+    lock.unlock();
+    task->finish(base::Result::failed_precondition(
+        "HTTP/2: concurrent reads of a request body"));
+    return;
+  }
+  *n = 0;
+  s->rtask = task;
+  s->rout = out;
+  s->rn = n;
+  s->rmin = min;
+  s->rmax = max;
+  satisfy_read(s.get(), &d);
+  settle(&d);
+  lock.unlock();
+  run(&d);
+}
+
+void Http2Conn::Impl::run(Deferred* d) {
+  for (auto& pair : d->finish) pair.first->finish(std::move(pair.second));
+
+  for (const auto& s : d->cancel) s->task.cancel();
+
+  for (const auto& s : d->handle) {
+    handler_(&s->task, &s->req, &s->resp);
+    s->task.on_finished(manager_.dispatcher(), event::callback([this, s] {
+                          on_handled(s);
+                          return base::Result();
+                        }));
+  }
+
+  for (const auto& s : d->pump) {
+    s->pump_n = 0;
+    s->pump_task.reset();
+    s->body.read(&s->pump_task, s->pump_buf.data(), &s->pump_n, 1,
+                 s->pump_buf.size(), options_);
+    s->pump_task.on_finished(manager_.dispatcher(),
+                             event::callback([this, s] {
+                               on_pumped(s);
+                               return base::Result();
+                             }));
+  }
+
+  for (const auto& r : d->close) {
+    fire_and_forget([r](event::Task* task) { r.close(task); });
+  }
+
+  if (d->write) {
+    wn_ = 0;
+    wtask_.reset();
+    w_.write(&wtask_, &wn_, wbuf_.data(), wbuf_.size(), options_);
+    wtask_.on_finished(manager_.dispatcher(), event::callback([this] {
+                         on_written();
+                         return base::Result();
+                       }));
+  }
+
+  if (d->read) {
+    rn_ = 0;
+    rtask_.reset();
+    r_.read(&rtask_, rbuf_.data() + rlen_, &rn_, 1, rbuf_.size() - rlen_,
+            options_);
+    rtask_.on_finished(manager_.dispatcher(), event::callback([this] {
+                         on_read();
+                         return base::Result();
+                       }));
+  }
+
+  if (hooks_.on_request) {
+    for (std::size_t i = 0; i < d->requests; ++i) hooks_.on_request(true);
+    for (std::size_t i = 0; i < d->bad_requests; ++i) hooks_.on_request(false);
+  }
+  if (d->shut && hooks_.shut) hooks_.shut();
+  d->drop.clear();
+}
+
+void Http2Conn::Impl::leave(Deferred* d) {
+  run(d);
+  auto lock = base::acquire_lock(mu_);
+  --ops_;
+  bool done = (closing_ && ops_ == 0 && !done_);
+  if (done) done_ = true;
+  lock.unlock();
+
+  // This may destroy |this|, so it has to come last.
+  if (done) task_->finish_ok();
+}
+
+void Http2Conn::Impl::settle(Deferred* d) {
+  fill(d);
+  maybe_drain(d);
+  update_timer();
+}
+
+void Http2Conn::Impl::read_more(Deferred* d) {
+  if (reading_ || peer_eof_ || closing_) return;
+  std::size_t pending = obuf_.size() + (writing_ ? wbuf_.size() : 0);
+  if (pending > kMaxPendingOutput) {
+    read_paused_ = true;
+    return;
+  }
+  reading_ = true;
+  ++ops_;
+  d->read = true;
+}
+
+void Http2Conn::Impl::process(Deferred* d) {
+  std::size_t pos = 0;
+  if (!preface_done_) {
+    std::size_t n = std::min(rlen_, kClientPrefaceSize);
+    if (::memcmp(rbuf_.data(), kClientPreface, n) != 0) {
+      conn_error(H2Error::protocol_error, "bad connection preface", d);
+      return;
+    }
+    if (rlen_ < kClientPrefaceSize) return;
+    pos = kClientPrefaceSize;
+    preface_done_ = true;
+  }
+
+  while (!closing_ && rlen_ - pos >= kFrameHeaderSize) {
+    FrameHeader h = parse_frame_header(rbuf_.data() + pos);
+    if (h.length > kDefaultMaxFrameSize) {
+      conn_error(H2Error::frame_size_error, "frame too large", d);
+      return;
+    }
+    if (rlen_ - pos < kFrameHeaderSize + h.length) break;
+    base::StringPiece payload(rbuf_.data() + pos + kFrameHeaderSize,
+                              h.length);
+    pos += kFrameHeaderSize + h.length;
+    handle_frame(h, payload, d);
+  }
+  if (closing_) return;
+
+  // Keep any partial frame for the next read.
+  rlen_ -= pos;
+  if (rlen_ != 0 && pos != 0)
+    ::memmove(rbuf_.data(), rbuf_.data() + pos, rlen_);
+}
+
+void Http2Conn::Impl::handle_frame(const FrameHeader& h,
+                                   base::StringPiece payload, Deferred* d) {
+  if (expect_continuation_ && (h.type != FrameType::continuation ||
+                               h.stream_id != hstream_)) {
+    conn_error(H2Error::protocol_error, "expected CONTINUATION", d);
+    return;
+  }
+  if (!settings_received_ && h.type != FrameType::settings) {
+    conn_error(H2Error::protocol_error, "expected SETTINGS", d);
+    return;
+  }
+  switch (h.type) {
+    case FrameType::data:
+      on_data(h, payload, d);
+      break;
+    case FrameType::headers:
+      on_headers(h, payload, d);
+      break;
+    case FrameType::priority:
+      on_priority(h, payload, d);
+      break;
+    case FrameType::rst_stream:
+      on_rst_stream(h, payload, d);
+      break;
+    case FrameType::settings:
+      on_settings(h, payload, d);
+      break;
+    case FrameType::push_promise:
+      conn_error(H2Error::protocol_error, "client sent PUSH_PROMISE", d);
+      break;
+    case FrameType::ping:
+      on_ping(h, payload, d);
+      break;
+    case FrameType::goaway:
+      on_goaway(h, payload, d);
+      break;
+    case FrameType::window_update:
+      on_window_update(h, payload, d);
+      break;
+    case FrameType::continuation:
+      on_continuation(h, payload, d);
+      break;
+    default:
+      // RFC 7540 section 4.1: frames of unknown types are ignored.
+      break;
+  }
+}
+
+void Http2Conn::Impl::on_data(const FrameHeader& h,
+                              base::StringPiece payload, Deferred* d) {
+  if (h.stream_id == 0) {
+    conn_error(H2Error::protocol_error, "DATA on stream 0", d);
+    return;
+  }
+  // Padding counts against the windows too.
+  if (int64_t(h.length) > conn_recv_window_) {
+    conn_error(H2Error::flow_control_error, "connection window exceeded", d);
+    return;
+  }
+  conn_recv_window_ -= h.length;
+  base::StringPiece data = payload;
+  if (!strip_padding(&data, h)) {
+    conn_error(H2Error::protocol_error, "bad padding", d);
+    return;
+  }
+
+  auto it = streams_.find(h.stream_id);
+  if (it == streams_.end()) {
+    conn_unacked_ += h.length;
+    replenish(nullptr);
+    if (h.stream_id > last_stream_id_) {
+      conn_error(H2Error::protocol_error, "DATA on idle stream", d);
+    }
+    // Else the stream was reset, and the client hadn't heard yet.
+    return;
+  }
+  Stream* s = it->second.get();
+  if (s->in_done || s->reset) {
+    conn_unacked_ += h.length;
+    replenish(nullptr);
+    if (!s->reset) stream_error(s, H2Error::stream_closed, d);
+    return;
+  }
+  if (int64_t(h.length) > s->recv_window) {
+    conn_unacked_ += h.length;
+    replenish(nullptr);
+    stream_error(s, H2Error::flow_control_error, d);
+    return;
+  }
+  s->recv_window -= h.length;
+  if (h.length > data.size()) credit(s, h.length - data.size());
+
+  s->in.append(data.data(), data.size());
+  s->in_total += data.size();
+  const auto& head = s->req.head;
+  if (head.has_content_length && s->in_total > head.content_length) {
+    stream_error(s, H2Error::protocol_error, d);
+    return;
+  }
+  if (h.has(kFlagEndStream)) {
+    end_body(s, d);
+    return;
+  }
+  satisfy_read(s, d);
+}
+
+void Http2Conn::Impl::on_headers(const FrameHeader& h,
+                                 base::StringPiece payload, Deferred* d) {
+  if (h.stream_id == 0 || (h.stream_id & 1) == 0) {
+    conn_error(H2Error::protocol_error, "HEADERS on a server stream ID", d);
+    return;
+  }
+  base::StringPiece block = payload;
+  if (!strip_padding(&block, h)) {
+    conn_error(H2Error::protocol_error, "bad padding", d);
+    return;
+  }
+  has_hprio_ = h.has(kFlagPriority);
+  if (has_hprio_ && !parse_priority(&hprio_, &block)) {
+    conn_error(H2Error::frame_size_error, "short HEADERS", d);
+    return;
+  }
+  hstream_ = h.stream_id;
+  hflags_ = h.flags;
+  hblock_.assign(block.data(), block.size());
+  if (h.has(kFlagEndHeaders))
+    end_headers(d);
+  else
+    expect_continuation_ = true;
+}
+
+void Http2Conn::Impl::on_continuation(const FrameHeader& h,
+                                      base::StringPiece payload,
+                                      Deferred* d) {
+  if (!expect_continuation_) {
+    conn_error(H2Error::protocol_error, "unexpected CONTINUATION", d);
+    return;
+  }
+  hblock_.append(payload.data(), payload.size());
+  if (hblock_.size() > std::max<std::size_t>(2 * so_.max_header_bytes,
+                                             kDefaultMaxFrameSize)) {
+    conn_error(H2Error::enhance_your_calm, "header block too large", d);
+    return;
+  }
+  if (h.has(kFlagEndHeaders)) {
+    expect_continuation_ = false;
+    end_headers(d);
+  }
+}
+
+void Http2Conn::Impl::on_priority(const FrameHeader& h,
+                                  base::StringPiece payload, Deferred* d) {
+  if (h.stream_id == 0) {
+    conn_error(H2Error::protocol_error, "PRIORITY on stream 0", d);
+    return;
+  }
+  auto it = streams_.find(h.stream_id);
+  Stream* s = (it != streams_.end()) ? it->second.get() : nullptr;
+  Priority prio;
+  H2Error err = H2Error::no_error;
+  if (h.length != 5)
+    err = H2Error::frame_size_error;
+  else if (!parse_priority(&prio, &payload) || prio.dependency == h.stream_id)
+    err = H2Error::protocol_error;
+  if (err != H2Error::no_error) {
+    if (s)
+      stream_error(s, err, d);
+    else
+      rst(h.stream_id, err);
+    return;
+  }
+  if (s) s->weight = prio.weight;
+}
+
+void Http2Conn::Impl::on_rst_stream(const FrameHeader& h,
+                                    base::StringPiece payload, Deferred* d) {
+  if (h.length != 4) {
+    conn_error(H2Error::frame_size_error, "bad RST_STREAM length", d);
+    return;
+  }
+  if (h.stream_id == 0 || h.stream_id > last_stream_id_) {
+    conn_error(H2Error::protocol_error, "RST_STREAM on idle stream", d);
+    return;
+  }
+  auto it = streams_.find(h.stream_id);
+  if (it == streams_.end()) return;
+  VLOG(1) << "net::http::Http2Conn: client reset stream " << h.stream_id
+          << ": " << h2_error_name(H2Error(parse_uint32(payload.data())));
+  reset_stream(it->second.get(), d);
+}
+
+void Http2Conn::Impl::on_settings(const FrameHeader& h,
+                                  base::StringPiece payload, Deferred* d) {
+  if (h.stream_id != 0) {
+    conn_error(H2Error::protocol_error, "SETTINGS on a stream", d);
+    return;
+  }
+  if (h.has(kFlagAck)) {
+    if (h.length != 0)
+      conn_error(H2Error::frame_size_error, "SETTINGS ACK with payload", d);
+    return;
+  }
+  settings_received_ = true;
+
+  H2Error err = H2Error::no_error;
+  base::Result r = parse_settings(payload, [this, &err](const Setting& s) {
+    switch (s.id) {
+      case SettingId::header_table_size:
+        encoder_.set_max_table_size(s.value);
+        break;
+
+      case SettingId::enable_push:
+        if (s.value > 1) err = H2Error::protocol_error;
+        break;
+
+      case SettingId::initial_window_size: {
+        if (s.value > kMaxWindowSize) {
+          err = H2Error::flow_control_error;
+          break;
+        }
+        // RFC 7540 section 6.9.2: this adjusts the open streams' windows,
+        // which may even go negative.
+        int64_t delta = int64_t(s.value) - peer_initial_window_;
+        peer_initial_window_ = s.value;
+        for (const auto& pair : streams_) {
+          pair.second->send_window += delta;
+          if (pair.second->send_window > int64_t(kMaxWindowSize))
+            err = H2Error::flow_control_error;
+        }
+        break;
+      }
+
+      case SettingId::max_frame_size:
+        if (s.value < kDefaultMaxFrameSize || s.value > kMaxMaxFrameSize)
+          err = H2Error::protocol_error;
+        else
+          peer_max_frame_size_ = s.value;
+        break;
+
+      default:
+        break;
+    }
+  });
+  if (!r) {
+    conn_error(H2Error::frame_size_error, "bad SETTINGS length", d);
+    return;
+  }
+  if (err != H2Error::no_error) {
+    conn_error(err, "bad SETTINGS value", d);
+    return;
+  }
+  append_settings_ack_frame(&obuf_);
+}
+
+void Http2Conn::Impl::on_ping(const FrameHeader& h, base::StringPiece payload,
+                              Deferred* d) {
+  if (h.stream_id != 0) {
+    conn_error(H2Error::protocol_error, "PING on a stream", d);
+    return;
+  }
+  if (h.length != 8) {
+    conn_error(H2Error::frame_size_error, "bad PING length", d);
+    return;
+  }
+  if (!h.has(kFlagAck)) append_ping_frame(&obuf_, true, payload.data());
+}
+
+void Http2Conn::Impl::on_goaway(const FrameHeader& h,
+                                base::StringPiece payload, Deferred* d) {
+  if (h.stream_id != 0) {
+    conn_error(H2Error::protocol_error, "GOAWAY on a stream", d);
+    return;
+  }
+  if (h.length < 8) {
+    conn_error(H2Error::frame_size_error, "short GOAWAY", d);
+    return;
+  }
+  VLOG(1) << "net::http::Http2Conn: client sent GOAWAY: "
+          << h2_error_name(H2Error(parse_uint32(payload.data() + 4)));
+  draining_ = true;
+}
+
+void Http2Conn::Impl::on_window_update(const FrameHeader& h,
+                                       base::StringPiece payload,
+                                       Deferred* d) {
+  if (h.length != 4) {
+    conn_error(H2Error::frame_size_error, "bad WINDOW_UPDATE length", d);
+    return;
+  }
+  const uint32_t inc = parse_uint32(payload.data()) & 0x7fffffffU;
+  if (h.stream_id == 0) {
+    if (inc == 0) {
+      conn_error(H2Error::protocol_error, "zero WINDOW_UPDATE", d);
+      return;
+    }
+    conn_send_window_ += inc;
+    if (conn_send_window_ > int64_t(kMaxWindowSize))
+      conn_error(H2Error::flow_control_error, "connection window overflow",
+                 d);
+    return;
+  }
+
+  auto it = streams_.find(h.stream_id);
+  if (it == streams_.end()) {
+    if (h.stream_id > last_stream_id_)
+      conn_error(H2Error::protocol_error, "WINDOW_UPDATE on idle stream", d);
+    return;
+  }
+  Stream* s = it->second.get();
+  if (inc == 0) {
+    stream_error(s, H2Error::protocol_error, d);
+    return;
+  }
+  s->send_window += inc;
+  if (s->send_window > int64_t(kMaxWindowSize))
+    stream_error(s, H2Error::flow_control_error, d);
+}
+
+void Http2Conn::Impl::end_headers(Deferred* d) {
+  std::vector<HeaderField> fields;
+  bool too_big;
+  base::Result r =
+      decoder_.decode(&fields, &too_big, hblock_, so_.max_header_bytes);
+  hblock_.clear();
+  if (!r) {
+    VLOG(1) << "net::http::Http2Conn: " << r;
+    conn_error(H2Error::compression_error, "bad header block", d);
+    return;
+  }
+  const uint32_t id = hstream_;
+  const bool end_stream = (hflags_ & kFlagEndStream) != 0;
+
+  auto it = streams_.find(id);
+  if (it != streams_.end()) {
+    // Trailers, which are read past.
+    Stream* s = it->second.get();
+    if (s->reset) return;
+    if (s->in_done)
+      stream_error(s, H2Error::stream_closed, d);
+    else if (!end_stream)
+      stream_error(s, H2Error::protocol_error, d);
+    else
+      end_body(s, d);
+    return;
+  }
+  if (id <= last_stream_id_) {
+    // RFC 7540 section 5.1: the client may have sent this before it heard of
+    // the reset.  The block was still decoded, keeping HPACK in sync.
+    if (was_reset(id)) return;
+    conn_error(H2Error::stream_closed, "HEADERS on closed stream", d);
+    return;
+  }
+  last_stream_id_ = id;
+  if (has_hprio_ && hprio_.dependency == id) {
+    rst(id, H2Error::protocol_error);
+    return;
+  }
+  if (draining_ || streams_.size() >= so_.max_concurrent_streams) {
+    rst(id, H2Error::refused_stream);
+    return;
+  }
+
+  auto s = std::make_shared<Stream>(id, stream_window_, peer_initial_window_);
+  if (has_hprio_) s->weight = hprio_.weight;
+  s->fields = std::move(fields);
+  s->in_done = end_stream;
+  s->req.local_addr = local_addr_;
+  s->req.remote_addr = remote_addr_;
+  streams_[id] = s;
+
+  int status = too_big ? 431 : build_request(s.get());
+  if (status != 0) {
+    ++d->bad_requests;
+    s->handler_done = true;
+    if (status < 0) {
+      stream_error(s.get(), H2Error::protocol_error, d);
+    } else {
+      s->resp.status = status;
+      send_response(s.get(), d);
+      maybe_retire(s.get(), d);
+    }
+    return;
+  }
+
+  if (s->in_done)
+    s->req.body = io::nullreader();
+  else
+    s->req.body = io::Reader(std::make_shared<BodyReader>(this, s));
+  ++d->requests;
+  ++ops_;
+  d->handle.push_back(std::move(s));
+}
+
+// Fills in |s->req.head| from |s->fields|, per RFC 7540 section 8.1.2.
+// Returns 0 on success, -1 if the request is malformed, or else the HTTP
+// status of the response to send instead of calling the handler.
+int Http2Conn::Impl::build_request(Stream* s) {
+  RequestHead& head = s->req.head;
+  head.clear();
+  base::StringPiece method, scheme, path, authority;
+  bool has_method = false, has_scheme = false, has_path = false,
+       has_authority = false;
+  bool regular = false;
+  std::size_t cookies = 0;
+
+  for (const auto& f : s->fields) {
+    base::StringPiece name = f.first;
+    base::StringPiece value = f.second;
+    if (name.empty() || has_upper(name)) return -1;
+    if (!is_valid_field(name, value)) return -1;
+
+    if (name[0] == ':') {
+      if (regular) return -1;
+      base::StringPiece* slot;
+      bool* seen;
+      if (name == ":method") {
+        slot = &method;
+        seen = &has_method;
+      } else if (name == ":scheme") {
+        slot = &scheme;
+        seen = &has_scheme;
+      } else if (name == ":path") {
+        slot = &path;
+        seen = &has_path;
+      } else if (name == ":authority") {
+        slot = &authority;
+        seen = &has_authority;
+      } else {
+        return -1;
+      }
+      if (*seen) return -1;
+      *seen = true;
+      *slot = value;
+      continue;
+    }
+
+    regular = true;
+    if (is_connection_specific(name)) return -1;
+    if (name == "te" && value != "trailers") return -1;
+    if (name == "content-length") {
+      uint64_t len;
+      if (!parse_content_length(&len, value)) return -1;
+      if (head.has_content_length && head.content_length != len) return -1;
+      head.has_content_length = true;
+      head.content_length = len;
+    }
+    // RFC 7540 section 8.1.2.5: crumbs are put back together below.
+    if (name == "cookie") {
+      if (cookies++ != 0) s->cookie.append("; ");
+      s->cookie.append(value.data(), value.size());
+      continue;
+    }
+    if (head.num_headers >= kMaxHeaders) return 431;
+    head.headers[head.num_headers++] = Header{name, value};
+  }
+
+  if (!has_method) return -1;
+  if (method == "CONNECT") return 501;
+  if (!has_scheme || !has_path || path.empty()) return -1;
+  if (cookies != 0) {
+    if (head.num_headers >= kMaxHeaders) return 431;
+    head.headers[head.num_headers++] = Header{"cookie", s->cookie};
+  }
+  if (has_authority && head.header("host").empty()) {
+    if (head.num_headers >= kMaxHeaders) return 431;
+    head.headers[head.num_headers++] = Header{"host", authority};
+  }
+  if (s->in_done && head.has_content_length && head.content_length != 0)
+    return -1;
+
+  head.method = method;
+  head.target = path;
+  head.minor_version = 1;
+  head.keep_alive = true;
+  return 0;
+}
+
+void Http2Conn::Impl::end_body(Stream* s, Deferred* d) {
+  s->in_done = true;
+  const auto& head = s->req.head;
+  if (head.has_content_length && s->in_total != head.content_length) {
+    stream_error(s, H2Error::protocol_error, d);
+    return;
+  }
+  satisfy_read(s, d);
+  maybe_retire(s, d);
+}
+
+void Http2Conn::Impl::satisfy_read(Stream* s, Deferred* d) {
+  if (s->rtask == nullptr) return;
+  std::size_t k = std::min(s->in.size() - s->in_pos, s->rmax - *s->rn);
+  if (k != 0) {
+    ::memcpy(s->rout + *s->rn, s->in.data() + s->in_pos, k);
+    *s->rn += k;
+    s->in_pos += k;
+    if (s->in_pos == s->in.size()) {
+      s->in.clear();
+      s->in_pos = 0;
+    } else if (s->in_pos >= kBodyBlockSize && 2 * s->in_pos > s->in.size()) {
+      s->in.erase(0, s->in_pos);
+      s->in_pos = 0;
+    }
+    credit(s, k);
+  }
+
+  base::Result r;
+  if (*s->rn >= s->rmin)
+    r = base::Result();
+  else if (s->reset)
+    r = base::Result::cancelled();
+  else if (s->in_done)
+    r = base::Result::eof();
+  else
+    return;
+  d->finish.emplace_back(s->rtask, std::move(r));
+  s->rtask = nullptr;
+}
+
+void Http2Conn::Impl::credit(Stream* s, std::size_t n) {
+  s->recv_unacked += n;
+  conn_unacked_ += n;
+  replenish(s);
+}
+
+void Http2Conn::Impl::discard_input(Stream* s) {
+  conn_unacked_ += s->in.size() - s->in_pos;
+  s->in.clear();
+  s->in_pos = 0;
+  replenish(nullptr);
+}
+
+// Returns consumed bytes to the client's windows, in batches of half a
+// window so that WINDOW_UPDATE frames stay rare.
+void Http2Conn::Impl::replenish(Stream* s) {
+  if (closing_) return;
+  if (conn_unacked_ != 0 && conn_unacked_ >= conn_window_ / 2) {
+    append_window_update_frame(&obuf_, 0, conn_unacked_);
+    conn_recv_window_ += conn_unacked_;
+    conn_unacked_ = 0;
+  }
+  if (s != nullptr && !s->in_done && !s->reset && s->recv_unacked != 0 &&
+      s->recv_unacked >= stream_window_ / 2) {
+    append_window_update_frame(&obuf_, s->id, s->recv_unacked);
+    s->recv_window += s->recv_unacked;
+    s->recv_unacked = 0;
+  }
+}
+
+void Http2Conn::Impl::send_response(Stream* s, Deferred* d) {
+  Response& resp = s->resp;
+  const int status = resp.status;
+  const bool has_body = (status >= 200 && status != 204 && status != 304);
+  const bool send = has_body && !s->req.head.is_head();
+  const bool use_reader = !!resp.body_reader;
+
+  int64_t length = -1;
+  if (has_body) length = use_reader ? resp.body_length : resp.body.size();
+
+  std::string block;
+  std::string str;
+  encoder_.begin_block(&block);
+  append_number(&str, status);
+  encoder_.encode(&block, ":status", str);
+  str.clear();
+  append_date(&str);
+  encoder_.encode(&block, "date", str);
+  for (const auto& pair : resp.headers) {
+    str = pair.first;
+    to_lower(&str);
+    if (is_connection_specific(str) || str == "content-length") continue;
+    encoder_.encode(&block, str, pair.second, str == "set-cookie");
+  }
+  if (length >= 0) {
+    str.clear();
+    append_number(&str, length);
+    encoder_.encode(&block, "content-length", str);
+  }
+
+  if (use_reader) {
+    if (send) {
+      s->body = std::move(resp.body_reader);
+      s->body_left = resp.body_length;
+      s->pump_buf.resize(kBodyBlockSize);
+    } else {
+      d->close.push_back(std::move(resp.body_reader));
+    }
+    resp.body_reader.reset();
+  } else if (send) {
+    s->out = std::move(resp.body);
+  }
+  resp.body.clear();
+
+  const bool end = !send || (!s->body && s->out.empty());
+  append_headers_frames(&obuf_, s->id, block, end, peer_max_frame_size_);
+  s->headers_sent = true;
+  if (end) {
+    s->end_sent = true;
+    return;
+  }
+  if (!s->body) s->out_done = true;
+
+  // A small body that fits in the windows goes out right behind its
+  // headers, without waiting for a turn.
+  const std::size_t size = s->out.size();
+  if (s->out_done && size <= data_frame_size() &&
+      int64_t(size) <= s->send_window && int64_t(size) <= conn_send_window_) {
+    append_data_frame(&obuf_, s->id, s->out, true);
+    s->send_window -= size;
+    conn_send_window_ -= size;
+    s->out.clear();
+    s->end_sent = true;
+    return;
+  }
+
+  s->vtime = vclock_;
+  s->active = true;
+  active_.push_back(s);
+  maybe_pump(s, d);
+}
+
+void Http2Conn::Impl::maybe_pump(Stream* s, Deferred* d) {
+  if (!s->body || s->pumping || s->reset || s->out_done) return;
+  if (s->out.size() - s->out_pos >= kMaxBufferedBody) return;
+  if (s->body_left == 0) {
+    s->out_done = true;
+    d->close.push_back(std::move(s->body));
+    s->body.reset();
+    return;
+  }
+  std::size_t want = kBodyBlockSize;
+  if (s->body_left > 0) want = std::min(want, std::size_t(s->body_left));
+  s->pump_buf.resize(want);
+  s->pumping = true;
+  ++ops_;
+  d->pump.push_back(s->shared_from_this());
+}
+
+// Starts a write of everything that's ready, if no write is in flight.
+void Http2Conn::Impl::fill(Deferred* d) {
+  if (writing_ || write_failed_ || shut_) return;
+  wbuf_.clear();
+  wbuf_.swap(obuf_);
+  if (!closing_) fill_data(d);
+  if (wbuf_.empty()) {
+    // Once the last frames are out, the connection can be shut down.
+    if (closing_) {
+      shut_ = true;
+      d->shut = true;
+    }
+    return;
+  }
+  writing_ = true;
+  ++ops_;
+  d->write = true;
+  timer_ = Timer::write;
+  if (hooks_.set_timeout) hooks_.set_timeout(so_.write_timeout);
+}
+
+// Appends DATA frames to |wbuf_|, taking turns among the streams by
+// weighted fair queueing: each turn goes to the stream with the earliest
+// virtual time, which then advances by the frame's size over its weight.
+void Http2Conn::Impl::fill_data(Deferred* d) {
+  while (wbuf_.size() < kMaxWriteBytes) {
+    Stream* best = nullptr;
+    for (Stream* s : active_) {
+      std::size_t avail = s->out.size() - s->out_pos;
+      bool fin_only = (avail == 0 && s->out_done);
+      if (!fin_only && (avail == 0 || s->send_window <= 0 ||
+                        conn_send_window_ <= 0))
+        continue;
+      // A stream that sat idle doesn't get to catch up.
+      if (s->vtime < vclock_) s->vtime = vclock_;
+      if (best == nullptr || s->vtime < best->vtime) best = s;
+    }
+    if (best == nullptr) break;
+
+    std::size_t avail = best->out.size() - best->out_pos;
+    std::size_t n = std::min(avail, std::size_t(data_frame_size()));
+    if (n != 0) {
+      n = std::min(n, std::size_t(best->send_window));
+      n = std::min(n, std::size_t(conn_send_window_));
+    }
+    const bool end = best->out_done && n == avail;
+    append_data_frame(&wbuf_, best->id,
+                      base::StringPiece(best->out.data() + best->out_pos, n),
+                      end);
+    best->out_pos += n;
+    if (best->out_pos == best->out.size()) {
+      best->out.clear();
+      best->out_pos = 0;
+    } else if (best->out_pos >= kMaxBufferedBody) {
+      best->out.erase(0, best->out_pos);
+      best->out_pos = 0;
+    }
+    best->send_window -= n;
+    conn_send_window_ -= n;
+    vclock_ = best->vtime;
+    best->vtime += (n + kFrameHeaderSize) * kWeightScale / best->weight;
+
+    if (end) {
+      best->end_sent = true;
+      deactivate(best);
+      maybe_retire(best, d);
+    } else {
+      maybe_pump(best, d);
+    }
+  }
+}
+
+void Http2Conn::Impl::deactivate(Stream* s) {
+  if (!s->active) return;
+  s->active = false;
+  auto it = std::find(active_.begin(), active_.end(), s);
+  DCHECK(it != active_.end());
+  *it = active_.back();
+  active_.pop_back();
+}
+
+void Http2Conn::Impl::rst(uint32_t id, H2Error code) {
+  append_rst_stream_frame(&obuf_, id, code);
+  if (resets_.size() >= kMaxRecentResets) resets_.pop_front();
+  resets_.push_back(id);
+}
+
+bool Http2Conn::Impl::was_reset(uint32_t id) const {
+  return std::find(resets_.begin(), resets_.end(), id) != resets_.end();
+}
+
+void Http2Conn::Impl::stream_error(Stream* s, H2Error code, Deferred* d) {
+  if (s->reset) return;
+  VLOG(1) << "net::http::Http2Conn: resetting stream " << s->id << ": "
+          << h2_error_name(code);
+  rst(s->id, code);
+  reset_stream(s, d);
+}
+
+void Http2Conn::Impl::reset_stream(Stream* s, Deferred* d) {
+  if (s->reset) return;
+  s->reset = true;
+  deactivate(s);
+  s->out.clear();
+  s->out_pos = 0;
+  discard_input(s);
+  satisfy_read(s, d);
+  if (!s->handler_done) d->cancel.push_back(s->shared_from_this());
+  if (s->body && !s->pumping) {
+    d->close.push_back(std::move(s->body));
+    s->body.reset();
+  }
+  maybe_retire(s, d);
+}
+
+// Forgets |s| once its handler is done and its response is over.
+void Http2Conn::Impl::maybe_retire(Stream* s, Deferred* d) {
+  if (!s->handler_done || s->pumping) return;
+  if (!s->end_sent && !s->reset) return;
+  auto it = streams_.find(s->id);
+  if (it == streams_.end() || it->second.get() != s) return;
+
+  // RFC 7540 section 8.1: the rest of the request isn't wanted.
+  if (!s->reset && !s->in_done) rst(s->id, H2Error::no_error);
+  discard_input(s);
+  if (s->body) {
+    d->close.push_back(std::move(s->body));
+    s->body.reset();
+  }
+  d->drop.push_back(std::move(it->second));
+  streams_.erase(it);
+}
+
+void Http2Conn::Impl::conn_error(H2Error code, const char* what,
+                                 Deferred* d) {
+  if (closing_) return;
+  VLOG(1) << "net::http::Http2Conn: " << h2_error_name(code) << ": " << what;
+  if (!write_failed_)
+    append_goaway_frame(&obuf_, last_stream_id_, code, what);
+  begin_close(d);
+}
+
+void Http2Conn::Impl::begin_close(Deferred* d) {
+  if (closing_) return;
+  closing_ = true;
+  draining_ = true;
+  std::vector<Stream*> all;
+  all.reserve(streams_.size());
+  for (const auto& pair : streams_) all.push_back(pair.second.get());
+  for (Stream* s : all) reset_stream(s, d);
+}
+
+void Http2Conn::Impl::maybe_drain(Deferred* d) {
+  if (!draining_ || closing_) return;
+  if (!streams_.empty() || writing_ || !obuf_.empty()) return;
+  if (!peer_eof_)
+    append_goaway_frame(&obuf_, last_stream_id_, H2Error::no_error, "");
+  begin_close(d);
+  fill(d);
+}
+
+void Http2Conn::Impl::update_timer() {
+  if (writing_) return;  // armed when the write started
+  Timer t = (streams_.empty() && !closing_) ? Timer::idle : Timer::none;
+  if (t == timer_) return;
+  timer_ = t;
+  if (!hooks_.set_timeout) return;
+  if (t == Timer::idle)
+    hooks_.set_timeout(so_.idle_timeout);
+  else
+    hooks_.set_timeout(base::time::Duration());
+}
+
+Http2Conn::Http2Conn(Handler handler, const ServerOptions& so,
+                     const base::Options& opts, io::Reader r, io::Writer w,
+                     Addr local_addr, Addr remote_addr, Hooks hooks)
+    : impl_(new Impl(std::move(handler), so, opts, std::move(r), std::move(w),
+                     std::move(local_addr), std::move(remote_addr),
+                     std::move(hooks))) {}
+
+Http2Conn::~Http2Conn() noexcept = default;
+
+void Http2Conn::start(event::Task* task) {
+  CHECK_NOTNULL(task);
+  if (!task->start()) return;
+  impl_->start(task);
+}
+
+}  // namespace http
+}  // namespace net
@@ -0,0 +1,80 @@
+// net/http/http2.h - HTTP/2 server connections
+// Copyright © 2017 by Donald King <chronos@chronos-tachyon.net>
+// Available under the MIT License. See LICENSE for details.
+
+#ifndef NET_HTTP_HTTP2_H
+#define NET_HTTP_HTTP2_H
+
+#include <functional>
+#include <memory>
+
+#include "base/options.h"
+#include "base/time/duration.h"
+#include "event/task.h"
+#include "io/reader.h"
+#include "io/writer.h"
+#include "net/addr.h"
+#include "net/http/server.h"
+
+namespace net {
+namespace http {
+
+// Http2Conn serves the requests on one HTTP/2 connection, per RFC 7540.
+// Server creates one for each connection that opens with the HTTP/2
+// connection preface.
+//
+// Each request is a stream that runs its handler concurrently with the
+// others.  Request bodies reach handlers through flow-controlled windows,
+// which are replenished as handlers read.  Responses are written by a
+// scheduler that shares the connection among streams in proportion to their
+// weights, within the client's flow control windows, and that gathers the
+// frames it has ready into large writes.
+//
+// Stream dependencies are not followed, only weights: RFC 7540's dependency
+// tree was deprecated by RFC 9113 because clients used it inconsistently.
+// Server push is not supported.
+//
+// THREAD SAFETY: This class is thread-safe.
+//
+class Http2Conn {
+ public:
+  struct Hooks {
+    // Called once for each request, with true if it goes to the handler or
+    // false if it's rejected as malformed.
+    std::function<void(bool)> on_request;
+
+    // Sets the connection's timeout, or cancels it if zero.
+    std::function<void(base::time::Duration)> set_timeout;
+
+    // Shuts down the connection, waking any I/O blocked on it.
+    std::function<void()> shut;
+  };
+
+  // Http2Conn reads from |r| and writes to |w|.  |r| MUST begin with the
+  // connection preface.
+  Http2Conn(Handler handler, const ServerOptions& so,
+            const base::Options& opts, io::Reader r, io::Writer w,
+            Addr local_addr, Addr remote_addr, Hooks hooks);
+
+  // The Http2Conn MUST NOT be destroyed until |start()|'s task finishes.
+  ~Http2Conn() noexcept;
+
+  // Http2Conn is neither copyable nor moveable.
+  Http2Conn(const Http2Conn&) = delete;
+  Http2Conn(Http2Conn&&) = delete;
+  Http2Conn& operator=(const Http2Conn&) = delete;
+  Http2Conn& operator=(Http2Conn&&) = delete;
+
+  // Serves requests until the connection fails or the client goes away, and
+  // then finishes |task| once all of the handlers have finished.
+  void start(event::Task* task);
+
+ private:
+  class Impl;
+  std::unique_ptr<Impl> impl_;
+};
+
+}  // namespace http
+}  // namespace net
+
+#endif  // NET_HTTP_HTTP2_H
@@ -0,0 +1,417 @@
+// Copyright © 2017 by Donald King <chronos@chronos-tachyon.net>
+// Available under the MIT License. See LICENSE for details.
+
+#include "gtest/gtest.h"
+
+#include <signal.h>
+#include <sys/socket.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "base/fd.h"
+#include "base/result_testing.h"
+#include "io/util.h"
+#include "net/connfd.h"
+#include "net/http/frame.h"
+#include "net/http/hpack.h"
+#include "net/http/server.h"
+#include "net/unix.h"
+
+using net::http::FrameHeader;
+using net::http::FrameType;
+using net::http::H2Error;
+using net::http::HeaderField;
+
+static constexpr std::size_t kBigSize = 1U << 20;
+
+static void make_pair(net::Conn* a, net::Conn* b) {
+  // The server writes to clients that may have gone away.
+  ::signal(SIGPIPE, SIG_IGN);
+
+  base::SocketPair s;
+  ASSERT_OK(base::make_socketpair(&s, AF_UNIX, SOCK_STREAM, 0));
+  auto addr = net::unixaddr(net::ProtocolType::stream, "");
+  ASSERT_OK(net::fdconn(a, addr, addr, s.left));
+  ASSERT_OK(net::fdconn(b, addr, addr, s.right));
+}
+
+// Echoes the method, path and body, except that "/big" gets kBigSize bytes.
+static void test_handler(event::Task* task, net::http::Request* req,
+                         net::http::Response* resp) {
+  struct Helper {
+    event::Task* const task;
+    net::http::Request* const req;
+    net::http::Response* const resp;
+    std::string body;
+    std::size_t n;
+    event::Task subtask;
+
+    Helper(event::Task* t, net::http::Request* q, net::http::Response* p)
+        : task(t), req(q), resp(p), n(0) {}
+  };
+
+  if (!task->start()) return;
+  if (req->head.target == "/big") {
+    resp->set_body(std::string(kBigSize, 'x'));
+    task->finish_ok();
+    return;
+  }
+  auto* h = new Helper(task, req, resp);
+  task->add_subtask(&h->subtask);
+  io::copy(&h->subtask, &h->n, io::stringwriter(&h->body), req->body);
+  h->subtask.on_finished(event::callback([h] {
+    if (!event::propagate_failure(h->task, &h->subtask)) {
+      const auto& head = h->req->head;
+      std::string str;
+      str.append(head.method.data(), head.method.size());
+      str.push_back(' ');
+      str.append(head.target.data(), head.target.size());
+      str.push_back(' ');
+      str.append(h->body);
+      h->resp->add_header("X-Test", "yes");
+      h->resp->set_body(std::move(str));
+      h->task->finish_ok();
+    }
+    delete h;
+    return base::Result();
+  }));
+}
+
+// Client speaks just enough HTTP/2 to drive the server.
+struct Client {
+  net::Conn conn;
+  std::string rbuf;
+  net::http::HPackEncoder enc;
+  net::http::HPackDecoder dec;
+
+  void send(const std::string& str) {
+    std::size_t n;
+    EXPECT_OK(conn.writer().write(&n, str));
+  }
+
+  // Appends the connection preface and an empty SETTINGS frame.
+  void preface(std::string* out) {
+    out->append(net::http::kClientPreface, net::http::kClientPrefaceSize);
+    net::http::append_settings_frame(out, nullptr, 0);
+  }
+
+  void request(std::string* out, uint32_t id, const char* method,
+               const char* path, bool end_stream) {
+    std::string block;
+    enc.begin_block(&block);
+    enc.encode(&block, ":method", method);
+    enc.encode(&block, ":scheme", "http");
+    enc.encode(&block, ":path", path);
+    enc.encode(&block, ":authority", "example.com");
+    net::http::append_headers_frames(out, id, block, end_stream,
+                                     net::http::kDefaultMaxFrameSize);
+  }
+
+  // Reads one frame, or returns false at EOF.
+  bool read_frame(FrameHeader* h, std::string* payload) {
+    while (true) {
+      if (rbuf.size() >= net::http::kFrameHeaderSize) {
+        *h = net::http::parse_frame_header(rbuf.data());
+        std::size_t size = net::http::kFrameHeaderSize + h->length;
+        if (rbuf.size() >= size) {
+          payload->assign(rbuf, net::http::kFrameHeaderSize, h->length);
+          rbuf.erase(0, size);
+          return true;
+        }
+      }
+      std::string buf;
+      base::Result r = conn.reader().read(&buf, 1, 65536);
+      rbuf.append(buf);
+      if (!r) {
+        EXPECT_EOF(r);
+        EXPECT_EQ(0U, rbuf.size());
+        return false;
+      }
+    }
+  }
+
+  std::string status(const std::string& block) {
+    std::vector<HeaderField> fields;
+    bool too_big;
+    EXPECT_OK(dec.decode(&fields, &too_big, block, 65536));
+    for (const auto& f : fields) {
+      if (f.first == ":status") return f.second;
+    }
+    return "";
+  }
+};
+
+TEST(Http2, Multiplexed) {
+  net::Conn s;
+  Client c;
+  make_pair(&c.conn, &s);
+  net::http::Server server(test_handler);
+  server.serve(s);
+
+  constexpr uint32_t kStreams = 200;
+  std::string out;
+  c.preface(&out);
+  net::http::append_ping_frame(&out, false, "12345678");
+  for (uint32_t i = 0; i < kStreams; ++i) {
+    std::string path = "/" + std::to_string(i);
+    c.request(&out, 2 * i + 1, "GET", path.c_str(), true);
+  }
+  c.send(out);
+
+  FrameHeader h;
+  std::string payload;
+  ASSERT_TRUE(c.read_frame(&h, &payload));
+  EXPECT_EQ(FrameType::settings, h.type);
+  EXPECT_FALSE(h.has(net::http::kFlagAck));
+
+  std::map<uint32_t, std::string> bodies;
+  std::size_t finished = 0;
+  bool pong = false, refused = false;
+  while (finished < kStreams && c.read_frame(&h, &payload)) {
+    switch (h.type) {
+      case FrameType::ping:
+        EXPECT_TRUE(h.has(net::http::kFlagAck));
+        EXPECT_EQ("12345678", payload);
+        pong = true;
+        break;
+      case FrameType::headers:
+        EXPECT_EQ("200", c.status(payload)) << h.stream_id;
+        break;
+      case FrameType::data:
+        bodies[h.stream_id].append(payload);
+        if (h.has(net::http::kFlagEndStream)) ++finished;
+        break;
+      case FrameType::rst_stream:
+        refused = true;
+        ++finished;
+        break;
+      default:
+        break;
+    }
+  }
+  EXPECT_TRUE(pong);
+  EXPECT_FALSE(refused);
+  ASSERT_EQ(kStreams, finished);
+  for (uint32_t i = 0; i < kStreams; ++i) {
+    EXPECT_EQ("GET /" + std::to_string(i) + " ", bodies[2 * i + 1]);
+  }
+
+  // The server finishes up once the client does.
+  EXPECT_OK(c.conn.writer().close());
+  while (c.read_frame(&h, &payload)) {
+  }
+
+  auto stats = server.stats();
+  EXPECT_EQ(1U, stats.http2_connections);
+  EXPECT_EQ(kStreams, stats.requests);
+  EXPECT_EQ(0U, stats.bad_requests);
+}
+
+TEST(Http2, FlowControl) {
+  net::Conn s;
+  Client c;
+  make_pair(&c.conn, &s);
+  net::http::Server server(test_handler);
+  server.serve(s);
+
+  std::string out;
+  c.preface(&out);
+  c.request(&out, 1, "POST", "/upload", false);
+  c.request(&out, 3, "GET", "/big", true);
+  c.send(out);
+
+  // A body larger than the default window fits in the server's.
+  std::string upload;
+  for (int i = 0; upload.size() < 100000; ++i) upload += std::to_string(i);
+  FrameHeader h;
+  std::string payload;
+  ASSERT_TRUE(c.read_frame(&h, &payload));
+  ASSERT_EQ(FrameType::settings, h.type);
+  out.clear();
+  for (std::size_t i = 0; i < upload.size(); i += 16384) {
+    std::size_t n = std::min<std::size_t>(16384, upload.size() - i);
+    net::http::append_data_frame(&out, 1, upload.substr(i, n),
+                                 i + n == upload.size());
+  }
+  c.send(out);
+
+  // The big response only fits if the client opens its windows as it
+  // reads.
+  std::map<uint32_t, std::string> bodies;
+  std::size_t finished = 0;
+  while (finished < 2 && c.read_frame(&h, &payload)) {
+    if (h.type == FrameType::rst_stream || h.type == FrameType::goaway) {
+      ADD_FAILURE() << "unexpected frame type " << int(h.type);
+      break;
+    }
+    if (h.type != FrameType::data) continue;
+    bodies[h.stream_id].append(payload);
+    if (h.has(net::http::kFlagEndStream)) ++finished;
+    if (!payload.empty()) {
+      out.clear();
+      net::http::append_window_update_frame(&out, 0, payload.size());
+      net::http::append_window_update_frame(&out, h.stream_id,
+                                            payload.size());
+      c.send(out);
+    }
+  }
+  EXPECT_EQ("POST /upload " + upload, bodies[1]);
+  EXPECT_EQ(std::string(kBigSize, 'x'), bodies[3]);
+}
+
+TEST(Http2, Weights) {
+  net::Conn s;
+  Client c;
+  make_pair(&c.conn, &s);
+  net::http::Server server(test_handler);
+  server.serve(s);
+
+  // Open the windows all the way, so that only the weights matter.
+  std::string out;
+  out.append(net::http::kClientPreface, net::http::kClientPrefaceSize);
+  net::http::Setting setting = {net::http::SettingId::initial_window_size,
+                                net::http::kMaxWindowSize};
+  net::http::append_settings_frame(&out, &setting, 1);
+  net::http::append_window_update_frame(
+      &out, 0, net::http::kMaxWindowSize - net::http::kDefaultWindowSize);
+  c.request(&out, 1, "GET", "/big", true);
+  c.request(&out, 3, "GET", "/big", true);
+
+  // PRIORITY frames: stream 1 gets weight 1, stream 3 gets weight 256.
+  for (uint32_t id : {1U, 3U}) {
+    net::http::append_frame_header(
+        &out, FrameHeader{5, FrameType::priority, 0, id});
+    out.append(4, '\0');
+    out.push_back(char(id == 1 ? 0 : 255));
+  }
+  c.send(out);
+
+  std::map<uint32_t, std::size_t> sizes;
+  std::vector<uint32_t> order;
+  FrameHeader h;
+  std::string payload;
+  while (order.size() < 2 && c.read_frame(&h, &payload)) {
+    if (h.type != FrameType::data) continue;
+    sizes[h.stream_id] += payload.size();
+    if (h.has(net::http::kFlagEndStream)) {
+      order.push_back(h.stream_id);
+      // The heavier stream hogs the connection until it's done.
+      if (order.size() == 1) {
+        EXPECT_LT(sizes[1], kBigSize / 4);
+      }
+    }
+  }
+  ASSERT_EQ(2U, order.size());
+  EXPECT_EQ(3U, order[0]);
+  EXPECT_EQ(kBigSize, sizes[1]);
+  EXPECT_EQ(kBigSize, sizes[3]);
+}
+
+TEST(Http2, ProtocolError) {
+  net::Conn s;
+  Client c;
+  make_pair(&c.conn, &s);
+  net::http::Server server(test_handler);
+  server.serve(s);
+
+  std::string out;
+  c.preface(&out);
+  net::http::append_data_frame(&out, 0, "oops", false);
+  c.send(out);
+
+  FrameHeader h;
+  std::string payload;
+  bool goaway = false;
+  while (c.read_frame(&h, &payload)) {
+    if (h.type != FrameType::goaway) continue;
+    ASSERT_GE(payload.size(), 8U);
+    EXPECT_EQ(H2Error::protocol_error,
+              H2Error(net::http::parse_uint32(payload.data() + 4)));
+    goaway = true;
+  }
+  EXPECT_TRUE(goaway);
+}
+
+TEST(Http2, BadRequests) {
+  net::Conn s;
+  Client c;
+  make_pair(&c.conn, &s);
+  net::http::Server server(test_handler);
+  server.serve(s);
+
+  std::string out;
+  c.preface(&out);
+
+  // Uppercase names are malformed in HTTP/2.
+  std::string block;
+  c.enc.begin_block(&block);
+  c.enc.encode(&block, ":method", "GET");
+  c.enc.encode(&block, ":scheme", "http");
+  c.enc.encode(&block, ":path", "/");
+  c.enc.encode(&block, "X-Upper", "1");
+  net::http::append_headers_frames(&out, 1, block, true,
+                                   net::http::kDefaultMaxFrameSize);
+
+  // CONNECT isn't supported.
+  block.clear();
+  c.enc.begin_block(&block);
+  c.enc.encode(&block, ":method", "CONNECT");
+  c.enc.encode(&block, ":authority", "example.com:443");
+  net::http::append_headers_frames(&out, 3, block, true,
+                                   net::http::kDefaultMaxFrameSize);
+
+  // Control characters could split the field when handed on as HTTP/1.1.
+  block.clear();
+  c.enc.begin_block(&block);
+  c.enc.encode(&block, ":method", "GET");
+  c.enc.encode(&block, ":scheme", "http");
+  c.enc.encode(&block, ":path", "/");
+  c.enc.encode(&block, "x-smuggle", "1\r\nx-evil: 1");
+  net::http::append_headers_frames(&out, 5, block, true,
+                                   net::http::kDefaultMaxFrameSize);
+
+  // So could names that aren't tokens.
+  block.clear();
+  c.enc.begin_block(&block);
+  c.enc.encode(&block, ":method", "GET");
+  c.enc.encode(&block, ":scheme", "http");
+  c.enc.encode(&block, ":path", "/");
+  c.enc.encode(&block, "x bad", "1");
+  net::http::append_headers_frames(&out, 7, block, true,
+                                   net::http::kDefaultMaxFrameSize);
+
+  // Trailers for a stream that was already reset are ignored, not a
+  // connection error, and the block still updates the HPACK table.
+  block.clear();
+  c.enc.begin_block(&block);
+  c.enc.encode(&block, "x-trailer", "1");
+  net::http::append_headers_frames(&out, 1, block, true,
+                                   net::http::kDefaultMaxFrameSize);
+
+  c.request(&out, 9, "GET", "/ok", true);
+  net::http::append_goaway_frame(&out, 0, H2Error::no_error, "");
+  c.send(out);
+
+  std::map<uint32_t, std::string> result;
+  FrameHeader h;
+  std::string payload;
+  while (c.read_frame(&h, &payload)) {
+    if (h.type == FrameType::rst_stream) {
+      result[h.stream_id] = net::http::h2_error_name(
+          H2Error(net::http::parse_uint32(payload.data())));
+    } else if (h.type == FrameType::headers) {
+      result[h.stream_id] = c.status(payload);
+    }
+  }
+  EXPECT_EQ("PROTOCOL_ERROR", result[1]);
+  EXPECT_EQ("501", result[3]);
+  EXPECT_EQ("PROTOCOL_ERROR", result[5]);
+  EXPECT_EQ("PROTOCOL_ERROR", result[7]);
+  EXPECT_EQ("200", result[9]);
+
+  auto stats = server.stats();
+  EXPECT_EQ(1U, stats.requests);
+  EXPECT_EQ(4U, stats.bad_requests);
+}
@@ -0,0 +1,75 @@
+// Copyright © 2017 by Donald King <chronos@chronos-tachyon.net>
+// Available under the MIT License. See LICENSE for details.
+
+#include "net/http/internal.h"
+
+#include <cstdio>
+#include <ctime>
+
+namespace net {
+namespace http {
+namespace internal {
+
+// The date only changes once a second, so each thread caches it.
+void append_date(std::string* out) {
+  thread_local time_t last = 0;
+  thread_local char buf[32];
+  time_t now = ::time(nullptr);
+  if (now != last) {
+    struct tm tm;
+    ::gmtime_r(&now, &tm);
+    ::strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    last = now;
+  }
+  out->append(buf);
+}
+
+void append_number(std::string* out, uint64_t value) {
+  char buf[24];
+  int n = ::snprintf(buf, sizeof(buf), "%llu", (unsigned long long)value);
+  out->append(buf, n);
+}
+
+bool is_tchar(char ch) noexcept {
+  if (ch >= '0' && ch <= '9') return true;
+  if (ch >= 'A' && ch <= 'Z') return true;
+  if (ch >= 'a' && ch <= 'z') return true;
+  switch (ch) {
+    case '!':
+    case '#':
+    case '$':
+    case '%':
+    case '&':
+    case '\'':
+    case '*':
+    case '+':
+    case '-':
+    case '.':
+    case '^':
+    case '_':
+    case '`':
+    case '|':
+    case '~':
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool is_ctl(char ch) noexcept {
+  unsigned char uch = ch;
+  return uch < 0x20 || uch == 0x7f;
+}
+
+void fire_and_forget(std::function<void(event::Task*)> fn) {
+  auto* task = new event::Task;
+  fn(task);
+  task->on_finished(event::callback([task] {
+    delete task;
+    return base::Result();
+  }));
+}
+
+}  // namespace internal
+}  // namespace http
+}  // namespace net
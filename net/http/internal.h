@@ -0,0 +1,37 @@
+// net/http/internal.h - Private helper functions
+// Copyright © 2017 by Donald King <chronos@chronos-tachyon.net>
+// Available under the MIT License. See LICENSE for details.
+
+#ifndef NET_HTTP_INTERNAL_H
+#define NET_HTTP_INTERNAL_H
+
+#include <cstdint>
+#include <functional>
+#include <string>
+
+#include "event/task.h"
+
+namespace net {
+namespace http {
+namespace internal {
+
+// Appends the current time as an IMF-fixdate, per RFC 7231 section 7.1.1.1.
+void append_date(std::string* out);
+
+void append_number(std::string* out, uint64_t value);
+
+// Returns true iff |ch| may appear in a token, per RFC 7230 section 3.2.6.
+bool is_tchar(char ch) noexcept;
+
+// Returns true iff |ch| is a control character, per RFC 5234 appendix B.1.
+bool is_ctl(char ch) noexcept;
+
+// Runs |fn| on a Task that cleans up after itself, for operations whose
+// results are of no interest.
+void fire_and_forget(std::function<void(event::Task*)> fn);
+
+}  // namespace internal
+}  // namespace http
+}  // namespace net
+
+#endif  // NET_HTTP_INTERNAL_H
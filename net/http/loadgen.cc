@@ -0,0 +1,162 @@
+// Copyright © 2017 by Donald King <chronos@chronos-tachyon.net>
+// Available under the MIT License. See LICENSE for details.
+//
+// Measures the throughput of net::http::Server over loopback: N client
+// threads each keep one connection busy with batches of pipelined requests.
+
+#include <signal.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "base/flag.h"
+#include "base/logging.h"
+#include "net/http/server.h"
+#include "net/inet.h"
+#include "net/net.h"
+
+static std::size_t get_size(const base::FlagSet& flags, const char* name) {
+  const std::string& str = flags.get_string(name)->value();
+  char* end = nullptr;
+  unsigned long value = ::strtoul(str.c_str(), &end, 10);
+  if (str.empty() || *end != '\0' || value == 0) {
+    std::cerr << "loadgen: --" << name << " must be a positive integer\n";
+    ::exit(2);
+  }
+  return value;
+}
+
+static void hello(event::Task* task, net::http::Request* req,
+                  net::http::Response* resp) {
+  if (!task->start()) return;
+  resp->add_header("Content-Type", "text/plain; charset=utf-8");
+  resp->set_body("Hello, world!\n");
+  task->finish_ok();
+}
+
+// Reads one response from |c| and returns its size in bytes, or 0 on error.
+static std::size_t measure_response(const net::Conn& c) {
+  std::string got, buf;
+  while (true) {
+    std::size_t end = got.find("\r\n\r\n");
+    if (end != std::string::npos) {
+      std::size_t cl = got.find("Content-Length: ");
+      if (cl == std::string::npos || cl > end) return 0;
+      std::size_t total =
+          end + 4 + ::strtoul(got.c_str() + cl + 16, nullptr, 10);
+      if (got.size() >= total) return total;
+    }
+    if (!c.reader().read(&buf, 1, 4096)) return 0;
+    got.append(buf);
+  }
+}
+
+struct Client {
+  std::size_t requests = 0;
+  bool failed = false;
+};
+
+static void run_client(Client* client, net::Addr addr, std::string batch,
+                       std::size_t pipeline,
+                       std::chrono::steady_clock::time_point deadline) {
+  net::Conn c;
+  if (!net::dial(&c, addr, net::Addr())) {
+    client->failed = true;
+    return;
+  }
+
+  // One request on its own to learn how long each response is; the Date
+  // header is fixed-length, so they're all the same.
+  std::size_t n;
+  std::string one = batch.substr(0, batch.size() / pipeline);
+  std::size_t resp_size = 0;
+  if (c.writer().write(&n, one)) resp_size = measure_response(c);
+  if (resp_size == 0) {
+    client->failed = true;
+    return;
+  }
+
+  std::string buf;
+  const std::size_t want = resp_size * pipeline;
+  while (std::chrono::steady_clock::now() < deadline) {
+    if (!c.writer().write(&n, batch) || !c.reader().read(&buf, want, want)) {
+      client->failed = true;
+      return;
+    }
+    client->requests += pipeline;
+  }
+}
+
+int main(int argc, char** argv) {
+  base::FlagSet flags;
+  flags.set_description(
+      "Benchmarks net::http::Server with pipelined keep-alive clients on a "
+      "loopback listener.");
+  flags.add_help();
+  flags.add_string("connections", "16", "Number of client connections");
+  flags.add_string("pipeline", "8", "Requests sent per batch on a connection");
+  flags.add_string("seconds", "5", "How long to run");
+  flags.add_string("root", "",
+                   "If set, serve files from this directory instead of a "
+                   "fixed greeting");
+  flags.add_string("target", "/", "Request target to ask for");
+  flags.parse(argc, argv);
+
+  const std::size_t connections = get_size(flags, "connections");
+  const std::size_t pipeline = get_size(flags, "pipeline");
+  const std::size_t seconds = get_size(flags, "seconds");
+  const std::string& root = flags.get_string("root")->value();
+  const std::string& target = flags.get_string("target")->value();
+
+  // Clients that go away mid-write must not kill the server.
+  ::signal(SIGPIPE, SIG_IGN);
+
+  net::http::Handler handler = hello;
+  if (!root.empty()) handler = net::http::file_handler(root);
+  net::http::Server server(handler);
+  server.listen(net::inetaddr(net::ProtocolType::stream,
+                              net::IP::localhost_v4(), 0))
+      .expect_ok(__FILE__, __LINE__);
+  net::Addr addr = server.listen_addr();
+
+  std::string batch;
+  for (std::size_t i = 0; i < pipeline; ++i) {
+    batch.append("GET ");
+    batch.append(target);
+    batch.append(" HTTP/1.1\r\nHost: localhost\r\n\r\n");
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  auto deadline = start + std::chrono::seconds(seconds);
+  std::vector<Client> clients(connections);
+  std::vector<std::thread> threads;
+  for (auto& client : clients) {
+    threads.emplace_back(run_client, &client, addr, batch, pipeline, deadline);
+  }
+  for (auto& t : threads) t.join();
+  double elapsed = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start).count();
+
+  std::size_t total = 0;
+  std::size_t failed = 0;
+  for (const auto& client : clients) {
+    total += client.requests;
+    if (client.failed) ++failed;
+  }
+  auto stats = server.stats();
+  std::cout << "connections: " << connections << " (" << failed
+            << " failed)\n"
+            << "pipeline:    " << pipeline << "\n"
+            << "requests:    " << total << " in " << elapsed << "s\n"
+            << "throughput:  " << std::size_t(total / elapsed) << " req/s\n"
+            << "server:      " << stats.requests << " requests, "
+            << stats.bad_requests << " bad, " << stats.timeouts
+            << " timeouts\n"
+            << std::flush;
+  server.shutdown();
+  return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,370 @@
+// Copyright © 2017 by Donald King <chronos@chronos-tachyon.net>
+// Available under the MIT License. See LICENSE for details.
+
+#include "net/http/parser.h"
+
+#include "base/logging.h"
+#include "net/http/internal.h"
+
+namespace net {
+namespace http {
+
+using internal::is_ctl;
+using internal::is_tchar;
+
+static bool is_ows(char ch) noexcept { return ch == ' ' || ch == '\t'; }
+
+static char to_lower(char ch) noexcept {
+  if (ch >= 'A' && ch <= 'Z') return ch + ('a' - 'A');
+  return ch;
+}
+
+static bool equal_fold(base::StringPiece a, base::StringPiece b) noexcept {
+  if (a.size() != b.size()) return false;
+  for (std::size_t i = 0; i < a.size(); ++i) {
+    if (to_lower(a[i]) != to_lower(b[i])) return false;
+  }
+  return true;
+}
+
+static base::StringPiece trim_ows(base::StringPiece sp) noexcept {
+  while (!sp.empty() && is_ows(sp.front())) sp.remove_prefix(1);
+  while (!sp.empty() && is_ows(sp.back())) sp.remove_suffix(1);
+  return sp;
+}
+
+// Calls |fn| on each element of the comma-separated list |sp|, skipping
+// empty elements as RFC 7230 section 7 requires.
+template <typename Fn>
+static void for_each_element(base::StringPiece sp, Fn fn) {
+  while (!sp.empty()) {
+    std::size_t comma = sp.find(',');
+    if (comma == base::StringPiece::npos) comma = sp.size();
+    base::StringPiece elem = trim_ows(sp.prefix(comma));
+    if (!elem.empty()) fn(elem);
+    if (comma == sp.size()) break;
+    sp.remove_prefix(comma + 1);
+  }
+}
+
+static int hex_value(char ch) noexcept {
+  if (ch >= '0' && ch <= '9') return ch - '0';
+  if (ch >= 'a' && ch <= 'f') return ch - 'a' + 10;
+  if (ch >= 'A' && ch <= 'F') return ch - 'A' + 10;
+  return -1;
+}
+
+void RequestHead::clear() noexcept {
+  method = base::StringPiece();
+  target = base::StringPiece();
+  minor_version = 0;
+  num_headers = 0;
+  chunked = false;
+  has_content_length = false;
+  content_length = 0;
+  keep_alive = false;
+  expect_continue = false;
+  size = 0;
+}
+
+base::StringPiece RequestHead::header(base::StringPiece name) const noexcept {
+  for (std::size_t i = 0; i < num_headers; ++i) {
+    if (equal_fold(headers[i].name, name)) return headers[i].value;
+  }
+  return base::StringPiece();
+}
+
+bool RequestHead::is_head() const noexcept { return method == "HEAD"; }
+
+void RequestParser::reset() noexcept {
+  state_ = State::request_line;
+  pos_ = 0;
+  scan_ = 0;
+  error_status_ = 0;
+}
+
+base::Result RequestParser::parse(RequestHead* out, bool* done,
+                                  base::StringPiece buf) {
+  CHECK_NOTNULL(out);
+  CHECK_NOTNULL(done);
+  *done = false;
+  if (state_ == State::request_line && pos_ == 0 && scan_ == 0) out->clear();
+
+  while (state_ != State::done) {
+    std::size_t lf = buf.find('\n', scan_);
+    if (lf == base::StringPiece::npos) {
+      scan_ = buf.size();
+      return base::Result();
+    }
+    // CRLF is the standard line ending, but RFC 7230 section 3.5 lets
+    // recipients accept a bare LF too.
+    base::StringPiece line = buf.substring(pos_, lf - pos_);
+    line.remove_suffix("\r");
+    pos_ = lf + 1;
+    scan_ = pos_;
+
+    base::Result r;
+    if (state_ == State::request_line) {
+      // RFC 7230 section 3.5: ignore empty lines before the request line.
+      if (line.empty()) continue;
+      r = parse_request_line(out, line);
+      state_ = State::headers;
+    } else if (line.empty()) {
+      out->size = pos_;
+      r = finish(out);
+      state_ = State::done;
+    } else {
+      r = parse_header(out, line);
+    }
+    if (!r) return r;
+  }
+  *done = true;
+  return base::Result();
+}
+
+base::Result RequestParser::fail(int status, const char* what) {
+  error_status_ = status;
+  switch (status) {
+    case 431:
+      return base::Result::resource_exhausted("HTTP: ", what);
+    case 501:
+    case 505:
+      return base::Result::not_implemented("HTTP: ", what);
+    default:
+      return base::Result::invalid_argument("HTTP: ", what);
+  }
+}
+
+base::Result RequestParser::parse_request_line(RequestHead* out,
+                                               base::StringPiece line) {
+  std::size_t sp1 = line.find(' ');
+  if (sp1 == base::StringPiece::npos || sp1 == 0)
+    return fail(400, "malformed request line");
+  base::StringPiece method = line.prefix(sp1);
+  for (char ch : method) {
+    if (!is_tchar(ch)) return fail(400, "malformed method");
+  }
+  line.remove_prefix(sp1 + 1);
+
+  std::size_t sp2 = line.find(' ');
+  if (sp2 == base::StringPiece::npos || sp2 == 0)
+    return fail(400, "malformed request line");
+  base::StringPiece target = line.prefix(sp2);
+  for (char ch : target) {
+    if (is_ctl(ch)) return fail(400, "malformed request target");
+  }
+  line.remove_prefix(sp2 + 1);
+
+  if (line.size() != 8 || !line.has_prefix("HTTP/") || line[6] != '.' ||
+      line[5] < '0' || line[5] > '9' || line[7] < '0' || line[7] > '9') {
+    return fail(400, "malformed HTTP version");
+  }
+  if (line[5] != '1') return fail(505, "unsupported HTTP version");
+
+  out->method = method;
+  out->target = target;
+  out->minor_version = line[7] - '0';
+  return base::Result();
+}
+
+base::Result RequestParser::parse_header(RequestHead* out,
+                                         base::StringPiece line) {
+  if (is_ows(line.front())) return fail(400, "obsolete line folding");
+
+  std::size_t colon = line.find(':');
+  if (colon == base::StringPiece::npos || colon == 0)
+    return fail(400, "malformed header field");
+  base::StringPiece name = line.prefix(colon);
+  for (char ch : name) {
+    if (!is_tchar(ch)) return fail(400, "malformed header field name");
+  }
+  base::StringPiece value = trim_ows(line.strip_prefix(colon + 1));
+  for (char ch : value) {
+    if (is_ctl(ch) && ch != '\t')
+      return fail(400, "malformed header field value");
+  }
+
+  if (out->num_headers >= kMaxHeaders)
+    return fail(431, "too many header fields");
+  auto& h = out->headers[out->num_headers++];
+  h.name = name;
+  h.value = value;
+  return base::Result();
+}
+
+base::Result RequestParser::finish(RequestHead* out) {
+  bool has_host = false;
+  bool has_te = false;
+  bool close = false;
+  bool keep_alive = false;
+
+  for (std::size_t i = 0; i < out->num_headers; ++i) {
+    const auto& h = out->headers[i];
+    if (equal_fold(h.name, "Host")) {
+      if (has_host) return fail(400, "duplicate Host");
+      has_host = true;
+    } else if (equal_fold(h.name, "Content-Length")) {
+      if (h.value.empty()) return fail(400, "malformed Content-Length");
+      uint64_t n = 0;
+      for (char ch : h.value) {
+        if (ch < '0' || ch > '9') return fail(400, "malformed Content-Length");
+        if (n > (UINT64_MAX - 9) / 10)
+          return fail(400, "Content-Length out of range");
+        n = n * 10 + (ch - '0');
+      }
+      if (out->has_content_length && out->content_length != n)
+        return fail(400, "conflicting Content-Length");
+      out->has_content_length = true;
+      out->content_length = n;
+    } else if (equal_fold(h.name, "Transfer-Encoding")) {
+      if (has_te) return fail(400, "duplicate Transfer-Encoding");
+      has_te = true;
+      if (!equal_fold(h.value, "chunked"))
+        return fail(501, "unsupported transfer coding");
+    } else if (equal_fold(h.name, "Connection")) {
+      for_each_element(h.value, [&close, &keep_alive](base::StringPiece x) {
+        if (equal_fold(x, "close")) close = true;
+        if (equal_fold(x, "keep-alive")) keep_alive = true;
+      });
+    } else if (equal_fold(h.name, "Expect")) {
+      if (equal_fold(h.value, "100-continue")) out->expect_continue = true;
+    }
+  }
+
+  if (out->minor_version >= 1 && !has_host) return fail(400, "missing Host");
+  if (has_te) {
+    // RFC 7230 section 3.3.3: a message with both is a smuggling attempt,
+    // and HTTP/1.0 has no chunked coding.
+    if (out->has_content_length || out->minor_version == 0)
+      return fail(400, "conflicting message framing");
+    out->chunked = true;
+  }
+  if (out->minor_version == 0) out->expect_continue = false;
+
+  if (close)
+    out->keep_alive = false;
+  else if (out->minor_version >= 1)
+    out->keep_alive = true;
+  else
+    out->keep_alive = keep_alive;
+  return base::Result();
+}
+
+void ChunkDecoder::reset() noexcept {
+  state_ = State::size;
+  digits_ = 0;
+  remaining_ = 0;
+}
+
+base::Result ChunkDecoder::decode(base::StringPiece* data,
+                                  std::size_t* consumed,
+                                  base::StringPiece in) {
+  CHECK_NOTNULL(data);
+  CHECK_NOTNULL(consumed);
+  *data = base::StringPiece();
+  *consumed = 0;
+
+  auto bad = [] {
+    return base::Result::invalid_argument("HTTP: malformed chunked coding");
+  };
+
+  std::size_t i = 0;
+  while (i < in.size() && state_ != State::done) {
+    char ch = in[i];
+    switch (state_) {
+      case State::size: {
+        int x = hex_value(ch);
+        if (x >= 0) {
+          if (digits_ >= 16) return bad();
+          remaining_ = (remaining_ << 4) | x;
+          ++digits_;
+        } else if (digits_ == 0) {
+          return bad();
+        } else if (ch == ';' || is_ows(ch)) {
+          state_ = State::extension;
+        } else if (ch == '\r') {
+          state_ = State::size_lf;
+        } else if (ch == '\n') {
+          state_ = (remaining_ == 0) ? State::trailer : State::data;
+        } else {
+          return bad();
+        }
+        ++i;
+        break;
+      }
+
+      case State::extension:
+        if (ch == '\r')
+          state_ = State::size_lf;
+        else if (ch == '\n')
+          state_ = (remaining_ == 0) ? State::trailer : State::data;
+        ++i;
+        break;
+
+      case State::size_lf:
+        if (ch != '\n') return bad();
+        state_ = (remaining_ == 0) ? State::trailer : State::data;
+        ++i;
+        break;
+
+      case State::data: {
+        std::size_t n = in.size() - i;
+        if (n > remaining_) n = remaining_;
+        *data = in.substring(i, n);
+        remaining_ -= n;
+        i += n;
+        if (remaining_ == 0) state_ = State::data_cr;
+        *consumed = i;
+        return base::Result();
+      }
+
+      case State::data_cr:
+        if (ch == '\r') {
+          state_ = State::data_lf;
+        } else if (ch == '\n') {
+          state_ = State::size;
+          digits_ = 0;
+        } else {
+          return bad();
+        }
+        ++i;
+        break;
+
+      case State::data_lf:
+        if (ch != '\n') return bad();
+        state_ = State::size;
+        digits_ = 0;
+        ++i;
+        break;
+
+      case State::trailer:
+        if (ch == '\r')
+          state_ = State::trailer_lf;
+        else if (ch == '\n')
+          state_ = State::done;
+        else
+          state_ = State::trailer_line;
+        ++i;
+        break;
+
+      case State::trailer_lf:
+        if (ch != '\n') return bad();
+        state_ = State::done;
+        ++i;
+        break;
+
+      case State::trailer_line:
+        if (ch == '\n') state_ = State::trailer;
+        ++i;
+        break;
+
+      default:
+        return bad();
+    }
+  }
+  *consumed = i;
+  return base::Result();
+}
+
+}  // namespace http
+}  // namespace net
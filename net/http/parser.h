@@ -0,0 +1,170 @@
+// net/http/parser.h - Incremental parsing of HTTP/1.1 messages
+// Copyright © 2017 by Donald King <chronos@chronos-tachyon.net>
+// Available under the MIT License. See LICENSE for details.
+
+#ifndef NET_HTTP_PARSER_H
+#define NET_HTTP_PARSER_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include "base/result.h"
+#include "base/strings.h"
+
+namespace net {
+namespace http {
+
+// The most header fields that a RequestHead can hold.
+constexpr std::size_t kMaxHeaders = 64;
+
+// Header is one header field.
+struct Header {
+  base::StringPiece name;
+  base::StringPiece value;
+};
+
+// RequestHead is the request line and header fields of a request, as parsed
+// by RequestParser.
+//
+// All StringPieces point into the buffer that was parsed, so a RequestHead
+// is only valid for as long as that buffer is unchanged.
+//
+struct RequestHead {
+  // The request line.
+  base::StringPiece method;
+  base::StringPiece target;
+  unsigned int minor_version;  // HTTP/1.x
+
+  // The header fields, in the order received.
+  std::array<Header, kMaxHeaders> headers;
+  std::size_t num_headers;
+
+  // How the body is framed.
+  // - If |chunked|, the body uses the chunked transfer coding
+  // - Else if |has_content_length|, the body is |content_length| bytes
+  // - Else there is no body
+  bool chunked;
+  bool has_content_length;
+  uint64_t content_length;
+
+  // True iff the client wants to send more requests on this connection.
+  bool keep_alive;
+
+  // True iff the client sent "Expect: 100-continue".
+  bool expect_continue;
+
+  // The length of the head in bytes, including the empty line.
+  std::size_t size;
+
+  RequestHead() noexcept { clear(); }
+
+  // Resets this RequestHead to the empty state.
+  void clear() noexcept;
+
+  // Returns the value of the first header field named |name|, compared
+  // case-insensitively, or an empty StringPiece if there is none.
+  base::StringPiece header(base::StringPiece name) const noexcept;
+
+  // Returns true iff |method| is "HEAD".
+  bool is_head() const noexcept;
+};
+
+// RequestParser parses the head of an HTTP/1.x request, as defined in RFC
+// 7230 section 3, without allocating memory.
+//
+// The caller appends received bytes to a buffer, and calls |parse()| with
+// all of the buffer after each append.  Lines parsed by earlier calls are
+// not rescanned.
+//
+// Obsolete line folding, whitespace before a colon, and conflicting framing
+// headers are rejected, because intermediaries might not agree on how to
+// interpret them.
+//
+// THREAD SAFETY: This class is NOT thread-safe.
+//
+class RequestParser {
+ public:
+  RequestParser() noexcept { reset(); }
+
+  // Prepares to parse a new request head.
+  void reset() noexcept;
+
+  // Continues parsing the request head at the start of |buf|.
+  // - |buf| MUST start with the same bytes at the same address as on all
+  //   previous calls since |reset()|
+  // - Sets |*done| to true once the head is complete, and |out->size| to
+  //   the number of bytes it took up; any bytes after that are not examined
+  // - Returns a failure if the head is malformed; see |error_status()|
+  base::Result parse(RequestHead* out, bool* done, base::StringPiece buf);
+
+  // Returns the HTTP status code that best describes the last failure:
+  // 400, 431, 501, or 505.
+  int error_status() const noexcept { return error_status_; }
+
+ private:
+  enum class State : uint8_t {
+    request_line = 0,
+    headers = 1,
+    done = 2,
+  };
+
+  base::Result fail(int status, const char* what);
+  base::Result parse_request_line(RequestHead* out, base::StringPiece line);
+  base::Result parse_header(RequestHead* out, base::StringPiece line);
+  base::Result finish(RequestHead* out);
+
+  State state_;
+  std::size_t pos_;   // offset of the first unparsed line
+  std::size_t scan_;  // offset at which to resume looking for LF
+  int error_status_;
+};
+
+// ChunkDecoder removes the chunked transfer coding of RFC 7230 section 4.1.
+// Chunk extensions and trailer fields are skipped.
+//
+// THREAD SAFETY: This class is NOT thread-safe.
+//
+class ChunkDecoder {
+ public:
+  ChunkDecoder() noexcept { reset(); }
+
+  // Prepares to decode a new body.
+  void reset() noexcept;
+
+  // Decodes as much of |in| as possible.
+  // - Sets |*data| to the next run of body bytes within |in|, which may be
+  //   empty, and |*consumed| to the number of bytes of |in| used up,
+  //   including those in |*data|
+  // - Call again with the rest of |in|, plus any bytes received later,
+  //   until |done()|
+  // - Returns INVALID_ARGUMENT if the coding is malformed
+  base::Result decode(base::StringPiece* data, std::size_t* consumed,
+                      base::StringPiece in);
+
+  // Returns true iff the last chunk and the trailer have been consumed.
+  bool done() const noexcept { return state_ == State::done; }
+
+ private:
+  enum class State : uint8_t {
+    size = 0,
+    extension = 1,
+    size_lf = 2,
+    data = 3,
+    data_cr = 4,
+    data_lf = 5,
+    trailer = 6,
+    trailer_lf = 7,
+    trailer_line = 8,
+    done = 9,
+  };
+
+  State state_;
+  uint8_t digits_;
+  uint64_t remaining_;
+};
+
+}  // namespace http
+}  // namespace net
+
+#endif  // NET_HTTP_PARSER_H
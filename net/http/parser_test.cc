@@ -0,0 +1,194 @@
+// Copyright © 2017 by Donald King <chronos@chronos-tachyon.net>
+// Available under the MIT License. See LICENSE for details.
+
+#include "gtest/gtest.h"
+
+#include <string>
+
+#include "base/result_testing.h"
+#include "net/http/parser.h"
+
+using RC = base::ResultCode;
+
+static base::Result parse_all(net::http::RequestParser* p,
+                              net::http::RequestHead* head, bool* done,
+                              const std::string& str) {
+  p->reset();
+  return p->parse(head, done, str);
+}
+
+TEST(RequestParser, Simple) {
+  std::string str =
+      "GET /index.html?x=1 HTTP/1.1\r\n"
+      "Host: example.com\r\n"
+      "User-Agent:  test/1.0  \r\n"
+      "\r\n"
+      "GET /next";
+
+  net::http::RequestParser p;
+  net::http::RequestHead head;
+  bool done;
+  ASSERT_OK(parse_all(&p, &head, &done, str));
+  ASSERT_TRUE(done);
+  EXPECT_EQ("GET", head.method);
+  EXPECT_EQ("/index.html?x=1", head.target);
+  EXPECT_EQ(1U, head.minor_version);
+  ASSERT_EQ(2U, head.num_headers);
+  EXPECT_EQ("Host", head.headers[0].name);
+  EXPECT_EQ("example.com", head.headers[0].value);
+  EXPECT_EQ("test/1.0", head.header("user-agent"));
+  EXPECT_EQ("", head.header("Accept"));
+  EXPECT_FALSE(head.chunked);
+  EXPECT_FALSE(head.has_content_length);
+  EXPECT_TRUE(head.keep_alive);
+  EXPECT_FALSE(head.expect_continue);
+  EXPECT_FALSE(head.is_head());
+  EXPECT_EQ(str.size() - 9, head.size);
+}
+
+TEST(RequestParser, Incremental) {
+  std::string str =
+      "\r\n"
+      "POST /upload HTTP/1.1\n"
+      "Host: example.com\n"
+      "Content-Length: 42\n"
+      "Expect: 100-continue\n"
+      "\n";
+
+  net::http::RequestParser p;
+  net::http::RequestHead head;
+  bool done = false;
+  for (std::size_t i = 1; i <= str.size(); ++i) {
+    ASSERT_OK(p.parse(&head, &done, base::StringPiece(str.data(), i)));
+    EXPECT_EQ(i == str.size(), done) << i;
+  }
+  EXPECT_EQ("POST", head.method);
+  EXPECT_EQ("/upload", head.target);
+  EXPECT_TRUE(head.has_content_length);
+  EXPECT_EQ(42U, head.content_length);
+  EXPECT_TRUE(head.expect_continue);
+  EXPECT_EQ(str.size(), head.size);
+}
+
+TEST(RequestParser, KeepAlive) {
+  struct TestRow {
+    const char* input;
+    bool keep_alive;
+  };
+  std::vector<TestRow> testdata = {
+      {"GET / HTTP/1.1\r\nHost: x\r\n\r\n", true},
+      {"GET / HTTP/1.1\r\nHost: x\r\nConnection: close\r\n\r\n", false},
+      {"GET / HTTP/1.1\r\nHost: x\r\nConnection: foo, Close\r\n\r\n", false},
+      {"GET / HTTP/1.0\r\n\r\n", false},
+      {"GET / HTTP/1.0\r\nConnection: keep-alive\r\n\r\n", true},
+  };
+
+  net::http::RequestParser p;
+  net::http::RequestHead head;
+  bool done;
+  for (const auto& row : testdata) {
+    ASSERT_OK(parse_all(&p, &head, &done, row.input));
+    EXPECT_TRUE(done);
+    EXPECT_EQ(row.keep_alive, head.keep_alive) << row.input;
+  }
+}
+
+TEST(RequestParser, Errors) {
+  struct TestRow {
+    const char* input;
+    int status;
+  };
+  std::vector<TestRow> testdata = {
+      {"GET /\r\n\r\n", 400},
+      {"GET / HTTP/1.1\r\n\r\n", 400},
+      {"GET / HTTP/1.1\r\nHost: x\r\nHost: y\r\n\r\n", 400},
+      {"GET / HTTP/1.1\r\nHost : x\r\n\r\n", 400},
+      {"GET / HTTP/1.1\r\nHost: x\r\nX-Foo: a\r\n b\r\n\r\n", 400},
+      {"GET / HTTP/1.1\r\nHost: x\r\nContent-Length: 1\r\n"
+       "Transfer-Encoding: chunked\r\n\r\n",
+       400},
+      {"GET / HTTP/1.1\r\nHost: x\r\nContent-Length: 1\r\n"
+       "Content-Length: 2\r\n\r\n",
+       400},
+      {"GET / HTTP/1.1\r\nHost: x\r\nContent-Length: -1\r\n\r\n", 400},
+      {"GET / HTTP/1.0\r\nTransfer-Encoding: chunked\r\n\r\n", 400},
+      {"GET / HTTP/1.1\r\nHost: x\r\nTransfer-Encoding: gzip\r\n\r\n", 501},
+      {"GET / HTTP/2.0\r\n\r\n", 505},
+  };
+
+  net::http::RequestParser p;
+  net::http::RequestHead head;
+  bool done;
+  for (const auto& row : testdata) {
+    EXPECT_FALSE(parse_all(&p, &head, &done, row.input)) << row.input;
+    EXPECT_EQ(row.status, p.error_status()) << row.input;
+  }
+}
+
+TEST(RequestParser, TooManyHeaders) {
+  std::string str = "GET / HTTP/1.1\r\nHost: x\r\n";
+  for (std::size_t i = 0; i < net::http::kMaxHeaders; ++i) {
+    str += "X-Foo: bar\r\n";
+  }
+  str += "\r\n";
+
+  net::http::RequestParser p;
+  net::http::RequestHead head;
+  bool done;
+  base::Result r = parse_all(&p, &head, &done, str);
+  EXPECT_EQ(RC::RESOURCE_EXHAUSTED, r.code());
+  EXPECT_EQ(431, p.error_status());
+}
+
+static base::Result decode_all(std::string* out, bool* done,
+                               const std::string& in, std::size_t step) {
+  net::http::ChunkDecoder d;
+  out->clear();
+  std::string pending;
+  for (std::size_t i = 0; i < in.size(); i += step) {
+    pending.append(in, i, step);
+    while (!pending.empty() && !d.done()) {
+      base::StringPiece data;
+      std::size_t consumed;
+      base::Result r = d.decode(&data, &consumed, pending);
+      if (!r) return r;
+      out->append(data.data(), data.size());
+      pending.erase(0, consumed);
+      if (consumed == 0) break;
+    }
+  }
+  *done = d.done();
+  return base::Result();
+}
+
+TEST(ChunkDecoder, Decode) {
+  std::string in =
+      "5\r\nHello\r\n"
+      "7;name=value\r\n, world\r\n"
+      "1A\r\nabcdefghijklmnopqrstuvwxyz\r\n"
+      "0\r\n"
+      "X-Trailer: yes\r\n"
+      "\r\n";
+  std::string expected = "Hello, worldabcdefghijklmnopqrstuvwxyz";
+
+  for (std::size_t step : {1, 2, 3, 7, 1000}) {
+    std::string out;
+    bool done;
+    ASSERT_OK(decode_all(&out, &done, in, step));
+    EXPECT_TRUE(done) << step;
+    EXPECT_EQ(expected, out) << step;
+  }
+}
+
+TEST(ChunkDecoder, Errors) {
+  for (const char* in : {
+           "\r\n",
+           "5\r\nHelloX\r\n",
+           "g\r\n",
+           "11111111111111111\r\n",
+       }) {
+    std::string out;
+    bool done;
+    EXPECT_FALSE(decode_all(&out, &done, in, 1000)) << in;
+  }
+}
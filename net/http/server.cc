@@ -0,0 +1,984 @@
+// Copyright © 2017 by Donald King <chronos@chronos-tachyon.net>
+// Available under the MIT License. See LICENSE for details.
+
+#include "net/http/server.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+
+#include "base/backport.h"
+#include "base/logging.h"
+#include "base/time/time.h"
+#include "event/callback.h"
+#include "event/manager.h"
+#include "file/file.h"
+#include "file/options.h"
+#include "io/options.h"
+#include "io/util.h"
+#include "io/writer.h"
+#include "net/http/chunked.h"
+#include "net/http/frame.h"
+#include "net/http/http2.h"
+#include "net/http/internal.h"
+#include "net/net.h"
+#include "net/url/url.h"
+
+using RC = base::ResultCode;
+using base::time::MonotonicTime;
+using base::time::monotonic_now;
+using net::http::internal::append_date;
+using net::http::internal::append_number;
+using net::http::internal::fire_and_forget;
+
+namespace net {
+namespace http {
+
+// Responses to pipelined requests are held back until this many bytes have
+// gathered, or until no more requests are buffered.
+static constexpr std::size_t kMaxPending = 65536;
+
+const char* reason_phrase(int status) noexcept {
+  switch (status) {
+    case 100:
+      return "Continue";
+    case 200:
+      return "OK";
+    case 201:
+      return "Created";
+    case 204:
+      return "No Content";
+    case 206:
+      return "Partial Content";
+    case 301:
+      return "Moved Permanently";
+    case 302:
+      return "Found";
+    case 304:
+      return "Not Modified";
+    case 400:
+      return "Bad Request";
+    case 403:
+      return "Forbidden";
+    case 404:
+      return "Not Found";
+    case 405:
+      return "Method Not Allowed";
+    case 408:
+      return "Request Timeout";
+    case 411:
+      return "Length Required";
+    case 413:
+      return "Payload Too Large";
+    case 414:
+      return "URI Too Long";
+    case 431:
+      return "Request Header Fields Too Large";
+    case 500:
+      return "Internal Server Error";
+    case 501:
+      return "Not Implemented";
+    case 503:
+      return "Service Unavailable";
+    case 505:
+      return "HTTP Version Not Supported";
+    default:
+      return "Unknown";
+  }
+}
+
+void Response::clear() {
+  status = 200;
+  headers.clear();
+  body.clear();
+  body_reader.reset();
+  body_length = -1;
+  close = false;
+}
+
+namespace {
+
+void append_status_line(std::string* out, int status) {
+  char buf[16];
+  int n = ::snprintf(buf, sizeof(buf), "HTTP/1.1 %03d ", status);
+  out->append(buf, n);
+  out->append(reason_phrase(status));
+  out->append("\r\n");
+}
+
+// ProgressReader calls |fn| each time a read of |r| returns some bytes, so
+// that a timeout can be pushed back for as long as the client keeps sending.
+class ProgressReader : public io::ReaderImpl {
+ public:
+  ProgressReader(io::Reader r, std::function<void()> fn)
+      : r_(std::move(r)), fn_(std::move(fn)) {}
+
+  std::size_t ideal_block_size() const noexcept override {
+    return r_.ideal_block_size();
+  }
+
+  bool is_buffered() const noexcept override { return r_.is_buffered(); }
+
+  void read(event::Task* task, char* out, std::size_t* n, std::size_t min,
+            std::size_t max, const base::Options& opts) override {
+    if (!prologue(task, out, n, min, max)) return;
+    auto helper = base::backport::make_unique<Helper>(task, n, fn_);
+    auto* st = &helper->subtask;
+    task->add_subtask(st);
+    r_.read(st, out, n, min, max, opts);
+    st->on_finished(std::move(helper));
+  }
+
+  void close(event::Task* task, const base::Options& opts) override {
+    r_.close(task, opts);
+  }
+
+ private:
+  struct Helper : public event::Callback {
+    event::Task* const task;
+    std::size_t* const n;
+    const std::function<void()> fn;
+    event::Task subtask;
+
+    Helper(event::Task* t, std::size_t* n, std::function<void()> f) noexcept
+        : task(t),
+          n(n),
+          fn(std::move(f)) {}
+
+    base::Result run() override {
+      if (*n > 0) fn();
+      event::propagate_result(task, &subtask);
+      return base::Result();
+    }
+  };
+
+  const io::Reader r_;
+  const std::function<void()> fn_;
+};
+
+}  // anonymous namespace
+
+struct Server::State : public std::enable_shared_from_this<Server::State> {
+  class Session;
+
+  const Handler handler;
+  const ServerOptions so;
+  const base::Options options;
+  const event::Manager manager;
+  mutable std::mutex mu;
+  ListenConn listener;  // protected by mu
+  std::unordered_map<Session*, std::shared_ptr<Session>>
+      sessions;         // protected by mu
+  ServerStats stats;    // protected by mu
+  bool shutting_down;   // protected by mu
+
+  State(Handler h, ServerOptions so, base::Options opts)
+      : handler(std::move(h)),
+        so(std::move(so)),
+        options(std::move(opts)),
+        manager(io::get_manager(options)),
+        shutting_down(false) {}
+
+  void listen(event::Task* task, const Addr& bind);
+  void serve(Conn conn);
+  void remove(Session* session);
+  void shutdown();
+};
+
+// Session serves the requests on one connection, one after another.  Each
+// step starts at most one operation on |task_| and names the step that
+// continues once it finishes, so only the timer runs concurrently.
+class Server::State::Session
+    : public std::enable_shared_from_this<Server::State::Session> {
+ public:
+  Session(std::shared_ptr<State> state, Conn conn)
+      : state_(std::move(state)),
+        so_(state_->so),
+        conn_(std::move(conn)),
+        br_(io::bufferedreader(conn_.reader())),
+        w_(conn_.writer()),
+        hbuf_(so_.max_header_bytes),
+        hlen_(0),
+        n_(0),
+        copied_(0),
+        nreqs_(0),
+        keep_alive_(false),
+        chunked_(false),
+        has_body_(false),
+        armed_(false),
+        shut_(false) {}
+
+  void start();
+
+  // Shuts the connection down, waking any I/O blocked on it.
+  // - Thread-safe
+  void shut();
+
+ private:
+  using Step = void (Session::*)();
+
+  // Runs |step| once |task_| finishes.  Completions can arrive with locks
+  // in |br_| still held, so steps always go through the dispatcher.
+  void then(Step step) {
+    task_.on_finished(state_->manager.dispatcher(),
+                      event::callback([this, step] {
+                        (this->*step)();
+                        return base::Result();
+                      }));
+  }
+
+  void next_request();
+  void wait_request();
+  void read_head();
+  void on_head_read();
+  void begin_request();
+  void call_handler();
+  void on_handled();
+  void on_drained();
+  void send_response();
+  void send_body();
+  void on_body_sent();
+  void finish_response();
+  void reject(int status);
+  void flush(Step next);
+  void on_flushed();
+  void end();
+  void on_closed();
+  void start_http2();
+
+  void arm(base::time::Duration timeout);
+  void disarm();
+  void expire();
+
+  const std::shared_ptr<State> state_;
+  const ServerOptions& so_;
+  const Conn conn_;
+  const io::Reader br_;
+  const io::Writer w_;
+  std::vector<char> hbuf_;
+  std::size_t hlen_;
+  RequestParser parser_;
+  Request req_;
+  Response resp_;
+  std::string obuf_;  // response bytes not yet written
+  event::Task task_;
+  std::size_t n_;
+  std::size_t copied_;
+  Step after_flush_;
+  std::size_t nreqs_;
+  bool keep_alive_;
+  bool chunked_;
+  bool has_body_;
+  std::unique_ptr<Http2Conn> h2_;
+
+  std::mutex mu_;
+  event::Handle timer_;     // protected by mu_
+  MonotonicTime deadline_;  // protected by mu_
+  bool armed_;              // protected by mu_
+  bool shut_;               // protected by mu_
+};
+
+void Server::State::Session::start() {
+  std::weak_ptr<Session> weak = shared_from_this();
+  auto closure = [weak](event::Data data) {
+    auto self = weak.lock();
+    if (self) self->expire();
+    return base::Result();
+  };
+  base::Result r = state_->manager.timer(&timer_, event::handler(closure));
+  if (!r) LOG(WARN) << "net::http::Server: no timeouts: " << r;
+
+  req_.local_addr = conn_.local_addr();
+  req_.remote_addr = conn_.remote_addr();
+  next_request();
+}
+
+void Server::State::Session::shut() {
+  auto lock = base::acquire_lock(mu_);
+  if (shut_) return;
+  shut_ = true;
+  lock.unlock();
+  io::Reader r = conn_.reader();
+  io::Writer w = conn_.writer();
+  fire_and_forget([r](event::Task* task) { r.close(task); });
+  fire_and_forget([w](event::Task* task) { w.close(task); });
+}
+
+void Server::State::Session::next_request() {
+  parser_.reset();
+  hlen_ = 0;
+  if (so_.max_requests_per_conn != 0 &&
+      nreqs_ >= so_.max_requests_per_conn) {
+    flush(&Session::end);
+    return;
+  }
+
+  // Hold the responses back for as long as the client has already sent more
+  // requests, so that a pipeline of them is answered with one write.
+  char ch;
+  if (!obuf_.empty() &&
+      (obuf_.size() >= kMaxPending || br_.peek(&ch, 1) == 0)) {
+    flush(&Session::wait_request);
+    return;
+  }
+  wait_request();
+}
+
+void Server::State::Session::wait_request() {
+  arm(so_.idle_timeout);
+  read_head();
+}
+
+void Server::State::Session::read_head() {
+  n_ = 0;
+  task_.reset();
+  br_.read(&task_, hbuf_.data() + hlen_, &n_, 1, hbuf_.size() - hlen_,
+           state_->options);
+  then(&Session::on_head_read);
+}
+
+void Server::State::Session::on_head_read() {
+  base::Result r = task_.result();
+  if (hlen_ == 0 && n_ > 0) arm(so_.header_timeout);
+  hlen_ += n_;
+
+  // RFC 7540 section 3.5: a client with prior knowledge opens with the
+  // HTTP/2 connection preface instead of a request.
+  if (nreqs_ == 0 && so_.enable_http2 && hlen_ != 0 &&
+      ::memcmp(hbuf_.data(), kClientPreface,
+               std::min(hlen_, kClientPrefaceSize)) == 0) {
+    if (hlen_ >= kClientPrefaceSize) {
+      start_http2();
+      return;
+    }
+    if (r) {
+      read_head();
+      return;
+    }
+  }
+
+  if (n_ > 0) {
+    bool done;
+    base::Result pr = parser_.parse(&req_.head, &done,
+                                    base::StringPiece(hbuf_.data(), hlen_));
+    if (!pr) {
+      VLOG(1) << "net::http::Server: " << pr;
+      reject(parser_.error_status());
+      return;
+    }
+    if (done) {
+      // The rest belongs to the body or to the next request.
+      std::size_t size = req_.head.size;
+      if (size < hlen_) {
+        br_.unread(hbuf_.data() + size, hlen_ - size)
+            .expect_ok(__FILE__, __LINE__);
+      }
+      begin_request();
+      return;
+    }
+  }
+
+  if (!r) {
+    if (hlen_ != 0 || r.code() != RC::END_OF_FILE)
+      VLOG(1) << "net::http::Server: reading request: " << r;
+    end();
+    return;
+  }
+  if (hlen_ == hbuf_.size()) {
+    reject(431);
+    return;
+  }
+  read_head();
+}
+
+void Server::State::Session::begin_request() {
+  disarm();
+  ++nreqs_;
+  auto lock = base::acquire_lock(state_->mu);
+  ++state_->stats.requests;
+  lock.unlock();
+
+  const auto& head = req_.head;
+  if (head.chunked)
+    req_.body = chunkedreader(br_);
+  else if (head.content_length != 0)
+    req_.body = io::limited_reader(io::ignore_close(br_), head.content_length);
+  else
+    req_.body = io::nullreader();
+  has_body_ = (head.chunked || head.content_length != 0);
+  if (has_body_) {
+    // The timeout only cuts off a client that stops sending.
+    std::weak_ptr<Session> weak = shared_from_this();
+    req_.body = io::Reader(std::make_shared<ProgressReader>(
+        std::move(req_.body), [weak] {
+          auto self = weak.lock();
+          if (self) self->arm(self->so_.body_timeout);
+        }));
+  }
+  resp_.clear();
+
+  // RFC 7231 section 5.1.1: the client waits for this before sending a body.
+  if (head.expect_continue && (head.chunked || head.content_length != 0)) {
+    obuf_.append("HTTP/1.1 100 Continue\r\n\r\n");
+    flush(&Session::call_handler);
+    return;
+  }
+  call_handler();
+}
+
+void Server::State::Session::call_handler() {
+  if (has_body_) arm(so_.body_timeout);
+  task_.reset();
+  state_->handler(&task_, &req_, &resp_);
+  then(&Session::on_handled);
+}
+
+void Server::State::Session::on_handled() {
+  disarm();
+  base::Result r = task_.result();
+  if (!r) {
+    LOG(WARN) << "net::http::Server: handler failed: " << r;
+    resp_.clear();
+    resp_.status = 500;
+    resp_.close = true;
+  }
+  if (resp_.close || !req_.head.keep_alive) {
+    send_response();
+    return;
+  }
+
+  // Whatever the handler left of the body has to be read past before the
+  // next request can be.
+  if (has_body_) arm(so_.body_timeout);
+  copied_ = 0;
+  task_.reset();
+  io::copy_n(&task_, &copied_, so_.max_drain_bytes + 1, io::discardwriter(),
+             req_.body, state_->options);
+  then(&Session::on_drained);
+}
+
+void Server::State::Session::on_drained() {
+  disarm();
+  base::Result r = task_.result();
+  if (!r || copied_ > so_.max_drain_bytes) resp_.close = true;
+  send_response();
+}
+
+void Server::State::Session::send_response() {
+  req_.body.reset();
+  const auto& head = req_.head;
+  const int status = resp_.status;
+  const bool has_body = (status >= 200 && status != 204 && status != 304);
+  const bool use_reader = !!resp_.body_reader;
+
+  keep_alive_ = head.keep_alive && !resp_.close;
+  if (so_.max_requests_per_conn != 0 && nreqs_ >= so_.max_requests_per_conn)
+    keep_alive_ = false;
+  chunked_ = false;
+  if (has_body && use_reader && resp_.body_length < 0) {
+    if (head.minor_version >= 1)
+      chunked_ = true;
+    else
+      keep_alive_ = false;
+  }
+
+  append_status_line(&obuf_, status);
+  obuf_.append("Date: ");
+  append_date(&obuf_);
+  obuf_.append("\r\n");
+  for (const auto& pair : resp_.headers) {
+    obuf_.append(pair.first);
+    obuf_.append(": ");
+    obuf_.append(pair.second);
+    obuf_.append("\r\n");
+  }
+  if (chunked_) {
+    obuf_.append("Transfer-Encoding: chunked\r\n");
+  } else if (has_body && (!use_reader || resp_.body_length >= 0)) {
+    obuf_.append("Content-Length: ");
+    append_number(&obuf_, use_reader ? resp_.body_length : resp_.body.size());
+    obuf_.append("\r\n");
+  }
+  if (!keep_alive_)
+    obuf_.append("Connection: close\r\n");
+  else if (head.minor_version == 0)
+    obuf_.append("Connection: keep-alive\r\n");
+  obuf_.append("\r\n");
+
+  const bool send = has_body && !head.is_head();
+  if (!use_reader) {
+    if (send) obuf_.append(resp_.body);
+    finish_response();
+    return;
+  }
+  if (!send) {
+    io::Reader r = std::move(resp_.body_reader);
+    fire_and_forget([r](event::Task* task) { r.close(task); });
+    finish_response();
+    return;
+  }
+  flush(&Session::send_body);
+}
+
+void Server::State::Session::send_body() {
+  arm(so_.write_timeout);
+  copied_ = 0;
+  task_.reset();
+  if (chunked_) {
+    io::copy(&task_, &copied_, chunkedwriter(w_), resp_.body_reader,
+             state_->options);
+  } else {
+    io::copy_n(&task_, &copied_, resp_.body_length, w_, resp_.body_reader,
+               state_->options);
+  }
+  then(&Session::on_body_sent);
+}
+
+void Server::State::Session::on_body_sent() {
+  disarm();
+  base::Result r = task_.result();
+  io::Reader body = std::move(resp_.body_reader);
+  fire_and_forget([body](event::Task* task) { body.close(task); });
+
+  // A body that came up short can't be framed, so the client has to be
+  // told by closing the connection.
+  if (!r || (!chunked_ && copied_ != uint64_t(resp_.body_length))) {
+    if (r) r = base::Result::data_loss("short body");
+    VLOG(1) << "net::http::Server: writing response: " << r;
+    end();
+    return;
+  }
+  if (chunked_) obuf_.append("0\r\n\r\n");
+  finish_response();
+}
+
+void Server::State::Session::finish_response() {
+  resp_.clear();
+  if (keep_alive_)
+    next_request();
+  else
+    flush(&Session::end);
+}
+
+void Server::State::Session::reject(int status) {
+  disarm();
+  auto lock = base::acquire_lock(state_->mu);
+  ++state_->stats.bad_requests;
+  lock.unlock();
+
+  append_status_line(&obuf_, status);
+  obuf_.append("Date: ");
+  append_date(&obuf_);
+  obuf_.append("\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+  flush(&Session::end);
+}
+
+void Server::State::Session::flush(Step next) {
+  if (obuf_.empty()) {
+    (this->*next)();
+    return;
+  }
+  after_flush_ = next;
+  arm(so_.write_timeout);
+  n_ = 0;
+  task_.reset();
+  w_.write(&task_, &n_, obuf_.data(), obuf_.size(), state_->options);
+  then(&Session::on_flushed);
+}
+
+void Server::State::Session::on_flushed() {
+  disarm();
+  base::Result r = task_.result();
+  obuf_.clear();
+  if (!r) {
+    VLOG(1) << "net::http::Server: writing response: " << r;
+    end();
+    return;
+  }
+  (this->*after_flush_)();
+}
+
+void Server::State::Session::end() {
+  disarm();
+  req_.body.reset();
+  if (resp_.body_reader) {
+    io::Reader body = std::move(resp_.body_reader);
+    fire_and_forget([body](event::Task* task) { body.close(task); });
+  }
+
+  // Only the writing half is closed here, which sends the client EOF.  The
+  // descriptor goes with the Session: closing it now would free its number
+  // for reuse while the poller still watches it.
+  task_.reset();
+  w_.close(&task_, state_->options);
+  then(&Session::on_closed);
+}
+
+void Server::State::Session::on_closed() {
+  auto lock = base::acquire_lock(mu_);
+  if (timer_) {
+    timer_.disable().ignore_ok();
+    timer_.disown();
+  }
+  lock.unlock();
+
+  // This may destroy |this|, so it has to come last.
+  auto state = state_;
+  state->remove(this);
+}
+
+void Server::State::Session::start_http2() {
+  disarm();
+  br_.unread(hbuf_.data(), hlen_).expect_ok(__FILE__, __LINE__);
+  hlen_ = 0;
+  auto lock = base::acquire_lock(state_->mu);
+  ++state_->stats.http2_connections;
+  lock.unlock();
+
+  Http2Conn::Hooks hooks;
+  hooks.on_request = [this](bool ok) {
+    auto lock = base::acquire_lock(state_->mu);
+    if (ok)
+      ++state_->stats.requests;
+    else
+      ++state_->stats.bad_requests;
+  };
+  hooks.set_timeout = [this](base::time::Duration timeout) { arm(timeout); };
+  hooks.shut = [this] { shut(); };
+
+  h2_.reset(new Http2Conn(state_->handler, so_, state_->options, br_, w_,
+                          req_.local_addr, req_.remote_addr,
+                          std::move(hooks)));
+  task_.reset();
+  h2_->start(&task_);
+  then(&Session::end);
+}
+
+void Server::State::Session::arm(base::time::Duration timeout) {
+  auto lock = base::acquire_lock(mu_);
+  if (!timer_) return;
+  if (timeout.is_zero()) {
+    if (armed_) timer_.cancel().ignore_ok();
+    armed_ = false;
+    return;
+  }
+  deadline_ = monotonic_now() + timeout;
+  timer_.set_at(deadline_).expect_ok(__FILE__, __LINE__);
+  armed_ = true;
+}
+
+void Server::State::Session::disarm() {
+  auto lock = base::acquire_lock(mu_);
+  if (!armed_) return;
+  timer_.cancel().ignore_ok();
+  armed_ = false;
+}
+
+void Server::State::Session::expire() {
+  // The timer may have fired just before being disarmed or re-armed.
+  auto lock = base::acquire_lock(mu_);
+  if (!armed_ || monotonic_now() < deadline_) return;
+  armed_ = false;
+  lock.unlock();
+
+  auto slock = base::acquire_lock(state_->mu);
+  ++state_->stats.timeouts;
+  slock.unlock();
+  VLOG(1) << "net::http::Server: connection timed out";
+  shut();
+}
+
+void Server::State::listen(event::Task* task, const Addr& bind) {
+  struct Helper {
+    std::shared_ptr<State> state;
+    event::Task* const task;
+    event::Task subtask;
+
+    Helper(std::shared_ptr<State> s, event::Task* t) noexcept
+        : state(std::move(s)), task(t) {}
+  };
+
+  std::weak_ptr<State> weak = shared_from_this();
+  AcceptFn fn = [weak](Conn conn) {
+    auto self = weak.lock();
+    if (self) {
+      self->serve(std::move(conn));
+    } else {
+      fire_and_forget([conn](event::Task* t) { conn.close(t); });
+    }
+  };
+
+  auto* h = new Helper(shared_from_this(), task);
+  task->add_subtask(&h->subtask);
+  net::listen(&h->subtask, &listener, bind, options, std::move(fn));
+  h->subtask.on_finished(event::callback([h] {
+    if (event::propagate_failure(h->task, &h->subtask)) {
+      delete h;
+      return base::Result();
+    }
+    auto lock = base::acquire_lock(h->state->mu);
+    ListenConn l = h->state->listener;
+    lock.unlock();
+    h->subtask.reset();
+    h->task->add_subtask(&h->subtask);
+    l.start(&h->subtask, h->state->options);
+    h->subtask.on_finished(event::callback([h] {
+      event::propagate_result(h->task, &h->subtask);
+      delete h;
+      return base::Result();
+    }));
+    return base::Result();
+  }));
+}
+
+void Server::State::serve(Conn conn) {
+  auto lock = base::acquire_lock(mu);
+  if (shutting_down) {
+    lock.unlock();
+    fire_and_forget([conn](event::Task* task) { conn.close(task); });
+    return;
+  }
+  auto session = std::make_shared<Session>(shared_from_this(), conn);
+  sessions[session.get()] = session;
+  ++stats.connections;
+  ++stats.active;
+  lock.unlock();
+  session->start();
+}
+
+void Server::State::remove(Session* session) {
+  auto lock = base::acquire_lock(mu);
+  auto it = sessions.find(session);
+  CHECK(it != sessions.end());
+  auto* ptr = new std::shared_ptr<Session>(std::move(it->second));
+  sessions.erase(it);
+  --stats.active;
+  lock.unlock();
+
+  // Destroying a connection may wait on the poller, which callbacks can't.
+  manager.dispatcher()->dispose(ptr);
+}
+
+void Server::State::shutdown() {
+  auto lock = base::acquire_lock(mu);
+  shutting_down = true;
+  ListenConn l = std::move(listener);
+  listener.reset();
+  std::vector<std::shared_ptr<Session>> vec;
+  vec.reserve(sessions.size());
+  for (const auto& pair : sessions) vec.push_back(pair.second);
+  lock.unlock();
+
+  if (l) fire_and_forget([l](event::Task* task) { l.close(task); });
+  for (const auto& session : vec) session->shut();
+}
+
+Server::Server(Handler handler, ServerOptions so, const base::Options& opts)
+    : state_(std::make_shared<State>(std::move(handler), std::move(so),
+                                     opts)) {}
+
+Server::~Server() noexcept { shutdown(); }
+
+void Server::listen(event::Task* task, const Addr& bind) {
+  CHECK_NOTNULL(task);
+  if (!task->start()) return;
+  state_->listen(task, bind);
+}
+
+base::Result Server::listen(const Addr& bind) {
+  event::Task task;
+  listen(&task, bind);
+  event::wait(state_->manager, &task);
+  return task.result();
+}
+
+Addr Server::listen_addr() const {
+  auto lock = base::acquire_lock(state_->mu);
+  return state_->listener.listen_addr();
+}
+
+void Server::serve(Conn conn) { state_->serve(std::move(conn)); }
+
+void Server::shutdown() { state_->shutdown(); }
+
+ServerStats Server::stats() const {
+  auto lock = base::acquire_lock(state_->mu);
+  return state_->stats;
+}
+
+namespace {
+
+const char* content_type(base::StringPiece path) {
+  static const struct {
+    const char* ext;
+    const char* type;
+  } kTypes[] = {
+      {".html", "text/html; charset=utf-8"},
+      {".htm", "text/html; charset=utf-8"},
+      {".css", "text/css; charset=utf-8"},
+      {".js", "application/javascript"},
+      {".json", "application/json"},
+      {".txt", "text/plain; charset=utf-8"},
+      {".svg", "image/svg+xml"},
+      {".png", "image/png"},
+      {".jpg", "image/jpeg"},
+      {".jpeg", "image/jpeg"},
+      {".gif", "image/gif"},
+  };
+  std::size_t slash = path.rfind('/');
+  std::size_t dot = path.rfind('.');
+  if (dot != base::StringPiece::npos &&
+      (slash == base::StringPiece::npos || dot > slash)) {
+    base::StringPiece ext = path.substring(dot);
+    for (const auto& t : kTypes) {
+      if (ext == t.ext) return t.type;
+    }
+  }
+  return "application/octet-stream";
+}
+
+void set_error(Response* resp, int status) {
+  resp->clear();
+  resp->status = status;
+  resp->add_header("Content-Type", "text/plain; charset=utf-8");
+  std::string body;
+  body.append(reason_phrase(status));
+  body.push_back('\n');
+  resp->set_body(std::move(body));
+}
+
+int status_for(const base::Result& r) {
+  switch (r.code()) {
+    case RC::NOT_FOUND:
+      return 404;
+    case RC::PERMISSION_DENIED:
+      return 403;
+    default:
+      return 500;
+  }
+}
+
+bool has_dotdot(base::StringPiece path) {
+  while (!path.empty()) {
+    std::size_t slash = path.find('/');
+    if (slash == base::StringPiece::npos) slash = path.size();
+    if (path.prefix(slash) == "..") return true;
+    if (slash == path.size()) break;
+    path.remove_prefix(slash + 1);
+  }
+  return false;
+}
+
+struct FileHelper {
+  event::Task* const task;
+  Response* const resp;
+  const base::Options options;
+  std::string path;
+  file::Stat stat;
+  file::File file;
+  event::Task subtask;
+  bool tried_index;
+
+  FileHelper(event::Task* t, Response* r, base::Options o, std::string p)
+      : task(t),
+        resp(r),
+        options(std::move(o)),
+        path(std::move(p)),
+        tried_index(false) {}
+
+  void do_stat() {
+    subtask.reset();
+    task->add_subtask(&subtask);
+    file::stat(&subtask, &stat, "local", path, options);
+    subtask.on_finished(event::callback([this] {
+      stat_complete();
+      return base::Result();
+    }));
+  }
+
+  void stat_complete() {
+    base::Result r = subtask.result();
+    if (!r) {
+      fail(status_for(r));
+      return;
+    }
+    if (stat.type == file::FileType::directory && !tried_index) {
+      if (path.empty() || path.back() != '/') path.push_back('/');
+      path.append("index.html");
+      tried_index = true;
+      do_stat();
+      return;
+    }
+    if (stat.type != file::FileType::regular) {
+      fail(404);
+      return;
+    }
+
+    subtask.reset();
+    task->add_subtask(&subtask);
+    file::open(&subtask, &file, "local", path, file::Mode::ro_mode(),
+               options);
+    subtask.on_finished(event::callback([this] {
+      open_complete();
+      return base::Result();
+    }));
+  }
+
+  void open_complete() {
+    base::Result r = subtask.result();
+    if (!r) {
+      fail(status_for(r));
+      return;
+    }
+    resp->add_header("Content-Type", content_type(path));
+    resp->set_body(file.reader(), stat.size);
+    task->finish_ok();
+    delete this;
+  }
+
+  void fail(int status) {
+    set_error(resp, status);
+    task->finish_ok();
+    delete this;
+  }
+};
+
+}  // anonymous namespace
+
+Handler file_handler(std::string root) {
+  while (!root.empty() && root.back() == '/') root.pop_back();
+  return [root](event::Task* task, Request* req, Response* resp) {
+    if (!task->start()) return;
+
+    const auto& head = req->head;
+    if (head.method != "GET" && head.method != "HEAD") {
+      set_error(resp, 405);
+      resp->add_header("Allow", "GET, HEAD");
+      task->finish_ok();
+      return;
+    }
+
+    base::StringPiece target = head.target;
+    std::size_t q = target.find('?');
+    if (q != base::StringPiece::npos) target = target.prefix(q);
+    url::URL u;
+    if (!target.has_prefix("/") || !u.set_raw_path(target) ||
+        has_dotdot(u.path())) {
+      set_error(resp, 400);
+      task->finish_ok();
+      return;
+    }
+
+    std::string path = root;
+    path.append(u.path().data(), u.path().size());
+    auto* h = new FileHelper(task, resp, base::default_options(),
+                             std::move(path));
+    h->do_stat();
+  };
+}
+
+}  // namespace http
+}  // namespace net
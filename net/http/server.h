@@ -0,0 +1,261 @@
+// net/http/server.h - HTTP/1.1 and HTTP/2 server
+// Copyright © 2017 by Donald King <chronos@chronos-tachyon.net>
+// Available under the MIT License. See LICENSE for details.
+
+#ifndef NET_HTTP_SERVER_H
+#define NET_HTTP_SERVER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "base/options.h"
+#include "base/result.h"
+#include "base/time/duration.h"
+#include "event/task.h"
+#include "io/reader.h"
+#include "net/addr.h"
+#include "net/conn.h"
+#include "net/http/parser.h"
+
+namespace net {
+namespace http {
+
+struct ServerOptions {
+  // The largest request head accepted, in bytes.  Each connection holds a
+  // buffer of this size; longer heads get "431 Request Header Fields Too
+  // Large".
+  std::size_t max_header_bytes;
+
+  // How long a connection may wait for the first byte of a request.
+  // - If zero, idle connections are kept until the client closes them
+  base::time::Duration idle_timeout;
+
+  // How long a client may take to send a request head, once it has started.
+  // - If zero, there is no limit
+  base::time::Duration header_timeout;
+
+  // How long a client may go without sending any more of a request body,
+  // while the handler is reading it or it is being discarded afterward.
+  // - If zero, there is no limit
+  base::time::Duration body_timeout;
+
+  // How long a response may take to write.
+  // - If zero, there is no limit
+  base::time::Duration write_timeout;
+
+  // The number of requests after which a connection is closed.
+  // - If 0, there is no limit
+  std::size_t max_requests_per_conn;
+
+  // The most unread request body that is discarded to keep a connection
+  // alive after the handler returns.  Connections with more are closed.
+  std::size_t max_drain_bytes;
+
+  // If true, connections that open with the HTTP/2 connection preface are
+  // served as HTTP/2, i.e. "h2c" with prior knowledge, per RFC 7540
+  // section 3.4.  For HTTP/2, |max_header_bytes| limits the decoded size of
+  // each request's header list, and |max_requests_per_conn| and
+  // |max_drain_bytes| do not apply.
+  bool enable_http2;
+
+  // HTTP/2 only: the most requests that a client may have in progress at
+  // once on a connection.
+  uint32_t max_concurrent_streams;
+
+  // HTTP/2 only: the flow control windows for receiving each request body,
+  // and for all of a connection's request bodies together.  Larger windows
+  // let clients upload faster, at the cost of more buffering.
+  uint32_t stream_window_size;
+  uint32_t connection_window_size;
+
+  ServerOptions() noexcept : max_header_bytes(8192),
+                             idle_timeout(base::time::seconds(60)),
+                             header_timeout(base::time::seconds(10)),
+                             body_timeout(base::time::seconds(30)),
+                             write_timeout(base::time::seconds(30)),
+                             max_requests_per_conn(0),
+                             max_drain_bytes(65536),
+                             enable_http2(true),
+                             max_concurrent_streams(250),
+                             stream_window_size(1U << 20),
+                             connection_window_size(1U << 23) {}
+};
+
+// ServerStats holds statistics for a Server.  All fields are advisory only,
+// as they are only a snapshot.
+struct ServerStats {
+  // |connections| is the number of connections served so far.
+  std::size_t connections;
+
+  // |requests| is the number of requests passed to the handler.
+  std::size_t requests;
+
+  // |bad_requests| is the number of requests rejected without calling the
+  // handler, e.g. because their heads were malformed.
+  std::size_t bad_requests;
+
+  // |timeouts| is the number of connections closed by a timeout.
+  std::size_t timeouts;
+
+  // |active| is the number of connections currently open.
+  std::size_t active;
+
+  // |http2_connections| is the number of connections that spoke HTTP/2.
+  std::size_t http2_connections;
+
+  ServerStats() noexcept : connections(0),
+                           requests(0),
+                           bad_requests(0),
+                           timeouts(0),
+                           active(0),
+                           http2_connections(0) {}
+};
+
+// Request is a request received by a Server.
+struct Request {
+  // The request line and header fields.  The StringPieces are only valid
+  // until the handler finishes.
+  RequestHead head;
+
+  // The request body, with any transfer coding removed.  Reaches EOF at the
+  // end of the body; closing it is optional and does not close the
+  // connection.
+  io::Reader body;
+
+  // The addresses of the connection.
+  Addr local_addr;
+  Addr remote_addr;
+};
+
+// Response is the response that a handler fills in.
+struct Response {
+  // The status code.
+  int status;
+
+  // Header fields to send, in order.  The server adds Date, Connection, and
+  // the framing headers itself; handlers MUST NOT add those.
+  std::vector<std::pair<std::string, std::string>> headers;
+
+  // The body, if |body_reader| is empty.
+  std::string body;
+
+  // If non-empty, the body is copied from here instead of |body| with
+  // io::copy(), so that regular files are sent with sendfile(2).
+  // - If |body_length| is non-negative, exactly that many bytes are sent
+  // - Else the body is sent chunked to HTTP/1.1 clients, or delimited by
+  //   closing the connection for HTTP/1.0 clients
+  // - The server closes |body_reader| when done with it
+  io::Reader body_reader;
+  int64_t body_length;
+
+  // If true, the connection is closed after this response.
+  bool close;
+
+  Response() { clear(); }
+
+  // Resets this Response to "200 OK" with no headers and an empty body.
+  void clear();
+
+  // Appends a header field.
+  void add_header(std::string name, std::string value) {
+    headers.emplace_back(std::move(name), std::move(value));
+  }
+
+  // Convenience methods for setting the body.
+  void set_body(std::string str) {
+    body = std::move(str);
+    body_reader.reset();
+    body_length = -1;
+  }
+  void set_body(io::Reader r, int64_t length = -1) {
+    body.clear();
+    body_reader = std::move(r);
+    body_length = length;
+  }
+};
+
+// Handler starts |task|, fills in a Response for a Request, and then finishes
+// |task|, like any other asynchronous operation.
+// - If |task| fails, the client gets "500 Internal Server Error" instead
+// - |req| and |resp| stay valid until |task| finishes
+using Handler = std::function<void(event::Task* task, Request* req,
+                                   Response* resp)>;
+
+// Returns the reason phrase for |status|, e.g. "Not Found" for 404.
+const char* reason_phrase(int status) noexcept;
+
+// Server speaks HTTP/1.1 to clients, with persistent connections and
+// pipelining as in RFC 7230 section 6.  Clients that know in advance that the
+// Server speaks HTTP/2 may use that instead; see Http2Conn.
+//
+// Each connection has a single buffer of |max_header_bytes| that request
+// heads are read into and parsed in place, so that a request costs no
+// allocations beyond what the handler does.  Pipelined requests are handled
+// one at a time, and their responses are gathered into one write for as
+// long as more requests are already buffered.
+//
+// Timeouts run on an event::Manager timer per connection; an expired
+// connection is shut down, which wakes any I/O blocked on it.
+//
+// Writing to a connection that the client has reset raises SIGPIPE, so
+// programs that run a Server SHOULD ignore that signal.
+//
+// THREAD SAFETY: This class is thread-safe.
+//
+class Server {
+ public:
+  // Server runs |handler| for each request, and does its I/O and timers on
+  // the io::Options event::Manager.
+  explicit Server(Handler handler, ServerOptions so = ServerOptions(),
+                  const base::Options& opts = base::default_options());
+
+  // Shuts down the Server.  See |shutdown()|.
+  ~Server() noexcept;
+
+  // Server is neither copyable nor moveable.
+  Server(const Server&) = delete;
+  Server(Server&&) = delete;
+  Server& operator=(const Server&) = delete;
+  Server& operator=(Server&&) = delete;
+
+  // Starts accepting connections on |bind|.
+  void listen(event::Task* task, const Addr& bind);
+
+  // Synchronous version of |listen()|.
+  base::Result listen(const Addr& bind);
+
+  // Returns the address that |listen()| bound, e.g. to learn the port when
+  // listening on port 0.
+  Addr listen_addr() const;
+
+  // Serves requests on |conn|, which the Server takes over.  Useful for
+  // connections accepted elsewhere, e.g. those wrapped by tls_server().
+  void serve(Conn conn);
+
+  // Stops listening, and closes all connections.  Requests in progress are
+  // abandoned.
+  void shutdown();
+
+  // Obtains statistics about this Server.
+  ServerStats stats() const;
+
+ private:
+  struct State;
+  std::shared_ptr<State> state_;
+};
+
+// Returns a Handler that serves the regular files under the local directory
+// |root| for GET and HEAD requests.
+// - Requests for a directory are served its "index.html"
+// - Targets containing a ".." path segment get "400 Bad Request"
+Handler file_handler(std::string root);
+
+}  // namespace http
+}  // namespace net
+
+#endif  // NET_HTTP_SERVER_H
@@ -0,0 +1,336 @@
+// Copyright © 2017 by Donald King <chronos@chronos-tachyon.net>
+// Available under the MIT License. See LICENSE for details.
+
+#include "gtest/gtest.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "base/cleanup.h"
+#include "base/fd.h"
+#include "base/result_testing.h"
+#include "base/time/duration.h"
+#include "io/util.h"
+#include "net/connfd.h"
+#include "net/http/server.h"
+#include "net/inet.h"
+#include "net/net.h"
+#include "net/unix.h"
+
+using RC = base::ResultCode;
+
+static void make_pair(net::Conn* a, net::Conn* b) {
+  // The server writes to clients that may have gone away.
+  ::signal(SIGPIPE, SIG_IGN);
+
+  base::SocketPair s;
+  ASSERT_OK(base::make_socketpair(&s, AF_UNIX, SOCK_STREAM, 0));
+  auto addr = net::unixaddr(net::ProtocolType::stream, "");
+  ASSERT_OK(net::fdconn(a, addr, addr, s.left));
+  ASSERT_OK(net::fdconn(b, addr, addr, s.right));
+}
+
+// Reads until EOF.
+static std::string read_all(const net::Conn& c) {
+  std::string out, buf;
+  while (true) {
+    base::Result r = c.reader().read(&buf, 1, 65536);
+    out.append(buf);
+    if (!r) {
+      EXPECT_EOF(r);
+      break;
+    }
+  }
+  return out;
+}
+
+// Removes the Date header fields, which are different on every run.
+static std::string strip_dates(std::string str) {
+  std::size_t i;
+  while ((i = str.find("Date: ")) != std::string::npos) {
+    std::size_t j = str.find("\r\n", i);
+    str.erase(i, j + 2 - i);
+  }
+  return str;
+}
+
+// Echoes the request line and body.
+static void echo_handler(event::Task* task, net::http::Request* req,
+                         net::http::Response* resp) {
+  struct Helper {
+    event::Task* const task;
+    net::http::Request* const req;
+    net::http::Response* const resp;
+    std::string body;
+    std::size_t n;
+    event::Task subtask;
+
+    Helper(event::Task* t, net::http::Request* q, net::http::Response* p)
+        : task(t), req(q), resp(p), n(0) {}
+  };
+
+  if (!task->start()) return;
+  auto* h = new Helper(task, req, resp);
+  task->add_subtask(&h->subtask);
+  io::copy(&h->subtask, &h->n, io::stringwriter(&h->body), req->body);
+  h->subtask.on_finished(event::callback([h] {
+    if (!event::propagate_failure(h->task, &h->subtask)) {
+      const auto& head = h->req->head;
+      std::string str;
+      str.append(head.method.data(), head.method.size());
+      str.push_back(' ');
+      str.append(head.target.data(), head.target.size());
+      str.push_back(' ');
+      str.append(h->body);
+      h->resp->add_header("X-Test", "yes");
+      h->resp->set_body(std::move(str));
+      h->task->finish_ok();
+    }
+    delete h;
+    return base::Result();
+  }));
+}
+
+TEST(Server, Pipelined) {
+  net::Conn c, s;
+  make_pair(&c, &s);
+  net::http::Server server(echo_handler);
+  server.serve(s);
+
+  std::size_t n;
+  EXPECT_OK(c.writer().write(&n,
+                             "GET /a HTTP/1.1\r\nHost: x\r\n\r\n"
+                             "POST /b HTTP/1.1\r\nHost: x\r\n"
+                             "Content-Length: 5\r\n\r\nhello"
+                             "POST /c HTTP/1.1\r\nHost: x\r\n"
+                             "Transfer-Encoding: chunked\r\n\r\n"
+                             "3\r\nabc\r\n2\r\nde\r\n0\r\n\r\n"
+                             "HEAD /d HTTP/1.1\r\nHost: x\r\n\r\n"
+                             "GET /e HTTP/1.1\r\nHost: x\r\n"
+                             "Connection: close\r\n\r\n"));
+  std::string out = strip_dates(read_all(c));
+  EXPECT_EQ(
+      "HTTP/1.1 200 OK\r\nX-Test: yes\r\nContent-Length: 7\r\n\r\nGET /a "
+      "HTTP/1.1 200 OK\r\nX-Test: yes\r\nContent-Length: 13\r\n\r\n"
+      "POST /b hello"
+      "HTTP/1.1 200 OK\r\nX-Test: yes\r\nContent-Length: 13\r\n\r\n"
+      "POST /c abcde"
+      "HTTP/1.1 200 OK\r\nX-Test: yes\r\nContent-Length: 8\r\n\r\n"
+      "HTTP/1.1 200 OK\r\nX-Test: yes\r\nContent-Length: 7\r\n"
+      "Connection: close\r\n\r\nGET /e ",
+      out);
+
+  auto stats = server.stats();
+  EXPECT_EQ(1U, stats.connections);
+  EXPECT_EQ(5U, stats.requests);
+  EXPECT_EQ(0U, stats.bad_requests);
+}
+
+TEST(Server, HTTP10) {
+  net::Conn c, s;
+  make_pair(&c, &s);
+  net::http::Server server(echo_handler);
+  server.serve(s);
+
+  std::size_t n;
+  EXPECT_OK(c.writer().write(&n,
+                             "GET /a HTTP/1.0\r\nConnection: keep-alive\r\n\r\n"
+                             "GET /b HTTP/1.0\r\n\r\n"));
+  std::string out = strip_dates(read_all(c));
+  EXPECT_EQ(
+      "HTTP/1.1 200 OK\r\nX-Test: yes\r\nContent-Length: 7\r\n"
+      "Connection: keep-alive\r\n\r\nGET /a "
+      "HTTP/1.1 200 OK\r\nX-Test: yes\r\nContent-Length: 7\r\n"
+      "Connection: close\r\n\r\nGET /b ",
+      out);
+}
+
+TEST(Server, Streamed) {
+  net::Conn c, s;
+  make_pair(&c, &s);
+  auto handler = [](event::Task* task, net::http::Request* req,
+                    net::http::Response* resp) {
+    if (!task->start()) return;
+    resp->set_body(io::stringreader("streamed body"));
+    task->finish_ok();
+  };
+  net::http::Server server(handler);
+  server.serve(s);
+
+  std::size_t n;
+  EXPECT_OK(c.writer().write(&n,
+                             "GET / HTTP/1.1\r\nHost: x\r\n\r\n"
+                             "GET / HTTP/1.0\r\n\r\n"));
+  std::string out = strip_dates(read_all(c));
+  EXPECT_EQ(
+      "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n"
+      "d\r\nstreamed body\r\n0\r\n\r\n"
+      "HTTP/1.1 200 OK\r\nConnection: close\r\n\r\nstreamed body",
+      out);
+}
+
+TEST(Server, HandlerFails) {
+  net::Conn c, s;
+  make_pair(&c, &s);
+  auto handler = [](event::Task* task, net::http::Request* req,
+                    net::http::Response* resp) {
+    if (!task->start()) return;
+    task->finish(base::Result::internal("oops"));
+  };
+  net::http::Server server(handler);
+  server.serve(s);
+
+  std::size_t n;
+  EXPECT_OK(c.writer().write(&n, "GET / HTTP/1.1\r\nHost: x\r\n\r\n"));
+  std::string out = strip_dates(read_all(c));
+  EXPECT_EQ(
+      "HTTP/1.1 500 Internal Server Error\r\nContent-Length: 0\r\n"
+      "Connection: close\r\n\r\n",
+      out);
+}
+
+TEST(Server, BadRequest) {
+  struct TestRow {
+    const char* input;
+    const char* status_line;
+  };
+  std::vector<TestRow> testdata = {
+      {"GET / HTTP/1.1\r\n\r\n", "HTTP/1.1 400 Bad Request\r\n"},
+      {"GET / HTTP/3.0\r\n\r\n", "HTTP/1.1 505 HTTP Version Not Supported\r\n"},
+      {"GET / HTTP/1.1\r\nHost: x\r\nX-Long: ",
+       "HTTP/1.1 431 Request Header Fields Too Large\r\n"},
+  };
+
+  net::http::ServerOptions so;
+  so.max_header_bytes = 256;
+  net::http::Server server(echo_handler, so);
+  for (const auto& row : testdata) {
+    net::Conn c, s;
+    make_pair(&c, &s);
+    server.serve(s);
+
+    std::string in = row.input;
+    if (in.back() == ' ') in.append(512, 'x');
+    std::size_t n;
+    EXPECT_OK(c.writer().write(&n, in));
+    std::string out = strip_dates(read_all(c));
+    std::string expected = row.status_line;
+    expected += "Content-Length: 0\r\nConnection: close\r\n\r\n";
+    EXPECT_EQ(expected, out);
+  }
+  EXPECT_EQ(3U, server.stats().bad_requests);
+}
+
+TEST(Server, IdleTimeout) {
+  net::Conn c, s;
+  make_pair(&c, &s);
+  net::http::ServerOptions so;
+  so.idle_timeout = base::time::milliseconds(50);
+  net::http::Server server(echo_handler, so);
+  server.serve(s);
+
+  std::size_t n;
+  EXPECT_OK(c.writer().write(&n, "GET / HTTP/1.1\r\nHost: x\r\n\r\n"));
+  std::string out = strip_dates(read_all(c));
+  EXPECT_EQ("HTTP/1.1 200 OK\r\nX-Test: yes\r\nContent-Length: 6\r\n\r\nGET / ",
+            out);
+  EXPECT_EQ(1U, server.stats().timeouts);
+}
+
+TEST(Server, BodyTimeout) {
+  // Ignores the body, which leaves it to be drained.
+  auto ignore_handler = [](event::Task* task, net::http::Request* req,
+                           net::http::Response* resp) {
+    if (task->start()) task->finish_ok();
+  };
+
+  net::http::ServerOptions so;
+  so.body_timeout = base::time::milliseconds(50);
+  for (const auto& handler : {net::http::Handler(echo_handler),
+                              net::http::Handler(ignore_handler)}) {
+    net::Conn c, s;
+    make_pair(&c, &s);
+    net::http::Server server(handler, so);
+    server.serve(s);
+
+    // The client promises a body, then stalls partway through it.
+    std::size_t n;
+    EXPECT_OK(c.writer().write(&n,
+                               "POST / HTTP/1.1\r\nHost: x\r\n"
+                               "Content-Length: 10\r\n\r\nhel"));
+    read_all(c);
+    EXPECT_EQ(1U, server.stats().timeouts);
+  }
+}
+
+TEST(Server, FileHandler) {
+  ::signal(SIGPIPE, SIG_IGN);
+
+  std::string dir;
+  ASSERT_OK(base::make_tempdir(&dir, "mojo2_net_http_XXXXXXXX"));
+  std::string path = dir + "/hello.txt";
+  std::string index = dir + "/index.html";
+  auto cleanup = base::cleanup([&] {
+    ::unlink(path.c_str());
+    ::unlink(index.c_str());
+    ::rmdir(dir.c_str());
+  });
+
+  // Large enough that the body goes out in more than one sendfile(2).
+  std::string content;
+  for (std::size_t i = 0; i < 300000; ++i) content.push_back('a' + i % 26);
+  for (const auto& pair : {std::make_pair(path, content),
+                           std::make_pair(index, std::string("<p>hi</p>"))}) {
+    int fd = ::open(pair.first.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(ssize_t(pair.second.size()),
+              ::write(fd, pair.second.data(), pair.second.size()));
+    ::close(fd);
+  }
+
+  net::http::Server server(net::http::file_handler(dir));
+  ASSERT_OK(server.listen(
+      net::inetaddr(net::ProtocolType::stream, net::IP::localhost_v4(), 0)));
+  net::Addr addr = server.listen_addr();
+
+  auto fetch = [&addr](const std::string& request) {
+    net::Conn c;
+    base::Result r = net::dial(&c, addr, net::Addr());
+    EXPECT_OK(r);
+    if (!r) return std::string();
+    std::size_t n;
+    EXPECT_OK(c.writer().write(&n, request));
+    return strip_dates(read_all(c));
+  };
+
+  EXPECT_EQ(
+      "HTTP/1.1 200 OK\r\nContent-Type: text/plain; charset=utf-8\r\n"
+      "Content-Length: 300000\r\nConnection: close\r\n\r\n" +
+          content,
+      fetch("GET /hello.txt HTTP/1.1\r\nHost: x\r\nConnection: close\r\n\r\n"));
+  EXPECT_EQ(
+      "HTTP/1.1 200 OK\r\nContent-Type: text/plain; charset=utf-8\r\n"
+      "Content-Length: 300000\r\nConnection: close\r\n\r\n",
+      fetch("HEAD /hello.txt HTTP/1.0\r\n\r\n"));
+  EXPECT_EQ(
+      "HTTP/1.1 200 OK\r\nContent-Type: text/html; charset=utf-8\r\n"
+      "Content-Length: 9\r\nConnection: close\r\n\r\n<p>hi</p>",
+      fetch("GET /?q HTTP/1.0\r\n\r\n"));
+  EXPECT_EQ(
+      "HTTP/1.1 404 Not Found\r\nContent-Type: text/plain; charset=utf-8\r\n"
+      "Content-Length: 10\r\nConnection: close\r\n\r\nNot Found\n",
+      fetch("GET /missing HTTP/1.0\r\n\r\n"));
+  EXPECT_EQ(
+      "HTTP/1.1 400 Bad Request\r\nContent-Type: text/plain; charset=utf-8\r\n"
+      "Content-Length: 12\r\nConnection: close\r\n\r\nBad Request\n",
+      fetch("GET /%2e%2e/etc/passwd HTTP/1.0\r\n\r\n"));
+  EXPECT_EQ(
+      "HTTP/1.1 405 Method Not Allowed\r\n"
+      "Content-Type: text/plain; charset=utf-8\r\nAllow: GET, HEAD\r\n"
+      "Content-Length: 19\r\nConnection: close\r\n\r\nMethod Not Allowed\n",
+      fetch("DELETE /hello.txt HTTP/1.0\r\n\r\n"));
+}
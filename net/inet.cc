@@ -16,13 +16,17 @@
 #include <map>
 #include <mutex>
 #include <string>
+#include <utility>
 
 #include "base/logging.h"
 #include "net/addr.h"
 #include "net/conn.h"
 #include "net/connfd.h"
+#include "net/dns.h"
+#include "net/hosts.h"
 #include "net/protocol.h"
 #include "net/registry.h"
+#include "net/resolvecache.h"
 
 using P = net::ProtocolType;
 using RC = base::ResultCode;
@@ -553,6 +557,118 @@ static void my_sev_notify_function(union sigval sv) {
   helper->run();
 }
 
+// Looks up |name| and |service| with getaddrinfo_a(3).
+static void resolve_gai(InetProtocol* inet, event::Task* task,
+                        std::vector<Addr>* out, Order order, int family,
+                        ProtocolType p, std::string name,
+                        std::string service) {
+  if (!task->start()) return;
+  auto* helper = new ResolveHelper(inet, task, out, order, family, p,
+                                   std::move(name), std::move(service));
+  struct gaicb* list[1] = {&helper->cb};
+  int rc = ::getaddrinfo_a(GAI_NOWAIT, list, 1, &helper->sev);
+  if (rc != 0) {
+    int err_no = errno;
+    task->finish(result_from_gaierror(rc, err_no, "getaddrinfo_a(3)"));
+    delete helper;
+    return;
+  }
+}
+
+// Appends |ips| to |out| as Addrs, filtered and ordered by |family| and
+// |order|.  Returns false if nothing was appended.
+static bool append_ips(std::vector<Addr>* out, const std::vector<IP>& ips,
+                       Order order, int family, ProtocolType p,
+                       uint16_t port) {
+  std::vector<AddrStub> stubs;
+  std::size_t index = 0;
+  for (const auto& ip : ips) {
+    int ipfamily = ip.is_ipv4() ? AF_INET : AF_INET6;
+    if (family == AF_UNSPEC || family == ipfamily) {
+      switch (order) {
+        case Order::untouched:
+          stubs.emplace_back(DontCare()(ipfamily), index);
+          break;
+
+        case Order::ipv4_first:
+          stubs.emplace_back(Favor4()(ipfamily), index);
+          break;
+
+        case Order::ipv6_first:
+          stubs.emplace_back(Favor6()(ipfamily), index);
+          break;
+      }
+    }
+    ++index;
+  }
+  if (stubs.empty()) return false;
+
+  std::sort(stubs.begin(), stubs.end());
+  for (const auto& stub : stubs) {
+    out->push_back(inetaddr(p, ips[stub.index].as_narrow(), port));
+  }
+  return true;
+}
+
+// Looks up |name| with the native DNS client configured by
+// |net::Options::resolv_conf|.
+static void resolve_dns(event::Task* task, std::vector<Addr>* out,
+                        base::time::Duration* /*nullable*/ ttl,
+                        const base::Options& opts, Order order, int family,
+                        ProtocolType p, const std::string& name,
+                        uint16_t port) {
+  struct DNSHelper {
+    event::Task* const task;
+    std::vector<Addr>* const out;
+    base::time::Duration* const ttl;
+    const Order order;
+    const int family;
+    const ProtocolType p;
+    const uint16_t port;
+    std::vector<IP> ips;
+    base::time::Duration lookup_ttl;
+    event::Task subtask;
+
+    DNSHelper(event::Task* t, std::vector<Addr>* o, base::time::Duration* d,
+              Order order, int f, ProtocolType p, uint16_t port) noexcept
+        : task(t),
+          out(o),
+          ttl(d),
+          order(order),
+          family(f),
+          p(p),
+          port(port) {}
+
+    base::Result done() {
+      base::Result r = subtask.result();
+      if (r && !append_ips(out, ips, order, family, p, port))
+        r = base::Result::not_found();
+      if (r && ttl != nullptr) *ttl = lookup_ttl;
+      task->finish(std::move(r));
+      delete this;
+      return base::Result();
+    }
+  };
+
+  if (!task->start()) return;
+  auto client = system_dnsclient(opts.get<net::Options>().resolv_conf);
+  auto* h = new DNSHelper(task, out, ttl, order, family, p, port);
+  task->add_subtask(&h->subtask);
+  client->lookup(&h->subtask, &h->ips, &h->lookup_ttl, name, family, opts);
+  h->subtask.on_finished(event::callback([h] { return h->done(); }));
+}
+
+// Appends the IPs listed for |name| in the hosts file to |out| as Addrs,
+// filtered and ordered by |family| and |order|.  Returns false if the hosts
+// file has nothing to say about |name|, in which case a lookup is needed.
+static bool resolve_hosts(std::vector<Addr>* out, const std::string& path,
+                          Order order, int family, ProtocolType p,
+                          const std::string& name, uint16_t port) {
+  std::vector<IP> ips;
+  if (!hosts_lookup(&ips, path, name)) return false;
+  return append_ips(out, ips, order, family, p, port);
+}
+
 void InetProtocol::resolve(event::Task* task, std::vector<Addr>* out,
                            const std::string& protocol,
                            const std::string& address,
@@ -560,11 +676,11 @@ void InetProtocol::resolve(event::Task* task, std::vector<Addr>* out,
   CHECK_NOTNULL(task);
   CHECK_NOTNULL(out);
   CHECK(supports(protocol));
-  if (!task->start()) return;
 
   auto i = address.rfind(':');
   if (i == std::string::npos) {
-    task->finish(base::Result::invalid_argument("missing port"));
+    if (task->start())
+      task->finish(base::Result::invalid_argument("missing port"));
     return;
   }
   std::string name = address.substr(0, i);
@@ -574,6 +690,7 @@ void InetProtocol::resolve(event::Task* task, std::vector<Addr>* out,
     name.erase(name.begin());
   }
 
+  const auto& o = opts.get<net::Options>();
   auto p = protomap().at(protocol);
   Order order = Order::untouched;
   int family = AF_UNSPEC;
@@ -587,8 +704,7 @@ void InetProtocol::resolve(event::Task* task, std::vector<Addr>* out,
       break;
 
     default:
-      const auto ds = opts.get<net::Options>().dualstack;
-      switch (ds) {
+      switch (o.dualstack) {
         case DualStack::only_ipv4:
           family = AF_INET;
           break;
@@ -610,16 +726,70 @@ void InetProtocol::resolve(event::Task* task, std::vector<Addr>* out,
       }
   }
 
-  auto* helper = new ResolveHelper(this, task, out, order, family, p,
-                                   std::move(name), std::move(service));
-  struct gaicb* list[1] = {&helper->cb};
-  int rc = ::getaddrinfo_a(GAI_NOWAIT, list, 1, &helper->sev);
-  if (rc != 0) {
-    int err_no = errno;
-    task->finish(result_from_gaierror(rc, err_no, "getaddrinfo_a(3)"));
-    delete helper;
+  // Names in the hosts file are answered from memory.  Named services still
+  // need getaddrinfo(3), so only numeric ports take this path, or the native
+  // DNS client.
+  uint16_t port = 0;
+  bool numeric = !name.empty() &&
+                 parse_port(&port, service.begin(), service.end());
+  if (numeric && !o.hosts_file.empty()) {
+    std::vector<Addr> addrs;
+    if (resolve_hosts(&addrs, o.hosts_file, order, family, p, name, port)) {
+      if (!task->start()) return;
+      out->insert(out->end(), addrs.begin(), addrs.end());
+      task->finish_ok();
+      return;
+    }
+  }
+
+  bool native = numeric && o.native_dns;
+  if (native) {
+    IP ip;
+    if (IP::parse(&ip, name)) {
+      if (!task->start()) return;
+      std::vector<IP> ips;
+      ips.push_back(ip);
+      if (append_ips(out, ips, order, family, p, port))
+        task->finish_ok();
+      else
+        task->finish(base::Result::not_found());
+      return;
+    }
+  }
+
+  if (!o.resolve_cache) {
+    if (native) {
+      resolve_dns(task, out, nullptr, opts, order, family, p, name, port);
+    } else {
+      resolve_gai(this, task, out, order, family, p, std::move(name),
+                  std::move(service));
+    }
     return;
   }
+
+  std::string key;
+  base::concat_to(&key, protocol, '\0', address, '\0',
+                  static_cast<unsigned int>(o.dualstack));
+  ResolveFn fn;
+  if (native) {
+    key.append(1, '\0');
+    key.append(o.resolv_conf);
+    fn = [order, family, p, name, port](event::Task* task,
+                                        std::vector<Addr>* out,
+                                        base::time::Duration* ttl,
+                                        const base::Options& opts) {
+      resolve_dns(task, out, ttl, opts, order, family, p, name, port);
+    };
+  } else {
+    // getaddrinfo(3) doesn't report TTLs, so the TTL is left unset and the
+    // cache falls back on |net::Options::resolve_ttl|.
+    fn = [this, order, family, p, name, service](
+        event::Task* task, std::vector<Addr>* out, base::time::Duration*,
+        const base::Options&) {
+      resolve_gai(this, task, out, order, family, p, name, service);
+    };
+  }
+  system_resolve_cache().resolve(task, out, key, fn, opts);
 }
 
 std::tuple<int, int, int> InetProtocol::socket_triple(
@@ -12,6 +12,7 @@
 #include "event/task.h"
 #include "net/addr.h"
 #include "net/inet.h"
+#include "net/options.h"
 #include "net/protocol.h"
 #include "net/registry.h"
 #include "net/testing.h"
@@ -114,3 +115,13 @@ TEST(InetProtocol, ListenAndDial) {
   net::Addr addr = net::inetaddr(P::stream, net::IP::localhost_v4(), 0);
   TestListenAndDial(p, addr);
 }
+
+TEST(InetProtocol, ListenAndDialSharded) {
+  auto p = net::inetprotocol();
+  net::Addr addr = net::inetaddr(P::stream, net::IP::localhost_v4(), 0);
+  base::Options opts;
+  opts.get<net::Options>().listen_backlog = 16;
+  opts.get<net::Options>().listen_shards = 4;
+  opts.get<net::Options>().listen_cpu_steering = true;
+  TestListenAndDial(p, addr, opts);
+}
@@ -45,6 +45,16 @@ void dial(event::Task* task, Conn* out, const Addr& peer, const Addr& bind) {
   system_registry().dial(task, out, peer, bind);
 }
 
+void dial_name(event::Task* task, Conn* out, const std::string& protocol,
+               const std::string& address, const base::Options& opts) {
+  system_registry().dial_name(task, out, protocol, address, opts);
+}
+
+void dial_name(event::Task* task, Conn* out, const std::string& protocol,
+               const std::string& address) {
+  system_registry().dial_name(task, out, protocol, address);
+}
+
 base::Result resolve(std::vector<Addr>* out, const std::string& protocol,
                      const std::string& address, const base::Options& opts) {
   return system_registry().resolve(out, protocol, address, opts);
@@ -73,4 +83,14 @@ base::Result dial(Conn* out, const Addr& peer, const Addr& bind) {
   return system_registry().dial(out, peer, bind);
 }
 
+base::Result dial_name(Conn* out, const std::string& protocol,
+                       const std::string& address, const base::Options& opts) {
+  return system_registry().dial_name(out, protocol, address, opts);
+}
+
+base::Result dial_name(Conn* out, const std::string& protocol,
+                       const std::string& address) {
+  return system_registry().dial_name(out, protocol, address);
+}
+
 }  // namespace net
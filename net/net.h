@@ -43,6 +43,13 @@ void dial(event::Task* task, Conn* out, const Addr& peer, const Addr& bind,
           const base::Options& opts);
 void dial(event::Task* task, Conn* out, const Addr& peer, const Addr& bind);
 
+// Resolves |address| and connects to the first resolved address to answer,
+// racing attempts per RFC 8305.  See |Registry::dial_name()|.
+void dial_name(event::Task* task, Conn* out, const std::string& protocol,
+               const std::string& address, const base::Options& opts);
+void dial_name(event::Task* task, Conn* out, const std::string& protocol,
+               const std::string& address);
+
 // Synchronous versions of the functions above.
 base::Result resolve(std::vector<Addr>* out, const std::string& protocol,
                      const std::string& address, const base::Options& opts);
@@ -54,6 +61,10 @@ base::Result listen(ListenConn* out, const Addr& bind, AcceptFn fn);
 base::Result dial(Conn* out, const Addr& peer, const Addr& bind,
                   const base::Options& opts);
 base::Result dial(Conn* out, const Addr& peer, const Addr& bind);
+base::Result dial_name(Conn* out, const std::string& protocol,
+                       const std::string& address, const base::Options& opts);
+base::Result dial_name(Conn* out, const std::string& protocol,
+                       const std::string& address);
 
 }  // namespace net
 
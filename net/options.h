@@ -5,9 +5,12 @@
 #ifndef NET_OPTIONS_H
 #define NET_OPTIONS_H
 
+#include <cstddef>
 #include <cstdint>
+#include <string>
 
 #include "base/options.h"
+#include "base/time/duration.h"
 
 namespace net {
 
@@ -81,15 +84,167 @@ struct Options : public base::OptionsType {
   //
   bool reuseaddr;
 
+  // Accesses the knob for the backlog passed to listen(2).
+  //
+  // This caps the number of connections that the kernel will queue up for a
+  // listen socket before they are accepted.  The kernel silently clamps it
+  // to "sysctl net.core.somaxconn".  Zero or less means SOMAXCONN.
+  //
+  // DEFAULT: 1000.
+  //
+  int listen_backlog;
+
+  // Accesses the knob for sharding listen sockets with <SOL_SOCKET,
+  // SO_REUSEPORT>.
+  //
+  // If 2 or more, listen opens this many sockets bound to the same address,
+  // and the kernel spreads incoming connections across them.  They are still
+  // presented as a single ListenConn, but each socket is accepted from
+  // independently, so several threads can accept connections at once.
+  //
+  // Only applies to protocols backed by native sockets.
+  //
+  // DEFAULT: 0, i.e. a single listen socket.
+  //
+  std::size_t listen_shards;
+
+  // Accesses the knob for <SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF>.
+  //
+  // If true and |listen_shards| is 2 or more, the kernel picks the listen
+  // socket for each incoming connection by the CPU that received it, rather
+  // than by hashing the connection's addresses.  This keeps a connection's
+  // packets and its accept on the same CPU when the shards are pinned to
+  // CPUs, e.g. see |event::DispatcherOptions::affinity()|.
+  //
+  // DEFAULT: false.
+  //
+  bool listen_cpu_steering;
+
+  // Accesses the knob for the number of datagrams that a PacketConn moves
+  // per recvmmsg(2) or sendmmsg(2) call.
+  //
+  // Zero means one at a time.
+  //
+  // DEFAULT: 64.
+  //
+  std::size_t packet_batch_size;
+
+  // Accesses the knob for the size of each datagram receive buffer.
+  //
+  // Datagrams larger than this are truncated; see |net::Packet::truncated|.
+  // The buffers for a whole batch are allocated once per PacketConn and
+  // reused, so this times |packet_batch_size| is held for the PacketConn's
+  // lifetime.  If |packet_gro| is true, at least 65535 is used instead.
+  //
+  // DEFAULT: 2048.
+  //
+  std::size_t packet_buffer_size;
+
+  // Accesses the knob for <IPPROTO_UDP, UDP_GRO>.
+  //
+  // If true, PacketConn asks the kernel to coalesce runs of UDP datagrams
+  // from the same peer into a single Packet; see |net::Packet::segment_size|.
+  // Ignored for protocols other than UDP, or where the kernel lacks support.
+  //
+  // DEFAULT: false.
+  //
+  bool packet_gro;
+
+  // Accesses the knob for the "Connection Attempt Delay" of RFC 8305.
+  //
+  // When dialing by name, connection attempts to the resolved addresses are
+  // started this far apart, without waiting for earlier attempts to time
+  // out.  An attempt that fails starts the next one immediately.
+  //
+  // DEFAULT: 250ms.
+  //
+  base::time::Duration dial_stagger;
+
+  // Accesses the knob for caching the results of name resolution.
+  //
+  // If true, resolved names are kept in |net::system_resolve_cache()| and
+  // concurrent resolves of the same name share a single lookup.
+  //
+  // DEFAULT: true.
+  //
+  bool resolve_cache;
+
+  // Accesses the knob for how long resolved names are cached when the
+  // resolver does not report a TTL of its own, e.g. for getaddrinfo(3).
+  //
+  // DEFAULT: 60s.
+  //
+  base::time::Duration resolve_ttl;
+
+  // Accesses the knobs for the floor and ceiling applied to all TTLs,
+  // whether reported by the resolver or taken from |resolve_ttl|.
+  //
+  // DEFAULT: 0s and 1h.
+  //
+  base::time::Duration resolve_min_ttl;
+  base::time::Duration resolve_max_ttl;
+
+  // Accesses the knob for serving expired names while they are refreshed.
+  //
+  // A name that expired no more than this long ago is returned from the
+  // cache immediately, and a lookup is started in the background to refresh
+  // it.  Zero means expired names are always looked up again first.
+  //
+  // DEFAULT: 30s.
+  //
+  base::time::Duration resolve_stale;
+
+  // Accesses the knob for the hosts(5) file consulted before any lookup.
+  //
+  // Names listed there are answered directly from memory; the file is
+  // re-read when it changes.  Empty means no hosts file is consulted.
+  //
+  // DEFAULT: "/etc/hosts".
+  //
+  std::string hosts_file;
+
+  // Accesses the knob for resolving names with the native DNS client.
+  //
+  // If true, names with numeric ports that aren't in |hosts_file| are looked
+  // up by speaking DNS directly to the servers in |resolv_conf|, instead of
+  // with getaddrinfo_a(3) and its helper threads.  Unlike getaddrinfo(3),
+  // this ignores nsswitch.conf(5), and the DNS TTLs are honored by the
+  // resolve cache.
+  //
+  // DEFAULT: false.
+  //
+  bool native_dns;
+
+  // Accesses the knob for the resolv.conf(5) file used by |native_dns|.
+  //
+  // DEFAULT: "/etc/resolv.conf".
+  //
+  std::string resolv_conf;
+
   // Options is default constructible.
-  Options() noexcept : dualstack(DualStack::smart),
-                       duallisten(DualListen::system_default),
-                       reuseaddr(true) {}
+  Options() : dualstack(DualStack::smart),
+              duallisten(DualListen::system_default),
+              reuseaddr(true),
+              listen_backlog(1000),
+              listen_shards(0),
+              listen_cpu_steering(false),
+              packet_batch_size(64),
+              packet_buffer_size(2048),
+              packet_gro(false),
+              dial_stagger(base::time::milliseconds(250)),
+              resolve_cache(true),
+              resolve_ttl(base::time::seconds(60)),
+              resolve_min_ttl(),
+              resolve_max_ttl(base::time::hours(1)),
+              resolve_stale(base::time::seconds(30)),
+              hosts_file("/etc/hosts"),
+              native_dns(false),
+              resolv_conf("/etc/resolv.conf") {}
 
   // Options is copyable and moveable.
-  Options(const Options&) noexcept = default;
+  Options(const Options&) = default;
   Options(Options&&) noexcept = default;
-  Options& operator=(const Options&) noexcept = default;
+  Options& operator=(const Options&) = default;
   Options& operator=(Options&&) noexcept = default;
 
   // Resets this net::Options to the default values.
@@ -0,0 +1,643 @@
+// Copyright © 2017 by Donald King <chronos@chronos-tachyon.net>
+// Available under the MIT License. See LICENSE for details.
+
+#include "net/packet.h"
+
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <utility>
+
+#include "base/logging.h"
+#include "base/mutex.h"
+#include "event/callback.h"
+#include "event/handler.h"
+#include "event/manager.h"
+#include "io/options.h"
+#include "net/net.h"
+#include "net/options.h"
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+
+using P = net::ProtocolType;
+
+namespace net {
+
+namespace {
+static sockaddr* RISA(void* ptr) { return reinterpret_cast<sockaddr*>(ptr); }
+
+static const sockaddr* RICSA(const void* ptr) {
+  return reinterpret_cast<const sockaddr*>(ptr);
+}
+
+// Room for one UDP_GRO or UDP_SEGMENT control message per datagram.
+static constexpr std::size_t kControlSpace = CMSG_SPACE(sizeof(int));
+
+// The largest possible UDP datagram, and thus the largest GRO train.
+static constexpr std::size_t kMaxUDPSize = 65535;
+
+static bool is_udp(const Addr& addr) {
+  return addr.protocol().compare(0, 3, "udp") == 0;
+}
+
+// Fills in the socket(2) type and protocol number for |addr|.
+static base::Result socket_args_for(int* type, int* protonum,
+                                    const Addr& addr) {
+  *protonum = is_udp(addr) ? IPPROTO_UDP : 0;
+  ProtocolType p = addr.protocol_type();
+  switch (p) {
+    case P::raw:
+      *type = SOCK_RAW;
+      return base::Result();
+    case P::datagram:
+      *type = SOCK_DGRAM;
+      return base::Result();
+    case P::rdm:
+      *type = SOCK_RDM;
+      return base::Result();
+    case P::seqpacket:
+      *type = SOCK_SEQPACKET;
+      return base::Result();
+    default:
+      return base::Result::invalid_argument(
+          "net::PacketConn requires a datagram protocol, not ", p);
+  }
+}
+
+static base::Result interpret_sockname(Addr* out, const base::FD& fd,
+                                       ProtocolType p) {
+  sockaddr_storage ss;
+  ::bzero(&ss, sizeof(ss));
+  socklen_t sslen = sizeof(ss);
+  auto pair = fd->acquire_fd();
+  int rc = ::getsockname(pair.first, RISA(&ss), &sslen);
+  if (rc != 0) {
+    int err_no = errno;
+    return base::Result::from_errno(err_no, "getsockname(2)");
+  }
+  // Unbound "unixgram" sockets have no name beyond their address family.
+  if (sslen <= sizeof(sa_family_t)) return base::Result();
+  return interpret(out, p, RICSA(&ss), sslen);
+}
+
+class FDPacketConn : public PacketConnImpl,
+                     public std::enable_shared_from_this<FDPacketConn> {
+ public:
+  FDPacketConn(event::Manager m, Addr la, Addr ra, base::FD fd,
+               std::size_t batch, std::size_t bufsize) noexcept
+      : m_(std::move(m)),
+        la_(std::move(la)),
+        ra_(std::move(ra)),
+        fd_(std::move(fd)),
+        pt_(ra_ ? ra_.protocol_type() : la_.protocol_type()),
+        batch_(std::max(batch, std::size_t(1))),
+        bufsize_(bufsize),
+        closed_(false) {
+    VLOG(6) << "net::FDPacketConn::FDPacketConn";
+  }
+
+  ~FDPacketConn() noexcept override {
+    VLOG(6) << "net::FDPacketConn::~FDPacketConn";
+    if (evt_) {
+      evt_.disable().ignore_ok();
+      evt_.disown();
+    }
+  }
+
+  base::Result initialize() {
+    std::weak_ptr<FDPacketConn> weak = shared_from_this();
+    auto closure = [weak](event::Data data) {
+      auto self = weak.lock();
+      if (self) self->process();
+      return base::Result();
+    };
+    auto set = event::Set::readable_bit() | event::Set::writable_bit();
+    return m_.fd(&evt_, fd_, set, event::handler(closure));
+  }
+
+  Addr local_addr() const override { return la_; }
+  Addr remote_addr() const override { return ra_; }
+
+  void recv(event::Task* task, std::vector<Packet>* out, std::size_t max,
+            const base::Options& opts) override;
+  void send(event::Task* task, std::size_t* n, const std::vector<Packet>* in,
+            const base::Options& opts) override;
+  void close(event::Task* task, const base::Options& opts) override;
+
+  void get_option(event::Task* task, SockOpt opt, void* optval,
+                  unsigned int* optlen,
+                  const base::Options& opts) const override {
+    if (!task->start()) return;
+    task->finish(opt.get(fd_, optval, optlen));
+  }
+
+  void set_option(event::Task* task, SockOpt opt, const void* optval,
+                  unsigned int optlen, const base::Options& opts) override {
+    if (!task->start()) return;
+    task->finish(opt.set(fd_, optval, optlen));
+  }
+
+ private:
+  struct RecvOp {
+    event::Task* task;
+    std::vector<Packet>* out;
+    std::size_t max;
+
+    RecvOp(event::Task* t, std::vector<Packet>* o, std::size_t mx) noexcept
+        : task(t),
+          out(o),
+          max(mx) {}
+  };
+
+  struct SendOp {
+    event::Task* task;
+    std::size_t* n;
+    const std::vector<Packet>* in;
+
+    SendOp(event::Task* t, std::size_t* n,
+           const std::vector<Packet>* i) noexcept
+        : task(t),
+          n(n),
+          in(i) {}
+  };
+
+  using Completion = std::pair<event::Task*, base::Result>;
+
+  // Wakes up |process()| if |task| is cancelled while queued.
+  void watch(event::Task* task);
+
+  // Runs as many queued operations as the socket allows, then finishes the
+  // tasks of the completed ones with |mu_| released.
+  void process();
+
+  // Each returns true iff |op| completed, adding it to |done|, or false if
+  // the socket would block.  Called with |mu_| held.
+  bool recv_some(const RecvOp& op, std::vector<Completion>* done);
+  bool send_some(const SendOp& op, std::vector<Completion>* done);
+
+  const event::Manager m_;
+  const Addr la_;
+  const Addr ra_;
+  const base::FD fd_;
+  const ProtocolType pt_;
+  const std::size_t batch_;
+  const std::size_t bufsize_;
+  event::Handle evt_;
+  mutable std::mutex mu_;
+  std::deque<RecvOp> rq_;  // protected by mu_
+  std::deque<SendOp> sq_;  // protected by mu_
+  bool closed_;            // protected by mu_
+
+  // Scratch space for recvmmsg(2) and sendmmsg(2), allocated on first use
+  // and reused by every batch.  All protected by mu_.
+  std::vector<char> rbuf_;
+  std::vector<mmsghdr> rhdr_;
+  std::vector<iovec> riov_;
+  std::vector<sockaddr_storage> rname_;
+  std::vector<char> rctl_;
+  std::vector<mmsghdr> shdr_;
+  std::vector<iovec> siov_;
+  std::vector<char> sctl_;
+};
+
+void FDPacketConn::recv(event::Task* task, std::vector<Packet>* out,
+                        std::size_t max, const base::Options& opts) {
+  if (!task->start()) return;
+  auto lock = base::acquire_lock(mu_);
+  if (closed_) {
+    lock.unlock();
+    task->finish(base::Result::failed_precondition("net::PacketConn closed"));
+    return;
+  }
+  rq_.emplace_back(task, out, max);
+  lock.unlock();
+  watch(task);
+  process();
+}
+
+void FDPacketConn::send(event::Task* task, std::size_t* n,
+                        const std::vector<Packet>* in,
+                        const base::Options& opts) {
+  if (!task->start()) return;
+  *n = 0;
+  for (const auto& pkt : *in) {
+    if (ra_ && pkt.addr) {
+      task->finish(base::Result::invalid_argument(
+          "net::Packet::addr must be empty on a connected net::PacketConn"));
+      return;
+    }
+    if (!ra_ && !pkt.addr) {
+      task->finish(base::Result::invalid_argument(
+          "net::Packet::addr is required on an unconnected net::PacketConn"));
+      return;
+    }
+    if (pkt.segment_size > kMaxUDPSize) {
+      task->finish(base::Result::invalid_argument(
+          "net::Packet::segment_size is too large"));
+      return;
+    }
+  }
+  auto lock = base::acquire_lock(mu_);
+  if (closed_) {
+    lock.unlock();
+    task->finish(base::Result::failed_precondition("net::PacketConn closed"));
+    return;
+  }
+  sq_.emplace_back(task, n, in);
+  lock.unlock();
+  watch(task);
+  process();
+}
+
+void FDPacketConn::close(event::Task* task, const base::Options& opts) {
+  VLOG(6) << "net::FDPacketConn::close";
+  auto lock = base::acquire_lock(mu_);
+  closed_ = true;
+  std::vector<event::Task*> pending;
+  for (const auto& op : rq_) pending.push_back(op.task);
+  for (const auto& op : sq_) pending.push_back(op.task);
+  rq_.clear();
+  sq_.clear();
+  base::Result r0 = evt_.disable();
+  base::Result r1 = fd_->close();
+  lock.unlock();
+  for (auto* t : pending) t->finish_cancel();
+  if (task->start()) task->finish(r0.and_then(r1));
+}
+
+void FDPacketConn::watch(event::Task* task) {
+  std::weak_ptr<FDPacketConn> weak = shared_from_this();
+  task->on_cancelled(event::callback([weak] {
+    auto self = weak.lock();
+    if (self) self->process();
+    return base::Result();
+  }));
+}
+
+void FDPacketConn::process() {
+  std::vector<Completion> done;
+  auto lock = base::acquire_lock(mu_);
+  while (!rq_.empty() && recv_some(rq_.front(), &done)) rq_.pop_front();
+  while (!sq_.empty() && send_some(sq_.front(), &done)) sq_.pop_front();
+  lock.unlock();
+  for (auto& c : done) c.first->finish(std::move(c.second));
+}
+
+bool FDPacketConn::recv_some(const RecvOp& op, std::vector<Completion>* done) {
+  if (!op.task->is_running()) {
+    done->emplace_back(op.task, base::Result::cancelled());
+    return true;
+  }
+
+  if (rhdr_.empty()) {
+    rbuf_.resize(batch_ * bufsize_);
+    rhdr_.resize(batch_);
+    riov_.resize(batch_);
+    rname_.resize(batch_);
+    rctl_.resize(batch_ * kControlSpace);
+  }
+
+  const std::size_t count = std::min(op.max, batch_);
+  for (std::size_t i = 0; i < count; ++i) {
+    riov_[i].iov_base = rbuf_.data() + i * bufsize_;
+    riov_[i].iov_len = bufsize_;
+    auto& h = rhdr_[i];
+    ::bzero(&h, sizeof(h));
+    h.msg_hdr.msg_iov = &riov_[i];
+    h.msg_hdr.msg_iovlen = 1;
+    if (!ra_) {
+      h.msg_hdr.msg_name = &rname_[i];
+      h.msg_hdr.msg_namelen = sizeof(rname_[i]);
+    }
+    h.msg_hdr.msg_control = rctl_.data() + i * kControlSpace;
+    h.msg_hdr.msg_controllen = kControlSpace;
+  }
+
+  int rc;
+  while (true) {
+    auto pair = fd_->acquire_fd();
+    rc = ::recvmmsg(pair.first, rhdr_.data(), count, 0, nullptr);
+    if (rc >= 0) break;
+    int err_no = errno;
+    if (err_no == EINTR) continue;
+    if (err_no == EAGAIN || err_no == EWOULDBLOCK) return false;
+    done->emplace_back(op.task,
+                       base::Result::from_errno(err_no, "recvmmsg(2)"));
+    return true;
+  }
+  VLOG(6) << "net::FDPacketConn: recvmmsg(2) returned " << rc;
+
+  // Senders tend to arrive in runs, so reuse the previous Addr when the
+  // source sockaddr repeats instead of interpreting it again.
+  const sockaddr_storage* prevname = nullptr;
+  socklen_t prevlen = 0;
+  Addr prev;
+
+  op.out->reserve(op.out->size() + rc);
+  for (int i = 0; i < rc; ++i) {
+    const auto& h = rhdr_[i].msg_hdr;
+    const char* ptr = rbuf_.data() + i * bufsize_;
+    Packet pkt;
+    pkt.data.assign(ptr, std::min(std::size_t(rhdr_[i].msg_len), bufsize_));
+    pkt.truncated = (h.msg_flags & MSG_TRUNC) != 0;
+
+    if (ra_) {
+      pkt.addr = ra_;
+    } else if (h.msg_namelen > sizeof(sa_family_t)) {
+      const auto* name = &rname_[i];
+      if (prevname && prevlen == h.msg_namelen &&
+          ::memcmp(prevname, name, prevlen) == 0) {
+        pkt.addr = prev;
+      } else {
+        base::Result r = interpret(&pkt.addr, pt_, RICSA(name), h.msg_namelen);
+        r.expect_ok(__FILE__, __LINE__);
+        prevname = name;
+        prevlen = h.msg_namelen;
+        prev = pkt.addr;
+      }
+    }
+
+    auto* mh = const_cast<msghdr*>(&h);
+    for (cmsghdr* cm = CMSG_FIRSTHDR(mh); cm; cm = CMSG_NXTHDR(mh, cm)) {
+      if (cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO) {
+        int value;
+        ::memcpy(&value, CMSG_DATA(cm), sizeof(value));
+        pkt.segment_size = value;
+      }
+    }
+
+    op.out->push_back(std::move(pkt));
+  }
+  done->emplace_back(op.task, base::Result());
+  return true;
+}
+
+bool FDPacketConn::send_some(const SendOp& op, std::vector<Completion>* done) {
+  if (!op.task->is_running()) {
+    done->emplace_back(op.task, base::Result::cancelled());
+    return true;
+  }
+
+  if (shdr_.empty()) {
+    shdr_.resize(batch_);
+    siov_.resize(batch_);
+    sctl_.resize(batch_ * kControlSpace);
+  }
+
+  const auto& in = *op.in;
+  while (*op.n < in.size()) {
+    const std::size_t count = std::min(in.size() - *op.n, batch_);
+    for (std::size_t i = 0; i < count; ++i) {
+      const Packet& pkt = in[*op.n + i];
+      siov_[i].iov_base = const_cast<char*>(pkt.data.data());
+      siov_[i].iov_len = pkt.data.size();
+      auto& h = shdr_[i];
+      ::bzero(&h, sizeof(h));
+      h.msg_hdr.msg_iov = &siov_[i];
+      h.msg_hdr.msg_iovlen = 1;
+      if (pkt.addr) {
+        auto raw = pkt.addr.raw();
+        h.msg_hdr.msg_name = const_cast<void*>(raw.first);
+        h.msg_hdr.msg_namelen = raw.second;
+      }
+      if (pkt.segment_size != 0) {
+        char* ctl = sctl_.data() + i * kControlSpace;
+        ::bzero(ctl, kControlSpace);
+        h.msg_hdr.msg_control = ctl;
+        h.msg_hdr.msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+        cmsghdr* cm = CMSG_FIRSTHDR(&h.msg_hdr);
+        cm->cmsg_level = SOL_UDP;
+        cm->cmsg_type = UDP_SEGMENT;
+        cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+        uint16_t value = pkt.segment_size;
+        ::memcpy(CMSG_DATA(cm), &value, sizeof(value));
+      }
+    }
+
+    auto pair = fd_->acquire_fd();
+    int rc = ::sendmmsg(pair.first, shdr_.data(), count, 0);
+    if (rc < 0) {
+      int err_no = errno;
+      if (err_no == EINTR) continue;
+      if (err_no == EAGAIN || err_no == EWOULDBLOCK) return false;
+      done->emplace_back(op.task,
+                         base::Result::from_errno(err_no, "sendmmsg(2)"));
+      return true;
+    }
+    VLOG(6) << "net::FDPacketConn: sendmmsg(2) returned " << rc;
+    *op.n += rc;
+  }
+  done->emplace_back(op.task, base::Result());
+  return true;
+}
+
+static base::Result open_packet(PacketConn* out, const Addr& peer,
+                                const Addr& bind, const base::Options& opts) {
+  const auto& no = opts.get<Options>();
+  const Addr& model = peer ? peer : bind;
+
+  int type = 0, protonum = 0;
+  base::Result r = socket_args_for(&type, &protonum, model);
+  if (!r) return r;
+
+  auto raw = model.raw();
+  int domain = RICSA(raw.first)->sa_family;
+  int fdnum = ::socket(domain, type | SOCK_NONBLOCK | SOCK_CLOEXEC, protonum);
+  if (fdnum == -1) {
+    int err_no = errno;
+    return base::Result::from_errno(err_no, "socket(2)");
+  }
+  base::FD fd = base::wrapfd(fdnum);
+
+  if (no.packet_gro && is_udp(model)) {
+    int value = 1;
+    r = sockopt_udp_gro.set(fd, &value, sizeof(value));
+    if (!r) VLOG(4) << "net::PacketConn: UDP_GRO unavailable: " << r;
+  }
+
+  if (bind) {
+    if (!peer && no.reuseaddr) {
+      int value = 1;
+      r = sockopt_reuseaddr.set(fd, &value, sizeof(value));
+      if (!r) return r;
+    }
+    raw = bind.raw();
+    int rc = ::bind(fdnum, RICSA(raw.first), raw.second);
+    if (rc != 0) {
+      int err_no = errno;
+      return base::Result::from_errno(err_no, "bind(2)");
+    }
+  }
+
+  if (peer) {
+    raw = peer.raw();
+    int rc;
+    do {
+      rc = ::connect(fdnum, RICSA(raw.first), raw.second);
+    } while (rc != 0 && errno == EINTR);
+    if (rc != 0) {
+      int err_no = errno;
+      return base::Result::from_errno(err_no, "connect(2)");
+    }
+  }
+
+  Addr la;
+  r = interpret_sockname(&la, fd, model.protocol_type());
+  if (!r) return r;
+
+  return fdpacketconn(out, std::move(la), peer, std::move(fd), opts);
+}
+
+}  // anonymous namespace
+
+void PacketConn::assert_valid() const {
+  CHECK(ptr_) << ": net::PacketConn is empty";
+}
+
+void PacketConn::recv(event::Task* task, std::vector<Packet>* out,
+                      std::size_t max, const base::Options& opts) const {
+  CHECK_NOTNULL(task);
+  CHECK_NOTNULL(out);
+  CHECK_GT(max, 0U);
+  assert_valid();
+  ptr_->recv(task, out, max, opts);
+}
+
+void PacketConn::send(event::Task* task, std::size_t* n,
+                      const std::vector<Packet>* in,
+                      const base::Options& opts) const {
+  CHECK_NOTNULL(task);
+  CHECK_NOTNULL(n);
+  CHECK_NOTNULL(in);
+  assert_valid();
+  ptr_->send(task, n, in, opts);
+}
+
+void PacketConn::get_option(event::Task* task, SockOpt opt, void* optval,
+                            unsigned int* optlen,
+                            const base::Options& opts) const {
+  CHECK_NOTNULL(task);
+  CHECK_NOTNULL(optval);
+  CHECK_NOTNULL(optlen);
+  assert_valid();
+  ptr_->get_option(task, opt, optval, optlen, opts);
+}
+
+void PacketConn::set_option(event::Task* task, SockOpt opt, const void* optval,
+                            unsigned int optlen,
+                            const base::Options& opts) const {
+  CHECK_NOTNULL(task);
+  CHECK_NOTNULL(optval);
+  assert_valid();
+  ptr_->set_option(task, opt, optval, optlen, opts);
+}
+
+base::Result PacketConn::recv(std::vector<Packet>* out, std::size_t max,
+                              const base::Options& opts) const {
+  event::Task task;
+  recv(&task, out, max, opts);
+  event::wait(io::get_manager(opts), &task);
+  return task.result();
+}
+
+base::Result PacketConn::send(std::size_t* n, const std::vector<Packet>& in,
+                              const base::Options& opts) const {
+  event::Task task;
+  send(&task, n, &in, opts);
+  event::wait(io::get_manager(opts), &task);
+  return task.result();
+}
+
+base::Result PacketConn::close(const base::Options& opts) const {
+  event::Task task;
+  close(&task, opts);
+  event::wait(io::get_manager(opts), &task);
+  return task.result();
+}
+
+base::Result PacketConn::get_option(SockOpt opt, void* optval,
+                                    unsigned int* optlen,
+                                    const base::Options& opts) const {
+  event::Task task;
+  get_option(&task, opt, optval, optlen, opts);
+  event::wait(io::get_manager(opts), &task);
+  return task.result();
+}
+
+base::Result PacketConn::set_option(SockOpt opt, const void* optval,
+                                    unsigned int optlen,
+                                    const base::Options& opts) const {
+  event::Task task;
+  set_option(&task, opt, optval, optlen, opts);
+  event::wait(io::get_manager(opts), &task);
+  return task.result();
+}
+
+void listen_packet(event::Task* task, PacketConn* out, const Addr& bind,
+                   const base::Options& opts) {
+  CHECK_NOTNULL(task);
+  CHECK_NOTNULL(out);
+  CHECK(bind);
+  if (!task->start()) return;
+  task->finish(open_packet(out, Addr(), bind, opts));
+}
+
+void dial_packet(event::Task* task, PacketConn* out, const Addr& peer,
+                 const Addr& bind, const base::Options& opts) {
+  CHECK_NOTNULL(task);
+  CHECK_NOTNULL(out);
+  CHECK(peer);
+  CHECK(!bind || bind.protocol() == peer.protocol());
+  if (!task->start()) return;
+  task->finish(open_packet(out, peer, bind, opts));
+}
+
+base::Result listen_packet(PacketConn* out, const Addr& bind,
+                           const base::Options& opts) {
+  event::Task task;
+  listen_packet(&task, out, bind, opts);
+  event::wait(io::get_manager(opts), &task);
+  return task.result();
+}
+
+base::Result dial_packet(PacketConn* out, const Addr& peer, const Addr& bind,
+                         const base::Options& opts) {
+  event::Task task;
+  dial_packet(&task, out, peer, bind, opts);
+  event::wait(io::get_manager(opts), &task);
+  return task.result();
+}
+
+base::Result fdpacketconn(PacketConn* out, Addr la, Addr ra, base::FD fd,
+                          const base::Options& opts) {
+  CHECK_NOTNULL(out);
+  CHECK(la || ra);
+  CHECK(fd);
+  const auto& no = opts.get<Options>();
+  std::size_t bufsize = no.packet_buffer_size;
+  if (no.packet_gro && bufsize < kMaxUDPSize) bufsize = kMaxUDPSize;
+  auto ptr = std::make_shared<FDPacketConn>(io::get_manager(opts),
+                                            std::move(la), std::move(ra),
+                                            std::move(fd),
+                                            no.packet_batch_size, bufsize);
+  base::Result r = ptr->initialize();
+  if (r) *out = PacketConn(std::move(ptr));
+  return r;
+}
+
+}  // namespace net
@@ -0,0 +1,241 @@
+// net/packet.h - Abstraction for datagram sockets
+// Copyright © 2017 by Donald King <chronos@chronos-tachyon.net>
+// Available under the MIT License. See LICENSE for details.
+
+#ifndef NET_PACKET_H
+#define NET_PACKET_H
+
+#include <sys/time.h>
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "base/fd.h"
+#include "base/options.h"
+#include "base/result.h"
+#include "event/task.h"
+#include "net/addr.h"
+#include "net/sockopt.h"
+
+namespace net {
+
+// Packet is a single datagram, with its message boundaries intact.
+struct Packet {
+  // The payload of the datagram.
+  //
+  // When received with |Options::packet_gro| enabled, this may hold several
+  // datagrams from the same peer back to back, each |segment_size| bytes
+  // long except possibly the last.
+  std::string data;
+
+  // On receive, the address of the peer that sent the datagram.  It is empty
+  // if the peer has no address, e.g. an unbound "unixgram" socket.
+  //
+  // On send, the address to send the datagram to.  It MUST be empty for a
+  // PacketConn with a |remote_addr()|, and MUST NOT be empty otherwise.
+  Addr addr;
+
+  // If non-zero, |data| is a train of datagrams of this size.
+  // - On send, the kernel splits |data| up (UDP GSO, i.e. UDP_SEGMENT)
+  // - On receive, the kernel coalesced them (UDP GRO, i.e. UDP_GRO)
+  std::size_t segment_size;
+
+  // On receive, true iff the datagram was larger than the receive buffer
+  // and |data| holds only its beginning.  See |Options::packet_buffer_size|.
+  bool truncated;
+
+  Packet() noexcept : segment_size(0), truncated(false) {}
+  Packet(std::string d, Addr a = Addr()) noexcept : data(std::move(d)),
+                                                    addr(std::move(a)),
+                                                    segment_size(0),
+                                                    truncated(false) {}
+};
+
+// PacketConnImpl is the abstract base class for datagram sockets.
+class PacketConnImpl {
+ protected:
+  PacketConnImpl() noexcept = default;
+
+ public:
+  // PacketConnImpl is neither copyable nor moveable.
+  PacketConnImpl(const PacketConnImpl&) = delete;
+  PacketConnImpl(PacketConnImpl&&) = delete;
+  PacketConnImpl& operator=(const PacketConnImpl&) = delete;
+  PacketConnImpl& operator=(PacketConnImpl&&) = delete;
+  virtual ~PacketConnImpl() noexcept = default;
+
+  // Returns the address of this end of the socket.
+  virtual Addr local_addr() const = 0;
+
+  // Returns the address of the peer, or an empty Addr if the socket isn't
+  // connected to one and may exchange datagrams with anyone.
+  virtual Addr remote_addr() const = 0;
+
+  // Receives at least 1 and at most |max| datagrams, appending them to |out|.
+  // - MUST preserve message boundaries: one datagram per Packet
+  // - SHOULD receive as many datagrams as are ready in as few system calls
+  //   as possible
+  virtual void recv(event::Task* task, std::vector<Packet>* out,
+                    std::size_t max, const base::Options& opts) = 0;
+
+  // Sends the datagrams in |in|, in order, setting |*n| to the number sent.
+  // - |in| MUST remain valid until |task| finishes
+  // - Unless |task| fails, |*n == in.size()| when it finishes
+  // - SHOULD send the datagrams in as few system calls as possible
+  virtual void send(event::Task* task, std::size_t* n,
+                    const std::vector<Packet>* in,
+                    const base::Options& opts) = 0;
+
+  // Fully closes the socket.
+  virtual void close(event::Task* task, const base::Options& opts) = 0;
+
+  // Retrieves the value of a socket option.
+  virtual void get_option(event::Task* task, SockOpt opt, void* optval,
+                          unsigned int* optlen,
+                          const base::Options& opts) const = 0;
+
+  // Assigns the value of a socket option.
+  virtual void set_option(event::Task* task, SockOpt opt, const void* optval,
+                          unsigned int optlen, const base::Options& opts) = 0;
+};
+
+// PacketConn is a handle to a datagram socket.
+//
+// Unlike a Conn, which is a bi-directional I/O stream, a PacketConn sends and
+// receives whole datagrams, each of which arrives intact or not at all.  It
+// serves the ProtocolType::datagram, ProtocolType::rdm, and
+// ProtocolType::seqpacket protocols, e.g. "udp" and "unixgram".
+//
+// A PacketConn may be connected to a single peer, or it may be unconnected,
+// in which case every datagram carries its own address.
+//
+// As with Conn, a PacketConn is either empty or points at a socket; sockets
+// are reference counted, and are closed along with the last PacketConn.
+//
+class PacketConn {
+ public:
+  using Pointer = std::shared_ptr<PacketConnImpl>;
+
+  // PacketConn is constructible from an implementation.
+  PacketConn(Pointer ptr) noexcept : ptr_(std::move(ptr)) {}
+
+  // PacketConn is default constructible, starting in the empty state.
+  PacketConn() noexcept = default;
+
+  // PacketConn is copyable and moveable.
+  // - These copy or move the handle, not the socket itself.
+  PacketConn(const PacketConn&) noexcept = default;
+  PacketConn(PacketConn&&) noexcept = default;
+  PacketConn& operator=(const PacketConn&) noexcept = default;
+  PacketConn& operator=(PacketConn&&) noexcept = default;
+
+  // Resets this PacketConn to the empty state.
+  void reset() noexcept { ptr_.reset(); }
+
+  // Swaps this PacketConn with another.
+  void swap(PacketConn& x) noexcept { ptr_.swap(x.ptr_); }
+
+  // Returns true iff this PacketConn is non-empty.
+  explicit operator bool() const noexcept { return !!ptr_; }
+
+  // Asserts that this PacketConn is non-empty.
+  void assert_valid() const;
+
+  // Returns this PacketConn's socket implementation.
+  const Pointer& implementation() const { return ptr_; }
+  Pointer& implementation() { return ptr_; }
+
+  // Returns the address of this end of the socket.
+  Addr local_addr() const {
+    assert_valid();
+    return ptr_->local_addr();
+  }
+
+  // Returns the address of the peer, or an empty Addr if unconnected.
+  Addr remote_addr() const {
+    assert_valid();
+    return ptr_->remote_addr();
+  }
+
+  // Receives at least 1 and at most |max| datagrams, appending them to |out|.
+  void recv(event::Task* task, std::vector<Packet>* out, std::size_t max,
+            const base::Options& opts = base::default_options()) const;
+
+  // Sends the datagrams in |in|, setting |*n| to the number sent.
+  void send(event::Task* task, std::size_t* n, const std::vector<Packet>* in,
+            const base::Options& opts = base::default_options()) const;
+
+  // Fully closes the socket.
+  void close(event::Task* task,
+             const base::Options& opts = base::default_options()) const {
+    assert_valid();
+    ptr_->close(task, opts);
+  }
+
+  // Retrieves the value of a socket option.
+  void get_option(event::Task* task, SockOpt opt, void* optval,
+                  unsigned int* optlen,
+                  const base::Options& opts = base::default_options()) const;
+
+  // Assigns the value of a socket option.
+  void set_option(event::Task* task, SockOpt opt, const void* optval,
+                  unsigned int optlen,
+                  const base::Options& opts = base::default_options()) const;
+
+  // Synchronous versions of the above.
+  base::Result recv(std::vector<Packet>* out, std::size_t max,
+                    const base::Options& opts = base::default_options()) const;
+  base::Result send(std::size_t* n, const std::vector<Packet>& in,
+                    const base::Options& opts = base::default_options()) const;
+  base::Result close(const base::Options& opts = base::default_options()) const;
+  base::Result get_option(
+      SockOpt opt, void* optval, unsigned int* optlen,
+      const base::Options& opts = base::default_options()) const;
+  base::Result set_option(
+      SockOpt opt, const void* optval, unsigned int optlen,
+      const base::Options& opts = base::default_options()) const;
+
+ private:
+  Pointer ptr_;
+};
+
+// PacketConn objects are swappable.
+inline void swap(PacketConn& a, PacketConn& b) noexcept { a.swap(b); }
+
+// PacketConn objects are comparable for equality.
+inline bool operator==(const PacketConn& a, const PacketConn& b) noexcept {
+  return a.implementation() == b.implementation();
+}
+inline bool operator!=(const PacketConn& a, const PacketConn& b) noexcept {
+  return !(a == b);
+}
+
+// Opens an unconnected datagram socket bound to |bind|.
+// - |bind.protocol_type()| MUST NOT be ProtocolType::stream
+void listen_packet(event::Task* task, PacketConn* out, const Addr& bind,
+                   const base::Options& opts = base::default_options());
+
+// Opens a datagram socket connected to |peer|, optionally bound to |bind|.
+// - |peer.protocol_type()| MUST NOT be ProtocolType::stream
+// - |bind.protocol() == peer.protocol() || !bind|
+void dial_packet(event::Task* task, PacketConn* out, const Addr& peer,
+                 const Addr& bind,
+                 const base::Options& opts = base::default_options());
+
+// Synchronous versions of the functions above.
+base::Result listen_packet(PacketConn* out, const Addr& bind,
+                           const base::Options& opts = base::default_options());
+base::Result dial_packet(PacketConn* out, const Addr& peer, const Addr& bind,
+                         const base::Options& opts = base::default_options());
+
+// Returns a net::PacketConn for the datagram socket |fd|.
+// - |ra| is empty iff |fd| isn't connected
+// - Received source addresses are |interpret()|-ed by the system registry
+base::Result fdpacketconn(PacketConn* out, Addr la, Addr ra, base::FD fd,
+                          const base::Options& opts);
+
+}  // namespace net
+
+#endif  // NET_PACKET_H
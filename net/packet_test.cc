@@ -0,0 +1,121 @@
+// Copyright © 2017 by Donald King <chronos@chronos-tachyon.net>
+// Available under the MIT License. See LICENSE for details.
+
+#include "gtest/gtest.h"
+
+#include <string>
+#include <vector>
+
+#include "base/logging.h"
+#include "base/result_testing.h"
+#include "net/addr.h"
+#include "net/inet.h"
+#include "net/net.h"
+#include "net/options.h"
+#include "net/packet.h"
+
+using RC = base::ResultCode;
+
+static void recv_exactly(const net::PacketConn& pc,
+                         std::vector<net::Packet>* out, std::size_t count) {
+  while (out->size() < count) {
+    ASSERT_OK(pc.recv(out, count - out->size()));
+  }
+}
+
+TEST(PacketConn, UDPRoundTrip) {
+  net::Addr bind;
+  ASSERT_OK(net::parse(&bind, "udp4", "127.0.0.1:0"));
+
+  net::PacketConn server;
+  ASSERT_OK(net::listen_packet(&server, bind));
+  EXPECT_FALSE(server.remote_addr());
+  net::Addr saddr = server.local_addr();
+  ASSERT_TRUE(saddr);
+  EXPECT_NE(0U, saddr.port());
+
+  net::PacketConn client;
+  ASSERT_OK(net::dial_packet(&client, saddr, net::Addr()));
+  EXPECT_EQ(saddr, client.remote_addr());
+  net::Addr caddr = client.local_addr();
+  ASSERT_TRUE(caddr);
+
+  std::vector<net::Packet> out;
+  out.emplace_back("alpha");
+  out.emplace_back("");
+  out.emplace_back("gamma");
+  std::size_t n = 0;
+  ASSERT_OK(client.send(&n, out));
+  EXPECT_EQ(3U, n);
+
+  std::vector<net::Packet> in;
+  recv_exactly(server, &in, 3);
+  ASSERT_EQ(3U, in.size());
+  EXPECT_EQ("alpha", in[0].data);
+  EXPECT_EQ("", in[1].data);
+  EXPECT_EQ("gamma", in[2].data);
+  for (const auto& pkt : in) {
+    EXPECT_EQ(caddr, pkt.addr);
+    EXPECT_FALSE(pkt.truncated);
+  }
+
+  std::vector<net::Packet> reply;
+  reply.emplace_back("delta", in[0].addr);
+  ASSERT_OK(server.send(&n, reply));
+  EXPECT_EQ(1U, n);
+
+  in.clear();
+  recv_exactly(client, &in, 1);
+  EXPECT_EQ("delta", in[0].data);
+  EXPECT_EQ(saddr, in[0].addr);
+
+  EXPECT_OK(client.close());
+  EXPECT_OK(server.close());
+}
+
+TEST(PacketConn, AddressRules) {
+  net::Addr bind;
+  ASSERT_OK(net::parse(&bind, "udp4", "127.0.0.1:0"));
+
+  net::PacketConn server;
+  ASSERT_OK(net::listen_packet(&server, bind));
+
+  std::size_t n = 0;
+  std::vector<net::Packet> out;
+  out.emplace_back("no address");
+  EXPECT_EQ(RC::INVALID_ARGUMENT, server.send(&n, out).code());
+
+  net::PacketConn client;
+  ASSERT_OK(net::dial_packet(&client, server.local_addr(), net::Addr()));
+  out.back().addr = server.local_addr();
+  EXPECT_EQ(RC::INVALID_ARGUMENT, client.send(&n, out).code());
+
+  net::Addr tcp;
+  ASSERT_OK(net::parse(&tcp, "tcp4", "127.0.0.1:0"));
+  net::PacketConn stream;
+  EXPECT_EQ(RC::INVALID_ARGUMENT, net::listen_packet(&stream, tcp).code());
+}
+
+TEST(PacketConn, Truncation) {
+  net::Addr bind;
+  ASSERT_OK(net::parse(&bind, "udp4", "127.0.0.1:0"));
+
+  base::Options opts;
+  opts.get<net::Options>().packet_buffer_size = 4;
+
+  net::PacketConn server;
+  ASSERT_OK(net::listen_packet(&server, bind, opts));
+
+  net::PacketConn client;
+  ASSERT_OK(net::dial_packet(&client, server.local_addr(), net::Addr()));
+
+  std::vector<net::Packet> out;
+  out.emplace_back("abcdefgh");
+  std::size_t n = 0;
+  ASSERT_OK(client.send(&n, out));
+
+  std::vector<net::Packet> in;
+  recv_exactly(server, &in, 1);
+  EXPECT_EQ("abcd", in[0].data);
+  EXPECT_TRUE(in[0].truncated);
+}
@@ -0,0 +1,461 @@
+// Copyright © 2017 by Donald King <chronos@chronos-tachyon.net>
+// Available under the MIT License. See LICENSE for details.
+
+#include "net/pool.h"
+
+#include <sys/socket.h>
+
+#include <cerrno>
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "base/logging.h"
+#include "base/mutex.h"
+#include "base/time/clock.h"
+#include "base/time/time.h"
+#include "event/callback.h"
+#include "event/dispatcher.h"
+#include "event/handler.h"
+#include "event/manager.h"
+#include "io/options.h"
+
+using base::time::MonotonicTime;
+using base::time::monotonic_now;
+
+namespace net {
+
+namespace {
+
+// Returns false if |conn| has been closed by the peer, or if it has bytes
+// waiting that nobody asked for, e.g. a stray response.  Connections that
+// aren't backed by a native socket are assumed to be healthy.
+static bool looks_healthy(const Conn& conn) {
+  base::FD fd = conn.writer().implementation()->internal_writerfd();
+  if (!fd) return true;
+  char ch;
+  auto pair = fd->acquire_fd();
+  ssize_t n = ::recv(pair.first, &ch, 1, MSG_PEEK | MSG_DONTWAIT);
+  if (n >= 0) return false;
+  int err_no = errno;
+  return err_no == EAGAIN || err_no == EWOULDBLOCK || err_no == EINTR;
+}
+
+struct IdleConn {
+  Conn conn;
+  MonotonicTime deadline;
+
+  IdleConn(Conn c, MonotonicTime d) noexcept : conn(std::move(c)),
+                                               deadline(d) {}
+};
+
+struct Waiter {
+  event::Task* task;
+  Conn* out;
+  base::Options options;
+
+  Waiter(event::Task* t, Conn* o, base::Options opts) noexcept
+      : task(t),
+        out(o),
+        options(std::move(opts)) {}
+};
+
+struct Host {
+  std::deque<IdleConn> idle;  // oldest at the front
+  std::deque<Waiter> waiters;
+  std::size_t active;
+  std::size_t dialing;
+
+  Host() noexcept : active(0), dialing(0) {}
+
+  std::size_t total() const noexcept { return idle.size() + active + dialing; }
+  bool empty() const noexcept { return total() == 0 && waiters.empty(); }
+};
+
+}  // anonymous namespace
+
+struct Pool::State : public std::enable_shared_from_this<Pool::State> {
+  const PoolOptions po;
+  const Registry registry;
+  const event::Manager manager;
+  mutable std::mutex mu;
+  std::unordered_map<Addr, Host> hosts;             // protected by mu
+  std::unordered_map<const ConnImpl*, Addr> peers;  // protected by mu
+  PoolStats stats;                                  // protected by mu
+  event::Handle timer;                              // protected by mu
+  bool armed;                                       // protected by mu
+
+  State(PoolOptions po, Registry r, event::Manager m) noexcept
+      : po(std::move(po)),
+        registry(std::move(r)),
+        manager(std::move(m)),
+        armed(false) {}
+
+  base::Result initialize();
+
+  // Hands out an idle connection or starts a dial, if the limits allow.
+  // Returns false if |w| has to wait.  Called with |mu| held; any
+  // connections to be dropped are moved to |trash|.
+  bool try_checkout(base::Lock& lock, const Addr& peer, Waiter& w,
+                    std::vector<Conn>* trash);
+
+  // Starts a dial on behalf of |w|.  Called without |mu| held.
+  void start_dial(const Addr& peer, Waiter w);
+
+  // Called when a dial started by |start_dial()| completes.
+  void finish_dial(const Addr& peer, Waiter w, base::Result r);
+
+  // A slot for |peer| was freed; lets the next waiter, if any, have it.
+  // Waiters that were cancelled in the meantime are moved to |cancelled|,
+  // to be finished once |mu| is released.
+  void wake_waiter(base::Lock& lock, const Addr& peer,
+                   std::vector<std::pair<Addr, Waiter>>* dials,
+                   std::vector<event::Task*>* cancelled);
+
+  // Drops the connections in |trash|.  Closing a connection may block,
+  // which callbacks can't, so on a dispatcher thread they are handed to
+  // the dispatcher to destroy in a safe context.  Called without |mu| held.
+  void dispose(std::vector<Conn>* trash);
+
+  void release(Conn conn, bool reusable);
+  void expire();
+  void arm(base::Lock& lock, MonotonicTime deadline);
+  void cancel(event::Task* task);
+};
+
+base::Result Pool::State::initialize() {
+  if (po.idle_timeout.is_zero()) return base::Result();
+  std::weak_ptr<State> weak = shared_from_this();
+  auto closure = [weak](event::Data data) {
+    auto self = weak.lock();
+    if (self) self->expire();
+    return base::Result();
+  };
+  return manager.timer(&timer, event::handler(closure));
+}
+
+bool Pool::State::try_checkout(base::Lock& lock, const Addr& peer, Waiter& w,
+                               std::vector<Conn>* trash) {
+  auto& host = hosts[peer];
+  while (!host.idle.empty()) {
+    Conn conn = std::move(host.idle.back().conn);
+    host.idle.pop_back();
+    --stats.idle;
+    if (po.health_check && !looks_healthy(conn)) {
+      ++stats.stale;
+      trash->push_back(std::move(conn));
+      continue;
+    }
+    ++host.active;
+    ++stats.active;
+    ++stats.reuses;
+    peers[conn.implementation().get()] = peer;
+    *w.out = std::move(conn);
+    return true;
+  }
+  if (po.max_per_host != 0 && host.total() >= po.max_per_host) return false;
+  ++host.dialing;
+  *w.out = Conn();
+  return true;
+}
+
+void Pool::State::start_dial(const Addr& peer, Waiter w) {
+  struct DialHelper {
+    const std::shared_ptr<State> state;
+    const Addr peer;
+    Waiter waiter;
+    event::Task subtask;
+
+    DialHelper(std::shared_ptr<State> s, Addr p, Waiter w) noexcept
+        : state(std::move(s)),
+          peer(std::move(p)),
+          waiter(std::move(w)) {}
+
+    base::Result done() {
+      state->finish_dial(peer, std::move(waiter), subtask.result());
+      delete this;
+      return base::Result();
+    }
+  };
+
+  auto* h = new DialHelper(shared_from_this(), peer, std::move(w));
+  h->waiter.task->add_subtask(&h->subtask);
+  registry.dial(&h->subtask, h->waiter.out, peer, Addr(), h->waiter.options);
+  h->subtask.on_finished(event::callback([h] { return h->done(); }));
+}
+
+void Pool::State::finish_dial(const Addr& peer, Waiter w, base::Result r) {
+  std::vector<std::pair<Addr, Waiter>> dials;
+  std::vector<event::Task*> cancelled;
+  auto lock = base::acquire_lock(mu);
+  auto& host = hosts[peer];
+  --host.dialing;
+  if (r) {
+    ++host.active;
+    ++stats.active;
+    ++stats.dials;
+    peers[w.out->implementation().get()] = peer;
+  } else {
+    wake_waiter(lock, peer, &dials, &cancelled);
+    if (host.empty()) hosts.erase(peer);
+  }
+  lock.unlock();
+  w.task->finish(std::move(r));
+  for (auto* t : cancelled) t->finish_cancel();
+  for (auto& pair : dials) start_dial(pair.first, std::move(pair.second));
+}
+
+void Pool::State::wake_waiter(base::Lock& lock, const Addr& peer,
+                              std::vector<std::pair<Addr, Waiter>>* dials,
+                              std::vector<event::Task*>* cancelled) {
+  auto& host = hosts[peer];
+  while (!host.waiters.empty()) {
+    Waiter w = std::move(host.waiters.front());
+    host.waiters.pop_front();
+    --stats.waiting;
+    if (!w.task->is_running()) {
+      cancelled->push_back(w.task);
+      continue;
+    }
+    ++host.dialing;
+    dials->emplace_back(peer, std::move(w));
+    return;
+  }
+}
+
+void Pool::State::release(Conn conn, bool reusable) {
+  CHECK(conn);
+  std::vector<Conn> trash;
+  std::vector<std::pair<Addr, Waiter>> dials;
+  std::vector<event::Task*> cancelled;
+  std::vector<Waiter> handoffs;
+  auto lock = base::acquire_lock(mu);
+
+  // Slots are counted against the peer that was dialed, which need not be
+  // the same as |conn.remote_addr()|.
+  auto pit = peers.find(conn.implementation().get());
+  CHECK(pit != peers.end()) << ": net::Pool: released a connection that "
+                               "was not checked out from this pool";
+  const Addr peer = std::move(pit->second);
+  peers.erase(pit);
+
+  auto& host = hosts[peer];
+  if (host.active != 0) {
+    --host.active;
+    --stats.active;
+  }
+
+  if (reusable) {
+    // Somebody is already waiting for this peer: skip the idle list.
+    while (!host.waiters.empty()) {
+      Waiter w = std::move(host.waiters.front());
+      host.waiters.pop_front();
+      --stats.waiting;
+      if (!w.task->is_running()) {
+        handoffs.push_back(std::move(w));
+        continue;
+      }
+      ++host.active;
+      ++stats.active;
+      ++stats.reuses;
+      peers[conn.implementation().get()] = peer;
+      *w.out = std::move(conn);
+      handoffs.push_back(std::move(w));
+      break;
+    }
+  }
+
+  if (conn) {
+    if (reusable && host.idle.size() < po.max_idle_per_host &&
+        stats.idle < po.max_idle) {
+      auto deadline = monotonic_now() + po.idle_timeout;
+      host.idle.emplace_back(std::move(conn), deadline);
+      ++stats.idle;
+      arm(lock, deadline);
+    } else {
+      if (reusable) ++stats.evicted;
+      trash.push_back(std::move(conn));
+      wake_waiter(lock, peer, &dials, &cancelled);
+    }
+  }
+  if (host.empty()) hosts.erase(peer);
+  lock.unlock();
+
+  for (auto& w : handoffs) {
+    if (*w.out)
+      w.task->finish_ok();
+    else
+      w.task->finish_cancel();
+  }
+  for (auto* t : cancelled) t->finish_cancel();
+  for (auto& pair : dials) start_dial(pair.first, std::move(pair.second));
+  dispose(&trash);
+}
+
+void Pool::State::dispose(std::vector<Conn>* trash) {
+  if (trash->empty()) return;
+  if (event::internal::is_shallow()) {
+    trash->clear();
+    return;
+  }
+  auto* ptr = new std::vector<Conn>(std::move(*trash));
+  trash->clear();
+  manager.dispatcher()->dispose(ptr);
+}
+
+void Pool::State::expire() {
+  std::vector<Conn> trash;
+  std::vector<std::pair<Addr, Waiter>> dials;
+  std::vector<event::Task*> cancelled;
+  auto lock = base::acquire_lock(mu);
+  armed = false;
+  auto now = monotonic_now();
+  bool any = false;
+  MonotonicTime next;
+  auto it = hosts.begin();
+  while (it != hosts.end()) {
+    auto& host = it->second;
+    bool freed = false;
+    while (!host.idle.empty() && !(now < host.idle.front().deadline)) {
+      trash.push_back(std::move(host.idle.front().conn));
+      host.idle.pop_front();
+      --stats.idle;
+      ++stats.expired;
+      freed = true;
+    }
+    if (freed) wake_waiter(lock, it->first, &dials, &cancelled);
+    if (!host.idle.empty()) {
+      auto deadline = host.idle.front().deadline;
+      if (!any || deadline < next) next = deadline;
+      any = true;
+    }
+    if (host.empty())
+      it = hosts.erase(it);
+    else
+      ++it;
+  }
+  if (any) arm(lock, next);
+  lock.unlock();
+  VLOG(4) << "net::Pool: expired " << trash.size() << " idle connections";
+  for (auto* t : cancelled) t->finish_cancel();
+  for (auto& pair : dials) start_dial(pair.first, std::move(pair.second));
+  dispose(&trash);
+}
+
+void Pool::State::arm(base::Lock& lock, MonotonicTime deadline) {
+  // Idle connections all share one timeout, so the timer only needs to be
+  // armed for the oldest one; |expire()| re-arms it for the next.
+  if (armed || !timer) return;
+  timer.set_at(deadline).expect_ok(__FILE__, __LINE__);
+  armed = true;
+}
+
+void Pool::State::cancel(event::Task* task) {
+  std::vector<event::Task*> cancelled;
+  auto lock = base::acquire_lock(mu);
+  for (auto& pair : hosts) {
+    auto& waiters = pair.second.waiters;
+    auto it = waiters.begin();
+    while (it != waiters.end()) {
+      if (it->task == task) {
+        cancelled.push_back(it->task);
+        it = waiters.erase(it);
+        --stats.waiting;
+      } else {
+        ++it;
+      }
+    }
+  }
+  lock.unlock();
+  for (auto* t : cancelled) t->finish_cancel();
+}
+
+Pool::Pool(PoolOptions po, Registry registry, const base::Options& opts)
+    : state_(std::make_shared<State>(std::move(po), std::move(registry),
+                                     io::get_manager(opts))) {
+  state_->initialize().expect_ok(__FILE__, __LINE__);
+}
+
+Pool::~Pool() noexcept {
+  close_idle();
+  auto lock = base::acquire_lock(state_->mu);
+  if (state_->timer) {
+    state_->timer.disable().ignore_ok();
+    state_->timer.disown();
+  }
+}
+
+void Pool::dial(event::Task* task, Conn* out, const Addr& peer,
+                const base::Options& opts) {
+  CHECK_NOTNULL(task);
+  CHECK_NOTNULL(out);
+  CHECK(peer);
+  if (!task->start()) return;
+
+  Waiter w(task, out, opts);
+  std::vector<Conn> trash;
+  auto lock = base::acquire_lock(state_->mu);
+  bool ready = state_->try_checkout(lock, peer, w, &trash);
+  if (!ready) {
+    state_->hosts[peer].waiters.push_back(w);
+    ++state_->stats.waiting;
+  }
+  lock.unlock();
+  state_->dispose(&trash);
+
+  if (!ready) {
+    std::weak_ptr<State> weak = state_;
+    task->on_cancelled(event::callback([weak, task] {
+      auto state = weak.lock();
+      if (state) state->cancel(task);
+      return base::Result();
+    }));
+  } else if (*out) {
+    task->finish_ok();
+  } else {
+    state_->start_dial(peer, std::move(w));
+  }
+}
+
+base::Result Pool::dial(Conn* out, const Addr& peer,
+                        const base::Options& opts) {
+  event::Task task;
+  dial(&task, out, peer, opts);
+  event::wait(io::get_manager(opts), &task);
+  return task.result();
+}
+
+void Pool::release(Conn conn, bool reusable) {
+  state_->release(std::move(conn), reusable);
+}
+
+void Pool::close_idle() {
+  std::vector<Conn> trash;
+  std::vector<std::pair<Addr, Waiter>> dials;
+  std::vector<event::Task*> cancelled;
+  auto lock = base::acquire_lock(state_->mu);
+  auto it = state_->hosts.begin();
+  while (it != state_->hosts.end()) {
+    auto& host = it->second;
+    for (auto& idle : host.idle) trash.push_back(std::move(idle.conn));
+    state_->stats.idle -= host.idle.size();
+    host.idle.clear();
+    state_->wake_waiter(lock, it->first, &dials, &cancelled);
+    if (host.empty())
+      it = state_->hosts.erase(it);
+    else
+      ++it;
+  }
+  lock.unlock();
+  for (auto* t : cancelled) t->finish_cancel();
+  for (auto& pair : dials) state_->start_dial(pair.first, std::move(pair.second));
+  state_->dispose(&trash);
+}
+
+PoolStats Pool::stats() const {
+  auto lock = base::acquire_lock(state_->mu);
+  return state_->stats;
+}
+
+}  // namespace net
@@ -0,0 +1,150 @@
+// net/pool.h - Reuse of idle connections across dials
+// Copyright © 2017 by Donald King <chronos@chronos-tachyon.net>
+// Available under the MIT License. See LICENSE for details.
+
+#ifndef NET_POOL_H
+#define NET_POOL_H
+
+#include <cstddef>
+#include <memory>
+
+#include "base/options.h"
+#include "base/result.h"
+#include "base/time/duration.h"
+#include "event/task.h"
+#include "net/addr.h"
+#include "net/conn.h"
+#include "net/registry.h"
+
+namespace net {
+
+struct PoolOptions {
+  // The maximum number of idle connections kept, across all peers.
+  std::size_t max_idle;
+
+  // The maximum number of idle connections kept for any one peer.
+  std::size_t max_idle_per_host;
+
+  // The maximum number of connections to any one peer, counting those that
+  // are checked out, idle, or still being dialed.  Once reached, dials to
+  // that peer wait for a connection to be released.
+  // - If 0, there is no limit
+  std::size_t max_per_host;
+
+  // How long a connection may sit idle before it is closed.
+  // - If zero, idle connections are kept until evicted
+  base::time::Duration idle_timeout;
+
+  // If true, idle connections are checked for EOF or unexpected data with a
+  // non-blocking MSG_PEEK before being handed out again.  Only applies to
+  // connections backed by native sockets.
+  bool health_check;
+
+  PoolOptions() noexcept : max_idle(256),
+                           max_idle_per_host(16),
+                           max_per_host(0),
+                           idle_timeout(base::time::seconds(90)),
+                           health_check(true) {}
+};
+
+// PoolStats holds statistics for a Pool.  All fields are advisory only, as
+// they are only a snapshot.
+struct PoolStats {
+  // |dials| is the number of new connections successfully dialed.
+  std::size_t dials;
+
+  // |reuses| is the number of dials served by an idle connection.
+  std::size_t reuses;
+
+  // |stale| is the number of idle connections that failed the health check.
+  std::size_t stale;
+
+  // |expired| is the number of idle connections closed by |idle_timeout|.
+  std::size_t expired;
+
+  // |evicted| is the number of released connections closed because the
+  // |max_idle| or |max_idle_per_host| limit was reached.
+  std::size_t evicted;
+
+  // |idle| is the number of idle connections currently held.
+  std::size_t idle;
+
+  // |active| is the number of connections currently checked out.
+  std::size_t active;
+
+  // |waiting| is the number of dials waiting on |max_per_host|.
+  std::size_t waiting;
+
+  PoolStats() noexcept : dials(0),
+                         reuses(0),
+                         stale(0),
+                         expired(0),
+                         evicted(0),
+                         idle(0),
+                         active(0),
+                         waiting(0) {}
+
+  // Convenience method for the fraction of dials served by reuse.
+  double reuse_ratio() const noexcept {
+    std::size_t total = dials + reuses;
+    if (total == 0) return 0.0;
+    return double(reuses) / double(total);
+  }
+};
+
+// Pool hands out connections to peers, keeping connections that are released
+// back to it and reusing them for later dials to the same peer.
+//
+// A connection obtained from |dial()| is "checked out" until it is given
+// back with |release()|.  Only release a connection as reusable if the next
+// user can pick up exactly where this one left off, e.g. an HTTP/1.1
+// keep-alive connection with no request or response in flight.
+//
+// Idle connections are closed by an event::Manager timer once they have
+// been idle for |PoolOptions::idle_timeout|.
+//
+// THREAD SAFETY: This class is thread-safe.
+//
+class Pool {
+ public:
+  // Pool dials new connections through |registry|, and runs its idle timer
+  // on the io::Options event::Manager.
+  explicit Pool(PoolOptions po = PoolOptions(),
+                Registry registry = system_registry(),
+                const base::Options& opts = base::default_options());
+
+  // Closes all idle connections.  Checked out connections are unaffected.
+  ~Pool() noexcept;
+
+  // Pool is neither copyable nor moveable.
+  Pool(const Pool&) = delete;
+  Pool(Pool&&) = delete;
+  Pool& operator=(const Pool&) = delete;
+  Pool& operator=(Pool&&) = delete;
+
+  // Obtains a connection to |peer|, either an idle one or a newly dialed one.
+  void dial(event::Task* task, Conn* out, const Addr& peer,
+            const base::Options& opts = base::default_options());
+
+  // Synchronous version of |dial()|.
+  base::Result dial(Conn* out, const Addr& peer,
+                    const base::Options& opts = base::default_options());
+
+  // Gives back |conn|, which MUST have come from |dial()|.
+  // - If |reusable| is false, |conn| is dropped instead of being kept
+  void release(Conn conn, bool reusable = true);
+
+  // Drops all idle connections.
+  void close_idle();
+
+  // Obtains statistics about this Pool.
+  PoolStats stats() const;
+
+ private:
+  struct State;
+  std::shared_ptr<State> state_;
+};
+
+}  // namespace net
+
+#endif  // NET_POOL_H
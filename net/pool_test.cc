@@ -0,0 +1,224 @@
+// Copyright © 2017 by Donald King <chronos@chronos-tachyon.net>
+// Available under the MIT License. See LICENSE for details.
+
+#include "gtest/gtest.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "base/logging.h"
+#include "base/mutex.h"
+#include "base/result_testing.h"
+#include "event/task.h"
+#include "io/options.h"
+#include "net/addr.h"
+#include "net/conn.h"
+#include "net/fake.h"
+#include "net/pool.h"
+#include "net/registry.h"
+#include "net/unix.h"
+
+using P = net::ProtocolType;
+
+// A fake server that accepts connections and holds on to them.
+struct Server {
+  net::FakeData data;
+  net::Registry registry;
+  net::Addr addr;
+  net::ListenConn listener;
+  std::mutex mu;
+  std::vector<net::Conn> accepted;
+
+  Server() {
+    registry.add(nullptr, 100, net::fakeprotocol(&data));
+    addr = net::fakeaddr(&data, P::stream, 0x72656d74);
+    auto fn = [this](net::Conn c) {
+      auto lock = base::acquire_lock(mu);
+      accepted.push_back(std::move(c));
+    };
+    CHECK_OK(registry.listen(&listener, addr, fn));
+    CHECK_OK(listener.start());
+  }
+
+  ~Server() { listener.close().ignore_ok(); }
+};
+
+TEST(Pool, Reuse) {
+  Server s;
+  net::Pool pool(net::PoolOptions(), s.registry);
+
+  net::Conn c1, c2;
+  ASSERT_OK(pool.dial(&c1, s.addr));
+  pool.release(c1);
+  ASSERT_OK(pool.dial(&c2, s.addr));
+  EXPECT_EQ(c1, c2);
+
+  auto stats = pool.stats();
+  EXPECT_EQ(1U, stats.dials);
+  EXPECT_EQ(1U, stats.reuses);
+  EXPECT_EQ(1U, stats.active);
+  EXPECT_EQ(0U, stats.idle);
+  EXPECT_DOUBLE_EQ(0.5, stats.reuse_ratio());
+
+  pool.release(c2, false);
+  stats = pool.stats();
+  EXPECT_EQ(0U, stats.active);
+  EXPECT_EQ(0U, stats.idle);
+
+  net::Conn c3;
+  ASSERT_OK(pool.dial(&c3, s.addr));
+  EXPECT_NE(c1, c3);
+  EXPECT_EQ(2U, pool.stats().dials);
+}
+
+TEST(Pool, IdleLimits) {
+  Server s;
+  net::PoolOptions po;
+  po.max_idle_per_host = 1;
+  net::Pool pool(po, s.registry);
+
+  net::Conn c1, c2;
+  ASSERT_OK(pool.dial(&c1, s.addr));
+  ASSERT_OK(pool.dial(&c2, s.addr));
+  EXPECT_NE(c1, c2);
+  pool.release(c1);
+  pool.release(c2);
+
+  auto stats = pool.stats();
+  EXPECT_EQ(1U, stats.idle);
+  EXPECT_EQ(1U, stats.evicted);
+
+  pool.close_idle();
+  EXPECT_EQ(0U, pool.stats().idle);
+}
+
+TEST(Pool, MaxPerHost) {
+  Server s;
+  net::PoolOptions po;
+  po.max_per_host = 1;
+  net::Pool pool(po, s.registry);
+  base::Options o;
+  const auto& m = io::get_manager(o);
+
+  net::Conn c1, c2;
+  ASSERT_OK(pool.dial(&c1, s.addr));
+
+  event::Task task;
+  pool.dial(&task, &c2, s.addr);
+  EXPECT_FALSE(task.is_finished());
+  EXPECT_EQ(1U, pool.stats().waiting);
+
+  pool.release(c1);
+  event::wait(m, &task);
+  EXPECT_OK(task.result());
+  EXPECT_EQ(c1, c2);
+  EXPECT_EQ(0U, pool.stats().waiting);
+  EXPECT_EQ(1U, pool.stats().dials);
+}
+
+TEST(Pool, IdleTimeout) {
+  Server s;
+  net::PoolOptions po;
+  po.idle_timeout = base::time::milliseconds(10);
+  net::Pool pool(po, s.registry);
+
+  net::Conn c;
+  ASSERT_OK(pool.dial(&c, s.addr));
+  pool.release(std::move(c));
+  EXPECT_EQ(1U, pool.stats().idle);
+
+  for (int i = 0; i < 100 && pool.stats().idle != 0; ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  auto stats = pool.stats();
+  EXPECT_EQ(0U, stats.idle);
+  EXPECT_EQ(1U, stats.expired);
+
+  // The expired connection was closed, even with the pool left idle.
+  auto lock = base::acquire_lock(s.mu);
+  ASSERT_EQ(1U, s.accepted.size());
+  net::Conn peer = s.accepted[0];
+  lock.unlock();
+  std::string buf;
+  EXPECT_EOF(peer.reader().read(&buf, 1, 1));
+}
+
+TEST(Pool, HealthCheck) {
+  std::string path = "@mojo/net/pool_test/health";
+  const char* seed = ::getenv("TEST_RANDOM_SEED");
+  if (seed) {
+    path += '/';
+    path += seed;
+  }
+
+  net::Registry registry;
+  registry.add(nullptr, 100, net::unixprotocol());
+  net::Addr addr = net::unixaddr(P::stream, path);
+
+  std::mutex mu;
+  std::vector<net::Conn> accepted;
+  auto fn = [&mu, &accepted](net::Conn c) {
+    auto lock = base::acquire_lock(mu);
+    accepted.push_back(std::move(c));
+  };
+  net::ListenConn listener;
+  ASSERT_OK(registry.listen(&listener, addr, fn));
+  ASSERT_OK(listener.start());
+
+  auto await_accepted = [&mu, &accepted](std::size_t n) {
+    for (int i = 0; i < 100; ++i) {
+      auto lock = base::acquire_lock(mu);
+      if (accepted.size() >= n) return;
+      lock.unlock();
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+  };
+
+  net::Pool pool(net::PoolOptions(), registry);
+
+  // A quiet connection passes the check and is reused.
+  net::Conn c1, c2;
+  ASSERT_OK(pool.dial(&c1, addr));
+  pool.release(c1);
+  ASSERT_OK(pool.dial(&c2, addr));
+  EXPECT_EQ(c1, c2);
+
+  // A connection with unsolicited bytes waiting fails the check.
+  await_accepted(1);
+  {
+    auto lock = base::acquire_lock(mu);
+    ASSERT_EQ(1U, accepted.size());
+    std::size_t n;
+    EXPECT_OK(accepted[0].writer().write(&n, "x"));
+  }
+  pool.release(c2);
+  net::Conn c3;
+  ASSERT_OK(pool.dial(&c3, addr));
+  EXPECT_NE(c2, c3);
+
+  // So does a connection that the peer has closed.
+  await_accepted(2);
+  {
+    auto lock = base::acquire_lock(mu);
+    ASSERT_EQ(2U, accepted.size());
+    EXPECT_OK(accepted[1].close());
+  }
+  pool.release(c3);
+  net::Conn c4;
+  ASSERT_OK(pool.dial(&c4, addr));
+  EXPECT_NE(c3, c4);
+
+  auto stats = pool.stats();
+  EXPECT_EQ(3U, stats.dials);
+  EXPECT_EQ(1U, stats.reuses);
+  EXPECT_EQ(2U, stats.stale);
+  EXPECT_EQ(1U, stats.active);
+
+  pool.release(c4, false);
+  EXPECT_EQ(0U, pool.stats().active);
+  EXPECT_OK(listener.close());
+}
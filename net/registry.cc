@@ -6,9 +6,16 @@
 #include <sys/socket.h>
 
 #include <algorithm>
+#include <memory>
+#include <mutex>
 #include <stdexcept>
 
 #include "base/logging.h"
+#include "base/mutex.h"
+#include "event/callback.h"
+#include "event/handler.h"
+#include "event/manager.h"
+#include "io/options.h"
 
 static base::Result family_not_supp() {
   return base::Result::not_implemented("address family not supported");
@@ -20,6 +27,184 @@ static base::Result proto_not_supp() {
 
 namespace net {
 
+namespace {
+
+// Reorders |addrs| so that consecutive addresses alternate between protocols
+// (e.g. "tcp6", "tcp4"), starting with the protocol of the first address.
+// The relative order of addresses with the same protocol is unchanged.
+static std::vector<Addr> interleave(std::vector<Addr> addrs) {
+  std::vector<std::string> order;
+  std::vector<std::vector<Addr>> groups;
+  for (auto& addr : addrs) {
+    std::string protocol = addr.protocol();
+    auto it = std::find(order.begin(), order.end(), protocol);
+    std::size_t i = it - order.begin();
+    if (it == order.end()) {
+      order.push_back(std::move(protocol));
+      groups.emplace_back();
+    }
+    groups[i].push_back(std::move(addr));
+  }
+
+  std::vector<Addr> out;
+  out.reserve(addrs.size());
+  for (std::size_t j = 0; out.size() < addrs.size(); ++j) {
+    for (auto& group : groups) {
+      if (j < group.size()) out.push_back(std::move(group[j]));
+    }
+  }
+  return out;
+}
+
+// DialRace runs the connection attempts for |Registry::dial_race()|.
+class DialRace : public std::enable_shared_from_this<DialRace> {
+ public:
+  DialRace(Registry registry, event::Task* task, Conn* out,
+           std::vector<Addr> addrs, const base::Options& opts) noexcept
+      : registry_(std::move(registry)),
+        task_(task),
+        out_(out),
+        addrs_(std::move(addrs)),
+        options_(opts),
+        stagger_(opts.get<Options>().dial_stagger),
+        next_(0),
+        pending_(0),
+        done_(false),
+        failed_(false) {}
+
+  ~DialRace() noexcept {
+    if (timer_) {
+      timer_.disable().ignore_ok();
+      timer_.disown();
+    }
+  }
+
+  void start() {
+    std::weak_ptr<DialRace> weak = shared_from_this();
+    auto closure = [weak](event::Data data) {
+      auto self = weak.lock();
+      if (self) self->launch();
+      return base::Result();
+    };
+    base::Result r = io::get_manager(options_).timer(&timer_,
+                                                     event::handler(closure));
+    r.expect_ok(__FILE__, __LINE__);
+    launch();
+  }
+
+ private:
+  struct Attempt {
+    event::Task task;
+    Conn conn;
+  };
+
+  // Starts the next connection attempt, if any remain.
+  void launch();
+
+  // Called when |attempt| has finished.
+  void finished(Attempt* attempt);
+
+  const Registry registry_;
+  event::Task* const task_;
+  Conn* const out_;
+  const std::vector<Addr> addrs_;
+  const base::Options options_;
+  const base::time::Duration stagger_;
+  event::Handle timer_;
+  std::mutex mu_;
+  std::vector<std::unique_ptr<Attempt>> attempts_;  // protected by mu_
+  std::size_t next_;                                // protected by mu_
+  std::size_t pending_;                             // protected by mu_
+  bool done_;                                       // protected by mu_
+  bool failed_;                                     // protected by mu_
+  base::Result result_;                             // protected by mu_
+};
+
+void DialRace::launch() {
+  auto lock = base::acquire_lock(mu_);
+  if (done_) return;
+  if (!task_->is_running() || next_ >= addrs_.size()) {
+    if (pending_ == 0) {
+      done_ = true;
+      lock.unlock();
+      if (failed_ && task_->is_running())
+        task_->finish(result_);
+      else
+        task_->finish_cancel();
+    }
+    return;
+  }
+
+  const Addr& addr = addrs_[next_];
+  ++next_;
+  ++pending_;
+  bool more = (next_ < addrs_.size());
+  attempts_.emplace_back(new Attempt);
+  Attempt* attempt = attempts_.back().get();
+  lock.unlock();
+
+  VLOG(4) << "net::Registry::dial_race: trying " << addr;
+  if (more && timer_) timer_.set_delay(stagger_).expect_ok(__FILE__, __LINE__);
+  task_->add_subtask(&attempt->task);
+  registry_.dial(&attempt->task, &attempt->conn, addr, Addr(), options_);
+  auto self = shared_from_this();
+  attempt->task.on_finished(event::callback([self, attempt] {
+    self->finished(attempt);
+    return base::Result();
+  }));
+}
+
+void DialRace::finished(Attempt* attempt) {
+  Conn loser;
+  auto lock = base::acquire_lock(mu_);
+  --pending_;
+  base::Result r = attempt->task.result();
+
+  if (done_) {
+    // Lost the race after all; drop the connection outside the lock.
+    loser = std::move(attempt->conn);
+    return;
+  }
+
+  if (r) {
+    done_ = true;
+    *out_ = std::move(attempt->conn);
+    std::vector<event::Task*> others;
+    for (const auto& a : attempts_) {
+      if (a.get() != attempt) others.push_back(&a->task);
+    }
+    lock.unlock();
+    if (timer_) timer_.cancel().ignore_ok();
+    for (auto* t : others) t->cancel();
+    task_->finish_ok();
+    return;
+  }
+
+  VLOG(4) << "net::Registry::dial_race: attempt failed: " << r;
+  if (!failed_) {
+    failed_ = true;
+    result_ = std::move(r);
+  }
+  lock.unlock();
+
+  // A failure doesn't wait out the stagger: move on to the next address.
+  launch();
+}
+
+// Races connections to |addrs| on behalf of |task|, which is running.
+static void race(const Registry& registry, event::Task* task, Conn* out,
+                 std::vector<Addr> addrs, const base::Options& opts) {
+  if (addrs.empty()) {
+    task->finish(base::Result::not_found("no addresses to dial"));
+    return;
+  }
+  auto ptr = std::make_shared<DialRace>(registry, task, out,
+                                        interleave(std::move(addrs)), opts);
+  ptr->start();
+}
+
+}  // anonymous namespace
+
 void Registry::add(base::token_t* t, prio_t prio,
                    std::shared_ptr<Protocol> ptr) {
   base::token_t token = base::next_token();
@@ -119,6 +304,54 @@ void Registry::dial(event::Task* task, Conn* out, const Addr& peer,
   if (task->start()) task->finish(proto_not_supp());
 }
 
+void Registry::dial_name(event::Task* task, Conn* out,
+                         const std::string& protocol,
+                         const std::string& address,
+                         const base::Options& opts) const {
+  CHECK_NOTNULL(task);
+  CHECK_NOTNULL(out);
+  if (!task->start()) return;
+
+  struct Helper {
+    const Registry registry;
+    event::Task* const task;
+    Conn* const out;
+    const base::Options options;
+    event::Task subtask;
+    std::vector<Addr> addrs;
+
+    Helper(Registry r, event::Task* t, Conn* o,
+           const base::Options& opts) noexcept : registry(std::move(r)),
+                                                 task(t),
+                                                 out(o),
+                                                 options(opts) {}
+
+    base::Result resolved() {
+      base::Result r = subtask.result();
+      if (!r)
+        task->finish(std::move(r));
+      else
+        race(registry, task, out, std::move(addrs), options);
+      delete this;
+      return base::Result();
+    }
+  };
+
+  auto* h = new Helper(*this, task, out, opts);
+  task->add_subtask(&h->subtask);
+  resolve(&h->subtask, &h->addrs, protocol, address, opts);
+  h->subtask.on_finished(event::callback([h] { return h->resolved(); }));
+}
+
+void Registry::dial_race(event::Task* task, Conn* out,
+                         std::vector<Addr> candidates,
+                         const base::Options& opts) const {
+  CHECK_NOTNULL(task);
+  CHECK_NOTNULL(out);
+  if (!task->start()) return;
+  race(*this, task, out, std::move(candidates), opts);
+}
+
 base::Result Registry::resolve(std::vector<Addr>* out,
                                const std::string& protocol,
                                const std::string& address,
@@ -145,6 +378,15 @@ base::Result Registry::dial(Conn* out, const Addr& peer, const Addr& bind,
   return task.result();
 }
 
+base::Result Registry::dial_name(Conn* out, const std::string& protocol,
+                                 const std::string& address,
+                                 const base::Options& opts) const {
+  event::Task task;
+  dial_name(&task, out, protocol, address, opts);
+  event::wait(io::get_manager(opts), &task);
+  return task.result();
+}
+
 std::mutex& system_registry_mutex() {
   static std::mutex mu;
   return mu;
@@ -84,6 +84,24 @@ class Registry {
   void dial(event::Task* task, Conn* out, const Addr& peer, const Addr& bind,
             const base::Options& opts = base::default_options()) const;
 
+  // Resolves |address| as a human-readable |protocol| address, then connects
+  // to whichever resolved address answers first ("Happy Eyeballs", RFC 8305).
+  //
+  // - Addresses are tried with their protocols (e.g. "tcp6", "tcp4")
+  //   interleaved, keeping the resolver's preference for the first one
+  // - A new attempt starts every |Options::dial_stagger|, or as soon as the
+  //   previous attempt fails, whichever comes first
+  // - Once one attempt connects, the others are cancelled
+  // - If every attempt fails, fails with the first attempt's result
+  //
+  void dial_name(event::Task* task, Conn* out, const std::string& protocol,
+                 const std::string& address,
+                 const base::Options& opts = base::default_options()) const;
+
+  // Connects to whichever of |candidates| answers first, as above.
+  void dial_race(event::Task* task, Conn* out, std::vector<Addr> candidates,
+                 const base::Options& opts = base::default_options()) const;
+
   // Synchronous versions of the functions above.
   base::Result resolve(
       std::vector<Addr>* out, const std::string& protocol,
@@ -96,6 +114,9 @@ class Registry {
   }
   base::Result dial(Conn* out, const Addr& peer, const Addr& bind,
                     const base::Options& opts = base::default_options()) const;
+  base::Result dial_name(
+      Conn* out, const std::string& protocol, const std::string& address,
+      const base::Options& opts = base::default_options()) const;
 
  private:
   struct Item {
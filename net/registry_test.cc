@@ -3,10 +3,15 @@
 
 #include "gtest/gtest.h"
 
+#include <mutex>
+#include <vector>
+
+#include "base/mutex.h"
 #include "base/result_testing.h"
 #include "event/manager.h"
 #include "event/task.h"
 #include "net/addr.h"
+#include "net/conn.h"
 #include "net/fake.h"
 #include "net/registry.h"
 
@@ -53,3 +58,36 @@ TEST(Registry, Thunk) {
     EXPECT_EQ("help", addrs[1].raw_string());
   }
 }
+
+TEST(Registry, DialName) {
+  base::Options o;
+
+  net::FakeData data;
+  data.names["multi"] = {0x64656164, 0x6c697665};
+  data.names["dead"] = {0x64656164, 0x64656164};
+  net::Registry r;
+  r.add(nullptr, 0, net::fakeprotocol(&data));
+
+  std::mutex mu;
+  std::vector<net::Conn> accepted;
+  auto fn = [&mu, &accepted](net::Conn c) {
+    auto lock = base::acquire_lock(mu);
+    accepted.push_back(std::move(c));
+  };
+  auto live = net::fakeaddr(&data, net::ProtocolType::stream, 0x6c697665);
+  net::ListenConn l;
+  ASSERT_OK(r.listen(&l, live, o, fn));
+  ASSERT_OK(l.start(o));
+
+  // The first address refuses; the race moves on without waiting.
+  net::Conn c;
+  ASSERT_OK(r.dial_name(&c, "fake", "multi", o));
+  EXPECT_EQ(live, c.remote_addr());
+  EXPECT_OK(c.close(o));
+
+  base::Result result = r.dial_name(&c, "fake", "dead", o);
+  EXPECT_FALSE(result);
+  EXPECT_NOT_FOUND(r.dial_name(&c, "fake", "nowhere", o));
+
+  EXPECT_OK(l.close(o));
+}
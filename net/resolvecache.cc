@@ -0,0 +1,266 @@
+// Copyright © 2017 by Donald King <chronos@chronos-tachyon.net>
+// Available under the MIT License. See LICENSE for details.
+
+#include "net/resolvecache.h"
+
+#include <algorithm>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+#include "base/logging.h"
+#include "base/mutex.h"
+#include "base/time/clock.h"
+#include "base/time/time.h"
+#include "event/callback.h"
+#include "net/options.h"
+
+using base::time::Duration;
+using base::time::MonotonicTime;
+using base::time::monotonic_now;
+
+namespace net {
+
+namespace {
+
+struct Waiter {
+  event::Task* task;
+  std::vector<Addr>* out;
+
+  Waiter(event::Task* t, std::vector<Addr>* o) noexcept : task(t), out(o) {}
+};
+
+struct Entry {
+  std::vector<Addr> addrs;
+  MonotonicTime expires;      // |addrs| is fresh until then
+  MonotonicTime stale_until;  // |addrs| may be served until then
+  std::vector<Waiter> waiters;
+  bool cached;
+  bool inflight;
+
+  Entry() noexcept : cached(false), inflight(false) {}
+};
+
+}  // anonymous namespace
+
+struct ResolveCache::State : public std::enable_shared_from_this<State> {
+  const std::size_t max_entries;
+  mutable std::mutex mu;
+  std::unordered_map<std::string, Entry> entries;  // protected by mu
+  ResolveCacheStats stats;                         // protected by mu
+
+  explicit State(std::size_t max) noexcept : max_entries(max) {}
+
+  // Calls |fn| to look up |key|.  Called without |mu| held.
+  void start(const std::string& key, ResolveFn fn, base::Options opts);
+
+  // Called when a lookup started by |start()| completes.
+  void finish(const std::string& key, std::vector<Addr> addrs, Duration ttl,
+              base::Result r, const base::Options& opts);
+
+  // Drops entries until there are no more than |max_entries|.
+  void trim(base::Lock& lock, MonotonicTime now);
+
+  void cancel(event::Task* task);
+};
+
+void ResolveCache::State::start(const std::string& key, ResolveFn fn,
+                                base::Options opts) {
+  struct FillHelper {
+    const std::shared_ptr<State> state;
+    const std::string key;
+    const base::Options options;
+    event::Task task;
+    std::vector<Addr> addrs;
+    Duration ttl;
+
+    FillHelper(std::shared_ptr<State> s, std::string k,
+               base::Options o) noexcept : state(std::move(s)),
+                                           key(std::move(k)),
+                                           options(std::move(o)),
+                                           ttl(Duration::min()) {}
+
+    base::Result done() {
+      state->finish(key, std::move(addrs), ttl, task.result(), options);
+      delete this;
+      return base::Result();
+    }
+  };
+
+  // The lookup belongs to every resolve waiting on it, so it is not made a
+  // subtask of any one of them: a cancelled resolve just stops waiting.
+  auto* h = new FillHelper(shared_from_this(), key, std::move(opts));
+  fn(&h->task, &h->addrs, &h->ttl, h->options);
+  h->task.on_finished(event::callback([h] { return h->done(); }));
+}
+
+void ResolveCache::State::finish(const std::string& key,
+                                 std::vector<Addr> addrs, Duration ttl,
+                                 base::Result r, const base::Options& opts) {
+  std::vector<Waiter> waiters;
+  auto lock = base::acquire_lock(mu);
+  auto& e = entries[key];
+  e.inflight = false;
+  waiters.swap(e.waiters);
+  if (r) {
+    const auto& o = opts.get<Options>();
+    if (ttl.is_neg()) ttl = o.resolve_ttl;
+    if (ttl < o.resolve_min_ttl) ttl = o.resolve_min_ttl;
+    if (o.resolve_max_ttl < ttl) ttl = o.resolve_max_ttl;
+    auto now = monotonic_now();
+    e.addrs = addrs;
+    e.expires = now + ttl;
+    e.stale_until = e.expires + o.resolve_stale;
+    e.cached = true;
+    trim(lock, now);
+  } else if (!e.cached) {
+    entries.erase(key);
+  }
+  lock.unlock();
+
+  VLOG(4) << "net::ResolveCache: lookup for " << key << " finished: " << r;
+  for (auto& w : waiters) {
+    if (!w.task->is_running()) {
+      w.task->finish_cancel();
+      continue;
+    }
+    if (r) w.out->insert(w.out->end(), addrs.begin(), addrs.end());
+    w.task->finish(r);
+  }
+}
+
+void ResolveCache::State::trim(base::Lock& lock, MonotonicTime now) {
+  if (entries.size() <= max_entries) return;
+
+  // First drop everything that is too stale to serve anyway.
+  auto it = entries.begin();
+  while (it != entries.end()) {
+    const auto& e = it->second;
+    if (!e.inflight && !(now < e.stale_until))
+      it = entries.erase(it);
+    else
+      ++it;
+  }
+  if (entries.size() <= max_entries) return;
+
+  // Then drop the names closest to expiring, leaving some headroom so that
+  // the next few insertions don't have to do this again.
+  using Item = std::pair<MonotonicTime, const std::string*>;
+  std::vector<Item> victims;
+  victims.reserve(entries.size());
+  for (const auto& pair : entries) {
+    if (!pair.second.inflight)
+      victims.emplace_back(pair.second.stale_until, &pair.first);
+  }
+  std::size_t target = max_entries - max_entries / 8;
+  std::size_t excess = entries.size() - std::min(entries.size(), target);
+  excess = std::min(excess, victims.size());
+  std::nth_element(victims.begin(), victims.begin() + excess, victims.end(),
+                   [](const Item& a, const Item& b) { return a.first < b.first; });
+  std::vector<std::string> keys;
+  keys.reserve(excess);
+  for (std::size_t i = 0; i < excess; ++i) keys.push_back(*victims[i].second);
+  for (const auto& key : keys) entries.erase(key);
+}
+
+void ResolveCache::State::cancel(event::Task* task) {
+  std::vector<event::Task*> cancelled;
+  auto lock = base::acquire_lock(mu);
+  for (auto& pair : entries) {
+    auto& waiters = pair.second.waiters;
+    auto it = waiters.begin();
+    while (it != waiters.end()) {
+      if (it->task == task) {
+        cancelled.push_back(it->task);
+        it = waiters.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+  lock.unlock();
+  for (auto* t : cancelled) t->finish_cancel();
+}
+
+ResolveCache::ResolveCache(std::size_t max_entries)
+    : state_(std::make_shared<State>(std::max(max_entries, std::size_t(1)))) {}
+
+void ResolveCache::resolve(event::Task* task, std::vector<Addr>* out,
+                           const std::string& key, ResolveFn fn,
+                           const base::Options& opts) {
+  CHECK_NOTNULL(task);
+  CHECK_NOTNULL(out);
+  CHECK(fn);
+  if (!task->start()) return;
+
+  auto now = monotonic_now();
+  auto lock = base::acquire_lock(state_->mu);
+  auto& e = state_->entries[key];
+  if (e.cached && now < e.stale_until) {
+    bool fresh = (now < e.expires);
+    bool refresh = (!fresh && !e.inflight);
+    if (fresh) {
+      ++state_->stats.hits;
+    } else {
+      ++state_->stats.stale_hits;
+    }
+    if (refresh) {
+      e.inflight = true;
+      ++state_->stats.refreshes;
+    }
+    out->insert(out->end(), e.addrs.begin(), e.addrs.end());
+    lock.unlock();
+    task->finish_ok();
+    if (refresh) state_->start(key, std::move(fn), opts);
+    return;
+  }
+
+  bool first = !e.inflight;
+  e.waiters.emplace_back(task, out);
+  e.inflight = true;
+  if (first) {
+    ++state_->stats.misses;
+  } else {
+    ++state_->stats.coalesced;
+  }
+  lock.unlock();
+
+  std::weak_ptr<State> weak = state_;
+  task->on_cancelled(event::callback([weak, task] {
+    auto state = weak.lock();
+    if (state) state->cancel(task);
+    return base::Result();
+  }));
+  if (first) state_->start(key, std::move(fn), opts);
+}
+
+void ResolveCache::clear() {
+  auto lock = base::acquire_lock(state_->mu);
+  auto it = state_->entries.begin();
+  while (it != state_->entries.end()) {
+    auto& e = it->second;
+    if (e.inflight) {
+      e.addrs.clear();
+      e.cached = false;
+      ++it;
+    } else {
+      it = state_->entries.erase(it);
+    }
+  }
+}
+
+ResolveCacheStats ResolveCache::stats() const {
+  auto lock = base::acquire_lock(state_->mu);
+  ResolveCacheStats out = state_->stats;
+  for (const auto& pair : state_->entries) {
+    if (pair.second.cached) ++out.entries;
+  }
+  return out;
+}
+
+ResolveCache& system_resolve_cache() {
+  static ResolveCache& ref = *new ResolveCache;
+  return ref;
+}
+
+}  // namespace net
@@ -0,0 +1,116 @@
+// net/resolvecache.h - Caching and coalescing of name resolution
+// Copyright © 2017 by Donald King <chronos@chronos-tachyon.net>
+// Available under the MIT License. See LICENSE for details.
+
+#ifndef NET_RESOLVECACHE_H
+#define NET_RESOLVECACHE_H
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "base/options.h"
+#include "base/time/duration.h"
+#include "event/task.h"
+#include "net/addr.h"
+
+namespace net {
+
+// ResolveFn performs the actual lookup on behalf of a ResolveCache.  It is
+// given the options of the resolve that started the lookup.
+//
+// On success, |*ttl| MAY be set to how long the results remain valid.  It
+// starts out negative, meaning that no TTL is known, and if it is left that
+// way then |net::Options::resolve_ttl| is used instead.  A TTL of zero is
+// honored, so the results are only cached for |net::Options::resolve_min_ttl|.
+using ResolveFn =
+    std::function<void(event::Task* task, std::vector<Addr>* out,
+                       base::time::Duration* ttl, const base::Options& opts)>;
+
+// ResolveCacheStats holds statistics for a ResolveCache.  All fields are
+// advisory only, as they are only a snapshot.
+struct ResolveCacheStats {
+  // |hits| is the number of resolves answered from an unexpired entry.
+  std::size_t hits;
+
+  // |stale_hits| is the number of resolves answered from an expired entry
+  // while it was being refreshed.
+  std::size_t stale_hits;
+
+  // |misses| is the number of resolves that started a lookup.
+  std::size_t misses;
+
+  // |coalesced| is the number of resolves that waited on a lookup started by
+  // an earlier resolve of the same name.
+  std::size_t coalesced;
+
+  // |refreshes| is the number of lookups started in the background to
+  // refresh an expired entry.
+  std::size_t refreshes;
+
+  // |entries| is the number of names currently cached.
+  std::size_t entries;
+
+  ResolveCacheStats() noexcept : hits(0),
+                                 stale_hits(0),
+                                 misses(0),
+                                 coalesced(0),
+                                 refreshes(0),
+                                 entries(0) {}
+};
+
+// ResolveCache remembers the results of name resolution for a while.
+//
+// Names are identified by an opaque |key|, which MUST capture everything
+// that can change the results, e.g. the protocol, the host, the service, and
+// any knobs that the ResolveFn consults.
+//
+// - Unexpired entries are returned without calling the ResolveFn
+// - Resolves of the same name while a lookup is running wait for its results
+//   instead of starting another lookup
+// - Entries that expired less than |net::Options::resolve_stale| ago are
+//   returned immediately while a lookup refreshes them in the background
+// - Failed lookups are not cached, but a failed refresh leaves the expired
+//   entry in place until it is too stale to serve
+//
+// THREAD SAFETY: This class is thread-safe.
+//
+class ResolveCache {
+ public:
+  // ResolveCache holds up to |max_entries| names.
+  explicit ResolveCache(std::size_t max_entries = 1024);
+
+  // Lookups that are still running complete normally, but are not cached.
+  ~ResolveCache() noexcept = default;
+
+  // ResolveCache is neither copyable nor moveable.
+  ResolveCache(const ResolveCache&) = delete;
+  ResolveCache(ResolveCache&&) = delete;
+  ResolveCache& operator=(const ResolveCache&) = delete;
+  ResolveCache& operator=(ResolveCache&&) = delete;
+
+  // Appends the resolved addresses for |key| to |out|, calling |fn| to look
+  // them up if they are not already cached.
+  void resolve(event::Task* task, std::vector<Addr>* out,
+               const std::string& key, ResolveFn fn,
+               const base::Options& opts = base::default_options());
+
+  // Forgets all cached names.  Lookups that are running are unaffected.
+  void clear();
+
+  // Obtains statistics about this ResolveCache.
+  ResolveCacheStats stats() const;
+
+ private:
+  struct State;
+  std::shared_ptr<State> state_;
+};
+
+// Returns the ResolveCache used by the system protocols.
+ResolveCache& system_resolve_cache();
+
+}  // namespace net
+
+#endif  // NET_RESOLVECACHE_H
@@ -0,0 +1,250 @@
+// Copyright © 2017 by Donald King <chronos@chronos-tachyon.net>
+// Available under the MIT License. See LICENSE for details.
+
+#include "gtest/gtest.h"
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "base/result_testing.h"
+#include "base/time/duration.h"
+#include "event/task.h"
+#include "io/options.h"
+#include "net/addr.h"
+#include "net/fake.h"
+#include "net/options.h"
+#include "net/resolvecache.h"
+
+using P = net::ProtocolType;
+using RC = base::ResultCode;
+
+// A ResolveFn that records its lookups, so that the test decides when and how
+// each one finishes.
+struct Lookups {
+  struct Pending {
+    event::Task* task;
+    std::vector<net::Addr>* out;
+    base::time::Duration* ttl;
+  };
+
+  std::vector<Pending> pending;
+  std::size_t count = 0;
+
+  net::ResolveFn fn() {
+    return [this](event::Task* task, std::vector<net::Addr>* out,
+                  base::time::Duration* ttl, const base::Options& opts) {
+      ++count;
+      if (task->start()) pending.push_back(Pending{task, out, ttl});
+    };
+  }
+
+  // Finishes the oldest lookup without reporting a TTL.
+  void finish(net::Addr addr) {
+    ASSERT_FALSE(pending.empty());
+    auto p = pending.front();
+    pending.erase(pending.begin());
+    p.out->push_back(std::move(addr));
+    p.task->finish_ok();
+  }
+
+  void finish(net::Addr addr, base::time::Duration ttl) {
+    ASSERT_FALSE(pending.empty());
+    *pending.front().ttl = ttl;
+    finish(std::move(addr));
+  }
+
+  void fail(base::Result r) {
+    ASSERT_FALSE(pending.empty());
+    auto p = pending.front();
+    pending.erase(pending.begin());
+    p.task->finish(std::move(r));
+  }
+};
+
+static base::Result resolve(net::ResolveCache* cache, Lookups* lookups,
+                            std::vector<net::Addr>* out,
+                            const base::Options& opts, net::Addr answer) {
+  event::Task task;
+  cache->resolve(&task, out, "key", lookups->fn(), opts);
+  if (!lookups->pending.empty()) lookups->finish(std::move(answer));
+  event::wait(io::get_manager(opts), &task);
+  return task.result();
+}
+
+TEST(ResolveCache, Hit) {
+  net::FakeData data;
+  auto a = net::fakeaddr(&data, P::stream, 1);
+  net::ResolveCache cache;
+  Lookups lookups;
+  base::Options o;
+
+  std::vector<net::Addr> out;
+  ASSERT_OK(resolve(&cache, &lookups, &out, o, a));
+  ASSERT_OK(resolve(&cache, &lookups, &out, o, a));
+  ASSERT_EQ(2U, out.size());
+  EXPECT_EQ(a, out[0]);
+  EXPECT_EQ(a, out[1]);
+  EXPECT_EQ(1U, lookups.count);
+
+  auto stats = cache.stats();
+  EXPECT_EQ(1U, stats.misses);
+  EXPECT_EQ(1U, stats.hits);
+  EXPECT_EQ(1U, stats.entries);
+
+  cache.clear();
+  out.clear();
+  ASSERT_OK(resolve(&cache, &lookups, &out, o, a));
+  EXPECT_EQ(2U, lookups.count);
+}
+
+TEST(ResolveCache, Coalesce) {
+  net::FakeData data;
+  auto a = net::fakeaddr(&data, P::stream, 1);
+  net::ResolveCache cache;
+  Lookups lookups;
+  base::Options o;
+
+  std::vector<net::Addr> out1, out2, out3;
+  event::Task t1, t2, t3;
+  cache.resolve(&t1, &out1, "key", lookups.fn(), o);
+  cache.resolve(&t2, &out2, "key", lookups.fn(), o);
+  cache.resolve(&t3, &out3, "key", lookups.fn(), o);
+  EXPECT_EQ(1U, lookups.count);
+  EXPECT_FALSE(t1.is_finished());
+  EXPECT_FALSE(t2.is_finished());
+
+  t3.cancel();
+  event::wait(io::get_manager(o), &t3);
+  EXPECT_EQ(RC::CANCELLED, t3.result().code());
+
+  lookups.finish(a);
+  event::wait(io::get_manager(o), &t1);
+  event::wait(io::get_manager(o), &t2);
+  EXPECT_OK(t1.result());
+  EXPECT_OK(t2.result());
+  ASSERT_EQ(1U, out1.size());
+  ASSERT_EQ(1U, out2.size());
+  EXPECT_EQ(a, out1[0]);
+  EXPECT_EQ(a, out2[0]);
+  EXPECT_TRUE(out3.empty());
+  EXPECT_EQ(2U, cache.stats().coalesced);
+}
+
+TEST(ResolveCache, Failure) {
+  net::ResolveCache cache;
+  Lookups lookups;
+  base::Options o;
+
+  for (int i = 0; i < 2; ++i) {
+    std::vector<net::Addr> out;
+    event::Task task;
+    cache.resolve(&task, &out, "key", lookups.fn(), o);
+    lookups.fail(base::Result::not_found());
+    event::wait(io::get_manager(o), &task);
+    EXPECT_EQ(RC::NOT_FOUND, task.result().code());
+  }
+  EXPECT_EQ(2U, lookups.count);
+  EXPECT_EQ(0U, cache.stats().entries);
+}
+
+TEST(ResolveCache, StaleWhileRefresh) {
+  net::FakeData data;
+  auto a = net::fakeaddr(&data, P::stream, 1);
+  auto b = net::fakeaddr(&data, P::stream, 2);
+  net::ResolveCache cache;
+  Lookups lookups;
+  base::Options o;
+  o.get<net::Options>().resolve_max_ttl = base::time::milliseconds(1);
+  o.get<net::Options>().resolve_stale = base::time::hours(1);
+
+  std::vector<net::Addr> out;
+  event::Task t1;
+  cache.resolve(&t1, &out, "key", lookups.fn(), o);
+  lookups.finish(a, base::time::hours(1));  // clamped to 1ms
+  event::wait(io::get_manager(o), &t1);
+  ASSERT_OK(t1.result());
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+  // Expired, so served stale while a refresh runs.
+  out.clear();
+  event::Task t2;
+  cache.resolve(&t2, &out, "key", lookups.fn(), o);
+  event::wait(io::get_manager(o), &t2);
+  ASSERT_OK(t2.result());
+  ASSERT_EQ(1U, out.size());
+  EXPECT_EQ(a, out[0]);
+  EXPECT_EQ(2U, lookups.count);
+  EXPECT_EQ(1U, lookups.pending.size());
+
+  // Only one refresh at a time.
+  out.clear();
+  event::Task t3;
+  cache.resolve(&t3, &out, "key", lookups.fn(), o);
+  event::wait(io::get_manager(o), &t3);
+  ASSERT_OK(t3.result());
+  EXPECT_EQ(2U, lookups.count);
+
+  lookups.finish(b);
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  out.clear();
+  event::Task t4;
+  cache.resolve(&t4, &out, "key", lookups.fn(), o);
+  event::wait(io::get_manager(o), &t4);
+  ASSERT_OK(t4.result());
+  ASSERT_EQ(1U, out.size());
+  EXPECT_EQ(b, out[0]);
+
+  auto stats = cache.stats();
+  EXPECT_EQ(3U, stats.stale_hits);
+  EXPECT_EQ(2U, stats.refreshes);
+  lookups.finish(b);
+}
+
+TEST(ResolveCache, ZeroTTL) {
+  net::FakeData data;
+  auto a = net::fakeaddr(&data, P::stream, 1);
+  net::ResolveCache cache;
+  Lookups lookups;
+  base::Options o;
+  o.get<net::Options>().resolve_stale = base::time::Duration();
+
+  // A reported TTL of zero is not mistaken for a missing one.
+  for (int i = 0; i < 2; ++i) {
+    std::vector<net::Addr> out;
+    event::Task task;
+    cache.resolve(&task, &out, "key", lookups.fn(), o);
+    lookups.finish(a, base::time::Duration());
+    event::wait(io::get_manager(o), &task);
+    ASSERT_OK(task.result());
+  }
+  EXPECT_EQ(2U, lookups.count);
+  EXPECT_EQ(0U, cache.stats().hits);
+
+  // It is still subject to the floor.
+  o.get<net::Options>().resolve_min_ttl = base::time::hours(1);
+  for (int i = 0; i < 2; ++i) {
+    std::vector<net::Addr> out;
+    ASSERT_OK(resolve(&cache, &lookups, &out, o, a));
+  }
+  EXPECT_EQ(3U, lookups.count);
+  EXPECT_EQ(1U, cache.stats().hits);
+}
+
+TEST(ResolveCache, Trim) {
+  net::FakeData data;
+  auto a = net::fakeaddr(&data, P::stream, 1);
+  net::ResolveCache cache(8);
+  Lookups lookups;
+  base::Options o;
+
+  for (int i = 0; i < 20; ++i) {
+    std::vector<net::Addr> out;
+    event::Task task;
+    cache.resolve(&task, &out, std::to_string(i), lookups.fn(), o);
+    lookups.finish(a);
+    event::wait(io::get_manager(o), &task);
+    ASSERT_OK(task.result());
+  }
+  EXPECT_GE(8U, cache.stats().entries);
+}
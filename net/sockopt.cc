@@ -15,6 +15,14 @@
 
 #include "base/logging.h"
 
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+
 namespace net {
 
 namespace {
@@ -62,6 +70,8 @@ static const OptnameMapping kSocketOptnames[] = {
     {SOL_SOCKET, SO_RCVTIMEO, "SO_RCVTIMEO"},
     {SOL_SOCKET, SO_SNDTIMEO, "SO_SNDTIMEO"},
     {SOL_SOCKET, SO_REUSEADDR, "SO_REUSEADDR"},
+    {SOL_SOCKET, SO_REUSEPORT, "SO_REUSEPORT"},
+    {SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, "SO_ATTACH_REUSEPORT_CBPF"},
     {SOL_SOCKET, SO_RXQ_OVFL, "SO_RXQ_OVFL"},
     {SOL_SOCKET, SO_SNDBUF, "SO_SNDBUF"},
     {SOL_SOCKET, SO_SNDBUFFORCE, "SO_SNDBUFFORCE"},
@@ -133,6 +143,8 @@ static const OptnameMapping kSocketOptnames[] = {
     {IPPROTO_TCP, TCP_WINDOW_CLAMP, "TCP_WINDOW_CLAMP"},
 
     {IPPROTO_UDP, UDP_CORK, "UDP_CORK"},
+    {IPPROTO_UDP, UDP_GRO, "UDP_GRO"},
+    {IPPROTO_UDP, UDP_SEGMENT, "UDP_SEGMENT"},
 
     //{IPPROTO_ICMP, ICMP_FILTER, "ICMP_FILTER"},
     //{IPPROTO_RAW, ICMP_FILTER, "ICMP_FILTER"},
@@ -208,9 +220,14 @@ const SockOpt sockopt_sndbuf = SockOpt(SOL_SOCKET, SO_SNDBUF);
 const SockOpt sockopt_rcvtimeo = SockOpt(SOL_SOCKET, SO_RCVTIMEO);
 const SockOpt sockopt_sndtimeo = SockOpt(SOL_SOCKET, SO_SNDTIMEO);
 const SockOpt sockopt_reuseaddr = SockOpt(SOL_SOCKET, SO_REUSEADDR);
+const SockOpt sockopt_reuseport = SockOpt(SOL_SOCKET, SO_REUSEPORT);
+const SockOpt sockopt_attach_reuseport_cbpf =
+    SockOpt(SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF);
 const SockOpt sockopt_ipv6_v6only = SockOpt(IPPROTO_IPV6, IPV6_V6ONLY);
 const SockOpt sockopt_tcp_cork = SockOpt(IPPROTO_TCP, TCP_CORK);
 const SockOpt sockopt_tcp_nodelay = SockOpt(IPPROTO_TCP, TCP_NODELAY);
 const SockOpt sockopt_udp_cork = SockOpt(IPPROTO_UDP, UDP_CORK);
+const SockOpt sockopt_udp_gro = SockOpt(IPPROTO_UDP, UDP_GRO);
+const SockOpt sockopt_udp_segment = SockOpt(IPPROTO_UDP, UDP_SEGMENT);
 
 }  // namespace net
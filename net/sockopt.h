@@ -71,10 +71,14 @@ extern const SockOpt sockopt_sndbuf;
 extern const SockOpt sockopt_rcvtimeo;
 extern const SockOpt sockopt_sndtimeo;
 extern const SockOpt sockopt_reuseaddr;
+extern const SockOpt sockopt_reuseport;
+extern const SockOpt sockopt_attach_reuseport_cbpf;
 extern const SockOpt sockopt_ipv6_v6only;
 extern const SockOpt sockopt_tcp_cork;
 extern const SockOpt sockopt_tcp_nodelay;
 extern const SockOpt sockopt_udp_cork;
+extern const SockOpt sockopt_udp_gro;
+extern const SockOpt sockopt_udp_segment;
 
 }  // namespace net
 
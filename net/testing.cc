@@ -243,6 +243,7 @@ struct TestHelper {
 }  // anonymous namespace
 
 static void TestListenAndDial_Common(std::shared_ptr<Protocol> pr, Addr addr,
+                                     const base::Options& base_opts,
                                      const event::ManagerOptions& mo,
                                      const char* name) {
   std::atomic<std::size_t> last_id(0);
@@ -255,7 +256,7 @@ static void TestListenAndDial_Common(std::shared_ptr<Protocol> pr, Addr addr,
   event::Manager m;
   ASSERT_OK(event::new_manager(&m, mo));
 
-  base::Options opts;
+  base::Options opts = base_opts;
   opts.get<io::Options>().manager = m;
 
   auto acceptfn = [&last_id, &dial, &talk, &opts](net::Conn c) {
@@ -312,35 +313,39 @@ static void TestListenAndDial_Common(std::shared_ptr<Protocol> pr, Addr addr,
   base::log_flush();
 }
 
-static void TestListenAndDial_Async(std::shared_ptr<Protocol> p, Addr addr) {
+static void TestListenAndDial_Async(std::shared_ptr<Protocol> p, Addr addr,
+                                    const base::Options& opts) {
   event::ManagerOptions mo;
   mo.set_async_mode();
-  TestListenAndDial_Common(p, addr, mo, "async");
+  TestListenAndDial_Common(p, addr, opts, mo, "async");
 }
 
 static void TestListenAndDial_SingleThreaded(std::shared_ptr<Protocol> p,
-                                             Addr addr) {
+                                             Addr addr,
+                                             const base::Options& opts) {
   event::ManagerOptions mo;
   mo.set_minimal_threaded_mode();
-  TestListenAndDial_Common(p, addr, mo, "single-threaded");
+  TestListenAndDial_Common(p, addr, opts, mo, "single-threaded");
 }
 
 static void TestListenAndDial_MultiThreaded(std::shared_ptr<Protocol> p,
-                                            Addr addr) {
+                                            Addr addr,
+                                            const base::Options& opts) {
   event::ManagerOptions mo;
   mo.set_threaded_mode();
   mo.set_num_pollers(2);
   mo.dispatcher().set_num_workers(4);
-  TestListenAndDial_Common(p, addr, mo, "multi-threaded");
+  TestListenAndDial_Common(p, addr, opts, mo, "multi-threaded");
 }
 
-void TestListenAndDial(std::shared_ptr<Protocol> p, Addr addr) {
+void TestListenAndDial(std::shared_ptr<Protocol> p, Addr addr,
+                       const base::Options& opts) {
   CHECK_NOTNULL(p);
   CHECK(addr);
   CHECK(p->supports(addr.protocol()));
-  TestListenAndDial_Async(p, addr);
-  TestListenAndDial_SingleThreaded(p, addr);
-  TestListenAndDial_MultiThreaded(p, addr);
+  TestListenAndDial_Async(p, addr, opts);
+  TestListenAndDial_SingleThreaded(p, addr, opts);
+  TestListenAndDial_MultiThreaded(p, addr, opts);
 }
 
 }  // namespace net
@@ -5,11 +5,13 @@
 #ifndef NET_TESTING_H
 #define NET_TESTING_H
 
+#include "base/options.h"
 #include "net/protocol.h"
 
 namespace net {
 
-void TestListenAndDial(std::shared_ptr<Protocol> p, Addr addr);
+void TestListenAndDial(std::shared_ptr<Protocol> p, Addr addr,
+                       const base::Options& opts = base::default_options());
 
 }  // namespace net
 
@@ -0,0 +1,1851 @@
+// Copyright © 2017 by Donald King <chronos@chronos-tachyon.net>
+// Available under the MIT License. See LICENSE for details.
+
+#ifndef HAVE_KTLS
+#define HAVE_KTLS 1
+#endif
+
+#include "net/tls.h"
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#if HAVE_KTLS
+#include <linux/tls.h>
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "base/logging.h"
+#include "base/mutex.h"
+#include "crypto/cipher/aes.h"
+#include "crypto/hash/sha2.h"
+#include "crypto/hmac.h"
+#include "crypto/subtle.h"
+#include "event/callback.h"
+#include "event/handler.h"
+#include "event/manager.h"
+#include "io/options.h"
+
+namespace net {
+
+namespace {
+
+using RC = base::ResultCode;
+
+// Record content types.
+enum : uint8_t {
+  kChangeCipherSpec = 20,
+  kAlert = 21,
+  kHandshake = 22,
+  kApplicationData = 23,
+};
+
+// Handshake message types.
+enum : uint8_t {
+  kClientHello = 1,
+  kServerHello = 2,
+  kNewSessionTicket = 4,
+  kEncryptedExtensions = 8,
+  kCertificate = 11,
+  kCertificateRequest = 13,
+  kFinished = 20,
+  kKeyUpdate = 24,
+};
+
+// Extension types.
+enum : uint16_t {
+  kExtServerName = 0,
+  kExtPreSharedKey = 41,
+  kExtSupportedVersions = 43,
+  kExtPSKKeyExchangeModes = 45,
+  kExtKeyShare = 51,
+};
+
+// Alert descriptions.
+enum : uint8_t {
+  kAlertCloseNotify = 0,
+  kAlertHandshakeFailure = 40,
+  kAlertDecodeError = 50,
+  kAlertDecryptError = 51,
+  kAlertProtocolVersion = 70,
+  kAlertInternalError = 80,
+  kAlertMissingExtension = 109,
+  kAlertUnknownPSKIdentity = 115,
+};
+
+constexpr uint16_t kLegacyVersion = 0x0303;
+constexpr uint16_t kVersionTLS13 = 0x0304;
+constexpr uint8_t kModePSKKE = 0;
+
+constexpr std::size_t kHeaderSize = 5;
+constexpr std::size_t kTagSize = 16;
+constexpr std::size_t kIVSize = 12;
+constexpr std::size_t kMaxPlaintext = 1U << 14;
+constexpr std::size_t kMaxCiphertext = kMaxPlaintext + 256;
+constexpr std::size_t kMaxHandshake = 1U << 16;
+
+// SHA-256("HelloRetryRequest"), which is sent as the ServerHello.random of a
+// HelloRetryRequest.
+const uint8_t kHelloRetryRandom[32] = {
+    0xcf, 0x21, 0xad, 0x74, 0xe5, 0x9a, 0x61, 0x11, 0xbe, 0x1d, 0x8c,
+    0x02, 0x1e, 0x65, 0xb8, 0x91, 0xc2, 0xa2, 0x11, 0x16, 0x7a, 0xbb,
+    0x8c, 0x5e, 0x07, 0x9e, 0x09, 0xe2, 0xc8, 0xa8, 0x33, 0x9c,
+};
+
+struct Suite {
+  TLSCipherSuite id;
+  crypto::NewHasher hash;
+  std::size_t hash_size;
+  std::size_t key_size;
+};
+
+const Suite kSuites[] = {
+    {TLSCipherSuite::aes_128_gcm_sha256, crypto::hash::new_sha256, 32, 16},
+    {TLSCipherSuite::aes_256_gcm_sha384, crypto::hash::new_sha384, 48, 32},
+};
+
+const Suite* find_suite(uint16_t id) {
+  for (const auto& suite : kSuites) {
+    if (static_cast<uint16_t>(suite.id) == id) return &suite;
+  }
+  return nullptr;
+}
+
+void random_bytes(std::string* out, std::size_t len) {
+  out->resize(len);
+  std::size_t pos = 0;
+  while (pos < len) {
+    ssize_t n = ::getrandom(&(*out)[pos], len - pos, 0);
+    if (n < 0 && errno == EINTR) continue;
+    CHECK_GT(n, 0) << ": getrandom(2) failed, errno=" << errno;
+    pos += n;
+  }
+}
+
+base::Result decode_error() {
+  return base::Result::data_loss("TLS: malformed message");
+}
+
+base::Result unexpected_message() {
+  return base::Result::data_loss("TLS: unexpected message");
+}
+
+// Maps a fatal alert from the peer to a Result.
+base::Result alert_result(uint8_t desc) {
+  switch (desc) {
+    case kAlertHandshakeFailure:
+    case kAlertProtocolVersion:
+    case kAlertMissingExtension:
+      return base::Result::failed_precondition(
+          "TLS: peer sent alert ", unsigned(desc));
+    case kAlertDecryptError:
+    case kAlertUnknownPSKIdentity:
+      return base::Result::unauthenticated("TLS: peer sent alert ",
+                                           unsigned(desc));
+    default:
+      return base::Result::aborted("TLS: peer sent alert ", unsigned(desc));
+  }
+}
+
+void put8(std::string* out, unsigned int x) { out->push_back(char(x)); }
+
+void put16(std::string* out, unsigned int x) {
+  out->push_back(char(x >> 8));
+  out->push_back(char(x));
+}
+
+void put24(std::string* out, unsigned int x) {
+  out->push_back(char(x >> 16));
+  out->push_back(char(x >> 8));
+  out->push_back(char(x));
+}
+
+// Appends a handshake message of type |type| holding |body|.
+void put_message(std::string* out, uint8_t type, const std::string& body) {
+  put8(out, type);
+  put24(out, body.size());
+  out->append(body);
+}
+
+// Appends an extension of type |type| holding |body|.
+void put_extension(std::string* out, uint16_t type, const std::string& body) {
+  put16(out, type);
+  put16(out, body.size());
+  out->append(body);
+}
+
+// Cursor reads the big-endian fields of a TLS message.  Reading past the end
+// makes |ok()| false and yields zeroes.
+class Cursor {
+ public:
+  Cursor(const std::string& s, std::size_t pos, std::size_t end) noexcept
+      : s_(&s),
+        pos_(pos),
+        end_(end),
+        ok_(true) {}
+  explicit Cursor(const std::string& s) noexcept : Cursor(s, 0, s.size()) {}
+
+  bool ok() const noexcept { return ok_; }
+  bool done() const noexcept { return pos_ == end_; }
+  std::size_t pos() const noexcept { return pos_; }
+
+  uint32_t uint(std::size_t n) {
+    if (!need(n)) return 0;
+    uint32_t x = 0;
+    for (std::size_t i = 0; i < n; ++i) x = (x << 8) | uint8_t((*s_)[pos_++]);
+    return x;
+  }
+  uint8_t u8() { return uint(1); }
+  uint16_t u16() { return uint(2); }
+  uint32_t u24() { return uint(3); }
+  uint32_t u32() { return uint(4); }
+
+  std::string bytes(std::size_t n) {
+    if (!need(n)) return std::string();
+    std::string out = s_->substr(pos_, n);
+    pos_ += n;
+    return out;
+  }
+  std::string vec8() { return bytes(u8()); }
+  std::string vec16() { return bytes(u16()); }
+
+  // Returns a Cursor over the next |n| bytes, and skips past them.
+  Cursor sub(std::size_t n) {
+    if (!need(n)) return Cursor(*s_, end_, end_, false);
+    Cursor out(*s_, pos_, pos_ + n);
+    pos_ += n;
+    return out;
+  }
+  Cursor sub8() { return sub(u8()); }
+  Cursor sub16() { return sub(u16()); }
+
+ private:
+  Cursor(const std::string& s, std::size_t pos, std::size_t end,
+         bool ok) noexcept : s_(&s),
+                             pos_(pos),
+                             end_(end),
+                             ok_(ok) {}
+
+  bool need(std::size_t n) {
+    if (ok_ && end_ - pos_ >= n) return true;
+    ok_ = false;
+    return false;
+  }
+
+  const std::string* s_;
+  std::size_t pos_;
+  std::size_t end_;
+  bool ok_;
+};
+
+// The TLS 1.3 key schedule, RFC 8446 section 7.1.
+
+std::string hash_of(const Suite& suite, const std::string& data) {
+  auto h = suite.hash();
+  std::string out(suite.hash_size, '\0');
+  h->write(data);
+  h->finalize();
+  h->sum(base::MutableBytes(&out[0], out.size()));
+  return out;
+}
+
+std::string expand_label(const Suite& suite, const std::string& secret,
+                         const char* label, const std::string& context,
+                         std::size_t len) {
+  std::string info;
+  std::size_t label_len = 6 + ::strlen(label);
+  put16(&info, len);
+  put8(&info, label_len);
+  info.append("tls13 ");
+  info.append(label);
+  put8(&info, context.size());
+  info.append(context);
+  return crypto::hkdf_expand(suite.hash, secret, info, len);
+}
+
+std::string derive_secret(const Suite& suite, const std::string& secret,
+                          const char* label, const std::string& messages) {
+  return expand_label(suite, secret, label, hash_of(suite, messages),
+                      suite.hash_size);
+}
+
+std::string extract(const Suite& suite, const std::string& salt,
+                    const std::string& ikm) {
+  return crypto::hkdf_extract(suite.hash, salt, ikm);
+}
+
+// Computes the verify_data of a Finished message, or of a PSK binder.
+std::string finished_mac(const Suite& suite, const std::string& base_key,
+                         const std::string& messages) {
+  std::string key =
+      expand_label(suite, base_key, "finished", "", suite.hash_size);
+  return crypto::hmac(suite.hash, key, hash_of(suite, messages));
+}
+
+// TrafficKeys protects the records sent in one direction.  Until |set()| is
+// first called, records are sent in the clear.
+struct TrafficKeys {
+  std::string secret;
+  std::string key;
+  std::string iv;
+  uint64_t seq;
+  std::unique_ptr<crypto::Sealer> aead;
+
+  TrafficKeys() noexcept : seq(0) {}
+
+  explicit operator bool() const noexcept { return !!aead; }
+
+  void set(const Suite& suite, std::string s) {
+    secret = std::move(s);
+    key = expand_label(suite, secret, "key", "", suite.key_size);
+    iv = expand_label(suite, secret, "iv", "", kIVSize);
+    seq = 0;
+    aead = crypto::cipher::new_aes_gcm(key);
+  }
+
+  void update(const Suite& suite) {
+    set(suite, expand_label(suite, secret, "traffic upd", "", suite.hash_size));
+  }
+
+  std::string nonce() const {
+    std::string out(iv);
+    for (std::size_t i = 0; i < 8; ++i) {
+      out[kIVSize - 1 - i] ^= char(seq >> (8 * i));
+    }
+    return out;
+  }
+};
+
+// Appends one record of type |type| holding |len| bytes at |ptr|.
+void seal_record(std::string* out, TrafficKeys* keys, uint8_t type,
+                 const char* ptr, std::size_t len) {
+  DCHECK_LE(len, kMaxPlaintext);
+  std::size_t hdr = out->size();
+  if (!*keys) {
+    put8(out, type);
+    put16(out, kLegacyVersion);
+    put16(out, len);
+    out->append(ptr, len);
+    return;
+  }
+
+  std::string inner(ptr, len);
+  inner.push_back(char(type));
+  put8(out, kApplicationData);
+  put16(out, kLegacyVersion);
+  put16(out, inner.size() + kTagSize);
+  out->resize(out->size() + inner.size() + kTagSize);
+
+  std::string nonce = keys->nonce();
+  std::string aad = out->substr(hdr, kHeaderSize);
+  char* ct = &(*out)[hdr + kHeaderSize];
+  auto tag = keys->aead->seal(base::MutableBytes(ct, inner.size()), inner, aad,
+                              nonce);
+  ::memcpy(ct + inner.size(), tag.data(), kTagSize);
+  ++keys->seq;
+}
+
+// Removes the protection from the record with header |hdr| and body |body|.
+base::Result open_record(uint8_t* type, std::string* out, TrafficKeys* keys,
+                         const std::string& hdr, const std::string& body) {
+  if (body.size() < kTagSize + 1) return decode_error();
+  std::size_t len = body.size() - kTagSize;
+  crypto::Tag tag(base::Bytes(body.data() + len, kTagSize));
+  std::string nonce = keys->nonce();
+  out->assign(len, '\0');
+  if (!keys->aead->unseal(tag, base::MutableBytes(&(*out)[0], len),
+                          base::Bytes(body.data(), len), hdr, nonce)) {
+    return base::Result::data_loss("TLS: record failed authentication");
+  }
+  ++keys->seq;
+
+  while (!out->empty() && out->back() == '\0') out->pop_back();
+  if (out->empty()) return unexpected_message();
+  *type = uint8_t(out->back());
+  out->pop_back();
+  return base::Result();
+}
+
+// Runs |fn| on a subtask of |task|, then finishes |task| the same way.
+void chain(event::Task* task, std::function<void(event::Task*)> fn) {
+  struct Helper {
+    event::Task* const task;
+    event::Task subtask;
+
+    explicit Helper(event::Task* t) noexcept : task(t) {}
+  };
+
+  auto* h = new Helper(task);
+  task->add_subtask(&h->subtask);
+  fn(&h->subtask);
+  h->subtask.on_finished(event::callback([h] {
+    event::propagate_result(h->task, &h->subtask);
+    delete h;
+    return base::Result();
+  }));
+}
+
+// TLSState is the state of one TLS connection, shared by the handshake and
+// by the reader and writer of the resulting Conn.
+struct TLSState : public std::enable_shared_from_this<TLSState> {
+  // ReadyFn is called with |rd_mu| held.  It returns true to finish the
+  // pump with |*r|.
+  using ReadyFn = std::function<bool(base::Result* r)>;
+
+  // BuildFn is called with |wr_mu| held.  It appends the bytes to send.
+  using BuildFn = std::function<base::Result(std::string* wire)>;
+
+  const Conn raw;
+  const TLSConfig config;
+  const Suite* const suite;
+  std::string server_name;
+  bool ktls_tx;
+
+  std::mutex rd_mu;
+  std::string inbuf;      // protected by rd_mu; raw bytes not yet processed
+  std::string hsbuf;      // protected by rd_mu; partial handshake messages
+  std::string plain;      // protected by rd_mu; application data
+  std::size_t plain_pos;  // protected by rd_mu
+  TrafficKeys rd;         // protected by rd_mu
+  base::Result rd_error;  // protected by rd_mu; sticky, EOF after close_notify
+  bool handshaking;       // protected by rd_mu
+  bool reading;           // protected by rd_mu
+  std::deque<std::function<void()>> rd_queue;  // protected by rd_mu
+
+  std::mutex wr_mu;
+  TrafficKeys wr;     // protected by wr_mu
+  bool wr_update;     // protected by wr_mu; a KeyUpdate is owed to the peer
+  bool wr_closed;     // protected by wr_mu; close_notify was sent
+
+  TLSState(Conn c, TLSConfig cfg, const Suite* s)
+      : raw(std::move(c)),
+        config(std::move(cfg)),
+        suite(s),
+        ktls_tx(false),
+        plain_pos(0),
+        handshaking(true),
+        reading(false),
+        wr_update(false),
+        wr_closed(false) {}
+
+  // Processes incoming records until |ready| returns true or an error
+  // occurs.  Pumps run one at a time, in the order they were requested.
+  // - |task| MUST be running
+  void pump(event::Task* task, ReadyFn ready, const base::Options& opts);
+  void pump_done();
+
+  // Takes one complete record out of |inbuf| and acts on it.  Sets |*have|
+  // to false if there is no complete record yet.
+  // - |rd_mu| MUST be held
+  base::Result process_record(bool* have);
+  base::Result process_post_handshake();
+
+  // Takes one complete handshake message out of |hsbuf|.
+  // - |rd_mu| MUST be held
+  bool take_message(std::string* out);
+
+  // Sends the bytes appended by |build|.  If |n| is non-null, |*n| is set to
+  // |len| once they are sent.
+  // - |task| MUST be running
+  void send(event::Task* task, std::size_t* n, std::size_t len, BuildFn build,
+            const base::Options& opts);
+
+  // Appends the records holding |len| bytes of application data at |ptr|.
+  // - |wr_mu| MUST be held
+  void seal_data(std::string* out, const char* ptr, std::size_t len);
+
+  // Hands the keys for sending to the kernel.
+  // - |wr_mu| MUST be held
+  bool enable_ktls();
+
+  // Sends a record of type |type| holding |data| through the kernel, for use
+  // with kTLS.  The raw writer is flushed first, so that the record follows
+  // everything written before it.
+  // - |task| MUST be running
+  void ktls_send(event::Task* task, uint8_t type, std::string data,
+                 const base::Options& opts);
+
+  // Makes one attempt to send a record through the kernel.  Returns 0 on
+  // success, or else the errno value.
+  int ktls_sendmsg(uint8_t type, const std::string& data);
+
+  // Sends a fatal alert in the background, for use with kTLS.  Nothing can
+  // be written afterward.
+  // - |wr_mu| MUST be held
+  void ktls_abort(uint8_t desc);
+};
+
+void TLSState::pump(event::Task* task, ReadyFn ready,
+                    const base::Options& opts) {
+  struct Helper {
+    const std::shared_ptr<TLSState> state;
+    event::Task* const task;
+    const ReadyFn ready;
+    const base::Options options;
+    event::Task subtask;
+    std::vector<char> buf;
+    std::size_t n;
+
+    Helper(std::shared_ptr<TLSState> s, event::Task* t, ReadyFn r,
+           base::Options o)
+        : state(std::move(s)),
+          task(t),
+          ready(std::move(r)),
+          options(std::move(o)),
+          buf(kHeaderSize + kMaxCiphertext),
+          n(0) {}
+
+    void run() {
+      while (true) {
+        auto lock = base::acquire_lock(state->rd_mu);
+        base::Result r;
+        if (ready(&r)) {
+          lock.unlock();
+          finish(std::move(r));
+          return;
+        }
+        if (!state->rd_error) {
+          r = state->rd_error;
+          lock.unlock();
+          finish(std::move(r));
+          return;
+        }
+        bool have;
+        r = state->process_record(&have);
+        if (!r) {
+          state->rd_error = std::move(r);
+          continue;
+        }
+        if (have) continue;
+        lock.unlock();
+        if (!task->is_running()) {
+          finish(base::Result::cancelled());
+          return;
+        }
+        break;
+      }
+
+      n = 0;
+      subtask.reset();
+      task->add_subtask(&subtask);
+      state->raw.reader().read(&subtask, buf.data(), &n, 1, buf.size(),
+                               options);
+      subtask.on_finished(event::callback([this] {
+        filled();
+        return base::Result();
+      }));
+    }
+
+    void filled() {
+      base::Result r = subtask.result();
+      auto lock = base::acquire_lock(state->rd_mu);
+      state->inbuf.append(buf.data(), n);
+      if (r.code() == RC::END_OF_FILE) {
+        if (state->inbuf.empty())
+          state->rd_error = base::Result::eof();
+        else
+          state->rd_error = base::Result::data_loss(
+              "TLS: connection closed in the middle of a record");
+      } else if (!r && r.code() != RC::CANCELLED) {
+        state->rd_error = r;
+      }
+      lock.unlock();
+      if (r.code() == RC::CANCELLED) {
+        finish(std::move(r));
+        return;
+      }
+      run();
+    }
+
+    void finish(base::Result r) {
+      auto s = state;
+      task->finish(std::move(r));
+      delete this;
+      s->pump_done();
+    }
+  };
+
+  auto self = shared_from_this();
+  auto* h = new Helper(self, task, std::move(ready), opts);
+  auto lock = base::acquire_lock(rd_mu);
+  if (reading) {
+    rd_queue.push_back([h] { h->run(); });
+    return;
+  }
+  reading = true;
+  lock.unlock();
+  h->run();
+}
+
+void TLSState::pump_done() {
+  auto lock = base::acquire_lock(rd_mu);
+  if (rd_queue.empty()) {
+    reading = false;
+    return;
+  }
+  auto next = std::move(rd_queue.front());
+  rd_queue.pop_front();
+  lock.unlock();
+  next();
+}
+
+base::Result TLSState::process_record(bool* have) {
+  *have = false;
+  if (inbuf.size() < kHeaderSize) return base::Result();
+  const auto* p = reinterpret_cast<const uint8_t*>(inbuf.data());
+  uint8_t outer = p[0];
+  std::size_t len = (std::size_t(p[3]) << 8) | p[4];
+  if (len > kMaxCiphertext)
+    return base::Result::data_loss("TLS: record too large");
+  if (inbuf.size() < kHeaderSize + len) return base::Result();
+  *have = true;
+
+  std::string hdr = inbuf.substr(0, kHeaderSize);
+  std::string body = inbuf.substr(kHeaderSize, len);
+  inbuf.erase(0, kHeaderSize + len);
+
+  // Middlebox compatibility mode (RFC 8446 appendix D.4) sends these in the
+  // clear during the handshake.  They mean nothing.
+  if (outer == kChangeCipherSpec) {
+    if (!handshaking || body != "\x01") return unexpected_message();
+    return base::Result();
+  }
+
+  uint8_t type = outer;
+  std::string data;
+  if (rd) {
+    if (outer != kApplicationData) return unexpected_message();
+    auto r = open_record(&type, &data, &rd, hdr, body);
+    if (!r) return r;
+  } else {
+    if (outer == kApplicationData) return unexpected_message();
+    data = std::move(body);
+  }
+  if (data.size() > kMaxPlaintext)
+    return base::Result::data_loss("TLS: record too large");
+
+  switch (type) {
+    case kApplicationData:
+      if (handshaking) return unexpected_message();
+      if (plain_pos == plain.size()) {
+        plain.clear();
+        plain_pos = 0;
+      }
+      plain.append(data);
+      return base::Result();
+
+    case kHandshake:
+      if (data.empty()) return decode_error();
+      hsbuf.append(data);
+      if (hsbuf.size() >= 4) {
+        std::size_t n = (std::size_t(uint8_t(hsbuf[1])) << 16) |
+                        (std::size_t(uint8_t(hsbuf[2])) << 8) |
+                        uint8_t(hsbuf[3]);
+        if (n > kMaxHandshake)
+          return base::Result::data_loss("TLS: handshake message too large");
+      }
+      if (!handshaking) return process_post_handshake();
+      return base::Result();
+
+    case kAlert:
+      if (data.size() != 2) return decode_error();
+      if (uint8_t(data[1]) == kAlertCloseNotify) return base::Result::eof();
+      return alert_result(uint8_t(data[1]));
+
+    default:
+      return unexpected_message();
+  }
+}
+
+base::Result TLSState::process_post_handshake() {
+  std::string msg;
+  while (take_message(&msg)) {
+    switch (uint8_t(msg[0])) {
+      case kNewSessionTicket:
+        // Tickets are only good for resumption, which isn't supported.
+        break;
+
+      case kKeyUpdate: {
+        if (msg.size() != 5 || uint8_t(msg[4]) > 1) return decode_error();
+        if (!hsbuf.empty()) return unexpected_message();
+        rd.update(*suite);
+        if (msg[4] != 0) {
+          // The kernel can't be handed new keys for sending, so a peer that
+          // insists on a reply can't be satisfied.
+          auto lock = base::acquire_lock(wr_mu);
+          if (ktls_tx) {
+            ktls_abort(kAlertInternalError);
+            return base::Result::not_implemented(
+                "TLS: can't update keys owned by the kernel");
+          }
+          wr_update = true;
+        }
+        break;
+      }
+
+      default:
+        return unexpected_message();
+    }
+  }
+  return base::Result();
+}
+
+bool TLSState::take_message(std::string* out) {
+  if (hsbuf.size() < 4) return false;
+  std::size_t n = (std::size_t(uint8_t(hsbuf[1])) << 16) |
+                  (std::size_t(uint8_t(hsbuf[2])) << 8) | uint8_t(hsbuf[3]);
+  if (hsbuf.size() < 4 + n) return false;
+  out->assign(hsbuf, 0, 4 + n);
+  hsbuf.erase(0, 4 + n);
+  return true;
+}
+
+void TLSState::send(event::Task* task, std::size_t* n, std::size_t len,
+                    BuildFn build, const base::Options& opts) {
+  struct Helper {
+    const std::shared_ptr<TLSState> state;
+    event::Task* const task;
+    std::size_t* const n;
+    const std::size_t len;
+    event::Task subtask;
+    std::string wire;
+    std::size_t written;
+
+    Helper(std::shared_ptr<TLSState> s, event::Task* t, std::size_t* n,
+           std::size_t len) noexcept : state(std::move(s)),
+                                       task(t),
+                                       n(n),
+                                       len(len),
+                                       written(0) {}
+
+    void done() {
+      if (n && subtask.result()) *n = len;
+      event::propagate_result(task, &subtask);
+      delete this;
+    }
+  };
+
+  auto* h = new Helper(shared_from_this(), task, n, len);
+  auto lock = base::acquire_lock(wr_mu);
+  auto r = build(&h->wire);
+  if (!r) {
+    lock.unlock();
+    task->finish(std::move(r));
+    delete h;
+    return;
+  }
+  // Records MUST reach the socket in sequence number order, so the write is
+  // queued before the lock is released.
+  task->add_subtask(&h->subtask);
+  raw.writer().write(&h->subtask, &h->written, h->wire.data(), h->wire.size(),
+                     opts);
+  lock.unlock();
+  h->subtask.on_finished(event::callback([h] {
+    h->done();
+    return base::Result();
+  }));
+}
+
+void TLSState::seal_data(std::string* out, const char* ptr, std::size_t len) {
+  if (wr_update) {
+    std::string msg;
+    put_message(&msg, kKeyUpdate, std::string(1, '\0'));
+    seal_record(out, &wr, kHandshake, msg.data(), msg.size());
+    wr.update(*suite);
+    wr_update = false;
+  }
+  out->reserve(out->size() + len + (len / kMaxPlaintext + 1) *
+                                        (kHeaderSize + 1 + kTagSize));
+  while (len > 0) {
+    std::size_t chunk = std::min(len, kMaxPlaintext);
+    seal_record(out, &wr, kApplicationData, ptr, chunk);
+    ptr += chunk;
+    len -= chunk;
+  }
+}
+
+bool TLSState::enable_ktls() {
+#if HAVE_KTLS
+  base::FD fd = raw.writer().implementation()->internal_writerfd();
+  if (!fd) return false;
+
+  union {
+    tls12_crypto_info_aes_gcm_128 aes128;
+    tls12_crypto_info_aes_gcm_256 aes256;
+  } info;
+  ::bzero(&info, sizeof(info));
+  socklen_t len;
+  uint8_t seq[8];
+  for (std::size_t i = 0; i < 8; ++i) seq[i] = uint8_t(wr.seq >> (56 - 8 * i));
+
+  // The kernel splits the 12-byte IV into a 4-byte salt and an 8-byte IV.
+  if (suite->id == TLSCipherSuite::aes_128_gcm_sha256) {
+    auto& x = info.aes128;
+    x.info.version = TLS_1_3_VERSION;
+    x.info.cipher_type = TLS_CIPHER_AES_GCM_128;
+    ::memcpy(x.key, wr.key.data(), sizeof(x.key));
+    ::memcpy(x.salt, wr.iv.data(), sizeof(x.salt));
+    ::memcpy(x.iv, wr.iv.data() + sizeof(x.salt), sizeof(x.iv));
+    ::memcpy(x.rec_seq, seq, sizeof(x.rec_seq));
+    len = sizeof(x);
+  } else {
+    auto& x = info.aes256;
+    x.info.version = TLS_1_3_VERSION;
+    x.info.cipher_type = TLS_CIPHER_AES_GCM_256;
+    ::memcpy(x.key, wr.key.data(), sizeof(x.key));
+    ::memcpy(x.salt, wr.iv.data(), sizeof(x.salt));
+    ::memcpy(x.iv, wr.iv.data() + sizeof(x.salt), sizeof(x.iv));
+    ::memcpy(x.rec_seq, seq, sizeof(x.rec_seq));
+    len = sizeof(x);
+  }
+
+  auto pair = fd->acquire_fd();
+  int rc = ::setsockopt(pair.first, SOL_TCP, TCP_ULP, "tls", sizeof("tls"));
+  if (rc == 0) rc = ::setsockopt(pair.first, SOL_TLS, TLS_TX, &info, len);
+  int err_no = errno;
+  ::explicit_bzero(&info, sizeof(info));
+  if (rc != 0) {
+    VLOG(1) << "net::TLS: kTLS unavailable, staying in userspace: "
+            << base::Result::from_errno(err_no, "setsockopt(2)");
+    return false;
+  }
+  return true;
+#else
+  return false;
+#endif
+}
+
+void TLSState::ktls_send(event::Task* task, uint8_t type, std::string data,
+                         const base::Options& opts) {
+  struct Helper : public std::enable_shared_from_this<Helper> {
+    const std::shared_ptr<TLSState> state;
+    event::Task* const task;
+    const uint8_t type;
+    const std::string data;
+    const base::Options options;
+    event::Task subtask;
+    std::mutex mu;
+    event::Handle evt;  // protected by mu
+    bool done;          // protected by mu
+
+    Helper(std::shared_ptr<TLSState> s, event::Task* t, uint8_t type,
+           std::string d, base::Options o) noexcept : state(std::move(s)),
+                                                      task(t),
+                                                      type(type),
+                                                      data(std::move(d)),
+                                                      options(std::move(o)),
+                                                      done(false) {}
+
+    void flushed() {
+      base::Result r = subtask.result();
+      if (!r) {
+        auto lock = base::acquire_lock(mu);
+        finish(lock, std::move(r));
+        return;
+      }
+      try_send();
+    }
+
+    // Called again each time the socket becomes writable.
+    base::Result try_send() {
+      auto lock = base::acquire_lock(mu);
+      if (done) return base::Result();
+      int err_no = state->ktls_sendmsg(type, data);
+      if (err_no != EAGAIN && err_no != EWOULDBLOCK) {
+        base::Result r;
+        if (err_no != 0) r = base::Result::from_errno(err_no, "sendmsg(2)");
+        finish(lock, std::move(r));
+        return base::Result();
+      }
+      if (!evt) {
+        auto fd = state->raw.writer().implementation()->internal_writerfd();
+        auto self = shared_from_this();
+        auto closure = [self](event::Data) { return self->try_send(); };
+        auto r = io::get_manager(options).fd(&evt, std::move(fd),
+                                             event::Set::writable_bit(),
+                                             event::handler(closure));
+        if (!r) finish(lock, std::move(r));
+      }
+      return base::Result();
+    }
+
+    void finish(base::Lock& lock, base::Result r) {
+      done = true;
+      event::Handle h = std::move(evt);
+      lock.unlock();
+      if (h) {
+        h.disable().ignore_ok();
+        h.disown();
+      }
+      task->finish(std::move(r));
+    }
+  };
+
+  auto h = std::make_shared<Helper>(shared_from_this(), task, type,
+                                    std::move(data), opts);
+  task->add_subtask(&h->subtask);
+  raw.writer().flush(&h->subtask, opts);
+  h->subtask.on_finished(event::callback([h] {
+    h->flushed();
+    return base::Result();
+  }));
+}
+
+int TLSState::ktls_sendmsg(uint8_t type, const std::string& data) {
+#if HAVE_KTLS
+  base::FD fd = raw.writer().implementation()->internal_writerfd();
+  char control[CMSG_SPACE(sizeof(uint8_t))];
+  ::bzero(control, sizeof(control));
+
+  struct iovec iov;
+  iov.iov_base = const_cast<char*>(data.data());
+  iov.iov_len = data.size();
+
+  struct msghdr msg;
+  ::bzero(&msg, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+
+  struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_TLS;
+  cmsg->cmsg_type = TLS_SET_RECORD_TYPE;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(uint8_t));
+  *CMSG_DATA(cmsg) = type;
+
+  auto pair = fd->acquire_fd();
+  ssize_t n;
+  do {
+    n = ::sendmsg(pair.first, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+  } while (n < 0 && errno == EINTR);
+  if (n < 0) return errno;
+  return 0;
+#else
+  return ENOSYS;
+#endif
+}
+
+void TLSState::ktls_abort(uint8_t desc) {
+  struct Helper {
+    event::Task task;
+  };
+
+  if (wr_closed) return;
+  wr_closed = true;
+  auto* h = new Helper;
+  CHECK(h->task.start());
+  const char alert[2] = {2, char(desc)};  // fatal
+  ktls_send(&h->task, kAlert, std::string(alert, sizeof(alert)),
+            base::default_options());
+  h->task.on_finished(event::callback([h] {
+    if (!h->task.result()) VLOG(1) << "net::TLS: alert: " << h->task.result();
+    delete h;
+    return base::Result();
+  }));
+}
+
+class TLSReader : public io::ReaderImpl {
+ public:
+  explicit TLSReader(std::shared_ptr<TLSState> s) noexcept
+      : state_(std::move(s)) {}
+
+  std::size_t ideal_block_size() const noexcept override {
+    return kMaxPlaintext;
+  }
+
+  void read(event::Task* task, char* out, std::size_t* n, std::size_t min,
+            std::size_t max, const base::Options& opts) override {
+    if (!prologue(task, out, n, min, max)) return;
+    if (max == 0) {
+      task->finish_ok();
+      return;
+    }
+    TLSState* s = state_.get();
+    state_->pump(task, [s, out, n, min, max](base::Result* r) {
+      std::size_t k = std::min(max - *n, s->plain.size() - s->plain_pos);
+      ::memcpy(out + *n, s->plain.data() + s->plain_pos, k);
+      s->plain_pos += k;
+      *n += k;
+      if (*n > 0 && *n >= min) return true;
+      if (s->rd_error.code() == RC::END_OF_FILE && *n >= min) return true;
+      return false;
+    }, opts);
+  }
+
+  void close(event::Task* task, const base::Options& opts) override {
+    if (!prologue(task)) return;
+    io::Reader r = state_->raw.reader();
+    chain(task, [r, opts](event::Task* subtask) { r.close(subtask, opts); });
+  }
+
+ private:
+  const std::shared_ptr<TLSState> state_;
+};
+
+class TLSWriter : public io::WriterImpl {
+ public:
+  explicit TLSWriter(std::shared_ptr<TLSState> s) noexcept
+      : state_(std::move(s)) {}
+
+  std::size_t ideal_block_size() const noexcept override {
+    return kMaxPlaintext;
+  }
+
+  void write(event::Task* task, std::size_t* n, const char* ptr,
+             std::size_t len, const base::Options& opts) override {
+    if (!prologue(task, n, ptr, len)) return;
+    if (state_->ktls_tx) {
+      if (ktls_closed(task)) return;
+      io::Writer w = state_->raw.writer();
+      chain(task, [w, n, ptr, len, opts](event::Task* subtask) {
+        w.write(subtask, n, ptr, len, opts);
+      });
+      return;
+    }
+    TLSState* s = state_.get();
+    state_->send(task, n, len, [s, ptr, len](std::string* wire) {
+      if (s->wr_closed)
+        return base::Result::failed_precondition("TLS: writer is closed");
+      s->seal_data(wire, ptr, len);
+      return base::Result();
+    }, opts);
+  }
+
+  void read_from(event::Task* task, std::size_t* n, std::size_t max,
+                 const io::Reader& r, const base::Options& opts) override {
+    // Only the kernel can encrypt what sendfile(2) and splice(2) move.
+    if (!state_->ktls_tx) {
+      io::WriterImpl::read_from(task, n, max, r, opts);
+      return;
+    }
+    if (!prologue(task, n, max, r)) return;
+    if (ktls_closed(task)) return;
+    io::Writer w = state_->raw.writer();
+    chain(task, [w, n, max, r, opts](event::Task* subtask) {
+      w.read_from(subtask, n, max, r, opts);
+    });
+  }
+
+  void close(event::Task* task, const base::Options& opts) override;
+
+  base::FD internal_writerfd() const override {
+    if (!state_->ktls_tx) return nullptr;
+    return state_->raw.writer().implementation()->internal_writerfd();
+  }
+
+ private:
+  // Fails |task| if an alert has already been sent through the kernel.
+  bool ktls_closed(event::Task* task) {
+    auto lock = base::acquire_lock(state_->wr_mu);
+    if (!state_->wr_closed) return false;
+    lock.unlock();
+    task->finish(base::Result::failed_precondition("TLS: writer is closed"));
+    return true;
+  }
+
+  const std::shared_ptr<TLSState> state_;
+};
+
+void TLSWriter::close(event::Task* task, const base::Options& opts) {
+  struct Helper {
+    const std::shared_ptr<TLSState> state;
+    event::Task* const task;
+    const base::Options options;
+    event::Task subtask;
+
+    Helper(std::shared_ptr<TLSState> s, event::Task* t,
+           base::Options o) noexcept : state(std::move(s)),
+                                       task(t),
+                                       options(std::move(o)) {}
+
+    void alert_sent() {
+      // Half-close even if close_notify couldn't be sent.
+      subtask.reset();
+      task->add_subtask(&subtask);
+      state->raw.writer().close(&subtask, options);
+      subtask.on_finished(event::callback([this] {
+        event::propagate_result(task, &subtask);
+        delete this;
+        return base::Result();
+      }));
+    }
+  };
+
+  if (!prologue(task)) return;
+  auto* h = new Helper(state_, task, opts);
+
+  TLSState* s = state_.get();
+  task->add_subtask(&h->subtask);
+  if (state_->ktls_tx) {
+    auto lock = base::acquire_lock(state_->wr_mu);
+    bool closed = state_->wr_closed;
+    state_->wr_closed = true;
+    lock.unlock();
+    if (closed) {
+      if (h->subtask.start()) h->subtask.finish_ok();
+    } else if (h->subtask.start()) {
+      const char alert[2] = {1, char(kAlertCloseNotify)};  // warning
+      state_->ktls_send(&h->subtask, kAlert, std::string(alert, sizeof(alert)),
+                        opts);
+    }
+  } else if (h->subtask.start()) {
+    state_->send(&h->subtask, nullptr, 0, [s](std::string* wire) {
+      if (s->wr_closed) return base::Result();
+      s->wr_closed = true;
+      const char alert[2] = {1, char(kAlertCloseNotify)};  // warning
+      seal_record(wire, &s->wr, kAlert, alert, sizeof(alert));
+      return base::Result();
+    }, opts);
+  }
+  h->subtask.on_finished(event::callback([h] {
+    h->alert_sent();
+    return base::Result();
+  }));
+}
+
+class TLSConnImpl : public ConnImpl {
+ public:
+  explicit TLSConnImpl(std::shared_ptr<TLSState> s)
+      : state_(s),
+        r_(std::make_shared<TLSReader>(s)),
+        w_(std::make_shared<TLSWriter>(s)) {}
+
+  const TLSState& state() const noexcept { return *state_; }
+
+  Addr local_addr() const override { return state_->raw.local_addr(); }
+  Addr remote_addr() const override { return state_->raw.remote_addr(); }
+  io::Reader reader() override { return r_; }
+  io::Writer writer() override { return w_; }
+
+  void close(event::Task* task, const base::Options& opts) override;
+
+  void get_option(event::Task* task, SockOpt opt, void* optval,
+                  unsigned int* optlen,
+                  const base::Options& opts) const override {
+    state_->raw.get_option(task, opt, optval, optlen, opts);
+  }
+
+  void set_option(event::Task* task, SockOpt opt, const void* optval,
+                  unsigned int optlen, const base::Options& opts) override {
+    state_->raw.set_option(task, opt, optval, optlen, opts);
+  }
+
+ private:
+  const std::shared_ptr<TLSState> state_;
+  const io::Reader r_;
+  const io::Writer w_;
+};
+
+void TLSConnImpl::close(event::Task* task, const base::Options& opts) {
+  struct Helper {
+    const Conn raw;
+    event::Task* const task;
+    const base::Options options;
+    event::Task subtask;
+
+    Helper(Conn c, event::Task* t, base::Options o) noexcept
+        : raw(std::move(c)),
+          task(t),
+          options(std::move(o)) {}
+
+    void writer_closed() {
+      subtask.reset();
+      task->add_subtask(&subtask);
+      raw.close(&subtask, options);
+      subtask.on_finished(event::callback([this] {
+        event::propagate_result(task, &subtask);
+        delete this;
+        return base::Result();
+      }));
+    }
+  };
+
+  if (!task->start()) return;
+  auto* h = new Helper(state_->raw, task, opts);
+  task->add_subtask(&h->subtask);
+  w_.close(&h->subtask, opts);
+  h->subtask.on_finished(event::callback([h] {
+    h->writer_closed();
+    return base::Result();
+  }));
+}
+
+// Handshake drives one side of the handshake, then hands the TLSState to a
+// new TLSConnImpl.
+class Handshake {
+ public:
+  Handshake(std::shared_ptr<TLSState> s, event::Task* t, Conn* o,
+            bool is_server, base::Options opts)
+      : state_(std::move(s)),
+        task_(t),
+        out_(o),
+        is_server_(is_server),
+        options_(std::move(opts)),
+        step_(Step::start) {
+    const Suite& suite = *state_->suite;
+    std::string zeroes(suite.hash_size, '\0');
+    early_ = extract(suite, zeroes, state_->config.psk);
+  }
+
+  void start() {
+    base::Result r;
+    if (is_server_)
+      read_message(Step::client_hello);
+    else if (!(r = send_client_hello()))
+      fail(std::move(r));
+  }
+
+ private:
+  enum class Step : uint8_t {
+    start,
+    client_hello_sent,
+    server_hello,
+    encrypted_extensions,
+    server_finished,
+    client_finished_sent,
+    client_hello,
+    server_flight_sent,
+    client_finished,
+    alert_sent,
+  };
+
+  void read_message(Step step);
+  void send(Step step, std::string wire);
+  void next();
+  // Tells the peer why the handshake failed, if it's the peer's fault, then
+  // finishes |task_| with |r|.
+  void fail(base::Result r);
+  void succeed();
+
+  base::Result send_client_hello();
+  base::Result on_server_hello();
+  base::Result on_encrypted_extensions();
+  base::Result on_server_finished();
+  base::Result on_client_hello();
+  base::Result on_client_finished();
+
+  // Derives the handshake traffic secrets from the transcript so far.
+  void derive_handshake_secrets();
+
+  // Derives the application traffic secrets from the transcript so far.
+  void derive_application_secrets();
+
+  // Replaces the keys for reading.  Fails if a handshake message straddles
+  // the change.
+  base::Result set_read_keys(const std::string& secret);
+
+  const std::shared_ptr<TLSState> state_;
+  event::Task* const task_;
+  Conn* const out_;
+  const bool is_server_;
+  const base::Options options_;
+  event::Task subtask_;
+  Step step_;
+  base::Result error_;
+  std::string msg_;
+  std::string transcript_;
+  std::string session_id_;
+  std::string early_;
+  std::string handshake_;
+  std::string client_hs_;
+  std::string server_hs_;
+  std::string client_ap_;
+  std::string server_ap_;
+};
+
+void Handshake::read_message(Step step) {
+  step_ = step;
+  msg_.clear();
+  subtask_.reset();
+  task_->add_subtask(&subtask_);
+  if (subtask_.start()) {
+    TLSState* s = state_.get();
+    std::string* msg = &msg_;
+    state_->pump(&subtask_, [s, msg](base::Result* r) {
+      return s->take_message(msg);
+    }, options_);
+  }
+  subtask_.on_finished(event::callback([this] {
+    next();
+    return base::Result();
+  }));
+}
+
+void Handshake::send(Step step, std::string wire) {
+  step_ = step;
+  subtask_.reset();
+  task_->add_subtask(&subtask_);
+  if (subtask_.start()) {
+    auto shared = std::make_shared<std::string>(std::move(wire));
+    state_->send(&subtask_, nullptr, 0, [shared](std::string* out) {
+      out->append(*shared);
+      return base::Result();
+    }, options_);
+  }
+  subtask_.on_finished(event::callback([this] {
+    next();
+    return base::Result();
+  }));
+}
+
+void Handshake::next() {
+  if (step_ == Step::alert_sent) {
+    task_->finish(std::move(error_));
+    delete this;
+    return;
+  }
+
+  base::Result r = subtask_.result();
+  if (!r) {
+    fail(std::move(r));
+    return;
+  }
+
+  switch (step_) {
+    case Step::client_hello_sent:
+      read_message(Step::server_hello);
+      return;
+
+    case Step::server_hello:
+      r = on_server_hello();
+      if (r) read_message(Step::encrypted_extensions);
+      break;
+
+    case Step::encrypted_extensions:
+      r = on_encrypted_extensions();
+      if (r) read_message(Step::server_finished);
+      break;
+
+    case Step::server_finished:
+      r = on_server_finished();
+      break;
+
+    case Step::client_finished_sent:
+      succeed();
+      return;
+
+    case Step::client_hello:
+      r = on_client_hello();
+      break;
+
+    case Step::server_flight_sent:
+      read_message(Step::client_finished);
+      return;
+
+    case Step::client_finished:
+      r = on_client_finished();
+      if (r) succeed();
+      break;
+
+    default:
+      LOG(DFATAL) << "BUG! net::TLS: unexpected handshake step";
+      r = base::Result::internal("BUG! bad handshake step");
+  }
+  if (!r) fail(std::move(r));
+}
+
+void Handshake::fail(base::Result r) {
+  VLOG(1) << "net::TLS: handshake failed: " << r;
+  uint8_t desc;
+  switch (r.code()) {
+    case RC::UNAUTHENTICATED:
+      desc = kAlertDecryptError;
+      break;
+    case RC::FAILED_PRECONDITION:
+      desc = kAlertHandshakeFailure;
+      break;
+    case RC::DATA_LOSS:
+      desc = kAlertDecodeError;
+      break;
+    default:
+      task_->finish(std::move(r));
+      delete this;
+      return;
+  }
+
+  error_ = std::move(r);
+  const char alert[2] = {2, char(desc)};  // fatal
+  std::string wire;
+  auto lock = base::acquire_lock(state_->wr_mu);
+  seal_record(&wire, &state_->wr, kAlert, alert, sizeof(alert));
+  lock.unlock();
+  send(Step::alert_sent, std::move(wire));
+}
+
+void Handshake::succeed() {
+  auto lock = base::acquire_lock(state_->rd_mu);
+  state_->handshaking = false;
+  lock.unlock();
+
+  if (state_->config.ktls) {
+    auto lock = base::acquire_lock(state_->wr_mu);
+    state_->ktls_tx = state_->enable_ktls();
+  }
+
+  *out_ = Conn(std::make_shared<TLSConnImpl>(state_));
+  task_->finish_ok();
+  delete this;
+}
+
+void Handshake::derive_handshake_secrets() {
+  const Suite& suite = *state_->suite;
+  std::string zeroes(suite.hash_size, '\0');
+  std::string salt = derive_secret(suite, early_, "derived", "");
+  handshake_ = extract(suite, salt, zeroes);
+  client_hs_ = derive_secret(suite, handshake_, "c hs traffic", transcript_);
+  server_hs_ = derive_secret(suite, handshake_, "s hs traffic", transcript_);
+}
+
+void Handshake::derive_application_secrets() {
+  const Suite& suite = *state_->suite;
+  std::string zeroes(suite.hash_size, '\0');
+  std::string salt = derive_secret(suite, handshake_, "derived", "");
+  std::string master = extract(suite, salt, zeroes);
+  client_ap_ = derive_secret(suite, master, "c ap traffic", transcript_);
+  server_ap_ = derive_secret(suite, master, "s ap traffic", transcript_);
+}
+
+base::Result Handshake::set_read_keys(const std::string& secret) {
+  auto lock = base::acquire_lock(state_->rd_mu);
+  if (!state_->hsbuf.empty()) return unexpected_message();
+  state_->rd.set(*state_->suite, secret);
+  return base::Result();
+}
+
+base::Result Handshake::send_client_hello() {
+  const Suite& suite = *state_->suite;
+  const TLSConfig& config = state_->config;
+
+  std::string random;
+  random_bytes(&random, 32);
+  random_bytes(&session_id_, 32);
+
+  std::string exts, ext;
+  if (!config.server_name.empty()) {
+    std::string list;
+    put8(&list, 0);  // host_name
+    put16(&list, config.server_name.size());
+    list.append(config.server_name);
+    put16(&ext, list.size());
+    ext.append(list);
+    put_extension(&exts, kExtServerName, ext);
+  }
+
+  ext.clear();
+  put8(&ext, 2);
+  put16(&ext, kVersionTLS13);
+  put_extension(&exts, kExtSupportedVersions, ext);
+
+  ext.clear();
+  put8(&ext, 1);
+  put8(&ext, kModePSKKE);
+  put_extension(&exts, kExtPSKKeyExchangeModes, ext);
+
+  // pre_shared_key MUST come last, as its binder covers everything before.
+  std::string identities;
+  put16(&identities, config.psk_identity.size());
+  identities.append(config.psk_identity);
+  identities.append(4, '\0');  // obfuscated_ticket_age
+  std::size_t binders_size = 2 + 1 + suite.hash_size;
+  put16(&exts, kExtPreSharedKey);
+  put16(&exts, 2 + identities.size() + binders_size);
+  put16(&exts, identities.size());
+  exts.append(identities);
+
+  std::string body;
+  put16(&body, kLegacyVersion);
+  body.append(random);
+  put8(&body, session_id_.size());
+  body.append(session_id_);
+  put16(&body, 2);
+  put16(&body, static_cast<uint16_t>(suite.id));
+  put8(&body, 1);
+  put8(&body, 0);  // null compression
+  put16(&body, exts.size() + binders_size);
+  body.append(exts);
+
+  // The binder is a MAC over the ClientHello up to, but not including, the
+  // binders themselves.
+  std::string hello;
+  put8(&hello, kClientHello);
+  put24(&hello, body.size() + binders_size);
+  hello.append(body);
+  std::string binder_key = derive_secret(suite, early_, "ext binder", "");
+  std::string binder = finished_mac(suite, binder_key, hello);
+  put16(&hello, 1 + binder.size());
+  put8(&hello, binder.size());
+  hello.append(binder);
+  transcript_.append(hello);
+
+  std::string wire;
+  TrafficKeys clear;
+  seal_record(&wire, &clear, kHandshake, hello.data(), hello.size());
+  send(Step::client_hello_sent, std::move(wire));
+  return base::Result();
+}
+
+base::Result Handshake::on_server_hello() {
+  const Suite& suite = *state_->suite;
+  Cursor c(msg_);
+  if (c.u8() != kServerHello) return unexpected_message();
+  c.u24();
+  c.u16();  // legacy_version
+  std::string random = c.bytes(32);
+  std::string session_id = c.vec8();
+  uint16_t cipher_suite = c.u16();
+  uint8_t compression = c.u8();
+  Cursor exts = c.sub16();
+  if (!c.ok() || !c.done()) return decode_error();
+
+  if (random == std::string(reinterpret_cast<const char*>(kHelloRetryRandom),
+                            sizeof(kHelloRetryRandom))) {
+    return base::Result::failed_precondition(
+        "TLS: server wants a key exchange, which isn't supported");
+  }
+  if (session_id != session_id_ || compression != 0 ||
+      cipher_suite != static_cast<uint16_t>(suite.id)) {
+    return base::Result::data_loss("TLS: ServerHello doesn't match");
+  }
+
+  uint16_t version = 0;
+  bool have_psk = false;
+  while (exts.ok() && !exts.done()) {
+    uint16_t type = exts.u16();
+    Cursor data = exts.sub16();
+    switch (type) {
+      case kExtSupportedVersions:
+        version = data.u16();
+        break;
+      case kExtPreSharedKey:
+        have_psk = (data.u16() == 0);
+        break;
+      case kExtKeyShare:
+        return base::Result::failed_precondition(
+            "TLS: server wants a key exchange, which isn't supported");
+      default:
+        return base::Result::data_loss("TLS: unsolicited extension ", type);
+    }
+    if (!data.ok() || !data.done()) return decode_error();
+  }
+  if (!exts.ok()) return decode_error();
+  if (version != kVersionTLS13)
+    return base::Result::failed_precondition("TLS: server lacks TLS 1.3");
+  if (!have_psk)
+    return base::Result::unauthenticated("TLS: server rejected the PSK");
+
+  transcript_.append(msg_);
+  derive_handshake_secrets();
+  return set_read_keys(server_hs_);
+}
+
+base::Result Handshake::on_encrypted_extensions() {
+  Cursor c(msg_);
+  if (c.u8() != kEncryptedExtensions) return unexpected_message();
+  c.u24();
+  Cursor exts = c.sub16();
+  if (!c.ok() || !c.done()) return decode_error();
+  while (exts.ok() && !exts.done()) {
+    exts.u16();
+    exts.vec16();
+  }
+  if (!exts.ok()) return decode_error();
+  transcript_.append(msg_);
+  return base::Result();
+}
+
+base::Result Handshake::on_server_finished() {
+  const Suite& suite = *state_->suite;
+  uint8_t type = uint8_t(msg_[0]);
+  if (type == kCertificate || type == kCertificateRequest) {
+    return base::Result::failed_precondition(
+        "TLS: certificates aren't supported");
+  }
+  if (type != kFinished) return unexpected_message();
+
+  std::string want = finished_mac(suite, server_hs_, transcript_);
+  if (msg_.size() != 4 + want.size() ||
+      !crypto::subtle::consttime_eq(
+          reinterpret_cast<const uint8_t*>(msg_.data() + 4),
+          reinterpret_cast<const uint8_t*>(want.data()), want.size())) {
+    return base::Result::data_loss("TLS: server Finished doesn't verify");
+  }
+  transcript_.append(msg_);
+  derive_application_secrets();
+
+  std::string fin;
+  put_message(&fin, kFinished, finished_mac(suite, client_hs_, transcript_));
+  transcript_.append(fin);
+
+  auto r = set_read_keys(server_ap_);
+  if (!r) return r;
+
+  std::string wire;
+  TrafficKeys keys;
+  const char ccs = 1;
+  seal_record(&wire, &keys, kChangeCipherSpec, &ccs, 1);
+  keys.set(suite, client_hs_);
+  seal_record(&wire, &keys, kHandshake, fin.data(), fin.size());
+
+  auto lock = base::acquire_lock(state_->wr_mu);
+  state_->wr.set(suite, client_ap_);
+  lock.unlock();
+
+  send(Step::client_finished_sent, std::move(wire));
+  return base::Result();
+}
+
+base::Result Handshake::on_client_hello() {
+  const Suite& suite = *state_->suite;
+  const TLSConfig& config = state_->config;
+
+  Cursor c(msg_);
+  if (c.u8() != kClientHello) return unexpected_message();
+  c.u24();
+  c.u16();  // legacy_version
+  c.bytes(32);
+  session_id_ = c.vec8();
+  Cursor suites = c.sub16();
+  std::string compression = c.vec8();
+  Cursor exts = c.sub16();
+  if (!c.ok() || !c.done() || session_id_.size() > 32) return decode_error();
+  if (compression != std::string(1, '\0')) return decode_error();
+
+  bool have_suite = false;
+  while (suites.ok() && !suites.done()) {
+    if (suites.u16() == static_cast<uint16_t>(suite.id)) have_suite = true;
+  }
+
+  bool have_version = false;
+  bool have_mode = false;
+  bool have_psk = false;
+  int index = -1;
+  std::string binder;
+  std::size_t binders_pos = 0;
+  while (exts.ok() && !exts.done()) {
+    if (have_psk) return base::Result::data_loss("TLS: misplaced PSK");
+    uint16_t type = exts.u16();
+    Cursor data = exts.sub16();
+    switch (type) {
+      case kExtServerName: {
+        Cursor list = data.sub16();
+        while (list.ok() && !list.done()) {
+          uint8_t name_type = list.u8();
+          std::string name = list.vec16();
+          if (name_type == 0) state_->server_name = name;
+        }
+        if (!list.ok()) return decode_error();
+        break;
+      }
+
+      case kExtSupportedVersions: {
+        Cursor list = data.sub8();
+        while (list.ok() && !list.done()) {
+          if (list.u16() == kVersionTLS13) have_version = true;
+        }
+        if (!list.ok()) return decode_error();
+        break;
+      }
+
+      case kExtPSKKeyExchangeModes: {
+        Cursor list = data.sub8();
+        while (list.ok() && !list.done()) {
+          if (list.u8() == kModePSKKE) have_mode = true;
+        }
+        if (!list.ok()) return decode_error();
+        break;
+      }
+
+      case kExtPreSharedKey: {
+        have_psk = true;
+        Cursor ids = data.sub16();
+        for (int i = 0; ids.ok() && !ids.done(); ++i) {
+          std::string id = ids.vec16();
+          ids.u32();  // obfuscated_ticket_age
+          if (index < 0 && id == config.psk_identity) index = i;
+        }
+        binders_pos = data.pos();
+        Cursor binders = data.sub16();
+        for (int i = 0; binders.ok() && !binders.done(); ++i) {
+          std::string b = binders.vec8();
+          if (i == index) binder = b;
+        }
+        if (!ids.ok() || !binders.ok()) return decode_error();
+        break;
+      }
+
+      default:
+        // Ignore extensions this end doesn't implement.
+        while (data.ok() && !data.done()) data.u8();
+    }
+    if (!data.ok() || !data.done()) return decode_error();
+  }
+  if (!exts.ok()) return decode_error();
+
+  if (!have_version)
+    return base::Result::failed_precondition("TLS: client lacks TLS 1.3");
+  if (!have_suite)
+    return base::Result::failed_precondition("TLS: no shared cipher suite");
+  if (!have_mode) {
+    return base::Result::failed_precondition(
+        "TLS: client wants a key exchange, which isn't supported");
+  }
+  if (index < 0)
+    return base::Result::unauthenticated("TLS: client doesn't know the PSK");
+
+  std::string binder_key = derive_secret(suite, early_, "ext binder", "");
+  std::string want =
+      finished_mac(suite, binder_key, msg_.substr(0, binders_pos));
+  if (binder.size() != want.size() ||
+      !crypto::subtle::consttime_eq(
+          reinterpret_cast<const uint8_t*>(binder.data()),
+          reinterpret_cast<const uint8_t*>(want.data()), want.size())) {
+    return base::Result::unauthenticated("TLS: client has a different PSK");
+  }
+  transcript_.append(msg_);
+
+  std::string random;
+  random_bytes(&random, 32);
+
+  std::string exts_out, ext;
+  put16(&ext, kVersionTLS13);
+  put_extension(&exts_out, kExtSupportedVersions, ext);
+  ext.clear();
+  put16(&ext, index);
+  put_extension(&exts_out, kExtPreSharedKey, ext);
+
+  std::string body;
+  put16(&body, kLegacyVersion);
+  body.append(random);
+  put8(&body, session_id_.size());
+  body.append(session_id_);
+  put16(&body, static_cast<uint16_t>(suite.id));
+  put8(&body, 0);  // null compression
+  put16(&body, exts_out.size());
+  body.append(exts_out);
+
+  std::string hello;
+  put_message(&hello, kServerHello, body);
+  transcript_.append(hello);
+  derive_handshake_secrets();
+
+  std::string ee;
+  put_message(&ee, kEncryptedExtensions, std::string(2, '\0'));
+  transcript_.append(ee);
+
+  std::string fin;
+  put_message(&fin, kFinished, finished_mac(suite, server_hs_, transcript_));
+  transcript_.append(fin);
+  derive_application_secrets();
+
+  auto r = set_read_keys(client_hs_);
+  if (!r) return r;
+
+  std::string wire;
+  TrafficKeys keys;
+  seal_record(&wire, &keys, kHandshake, hello.data(), hello.size());
+  if (!session_id_.empty()) {
+    const char ccs = 1;
+    seal_record(&wire, &keys, kChangeCipherSpec, &ccs, 1);
+  }
+  keys.set(suite, server_hs_);
+  std::string flight = ee + fin;
+  seal_record(&wire, &keys, kHandshake, flight.data(), flight.size());
+
+  auto lock = base::acquire_lock(state_->wr_mu);
+  state_->wr.set(suite, server_ap_);
+  lock.unlock();
+
+  send(Step::server_flight_sent, std::move(wire));
+  return base::Result();
+}
+
+base::Result Handshake::on_client_finished() {
+  const Suite& suite = *state_->suite;
+  if (uint8_t(msg_[0]) != kFinished) return unexpected_message();
+
+  std::string want = finished_mac(suite, client_hs_, transcript_);
+  if (msg_.size() != 4 + want.size() ||
+      !crypto::subtle::consttime_eq(
+          reinterpret_cast<const uint8_t*>(msg_.data() + 4),
+          reinterpret_cast<const uint8_t*>(want.data()), want.size())) {
+    return base::Result::data_loss("TLS: client Finished doesn't verify");
+  }
+  transcript_.append(msg_);
+  return set_read_keys(client_ap_);
+}
+
+void handshake(event::Task* task, Conn* out, Conn raw, const TLSConfig& config,
+               bool is_server, const base::Options& opts) {
+  CHECK_NOTNULL(out);
+  CHECK(raw);
+  if (!task->start()) return;
+
+  const Suite* suite = find_suite(static_cast<uint16_t>(config.cipher_suite));
+  if (!suite) {
+    task->finish(base::Result::invalid_argument("TLS: unknown cipher suite"));
+    return;
+  }
+  if (config.psk.empty() || config.psk_identity.empty() ||
+      config.psk_identity.size() > 0xffff) {
+    task->finish(base::Result::invalid_argument("TLS: PSK is required"));
+    return;
+  }
+
+  auto state = std::make_shared<TLSState>(std::move(raw), config, suite);
+  auto* h = new Handshake(std::move(state), task, out, is_server, opts);
+  h->start();
+}
+
+}  // anonymous namespace
+
+void tls_client(event::Task* task, Conn* out, Conn raw,
+                const TLSConfig& config, const base::Options& opts) {
+  handshake(task, out, std::move(raw), config, false, opts);
+}
+
+void tls_server(event::Task* task, Conn* out, Conn raw,
+                const TLSConfig& config, const base::Options& opts) {
+  handshake(task, out, std::move(raw), config, true, opts);
+}
+
+base::Result tls_client(Conn* out, Conn raw, const TLSConfig& config,
+                        const base::Options& opts) {
+  event::Task task;
+  tls_client(&task, out, std::move(raw), config, opts);
+  event::wait(io::get_manager(opts), &task);
+  return task.result();
+}
+
+base::Result tls_server(Conn* out, Conn raw, const TLSConfig& config,
+                        const base::Options& opts) {
+  event::Task task;
+  tls_server(&task, out, std::move(raw), config, opts);
+  event::wait(io::get_manager(opts), &task);
+  return task.result();
+}
+
+base::Result tls_state(TLSConnState* out, const Conn& conn) {
+  CHECK_NOTNULL(out);
+  const auto* impl =
+      dynamic_cast<const TLSConnImpl*>(conn.implementation().get());
+  if (!impl) return base::Result::invalid_argument("not a TLS connection");
+  const auto& state = impl->state();
+  out->cipher_suite = state.suite->id;
+  out->server_name = state.server_name;
+  out->ktls_tx = state.ktls_tx;
+  return base::Result();
+}
+
+}  // namespace net
@@ -0,0 +1,96 @@
+// net/tls.h - TLS 1.3 connections
+// Copyright © 2017 by Donald King <chronos@chronos-tachyon.net>
+// Available under the MIT License. See LICENSE for details.
+
+#ifndef NET_TLS_H
+#define NET_TLS_H
+
+#include <cstdint>
+#include <string>
+
+#include "base/options.h"
+#include "base/result.h"
+#include "event/task.h"
+#include "net/conn.h"
+
+namespace net {
+
+// TLS 1.3 cipher suites implemented by this package.
+enum class TLSCipherSuite : uint16_t {
+  aes_128_gcm_sha256 = 0x1301,
+  aes_256_gcm_sha384 = 0x1302,
+};
+
+// TLSConfig configures one end of a TLS connection.
+//
+// Peers authenticate each other with an external pre-shared key, in the
+// "psk_ke" mode of RFC 8446.  Certificates are not supported.
+//
+struct TLSConfig {
+  // The pre-shared key, and the identity under which the peers know it.
+  std::string psk;
+  std::string psk_identity;
+
+  // The cipher suite to use.  The PSK is used with the suite's hash.
+  TLSCipherSuite cipher_suite;
+
+  // For clients, the name to send in the server_name extension.
+  // - If empty, no server_name is sent
+  std::string server_name;
+
+  // If true, the keys for sending are handed to the kernel's TLS ULP once
+  // the handshake completes, so that sendfile(2) and splice(2) into the
+  // connection keep working.  Falls back to userspace if the kernel can't.
+  // - The kernel's keys can't be updated, so if the peer requests a
+  //   KeyUpdate then the connection fails with an internal_error alert
+  bool ktls;
+
+  TLSConfig() : cipher_suite(TLSCipherSuite::aes_128_gcm_sha256),
+                ktls(true) {}
+};
+
+// TLSConnState describes an established TLS connection.
+struct TLSConnState {
+  // The cipher suite in use.
+  TLSCipherSuite cipher_suite;
+
+  // The name from the client's server_name extension, if any.
+  std::string server_name;
+
+  // True iff the kernel is encrypting outgoing records.
+  bool ktls_tx;
+
+  TLSConnState() noexcept : cipher_suite(TLSCipherSuite::aes_128_gcm_sha256),
+                            ktls_tx(false) {}
+};
+
+// Performs the client side of a TLS handshake over |raw|.  On success,
+// |*out| is a Conn whose reader and writer carry the application data, and
+// which takes over |raw|.  On failure, |raw| is left for the caller to close.
+// - Returns UNAUTHENTICATED if the peers don't share the PSK
+// - Returns FAILED_PRECONDITION if the server wants something unsupported,
+//   such as certificates or a key exchange
+// - Returns DATA_LOSS if the server sends a malformed or forged message
+void tls_client(event::Task* task, Conn* out, Conn raw,
+                const TLSConfig& config,
+                const base::Options& opts = base::default_options());
+
+// Performs the server side of a TLS handshake over |raw|.  Error codes are
+// as for |tls_client()|.
+void tls_server(event::Task* task, Conn* out, Conn raw,
+                const TLSConfig& config,
+                const base::Options& opts = base::default_options());
+
+// Synchronous versions of the above.
+base::Result tls_client(Conn* out, Conn raw, const TLSConfig& config,
+                        const base::Options& opts = base::default_options());
+base::Result tls_server(Conn* out, Conn raw, const TLSConfig& config,
+                        const base::Options& opts = base::default_options());
+
+// Describes |conn|, which MUST have been returned by |tls_client()| or
+// |tls_server()|.  Returns INVALID_ARGUMENT if it wasn't.
+base::Result tls_state(TLSConnState* out, const Conn& conn);
+
+}  // namespace net
+
+#endif  // NET_TLS_H
@@ -0,0 +1,140 @@
+// Copyright © 2017 by Donald King <chronos@chronos-tachyon.net>
+// Available under the MIT License. See LICENSE for details.
+
+#include "gtest/gtest.h"
+
+#include <sys/socket.h>
+
+#include <string>
+
+#include "base/fd.h"
+#include "base/result_testing.h"
+#include "event/manager.h"
+#include "event/task.h"
+#include "io/options.h"
+#include "net/connfd.h"
+#include "net/tls.h"
+#include "net/unix.h"
+
+static void make_pair(net::Conn* a, net::Conn* b) {
+  base::SocketPair s;
+  ASSERT_OK(base::make_socketpair(&s, AF_UNIX, SOCK_STREAM, 0));
+  auto addr = net::unixaddr(net::ProtocolType::stream, "");
+  ASSERT_OK(net::fdconn(a, addr, addr, s.left));
+  ASSERT_OK(net::fdconn(b, addr, addr, s.right));
+}
+
+static net::TLSConfig make_config(net::TLSCipherSuite suite) {
+  net::TLSConfig config;
+  config.psk = std::string(32, '\x42');
+  config.psk_identity = "mojo";
+  config.cipher_suite = suite;
+  return config;
+}
+
+// Runs both ends of a handshake to completion.
+static void handshake(net::Conn* client, net::Conn* server,
+                      base::Result* client_result, base::Result* server_result,
+                      const net::TLSConfig& client_config,
+                      const net::TLSConfig& server_config) {
+  net::Conn a, b;
+  make_pair(&a, &b);
+
+  auto m = io::get_manager(base::default_options());
+  event::Task st, ct;
+  net::tls_server(&st, server, b, server_config);
+  net::tls_client(&ct, client, a, client_config);
+  event::wait_all({m}, {&st, &ct});
+  *client_result = ct.result();
+  *server_result = st.result();
+  if (!*client_result) {
+    EXPECT_OK(a.close());
+  }
+  if (!*server_result) {
+    EXPECT_OK(b.close());
+  }
+}
+
+static void roundtrip(net::TLSCipherSuite suite) {
+  auto config = make_config(suite);
+  auto client_config = config;
+  client_config.server_name = "example.com";
+
+  net::Conn c, s;
+  base::Result cr, sr;
+  handshake(&c, &s, &cr, &sr, client_config, config);
+  ASSERT_OK(cr);
+  ASSERT_OK(sr);
+
+  net::TLSConnState state;
+  EXPECT_OK(net::tls_state(&state, s));
+  EXPECT_EQ(suite, state.cipher_suite);
+  EXPECT_EQ("example.com", state.server_name);
+  EXPECT_OK(net::tls_state(&state, c));
+  EXPECT_EQ("", state.server_name);
+
+  // Large enough to span several records.
+  std::string big;
+  for (std::size_t i = 0; i < 40000; ++i) big.push_back(char('a' + i % 26));
+
+  std::size_t n;
+  EXPECT_OK(c.writer().write(&n, "Hello, world!"));
+  EXPECT_EQ(13U, n);
+  EXPECT_OK(c.writer().write(&n, big));
+  EXPECT_EQ(big.size(), n);
+
+  std::string got;
+  EXPECT_OK(s.reader().read(&got, 13, 13));
+  EXPECT_EQ("Hello, world!", got);
+  EXPECT_OK(s.reader().read(&got, big.size(), big.size()));
+  EXPECT_EQ(big, got);
+
+  EXPECT_OK(s.writer().write(&n, "pong"));
+  EXPECT_OK(c.reader().read(&got, 4, 4));
+  EXPECT_EQ("pong", got);
+
+  // close_notify shows up as EOF, in each direction.
+  EXPECT_OK(s.writer().close());
+  EXPECT_EOF(c.reader().read(&got, 1, 16));
+  EXPECT_OK(c.close());
+  EXPECT_EOF(s.reader().read(&got, 1, 16));
+  EXPECT_OK(s.close());
+}
+
+TEST(TLS, AES128) { roundtrip(net::TLSCipherSuite::aes_128_gcm_sha256); }
+
+TEST(TLS, AES256) { roundtrip(net::TLSCipherSuite::aes_256_gcm_sha384); }
+
+TEST(TLS, WrongPSK) {
+  auto config = make_config(net::TLSCipherSuite::aes_128_gcm_sha256);
+  auto client_config = config;
+  client_config.psk[0] = 'X';
+
+  net::Conn c, s;
+  base::Result cr, sr;
+  handshake(&c, &s, &cr, &sr, client_config, config);
+  EXPECT_EQ(base::ResultCode::UNAUTHENTICATED, sr.code());
+  EXPECT_EQ(base::ResultCode::UNAUTHENTICATED, cr.code());
+}
+
+TEST(TLS, WrongSuite) {
+  auto config = make_config(net::TLSCipherSuite::aes_128_gcm_sha256);
+  auto client_config =
+      make_config(net::TLSCipherSuite::aes_256_gcm_sha384);
+
+  net::Conn c, s;
+  base::Result cr, sr;
+  handshake(&c, &s, &cr, &sr, client_config, config);
+  EXPECT_EQ(base::ResultCode::FAILED_PRECONDITION, sr.code());
+  EXPECT_EQ(base::ResultCode::FAILED_PRECONDITION, cr.code());
+}
+
+TEST(TLS, NotTLS) {
+  net::Conn a, b;
+  make_pair(&a, &b);
+  net::TLSConnState state;
+  EXPECT_EQ(base::ResultCode::INVALID_ARGUMENT,
+            net::tls_state(&state, a).code());
+  EXPECT_OK(a.close());
+  EXPECT_OK(b.close());
+}